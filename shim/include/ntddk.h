@@ -0,0 +1,771 @@
+#pragma once
+
+//
+// Host shim for the subset of <ntddk.h> used by the driver modules
+//
+// Only compiled when the WDK is absent (see CMakeLists.txt). Layouts follow
+// x64 Windows so structures returned by the simulated system calls match
+// what the modules expect. The shim requires -fshort-wchar: WCHAR must be
+// 16 bits and L"" literals must produce UTF-16 arrays.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static_assert(sizeof(wchar_t) == 2, "the kernel shim must be built with -fshort-wchar");
+static_assert(sizeof(void*) == 8, "the kernel shim models x64 Windows");
+
+// ========== Annotations / calling conventions ==========
+
+#define _In_
+#define _In_opt_
+#define _Inout_
+#define _Out_
+#define _Out_opt_
+#define _Outptr_
+#define _In_reads_(n)
+#define _In_reads_bytes_(n)
+#define _Out_writes_(n)
+#define _Out_writes_bytes_(n)
+
+#define NTAPI
+#define NTKERNELAPI
+#define __fastcall
+#define __stdcall
+#define __cdecl
+#define __forceinline inline __attribute__((always_inline))
+#define DECLSPEC_CACHEALIGN alignas(64)
+#define SYSTEM_CACHE_ALIGNMENT_SIZE 64
+
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+#define RTL_NUMBER_OF(A)          (sizeof(A) / sizeof((A)[0]))
+#define ARRAYSIZE(A)              RTL_NUMBER_OF(A)
+#define FIELD_OFFSET(type, field) ((LONG)offsetof(type, field))
+#define C_ASSERT(e)               static_assert(e, #e)
+#define UNALIGNED
+
+// Functions rather than the WDK macros, so they survive the C++ standard headers
+template <typename A, typename B>
+inline auto min(A a, B b) -> decltype(a + b) { return a < b ? a : b; }
+template <typename A, typename B>
+inline auto max(A a, B b) -> decltype(a + b) { return a > b ? a : b; }
+
+// SEH does not exist on the host: the guarded block simply runs.
+// libstdc++ defines its own __try; driver sources include no C++ headers.
+#undef  __try
+#define __try                       if (1)
+#define __except(filter)            else if (0)
+#define __finally
+#define GetExceptionCode()          ((NTSTATUS)0)
+#define EXCEPTION_EXECUTE_HANDLER   1
+
+// ========== Base types ==========
+
+typedef void                VOID, *PVOID;
+typedef const void*         PCVOID;
+typedef char                CHAR, *PCHAR;
+typedef const char*         PCSTR;
+typedef int16_t             SHORT;
+typedef int32_t             LONG, *PLONG;
+typedef int64_t             LONGLONG, *PLONGLONG, LONG64, *PLONG64;
+typedef uint8_t             UCHAR, *PUCHAR, BYTE;
+typedef uint16_t            USHORT, *PUSHORT;
+typedef uint32_t            ULONG, *PULONG, DWORD;
+typedef uint64_t            ULONGLONG, ULONG64, *PULONG64, DWORD64;
+typedef uintptr_t           ULONG_PTR, *PULONG_PTR;
+typedef intptr_t            LONG_PTR;
+typedef size_t              SIZE_T, *PSIZE_T;
+typedef UCHAR               BOOLEAN, *PBOOLEAN;
+typedef wchar_t             WCHAR, *PWCHAR, *PWCH, *PWSTR;
+typedef const wchar_t*      PCWSTR;
+typedef int32_t             NTSTATUS;
+typedef void*               HANDLE, **PHANDLE;
+typedef ULONG               ACCESS_MASK;
+typedef LONG                KPRIORITY;
+typedef UCHAR               KIRQL, *PKIRQL;
+typedef CHAR                KPROCESSOR_MODE;
+typedef ULONG64             POOL_FLAGS;
+typedef ULONG               LOGICAL;
+
+#define TRUE    1
+#define FALSE   0
+#ifndef NULL
+#define NULL    0
+#endif
+#define MAXULONG    0xFFFFFFFFUL
+#define MAXLONG     0x7FFFFFFFL
+#define MAXUSHORT   0xFFFF
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG  HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH   Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY* Flink;
+    struct _LIST_ENTRY* Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+#define CONTAINING_RECORD(address, type, field) \
+    ((type*)((PUCHAR)(address) - offsetof(type, field)))
+
+inline VOID InitializeListHead(PLIST_ENTRY ListHead)
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+inline BOOLEAN IsListEmpty(const LIST_ENTRY* ListHead)
+{
+    return ListHead->Flink == ListHead;
+}
+
+inline BOOLEAN RemoveEntryList(PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY next = Entry->Flink;
+    PLIST_ENTRY prev = Entry->Blink;
+    prev->Flink = next;
+    next->Blink = prev;
+    return next == prev;
+}
+
+inline PLIST_ENTRY RemoveHeadList(PLIST_ENTRY ListHead)
+{
+    PLIST_ENTRY entry = ListHead->Flink;
+    RemoveEntryList(entry);
+    return entry;
+}
+
+inline VOID InsertTailList(PLIST_ENTRY ListHead, PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY last = ListHead->Blink;
+    Entry->Flink = ListHead;
+    Entry->Blink = last;
+    last->Flink  = Entry;
+    ListHead->Blink = Entry;
+}
+
+// ========== Status codes ==========
+
+#define NT_SUCCESS(Status)                  (((NTSTATUS)(Status)) >= 0)
+#define NT_ERROR(Status)                    ((((ULONG)(Status)) >> 30) == 3)
+
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_WAIT_0                       ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                      ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                      ((NTSTATUS)0x00000103L)
+#define STATUS_BUFFER_OVERFLOW              ((NTSTATUS)0x80000005L)
+#define STATUS_NO_MORE_ENTRIES              ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED              ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_INFO_CLASS           ((NTSTATUS)0xC0000003L)
+#define STATUS_INFO_LENGTH_MISMATCH         ((NTSTATUS)0xC0000004L)
+#define STATUS_INVALID_HANDLE               ((NTSTATUS)0xC0000008L)
+#define STATUS_INVALID_CID                  ((NTSTATUS)0xC000000BL)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_INVALID_DEVICE_REQUEST       ((NTSTATUS)0xC0000010L)
+#define STATUS_QUOTA_EXCEEDED               ((NTSTATUS)0xC0000044L)
+#define STATUS_END_OF_FILE                  ((NTSTATUS)0xC0000011L)
+#define STATUS_INVALID_DEVICE_STATE         ((NTSTATUS)0xC0000184L)
+#define STATUS_NO_MEMORY                    ((NTSTATUS)0xC0000017L)
+#define STATUS_ACCESS_DENIED                ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND        ((NTSTATUS)0xC0000034L)
+#define STATUS_OBJECT_NAME_COLLISION        ((NTSTATUS)0xC0000035L)
+#define STATUS_OBJECT_TYPE_MISMATCH         ((NTSTATUS)0xC0000024L)
+#define STATUS_PROCEDURE_NOT_FOUND          ((NTSTATUS)0xC000007AL)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_DEVICE_NOT_READY             ((NTSTATUS)0xC00000A3L)
+#define STATUS_NOT_SUPPORTED                ((NTSTATUS)0xC00000BBL)
+#define STATUS_PROCESS_IS_TERMINATING       ((NTSTATUS)0xC000010AL)
+#define STATUS_CANCELLED                    ((NTSTATUS)0xC0000120L)
+#define STATUS_NOT_FOUND                    ((NTSTATUS)0xC0000225L)
+#define STATUS_INTEGER_OVERFLOW             ((NTSTATUS)0xC0000095L)
+#define STATUS_NOT_MAPPED_VIEW              ((NTSTATUS)0xC0000019L)
+#define STATUS_INVALID_PAGE_PROTECTION      ((NTSTATUS)0xC0000045L)
+
+// ========== Access rights / object attributes ==========
+
+#define DELETE                      0x00010000L
+#define SYNCHRONIZE                 0x00100000L
+#define GENERIC_READ                0x80000000L
+#define GENERIC_WRITE               0x40000000L
+#define GENERIC_ALL                 0x10000000L
+#define PROCESS_ALL_ACCESS          0x001FFFFFL
+#define THREAD_ALL_ACCESS           0x001FFFFFL
+
+#define OBJ_CASE_INSENSITIVE        0x00000040L
+#define OBJ_KERNEL_HANDLE           0x00000200L
+
+typedef struct _OBJECT_ATTRIBUTES {
+    ULONG           Length;
+    HANDLE          RootDirectory;
+    PUNICODE_STRING ObjectName;
+    ULONG           Attributes;
+    PVOID           SecurityDescriptor;
+    PVOID           SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
+
+#define InitializeObjectAttributes(p, n, a, r, s) {     \
+    (p)->Length = sizeof(OBJECT_ATTRIBUTES);            \
+    (p)->RootDirectory = (r);                           \
+    (p)->Attributes = (a);                              \
+    (p)->ObjectName = (n);                              \
+    (p)->SecurityDescriptor = (s);                      \
+    (p)->SecurityQualityOfService = NULL;               \
+}
+
+typedef struct _CLIENT_ID {
+    HANDLE UniqueProcess;
+    HANDLE UniqueThread;
+} CLIENT_ID, *PCLIENT_ID;
+
+typedef struct _OBJECT_NAME_INFORMATION {
+    UNICODE_STRING Name;
+} OBJECT_NAME_INFORMATION, *POBJECT_NAME_INFORMATION;
+
+// ========== Files ==========
+
+typedef struct _IO_STATUS_BLOCK {
+    union {
+        NTSTATUS Status;
+        PVOID    Pointer;
+    };
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef enum _FILE_INFORMATION_CLASS {
+    FileBasicInformation            = 4,
+    FileStandardInformation         = 5,
+    FileDispositionInformation      = 13,
+    FileDispositionInformationEx    = 64
+} FILE_INFORMATION_CLASS;
+
+typedef struct _FILE_DISPOSITION_INFORMATION {
+    BOOLEAN DeleteFile;
+} FILE_DISPOSITION_INFORMATION;
+
+typedef struct _FILE_DISPOSITION_INFORMATION_EX {
+    ULONG Flags;
+} FILE_DISPOSITION_INFORMATION_EX;
+
+typedef struct _FILE_STANDARD_INFORMATION {
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    ULONG         NumberOfLinks;
+    BOOLEAN       DeletePending;
+    BOOLEAN       Directory;
+} FILE_STANDARD_INFORMATION;
+
+#define FILE_ATTRIBUTE_NORMAL               0x00000080
+#define FILE_SHARE_READ                     0x00000001
+#define FILE_SHARE_WRITE                    0x00000002
+#define FILE_SHARE_DELETE                   0x00000004
+#define FILE_OPEN                           0x00000001
+#define FILE_OVERWRITE_IF                   0x00000005
+#define FILE_NON_DIRECTORY_FILE             0x00000040
+#define FILE_SYNCHRONOUS_IO_NONALERT        0x00000020
+
+// ========== Pool ==========
+
+#define POOL_FLAG_UNINITIALIZED     0x0000000000000002ULL
+#define POOL_FLAG_NON_PAGED         0x0000000000000040ULL
+#define POOL_FLAG_PAGED             0x0000000000000100ULL
+
+// ========== IRQL / spinlocks / processors ==========
+
+#define PASSIVE_LEVEL   0
+#define APC_LEVEL       1
+#define DISPATCH_LEVEL  2
+
+typedef ULONG_PTR KSPIN_LOCK, *PKSPIN_LOCK;
+
+#define ALL_PROCESSOR_GROUPS    0xFFFF
+
+// ========== Interlocked ==========
+//
+// Compiler builtins with the semantics of the WDK intrinsics: full barrier
+// unless the name says NoFence.
+//
+
+inline LONG   InterlockedIncrement(LONG volatile* Addend)            { return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST); }
+inline LONG   InterlockedDecrement(LONG volatile* Addend)            { return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST); }
+inline LONG   InterlockedExchange(LONG volatile* Target, LONG Value)  { return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST); }
+inline LONG   InterlockedCompareExchange(LONG volatile* Destination, LONG Exchange, LONG Comparand)
+{
+    __atomic_compare_exchange_n(Destination, &Comparand, Exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+inline LONG64 InterlockedIncrement64(LONG64 volatile* Addend)        { return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST); }
+inline LONG64 InterlockedIncrementNoFence64(LONG64 volatile* Addend) { return __atomic_add_fetch(Addend, 1, __ATOMIC_RELAXED); }
+inline LONG64 InterlockedAddNoFence64(LONG64 volatile* Addend, LONG64 Value) { return __atomic_add_fetch(Addend, Value, __ATOMIC_RELAXED); }
+inline LONG64 InterlockedExchangeAdd64(LONG64 volatile* Addend, LONG64 Value) { return __atomic_fetch_add(Addend, Value, __ATOMIC_SEQ_CST); }
+inline PVOID  InterlockedExchangePointer(PVOID volatile* Target, PVOID Value) { return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST); }
+inline PVOID  InterlockedCompareExchangePointer(PVOID volatile* Destination, PVOID Exchange, PVOID Comparand)
+{
+    __atomic_compare_exchange_n(Destination, &Comparand, Exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+inline LONG   ReadNoFence(LONG const volatile* Source)               { return __atomic_load_n(Source, __ATOMIC_RELAXED); }
+inline BOOLEAN ReadBooleanNoFence(BOOLEAN const volatile* Source)    { return __atomic_load_n(Source, __ATOMIC_RELAXED); }
+inline LONG64 ReadNoFence64(LONG64 const volatile* Source)           { return __atomic_load_n(Source, __ATOMIC_RELAXED); }
+inline LONG64 InterlockedCompareExchange64(LONG64 volatile* Destination, LONG64 Exchange, LONG64 Comparand)
+{
+    __atomic_compare_exchange_n(Destination, &Comparand, Exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+inline LONG   ReadAcquire(LONG const volatile* Source)               { return __atomic_load_n(Source, __ATOMIC_ACQUIRE); }
+inline LONG64 ReadAcquire64(LONG64 const volatile* Source)           { return __atomic_load_n(Source, __ATOMIC_ACQUIRE); }
+inline PVOID  ReadPointerAcquire(PVOID const volatile* Source)       { return __atomic_load_n(Source, __ATOMIC_ACQUIRE); }
+inline PVOID  ReadPointerNoFence(PVOID const volatile* Source)       { return __atomic_load_n(Source, __ATOMIC_RELAXED); }
+inline VOID   WriteRelease(LONG volatile* Destination, LONG Value)   { __atomic_store_n(Destination, Value, __ATOMIC_RELEASE); }
+inline VOID   WriteRelease64(LONG64 volatile* Destination, LONG64 Value) { __atomic_store_n(Destination, Value, __ATOMIC_RELEASE); }
+inline VOID   WritePointerRelease(PVOID volatile* Destination, PVOID Value) { __atomic_store_n(Destination, Value, __ATOMIC_RELEASE); }
+inline VOID   MemoryBarrier(VOID)                                   { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+inline VOID   KeMemoryBarrier(VOID)                                 { MemoryBarrier(); }
+inline VOID   YieldProcessor(VOID)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+inline BOOLEAN _BitScanReverse64(ULONG* Index, ULONG64 Mask)
+{
+    if (!Mask) return FALSE;
+    *Index = 63 - (ULONG)__builtin_clzll(Mask);
+    return TRUE;
+}
+
+typedef struct _KAPC_STATE {
+    PVOID Process;
+    UCHAR Reserved[40];
+} KAPC_STATE, *PKAPC_STATE, *PRKAPC_STATE;
+
+// ========== Kernel objects ==========
+//
+// Opaque on the host as in the WDK; the shim defines them internally.
+//
+
+typedef struct _KPROCESS* PKPROCESS, *PRKPROCESS, *PEPROCESS;
+typedef struct _KTHREAD*  PKTHREAD, *PRKTHREAD, *PETHREAD;
+typedef struct _OBJECT_TYPE*  POBJECT_TYPE;
+typedef struct _ACCESS_STATE* PACCESS_STATE;
+
+// ========== Dispatcher objects ==========
+//
+// Events, semaphores and the shim's thread objects all start with the
+// dispatcher type, so KeWaitForSingleObject can tell them apart.
+//
+
+typedef struct _DISPATCHER_HEADER {
+    LONG Type;
+    LONG SignalState;
+} DISPATCHER_HEADER;
+
+typedef struct _KEVENT {
+    DISPATCHER_HEADER Header;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+typedef struct _KSEMAPHORE {
+    DISPATCHER_HEADER Header;
+    LONG Limit;
+} KSEMAPHORE, *PKSEMAPHORE, *PRKSEMAPHORE;
+
+typedef enum _EVENT_TYPE {
+    NotificationEvent,
+    SynchronizationEvent
+} EVENT_TYPE;
+
+typedef enum _KWAIT_REASON {
+    Executive   = 0,
+    UserRequest = 6
+} KWAIT_REASON;
+
+typedef VOID (*PKSTART_ROUTINE)(PVOID StartContext);
+
+// ========== Rundown protection ==========
+//
+// Count of active references in units of 2; bit 0 set once a wait for
+// rundown has begun, after which acquisition fails.
+//
+
+typedef struct _EX_RUNDOWN_REF {
+    volatile LONG64 Count;
+} EX_RUNDOWN_REF, *PEX_RUNDOWN_REF;
+
+// ========== Executive resources ==========
+//
+// Shared holders counted in units of 4; bit 0 set while held exclusive,
+// bit 1 while an exclusive acquirer waits, which holds off new sharers.
+// As on Windows, callers must be inside a critical region.
+//
+
+typedef struct _ERESOURCE {
+    volatile LONG64 State;
+} ERESOURCE, *PERESOURCE;
+
+// ========== Sections ==========
+
+#define SECTION_QUERY               0x0001
+#define SECTION_MAP_WRITE           0x0002
+#define SECTION_MAP_READ            0x0004
+#define SECTION_ALL_ACCESS          0x000F001F
+
+#define SEC_COMMIT                  0x08000000
+#define SEC_NO_CHANGE               0x00400000
+
+#define PAGE_READONLY               0x02
+#define PAGE_READWRITE              0x04
+
+typedef enum _SECTION_INHERIT {
+    ViewShare = 1,
+    ViewUnmap = 2
+} SECTION_INHERIT;
+
+#define NtCurrentProcess()          ((HANDLE)(LONG_PTR)-1)
+#define ZwCurrentProcess()          NtCurrentProcess()
+
+// ========== Notify routines ==========
+
+typedef struct _PS_CREATE_NOTIFY_INFO {
+    SIZE_T           Size;
+    ULONG            Flags;
+    HANDLE           ParentProcessId;
+    CLIENT_ID        CreatingThreadId;
+    struct _FILE_OBJECT* FileObject;
+    PCUNICODE_STRING ImageFileName;
+    PCUNICODE_STRING CommandLine;
+    NTSTATUS         CreationStatus;
+} PS_CREATE_NOTIFY_INFO, *PPS_CREATE_NOTIFY_INFO;
+
+typedef struct _IMAGE_INFO {
+    union {
+        ULONG Properties;
+        struct {
+            ULONG ImageAddressingMode  : 8;
+            ULONG SystemModeImage      : 1;
+            ULONG ImageMappedToAllViews : 1;
+            ULONG ExtendedInfoPresent  : 1;
+            ULONG Reserved             : 21;
+        };
+    };
+    PVOID  ImageBase;
+    ULONG  ImageSelector;
+    SIZE_T ImageSize;
+    ULONG  ImageSectionNumber;
+} IMAGE_INFO, *PIMAGE_INFO;
+
+typedef VOID (*PCREATE_PROCESS_NOTIFY_ROUTINE_EX)(PEPROCESS Process, HANDLE ProcessId,
+    PPS_CREATE_NOTIFY_INFO CreateInfo);
+typedef VOID (*PCREATE_THREAD_NOTIFY_ROUTINE)(HANDLE ProcessId, HANDLE ThreadId, BOOLEAN Create);
+typedef VOID (*PLOAD_IMAGE_NOTIFY_ROUTINE)(PUNICODE_STRING FullImageName, HANDLE ProcessId,
+    PIMAGE_INFO ImageInfo);
+
+// ========== I/O manager ==========
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((ULONG)(DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#define METHOD_BUFFERED     0
+#define METHOD_IN_DIRECT    1
+#define METHOD_OUT_DIRECT   2
+#define METHOD_NEITHER      3
+
+#define FILE_ANY_ACCESS     0
+#define FILE_READ_ACCESS    0x0001
+#define FILE_WRITE_ACCESS   0x0002
+
+#define FILE_DEVICE_UNKNOWN         0x00000022
+#define FILE_DEVICE_SECURE_OPEN     0x00000100
+
+#define DO_BUFFERED_IO              0x00000004
+#define DO_DIRECT_IO                0x00000010
+#define DO_DEVICE_INITIALIZING      0x00000080
+
+#define IRP_MJ_CREATE               0x00
+#define IRP_MJ_CLOSE                0x02
+#define IRP_MJ_READ                 0x03
+#define IRP_MJ_DEVICE_CONTROL       0x0e
+#define IRP_MJ_CLEANUP              0x12
+#define IRP_MJ_MAXIMUM_FUNCTION     0x1b
+
+#define IO_NO_INCREMENT             0
+
+#define KernelMode  0
+#define UserMode    1
+
+typedef struct _MDL {
+    struct _MDL* Next;
+    SHORT        Size;
+    SHORT        MdlFlags;
+    PVOID        MappedSystemVa;
+    PVOID        StartVa;
+    ULONG        ByteCount;
+    ULONG        ByteOffset;
+} MDL, *PMDL;
+
+#define MmGetMdlByteCount(Mdl)  ((Mdl)->ByteCount)
+
+typedef enum _MM_PAGE_PRIORITY {
+    LowPagePriority     = 0,
+    NormalPagePriority  = 16,
+    HighPagePriority    = 32,
+} MM_PAGE_PRIORITY;
+
+#define MdlMappingNoExecute     0x40000000
+
+typedef struct _FILE_OBJECT {
+    SHORT  Type;
+    SHORT  Size;
+    struct _DEVICE_OBJECT* DeviceObject;
+    PVOID  FsContext;
+    PVOID  FsContext2;
+    ULONG  Flags;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+#define FO_SYNCHRONOUS_IO           0x00000002
+
+typedef struct _IO_STACK_LOCATION {
+    UCHAR MajorFunction;
+    UCHAR MinorFunction;
+    UCHAR Flags;
+    UCHAR Control;
+    union {
+        struct {
+            ULONG         Length;
+            ULONG         Key;
+            LARGE_INTEGER ByteOffset;
+        } Read;
+        struct {
+            ULONG OutputBufferLength;
+            ULONG InputBufferLength;
+            ULONG IoControlCode;
+            PVOID Type3InputBuffer;
+        } DeviceIoControl;
+    } Parameters;
+    struct _DEVICE_OBJECT* DeviceObject;
+    PFILE_OBJECT FileObject;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP* PIRP;
+typedef VOID (*PDRIVER_CANCEL)(struct _DEVICE_OBJECT* DeviceObject, PIRP Irp);
+
+typedef struct _IRP {
+    SHORT Type;
+    USHORT Size;
+    PMDL MdlAddress;
+    ULONG Flags;
+    union {
+        PVOID SystemBuffer;
+    } AssociatedIrp;
+    IO_STATUS_BLOCK IoStatus;
+    KPROCESSOR_MODE RequestorMode;
+    BOOLEAN PendingReturned;
+    BOOLEAN Cancel;
+    KIRQL CancelIrql;
+    PDRIVER_CANCEL CancelRoutine;
+    PIO_STATUS_BLOCK UserIosb;
+    PVOID UserBuffer;
+    union {
+        struct {
+            PVOID DriverContext[4];
+            LIST_ENTRY ListEntry;
+            PIO_STACK_LOCATION CurrentStackLocation;
+        } Overlay;
+    } Tail;
+} IRP;
+
+typedef struct _DEVICE_OBJECT {
+    SHORT Type;
+    USHORT Size;
+    struct _DRIVER_OBJECT* DriverObject;
+    ULONG Flags;
+    ULONG Characteristics;
+    PVOID DeviceExtension;
+    ULONG DeviceType;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef NTSTATUS (*PDRIVER_DISPATCH)(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+typedef VOID (*PDRIVER_UNLOAD)(struct _DRIVER_OBJECT* DriverObject);
+
+typedef struct _DRIVER_OBJECT {
+    SHORT Type;
+    SHORT Size;
+    PDEVICE_OBJECT DeviceObject;
+    UNICODE_STRING DriverName;
+    PDRIVER_UNLOAD DriverUnload;
+    PDRIVER_DISPATCH MajorFunction[IRP_MJ_MAXIMUM_FUNCTION + 1];
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+__forceinline PIO_STACK_LOCATION IoGetCurrentIrpStackLocation(PIRP Irp)
+{
+    return Irp->Tail.Overlay.CurrentStackLocation;
+}
+
+#define SL_PENDING_RETURNED         0x01
+
+__forceinline VOID IoMarkIrpPending(PIRP Irp)
+{
+    IoGetCurrentIrpStackLocation(Irp)->Control |= SL_PENDING_RETURNED;
+}
+
+__forceinline PDRIVER_CANCEL IoSetCancelRoutine(PIRP Irp, PDRIVER_CANCEL CancelRoutine)
+{
+    return (PDRIVER_CANCEL)InterlockedExchangePointer(
+        (PVOID volatile*)&Irp->CancelRoutine, (PVOID)CancelRoutine);
+}
+
+// ========== Rtl helpers ==========
+
+#define RtlCopyMemory(Destination, Source, Length)  memcpy((Destination), (Source), (Length))
+#define RtlMoveMemory(Destination, Source, Length)  memmove((Destination), (Source), (Length))
+#define RtlZeroMemory(Destination, Length)          memset((Destination), 0, (Length))
+#define RtlFillMemory(Destination, Length, Fill)    memset((Destination), (Fill), (Length))
+
+// ========== Kernel API (implemented by the shim) ==========
+
+extern "C" {
+
+ULONG DbgPrint(PCSTR Format, ...);
+
+VOID   RtlInitUnicodeString(PUNICODE_STRING DestinationString, PCWSTR SourceString);
+BOOLEAN RtlEqualUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive);
+SIZE_T RtlCompareMemory(const VOID* Source1, const VOID* Source2, SIZE_T Length);
+
+PVOID ExAllocatePool2(POOL_FLAGS Flags, SIZE_T NumberOfBytes, ULONG Tag);
+VOID  ExFreePoolWithTag(PVOID P, ULONG Tag);
+VOID  ExFreePool(PVOID P);
+
+KIRQL KeGetCurrentIrql(VOID);
+VOID  KeEnterCriticalRegion(VOID);
+VOID  KeLeaveCriticalRegion(VOID);
+VOID  KeRaiseIrql(KIRQL NewIrql, PKIRQL OldIrql);
+VOID  KeLowerIrql(KIRQL NewIrql);
+VOID  KeInitializeSpinLock(PKSPIN_LOCK SpinLock);
+KIRQL KeAcquireSpinLockRaiseToDpc(PKSPIN_LOCK SpinLock);
+VOID  KeReleaseSpinLock(PKSPIN_LOCK SpinLock, KIRQL NewIrql);
+VOID  KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock);
+VOID  KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK SpinLock);
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency);
+VOID  KeQuerySystemTimePrecise(PLARGE_INTEGER CurrentTime);
+ULONGLONG KeQueryInterruptTime(VOID);
+ULONG KeGetCurrentProcessorNumberEx(PVOID ProcNumber);
+ULONG KeQueryActiveProcessorCountEx(USHORT GroupNumber);
+ULONG KeQueryMaximumProcessorCountEx(USHORT GroupNumber);
+KPRIORITY KeQueryPriorityThread(PKTHREAD Thread);
+
+VOID     KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State);
+LONG     KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait);
+VOID     KeClearEvent(PRKEVENT Event);
+VOID     KeInitializeSemaphore(PRKSEMAPHORE Semaphore, LONG Count, LONG Limit);
+LONG     KeReleaseSemaphore(PRKSEMAPHORE Semaphore, KPRIORITY Increment, LONG Adjustment, BOOLEAN Wait);
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable, PLARGE_INTEGER Timeout);
+VOID  KeStackAttachProcess(PRKPROCESS Process, PRKAPC_STATE ApcState);
+VOID  KeUnstackDetachProcess(PRKAPC_STATE ApcState);
+
+VOID  ObReferenceObject(PVOID Object);
+VOID  ObDereferenceObject(PVOID Object);
+#define ObfReferenceObject      ObReferenceObject
+#define ObfDereferenceObject    ObDereferenceObject
+NTSTATUS ObQueryNameString(PVOID Object, POBJECT_NAME_INFORMATION ObjectNameInfo,
+    ULONG Length, PULONG ReturnLength);
+NTSTATUS ObOpenObjectByPointer(PVOID Object, ULONG HandleAttributes, PACCESS_STATE PassedAccessState,
+    ACCESS_MASK DesiredAccess, POBJECT_TYPE ObjectType, KPROCESSOR_MODE AccessMode, PHANDLE Handle);
+
+NTSTATUS ObReferenceObjectByHandle(HANDLE Handle, ACCESS_MASK DesiredAccess, POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode, PVOID* Object, PVOID HandleInformation);
+
+extern POBJECT_TYPE* PsProcessType;
+extern POBJECT_TYPE* PsThreadType;
+
+NTSTATUS PsCreateSystemThread(PHANDLE ThreadHandle, ULONG DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes, HANDLE ProcessHandle, PCLIENT_ID ClientId,
+    PKSTART_ROUTINE StartRoutine, PVOID StartContext);
+NTSTATUS PsTerminateSystemThread(NTSTATUS ExitStatus);
+
+VOID     ExInitializeRundownProtection(PEX_RUNDOWN_REF RunRef);
+VOID     ExReInitializeRundownProtection(PEX_RUNDOWN_REF RunRef);
+BOOLEAN  ExAcquireRundownProtection(PEX_RUNDOWN_REF RunRef);
+VOID     ExReleaseRundownProtection(PEX_RUNDOWN_REF RunRef);
+VOID     ExWaitForRundownProtectionRelease(PEX_RUNDOWN_REF RunRef);
+
+NTSTATUS ExInitializeResourceLite(PERESOURCE Resource);
+NTSTATUS ExDeleteResourceLite(PERESOURCE Resource);
+BOOLEAN  ExAcquireResourceSharedLite(PERESOURCE Resource, BOOLEAN Wait);
+BOOLEAN  ExAcquireResourceExclusiveLite(PERESOURCE Resource, BOOLEAN Wait);
+VOID     ExReleaseResourceLite(PERESOURCE Resource);
+
+// Removal waits for routines already running, as on Windows
+NTSTATUS PsSetCreateProcessNotifyRoutineEx(PCREATE_PROCESS_NOTIFY_ROUTINE_EX NotifyRoutine, BOOLEAN Remove);
+NTSTATUS PsSetCreateThreadNotifyRoutine(PCREATE_THREAD_NOTIFY_ROUTINE NotifyRoutine);
+NTSTATUS PsRemoveCreateThreadNotifyRoutine(PCREATE_THREAD_NOTIFY_ROUTINE NotifyRoutine);
+NTSTATUS PsSetLoadImageNotifyRoutine(PLOAD_IMAGE_NOTIFY_ROUTINE NotifyRoutine);
+NTSTATUS PsRemoveLoadImageNotifyRoutine(PLOAD_IMAGE_NOTIFY_ROUTINE NotifyRoutine);
+
+NTSTATUS PsLookupProcessByProcessId(HANDLE ProcessId, PEPROCESS* Process);
+HANDLE   PsGetCurrentProcessId(VOID);
+PEPROCESS PsGetCurrentProcess(VOID);
+HANDLE   PsGetProcessId(PEPROCESS Process);
+HANDLE   PsGetThreadId(PETHREAD Thread);
+BOOLEAN  PsIsThreadTerminating(PETHREAD Thread);
+LONGLONG PsGetProcessCreateTimeQuadPart(PEPROCESS Process);
+ULONG    PsGetProcessSessionId(PEPROCESS Process);
+NTSTATUS PsGetProcessExitStatus(PEPROCESS Process);
+#define IoGetCurrentProcess PsGetCurrentProcess
+
+PVOID MmGetSystemRoutineAddress(PUNICODE_STRING SystemRoutineName);
+PVOID MmGetSystemAddressForMdlSafe(PMDL Mdl, ULONG Priority);
+
+NTSTATUS ZwOpenProcess(PHANDLE ProcessHandle, ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes, PCLIENT_ID ClientId);
+NTSTATUS ZwTerminateProcess(HANDLE ProcessHandle, NTSTATUS ExitStatus);
+NTSTATUS ZwClose(HANDLE Handle);
+
+// Pagefile-backed sections only (FileHandle must be NULL); views can only be
+// mapped into the current process
+extern POBJECT_TYPE* MmSectionObjectType;
+NTSTATUS ZwCreateSection(PHANDLE SectionHandle, ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes, PLARGE_INTEGER MaximumSize, ULONG SectionPageProtection,
+    ULONG AllocationAttributes, HANDLE FileHandle);
+NTSTATUS ZwMapViewOfSection(HANDLE SectionHandle, HANDLE ProcessHandle, PVOID* BaseAddress,
+    ULONG_PTR ZeroBits, SIZE_T CommitSize, PLARGE_INTEGER SectionOffset, PSIZE_T ViewSize,
+    SECTION_INHERIT InheritDisposition, ULONG AllocationType, ULONG Win32Protect);
+NTSTATUS ZwUnmapViewOfSection(HANDLE ProcessHandle, PVOID BaseAddress);
+NTSTATUS MmMapViewInSystemSpace(PVOID Section, PVOID* MappedBase, PSIZE_T ViewSize);
+NTSTATUS MmUnmapViewInSystemSpace(PVOID MappedBase);
+NTSTATUS ZwCreateFile(PHANDLE FileHandle, ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes, PIO_STATUS_BLOCK IoStatusBlock,
+    PLARGE_INTEGER AllocationSize, ULONG FileAttributes, ULONG ShareAccess,
+    ULONG CreateDisposition, ULONG CreateOptions, PVOID EaBuffer, ULONG EaLength);
+NTSTATUS ZwSetInformationFile(HANDLE FileHandle, PIO_STATUS_BLOCK IoStatusBlock,
+    PVOID FileInformation, ULONG Length, FILE_INFORMATION_CLASS FileInformationClass);
+
+NTSTATUS IoCreateDevice(PDRIVER_OBJECT DriverObject, ULONG DeviceExtensionSize,
+    PUNICODE_STRING DeviceName, ULONG DeviceType, ULONG DeviceCharacteristics,
+    BOOLEAN Exclusive, PDEVICE_OBJECT* DeviceObject);
+VOID     IoDeleteDevice(PDEVICE_OBJECT DeviceObject);
+NTSTATUS IoCreateSymbolicLink(PUNICODE_STRING SymbolicLinkName, PUNICODE_STRING DeviceName);
+NTSTATUS IoDeleteSymbolicLink(PUNICODE_STRING SymbolicLinkName);
+VOID     IoCompleteRequest(PIRP Irp, CHAR PriorityBoost);
+BOOLEAN  IoCancelIrp(PIRP Irp);
+VOID     IoAcquireCancelSpinLock(PKIRQL Irql);
+VOID     IoReleaseCancelSpinLock(KIRQL Irql);
+
+} // extern "C"
+
+#define KeAcquireSpinLock(SpinLock, OldIrql) \
+    (*(OldIrql) = KeAcquireSpinLockRaiseToDpc(SpinLock))
@@ -0,0 +1,4 @@
+#pragma once
+
+// Host shim: <ntifs.h> adds nothing beyond <ntddk.h> for the modules built here
+#include "ntddk.h"
@@ -0,0 +1,427 @@
+//
+// Host shim: I/O manager and the driver harness
+//
+
+#include "shim_internal.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+
+// ========== Devices and symbolic links ==========
+
+static std::mutex g_NameLock;
+static std::set<std::u16string> g_SymbolicLinks;
+
+static std::u16string NameOf(PUNICODE_STRING Name)
+{
+    return std::u16string((const char16_t*)Name->Buffer, Name->Length / sizeof(WCHAR));
+}
+
+extern "C" NTSTATUS IoCreateDevice(
+    PDRIVER_OBJECT DriverObject, ULONG DeviceExtensionSize,
+    PUNICODE_STRING DeviceName, ULONG DeviceType, ULONG DeviceCharacteristics,
+    BOOLEAN Exclusive, PDEVICE_OBJECT* DeviceObject)
+{
+    UNREFERENCED_PARAMETER(DeviceName);
+    UNREFERENCED_PARAMETER(Exclusive);
+
+    PDEVICE_OBJECT device = (PDEVICE_OBJECT)calloc(1, sizeof(DEVICE_OBJECT) + DeviceExtensionSize);
+    if (!device) return STATUS_INSUFFICIENT_RESOURCES;
+
+    device->Size            = (USHORT)sizeof(DEVICE_OBJECT);
+    device->DriverObject    = DriverObject;
+    device->Flags           = DO_DEVICE_INITIALIZING;
+    device->Characteristics = DeviceCharacteristics;
+    device->DeviceType      = DeviceType;
+    device->DeviceExtension = DeviceExtensionSize ? (PVOID)(device + 1) : NULL;
+
+    DriverObject->DeviceObject = device;
+    *DeviceObject = device;
+    return STATUS_SUCCESS;
+}
+
+extern "C" VOID IoDeleteDevice(PDEVICE_OBJECT DeviceObject)
+{
+    if (DeviceObject->DriverObject && DeviceObject->DriverObject->DeviceObject == DeviceObject)
+        DeviceObject->DriverObject->DeviceObject = NULL;
+    free(DeviceObject);
+}
+
+extern "C" NTSTATUS IoCreateSymbolicLink(PUNICODE_STRING SymbolicLinkName, PUNICODE_STRING DeviceName)
+{
+    UNREFERENCED_PARAMETER(DeviceName);
+    std::lock_guard<std::mutex> guard(g_NameLock);
+    return g_SymbolicLinks.insert(NameOf(SymbolicLinkName)).second
+        ? STATUS_SUCCESS
+        : STATUS_OBJECT_NAME_COLLISION;
+}
+
+extern "C" NTSTATUS IoDeleteSymbolicLink(PUNICODE_STRING SymbolicLinkName)
+{
+    std::lock_guard<std::mutex> guard(g_NameLock);
+    return g_SymbolicLinks.erase(NameOf(SymbolicLinkName))
+        ? STATUS_SUCCESS
+        : STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+// ========== IRPs ==========
+//
+// Every IRP the harness sends is a SHIM_IRP with a single stack location.
+// Completion is published under g_IrpLock so a pended IRP can be waited
+// for from another thread. The reference the I/O manager holds on the file
+// object for each IRP becomes SHIM_FILE.OutstandingIrps, which
+// ShimCloseDevice drains before sending IRP_MJ_CLOSE.
+//
+
+typedef struct _SHIM_FILE {
+    FILE_OBJECT File;
+    LONG        OutstandingIrps;    // guarded by g_IrpLock
+    BOOLEAN     CleanedUp;          // IRP_MJ_CLEANUP already sent by ShimCleanupDevice
+} SHIM_FILE;
+
+typedef struct _SHIM_IRP {
+    IRP               Irp;
+    IO_STACK_LOCATION Stack;
+    BOOLEAN           Completed;    // guarded by g_IrpLock
+    BOOLEAN           Counted;      // included in SHIM_FILE.OutstandingIrps
+} SHIM_IRP;
+
+static std::mutex g_IrpLock;
+static std::condition_variable g_IrpCompleted;
+static KSPIN_LOCK g_CancelSpinLock = 0;
+
+extern "C" VOID IoCompleteRequest(PIRP Irp, CHAR PriorityBoost)
+{
+    UNREFERENCED_PARAMETER(PriorityBoost);
+
+    // CANCEL_STATE_IN_COMPLETED_IRP on Windows
+    if (Irp->CancelRoutine) {
+        fprintf(stderr, "shim: IRP %p completed with a cancel routine set\n", (void*)Irp);
+        abort();
+    }
+    if (Irp->UserIosb)
+        *Irp->UserIosb = Irp->IoStatus;
+
+    SHIM_IRP* shimIrp = CONTAINING_RECORD(Irp, SHIM_IRP, Irp);
+    {
+        std::lock_guard<std::mutex> guard(g_IrpLock);
+        if (shimIrp->Completed) {
+            fprintf(stderr, "shim: IRP %p completed twice\n", (void*)Irp);
+            abort();
+        }
+        shimIrp->Completed = TRUE;
+        if (shimIrp->Counted)
+            CONTAINING_RECORD(shimIrp->Stack.FileObject, SHIM_FILE, File)->OutstandingIrps--;
+    }
+    // The waiter may free the IRP as soon as the lock is released
+    g_IrpCompleted.notify_all();
+}
+
+extern "C" VOID IoAcquireCancelSpinLock(PKIRQL Irql)
+{
+    KeAcquireSpinLock(&g_CancelSpinLock, Irql);
+}
+
+extern "C" VOID IoReleaseCancelSpinLock(KIRQL Irql)
+{
+    KeReleaseSpinLock(&g_CancelSpinLock, Irql);
+}
+
+// The cancel routine is entered holding the cancel spin lock and releases it
+extern "C" BOOLEAN IoCancelIrp(PIRP Irp)
+{
+    KIRQL irql;
+    IoAcquireCancelSpinLock(&irql);
+    Irp->Cancel = TRUE;
+
+    PDRIVER_CANCEL routine = IoSetCancelRoutine(Irp, NULL);
+    if (!routine) {
+        IoReleaseCancelSpinLock(irql);
+        return FALSE;
+    }
+
+    Irp->CancelIrql = irql;
+    routine(IoGetCurrentIrpStackLocation(Irp)->DeviceObject, Irp);
+    return TRUE;
+}
+
+static VOID InitializeIrp(SHIM_IRP* ShimIrp, UCHAR MajorFunction, PFILE_OBJECT FileObject)
+{
+    RtlZeroMemory(ShimIrp, sizeof(*ShimIrp));
+    ShimIrp->Irp.Size          = (USHORT)sizeof(IRP);
+    ShimIrp->Irp.RequestorMode = UserMode;
+    ShimIrp->Irp.Tail.Overlay.CurrentStackLocation = &ShimIrp->Stack;
+    ShimIrp->Stack.MajorFunction = MajorFunction;
+    ShimIrp->Stack.FileObject    = FileObject;
+    ShimIrp->Stack.DeviceObject  = FileObject ? FileObject->DeviceObject : NULL;
+}
+
+static BOOLEAN IrpCompleted(SHIM_IRP* ShimIrp)
+{
+    std::lock_guard<std::mutex> guard(g_IrpLock);
+    return ShimIrp->Completed;
+}
+
+static NTSTATUS CallDriver(SHIM_IRP* ShimIrp)
+{
+    PDEVICE_OBJECT device = ShimIrp->Stack.DeviceObject;
+    PDRIVER_DISPATCH dispatch = device->DriverObject->MajorFunction[ShimIrp->Stack.MajorFunction];
+    if (!dispatch) {
+        // IopInvalidDeviceRequest
+        ShimIrp->Irp.IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+        IoCompleteRequest(&ShimIrp->Irp, IO_NO_INCREMENT);
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    NTSTATUS status = dispatch(device, &ShimIrp->Irp);
+    if (status == STATUS_PENDING) {
+        if (!(ShimIrp->Stack.Control & SL_PENDING_RETURNED)) {
+            fprintf(stderr, "shim: dispatch returned STATUS_PENDING without IoMarkIrpPending\n");
+            abort();
+        }
+    } else if (!IrpCompleted(ShimIrp)) {
+        fprintf(stderr, "shim: dispatch returned 0x%08X without completing the IRP\n", (unsigned)status);
+        abort();
+    }
+    return status;
+}
+
+// ========== Harness ==========
+
+static DRIVER_OBJECT g_DriverObject;
+static BOOLEAN g_DriverLoaded = FALSE;
+
+NTSTATUS ShimLoadDriver(PSHIM_DRIVER_ENTRY DriverEntry)
+{
+    static WCHAR s_RegistryPath[] = L"\\Registry\\Machine\\System\\CurrentControlSet\\Services\\OpenSysKit";
+    static WCHAR s_DriverName[] = L"\\Driver\\OpenSysKit";
+
+    RtlZeroMemory(&g_DriverObject, sizeof(g_DriverObject));
+    g_DriverObject.Size = (SHORT)sizeof(DRIVER_OBJECT);
+    RtlInitUnicodeString(&g_DriverObject.DriverName, s_DriverName);
+
+    UNICODE_STRING registryPath;
+    RtlInitUnicodeString(&registryPath, s_RegistryPath);
+
+    ShimSetCurrentProcessId(4);
+    NTSTATUS status = DriverEntry(&g_DriverObject, &registryPath);
+    g_DriverLoaded = NT_SUCCESS(status);
+    return status;
+}
+
+VOID ShimUnloadDriver(VOID)
+{
+    if (!g_DriverLoaded) return;
+
+    ShimSetCurrentProcessId(4);
+    if (g_DriverObject.DriverUnload)
+        g_DriverObject.DriverUnload(&g_DriverObject);
+    g_DriverLoaded = FALSE;
+}
+
+PFILE_OBJECT ShimOpenDevice(ULONG CallerPid, BOOLEAN Overlapped)
+{
+    PDEVICE_OBJECT device = g_DriverObject.DeviceObject;
+    if (!g_DriverLoaded || !device || (device->Flags & DO_DEVICE_INITIALIZING))
+        return NULL;
+
+    SHIM_FILE* file = (SHIM_FILE*)calloc(1, sizeof(SHIM_FILE));
+    if (!file) return NULL;
+    PFILE_OBJECT fileObject = &file->File;
+    fileObject->Size = (SHORT)sizeof(FILE_OBJECT);
+    fileObject->DeviceObject = device;
+    fileObject->Flags = Overlapped ? 0 : FO_SYNCHRONOUS_IO;
+
+    SHIM_IRP irp;
+    InitializeIrp(&irp, IRP_MJ_CREATE, fileObject);
+    ShimSetCurrentProcessId(CallerPid);
+    NTSTATUS status = CallDriver(&irp);
+    if (!NT_SUCCESS(status)) {
+        free(file);
+        return NULL;
+    }
+    return fileObject;
+}
+
+VOID ShimCleanupDevice(PFILE_OBJECT FileObject)
+{
+    SHIM_FILE* file = CONTAINING_RECORD(FileObject, SHIM_FILE, File);
+    if (file->CleanedUp) return;
+    file->CleanedUp = TRUE;
+
+    SHIM_IRP irp;
+    InitializeIrp(&irp, IRP_MJ_CLEANUP, FileObject);
+    CallDriver(&irp);
+}
+
+// As with the last CloseHandle on Windows: IRP_MJ_CLEANUP right away,
+// IRP_MJ_CLOSE once every IRP on the file object has completed
+VOID ShimCloseDevice(PFILE_OBJECT FileObject)
+{
+    SHIM_FILE* file = CONTAINING_RECORD(FileObject, SHIM_FILE, File);
+    SHIM_IRP irp;
+
+    ShimCleanupDevice(FileObject);
+
+    {
+        std::unique_lock<std::mutex> lock(g_IrpLock);
+        g_IrpCompleted.wait(lock, [file] { return file->OutstandingIrps == 0; });
+    }
+
+    InitializeIrp(&irp, IRP_MJ_CLOSE, FileObject);
+    CallDriver(&irp);
+
+    free(file);
+}
+
+// ========== Memory descriptor lists ==========
+//
+// Caller pages are already addressable, so "locking" an output buffer is
+// describing it and "mapping" it is returning the same address.
+//
+
+extern "C" PVOID MmGetSystemAddressForMdlSafe(PMDL Mdl, ULONG Priority)
+{
+    UNREFERENCED_PARAMETER(Priority);
+    return Mdl->MappedSystemVa;
+}
+
+static VOID InitializeMdl(PMDL Mdl, PVOID Buffer, ULONG Length)
+{
+    RtlZeroMemory(Mdl, sizeof(*Mdl));
+    Mdl->Size           = (SHORT)sizeof(MDL);
+    Mdl->StartVa        = Buffer;
+    Mdl->MappedSystemVa = Buffer;
+    Mdl->ByteCount      = Length;
+}
+
+//
+// Device control IRPs live on the heap so they can outlive the call that
+// sent them. The I/O manager's transfer types:
+//
+//   METHOD_BUFFERED    one system buffer sized for the larger of the two
+//                      lengths; input copied in before dispatch,
+//                      Information bytes copied out after completion
+//   METHOD_*_DIRECT    input still copied into a system buffer, output
+//                      described by an MDL and written in place
+//
+struct _SHIM_ASYNC_IO {
+    SHIM_IRP        Irp;
+    MDL             Mdl;
+    IO_STATUS_BLOCK Iosb;           // Irp.UserIosb, the OVERLAPPED of a real caller
+    PVOID           SystemBuffer;
+    SIZE_T          SystemLength;
+    PVOID           OutputBuffer;
+    ULONG           InputLength;
+    ULONG           OutputLength;
+    BOOLEAN         Direct;
+    NTSTATUS        Status;         // returned by the dispatch routine
+};
+
+NTSTATUS ShimDeviceIoControlAsync(
+    PFILE_OBJECT FileObject, ULONG IoControlCode,
+    const VOID* InputBuffer, ULONG InputBufferLength,
+    PVOID OutputBuffer, ULONG OutputBufferLength,
+    PSHIM_ASYNC_IO* Request)
+{
+    *Request = NULL;
+
+    BOOLEAN direct;
+    switch (IoControlCode & 3) {
+    case METHOD_BUFFERED:   direct = FALSE; break;
+    case METHOD_IN_DIRECT:
+    case METHOD_OUT_DIRECT: direct = TRUE;  break;
+    default:
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    PSHIM_ASYNC_IO request = (PSHIM_ASYNC_IO)calloc(1, sizeof(_SHIM_ASYNC_IO));
+    if (!request) return STATUS_INSUFFICIENT_RESOURCES;
+
+    request->Direct       = direct;
+    request->InputLength  = InputBufferLength;
+    request->OutputLength = OutputBufferLength;
+    request->OutputBuffer = OutputBuffer;
+    request->SystemLength = direct ? InputBufferLength : max(InputBufferLength, OutputBufferLength);
+    if (request->SystemLength) {
+        request->SystemBuffer = malloc(request->SystemLength);
+        if (!request->SystemBuffer) {
+            free(request);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+    if (InputBufferLength) RtlCopyMemory(request->SystemBuffer, InputBuffer, InputBufferLength);
+
+    SHIM_IRP* irp = &request->Irp;
+    InitializeIrp(irp, IRP_MJ_DEVICE_CONTROL, FileObject);
+    irp->Counted = TRUE;
+    irp->Irp.AssociatedIrp.SystemBuffer = request->SystemBuffer;
+    irp->Irp.UserIosb = &request->Iosb;
+    if (!direct) {
+        irp->Irp.UserBuffer = OutputBuffer;
+    } else if (OutputBufferLength) {
+        InitializeMdl(&request->Mdl, OutputBuffer, OutputBufferLength);
+        irp->Irp.MdlAddress = &request->Mdl;
+    }
+    irp->Stack.Parameters.DeviceIoControl.IoControlCode      = IoControlCode;
+    irp->Stack.Parameters.DeviceIoControl.InputBufferLength  = InputBufferLength;
+    irp->Stack.Parameters.DeviceIoControl.OutputBufferLength = OutputBufferLength;
+
+    {
+        std::lock_guard<std::mutex> guard(g_IrpLock);
+        CONTAINING_RECORD(FileObject, SHIM_FILE, File)->OutstandingIrps++;
+    }
+
+    request->Status = CallDriver(irp);
+    *Request = request;
+    return request->Status;
+}
+
+BOOLEAN ShimCancelIo(PSHIM_ASYNC_IO Request)
+{
+    return IoCancelIrp(&Request->Irp.Irp);
+}
+
+NTSTATUS ShimWaitIo(PSHIM_ASYNC_IO Request, PULONG BytesReturned)
+{
+    {
+        std::unique_lock<std::mutex> lock(g_IrpLock);
+        g_IrpCompleted.wait(lock, [Request] { return Request->Irp.Completed != FALSE; });
+    }
+
+    NTSTATUS status = (Request->Status == STATUS_PENDING) ? Request->Iosb.Status : Request->Status;
+    SIZE_T returned = 0;
+
+    // Success and warning statuses (e.g. STATUS_BUFFER_OVERFLOW) both return data
+    if (!NT_ERROR(status))
+        returned = min((SIZE_T)Request->Iosb.Information, (SIZE_T)Request->OutputLength);
+
+    if (Request->Direct) {
+        ShimNoteIoBuffer(Request->InputLength, Request->InputLength);
+        ShimNoteIoMapping(Request->OutputLength);
+    } else {
+        if (returned) RtlCopyMemory(Request->OutputBuffer, Request->SystemBuffer, returned);
+        ShimNoteIoBuffer(Request->SystemLength, Request->InputLength + returned);
+    }
+    if (BytesReturned) *BytesReturned = (ULONG)returned;
+
+    free(Request->SystemBuffer);
+    free(Request);
+    return status;
+}
+
+NTSTATUS ShimDeviceIoControl(
+    PFILE_OBJECT FileObject, ULONG IoControlCode,
+    const VOID* InputBuffer, ULONG InputBufferLength,
+    PVOID OutputBuffer, ULONG OutputBufferLength,
+    PULONG BytesReturned)
+{
+    *BytesReturned = 0;
+
+    PSHIM_ASYNC_IO request;
+    NTSTATUS status = ShimDeviceIoControlAsync(FileObject, IoControlCode,
+        InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, &request);
+    return request ? ShimWaitIo(request, BytesReturned) : status;
+}
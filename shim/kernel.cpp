@@ -0,0 +1,1673 @@
+//
+// Host shim: Ex / Ke / Ob / Ps / Mm / Zw / Rtl over the current snapshot
+//
+
+#include "shim_internal.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unordered_map>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// ========== Accounting ==========
+
+static std::atomic<ULONG64> g_PoolAllocations(0);
+static std::atomic<ULONG64> g_PoolFrees(0);
+static std::atomic<ULONG64> g_PoolBytes(0);
+static std::atomic<LONG64>  g_ObjectsOutstanding(0);
+static std::atomic<LONG64>  g_CurrentProcessObjects(0);  // held by the PsGetCurrentProcess cache
+static std::atomic<ULONG64> g_IoBufferBytes(0);
+static std::atomic<ULONG64> g_IoCopiedBytes(0);
+static std::atomic<ULONG64> g_IoMappedBytes(0);
+static std::atomic<ULONG64> g_SystemQueries(0);
+static std::atomic<ULONG64> g_UnguardedAcquires(0);
+static std::atomic<bool>    g_DebugOutput(false);
+
+VOID ShimNoteIoBuffer(SIZE_T Allocated, SIZE_T Copied)
+{
+    g_IoBufferBytes += Allocated;
+    g_IoCopiedBytes += Copied;
+}
+
+VOID ShimNoteIoMapping(SIZE_T Mapped)
+{
+    g_IoMappedBytes += Mapped;
+}
+
+SHIM_STATS ShimGetStats(VOID)
+{
+    SHIM_STATS stats;
+    stats.PoolAllocations      = g_PoolAllocations;
+    stats.PoolFrees            = g_PoolFrees;
+    stats.PoolBytesOutstanding = g_PoolBytes;
+    stats.ObjectsOutstanding   = g_ObjectsOutstanding - g_CurrentProcessObjects;
+    stats.IoBufferBytes        = g_IoBufferBytes;
+    stats.IoCopiedBytes        = g_IoCopiedBytes;
+    stats.IoMappedBytes        = g_IoMappedBytes;
+    stats.SystemQueries        = g_SystemQueries;
+    stats.UnguardedAcquires    = g_UnguardedAcquires;
+    return stats;
+}
+
+VOID ShimResetIoStats(VOID)
+{
+    g_IoBufferBytes = 0;
+    g_IoCopiedBytes = 0;
+    g_IoMappedBytes = 0;
+}
+
+VOID ShimSetDebugOutput(BOOLEAN Enabled)
+{
+    g_DebugOutput = Enabled != FALSE;
+}
+
+extern "C" ULONG DbgPrint(PCSTR Format, ...)
+{
+    if (!g_DebugOutput) return 0;
+
+    va_list args;
+    va_start(args, Format);
+    vfprintf(stderr, Format, args);
+    va_end(args);
+    return 0;
+}
+
+// ========== Rtl ==========
+
+extern "C" VOID RtlInitUnicodeString(PUNICODE_STRING DestinationString, PCWSTR SourceString)
+{
+    SIZE_T length = 0;
+    if (SourceString) {
+        while (SourceString[length]) length++;
+    }
+    DestinationString->Buffer        = (PWCH)SourceString;
+    DestinationString->Length        = (USHORT)(length * sizeof(WCHAR));
+    DestinationString->MaximumLength = SourceString ? (USHORT)((length + 1) * sizeof(WCHAR)) : 0;
+}
+
+// Case folding covers ASCII only; image names in snapshots are ASCII
+extern "C" BOOLEAN RtlEqualUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive)
+{
+    if (String1->Length != String2->Length) return FALSE;
+    for (USHORT i = 0; i < String1->Length / sizeof(WCHAR); i++) {
+        WCHAR a = String1->Buffer[i];
+        WCHAR b = String2->Buffer[i];
+        if (CaseInSensitive) {
+            if (a >= L'a' && a <= L'z') a -= L'a' - L'A';
+            if (b >= L'a' && b <= L'z') b -= L'a' - L'A';
+        }
+        if (a != b) return FALSE;
+    }
+    return TRUE;
+}
+
+extern "C" SIZE_T RtlCompareMemory(const VOID* Source1, const VOID* Source2, SIZE_T Length)
+{
+    const UCHAR* a = (const UCHAR*)Source1;
+    const UCHAR* b = (const UCHAR*)Source2;
+    SIZE_T i = 0;
+    while (i < Length && a[i] == b[i]) i++;
+    return i;
+}
+
+// ========== Pool ==========
+//
+// Each block carries its size and tag. Freeing with the wrong tag aborts,
+// as BAD_POOL_CALLER would bugcheck on the real kernel.
+//
+
+typedef struct alignas(16) _SHIM_POOL_HEADER {
+    SIZE_T Size;
+    ULONG  Tag;
+} SHIM_POOL_HEADER;
+
+extern "C" PVOID ExAllocatePool2(POOL_FLAGS Flags, SIZE_T NumberOfBytes, ULONG Tag)
+{
+    SHIM_POOL_HEADER* header = (SHIM_POOL_HEADER*)((Flags & POOL_FLAG_UNINITIALIZED)
+        ? malloc(sizeof(SHIM_POOL_HEADER) + NumberOfBytes)
+        : calloc(1, sizeof(SHIM_POOL_HEADER) + NumberOfBytes));
+    if (!header) return NULL;
+
+    header->Size = NumberOfBytes;
+    header->Tag  = Tag;
+    g_PoolAllocations++;
+    g_PoolBytes += NumberOfBytes;
+    return header + 1;
+}
+
+static VOID ShimFreePool(PVOID P, const ULONG* Tag)
+{
+    if (!P) {
+        fprintf(stderr, "shim: freeing NULL pool block\n");
+        abort();
+    }
+
+    SHIM_POOL_HEADER* header = (SHIM_POOL_HEADER*)P - 1;
+    if (Tag && header->Tag != *Tag) {
+        fprintf(stderr, "shim: pool block tagged 0x%08X freed with tag 0x%08X\n", header->Tag, *Tag);
+        abort();
+    }
+
+    g_PoolFrees++;
+    g_PoolBytes -= header->Size;
+    free(header);
+}
+
+extern "C" VOID ExFreePoolWithTag(PVOID P, ULONG Tag)
+{
+    ShimFreePool(P, &Tag);
+}
+
+extern "C" VOID ExFreePool(PVOID P)
+{
+    ShimFreePool(P, NULL);
+}
+
+// ========== IRQL / spinlocks / time ==========
+
+static thread_local KIRQL t_Irql = PASSIVE_LEVEL;
+static thread_local LONG  t_CriticalRegion = 0;
+
+extern "C" KIRQL KeGetCurrentIrql(VOID)
+{
+    return t_Irql;
+}
+
+// No APCs are delivered here; the depth only lets resource acquisition check it
+extern "C" VOID KeEnterCriticalRegion(VOID)
+{
+    t_CriticalRegion++;
+}
+
+extern "C" VOID KeLeaveCriticalRegion(VOID)
+{
+    t_CriticalRegion--;
+}
+
+extern "C" VOID KeRaiseIrql(KIRQL NewIrql, PKIRQL OldIrql)
+{
+    *OldIrql = t_Irql;
+    t_Irql = NewIrql;
+}
+
+extern "C" VOID KeLowerIrql(KIRQL NewIrql)
+{
+    t_Irql = NewIrql;
+}
+
+extern "C" VOID KeInitializeSpinLock(PKSPIN_LOCK SpinLock)
+{
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+extern "C" VOID KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock)
+{
+    while (__atomic_exchange_n(SpinLock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(SpinLock, __ATOMIC_RELAXED))
+            std::this_thread::yield();
+    }
+}
+
+extern "C" VOID KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK SpinLock)
+{
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+extern "C" KIRQL KeAcquireSpinLockRaiseToDpc(PKSPIN_LOCK SpinLock)
+{
+    KIRQL oldIrql = t_Irql;
+    t_Irql = DISPATCH_LEVEL;
+    KeAcquireSpinLockAtDpcLevel(SpinLock);
+    return oldIrql;
+}
+
+extern "C" VOID KeReleaseSpinLock(PKSPIN_LOCK SpinLock, KIRQL NewIrql)
+{
+    KeReleaseSpinLockFromDpcLevel(SpinLock);
+    t_Irql = NewIrql;
+}
+
+// 10 MHz, the usual QPC frequency on current Windows
+extern "C" LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency)
+{
+    if (PerformanceFrequency) PerformanceFrequency->QuadPart = 10000000;
+    LARGE_INTEGER now;
+    now.QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count() / 100;
+    return now;
+}
+
+// 100 ns units since boot; steady_clock stands in for the interrupt clock
+extern "C" ULONGLONG KeQueryInterruptTime(VOID)
+{
+    return (ULONGLONG)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count() / 100;
+}
+
+// 100 ns units since 1601-01-01
+extern "C" VOID KeQuerySystemTimePrecise(PLARGE_INTEGER CurrentTime)
+{
+    CurrentTime->QuadPart = 116444736000000000LL +
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() / 100;
+}
+
+extern "C" ULONG KeQueryActiveProcessorCountEx(USHORT GroupNumber)
+{
+    UNREFERENCED_PARAMETER(GroupNumber);
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+extern "C" ULONG KeQueryMaximumProcessorCountEx(USHORT GroupNumber)
+{
+    return KeQueryActiveProcessorCountEx(GroupNumber);
+}
+
+extern "C" ULONG KeGetCurrentProcessorNumberEx(PVOID ProcNumber)
+{
+    UNREFERENCED_PARAMETER(ProcNumber);
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : (ULONG)cpu % KeQueryActiveProcessorCountEx(0);
+}
+
+// ========== Objects ==========
+//
+// Process and thread objects are reference-counted copies of the snapshot
+// record they were looked up from. ObjectsOutstanding in ShimGetStats
+// exposes leaked references.
+//
+
+// DISPATCHER_HEADER.Type values, as on Windows
+#define ShimDispatcherNotificationEvent     0
+#define ShimDispatcherSynchronizationEvent  1
+#define ShimDispatcherProcess               3
+#define ShimDispatcherSemaphore             5
+#define ShimDispatcherThread                6
+
+typedef enum _SHIM_OBJECT_TYPE {
+    ShimObjectProcess = 1,
+    ShimObjectThread,
+    ShimObjectSection
+} SHIM_OBJECT_TYPE;
+
+typedef struct _SHIM_OBJECT_HEADER {
+    LONG              DispatcherType;   // overlays DISPATCHER_HEADER.Type
+    std::atomic<LONG> RefCount;
+    SHIM_OBJECT_TYPE  Type;
+} SHIM_OBJECT_HEADER;
+
+struct _KPROCESS {
+    SHIM_OBJECT_HEADER Header;
+    ULONG    ProcessId;
+    ULONG    SessionId;
+    LONGLONG CreateTime;
+};
+
+struct _KTHREAD {
+    SHIM_OBJECT_HEADER Header;
+    ULONG   ProcessId;
+    ULONG   ThreadId;
+    size_t  Index;          // position in the owner's thread list when created
+    LONG    Priority;
+    ULONG64 StartAddress;
+    BOOLEAN Terminating;
+    BOOLEAN Exited;         // system threads only; guarded by g_WaitLock
+};
+
+static PEPROCESS NewProcessObject(ULONG ProcessId, LONGLONG CreateTime, ULONG SessionId)
+{
+    PEPROCESS object = new _KPROCESS;
+    object->Header.DispatcherType = ShimDispatcherProcess;
+    object->Header.RefCount = 1;
+    object->Header.Type     = ShimObjectProcess;
+    object->ProcessId       = ProcessId;
+    object->SessionId       = SessionId;
+    object->CreateTime      = CreateTime;
+    g_ObjectsOutstanding++;
+    return object;
+}
+
+static PEPROCESS NewProcessObject(const SHIM_PROCESS* Process)
+{
+    return NewProcessObject(Process->ProcessId, Process->CreateTime, Process->SessionId);
+}
+
+static PETHREAD NewThreadObject(const SHIM_PROCESS* Process, size_t Index)
+{
+    const SHIM_THREAD& thread = Process->Threads[Index];
+    PETHREAD object = new _KTHREAD;
+    object->Header.DispatcherType = ShimDispatcherThread;
+    object->Header.RefCount = 1;
+    object->Header.Type     = ShimObjectThread;
+    object->ProcessId       = Process->ProcessId;
+    object->ThreadId        = thread.ThreadId;
+    object->Index           = Index;
+    object->Priority        = thread.Priority;
+    object->StartAddress    = thread.StartAddress;
+    object->Terminating     = thread.Terminating;
+    object->Exited          = FALSE;
+    g_ObjectsOutstanding++;
+    return object;
+}
+
+static VOID DeleteSection(PVOID Object);
+
+extern "C" VOID ObReferenceObject(PVOID Object)
+{
+    ((SHIM_OBJECT_HEADER*)Object)->RefCount++;
+}
+
+extern "C" VOID ObDereferenceObject(PVOID Object)
+{
+    SHIM_OBJECT_HEADER* header = (SHIM_OBJECT_HEADER*)Object;
+    LONG remaining = --header->RefCount;
+    if (remaining < 0) {
+        fprintf(stderr, "shim: object %p dereferenced below zero\n", Object);
+        abort();
+    }
+    if (remaining > 0) return;
+
+    g_ObjectsOutstanding--;
+    if (header->Type == ShimObjectProcess)
+        delete (PEPROCESS)Object;
+    else if (header->Type == ShimObjectThread)
+        delete (PETHREAD)Object;
+    else
+        DeleteSection(Object);
+}
+
+extern "C" NTSTATUS ObQueryNameString(
+    PVOID Object, POBJECT_NAME_INFORMATION ObjectNameInfo, ULONG Length, PULONG ReturnLength)
+{
+    UNREFERENCED_PARAMETER(Object);
+    *ReturnLength = sizeof(OBJECT_NAME_INFORMATION);
+    if (Length < sizeof(OBJECT_NAME_INFORMATION)) return STATUS_INFO_LENGTH_MISMATCH;
+
+    // The snapshot does not record object names
+    RtlZeroMemory(ObjectNameInfo, sizeof(OBJECT_NAME_INFORMATION));
+    return STATUS_SUCCESS;
+}
+
+// ========== Processes and threads ==========
+
+static thread_local ULONG t_CurrentProcessId = 4;
+static thread_local ULONG t_AttachedProcessId = 0;
+
+// PsGetCurrentProcess objects, one per running process: the same process always
+// yields the same pointer, as on Windows. The cache holds one reference of its
+// own; references taken by the driver show up in ObjectsOutstanding.
+static std::unordered_map<ULONG, PEPROCESS> g_CurrentProcessCache;
+
+VOID ShimSetCurrentProcessId(ULONG ProcessId)
+{
+    t_CurrentProcessId = ProcessId;
+}
+
+ULONG ShimGetCurrentProcessId(VOID)
+{
+    return t_CurrentProcessId;
+}
+
+extern "C" NTSTATUS PsLookupProcessByProcessId(HANDLE ProcessId, PEPROCESS* Process)
+{
+    *Process = NULL;
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_PROCESS* process = ShimFindProcess((ULONG)(ULONG_PTR)ProcessId);
+    if (!process) return STATUS_INVALID_PARAMETER;
+
+    *Process = NewProcessObject(process);
+    return STATUS_SUCCESS;
+}
+
+extern "C" HANDLE PsGetCurrentProcessId(VOID)
+{
+    return (HANDLE)(ULONG_PTR)t_CurrentProcessId;
+}
+
+// Like the real IoGetCurrentProcess, the result is not referenced
+extern "C" PEPROCESS PsGetCurrentProcess(VOID)
+{
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_PROCESS* process = ShimFindProcess(t_CurrentProcessId);
+    LONGLONG createTime = process ? process->CreateTime : 0;
+    ULONG sessionId = process ? process->SessionId : 0;
+
+    PEPROCESS& cached = g_CurrentProcessCache[t_CurrentProcessId];
+    if (cached && cached->CreateTime != createTime) {
+        // The PID now names another process: references still held on the
+        // old object keep it alive and are no longer the cache's
+        g_CurrentProcessObjects--;
+        ObDereferenceObject(cached);
+        cached = NULL;
+    }
+    if (!cached) {
+        cached = NewProcessObject(t_CurrentProcessId, createTime, sessionId);
+        g_CurrentProcessObjects++;
+    }
+    return cached;
+}
+
+extern "C" HANDLE PsGetProcessId(PEPROCESS Process)
+{
+    return (HANDLE)(ULONG_PTR)Process->ProcessId;
+}
+
+extern "C" LONGLONG PsGetProcessCreateTimeQuadPart(PEPROCESS Process)
+{
+    return Process->CreateTime;
+}
+
+extern "C" ULONG PsGetProcessSessionId(PEPROCESS Process)
+{
+    return Process->SessionId;
+}
+
+// A process is running while it is in the snapshot with the same create time
+extern "C" NTSTATUS PsGetProcessExitStatus(PEPROCESS Process)
+{
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_PROCESS* process = ShimFindProcess(Process->ProcessId);
+    return (process && process->CreateTime == Process->CreateTime) ? STATUS_PENDING : STATUS_SUCCESS;
+}
+
+extern "C" HANDLE PsGetThreadId(PETHREAD Thread)
+{
+    return (HANDLE)(ULONG_PTR)Thread->ThreadId;
+}
+
+extern "C" BOOLEAN PsIsThreadTerminating(PETHREAD Thread)
+{
+    return Thread->Terminating;
+}
+
+extern "C" KPRIORITY KeQueryPriorityThread(PKTHREAD Thread)
+{
+    return Thread->Priority;
+}
+
+// Not exported by ntddk.h: resolved by the modules via MmGetSystemRoutineAddress
+static PETHREAD NTAPI ShimPsGetNextProcessThread(PEPROCESS Process, PETHREAD Thread)
+{
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_PROCESS* process = ShimFindProcess(Process->ProcessId);
+    if (!process) return NULL;
+
+    size_t next = 0;
+    if (Thread) {
+        auto& threads = process->Threads;
+        size_t index = Thread->Index;
+        if (index >= threads.size() || threads[index].ThreadId != Thread->ThreadId) {
+            for (index = 0; index < threads.size(); index++) {
+                if (threads[index].ThreadId == Thread->ThreadId) break;
+            }
+        }
+        next = index + 1;
+    }
+
+    return next < process->Threads.size() ? NewThreadObject(process, next) : NULL;
+}
+
+static PVOID NTAPI ShimPsGetThreadWin32StartAddress(PETHREAD Thread)
+{
+    return (PVOID)(ULONG_PTR)Thread->StartAddress;
+}
+
+extern "C" VOID KeStackAttachProcess(PRKPROCESS Process, PRKAPC_STATE ApcState)
+{
+    ApcState->Process = (PVOID)(ULONG_PTR)t_AttachedProcessId;
+    t_AttachedProcessId = Process->ProcessId;
+}
+
+extern "C" VOID KeUnstackDetachProcess(PRKAPC_STATE ApcState)
+{
+    t_AttachedProcessId = (ULONG)(ULONG_PTR)ApcState->Process;
+}
+
+//
+// Only the routines the modules resolve dynamically and the shim can
+// honour are exported. PsTerminateSystemThread is deliberately missing:
+// there is no machine code to scan for PspTerminateThreadByPointer, so
+// ProcessKill takes its ZwTerminateProcess path.
+//
+extern "C" PVOID MmGetSystemRoutineAddress(PUNICODE_STRING SystemRoutineName)
+{
+    static const struct {
+        const char16_t* Name;
+        PVOID Routine;
+    } s_Routines[] = {
+        { u"PsGetNextProcessThread",       (PVOID)ShimPsGetNextProcessThread },
+        { u"PsGetThreadWin32StartAddress", (PVOID)ShimPsGetThreadWin32StartAddress },
+    };
+
+    std::u16string name((const char16_t*)SystemRoutineName->Buffer,
+        SystemRoutineName->Length / sizeof(WCHAR));
+    for (const auto& routine : s_Routines) {
+        if (name == routine.Name) return routine.Routine;
+    }
+    return NULL;
+}
+
+// ========== Kernel handles ==========
+
+#define SHIM_KERNEL_HANDLE_BASE 0xFFFFFFFF80000000ULL
+
+static std::mutex g_HandleLock;
+static std::unordered_map<ULONG_PTR, ULONG> g_KernelHandles;     // handle -> PID
+static std::unordered_map<ULONG_PTR, PETHREAD> g_ThreadHandles;  // handle -> system thread
+static std::unordered_map<ULONG_PTR, PVOID> g_SectionHandles;    // handle -> section
+static ULONG_PTR g_NextKernelHandle = SHIM_KERNEL_HANDLE_BASE + 4;
+
+static BOOLEAN LookupKernelHandle(HANDLE Handle, PULONG ProcessId)
+{
+    std::lock_guard<std::mutex> guard(g_HandleLock);
+    auto it = g_KernelHandles.find((ULONG_PTR)Handle);
+    if (it == g_KernelHandles.end()) return FALSE;
+    *ProcessId = it->second;
+    return TRUE;
+}
+
+extern "C" NTSTATUS ZwOpenProcess(
+    PHANDLE ProcessHandle, ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes, PCLIENT_ID ClientId)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(ObjectAttributes);
+
+    ULONG pid = (ULONG)(ULONG_PTR)ClientId->UniqueProcess;
+    {
+        std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+        if (!ShimFindProcess(pid)) return STATUS_INVALID_CID;
+    }
+
+    std::lock_guard<std::mutex> guard(g_HandleLock);
+    ULONG_PTR handle = g_NextKernelHandle;
+    g_NextKernelHandle += 4;
+    g_KernelHandles[handle] = pid;
+    *ProcessHandle = (HANDLE)handle;
+    return STATUS_SUCCESS;
+}
+
+// Object types only need distinct addresses
+struct _OBJECT_TYPE {
+    SHIM_OBJECT_TYPE Type;
+};
+
+// Only process objects are opened by pointer (ProcessKillObject)
+static _OBJECT_TYPE g_ShimProcessTypeObject = { ShimObjectProcess };
+static POBJECT_TYPE g_ShimProcessType = &g_ShimProcessTypeObject;
+extern "C" { POBJECT_TYPE* PsProcessType = &g_ShimProcessType; }
+
+extern "C" NTSTATUS ObOpenObjectByPointer(
+    PVOID Object, ULONG HandleAttributes, PACCESS_STATE PassedAccessState,
+    ACCESS_MASK DesiredAccess, POBJECT_TYPE ObjectType, KPROCESSOR_MODE AccessMode, PHANDLE Handle)
+{
+    UNREFERENCED_PARAMETER(HandleAttributes);
+    UNREFERENCED_PARAMETER(PassedAccessState);
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(ObjectType);
+    UNREFERENCED_PARAMETER(AccessMode);
+
+    SHIM_OBJECT_HEADER* header = (SHIM_OBJECT_HEADER*)Object;
+    if (header->Type != ShimObjectProcess) return STATUS_OBJECT_TYPE_MISMATCH;
+
+    // A terminated process keeps its object but can no longer be opened
+    ULONG pid = ((PEPROCESS)Object)->ProcessId;
+    {
+        std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+        if (!ShimFindProcess(pid)) return STATUS_PROCESS_IS_TERMINATING;
+    }
+
+    std::lock_guard<std::mutex> guard(g_HandleLock);
+    ULONG_PTR handle = g_NextKernelHandle;
+    g_NextKernelHandle += 4;
+    g_KernelHandles[handle] = pid;
+    *Handle = (HANDLE)handle;
+    return STATUS_SUCCESS;
+}
+
+//
+// Kernel handles are closed in the shim's table. Anything else is a user
+// handle of the process the thread is attached to (ForceCloseHandle) and is
+// removed from that process's handle list.
+//
+extern "C" NTSTATUS ZwClose(HANDLE Handle)
+{
+    if ((ULONG_PTR)Handle >= SHIM_KERNEL_HANDLE_BASE) {
+        PVOID object;
+        {
+            std::lock_guard<std::mutex> guard(g_HandleLock);
+            if (g_KernelHandles.erase((ULONG_PTR)Handle)) return STATUS_SUCCESS;
+
+            auto section = g_SectionHandles.find((ULONG_PTR)Handle);
+            if (section != g_SectionHandles.end()) {
+                object = section->second;
+                g_SectionHandles.erase(section);
+            } else {
+                auto it = g_ThreadHandles.find((ULONG_PTR)Handle);
+                if (it == g_ThreadHandles.end()) return STATUS_INVALID_HANDLE;
+                object = it->second;
+                g_ThreadHandles.erase(it);
+            }
+        }
+        ObDereferenceObject(object);
+        return STATUS_SUCCESS;
+    }
+
+    if (!t_AttachedProcessId) return STATUS_INVALID_HANDLE;
+
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_PROCESS* process = ShimFindProcess(t_AttachedProcessId);
+    if (!process) return STATUS_INVALID_HANDLE;
+
+    auto& handles = process->Handles;
+    for (auto it = handles.begin(); it != handles.end(); ++it) {
+        if (it->Value == (USHORT)(ULONG_PTR)Handle) {
+            handles.erase(it);
+            return STATUS_SUCCESS;
+        }
+    }
+    return STATUS_INVALID_HANDLE;
+}
+
+#define ProcessBreakOnTermination 29
+
+extern "C" NTSTATUS NTAPI ZwQueryInformationProcess(
+    HANDLE ProcessHandle, ULONG ProcessInformationClass,
+    PVOID ProcessInformation, ULONG ProcessInformationLength, PULONG ReturnLength)
+{
+    ULONG pid;
+    if (!LookupKernelHandle(ProcessHandle, &pid)) return STATUS_INVALID_HANDLE;
+    if (ProcessInformationClass != ProcessBreakOnTermination) return STATUS_INVALID_INFO_CLASS;
+    if (ReturnLength) *ReturnLength = sizeof(ULONG);
+    if (ProcessInformationLength < sizeof(ULONG)) return STATUS_INFO_LENGTH_MISMATCH;
+
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_PROCESS* process = ShimFindProcess(pid);
+    if (!process) return STATUS_PROCESS_IS_TERMINATING;
+    *(PULONG)ProcessInformation = process->Critical ? 1 : 0;
+    return STATUS_SUCCESS;
+}
+
+static VOID NotifyProcess(PEPROCESS Process, PPS_CREATE_NOTIFY_INFO CreateInfo);
+
+extern "C" NTSTATUS ZwTerminateProcess(HANDLE ProcessHandle, NTSTATUS ExitStatus)
+{
+    UNREFERENCED_PARAMETER(ExitStatus);
+
+    ULONG pid;
+    if (!LookupKernelHandle(ProcessHandle, &pid)) return STATUS_INVALID_HANDLE;
+
+    PEPROCESS object;
+    {
+        std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+        auto& procs = g_ShimSystem.Processes;
+        auto it = procs.begin();
+        while (it != procs.end() && it->ProcessId != pid) ++it;
+        if (it == procs.end()) return STATUS_PROCESS_IS_TERMINATING;
+        object = NewProcessObject(&*it);
+        procs.erase(it);
+    }
+
+    // Exit notifications follow the removal, outside the snapshot lock
+    NotifyProcess(object, NULL);
+    ObDereferenceObject(object);
+    return STATUS_SUCCESS;
+}
+
+// The snapshot has no file system
+extern "C" NTSTATUS ZwCreateFile(
+    PHANDLE FileHandle, ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes, PIO_STATUS_BLOCK IoStatusBlock,
+    PLARGE_INTEGER AllocationSize, ULONG FileAttributes, ULONG ShareAccess,
+    ULONG CreateDisposition, ULONG CreateOptions, PVOID EaBuffer, ULONG EaLength)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(ObjectAttributes);
+    UNREFERENCED_PARAMETER(AllocationSize);
+    UNREFERENCED_PARAMETER(FileAttributes);
+    UNREFERENCED_PARAMETER(ShareAccess);
+    UNREFERENCED_PARAMETER(CreateDisposition);
+    UNREFERENCED_PARAMETER(CreateOptions);
+    UNREFERENCED_PARAMETER(EaBuffer);
+    UNREFERENCED_PARAMETER(EaLength);
+
+    *FileHandle = NULL;
+    IoStatusBlock->Status = STATUS_OBJECT_NAME_NOT_FOUND;
+    IoStatusBlock->Information = 0;
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+extern "C" NTSTATUS ZwSetInformationFile(
+    HANDLE FileHandle, PIO_STATUS_BLOCK IoStatusBlock,
+    PVOID FileInformation, ULONG Length, FILE_INFORMATION_CLASS FileInformationClass)
+{
+    UNREFERENCED_PARAMETER(FileHandle);
+    UNREFERENCED_PARAMETER(IoStatusBlock);
+    UNREFERENCED_PARAMETER(FileInformation);
+    UNREFERENCED_PARAMETER(Length);
+    UNREFERENCED_PARAMETER(FileInformationClass);
+    return STATUS_INVALID_HANDLE;
+}
+
+// ========== Dispatcher objects and system threads ==========
+//
+// One mutex and condition variable serve every wait: the driver waits
+// rarely enough that waking all waiters on each signal costs nothing
+// measurable. A system thread is a std::thread behind a thread object that
+// becomes signalled when its routine returns or calls PsTerminateSystemThread.
+//
+
+static std::mutex g_WaitLock;
+static std::condition_variable g_WaitSignal;
+static std::atomic<ULONG> g_NextSystemThreadId(0x10000);
+
+static _OBJECT_TYPE g_ShimThreadTypeObject = { ShimObjectThread };
+static POBJECT_TYPE g_ShimThreadType = &g_ShimThreadTypeObject;
+extern "C" { POBJECT_TYPE* PsThreadType = &g_ShimThreadType; }
+
+extern "C" VOID KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State)
+{
+    Event->Header.Type = (Type == SynchronizationEvent)
+        ? ShimDispatcherSynchronizationEvent
+        : ShimDispatcherNotificationEvent;
+    Event->Header.SignalState = State ? 1 : 0;
+}
+
+extern "C" LONG KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait)
+{
+    UNREFERENCED_PARAMETER(Increment);
+    UNREFERENCED_PARAMETER(Wait);
+
+    LONG previous;
+    {
+        std::lock_guard<std::mutex> guard(g_WaitLock);
+        previous = Event->Header.SignalState;
+        Event->Header.SignalState = 1;
+    }
+    g_WaitSignal.notify_all();
+    return previous;
+}
+
+extern "C" VOID KeClearEvent(PRKEVENT Event)
+{
+    std::lock_guard<std::mutex> guard(g_WaitLock);
+    Event->Header.SignalState = 0;
+}
+
+extern "C" VOID KeInitializeSemaphore(PRKSEMAPHORE Semaphore, LONG Count, LONG Limit)
+{
+    Semaphore->Header.Type        = ShimDispatcherSemaphore;
+    Semaphore->Header.SignalState = Count;
+    Semaphore->Limit              = Limit;
+}
+
+extern "C" LONG KeReleaseSemaphore(PRKSEMAPHORE Semaphore, KPRIORITY Increment, LONG Adjustment, BOOLEAN Wait)
+{
+    UNREFERENCED_PARAMETER(Increment);
+    UNREFERENCED_PARAMETER(Wait);
+
+    LONG previous;
+    {
+        std::lock_guard<std::mutex> guard(g_WaitLock);
+        previous = Semaphore->Header.SignalState;
+        if (Adjustment <= 0 || previous > Semaphore->Limit - Adjustment) {
+            // STATUS_SEMAPHORE_LIMIT_EXCEEDED is raised on Windows
+            fprintf(stderr, "shim: semaphore %p released past its limit\n", (void*)Semaphore);
+            abort();
+        }
+        Semaphore->Header.SignalState = previous + Adjustment;
+    }
+    g_WaitSignal.notify_all();
+    return previous;
+}
+
+// Caller holds g_WaitLock. Satisfying a wait consumes synchronization
+// events and semaphore counts, as on Windows.
+static bool TrySatisfyWait(PVOID Object)
+{
+    DISPATCHER_HEADER* header = (DISPATCHER_HEADER*)Object;
+
+    switch (header->Type) {
+    case ShimDispatcherNotificationEvent:
+        return header->SignalState != 0;
+    case ShimDispatcherSynchronizationEvent:
+        if (!header->SignalState) return false;
+        header->SignalState = 0;
+        return true;
+    case ShimDispatcherSemaphore:
+        if (header->SignalState <= 0) return false;
+        header->SignalState--;
+        return true;
+    case ShimDispatcherThread:
+        return ((PETHREAD)Object)->Exited != FALSE;
+    default:
+        fprintf(stderr, "shim: waiting on unsupported object %p (type %d)\n", Object, (int)header->Type);
+        abort();
+    }
+}
+
+//
+// Timeouts follow the NT convention: negative is relative, positive is an
+// absolute system time, both in 100 ns units.
+//
+extern "C" NTSTATUS KeWaitForSingleObject(
+    PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode,
+    BOOLEAN Alertable, PLARGE_INTEGER Timeout)
+{
+    UNREFERENCED_PARAMETER(WaitReason);
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+
+    std::unique_lock<std::mutex> lock(g_WaitLock);
+    if (!Timeout) {
+        g_WaitSignal.wait(lock, [Object] { return TrySatisfyWait(Object); });
+        return STATUS_WAIT_0;
+    }
+
+    LONGLONG interval = Timeout->QuadPart;
+    if (interval > 0) {
+        LARGE_INTEGER now;
+        KeQuerySystemTimePrecise(&now);
+        interval = now.QuadPart - interval;
+    }
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::nanoseconds(interval < 0 ? -interval * 100 : 0);
+
+    return g_WaitSignal.wait_until(lock, deadline, [Object] { return TrySatisfyWait(Object); })
+        ? STATUS_WAIT_0
+        : STATUS_TIMEOUT;
+}
+
+typedef struct _SHIM_THREAD_EXIT {
+    NTSTATUS ExitStatus;
+} SHIM_THREAD_EXIT;
+
+static thread_local PETHREAD t_SystemThread = NULL;
+
+static VOID RunSystemThread(PETHREAD Thread, PKSTART_ROUTINE StartRoutine, PVOID StartContext)
+{
+    t_SystemThread = Thread;
+    try {
+        StartRoutine(StartContext);
+    } catch (const SHIM_THREAD_EXIT&) {
+    }
+
+    // Drop the thread's own reference before waiters can observe the exit,
+    // so a leak check right after the wait sees the final count
+    std::lock_guard<std::mutex> guard(g_WaitLock);
+    Thread->Exited = TRUE;
+    ObDereferenceObject(Thread);
+    g_WaitSignal.notify_all();
+}
+
+// System threads run in the System process (PID 4), the thread_local default
+extern "C" NTSTATUS PsCreateSystemThread(
+    PHANDLE ThreadHandle, ULONG DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes, HANDLE ProcessHandle, PCLIENT_ID ClientId,
+    PKSTART_ROUTINE StartRoutine, PVOID StartContext)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(ObjectAttributes);
+    UNREFERENCED_PARAMETER(ProcessHandle);
+
+    PETHREAD object = new _KTHREAD;
+    object->Header.DispatcherType = ShimDispatcherThread;
+    object->Header.RefCount = 2;    // the handle and the running thread
+    object->Header.Type     = ShimObjectThread;
+    object->ProcessId       = 4;
+    object->ThreadId        = g_NextSystemThreadId.fetch_add(4);
+    object->Index           = 0;
+    object->Priority        = 8;
+    object->StartAddress    = (ULONG64)(ULONG_PTR)StartRoutine;
+    object->Terminating     = FALSE;
+    object->Exited          = FALSE;
+    g_ObjectsOutstanding++;
+
+    {
+        std::lock_guard<std::mutex> guard(g_HandleLock);
+        ULONG_PTR handle = g_NextKernelHandle;
+        g_NextKernelHandle += 4;
+        g_ThreadHandles[handle] = object;
+        *ThreadHandle = (HANDLE)handle;
+    }
+    if (ClientId) {
+        ClientId->UniqueProcess = (HANDLE)(ULONG_PTR)object->ProcessId;
+        ClientId->UniqueThread  = (HANDLE)(ULONG_PTR)object->ThreadId;
+    }
+
+    std::thread(RunSystemThread, object, StartRoutine, StartContext).detach();
+    return STATUS_SUCCESS;
+}
+
+// Unwinds back to RunSystemThread; the driver code in between holds no
+// host resources that need destructors
+extern "C" NTSTATUS PsTerminateSystemThread(NTSTATUS ExitStatus)
+{
+    if (!t_SystemThread) {
+        fprintf(stderr, "shim: PsTerminateSystemThread called outside a system thread\n");
+        abort();
+    }
+    throw SHIM_THREAD_EXIT{ ExitStatus };
+}
+
+
+// ========== Sections ==========
+//
+// Pagefile-backed sections are memfds, so the driver's system view and a
+// view mapped into the "current process" are separate mappings of the same
+// pages, and a PAGE_READONLY view really is read-only. Each view holds a
+// reference on its section; the section is freed once its handle, its views
+// and any ObReferenceObjectByHandle references are gone.
+//
+
+typedef struct _SHIM_SECTION {
+    SHIM_OBJECT_HEADER Header;
+    int    Fd;
+    SIZE_T Size;
+} SHIM_SECTION;
+
+typedef struct _SHIM_VIEW {
+    SHIM_SECTION* Section;
+    SIZE_T        Size;
+    ULONG         ProcessId;    // 0 for a system-space view
+} SHIM_VIEW;
+
+static _OBJECT_TYPE g_ShimSectionTypeObject = { ShimObjectSection };
+static POBJECT_TYPE g_ShimSectionType = &g_ShimSectionTypeObject;
+extern "C" { POBJECT_TYPE* MmSectionObjectType = &g_ShimSectionType; }
+
+static std::mutex g_ViewLock;
+static std::unordered_map<ULONG_PTR, SHIM_VIEW> g_Views;    // base address -> view
+
+static VOID DeleteSection(PVOID Object)
+{
+    SHIM_SECTION* section = (SHIM_SECTION*)Object;
+    close(section->Fd);
+    delete section;
+}
+
+extern "C" NTSTATUS ZwCreateSection(
+    PHANDLE SectionHandle, ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes, PLARGE_INTEGER MaximumSize, ULONG SectionPageProtection,
+    ULONG AllocationAttributes, HANDLE FileHandle)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(ObjectAttributes);
+    UNREFERENCED_PARAMETER(AllocationAttributes);
+
+    *SectionHandle = NULL;
+    if (FileHandle || !MaximumSize || MaximumSize->QuadPart <= 0) return STATUS_INVALID_PARAMETER;
+    if (SectionPageProtection != PAGE_READWRITE && SectionPageProtection != PAGE_READONLY)
+        return STATUS_INVALID_PAGE_PROTECTION;
+
+    int fd = memfd_create("osk-section", MFD_CLOEXEC);
+    if (fd < 0) return STATUS_INSUFFICIENT_RESOURCES;
+    if (ftruncate(fd, (off_t)MaximumSize->QuadPart) != 0) {
+        close(fd);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    SHIM_SECTION* section = new SHIM_SECTION;
+    section->Header.DispatcherType = 0;
+    section->Header.RefCount = 1;   // the handle
+    section->Header.Type     = ShimObjectSection;
+    section->Fd              = fd;
+    section->Size            = (SIZE_T)MaximumSize->QuadPart;
+    g_ObjectsOutstanding++;
+
+    std::lock_guard<std::mutex> guard(g_HandleLock);
+    ULONG_PTR handle = g_NextKernelHandle;
+    g_NextKernelHandle += 4;
+    g_SectionHandles[handle] = section;
+    *SectionHandle = (HANDLE)handle;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS MapView(SHIM_SECTION* Section, ULONG ProcessId, int Protection, PVOID* BaseAddress, PSIZE_T ViewSize)
+{
+    SIZE_T size = (*ViewSize && *ViewSize < Section->Size) ? *ViewSize : Section->Size;
+    PVOID base = mmap(NULL, size, Protection, MAP_SHARED, Section->Fd, 0);
+    if (base == MAP_FAILED) return STATUS_INSUFFICIENT_RESOURCES;
+
+    ObReferenceObject(Section);
+    std::lock_guard<std::mutex> guard(g_ViewLock);
+    g_Views[(ULONG_PTR)base] = SHIM_VIEW{ Section, size, ProcessId };
+    *BaseAddress = base;
+    *ViewSize    = size;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS UnmapView(PVOID BaseAddress, ULONG ProcessId)
+{
+    SHIM_VIEW view;
+    {
+        std::lock_guard<std::mutex> guard(g_ViewLock);
+        auto it = g_Views.find((ULONG_PTR)BaseAddress);
+        if (it == g_Views.end() || it->second.ProcessId != ProcessId) return STATUS_NOT_MAPPED_VIEW;
+        view = it->second;
+        g_Views.erase(it);
+    }
+    munmap(BaseAddress, view.Size);
+    ObDereferenceObject(view.Section);
+    return STATUS_SUCCESS;
+}
+
+static SHIM_SECTION* ReferenceSection(HANDLE SectionHandle)
+{
+    std::lock_guard<std::mutex> guard(g_HandleLock);
+    auto it = g_SectionHandles.find((ULONG_PTR)SectionHandle);
+    if (it == g_SectionHandles.end()) return NULL;
+    ObReferenceObject(it->second);
+    return (SHIM_SECTION*)it->second;
+}
+
+// The current process is the one the thread is attached to, else the caller
+static ULONG ViewProcessId(VOID)
+{
+    return t_AttachedProcessId ? t_AttachedProcessId : t_CurrentProcessId;
+}
+
+extern "C" NTSTATUS ZwMapViewOfSection(
+    HANDLE SectionHandle, HANDLE ProcessHandle, PVOID* BaseAddress,
+    ULONG_PTR ZeroBits, SIZE_T CommitSize, PLARGE_INTEGER SectionOffset, PSIZE_T ViewSize,
+    SECTION_INHERIT InheritDisposition, ULONG AllocationType, ULONG Win32Protect)
+{
+    UNREFERENCED_PARAMETER(ZeroBits);
+    UNREFERENCED_PARAMETER(CommitSize);
+    UNREFERENCED_PARAMETER(InheritDisposition);
+    UNREFERENCED_PARAMETER(AllocationType);
+
+    if (ProcessHandle != NtCurrentProcess()) return STATUS_NOT_SUPPORTED;
+    if (SectionOffset && SectionOffset->QuadPart != 0) return STATUS_NOT_SUPPORTED;
+    if (Win32Protect != PAGE_READONLY && Win32Protect != PAGE_READWRITE) return STATUS_INVALID_PAGE_PROTECTION;
+
+    SHIM_SECTION* section = ReferenceSection(SectionHandle);
+    if (!section) return STATUS_INVALID_HANDLE;
+
+    int protection = (Win32Protect == PAGE_READONLY) ? PROT_READ : PROT_READ | PROT_WRITE;
+    NTSTATUS status = MapView(section, ViewProcessId(), protection, BaseAddress, ViewSize);
+    ObDereferenceObject(section);
+    return status;
+}
+
+extern "C" NTSTATUS ZwUnmapViewOfSection(HANDLE ProcessHandle, PVOID BaseAddress)
+{
+    if (ProcessHandle != NtCurrentProcess()) return STATUS_NOT_SUPPORTED;
+    return UnmapView(BaseAddress, ViewProcessId());
+}
+
+extern "C" NTSTATUS MmMapViewInSystemSpace(PVOID Section, PVOID* MappedBase, PSIZE_T ViewSize)
+{
+    if (((SHIM_OBJECT_HEADER*)Section)->Type != ShimObjectSection) return STATUS_OBJECT_TYPE_MISMATCH;
+    return MapView((SHIM_SECTION*)Section, 0, PROT_READ | PROT_WRITE, MappedBase, ViewSize);
+}
+
+extern "C" NTSTATUS MmUnmapViewInSystemSpace(PVOID MappedBase)
+{
+    return UnmapView(MappedBase, 0);
+}
+
+// System thread and section handles can be referenced
+extern "C" NTSTATUS ObReferenceObjectByHandle(
+    HANDLE Handle, ACCESS_MASK DesiredAccess, POBJECT_TYPE ObjectType,
+    KPROCESSOR_MODE AccessMode, PVOID* Object, PVOID HandleInformation)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(AccessMode);
+    UNREFERENCED_PARAMETER(HandleInformation);
+
+    *Object = NULL;
+    std::lock_guard<std::mutex> guard(g_HandleLock);
+    if (!ObjectType || ObjectType == g_ShimThreadType) {
+        auto it = g_ThreadHandles.find((ULONG_PTR)Handle);
+        if (it != g_ThreadHandles.end()) {
+            ObReferenceObject(it->second);
+            *Object = it->second;
+            return STATUS_SUCCESS;
+        }
+    }
+    if (!ObjectType || ObjectType == g_ShimSectionType) {
+        auto it = g_SectionHandles.find((ULONG_PTR)Handle);
+        if (it != g_SectionHandles.end()) {
+            ObReferenceObject(it->second);
+            *Object = it->second;
+            return STATUS_SUCCESS;
+        }
+    }
+    if (ObjectType && ObjectType != g_ShimThreadType && ObjectType != g_ShimSectionType)
+        return STATUS_OBJECT_TYPE_MISMATCH;
+    return STATUS_INVALID_HANDLE;
+}
+
+// ========== Rundown protection ==========
+
+extern "C" VOID ExInitializeRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    RunRef->Count = 0;
+}
+
+extern "C" VOID ExReInitializeRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    WriteRelease64(&RunRef->Count, 0);
+}
+
+extern "C" BOOLEAN ExAcquireRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    LONG64 value = ReadNoFence64(&RunRef->Count);
+    for (;;) {
+        if (value & 1) return FALSE;
+        LONG64 seen = InterlockedCompareExchange64(&RunRef->Count, value + 2, value);
+        if (seen == value) return TRUE;
+        value = seen;
+    }
+}
+
+extern "C" VOID ExReleaseRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    InterlockedExchangeAdd64(&RunRef->Count, -2);
+}
+
+// Windows blocks on an event; the driver holds its references briefly, so yield instead
+extern "C" VOID ExWaitForRundownProtectionRelease(PEX_RUNDOWN_REF RunRef)
+{
+    LONG64 value = ReadNoFence64(&RunRef->Count);
+    for (;;) {
+        LONG64 seen = InterlockedCompareExchange64(&RunRef->Count, value | 1, value);
+        if (seen == value) break;
+        value = seen;
+    }
+    while (ReadAcquire64(&RunRef->Count) != 1)
+        std::this_thread::yield();
+}
+
+// ========== Executive resources ==========
+
+#define RESOURCE_EXCLUSIVE  1
+#define RESOURCE_WAITING    2
+#define RESOURCE_SHARED     4
+
+extern "C" NTSTATUS ExInitializeResourceLite(PERESOURCE Resource)
+{
+    Resource->State = 0;
+    return STATUS_SUCCESS;
+}
+
+extern "C" NTSTATUS ExDeleteResourceLite(PERESOURCE Resource)
+{
+    UNREFERENCED_PARAMETER(Resource);
+    return STATUS_SUCCESS;
+}
+
+extern "C" BOOLEAN ExAcquireResourceSharedLite(PERESOURCE Resource, BOOLEAN Wait)
+{
+    if (t_CriticalRegion <= 0) g_UnguardedAcquires++;
+
+    LONG64 value = ReadNoFence64(&Resource->State);
+    for (;;) {
+        if (value & (RESOURCE_EXCLUSIVE | RESOURCE_WAITING)) {
+            if (!Wait) return FALSE;
+            std::this_thread::yield();
+            value = ReadNoFence64(&Resource->State);
+            continue;
+        }
+        LONG64 seen = InterlockedCompareExchange64(&Resource->State, value + RESOURCE_SHARED, value);
+        if (seen == value) return TRUE;
+        value = seen;
+    }
+}
+
+extern "C" BOOLEAN ExAcquireResourceExclusiveLite(PERESOURCE Resource, BOOLEAN Wait)
+{
+    if (t_CriticalRegion <= 0) g_UnguardedAcquires++;
+
+    LONG64 value = ReadNoFence64(&Resource->State);
+    for (;;) {
+        if (value & ~(LONG64)RESOURCE_WAITING) {
+            if (!Wait) return FALSE;
+            // Announce the wait so sharers drain instead of starving the writer
+            if (!(value & RESOURCE_WAITING))
+                InterlockedCompareExchange64(&Resource->State, value | RESOURCE_WAITING, value);
+            std::this_thread::yield();
+            value = ReadNoFence64(&Resource->State);
+            continue;
+        }
+        LONG64 seen = InterlockedCompareExchange64(&Resource->State, RESOURCE_EXCLUSIVE, value);
+        if (seen == value) return TRUE;
+        value = seen;
+    }
+}
+
+extern "C" VOID ExReleaseResourceLite(PERESOURCE Resource)
+{
+    LONG64 value = ReadNoFence64(&Resource->State);
+    for (;;) {
+        LONG64 next = (value & RESOURCE_EXCLUSIVE) ? (value & RESOURCE_WAITING) : value - RESOURCE_SHARED;
+        LONG64 seen = InterlockedCompareExchange64(&Resource->State, next, value);
+        if (seen == value) return;
+        value = seen;
+    }
+}
+
+// ========== Notify routines ==========
+//
+// Up to SHIM_MAX_NOTIFY_ROUTINES of each kind, called in slot order on the
+// thread that reports the activity. Every notification counts itself in
+// g_NotifyActive while routines run, so removal can wait for them.
+//
+
+#define SHIM_MAX_NOTIFY_ROUTINES 8
+
+static std::atomic<PCREATE_PROCESS_NOTIFY_ROUTINE_EX> g_ProcessNotify[SHIM_MAX_NOTIFY_ROUTINES];
+static std::atomic<PCREATE_THREAD_NOTIFY_ROUTINE>     g_ThreadNotify[SHIM_MAX_NOTIFY_ROUTINES];
+static std::atomic<PLOAD_IMAGE_NOTIFY_ROUTINE>        g_ImageNotify[SHIM_MAX_NOTIFY_ROUTINES];
+static std::atomic<LONG> g_NotifyActive(0);
+
+template <typename T>
+static NTSTATUS AddNotifyRoutine(std::atomic<T>* Slots, T Routine)
+{
+    for (ULONG i = 0; i < SHIM_MAX_NOTIFY_ROUTINES; i++) {
+        if (Slots[i].load() == Routine) return STATUS_INVALID_PARAMETER;
+    }
+    for (ULONG i = 0; i < SHIM_MAX_NOTIFY_ROUTINES; i++) {
+        T expected = NULL;
+        if (Slots[i].compare_exchange_strong(expected, Routine)) return STATUS_SUCCESS;
+    }
+    return STATUS_INSUFFICIENT_RESOURCES;
+}
+
+template <typename T>
+static NTSTATUS RemoveNotifyRoutine(std::atomic<T>* Slots, T Routine)
+{
+    for (ULONG i = 0; i < SHIM_MAX_NOTIFY_ROUTINES; i++) {
+        T expected = Routine;
+        if (Slots[i].compare_exchange_strong(expected, (T)NULL)) {
+            while (g_NotifyActive.load())
+                std::this_thread::yield();
+            return STATUS_SUCCESS;
+        }
+    }
+    return STATUS_PROCEDURE_NOT_FOUND;
+}
+
+extern "C" NTSTATUS PsSetCreateProcessNotifyRoutineEx(PCREATE_PROCESS_NOTIFY_ROUTINE_EX NotifyRoutine, BOOLEAN Remove)
+{
+    return Remove ? RemoveNotifyRoutine(g_ProcessNotify, NotifyRoutine)
+                  : AddNotifyRoutine(g_ProcessNotify, NotifyRoutine);
+}
+
+extern "C" NTSTATUS PsSetCreateThreadNotifyRoutine(PCREATE_THREAD_NOTIFY_ROUTINE NotifyRoutine)
+{
+    return AddNotifyRoutine(g_ThreadNotify, NotifyRoutine);
+}
+
+extern "C" NTSTATUS PsRemoveCreateThreadNotifyRoutine(PCREATE_THREAD_NOTIFY_ROUTINE NotifyRoutine)
+{
+    return RemoveNotifyRoutine(g_ThreadNotify, NotifyRoutine);
+}
+
+extern "C" NTSTATUS PsSetLoadImageNotifyRoutine(PLOAD_IMAGE_NOTIFY_ROUTINE NotifyRoutine)
+{
+    return AddNotifyRoutine(g_ImageNotify, NotifyRoutine);
+}
+
+extern "C" NTSTATUS PsRemoveLoadImageNotifyRoutine(PLOAD_IMAGE_NOTIFY_ROUTINE NotifyRoutine)
+{
+    return RemoveNotifyRoutine(g_ImageNotify, NotifyRoutine);
+}
+
+static VOID NotifyProcess(PEPROCESS Process, PPS_CREATE_NOTIFY_INFO CreateInfo)
+{
+    g_NotifyActive++;
+    for (auto& slot : g_ProcessNotify) {
+        PCREATE_PROCESS_NOTIFY_ROUTINE_EX routine = slot.load();
+        if (routine) routine(Process, (HANDLE)(ULONG_PTR)Process->ProcessId, CreateInfo);
+    }
+    g_NotifyActive--;
+}
+
+// The snapshot's process when it has one; otherwise a new process created
+// now in the session of ParentProcessId
+static PEPROCESS NotifyProcessObject(ULONG ProcessId, ULONG ParentProcessId)
+{
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_PROCESS* process = ShimFindProcess(ProcessId);
+    if (process) return NewProcessObject(process);
+
+    SHIM_PROCESS* parent = ShimFindProcess(ParentProcessId);
+    LARGE_INTEGER now;
+    KeQuerySystemTimePrecise(&now);
+    return NewProcessObject(ProcessId, now.QuadPart, parent ? parent->SessionId : 0);
+}
+
+VOID ShimNotifyProcessCreate(ULONG ProcessId, ULONG ParentProcessId, const WCHAR* ImageFileName)
+{
+    UNICODE_STRING name;
+    RtlInitUnicodeString(&name, ImageFileName);
+
+    PS_CREATE_NOTIFY_INFO info = {};
+    info.Size            = sizeof(info);
+    info.ParentProcessId = (HANDLE)(ULONG_PTR)ParentProcessId;
+    info.CreatingThreadId.UniqueProcess = (HANDLE)(ULONG_PTR)ParentProcessId;
+    info.ImageFileName   = &name;
+
+    PEPROCESS object = NotifyProcessObject(ProcessId, ParentProcessId);
+    NotifyProcess(object, &info);
+    ObDereferenceObject(object);
+}
+
+VOID ShimNotifyProcessExit(ULONG ProcessId)
+{
+    PEPROCESS object = NotifyProcessObject(ProcessId, 0);
+    NotifyProcess(object, NULL);
+    ObDereferenceObject(object);
+}
+
+VOID ShimNotifyThread(ULONG ProcessId, ULONG ThreadId, BOOLEAN Create)
+{
+    g_NotifyActive++;
+    for (auto& slot : g_ThreadNotify) {
+        PCREATE_THREAD_NOTIFY_ROUTINE routine = slot.load();
+        if (routine) routine((HANDLE)(ULONG_PTR)ProcessId, (HANDLE)(ULONG_PTR)ThreadId, Create);
+    }
+    g_NotifyActive--;
+}
+
+VOID ShimNotifyImageLoad(ULONG ProcessId, const WCHAR* FullImageName, ULONG64 ImageBase, SIZE_T ImageSize)
+{
+    UNICODE_STRING name;
+    RtlInitUnicodeString(&name, FullImageName);
+
+    IMAGE_INFO info = {};
+    info.SystemModeImage = (ProcessId == 0);
+    info.ImageBase       = (PVOID)(ULONG_PTR)ImageBase;
+    info.ImageSize       = ImageSize;
+
+    g_NotifyActive++;
+    for (auto& slot : g_ImageNotify) {
+        PLOAD_IMAGE_NOTIFY_ROUTINE routine = slot.load();
+        if (routine) routine(&name, (HANDLE)(ULONG_PTR)ProcessId, &info);
+    }
+    g_NotifyActive--;
+}
+
+// ========== ZwQuerySystemInformation ==========
+//
+// Buffers are laid out exactly as x64 Windows returns them, including the
+// parts the modules skip (thread arrays, trailing name storage), so buffer
+// sizes and copy costs match a real machine with the same snapshot.
+//
+
+#define SystemProcessInformation    5
+#define SystemModuleInformation     11
+#define SystemHandleInformation     16
+
+typedef struct _SHIM_SYSTEM_PROCESS_INFORMATION {
+    ULONG          NextEntryOffset;
+    ULONG          NumberOfThreads;
+    LARGE_INTEGER  WorkingSetPrivateSize;
+    ULONG          HardFaultCount;
+    ULONG          NumberOfThreadsHighWatermark;
+    ULONGLONG      CycleTime;
+    LARGE_INTEGER  CreateTime;
+    LARGE_INTEGER  UserTime;
+    LARGE_INTEGER  KernelTime;
+    UNICODE_STRING ImageName;
+    KPRIORITY      BasePriority;
+    HANDLE         UniqueProcessId;
+    HANDLE         InheritedFromUniqueProcessId;
+    ULONG          HandleCount;
+    ULONG          SessionId;
+    ULONG_PTR      UniqueProcessKey;
+    SIZE_T         PeakVirtualSize;
+    SIZE_T         VirtualSize;
+    ULONG          PageFaultCount;
+    SIZE_T         PeakWorkingSetSize;
+    SIZE_T         WorkingSetSize;
+    SIZE_T         QuotaPeakPagedPoolUsage;
+    SIZE_T         QuotaPagedPoolUsage;
+    SIZE_T         QuotaPeakNonPagedPoolUsage;
+    SIZE_T         QuotaNonPagedPoolUsage;
+    SIZE_T         PagefileUsage;
+    SIZE_T         PeakPagefileUsage;
+    SIZE_T         PrivatePageCount;
+    LARGE_INTEGER  ReadOperationCount;
+    LARGE_INTEGER  WriteOperationCount;
+    LARGE_INTEGER  OtherOperationCount;
+    LARGE_INTEGER  ReadTransferCount;
+    LARGE_INTEGER  WriteTransferCount;
+    LARGE_INTEGER  OtherTransferCount;
+} SHIM_SYSTEM_PROCESS_INFORMATION;
+C_ASSERT(sizeof(SHIM_SYSTEM_PROCESS_INFORMATION) == 0x100);
+
+typedef struct _SHIM_SYSTEM_THREAD_INFORMATION {
+    LARGE_INTEGER KernelTime;
+    LARGE_INTEGER UserTime;
+    LARGE_INTEGER CreateTime;
+    ULONG         WaitTime;
+    PVOID         StartAddress;
+    CLIENT_ID     ClientId;
+    KPRIORITY     Priority;
+    LONG          BasePriority;
+    ULONG         ContextSwitches;
+    ULONG         ThreadState;
+    ULONG         WaitReason;
+} SHIM_SYSTEM_THREAD_INFORMATION;
+C_ASSERT(sizeof(SHIM_SYSTEM_THREAD_INFORMATION) == 0x50);
+
+typedef struct _SHIM_SYSTEM_HANDLE_ENTRY {
+    USHORT UniqueProcessId;
+    USHORT CreatorBackTraceIndex;
+    UCHAR  ObjectTypeIndex;
+    UCHAR  HandleAttributes;
+    USHORT HandleValue;
+    PVOID  Object;
+    ULONG  GrantedAccess;
+} SHIM_SYSTEM_HANDLE_ENTRY;
+C_ASSERT(sizeof(SHIM_SYSTEM_HANDLE_ENTRY) == 24);
+
+typedef struct _SHIM_SYSTEM_MODULE_ENTRY {
+    HANDLE Section;
+    PVOID  MappedBase;
+    PVOID  ImageBase;
+    ULONG  ImageSize;
+    ULONG  Flags;
+    USHORT LoadOrderIndex;
+    USHORT InitOrderIndex;
+    USHORT LoadCount;
+    USHORT OffsetToFileName;
+    UCHAR  FullPathName[256];
+} SHIM_SYSTEM_MODULE_ENTRY;
+C_ASSERT(sizeof(SHIM_SYSTEM_MODULE_ENTRY) == 296);
+
+// Both list classes start with a ULONG count padded to pointer alignment
+#define SHIM_LIST_HEADER_SIZE 8
+
+static SIZE_T ProcessEntrySize(const SHIM_PROCESS& Process)
+{
+    SIZE_T size = sizeof(SHIM_SYSTEM_PROCESS_INFORMATION) +
+        Process.Threads.size() * sizeof(SHIM_SYSTEM_THREAD_INFORMATION) +
+        (Process.ImageName.size() + 1) * sizeof(WCHAR);
+    return (size + 7) & ~(SIZE_T)7;
+}
+
+static SIZE_T QueryProcessInformation(PUCHAR Buffer, SIZE_T Length, BOOLEAN* Fits)
+{
+    const auto& procs = g_ShimSystem.Processes;
+    SIZE_T required = 0;
+    for (const auto& p : procs) required += ProcessEntrySize(p);
+
+    *Fits = required <= Length;
+    if (!*Fits) return required;
+
+    PUCHAR cursor = Buffer;
+    for (size_t i = 0; i < procs.size(); i++) {
+        const SHIM_PROCESS& p = procs[i];
+        SIZE_T entrySize = ProcessEntrySize(p);
+        RtlZeroMemory(cursor, entrySize);
+
+        SHIM_SYSTEM_PROCESS_INFORMATION* info = (SHIM_SYSTEM_PROCESS_INFORMATION*)cursor;
+        info->NextEntryOffset = (i + 1 < procs.size()) ? (ULONG)entrySize : 0;
+        info->NumberOfThreads = (ULONG)p.Threads.size();
+        info->CreateTime.QuadPart = p.CreateTime;
+        info->KernelTime.QuadPart = p.KernelTime;
+        info->UserTime.QuadPart = p.UserTime;
+        info->BasePriority = 8;
+        info->UniqueProcessId = (HANDLE)(ULONG_PTR)p.ProcessId;
+        info->InheritedFromUniqueProcessId = (HANDLE)(ULONG_PTR)p.ParentProcessId;
+        info->HandleCount = (ULONG)p.Handles.size();
+        info->SessionId = p.SessionId;
+        info->UniqueProcessKey = p.ProcessId;
+        info->WorkingSetSize = p.WorkingSetSize;
+        info->PeakWorkingSetSize = p.PeakWorkingSetSize;
+
+        SHIM_SYSTEM_THREAD_INFORMATION* threads = (SHIM_SYSTEM_THREAD_INFORMATION*)(info + 1);
+        for (size_t t = 0; t < p.Threads.size(); t++) {
+            threads[t].CreateTime.QuadPart = p.CreateTime;
+            threads[t].StartAddress = (PVOID)(ULONG_PTR)p.Threads[t].StartAddress;
+            threads[t].ClientId.UniqueProcess = (HANDLE)(ULONG_PTR)p.ProcessId;
+            threads[t].ClientId.UniqueThread = (HANDLE)(ULONG_PTR)p.Threads[t].ThreadId;
+            threads[t].Priority = p.Threads[t].Priority;
+            threads[t].BasePriority = 8;
+            threads[t].ThreadState = p.Threads[t].State;
+            threads[t].WaitReason = p.Threads[t].WaitReason;
+            threads[t].ContextSwitches = p.Threads[t].ContextSwitches;
+            threads[t].KernelTime.QuadPart = p.Threads[t].KernelTime;
+            threads[t].UserTime.QuadPart = p.Threads[t].UserTime;
+        }
+
+        PWCH name = (PWCH)(threads + p.Threads.size());
+        RtlCopyMemory(name, p.ImageName.data(), p.ImageName.size() * sizeof(WCHAR));
+        if (!p.ImageName.empty()) {
+            info->ImageName.Buffer = name;
+            info->ImageName.Length = (USHORT)(p.ImageName.size() * sizeof(WCHAR));
+            info->ImageName.MaximumLength = (USHORT)(info->ImageName.Length + sizeof(WCHAR));
+        }
+
+        cursor += entrySize;
+    }
+    return required;
+}
+
+static SIZE_T QueryHandleInformation(PUCHAR Buffer, SIZE_T Length, BOOLEAN* Fits)
+{
+    SIZE_T count = 0;
+    for (const auto& p : g_ShimSystem.Processes) count += p.Handles.size();
+
+    SIZE_T required = SHIM_LIST_HEADER_SIZE + count * sizeof(SHIM_SYSTEM_HANDLE_ENTRY);
+    *Fits = required <= Length;
+    if (!*Fits) return required;
+
+    *(PULONG)Buffer = (ULONG)count;
+    SHIM_SYSTEM_HANDLE_ENTRY* entry = (SHIM_SYSTEM_HANDLE_ENTRY*)(Buffer + SHIM_LIST_HEADER_SIZE);
+    for (const auto& p : g_ShimSystem.Processes) {
+        for (const auto& h : p.Handles) {
+            RtlZeroMemory(entry, sizeof(*entry));
+            entry->UniqueProcessId  = (USHORT)p.ProcessId;
+            entry->ObjectTypeIndex  = h.ObjectTypeIndex;
+            entry->HandleAttributes = h.Attributes;
+            entry->HandleValue      = h.Value;
+            entry->Object           = (PVOID)(ULONG_PTR)h.Object;
+            entry->GrantedAccess    = h.GrantedAccess;
+            entry++;
+        }
+    }
+    return required;
+}
+
+static SIZE_T QueryModuleInformation(PUCHAR Buffer, SIZE_T Length, BOOLEAN* Fits)
+{
+    const auto& modules = g_ShimSystem.Modules;
+    SIZE_T required = SHIM_LIST_HEADER_SIZE + modules.size() * sizeof(SHIM_SYSTEM_MODULE_ENTRY);
+    *Fits = required <= Length;
+    if (!*Fits) return required;
+
+    *(PULONG)Buffer = (ULONG)modules.size();
+    SHIM_SYSTEM_MODULE_ENTRY* entry = (SHIM_SYSTEM_MODULE_ENTRY*)(Buffer + SHIM_LIST_HEADER_SIZE);
+    for (size_t i = 0; i < modules.size(); i++, entry++) {
+        const SHIM_MODULE& m = modules[i];
+        RtlZeroMemory(entry, sizeof(*entry));
+        entry->ImageBase      = (PVOID)(ULONG_PTR)m.ImageBase;
+        entry->ImageSize      = m.ImageSize;
+        entry->LoadOrderIndex = (USHORT)i;
+        entry->InitOrderIndex = (USHORT)i;
+        entry->LoadCount      = 1;
+
+        size_t pathLen = min(m.FullPath.size(), sizeof(entry->FullPathName) - 1);
+        RtlCopyMemory(entry->FullPathName, m.FullPath.data(), pathLen);
+        size_t slash = m.FullPath.find_last_of('\\', pathLen ? pathLen - 1 : 0);
+        entry->OffsetToFileName = (slash == std::string::npos) ? 0 : (USHORT)(slash + 1);
+    }
+    return required;
+}
+
+static std::mutex g_QueryGateLock;
+static std::condition_variable g_QueryGateSignal;
+static bool  g_QueryGateHeld = false;
+static ULONG g_QueryGateClass = 0;
+static ULONG g_QueryGateBlocked = 0;
+
+VOID ShimHoldSystemQueries(ULONG InformationClass)
+{
+    std::lock_guard<std::mutex> guard(g_QueryGateLock);
+    g_QueryGateHeld  = true;
+    g_QueryGateClass = InformationClass;
+}
+
+VOID ShimWaitHeldSystemQueries(ULONG Count)
+{
+    std::unique_lock<std::mutex> lock(g_QueryGateLock);
+    g_QueryGateSignal.wait(lock, [Count] { return g_QueryGateBlocked >= Count; });
+}
+
+VOID ShimReleaseSystemQueries(VOID)
+{
+    std::lock_guard<std::mutex> guard(g_QueryGateLock);
+    g_QueryGateHeld = false;
+    g_QueryGateSignal.notify_all();
+}
+
+static VOID PassQueryGate(ULONG SystemInformationClass)
+{
+    std::unique_lock<std::mutex> lock(g_QueryGateLock);
+    if (!g_QueryGateHeld || g_QueryGateClass != SystemInformationClass) return;
+
+    g_QueryGateBlocked++;
+    g_QueryGateSignal.notify_all();
+    g_QueryGateSignal.wait(lock, [] { return !g_QueryGateHeld; });
+    g_QueryGateBlocked--;
+}
+
+extern "C" NTSTATUS NTAPI ZwQuerySystemInformation(
+    ULONG SystemInformationClass, PVOID SystemInformation,
+    ULONG SystemInformationLength, PULONG ReturnLength)
+{
+    PassQueryGate(SystemInformationClass);
+
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    g_SystemQueries++;
+
+    PUCHAR buffer = SystemInformation ? (PUCHAR)SystemInformation : NULL;
+    SIZE_T length = buffer ? SystemInformationLength : 0;
+    BOOLEAN fits = FALSE;
+    SIZE_T required;
+
+    switch (SystemInformationClass) {
+    case SystemProcessInformation: required = QueryProcessInformation(buffer, length, &fits); break;
+    case SystemHandleInformation:  required = QueryHandleInformation(buffer, length, &fits);  break;
+    case SystemModuleInformation:  required = QueryModuleInformation(buffer, length, &fits);  break;
+    default:
+        return STATUS_INVALID_INFO_CLASS;
+    }
+
+    if (required > MAXULONG) return STATUS_INSUFFICIENT_RESOURCES;
+    if (ReturnLength) *ReturnLength = (ULONG)required;
+    return fits ? STATUS_SUCCESS : STATUS_INFO_LENGTH_MISMATCH;
+}
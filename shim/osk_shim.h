@@ -0,0 +1,157 @@
+#pragma once
+
+//
+// OpenSysKit host shim
+//
+// Runs the driver's dispatch and enumeration code in a normal process.
+// The simulated kernel APIs (include/ntddk.h) answer from a system
+// snapshot: processes with their threads and handles, plus loaded kernel
+// modules. A snapshot is either loaded from a text file recorded on a real
+// machine or synthesized at a chosen scale.
+//
+// Snapshot file format, one record per line ('#' starts a comment):
+//
+//   process <pid> <ppid> <create-time> <working-set> <session> [critical] <image name>
+//   thread  <tid> <priority> <start-address-hex> [terminating]
+//   handle  <value-hex> <type-index> <granted-access-hex> <object-hex>
+//   module  <base-hex> <size> <full path>
+//
+// thread and handle records belong to the preceding process.
+//
+
+#include <ntddk.h>
+
+#include <string>
+
+// ========== Snapshot ==========
+
+typedef struct _SHIM_SYNTHETIC_SPEC {
+    ULONG Processes;
+    ULONG ThreadsPerProcess;
+    ULONG HandlesPerProcess;
+    ULONG KernelModules;
+    ULONG Seed;
+} SHIM_SYNTHETIC_SPEC;
+
+// Replaces the current snapshot. Returns false and sets *Error on a
+// malformed file.
+bool ShimLoadSnapshot(const char* Path, std::string* Error);
+VOID ShimSynthesizeSnapshot(const SHIM_SYNTHETIC_SPEC* Spec);
+
+typedef struct _SHIM_SNAPSHOT_COUNTS {
+    ULONG Processes;
+    ULONG Threads;
+    ULONG Handles;
+    ULONG KernelModules;
+} SHIM_SNAPSHOT_COUNTS;
+
+SHIM_SNAPSHOT_COUNTS ShimSnapshotCounts(VOID);
+
+// Change what later SystemProcessInformation queries report for the
+// process; the peak working set follows the largest value set, and added
+// CPU time is also charged to the process's first thread. Return false if
+// the snapshot has no such process.
+bool ShimSetWorkingSet(ULONG ProcessId, SIZE_T WorkingSetSize);
+bool ShimAddCpuTime(ULONG ProcessId, LONGLONG KernelTime, LONGLONG UserTime);
+
+// ========== Driver and device ==========
+
+typedef NTSTATUS (*PSHIM_DRIVER_ENTRY)(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+
+NTSTATUS ShimLoadDriver(PSHIM_DRIVER_ENTRY DriverEntry);
+VOID     ShimUnloadDriver(VOID);
+
+// Opens the device as process CallerPid (IRP_MJ_CREATE). NULL on failure.
+// Overlapped opens the handle without FO_SYNCHRONOUS_IO, as
+// FILE_FLAG_OVERLAPPED does, so the driver may pend its IRPs.
+PFILE_OBJECT ShimOpenDevice(ULONG CallerPid, BOOLEAN Overlapped = FALSE);
+
+// IRP_MJ_CLEANUP, then IRP_MJ_CLOSE once every outstanding IRP on the
+// handle has completed
+VOID ShimCloseDevice(PFILE_OBJECT FileObject);
+
+// Only the IRP_MJ_CLEANUP half, so a test can act between the two;
+// ShimCloseDevice still has to be called and then skips the cleanup
+VOID ShimCleanupDevice(PFILE_OBJECT FileObject);
+
+// DeviceIoControl as the I/O manager would perform it for the transfer
+// type encoded in IoControlCode. *BytesReturned receives
+// IoStatus.Information. Waits if the driver pends the IRP.
+NTSTATUS ShimDeviceIoControl(
+    PFILE_OBJECT FileObject, ULONG IoControlCode,
+    const VOID* InputBuffer, ULONG InputBufferLength,
+    PVOID OutputBuffer, ULONG OutputBufferLength,
+    PULONG BytesReturned);
+
+// Overlapped DeviceIoControl. Returns what the dispatch routine returned:
+// STATUS_PENDING while the driver still owns the IRP, otherwise the final
+// status. Unless *Request is NULL (the IRP was never sent), it must be
+// passed to ShimWaitIo, which waits for completion, copies buffered output
+// back and frees the request. Buffers must stay valid until then.
+typedef struct _SHIM_ASYNC_IO* PSHIM_ASYNC_IO;
+
+NTSTATUS ShimDeviceIoControlAsync(
+    PFILE_OBJECT FileObject, ULONG IoControlCode,
+    const VOID* InputBuffer, ULONG InputBufferLength,
+    PVOID OutputBuffer, ULONG OutputBufferLength,
+    PSHIM_ASYNC_IO* Request);
+
+// CancelIoEx: IoCancelIrp on the request's IRP
+BOOLEAN  ShimCancelIo(PSHIM_ASYNC_IO Request);
+NTSTATUS ShimWaitIo(PSHIM_ASYNC_IO Request, PULONG BytesReturned);
+
+// ========== Notifications ==========
+//
+// Run the registered process, thread and image notify routines on the
+// calling thread, as the kernel does in the context of the process or
+// thread involved. Process notifications pass a process object: the
+// snapshot's process when it has one, otherwise one created at the time of
+// the call in the parent's session. The snapshot is left alone, except that
+// ZwTerminateProcess removes the process and then reports its exit itself.
+//
+
+VOID ShimNotifyProcessCreate(ULONG ProcessId, ULONG ParentProcessId, const WCHAR* ImageFileName);
+VOID ShimNotifyProcessExit(ULONG ProcessId);
+VOID ShimNotifyThread(ULONG ProcessId, ULONG ThreadId, BOOLEAN Create);
+
+// ProcessId 0 reports a driver load (SystemModeImage)
+VOID ShimNotifyImageLoad(ULONG ProcessId, const WCHAR* FullImageName, ULONG64 ImageBase, SIZE_T ImageSize);
+
+// ========== Signature ==========
+//
+// The stub VerifyCallerSignature (shim/stubs.cpp) answers from the
+// driver's PID index (src/sigpid.h) like the real hit path. A caller it
+// has no verdict for gets the one set here, SignatureValid by default,
+// without any image being read.
+//
+
+VOID  ShimSetCallerSignature(ULONG Status);    // SIGNATURE_STATUS
+ULONG ShimSignatureChecks(VOID);                // VerifyCallerSignature calls so far
+
+// ========== Accounting ==========
+
+typedef struct _SHIM_STATS {
+    ULONG64 PoolAllocations;
+    ULONG64 PoolFrees;
+    ULONG64 PoolBytesOutstanding;
+    LONG64  ObjectsOutstanding;     // process/thread objects not yet dereferenced
+    ULONG64 IoBufferBytes;          // system buffers allocated by the I/O manager
+    ULONG64 IoCopiedBytes;          // bytes copied between caller and system buffers
+    ULONG64 IoMappedBytes;          // caller bytes described by MDLs (direct I/O, no copy)
+    ULONG64 SystemQueries;          // ZwQuerySystemInformation calls, any class
+    ULONG64 UnguardedAcquires;      // resources acquired outside a critical region
+} SHIM_STATS;
+
+SHIM_STATS ShimGetStats(VOID);
+
+// While held, ZwQuerySystemInformation calls for InformationClass block
+// before reading the snapshot, which parks a request at a known point
+// inside the driver. ShimWaitHeldSystemQueries returns once Count callers
+// are blocked; ShimReleaseSystemQueries lets them all continue.
+VOID ShimHoldSystemQueries(ULONG InformationClass);
+VOID ShimWaitHeldSystemQueries(ULONG Count);
+VOID ShimReleaseSystemQueries(VOID);
+VOID       ShimResetIoStats(VOID);
+
+// DbgPrint output goes to stderr when enabled (off by default)
+VOID ShimSetDebugOutput(BOOLEAN Enabled);
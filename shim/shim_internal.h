@@ -0,0 +1,71 @@
+#pragma once
+
+//
+// State shared between the shim's translation units
+//
+
+#include "osk_shim.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef struct _SHIM_THREAD {
+    ULONG    ThreadId;
+    LONG     Priority;
+    ULONG64  StartAddress;
+    BOOLEAN  Terminating;
+    ULONG    State;             // KTHREAD_STATE
+    ULONG    WaitReason;
+    ULONG    ContextSwitches;
+    LONGLONG KernelTime;        // 100ns
+    LONGLONG UserTime;
+} SHIM_THREAD;
+
+typedef struct _SHIM_HANDLE {
+    USHORT  Value;
+    UCHAR   ObjectTypeIndex;
+    UCHAR   Attributes;
+    ULONG   GrantedAccess;
+    ULONG64 Object;
+} SHIM_HANDLE;
+
+typedef struct _SHIM_PROCESS {
+    ULONG          ProcessId;
+    ULONG          ParentProcessId;
+    LONGLONG       CreateTime;
+    SIZE_T         WorkingSetSize;
+    SIZE_T         PeakWorkingSetSize;
+    LONGLONG       KernelTime;      // 100ns
+    LONGLONG       UserTime;
+    ULONG          SessionId;
+    BOOLEAN        Critical;
+    std::u16string ImageName;
+    std::vector<SHIM_THREAD> Threads;
+    std::vector<SHIM_HANDLE> Handles;
+} SHIM_PROCESS;
+
+typedef struct _SHIM_MODULE {
+    ULONG64     ImageBase;
+    ULONG       ImageSize;
+    std::string FullPath;
+} SHIM_MODULE;
+
+typedef struct _SHIM_SYSTEM {
+    std::mutex Lock;
+    std::vector<SHIM_PROCESS> Processes;    // sorted by ProcessId
+    std::vector<SHIM_MODULE>  Modules;
+} SHIM_SYSTEM;
+
+extern SHIM_SYSTEM g_ShimSystem;
+
+// Caller must hold g_ShimSystem.Lock
+SHIM_PROCESS* ShimFindProcess(ULONG ProcessId);
+
+// Process the "current thread" runs in: the device opener during dispatch
+VOID  ShimSetCurrentProcessId(ULONG ProcessId);
+ULONG ShimGetCurrentProcessId(VOID);
+
+VOID ShimNoteIoBuffer(SIZE_T Allocated, SIZE_T Copied);
+VOID ShimNoteIoMapping(SIZE_T Mapped);
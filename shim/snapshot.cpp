@@ -0,0 +1,260 @@
+//
+// Host shim: system snapshots
+//
+
+#include "shim_internal.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+SHIM_SYSTEM g_ShimSystem;
+
+SHIM_PROCESS* ShimFindProcess(ULONG ProcessId)
+{
+    auto& procs = g_ShimSystem.Processes;
+    auto it = std::lower_bound(procs.begin(), procs.end(), ProcessId,
+        [](const SHIM_PROCESS& p, ULONG pid) { return p.ProcessId < pid; });
+    return (it != procs.end() && it->ProcessId == ProcessId) ? &*it : nullptr;
+}
+
+static std::u16string Utf8ToUtf16(const std::string& s)
+{
+    std::u16string out;
+    for (size_t i = 0; i < s.size(); ) {
+        unsigned char c = (unsigned char)s[i];
+        char32_t cp;
+        size_t n;
+        if (c < 0x80)              { cp = c;        n = 1; }
+        else if ((c >> 5) == 0x6)  { cp = c & 0x1F; n = 2; }
+        else if ((c >> 4) == 0xE)  { cp = c & 0x0F; n = 3; }
+        else if ((c >> 3) == 0x1E) { cp = c & 0x07; n = 4; }
+        else                       { cp = 0xFFFD;   n = 1; }
+        if (i + n > s.size()) { cp = 0xFFFD; n = s.size() - i; }
+        for (size_t k = 1; k < n; k++) cp = (cp << 6) | ((unsigned char)s[i + k] & 0x3F);
+        i += n;
+
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            out.push_back((char16_t)(0xD800 + (cp >> 10)));
+            out.push_back((char16_t)(0xDC00 + (cp & 0x3FF)));
+        } else {
+            out.push_back((char16_t)cp);
+        }
+    }
+    return out;
+}
+
+static std::string RestOfLine(std::istringstream& in)
+{
+    std::string rest;
+    std::getline(in >> std::ws, rest);
+    while (!rest.empty() && (rest.back() == '\r' || rest.back() == ' '))
+        rest.pop_back();
+    return rest;
+}
+
+bool ShimLoadSnapshot(const char* Path, std::string* Error)
+{
+    std::ifstream file(Path);
+    if (!file) {
+        if (Error) *Error = std::string("cannot open ") + Path;
+        return false;
+    }
+
+    std::vector<SHIM_PROCESS> processes;
+    std::vector<SHIM_MODULE> modules;
+    std::string line;
+    ULONG lineNo = 0;
+
+    auto fail = [&](const char* what) {
+        if (Error) *Error = std::string(Path) + ":" + std::to_string(lineNo) + ": " + what;
+        return false;
+    };
+
+    while (std::getline(file, line)) {
+        lineNo++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+
+        std::istringstream in(line);
+        std::string kind;
+        if (!(in >> kind)) continue;
+
+        if (kind == "process") {
+            SHIM_PROCESS p = {};
+            if (!(in >> p.ProcessId >> p.ParentProcessId >> p.CreateTime >> p.WorkingSetSize >> p.SessionId))
+                return fail("malformed process record");
+            p.PeakWorkingSetSize = p.WorkingSetSize;
+            std::string name = RestOfLine(in);
+            if (name.rfind("critical ", 0) == 0) {
+                p.Critical = TRUE;
+                name.erase(0, 9);
+            }
+            p.ImageName = Utf8ToUtf16(name);
+            processes.push_back(std::move(p));
+        } else if (kind == "thread") {
+            if (processes.empty()) return fail("thread record before any process");
+            SHIM_THREAD t = {};
+            std::string terminating;
+            if (!(in >> t.ThreadId >> t.Priority >> std::hex >> t.StartAddress))
+                return fail("malformed thread record");
+            t.Terminating = (in >> terminating && terminating == "terminating") ? TRUE : FALSE;
+            processes.back().Threads.push_back(t);
+        } else if (kind == "handle") {
+            if (processes.empty()) return fail("handle record before any process");
+            SHIM_HANDLE h = {};
+            ULONG value, type;
+            if (!(in >> std::hex >> value >> std::dec >> type >> std::hex >> h.GrantedAccess >> h.Object))
+                return fail("malformed handle record");
+            h.Value = (USHORT)value;
+            h.ObjectTypeIndex = (UCHAR)type;
+            processes.back().Handles.push_back(h);
+        } else if (kind == "module") {
+            SHIM_MODULE m = {};
+            if (!(in >> std::hex >> m.ImageBase >> std::dec >> m.ImageSize))
+                return fail("malformed module record");
+            m.FullPath = RestOfLine(in);
+            modules.push_back(std::move(m));
+        } else {
+            return fail("unknown record type");
+        }
+    }
+
+    std::sort(processes.begin(), processes.end(),
+        [](const SHIM_PROCESS& a, const SHIM_PROCESS& b) { return a.ProcessId < b.ProcessId; });
+
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    g_ShimSystem.Processes = std::move(processes);
+    g_ShimSystem.Modules   = std::move(modules);
+    return true;
+}
+
+//
+// Synthetic snapshots: deterministic for a given seed, with the shape of a
+// busy desktop (System + svchost-heavy process mix, mostly File/Key/Event
+// handles) so enumeration cost scales the way it does on a real machine.
+//
+
+static ULONG NextRandom(ULONG* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+VOID ShimSynthesizeSnapshot(const SHIM_SYNTHETIC_SPEC* Spec)
+{
+    static const char* s_Images[] = {
+        "svchost.exe", "svchost.exe", "svchost.exe", "RuntimeBroker.exe", "conhost.exe",
+        "explorer.exe", "chrome.exe", "chrome.exe", "Code.exe", "dllhost.exe",
+        "SearchHost.exe", "MsMpEng.exe", "lsass.exe", "csrss.exe", "winlogon.exe",
+    };
+    // ObjectTypeIndex values roughly as on Windows 11: File, Key, Event, Section, Thread
+    static const UCHAR s_HandleTypes[] = { 37, 37, 37, 44, 44, 16, 16, 42, 8 };
+
+    ULONG rng = Spec->Seed ? Spec->Seed : 0x4F534B31;
+    std::vector<SHIM_PROCESS> processes;
+    processes.reserve(Spec->Processes);
+
+    ULONG nextTid = 8;
+    for (ULONG i = 0; i < Spec->Processes; i++) {
+        SHIM_PROCESS p = {};
+        p.ProcessId       = (i == 0) ? 4 : 100 + i * 4;
+        p.ParentProcessId = (i == 0) ? 0 : (i < 8 ? 4 : 100 + (NextRandom(&rng) % i) * 4);
+        p.CreateTime      = 133000000000000000LL + (LONGLONG)i * 10000000;
+        p.WorkingSetSize  = (SIZE_T)(NextRandom(&rng) % 512 + 1) * 1024 * 1024;
+        p.PeakWorkingSetSize = p.WorkingSetSize;
+        p.KernelTime      = (LONGLONG)(i % 97) * 1000000;
+        p.UserTime        = (LONGLONG)(i % 89) * 2000000;
+        p.SessionId       = (i < 16) ? 0 : 1;
+        p.Critical        = (i == 0) ? TRUE : FALSE;
+        p.ImageName       = Utf8ToUtf16(i == 0 ? "System" : s_Images[NextRandom(&rng) % RTL_NUMBER_OF(s_Images)]);
+
+        for (ULONG t = 0; t < Spec->ThreadsPerProcess; t++) {
+            SHIM_THREAD th = {};
+            th.ThreadId        = nextTid;
+            th.Priority        = 8 + (LONG)(NextRandom(&rng) % 8);
+            th.StartAddress    = 0x7FF600000000ULL + (NextRandom(&rng) & 0xFFFFF0);
+            th.State           = (t == 0) ? 2 : 5;      // Running / Waiting
+            th.WaitReason      = (t == 0) ? 0 : 6 + (i + t) % 7;
+            th.ContextSwitches = (i * 31 + t * 7) % 5000;
+            th.KernelTime      = (LONGLONG)((i + t) % 53) * 100000;
+            th.UserTime        = (LONGLONG)((i * 3 + t) % 61) * 100000;
+            nextTid += 4;
+            p.Threads.push_back(th);
+        }
+
+        for (ULONG h = 0; h < Spec->HandlesPerProcess; h++) {
+            SHIM_HANDLE hd = {};
+            hd.Value           = (USHORT)((h + 1) * 4);
+            hd.ObjectTypeIndex = s_HandleTypes[NextRandom(&rng) % RTL_NUMBER_OF(s_HandleTypes)];
+            hd.GrantedAccess   = 0x001F0003;
+            hd.Object          = 0xFFFF800000000000ULL + ((ULONG64)NextRandom(&rng) << 4);
+            p.Handles.push_back(hd);
+        }
+
+        processes.push_back(std::move(p));
+    }
+
+    std::vector<SHIM_MODULE> modules;
+    ULONG64 base = 0xFFFFF80000000000ULL;
+    for (ULONG i = 0; i < Spec->KernelModules; i++) {
+        SHIM_MODULE m = {};
+        char path[64];
+        if (i == 0)
+            snprintf(path, sizeof(path), "\\SystemRoot\\system32\\ntoskrnl.exe");
+        else
+            snprintf(path, sizeof(path), "\\SystemRoot\\System32\\drivers\\drv%04u.sys", i);
+        m.ImageBase = base;
+        m.ImageSize = (NextRandom(&rng) % 64 + 1) * 0x10000;
+        m.FullPath  = path;
+        base += m.ImageSize + 0x10000;
+        modules.push_back(std::move(m));
+    }
+
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    g_ShimSystem.Processes = std::move(processes);
+    g_ShimSystem.Modules   = std::move(modules);
+}
+
+bool ShimSetWorkingSet(ULONG ProcessId, SIZE_T WorkingSetSize)
+{
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_PROCESS* process = ShimFindProcess(ProcessId);
+    if (!process) return false;
+    process->WorkingSetSize = WorkingSetSize;
+    process->PeakWorkingSetSize = std::max(process->PeakWorkingSetSize, WorkingSetSize);
+    return true;
+}
+
+bool ShimAddCpuTime(ULONG ProcessId, LONGLONG KernelTime, LONGLONG UserTime)
+{
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_PROCESS* process = ShimFindProcess(ProcessId);
+    if (!process) return false;
+    process->KernelTime += KernelTime;
+    process->UserTime += UserTime;
+    if (!process->Threads.empty()) {
+        process->Threads[0].KernelTime += KernelTime;
+        process->Threads[0].UserTime += UserTime;
+        process->Threads[0].ContextSwitches++;
+    }
+    return true;
+}
+
+SHIM_SNAPSHOT_COUNTS ShimSnapshotCounts(VOID)
+{
+    std::lock_guard<std::mutex> guard(g_ShimSystem.Lock);
+    SHIM_SNAPSHOT_COUNTS counts = {};
+    counts.Processes     = (ULONG)g_ShimSystem.Processes.size();
+    counts.KernelModules = (ULONG)g_ShimSystem.Modules.size();
+    for (const auto& p : g_ShimSystem.Processes) {
+        counts.Threads += (ULONG)p.Threads.size();
+        counts.Handles += (ULONG)p.Handles.size();
+    }
+    return counts;
+}
@@ -0,0 +1,144 @@
+//
+// Host shim: modules that are not built on the host
+//
+// These depend on EPROCESS layout scanning, tokens, APCs, NSI or file
+// system access that a snapshot cannot reproduce. driver.cpp still links
+// against them, so they report STATUS_NOT_SUPPORTED. Signature checks go
+// through the PID index but never hash an image: a process without a
+// verdict gets the one set with ShimSetCallerSignature.
+//
+
+#include "../src/signature.h"
+#include "../src/sha.h"
+#include "../src/sigpid.h"
+#include "../src/protect.h"
+#include "../src/token.h"
+#include "../src/freeze.h"
+#include "../src/memory.h"
+#include "../src/registry.h"
+#include "../src/inject.h"
+#include "../src/network.h"
+#include "../src/dkom.h"
+#include "../src/unload_driver.h"
+#include "osk_shim.h"
+
+// ========== Signature ==========
+
+static volatile LONG g_CallerSignature = SignatureValid;
+static volatile LONG g_SignatureChecks = 0;
+
+VOID ShimSetCallerSignature(ULONG Status)
+{
+    InterlockedExchange(&g_CallerSignature, (LONG)Status);
+}
+
+ULONG ShimSignatureChecks(VOID)
+{
+    return (ULONG)ReadAcquire(&g_SignatureChecks);
+}
+
+SIGNATURE_STATUS VerifyCallerSignature(VOID)
+{
+    InterlockedIncrement(&g_SignatureChecks);
+
+    ULONG processId = (ULONG)(ULONG_PTR)PsGetCurrentProcessId();
+    LONGLONG createTime = PsGetProcessCreateTimeQuadPart(PsGetCurrentProcess());
+    SIGNATURE_STATUS status;
+    BOOLEAN prewarmed;
+    if (PidIndexLookup(processId, createTime, &status, &prewarmed)) return status;
+
+    status = (SIGNATURE_STATUS)ReadAcquire(&g_CallerSignature);
+    PidIndexInsert(processId, createTime, status, FALSE);
+    return status;
+}
+
+SIGNATURE_STATUS VerifyFileSignature(PUNICODE_STRING FilePath)
+{
+    UNREFERENCED_PARAMETER(FilePath);
+    return SignatureNotFound;
+}
+
+NTSTATUS GetCallerImagePath(PUNICODE_STRING ImagePath)
+{
+    UNREFERENCED_PARAMETER(ImagePath);
+    return STATUS_NOT_SUPPORTED;
+}
+
+SIGNATURE_STATUS PrewarmProcessSignature(ULONG ProcessId, LONGLONG CreateTime, PUNICODE_STRING ImagePath)
+{
+    UNREFERENCED_PARAMETER(ProcessId);
+    UNREFERENCED_PARAMETER(CreateTime);
+    UNREFERENCED_PARAMETER(ImagePath);
+    return SignatureError;
+}
+
+// The hash engine is picked as the driver does, for callers of the Authenticode core
+NTSTATUS InitializeSignatureVerification(PUNICODE_STRING RegistryPath)
+{
+    UNREFERENCED_PARAMETER(RegistryPath);
+    ShaSelectEngine();
+    return STATUS_SUCCESS;
+}
+
+VOID CleanupSignatureVerification(VOID)
+{
+}
+
+VOID GetSignatureStats(PSIGNATURE_STATS Stats)
+{
+    RtlZeroMemory(Stats, sizeof(*Stats));
+    Stats->Version = SIGNATURE_STATS_VERSION;
+    Stats->Size    = sizeof(SIGNATURE_STATS);
+}
+
+// ========== Protection / token / freeze ==========
+
+NTSTATUS InitProtect()                                          { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessProtect(ULONG)                                  { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessSetProtectLevel(ULONG, UCHAR)                   { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessUnprotect(ULONG)                                { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessProtectObject(PEPROCESS)                        { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessSetProtectLevelObject(PEPROCESS, UCHAR)         { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessUnprotectObject(PEPROCESS)                      { return STATUS_NOT_SUPPORTED; }
+UCHAR    ProcessGetProtectLevel(PEPROCESS)                      { return 0; }
+VOID     CleanupProtect()                                       { }
+NTSTATUS ProcessElevate(ULONG, ULONG)                           { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessFreeze(ULONG)                                   { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessUnfreeze(ULONG)                                 { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessFreezeObject(PEPROCESS)                         { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessUnfreezeObject(PEPROCESS)                       { return STATUS_NOT_SUPPORTED; }
+
+// ========== Memory / network / DKOM / unload ==========
+
+NTSTATUS ProcessReadMemory(ULONG, ULONG64, PVOID, ULONG)        { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ProcessWriteMemory(ULONG, ULONG64, PVOID, ULONG)       { return STATUS_NOT_SUPPORTED; }
+
+NTSTATUS ProcessEnumModules(ULONG, ULONG, PVOID, ULONG, PULONG BytesWritten)
+{
+    *BytesWritten = 0;
+    return STATUS_NOT_SUPPORTED;
+}
+
+NTSTATUS ProcessEnumModulesV2(ULONG, ULONG, PVOID, ULONG, PULONG BytesWritten)
+{
+    *BytesWritten = 0;
+    return STATUS_NOT_SUPPORTED;
+}
+
+NTSTATUS EnumConnections(PVOID, ULONG, PULONG BytesWritten)
+{
+    *BytesWritten = 0;
+    return STATUS_NOT_SUPPORTED;
+}
+
+NTSTATUS HideProcess(ULONG)                                     { return STATUS_NOT_SUPPORTED; }
+NTSTATUS UnhideProcess(ULONG)                                   { return STATUS_NOT_SUPPORTED; }
+NTSTATUS HideProcessObject(PEPROCESS)                           { return STATUS_NOT_SUPPORTED; }
+NTSTATUS UnhideProcessObject(PEPROCESS)                         { return STATUS_NOT_SUPPORTED; }
+NTSTATUS ForceUnloadDriver(PCWSTR)                              { return STATUS_NOT_SUPPORTED; }
+
+// ========== Registry / injection ==========
+
+NTSTATUS RegDeleteKeyKernel(PCWSTR)                             { return STATUS_NOT_SUPPORTED; }
+NTSTATUS RegDeleteValueKernel(PCWSTR, PCWSTR)                   { return STATUS_NOT_SUPPORTED; }
+NTSTATUS InjectDll(ULONG, PCWSTR)                               { return STATUS_NOT_SUPPORTED; }
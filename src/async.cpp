@@ -0,0 +1,356 @@
+#include "async.h"
+
+// ========== 工作项 ==========
+//
+// 工作项从排队到完成一直挂在 g_AsyncQueue 或 g_AsyncRunning 上，两条链表与
+// 计数共用 g_AsyncLock。工作项指针存放在 IRP 的 DriverContext[0]，供取消例程找回。
+//
+// 排队中的 IRP 由三方竞争：工作线程、取消例程、IRP_MJ_CLEANUP。谁在锁内
+// 用 IoSetCancelRoutine(NULL) 拿到非 NULL 的取消例程，谁就拥有该 IRP；
+// 拿到 NULL 说明取消例程已在路上，只能把链接复位成自指，由取消例程完成。
+//
+
+typedef struct _ASYNC_WORK {
+    LIST_ENTRY      Link;
+    PCLIENT_CONTEXT Client;
+    PASYNC_ROUTINE  Routine;
+    ULONG           IoControlCode;
+    ULONG           State;          // ASYNC_STATE_*
+    ULONG64         QueuedAt;       // KeQueryInterruptTime，100ns
+    ASYNC_PROGRESS  Progress;       // Progress.Irp 即本工作项的 IRP
+} ASYNC_WORK, *PASYNC_WORK;
+
+static LIST_ENTRY    g_AsyncQueue;
+static LIST_ENTRY    g_AsyncRunning;
+static ULONG         g_AsyncQueued = 0;
+static ULONG         g_AsyncRunningCount = 0;
+static KSPIN_LOCK    g_AsyncLock;
+static KSEMAPHORE    g_AsyncSemaphore;      // 每排队一项释放一次，停止时按线程数释放
+static PKTHREAD      g_AsyncWorkers[ASYNC_MAX_WORKERS];
+static ULONG         g_AsyncWorkerCount = 0;
+static volatile LONG g_AsyncStopping = 0;
+
+static PASYNC_WORK WorkFromIrp(PIRP Irp)
+{
+    return (PASYNC_WORK)Irp->Tail.Overlay.DriverContext[0];
+}
+
+static VOID CompleteWork(PASYNC_WORK Work, NTSTATUS Status, ULONG_PTR Information)
+{
+    PIRP irp = Work->Progress.Irp;
+    ExFreePoolWithTag(Work, ASYNC_POOL_TAG);
+
+    irp->IoStatus.Status      = Status;
+    irp->IoStatus.Information = Information;
+    IoCompleteRequest(irp, IO_NO_INCREMENT);
+}
+
+// 进入时持有取消自旋锁
+static VOID AsyncCancelRoutine(PDEVICE_OBJECT DeviceObject, PIRP Irp)
+{
+    UNREFERENCED_PARAMETER(DeviceObject);
+    IoReleaseCancelSpinLock(Irp->CancelIrql);
+
+    PASYNC_WORK work = WorkFromIrp(Irp);
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_AsyncLock, &oldIrql);
+    // 已被工作线程摘下的工作项链接指向自身
+    if (!IsListEmpty(&work->Link)) {
+        RemoveEntryList(&work->Link);
+        g_AsyncQueued--;
+    }
+    KeReleaseSpinLock(&g_AsyncLock, oldIrql);
+
+    CompleteWork(work, STATUS_CANCELLED, 0);
+}
+
+// ========== 工作线程 ==========
+
+static PASYNC_WORK DequeueWork(VOID)
+{
+    PASYNC_WORK work = NULL;
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_AsyncLock, &oldIrql);
+
+    while (!IsListEmpty(&g_AsyncQueue)) {
+        PASYNC_WORK head = CONTAINING_RECORD(RemoveHeadList(&g_AsyncQueue), ASYNC_WORK, Link);
+        g_AsyncQueued--;
+
+        if (IoSetCancelRoutine(head->Progress.Irp, NULL) == NULL) {
+            InitializeListHead(&head->Link);
+            continue;
+        }
+
+        head->State = ASYNC_STATE_RUNNING;
+        InsertTailList(&g_AsyncRunning, &head->Link);
+        g_AsyncRunningCount++;
+        work = head;
+        break;
+    }
+
+    KeReleaseSpinLock(&g_AsyncLock, oldIrql);
+    return work;
+}
+
+static VOID RunWork(PASYNC_WORK Work)
+{
+    ULONG_PTR information = 0;
+    NTSTATUS status = Work->Routine(Work->Progress.Irp, &Work->Progress, &information);
+
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_AsyncLock, &oldIrql);
+    RemoveEntryList(&Work->Link);
+    g_AsyncRunningCount--;
+    KeReleaseSpinLock(&g_AsyncLock, oldIrql);
+
+    CompleteWork(Work, status, information);
+}
+
+static VOID AsyncWorker(PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    for (;;) {
+        KeWaitForSingleObject(&g_AsyncSemaphore, Executive, KernelMode, FALSE, NULL);
+        if (ReadNoFence(&g_AsyncStopping)) break;
+
+        // 排队的 IRP 可能已被取消，这次唤醒就落空
+        PASYNC_WORK work = DequeueWork();
+        if (work)
+            RunWork(work);
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+// 取走 Client（NULL 为全部）仍在排队、且取消例程尚未介入的工作项
+static VOID TakeQueuedLocked(PCLIENT_CONTEXT Client, PLIST_ENTRY Taken)
+{
+    PLIST_ENTRY e = g_AsyncQueue.Flink;
+    while (e != &g_AsyncQueue) {
+        PASYNC_WORK work = CONTAINING_RECORD(e, ASYNC_WORK, Link);
+        e = e->Flink;
+
+        if (Client && work->Client != Client)
+            continue;
+        if (IoSetCancelRoutine(work->Progress.Irp, NULL) == NULL)
+            continue;
+
+        RemoveEntryList(&work->Link);
+        g_AsyncQueued--;
+        InsertTailList(Taken, &work->Link);
+    }
+}
+
+static VOID CancelTaken(PLIST_ENTRY Taken)
+{
+    while (!IsListEmpty(Taken)) {
+        PASYNC_WORK work = CONTAINING_RECORD(RemoveHeadList(Taken), ASYNC_WORK, Link);
+        CompleteWork(work, STATUS_CANCELLED, 0);
+    }
+}
+
+// ========== 公开接口 ==========
+
+BOOLEAN AsyncCancelled(PASYNC_PROGRESS Progress)
+{
+    return Progress &&
+        (ReadNoFence(&Progress->Cancelled) || ReadBooleanNoFence(&Progress->Irp->Cancel));
+}
+
+VOID AsyncReportProgress(PASYNC_PROGRESS Progress, ULONG Completed, ULONG Total)
+{
+    if (!Progress) return;
+    InterlockedExchange(&Progress->Total, (LONG)Total);
+    InterlockedExchange(&Progress->Completed, (LONG)Completed);
+}
+
+BOOLEAN AsyncCheckpoint(PASYNC_PROGRESS Progress, ULONG Completed, ULONG Total)
+{
+    if (!Progress || Completed % ASYNC_CHECKPOINT_INTERVAL != 0) return FALSE;
+    AsyncReportProgress(Progress, Completed, Total);
+    return AsyncCancelled(Progress);
+}
+
+NTSTATUS AsyncInitialize(VOID)
+{
+    InitializeListHead(&g_AsyncQueue);
+    InitializeListHead(&g_AsyncRunning);
+    KeInitializeSpinLock(&g_AsyncLock);
+    KeInitializeSemaphore(&g_AsyncSemaphore, 0, MAXLONG);
+    g_AsyncStopping = 0;
+
+    ULONG workers = min(KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS), (ULONG)ASYNC_MAX_WORKERS);
+    NTSTATUS status = STATUS_SUCCESS;
+
+    for (ULONG i = 0; i < workers; i++) {
+        HANDLE threadHandle = NULL;
+        status = PsCreateSystemThread(&threadHandle, THREAD_ALL_ACCESS, NULL,
+            NULL, NULL, AsyncWorker, NULL);
+        if (!NT_SUCCESS(status))
+            break;
+
+        status = ObReferenceObjectByHandle(threadHandle, SYNCHRONIZE, *PsThreadType,
+            KernelMode, (PVOID*)&g_AsyncWorkers[g_AsyncWorkerCount], NULL);
+        ZwClose(threadHandle);
+        if (!NT_SUCCESS(status)) {
+            // 等不到这个线程：整个线程池停掉，请求全部同步执行
+            InterlockedExchange(&g_AsyncStopping, 1);
+            KeReleaseSemaphore(&g_AsyncSemaphore, IO_NO_INCREMENT, 1, FALSE);
+            AsyncShutdown();
+            return status;
+        }
+        g_AsyncWorkerCount++;
+    }
+
+    if (g_AsyncWorkerCount == 0)
+        return status;
+
+    DbgPrint("[OpenSysKit] Async workers: %lu\n", g_AsyncWorkerCount);
+    return STATUS_SUCCESS;
+}
+
+// 卸载时所有句柄都已关闭，IRP_MJ_CLEANUP 已清空各自的队列；这里只兜底
+VOID AsyncShutdown(VOID)
+{
+    if (g_AsyncWorkerCount == 0)
+        return;
+
+    InterlockedExchange(&g_AsyncStopping, 1);
+    KeReleaseSemaphore(&g_AsyncSemaphore, IO_NO_INCREMENT, (LONG)g_AsyncWorkerCount, FALSE);
+
+    for (ULONG i = 0; i < g_AsyncWorkerCount; i++) {
+        KeWaitForSingleObject(g_AsyncWorkers[i], Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(g_AsyncWorkers[i]);
+        g_AsyncWorkers[i] = NULL;
+    }
+    g_AsyncWorkerCount = 0;
+
+    LIST_ENTRY taken;
+    InitializeListHead(&taken);
+
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_AsyncLock, &oldIrql);
+    TakeQueuedLocked(NULL, &taken);
+    KeReleaseSpinLock(&g_AsyncLock, oldIrql);
+
+    CancelTaken(&taken);
+}
+
+BOOLEAN AsyncEligible(PIRP Irp)
+{
+    PFILE_OBJECT fileObject = IoGetCurrentIrpStackLocation(Irp)->FileObject;
+    return g_AsyncWorkerCount != 0 &&
+        !ReadNoFence(&g_AsyncStopping) &&
+        fileObject && !(fileObject->Flags & FO_SYNCHRONOUS_IO);
+}
+
+NTSTATUS AsyncQueueIrp(PIRP Irp, PCLIENT_CONTEXT Client, PASYNC_ROUTINE Routine)
+{
+    PASYNC_WORK work = (PASYNC_WORK)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, sizeof(ASYNC_WORK), ASYNC_POOL_TAG);
+    if (!work)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    work->Client        = Client;
+    work->Routine       = Routine;
+    work->IoControlCode = IoGetCurrentIrpStackLocation(Irp)->Parameters.DeviceIoControl.IoControlCode;
+    work->State         = ASYNC_STATE_QUEUED;
+    work->QueuedAt      = KeQueryInterruptTime();
+    work->Progress.Irp  = Irp;
+    Irp->Tail.Overlay.DriverContext[0] = work;
+
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_AsyncLock, &oldIrql);
+
+    if (g_AsyncQueued >= ASYNC_MAX_QUEUED || ReadNoFence(&g_AsyncStopping)) {
+        KeReleaseSpinLock(&g_AsyncLock, oldIrql);
+        ExFreePoolWithTag(work, ASYNC_POOL_TAG);
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    IoMarkIrpPending(Irp);
+    IoSetCancelRoutine(Irp, AsyncCancelRoutine);
+
+    // 排队前已被取消：取消例程若已被 I/O 管理器取走，它会等锁后从队列摘除
+    if (Irp->Cancel && IoSetCancelRoutine(Irp, NULL) != NULL) {
+        KeReleaseSpinLock(&g_AsyncLock, oldIrql);
+        CompleteWork(work, STATUS_CANCELLED, 0);
+        return STATUS_PENDING;
+    }
+
+    InsertTailList(&g_AsyncQueue, &work->Link);
+    g_AsyncQueued++;
+    KeReleaseSpinLock(&g_AsyncLock, oldIrql);
+
+    KeReleaseSemaphore(&g_AsyncSemaphore, IO_NO_INCREMENT, 1, FALSE);
+    return STATUS_PENDING;
+}
+
+VOID AsyncCancelClient(PCLIENT_CONTEXT Client)
+{
+    LIST_ENTRY taken;
+    InitializeListHead(&taken);
+
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_AsyncLock, &oldIrql);
+
+    TakeQueuedLocked(Client, &taken);
+    for (PLIST_ENTRY e = g_AsyncRunning.Flink; e != &g_AsyncRunning; e = e->Flink) {
+        PASYNC_WORK work = CONTAINING_RECORD(e, ASYNC_WORK, Link);
+        if (work->Client == Client)
+            InterlockedExchange(&work->Progress.Cancelled, 1);
+    }
+
+    KeReleaseSpinLock(&g_AsyncLock, oldIrql);
+
+    CancelTaken(&taken);
+}
+
+static VOID FillOperation(const ASYNC_WORK* Work, ULONG64 Now, PASYNC_OPERATION_INFO Info)
+{
+    Info->Overlapped          = (ULONG64)(ULONG_PTR)Work->Progress.Irp->UserIosb;
+    Info->IoControlCode       = Work->IoControlCode;
+    Info->State               = Work->State;
+    Info->Completed           = (ULONG)ReadNoFence(&Work->Progress.Completed);
+    Info->Total               = (ULONG)ReadNoFence(&Work->Progress.Total);
+    Info->ElapsedMicroseconds = (Now - Work->QueuedAt) / 10;
+}
+
+NTSTATUS AsyncQueryClient(PCLIENT_CONTEXT Client, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+{
+    PASYNC_STATUS_HEADER  header = (PASYNC_STATUS_HEADER)OutputBuffer;
+    PASYNC_OPERATION_INFO entry  = (PASYNC_OPERATION_INFO)(header + 1);
+    ULONG maxEntries = (OutputBufferSize - sizeof(ASYNC_STATUS_HEADER)) / sizeof(ASYNC_OPERATION_INFO);
+    ULONG count = 0;
+    ULONG total = 0;
+
+    RtlZeroMemory(header, sizeof(ASYNC_STATUS_HEADER));
+    ULONG64 now = KeQueryInterruptTime();
+
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_AsyncLock, &oldIrql);
+
+    PLIST_ENTRY lists[] = { &g_AsyncRunning, &g_AsyncQueue };
+    for (ULONG l = 0; l < RTL_NUMBER_OF(lists); l++) {
+        for (PLIST_ENTRY e = lists[l]->Flink; e != lists[l]; e = e->Flink) {
+            PASYNC_WORK work = CONTAINING_RECORD(e, ASYNC_WORK, Link);
+            if (work->Client != Client)
+                continue;
+            if (count < maxEntries)
+                FillOperation(work, now, &entry[count++]);
+            total++;
+        }
+    }
+    header->Queued  = g_AsyncQueued;
+    header->Running = g_AsyncRunningCount;
+
+    KeReleaseSpinLock(&g_AsyncLock, oldIrql);
+
+    header->Count     = count;
+    header->TotalSize = sizeof(ASYNC_STATUS_HEADER) + total * sizeof(ASYNC_OPERATION_INFO);
+    header->Workers   = g_AsyncWorkerCount;
+
+    *BytesWritten = sizeof(ASYNC_STATUS_HEADER) + count * sizeof(ASYNC_OPERATION_INFO);
+    return STATUS_SUCCESS;
+}
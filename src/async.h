@@ -0,0 +1,50 @@
+#pragma once
+
+#include "driver.h"
+
+#define ASYNC_POOL_TAG      'cysA'
+#define ASYNC_MAX_WORKERS   4
+#define ASYNC_MAX_QUEUED    1024
+
+// ========== 异步执行 ==========
+//
+// 驱动自有的工作线程池：分发函数把已通过检查的 IRP 交给 AsyncQueueIrp，
+// 工作线程调用 PASYNC_ROUTINE 执行并完成 IRP。排队中的 IRP 挂取消例程；
+// 执行中的 IRP 只能协作取消，处理函数在检查点调用 AsyncCancelled。
+//
+
+// 处理函数看到的执行状态；同步执行时传 NULL
+typedef struct _ASYNC_PROGRESS {
+    PIRP          Irp;
+    volatile LONG Cancelled;    // IRP_MJ_CLEANUP 或卸载时置位
+    volatile LONG Completed;
+    volatile LONG Total;
+} ASYNC_PROGRESS, *PASYNC_PROGRESS;
+
+BOOLEAN AsyncCancelled(PASYNC_PROGRESS Progress);
+VOID AsyncReportProgress(PASYNC_PROGRESS Progress, ULONG Completed, ULONG Total);
+
+// 逐条记录的循环中调用：每 ASYNC_CHECKPOINT_INTERVAL 条报告一次进度并检查取消，
+// 已取消返回 TRUE。Progress 为 NULL 时总是 FALSE
+#define ASYNC_CHECKPOINT_INTERVAL 256
+BOOLEAN AsyncCheckpoint(PASYNC_PROGRESS Progress, ULONG Completed, ULONG Total);
+
+// 返回 IRP 的完成状态，*Information 为 IoStatus.Information
+typedef NTSTATUS (*PASYNC_ROUTINE)(PIRP Irp, PASYNC_PROGRESS Progress, PULONG_PTR Information);
+
+// 启动失败时不排队，所有请求照旧同步执行
+NTSTATUS AsyncInitialize(VOID);
+VOID AsyncShutdown(VOID);
+
+// 句柄以重叠方式打开且线程池在运行时才值得排队
+BOOLEAN AsyncEligible(PIRP Irp);
+
+// 返回 STATUS_PENDING 时 IRP 已标记挂起并归线程池所有（可能已经完成），
+// 分发函数须原样返回；其他返回值表示未排队，IRP 仍由调用方处理
+NTSTATUS AsyncQueueIrp(PIRP Irp, PCLIENT_CONTEXT Client, PASYNC_ROUTINE Routine);
+
+// IRP_MJ_CLEANUP：完成该客户端仍在排队的 IRP，并通知执行中的停下
+VOID AsyncCancelClient(PCLIENT_CONTEXT Client);
+
+// IOCTL_GET_ASYNC_STATUS
+NTSTATUS AsyncQueryClient(PCLIENT_CONTEXT Client, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
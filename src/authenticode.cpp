@@ -0,0 +1,444 @@
+//
+// Authenticode verification core
+//
+// Shared by the driver and the host tools; see authenticode.h. Everything
+// platform specific (file access, clock, allocation) comes in through
+// SIG_READER or the two allocator helpers below.
+//
+
+#include "authenticode.h"
+#include "sha.h"
+#include "pkcs7.h"
+
+#ifdef OSK_HOST_BUILD
+
+#define SigLog(fmt, ...) ((void)0)
+
+static PVOID SigAllocMem(SIZE_T Size)
+{
+    return malloc(Size);
+}
+
+static VOID SigFreeMem(PVOID Ptr)
+{
+    free(Ptr);
+}
+
+#else
+
+#ifdef DBG
+#define SigLog(fmt, ...) DbgPrint("[OpenSysKit][Sig] " fmt "\n", ##__VA_ARGS__)
+#else
+#define SigLog(fmt, ...)
+#endif
+
+// Tag shared with signature.cpp so pool usage shows up under one owner
+#define AUTHENTICODE_TAG 'GiSK'
+
+// Verification only runs at PASSIVE_LEVEL, so work buffers come from paged pool
+static PVOID SigAllocMem(SIZE_T Size)
+{
+    return ExAllocatePool2(POOL_FLAG_PAGED, Size, AUTHENTICODE_TAG);
+}
+
+static VOID SigFreeMem(PVOID Ptr)
+{
+    if (Ptr) ExFreePoolWithTag(Ptr, AUTHENTICODE_TAG);
+}
+
+#endif // OSK_HOST_BUILD
+
+// ================================================================
+// Thumbprint comparison
+// ================================================================
+
+static int HexCharToValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static BOOLEAN CompareThumbprint(const UCHAR digest[20], const char* thumbprint)
+{
+    if (!thumbprint || thumbprint[0] == '\0') {
+        return FALSE; // Empty thumbprint = reject all (safer than WinDrive default)
+    }
+
+    size_t len = 0;
+    while (thumbprint[len] && len < 41) len++;
+    if (len < 40) {
+        SigLog("Invalid thumbprint length: %zu (expected 40)", len);
+        return FALSE;
+    }
+
+    for (ULONG i = 0; i < 20; i++) {
+        int high = HexCharToValue(thumbprint[i * 2]);
+        int low = HexCharToValue(thumbprint[i * 2 + 1]);
+        if (high < 0 || low < 0) return FALSE;
+        if (digest[i] != (UCHAR)((high << 4) | low)) return FALSE;
+    }
+    return TRUE;
+}
+
+// ================================================================
+// WIN_CERTIFICATE
+// ================================================================
+
+typedef struct _WIN_CERTIFICATE {
+    ULONG dwLength;
+    USHORT wRevision;
+    USHORT wCertificateType;
+    UCHAR bCertificate[1];
+} WIN_CERTIFICATE, *PWIN_CERTIFICATE;
+
+#define WIN_CERT_TYPE_PKCS_SIGNED_DATA 0x0002
+
+// ================================================================
+// File reader
+// ================================================================
+
+static NTSTATUS ReaderRead(const SIG_READER* Reader, ULONG Offset, PVOID Buffer, ULONG Length)
+{
+    if (!Reader->Ticks) return Reader->Read(Reader->Context, Offset, Buffer, Length);
+
+    ULONG64 start = Reader->Ticks->Now();
+    NTSTATUS status = Reader->Read(Reader->Context, Offset, Buffer, Length);
+    Reader->Ticks->Read += Reader->Ticks->Now() - start;
+    return status;
+}
+
+// Chunk size used when streaming the hashed ranges through the work buffer
+#define SIG_CHUNK_SIZE          (64 * 1024)
+// Tail window searched for a WIN_CERTIFICATE when the directory is bogus
+#define SIG_TAIL_SCAN_SIZE      0x1000
+// Upper bound for the certificate table we are willing to load
+#define SIG_MAX_CERT_TABLE_SIZE (1024 * 1024)
+
+// Not the min macro: osk_types.h must not define one for host consumers
+static inline ULONG MinUlong(ULONG a, ULONG b)
+{
+    return a < b ? a : b;
+}
+
+// ================================================================
+// Authenticode layout
+// ================================================================
+
+typedef struct _AUTHENTICODE_LAYOUT {
+    ULONG ChecksumOffset;
+    ULONG SecurityDirOffset;
+    ULONG SecurityDirVA;
+    ULONG SecurityDirSize;
+} AUTHENTICODE_LAYOUT, *PAUTHENTICODE_LAYOUT;
+
+// PE header offsets, read as raw little-endian fields so the core does not
+// depend on ntimage.h or on the host's struct packing
+#define PE_DOS_SIGNATURE          0x5A4D        // "MZ"
+#define PE_DOS_LFANEW_OFFSET      0x3C
+#define PE_NT_SIGNATURE           0x00004550    // "PE\0\0"
+#define PE_NT_HEADERS64_SIZE      264
+#define PE_OPTIONAL_HEADER_OFFSET 24
+#define PE_OPT_HDR32_MAGIC        0x10B
+#define PE_OPT_HDR64_MAGIC        0x20B
+#define PE_CHECKSUM_OFFSET        64            // within the optional header
+#define PE_SECURITY_DIR32_OFFSET  128
+#define PE_SECURITY_DIR64_OFFSET  144
+
+static USHORT LoadLe16(const UCHAR* p)
+{
+    return (USHORT)(p[0] | (p[1] << 8));
+}
+
+static ULONG LoadLe32(const UCHAR* p)
+{
+    return (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+//
+// Reads DOS + NT headers and locates the checksum field and the security
+// data directory entry. Only the headers are read, never the image body.
+//
+static SIGNATURE_STATUS ReadAuthenticodeLayout(
+    const SIG_READER* Reader, PAUTHENTICODE_LAYOUT Layout)
+{
+    UCHAR dosHeader[64];
+    if (!NT_SUCCESS(ReaderRead(Reader, 0, dosHeader, sizeof(dosHeader))))
+        return SignatureError;
+
+    if (LoadLe16(dosHeader) != PE_DOS_SIGNATURE) return SignatureInvalid;
+
+    ULONG ntOffset = LoadLe32(dosHeader + PE_DOS_LFANEW_OFFSET);
+    if (ntOffset > 0x7FFFFFFF ||
+        (ULONG64)ntOffset + PE_NT_HEADERS64_SIZE > Reader->FileSize)
+        return SignatureInvalid;
+
+    UCHAR ntHeaders[PE_NT_HEADERS64_SIZE];
+    if (!NT_SUCCESS(ReaderRead(Reader, ntOffset, ntHeaders, sizeof(ntHeaders))))
+        return SignatureError;
+
+    if (LoadLe32(ntHeaders) != PE_NT_SIGNATURE) return SignatureInvalid;
+
+    const UCHAR* optionalHeader = ntHeaders + PE_OPTIONAL_HEADER_OFFSET;
+    ULONG securityDir;
+    switch (LoadLe16(optionalHeader)) {
+    case PE_OPT_HDR64_MAGIC: securityDir = PE_SECURITY_DIR64_OFFSET; break;
+    case PE_OPT_HDR32_MAGIC: securityDir = PE_SECURITY_DIR32_OFFSET; break;
+    default: return SignatureInvalid;
+    }
+
+    Layout->ChecksumOffset    = ntOffset + PE_OPTIONAL_HEADER_OFFSET + PE_CHECKSUM_OFFSET;
+    Layout->SecurityDirOffset = ntOffset + PE_OPTIONAL_HEADER_OFFSET + securityDir;
+    Layout->SecurityDirVA     = LoadLe32(optionalHeader + securityDir);
+    Layout->SecurityDirSize   = LoadLe32(optionalHeader + securityDir + 4);
+    return SignatureValid;
+}
+
+//
+// Finds the certificate table. Normally that is the security directory;
+// if the directory points outside the file, scan the file tail for a
+// PKCS#7 WIN_CERTIFICATE header (same heuristic as before).
+//
+static SIGNATURE_STATUS LocateCertificateTable(
+    const SIG_READER* Reader, const AUTHENTICODE_LAYOUT* Layout,
+    PUCHAR WorkBuffer, PULONG CertOffset)
+{
+    *CertOffset = 0;
+
+    if (Layout->SecurityDirVA == 0 || Layout->SecurityDirSize == 0) {
+        SigLog("No security directory - file is not signed");
+        return SignatureNotFound;
+    }
+
+    if ((ULONG64)Layout->SecurityDirVA + Layout->SecurityDirSize <= Reader->FileSize) {
+        *CertOffset = Layout->SecurityDirVA;
+        return SignatureValid;
+    }
+
+    SigLog("SecVA out of range, scanning file tail");
+    ULONG scanStart = Reader->FileSize > SIG_TAIL_SCAN_SIZE
+        ? Reader->FileSize - SIG_TAIL_SCAN_SIZE
+        : 0;
+    ULONG scanLen = Reader->FileSize - scanStart;
+    if (!NT_SUCCESS(ReaderRead(Reader, scanStart, WorkBuffer, scanLen)))
+        return SignatureError;
+
+    for (ULONG i = 0; i + 8 < scanLen; i++) {
+        PUCHAR p = WorkBuffer + i;
+        ULONG  dwLen = LoadLe32(p);
+        USHORT wType = LoadLe16(p + 6);
+        if (wType == WIN_CERT_TYPE_PKCS_SIGNED_DATA &&
+            dwLen > 8 && dwLen < 0x4000 &&
+            (ULONG64)scanStart + i + dwLen <= Reader->FileSize &&
+            p[8] == 0x30) {
+            *CertOffset = scanStart + i;
+            SigLog("Found WIN_CERTIFICATE at 0x%X", *CertOffset);
+            return SignatureValid;
+        }
+    }
+
+    return SignatureInvalid;
+}
+
+static BOOLEAN HashFileRange(
+    const SIG_READER* Reader, SHA256_CTX* Ctx,
+    ULONG Start, ULONG End, PUCHAR WorkBuffer)
+{
+    for (ULONG pos = Start; pos < End; ) {
+        ULONG chunk = MinUlong(End - pos, SIG_CHUNK_SIZE);
+        if (!NT_SUCCESS(ReaderRead(Reader, pos, WorkBuffer, chunk)))
+            return FALSE;
+        SHA256Update(Ctx, WorkBuffer, chunk);
+        pos += chunk;
+    }
+    return TRUE;
+}
+
+//
+// Authenticode hash: the whole file up to the certificate table, minus the
+// checksum field and the security directory entry. Streamed in
+// SIG_CHUNK_SIZE pieces through WorkBuffer.
+//
+static BOOLEAN CalculateAuthenticodeHash(
+    const SIG_READER* Reader, const AUTHENTICODE_LAYOUT* Layout,
+    PUCHAR WorkBuffer, UCHAR hash[32])
+{
+    ULONG checksumOffset    = Layout->ChecksumOffset;
+    ULONG securityDirOffset = Layout->SecurityDirOffset;
+    ULONG hashEnd = Layout->SecurityDirVA > 0 ? Layout->SecurityDirVA : Reader->FileSize;
+
+    if (checksumOffset + 4 > Reader->FileSize ||
+        securityDirOffset + 8 > Reader->FileSize ||
+        hashEnd > Reader->FileSize ||
+        checksumOffset >= securityDirOffset ||
+        securityDirOffset + 8 > hashEnd)
+        return FALSE;
+
+    SHA256_CTX ctx;
+    SHA256Init(&ctx);
+    if (!HashFileRange(Reader, &ctx, 0, checksumOffset, WorkBuffer) ||
+        !HashFileRange(Reader, &ctx, checksumOffset + 4, securityDirOffset, WorkBuffer) ||
+        !HashFileRange(Reader, &ctx, securityDirOffset + 8, hashEnd, WorkBuffer))
+        return FALSE;
+    SHA256Final(hash, &ctx);
+
+    return TRUE;
+}
+
+// ================================================================
+// PKCS#7 verification
+// ================================================================
+
+//
+// The signer's messageDigest attribute is the hash of the
+// SpcIndirectDataContent value bytes. Checking it ties the image digest
+// to the part of the blob the signer actually signed.
+//
+static BOOLEAN VerifyIndirectDataDigest(const PKCS7_SIGNED_DATA* SignedData)
+{
+    UCHAR digest[32];
+    ULONG digestLen;
+
+    if (SignedData->SignerDigestAlg == Pkcs7DigestSha256) {
+        SHA256_CTX ctx;
+        SHA256Init(&ctx);
+        SHA256Update(&ctx, SignedData->IndirectContent, SignedData->IndirectContentLength);
+        SHA256Final(digest, &ctx);
+        digestLen = 32;
+    } else if (SignedData->SignerDigestAlg == Pkcs7DigestSha1) {
+        SHA1_CTX ctx;
+        SHA1Init(&ctx);
+        SHA1Update(&ctx, SignedData->IndirectContent, SignedData->IndirectContentLength);
+        SHA1Final(digest, &ctx);
+        digestLen = 20;
+    } else {
+        SigLog("Unsupported signer digest algorithm");
+        return FALSE;
+    }
+
+    return SignedData->AttrMessageDigestLength == digestLen &&
+        RtlCompareMemory(SignedData->AttrMessageDigest, digest, digestLen) == digestLen;
+}
+
+static SIGNATURE_STATUS VerifyPkcs7(
+    PUCHAR pkcs7Data, ULONG pkcs7Len, const UCHAR authenticodeHash[32],
+    const CHAR* TrustedThumbprint)
+{
+    PKCS7_SIGNED_DATA signedData;
+    if (!Pkcs7ParseSignedData(pkcs7Data, pkcs7Len, &signedData)) {
+        SigLog("Malformed PKCS#7 SignedData");
+        return SignatureInvalid;
+    }
+
+    // Step 1: Compare the signed image digest with the computed hash
+    if (signedData.ImageDigestAlg != Pkcs7DigestSha256 || signedData.ImageDigestLength != 32) {
+        SigLog("Image digest is not SHA256");
+        return SignatureInvalid;
+    }
+    if (RtlCompareMemory(authenticodeHash, signedData.ImageDigest, 32) != 32) {
+        SigLog("Authenticode SHA256 hash mismatch - file has been tampered");
+        return SignatureInvalid;
+    }
+    SigLog("Authenticode SHA256 hash verified");
+
+    // Step 2: Check the signed attributes cover that digest
+    if (!VerifyIndirectDataDigest(&signedData)) {
+        SigLog("messageDigest attribute does not match SpcIndirectDataContent");
+        return SignatureInvalid;
+    }
+
+    // Step 3: Verify certificate thumbprint, only over the certificates set
+    const UCHAR* cursor = signedData.Certificates;
+    const UCHAR* end = signedData.Certificates + signedData.CertificatesLength;
+    const UCHAR* cert;
+    ULONG certLen;
+    while (Pkcs7NextCertificate(&cursor, end, &cert, &certLen)) {
+        SHA1_CTX tmpCtx;
+        UCHAR tmpThumb[20];
+        SHA1Init(&tmpCtx);
+        SHA1Update(&tmpCtx, cert, certLen);
+        SHA1Final(tmpThumb, &tmpCtx);
+
+        if (CompareThumbprint(tmpThumb, TrustedThumbprint)) {
+            SigLog("Found matching cert at pkcs7+0x%X len=%u", (ULONG)(cert - pkcs7Data), certLen);
+            return SignatureValid;
+        }
+    }
+
+    SigLog("No matching certificate found in PKCS#7");
+    return SignatureUntrusted;
+}
+
+// ================================================================
+// Streaming PE signature verification
+// ================================================================
+
+static SIGNATURE_STATUS VerifyCertificateTable(
+    const SIG_READER* Reader, const AUTHENTICODE_LAYOUT* Layout, PUCHAR WorkBuffer,
+    const CHAR* TrustedThumbprint, UCHAR authenticodeHash[32])
+{
+    ULONG certOffset = 0;
+    SIGNATURE_STATUS result = LocateCertificateTable(Reader, Layout, WorkBuffer, &certOffset);
+    if (result != SignatureValid) return result;
+
+    WIN_CERTIFICATE certHeader;
+    if (!NT_SUCCESS(ReaderRead(Reader, certOffset, &certHeader,
+            FIELD_OFFSET(WIN_CERTIFICATE, bCertificate))))
+        return SignatureError;
+
+    if (certHeader.wCertificateType != WIN_CERT_TYPE_PKCS_SIGNED_DATA ||
+        certHeader.dwLength < sizeof(WIN_CERTIFICATE) ||
+        certHeader.dwLength > Reader->FileSize - certOffset ||
+        certHeader.dwLength > SIG_MAX_CERT_TABLE_SIZE)
+        return SignatureInvalid;
+
+    PSIG_PHASE_TICKS ticks = Reader->Ticks;
+    ULONG64 start = ticks ? ticks->Now() : 0;
+    ULONG64 readBefore = ticks ? ticks->Read : 0;
+    if (!CalculateAuthenticodeHash(Reader, Layout, WorkBuffer, authenticodeHash))
+        return SignatureInvalid;
+    if (ticks)
+        ticks->Hash += (ticks->Now() - start) - (ticks->Read - readBefore);
+
+    // Only the certificate table is loaded into memory
+    PUCHAR certTable = (PUCHAR)SigAllocMem(certHeader.dwLength);
+    if (!certTable) return SignatureError;
+
+    if (!NT_SUCCESS(ReaderRead(Reader, certOffset, certTable, certHeader.dwLength))) {
+        SigFreeMem(certTable);
+        return SignatureError;
+    }
+
+    start = ticks ? ticks->Now() : 0;
+    result = VerifyPkcs7(
+        certTable + FIELD_OFFSET(WIN_CERTIFICATE, bCertificate),
+        certHeader.dwLength - FIELD_OFFSET(WIN_CERTIFICATE, bCertificate),
+        authenticodeHash, TrustedThumbprint);
+    if (ticks)
+        ticks->Pkcs7 += ticks->Now() - start;
+
+    SigFreeMem(certTable);
+    return result;
+}
+
+SIGNATURE_STATUS AuthenticodeVerifyStream(
+    const SIG_READER* Reader, const CHAR* TrustedThumbprint, UCHAR ImageHash[32])
+{
+    RtlZeroMemory(ImageHash, 32);
+    if (Reader->FileSize < 256) return SignatureError;
+
+    AUTHENTICODE_LAYOUT layout;
+    SIGNATURE_STATUS result = ReadAuthenticodeLayout(Reader, &layout);
+    if (result != SignatureValid) return result;
+
+    PUCHAR workBuffer = (PUCHAR)SigAllocMem(SIG_CHUNK_SIZE);
+    if (!workBuffer) return SignatureError;
+
+    result = VerifyCertificateTable(Reader, &layout, workBuffer, TrustedThumbprint, ImageHash);
+    SigFreeMem(workBuffer);
+
+    if (result == SignatureValid)
+        SigLog("Full Authenticode verification passed");
+    return result;
+}
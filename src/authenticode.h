@@ -0,0 +1,61 @@
+#pragma once
+
+//
+// Authenticode verification core
+//
+// Platform-neutral: PE layout, streaming hash and PKCS#7 checks over an
+// abstract reader. The driver feeds it a kernel file handle
+// (signature.cpp); host tools feed it a regular file.
+//
+
+#include "osk_types.h"
+
+// Certificate: WinDriverLoader (O=Admilk)
+// SHA1 thumbprint of the trusted signing certificate (40 hex chars, uppercase)
+#define TRUSTED_CERT_THUMBPRINT "E723BD5F5C61A0541945A3640F3FEFFE3F090D69"
+
+typedef enum _SIGNATURE_STATUS {
+    SignatureValid = 0,
+    SignatureNotFound,
+    SignatureInvalid,
+    SignatureUntrusted,
+    SignatureExpired,
+    SignatureError
+} SIGNATURE_STATUS;
+
+//
+// The verifier core never touches a file handle directly. It pulls bytes
+// through SIG_READER, so the same code path can run over a kernel file
+// handle or any in-memory / host-side source.
+//
+// Read must return STATUS_SUCCESS only if exactly Length bytes were read.
+//
+typedef NTSTATUS (*PFN_SIG_READ)(PVOID Context, ULONG Offset, PVOID Buffer, ULONG Length);
+
+//
+// Optional per-verification phase timing. Read accumulates every read;
+// Hash is the Authenticode hash with its reads subtracted.
+//
+typedef struct _SIG_PHASE_TICKS {
+    ULONG64 (*Now)(VOID);
+    ULONG64 Read;
+    ULONG64 Hash;
+    ULONG64 Pkcs7;
+} SIG_PHASE_TICKS, *PSIG_PHASE_TICKS;
+
+typedef struct _SIG_READER {
+    PVOID            Context;
+    PFN_SIG_READ     Read;
+    ULONG            FileSize;
+    PSIG_PHASE_TICKS Ticks;     // may be NULL
+} SIG_READER, *PSIG_READER;
+
+//
+// Verifies a PE image pulled through Reader against a certificate SHA1
+// thumbprint (40 hex chars). Memory use is bounded by one chunk-sized
+// work buffer plus the certificate table itself, independent of the
+// image size. ImageHash receives the Authenticode SHA-256, or stays zero
+// if verification stopped before hashing.
+//
+SIGNATURE_STATUS AuthenticodeVerifyStream(
+    const SIG_READER* Reader, const CHAR* TrustedThumbprint, UCHAR ImageHash[32]);
@@ -0,0 +1,198 @@
+#include "batch.h"
+#include "process.h"
+#include "protect.h"
+#include "freeze.h"
+#include "dkom.h"
+
+// ========== 批量命令 ==========
+//
+// PID -> EPROCESS 缓存为开放寻址表，容量取不小于 2 × Count 的 2 的幂，
+// 随命令数组一起分配。每个 PID 第一次出现时查找，之后的命令复用引用，
+// 整批结束后统一 ObDereferenceObject。
+//
+
+typedef struct _BATCH_PROCESS_ENTRY {
+    BOOLEAN   Used;
+    ULONG     ProcessId;
+    NTSTATUS  LookupStatus;
+    PEPROCESS Process;
+} BATCH_PROCESS_ENTRY, *PBATCH_PROCESS_ENTRY;
+
+typedef struct _BATCH_PROCESS_CACHE {
+    PBATCH_PROCESS_ENTRY Entries;
+    ULONG                Mask;
+    ULONG                Lookups;
+} BATCH_PROCESS_CACHE, *PBATCH_PROCESS_CACHE;
+
+static BOOLEAN ValidCommand(const BATCH_COMMAND* Command)
+{
+    if (Command->Reserved != 0) return FALSE;
+
+    switch (Command->Opcode) {
+    case BATCH_OP_SET_PROTECT_LEVEL:
+        return Command->Parameter <= 0xFF;
+    case BATCH_OP_KILL:
+    case BATCH_OP_FREEZE:
+    case BATCH_OP_UNFREEZE:
+    case BATCH_OP_PROTECT:
+    case BATCH_OP_UNPROTECT:
+    case BATCH_OP_HIDE:
+    case BATCH_OP_UNHIDE:
+        return Command->Parameter == 0;
+    default:
+        return FALSE;
+    }
+}
+
+static ULONG CacheCapacity(ULONG Count)
+{
+    ULONG capacity = 16;
+    while (capacity < Count * 2)
+        capacity *= 2;
+    return capacity;
+}
+
+// 返回的引用归缓存所有，调用方不得释放
+static NTSTATUS LookupCachedProcess(PBATCH_PROCESS_CACHE Cache, ULONG ProcessId, PEPROCESS* Process)
+{
+    // PID 为 4 的倍数，先去掉低位再散列
+    ULONG slot = ((ProcessId >> 2) * 2654435761UL) & Cache->Mask;
+    while (Cache->Entries[slot].Used && Cache->Entries[slot].ProcessId != ProcessId)
+        slot = (slot + 1) & Cache->Mask;
+
+    PBATCH_PROCESS_ENTRY entry = &Cache->Entries[slot];
+    if (!entry->Used) {
+        entry->Used         = TRUE;
+        entry->ProcessId    = ProcessId;
+        entry->LookupStatus = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &entry->Process);
+        if (!NT_SUCCESS(entry->LookupStatus))
+            entry->Process = NULL;
+        Cache->Lookups++;
+    }
+
+    *Process = entry->Process;
+    return entry->LookupStatus;
+}
+
+static VOID ReleaseProcessCache(PBATCH_PROCESS_CACHE Cache)
+{
+    for (ULONG i = 0; i <= Cache->Mask; i++) {
+        if (Cache->Entries[i].Process)
+            ObDereferenceObject(Cache->Entries[i].Process);
+    }
+}
+
+static NTSTATUS ExecuteCommand(PEPROCESS Process, const BATCH_COMMAND* Command, PULONG Detail)
+{
+    *Detail = 0;
+
+    switch (Command->Opcode) {
+    case BATCH_OP_KILL: {
+        PROCESS_KILL_RESULT result;
+        // 取消只在命令之间生效（见 BatchExecute），单条终止不中途停下
+        NTSTATUS status = ProcessKillObject(Process, NULL, &result);
+        *Detail = result.Method;
+        return status;
+    }
+    case BATCH_OP_FREEZE:            return ProcessFreezeObject(Process);
+    case BATCH_OP_UNFREEZE:          return ProcessUnfreezeObject(Process);
+    case BATCH_OP_PROTECT:           return ProcessProtectObject(Process);
+    case BATCH_OP_UNPROTECT:         return ProcessUnprotectObject(Process);
+    case BATCH_OP_SET_PROTECT_LEVEL: return ProcessSetProtectLevelObject(Process, (UCHAR)Command->Parameter);
+    case BATCH_OP_HIDE:              return HideProcessObject(Process);
+    case BATCH_OP_UNHIDE:            return UnhideProcessObject(Process);
+    default:                         return STATUS_INVALID_PARAMETER;
+    }
+}
+
+NTSTATUS BatchExecute(
+    PVOID           InputBuffer,
+    ULONG           InputBufferSize,
+    PASYNC_PROGRESS Progress,
+    PVOID           OutputBuffer,
+    ULONG           OutputBufferSize,
+    PULONG          BytesWritten)
+{
+    BATCH_REQUEST_HEADER request;
+
+    *BytesWritten = 0;
+    if (InputBufferSize < sizeof(request))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    RtlCopyMemory(&request, InputBuffer, sizeof(request));
+    if (request.Count == 0 || request.Count > BATCH_MAX_COMMANDS)
+        return STATUS_INVALID_PARAMETER;
+    if (request.Flags & ~BATCH_FLAG_STOP_ON_ERROR)
+        return STATUS_INVALID_PARAMETER;
+
+    // Count 有上限，以下长度均不会溢出
+    ULONG commandBytes = request.Count * sizeof(BATCH_COMMAND);
+    ULONG replySize    = sizeof(BATCH_REPLY_HEADER) + request.Count * sizeof(BATCH_RESULT);
+    if (InputBufferSize < sizeof(request) + commandBytes || OutputBufferSize < replySize)
+        return STATUS_BUFFER_TOO_SMALL;
+
+    ULONG capacity = CacheCapacity(request.Count);
+    PUCHAR block = (PUCHAR)ExAllocatePool2(POOL_FLAG_NON_PAGED,
+        commandBytes + capacity * sizeof(BATCH_PROCESS_ENTRY), BATCH_POOL_TAG);
+    if (!block)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    PBATCH_COMMAND commands = (PBATCH_COMMAND)block;
+    RtlCopyMemory(commands, (PUCHAR)InputBuffer + sizeof(request), commandBytes);
+
+    for (ULONG i = 0; i < request.Count; i++) {
+        if (!ValidCommand(&commands[i])) {
+            ExFreePoolWithTag(block, BATCH_POOL_TAG);
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    BATCH_PROCESS_CACHE cache;
+    cache.Entries = (PBATCH_PROCESS_ENTRY)(block + commandBytes);
+    cache.Mask    = capacity - 1;
+    cache.Lookups = 0;
+
+    PBATCH_RESULT results = (PBATCH_RESULT)((PUCHAR)OutputBuffer + sizeof(BATCH_REPLY_HEADER));
+    ULONG completed = 0;
+    BOOLEAN stopped = FALSE;
+
+    for (ULONG i = 0; i < request.Count; i++) {
+        BATCH_RESULT result = { (ULONG)STATUS_CANCELLED, 0 };
+
+        // 取消只在两条命令之间生效，已执行的结果照常返回
+        if (!stopped && AsyncCancelled(Progress))
+            stopped = TRUE;
+
+        if (!stopped) {
+            PEPROCESS process = NULL;
+            NTSTATUS status = LookupCachedProcess(&cache, commands[i].ProcessId, &process);
+            if (NT_SUCCESS(status))
+                status = ExecuteCommand(process, &commands[i], &result.Detail);
+
+            result.Status = (ULONG)status;
+            completed++;
+            AsyncReportProgress(Progress, completed, request.Count);
+            if (!NT_SUCCESS(status) && (request.Flags & BATCH_FLAG_STOP_ON_ERROR))
+                stopped = TRUE;
+        }
+
+        RtlCopyMemory(&results[i], &result, sizeof(result));
+    }
+
+    ReleaseProcessCache(&cache);
+
+    BATCH_REPLY_HEADER reply;
+    reply.Count     = request.Count;
+    reply.Completed = completed;
+    reply.Lookups   = cache.Lookups;
+    reply.Reserved  = 0;
+    RtlCopyMemory(OutputBuffer, &reply, sizeof(reply));
+
+    ExFreePoolWithTag(block, BATCH_POOL_TAG);
+
+    DbgPrint("[OpenSysKit] [Batch] %lu commands, %lu completed, %lu lookups\n",
+        request.Count, completed, cache.Lookups);
+
+    *BytesWritten = replySize;
+    return STATUS_SUCCESS;
+}
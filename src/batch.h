@@ -0,0 +1,17 @@
+#pragma once
+
+#include "driver.h"
+#include "async.h"
+
+#define BATCH_POOL_TAG 'htaB'
+
+// 执行 IOCTL_BATCH（协议见 driver.h）。输入与输出可以是同一块系统缓冲区：
+// 命令在执行前整体拷出，结果只写不回读。
+// 异步执行时每条命令前检查取消，已取消则其余命令按 STATUS_CANCELLED 返回
+NTSTATUS BatchExecute(
+    PVOID           InputBuffer,
+    ULONG           InputBufferSize,
+    PASYNC_PROGRESS Progress,
+    PVOID           OutputBuffer,
+    ULONG           OutputBufferSize,
+    PULONG          BytesWritten);
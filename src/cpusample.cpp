@@ -0,0 +1,173 @@
+#include "cpusample.h"
+
+// SystemProcessInformation 条目中采样用到的前缀
+typedef struct _SYSTEM_PROCESS_ENTRY {
+    ULONG          NextEntryOffset;
+    ULONG          NumberOfThreads;
+    LARGE_INTEGER  Reserved[3];
+    LARGE_INTEGER  CreateTime;
+    LARGE_INTEGER  UserTime;
+    LARGE_INTEGER  KernelTime;
+    UNICODE_STRING ImageName;
+    KPRIORITY      BasePriority;
+    HANDLE         UniqueProcessId;
+} SYSTEM_PROCESS_ENTRY, *PSYSTEM_PROCESS_ENTRY;
+
+typedef struct _CPU_SAMPLE {
+    ULONG    ProcessId;
+    ULONG    Usage;         // 本次与上次采样之间的占用率
+    LONGLONG CreateTime;
+    ULONG64  CpuTime;       // KernelTime + UserTime
+} CPU_SAMPLE, *PCPU_SAMPLE;
+
+// ========== 状态 ==========
+//
+// 锁是初始为有信号的同步事件，在临界区内持有，期间仍在 PASSIVE_LEVEL。
+// g_SampledAt 为当前采样所用快照的 CapturedAt，0 表示还没有采样。
+//
+
+static KEVENT       g_SampleLock;
+static PCPU_SAMPLE  g_Samples     = NULL;
+static ULONG        g_SampleCount = 0;
+static ULONG64      g_SampledAt   = 0;
+static ULONG        g_CpuCount    = 1;
+
+// 临界区挡住普通内核 APC：持锁线程不会被挂起而让枚举请求一直等
+static VOID AcquireSampleLock(VOID)
+{
+    KeEnterCriticalRegion();
+    KeWaitForSingleObject(&g_SampleLock, Executive, KernelMode, FALSE, NULL);
+}
+
+static VOID ReleaseSampleLock(VOID)
+{
+    KeSetEvent(&g_SampleLock, IO_NO_INCREMENT, FALSE);
+    KeLeaveCriticalRegion();
+}
+
+static PSYSTEM_PROCESS_ENTRY NextEntry(PSYSTEM_PROCESS_ENTRY Entry)
+{
+    return Entry->NextEntryOffset ? (PSYSTEM_PROCESS_ENTRY)((PUCHAR)Entry + Entry->NextEntryOffset) : NULL;
+}
+
+// Shell 排序：进程链大体按创建顺序排列，与 PID 顺序相近
+static VOID SortSamples(PCPU_SAMPLE Samples, ULONG Count)
+{
+    static const ULONG gaps[] = { 701, 301, 132, 57, 23, 10, 4, 1 };
+    for (ULONG g = 0; g < RTL_NUMBER_OF(gaps); g++) {
+        ULONG gap = gaps[g];
+        for (ULONG i = gap; i < Count; i++) {
+            CPU_SAMPLE sample = Samples[i];
+            ULONG j = i;
+            while (j >= gap && Samples[j - gap].ProcessId > sample.ProcessId) {
+                Samples[j] = Samples[j - gap];
+                j -= gap;
+            }
+            Samples[j] = sample;
+        }
+    }
+}
+
+// 持锁调用；同一进程（PID 与创建时间都相同）不在当前采样中时返回 NULL
+static PCPU_SAMPLE FindSampleLocked(ULONG ProcessId, LONGLONG CreateTime)
+{
+    ULONG low = 0, high = g_SampleCount;
+    while (low < high) {
+        ULONG mid = low + (high - low) / 2;
+        if (g_Samples[mid].ProcessId < ProcessId)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low < g_SampleCount && g_Samples[low].ProcessId == ProcessId && g_Samples[low].CreateTime == CreateTime)
+        return &g_Samples[low];
+    return NULL;
+}
+
+static VOID UpdateLocked(PPROCESS_SNAPSHOT Snapshot)
+{
+    if (g_SampledAt && Snapshot->CapturedAt < g_SampledAt + (ULONG64)CPU_SAMPLE_MIN_INTERVAL_MS * 10000)
+        return;
+
+    ULONG count = 0;
+    for (PSYSTEM_PROCESS_ENTRY entry = (PSYSTEM_PROCESS_ENTRY)Snapshot->Data; entry; entry = NextEntry(entry))
+        count++;
+
+    // 分配失败时保留上一次采样，之后的快照再试
+    PCPU_SAMPLE samples = (PCPU_SAMPLE)ExAllocatePool2(POOL_FLAG_PAGED,
+        (SIZE_T)count * sizeof(CPU_SAMPLE), CPU_SAMPLE_TAG);
+    if (!samples)
+        return;
+
+    ULONG64 interval = (Snapshot->CapturedAt - g_SampledAt) * g_CpuCount;
+    PCPU_SAMPLE sample = samples;
+    for (PSYSTEM_PROCESS_ENTRY entry = (PSYSTEM_PROCESS_ENTRY)Snapshot->Data; entry; entry = NextEntry(entry), sample++) {
+        sample->ProcessId  = (ULONG)(ULONG_PTR)entry->UniqueProcessId;
+        sample->CreateTime = entry->CreateTime.QuadPart;
+        sample->CpuTime    = (ULONG64)(entry->KernelTime.QuadPart + entry->UserTime.QuadPart);
+        sample->Usage      = 0;
+
+        if (g_SampledAt && interval) {
+            PCPU_SAMPLE previous = FindSampleLocked(sample->ProcessId, sample->CreateTime);
+            ULONG64 base = previous ? previous->CpuTime : 0;
+            ULONG64 used = (sample->CpuTime > base) ? sample->CpuTime - base : 0;
+            sample->Usage = (ULONG)min(used * CPU_SAMPLE_FULL / interval, (ULONG64)CPU_SAMPLE_FULL);
+        }
+    }
+    SortSamples(samples, count);
+
+    if (g_Samples)
+        ExFreePoolWithTag(g_Samples, CPU_SAMPLE_TAG);
+    g_Samples     = samples;
+    g_SampleCount = count;
+    g_SampledAt   = Snapshot->CapturedAt;
+}
+
+// ========== 接口 ==========
+
+VOID CpuSampleUpdate(PPROCESS_SNAPSHOT Snapshot)
+{
+    AcquireSampleLock();
+    UpdateLocked(Snapshot);
+    ReleaseSampleLock();
+}
+
+VOID CpuSampleQuery(PPROCESS_SNAPSHOT Snapshot, PULONG Usage, ULONG Count)
+{
+    AcquireSampleLock();
+    UpdateLocked(Snapshot);
+
+    ULONG index = 0;
+    for (PSYSTEM_PROCESS_ENTRY entry = (PSYSTEM_PROCESS_ENTRY)Snapshot->Data; entry && index < Count; entry = NextEntry(entry)) {
+        PCPU_SAMPLE sample = FindSampleLocked((ULONG)(ULONG_PTR)entry->UniqueProcessId, entry->CreateTime.QuadPart);
+        Usage[index++] = sample ? sample->Usage : 0;
+    }
+    ReleaseSampleLock();
+}
+
+VOID CpuSampleInitialize(VOID)
+{
+    KeInitializeEvent(&g_SampleLock, SynchronizationEvent, TRUE);
+    g_CpuCount    = max(KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS), 1UL);
+    g_Samples     = NULL;
+    g_SampleCount = 0;
+    g_SampledAt   = 0;
+
+    // 取进程表填充时抓取的快照作为第一次采样；失败时第一次查询才开始采样
+    PPROCESS_SNAPSHOT snapshot = NULL;
+    if (NT_SUCCESS(ProcessSnapshotAcquire(PROCESS_SNAPSHOT_FRESH_MS, &snapshot))) {
+        CpuSampleUpdate(snapshot);
+        ProcessSnapshotRelease(snapshot);
+    }
+}
+
+VOID CpuSampleShutdown(VOID)
+{
+    AcquireSampleLock();
+    if (g_Samples)
+        ExFreePoolWithTag(g_Samples, CPU_SAMPLE_TAG);
+    g_Samples     = NULL;
+    g_SampleCount = 0;
+    g_SampledAt   = 0;
+    ReleaseSampleLock();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "driver.h"
+#include "procsnap.h"
+
+#define CPU_SAMPLE_TAG              'uCrP'
+
+// 两次采样的最小间隔；间隔内抓取的快照沿用上一区间的占用率
+#define CPU_SAMPLE_MIN_INTERVAL_MS  500
+
+// 占用率的满值：整机全部逻辑处理器都忙
+#define CPU_SAMPLE_FULL             10000
+
+// ========== 进程 CPU 占用率采样 ==========
+//
+// 保留上一次采样时每个进程（PID + 创建时间）的 KernelTime + UserTime，按 PID 排序。
+// 比上次采样晚至少 CPU_SAMPLE_MIN_INTERVAL_MS 的快照到来时轮换：新采样与上一次
+// 相减，除以两次抓取的间隔与处理器数，得到该区间的占用率。上次采样中没有的进程
+// 是区间内创建的，全部 CPU 时间都算在区间内。
+//
+// 加载时以共用快照作为第一次采样，此前的占用率为 0。
+// 全部接口只能在 PASSIVE_LEVEL 调用。
+//
+
+VOID CpuSampleInitialize(VOID);
+VOID CpuSampleShutdown(VOID);
+
+// 快照足够新时轮换采样
+VOID CpuSampleUpdate(PPROCESS_SNAPSHOT Snapshot);
+
+// 先做 CpuSampleUpdate，再按快照中的顺序写出每个进程的占用率（0..CPU_SAMPLE_FULL）；
+// Count 为 Usage 的容量，不少于快照中的进程数
+VOID CpuSampleQuery(PPROCESS_SNAPSHOT Snapshot, PULONG Usage, ULONG Count);
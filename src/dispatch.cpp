@@ -0,0 +1,669 @@
+#include "dispatch.h"
+#include "async.h"
+#include "batch.h"
+#include "enumsnap.h"
+#include "events.h"
+#include "signature.h"
+#include "process.h"
+#include "proctable.h"
+#include "protect.h"
+#include "shared.h"
+#include "token.h"
+#include "freeze.h"
+#include "memory.h"
+#include "kernelmod.h"
+#include "handle.h"
+#include "network.h"
+#include "threads.h"
+#include "dkom.h"
+#include "unload_driver.h"
+
+// ========== IOCTL 描述符 ==========
+//
+// 每个 IOCTL 一条描述符：最小输入 / 输出长度直接取 driver.h 中的结构大小，
+// 授权与 IRQL 要求由标志声明。分发函数统一做这些检查，处理函数只管业务。
+//
+// 描述符表在编译期校验（设备类型、传输方式、功能码范围与升序），
+// 并生成按功能码下标的索引，运行时查找为 O(1)。
+//
+// METHOD_OUT_DIRECT 的 IOCTL 与 METHOD_BUFFERED 版本共用处理函数：分发函数把
+// 输出 MDL 映射到系统地址后作为 OutBuf 传入。处理函数对 OutBuf 只写不回读，
+// 因为调用方的其他线程可能同时改写这些页。
+//
+// 重叠句柄上的 PASSIVE IOCTL 在检查通过后交给异步线程池（async.cpp），
+// 处理函数在工作线程上运行，Progress 非 NULL；耗时的处理函数在检查点
+// 调用 AsyncCancelled，并可用 AsyncReportProgress 报告进度。
+//
+// 处理函数返回 STATUS_PENDING 表示它已把 IRP 标记挂起并接管（如 IOCTL_READ_EVENTS），
+// 分发函数不再完成它。这类 IOCTL 不能带 PASSIVE 标志，不会交给线程池。
+//
+
+typedef struct _IOCTL_CALL {
+    PVOID           InBuf;
+    ULONG           InLen;
+    PVOID           OutBuf;
+    ULONG           OutLen;
+    ULONG           BytesWritten;
+    PCLIENT_CONTEXT Client;
+    PASYNC_PROGRESS Progress;       // 同步执行时为 NULL
+    PIRP            Irp;
+} IOCTL_CALL, *PIOCTL_CALL;
+
+typedef NTSTATUS (*PIOCTL_HANDLER)(PIOCTL_CALL Call);
+
+typedef struct _IOCTL_DESCRIPTOR {
+    ULONG          IoControlCode;
+    ULONG          MinInput;
+    ULONG          MinOutput;
+    ULONG          Flags;
+    PIOCTL_HANDLER Handler;
+} IOCTL_DESCRIPTOR;
+
+// ========== 处理函数 ==========
+
+// 枚举类 IOCTL 的请求：ENUM_REQUEST 的任意前缀都合法（旧客户端只传 ProcessId 或不传），
+// 缺省字段按 0 处理，Version 为 0 时按 v1，Fields 为 0 时展开为 AllFields；
+// Fields 含 AllFields 之外的位返回 STATUS_INVALID_PARAMETER
+static NTSTATUS ReadEnumRequest(PIOCTL_CALL Call, ULONG AllFields, PENUM_REQUEST Request)
+{
+    RtlZeroMemory(Request, sizeof(*Request));
+    if (Call->InBuf && Call->InLen)
+        RtlCopyMemory(Request, Call->InBuf, min(Call->InLen, (ULONG)sizeof(*Request)));
+
+    if (Request->Version == 0)
+        Request->Version = ENUM_VERSION_1;
+
+    if (Request->Fields & ~AllFields)
+        return STATUS_INVALID_PARAMETER;
+    if (Request->Fields == ENUM_FIELDS_ALL)
+        Request->Fields = AllFields;
+    return STATUS_SUCCESS;
+}
+
+static const ENUM_SOURCE g_ProcessSource       = { ProcessCaptureSnapshot, ProcessFormatSnapshot, ProcessReleaseSnapshot };
+static const ENUM_SOURCE g_ProcessThreadSource = { ProcessCaptureSnapshot, ProcessFormatWithThreads, ProcessReleaseSnapshot };
+static const ENUM_SOURCE g_KernelModuleSource  = { KernelModuleCaptureSnapshot, KernelModuleFormatSnapshot, KernelModuleReleaseSnapshot };
+static const ENUM_SOURCE g_HandleSource        = { HandleCaptureSnapshot, HandleFormatSnapshot, HandleReleaseSnapshot };
+
+static NTSTATUS ServeEnum(PIOCTL_CALL Call, const ENUM_SOURCE* Source, ULONG AllFields)
+{
+    ENUM_REQUEST request;
+    NTSTATUS status = ReadEnumRequest(Call, AllFields, &request);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    return EnumServe(Call->Client, Source, &request, Call->Progress,
+        Call->OutBuf, Call->OutLen, &Call->BytesWritten);
+}
+
+// ----- 进程 -----
+
+static NTSTATUS OnEnumProcesses(PIOCTL_CALL Call)
+{
+    return ServeEnum(Call, &g_ProcessSource, PROCESS_FIELDS_ALL);
+}
+
+// 请求带上次回复中的 Generation，0 表示取全表
+static NTSTATUS OnEnumProcessesDelta(PIOCTL_CALL Call)
+{
+    return ProcessTableEnumerateDelta(((PPROCESS_DELTA_REQUEST)Call->InBuf)->Generation,
+        Call->OutBuf, Call->OutLen, &Call->BytesWritten);
+}
+
+// 进程与线程共用一份快照，令牌属于独立的枚举类型；Fields 只选择进程字段
+static NTSTATUS OnEnumProcessesThreads(PIOCTL_CALL Call)
+{
+    return ServeEnum(Call, &g_ProcessThreadSource, PROCESS_FIELDS_ALL);
+}
+
+static NTSTATUS OnKillProcess(PIOCTL_CALL Call)
+{
+    NTSTATUS status = ProcessKill(((PPROCESS_REQUEST)Call->InBuf)->ProcessId, Call->Progress,
+                                  (PPROCESS_KILL_RESULT)Call->OutBuf);
+    if (NT_SUCCESS(status))
+        Call->BytesWritten = sizeof(PROCESS_KILL_RESULT);
+    return status;
+}
+
+static NTSTATUS OnFreezeProcess(PIOCTL_CALL Call)
+{
+    return ProcessFreeze(((PPROCESS_REQUEST)Call->InBuf)->ProcessId);
+}
+
+static NTSTATUS OnUnfreezeProcess(PIOCTL_CALL Call)
+{
+    return ProcessUnfreeze(((PPROCESS_REQUEST)Call->InBuf)->ProcessId);
+}
+
+static NTSTATUS OnProtectProcess(PIOCTL_CALL Call)
+{
+    return ProcessProtect(((PPROCESS_REQUEST)Call->InBuf)->ProcessId);
+}
+
+static NTSTATUS OnUnprotectProcess(PIOCTL_CALL Call)
+{
+    return ProcessUnprotect(((PPROCESS_REQUEST)Call->InBuf)->ProcessId);
+}
+
+static NTSTATUS OnSetProtectLevel(PIOCTL_CALL Call)
+{
+    PPROCESS_PROTECT_REQUEST req = (PPROCESS_PROTECT_REQUEST)Call->InBuf;
+    return ProcessSetProtectLevel(req->ProcessId, req->ProtectionLevel);
+}
+
+static NTSTATUS OnElevateProcess(PIOCTL_CALL Call)
+{
+    PPROCESS_ELEVATE_REQUEST req = (PPROCESS_ELEVATE_REQUEST)Call->InBuf;
+    return ProcessElevate(req->ProcessId, req->Level);
+}
+
+// 模块链表在目标进程地址空间内现场遍历，没有可保留的快照，令牌被忽略
+static NTSTATUS OnEnumModules(PIOCTL_CALL Call)
+{
+    ENUM_REQUEST request;
+    NTSTATUS status = ReadEnumRequest(Call, MODULE_FIELDS_ALL, &request);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    switch (request.Version) {
+    case ENUM_VERSION_1:
+        return ProcessEnumModules(request.ProcessId, request.Fields,
+            Call->OutBuf, Call->OutLen, &Call->BytesWritten);
+    case ENUM_VERSION_2:
+        return ProcessEnumModulesV2(request.ProcessId, request.Fields,
+            Call->OutBuf, Call->OutLen, &Call->BytesWritten);
+    default:
+        return STATUS_NOT_SUPPORTED;
+    }
+}
+
+// 只有 v1 布局，Version 与令牌被忽略；PROCESS_REQUEST 是 ENUM_REQUEST 的前缀
+static NTSTATUS OnEnumThreads(PIOCTL_CALL Call)
+{
+    ENUM_REQUEST request;
+    NTSTATUS status = ReadEnumRequest(Call, THREAD_FIELDS_ALL, &request);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    return ProcessEnumThreads(request.ProcessId, request.Fields,
+                              Call->OutBuf, Call->OutLen, &Call->BytesWritten);
+}
+
+// ----- 文件 -----
+
+static NTSTATUS OnDeleteFile(PIOCTL_CALL Call)
+{
+    PFILE_PATH_REQUEST req = (PFILE_PATH_REQUEST)Call->InBuf;
+    req->Path[RTL_NUMBER_OF(req->Path) - 1] = L'\0';
+    return FileDeleteKernel(req->Path);
+}
+
+// ----- 内核模块 -----
+
+static NTSTATUS OnEnumKernelModules(PIOCTL_CALL Call)
+{
+    return ServeEnum(Call, &g_KernelModuleSource, MODULE_FIELDS_ALL);
+}
+
+static NTSTATUS OnUnloadDriver(PIOCTL_CALL Call)
+{
+    PDRIVER_SERVICE_REQUEST req = (PDRIVER_SERVICE_REQUEST)Call->InBuf;
+    req->ServiceName[RTL_NUMBER_OF(req->ServiceName) - 1] = L'\0';
+    return ForceUnloadDriver(req->ServiceName);
+}
+
+// ----- 句柄 -----
+
+static NTSTATUS OnEnumHandles(PIOCTL_CALL Call)
+{
+    return ServeEnum(Call, &g_HandleSource, HANDLE_FIELDS_ALL);
+}
+
+static NTSTATUS OnCloseHandle(PIOCTL_CALL Call)
+{
+    PCLOSE_HANDLE_REQUEST req = (PCLOSE_HANDLE_REQUEST)Call->InBuf;
+    return ForceCloseHandle(req->ProcessId, req->Handle);
+}
+
+// ----- 网络 -----
+
+static NTSTATUS OnEnumConnections(PIOCTL_CALL Call)
+{
+    return EnumConnections(Call->OutBuf, Call->OutLen, &Call->BytesWritten);
+}
+
+// ----- DKOM 进程隐藏 -----
+
+static NTSTATUS OnHideProcess(PIOCTL_CALL Call)
+{
+    return HideProcess(((PPROCESS_REQUEST)Call->InBuf)->ProcessId);
+}
+
+static NTSTATUS OnUnhideProcess(PIOCTL_CALL Call)
+{
+    return UnhideProcess(((PPROCESS_REQUEST)Call->InBuf)->ProcessId);
+}
+
+// ----- 批量命令 -----
+
+// 整批共用分发函数的一次授权检查
+static NTSTATUS OnBatch(PIOCTL_CALL Call)
+{
+    return BatchExecute(Call->InBuf, Call->InLen, Call->Progress,
+        Call->OutBuf, Call->OutLen, &Call->BytesWritten);
+}
+
+// ----- 事件通道 -----
+
+static NTSTATUS OnEventSubscribe(PIOCTL_CALL Call)
+{
+    if (!Call->Client) return STATUS_INVALID_DEVICE_REQUEST;
+    return EventsSubscribe(Call->Client, (PEVENT_SUBSCRIBE_REQUEST)Call->InBuf);
+}
+
+// 环中没有事件时挂起，返回 STATUS_PENDING 后 IRP 归事件通道所有
+static NTSTATUS OnReadEvents(PIOCTL_CALL Call)
+{
+    if (!Call->Client) return STATUS_INVALID_DEVICE_REQUEST;
+    return EventsRead(Call->Client, Call->Irp, Call->OutBuf, Call->OutLen, &Call->BytesWritten);
+}
+
+static NTSTATUS OnGetEventStats(PIOCTL_CALL Call)
+{
+    if (!Call->Client) return STATUS_INVALID_DEVICE_REQUEST;
+    EventsQueryStats(Call->Client, (PEVENT_STATS)Call->OutBuf);
+    Call->BytesWritten = sizeof(EVENT_STATS);
+    return STATUS_SUCCESS;
+}
+
+// ----- 共享快照区 -----
+
+// 视图映射进当前进程，描述符带 CALLER_CONTEXT，不会在工作线程上执行
+static NTSTATUS OnMapSharedSection(PIOCTL_CALL Call)
+{
+    if (!Call->Client) return STATUS_INVALID_DEVICE_REQUEST;
+    NTSTATUS status = SharedMapClient(Call->Client, (PSHARED_MAP_REPLY)Call->OutBuf);
+    if (NT_SUCCESS(status))
+        Call->BytesWritten = sizeof(SHARED_MAP_REPLY);
+    return status;
+}
+
+static NTSTATUS OnRefreshSharedSection(PIOCTL_CALL Call)
+{
+    PSHARED_REFRESH_REPLY reply = (PSHARED_REFRESH_REPLY)Call->OutBuf;
+    NTSTATUS status = SharedRefresh(&reply->Generation);
+    if (NT_SUCCESS(status))
+        Call->BytesWritten = sizeof(SHARED_REFRESH_REPLY);
+    return status;
+}
+
+// ----- 签名校验 / 诊断 -----
+
+static NTSTATUS OnGetSignatureStats(PIOCTL_CALL Call)
+{
+    GetSignatureStats((PSIGNATURE_STATS)Call->OutBuf);
+    Call->BytesWritten = sizeof(SIGNATURE_STATS);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS OnGetDispatchStats(PIOCTL_CALL Call);
+
+static NTSTATUS OnGetAsyncStatus(PIOCTL_CALL Call)
+{
+    if (!Call->Client) return STATUS_INVALID_DEVICE_REQUEST;
+    return AsyncQueryClient(Call->Client, Call->OutBuf, Call->OutLen, &Call->BytesWritten);
+}
+
+// ----- 生命周期 -----
+
+static NTSTATUS OnDetachSymlink(PIOCTL_CALL Call)
+{
+    UNREFERENCED_PARAMETER(Call);
+
+    UNICODE_STRING symLinkName;
+    RtlInitUnicodeString(&symLinkName, SYMLINK_NAME);
+    NTSTATUS status = IoDeleteSymbolicLink(&symLinkName);
+    DbgPrint("[OpenSysKit] IOCTL_DETACH_SYMLINK: 0x%X\n", status);
+    return status;
+}
+
+// ========== 描述符表 ==========
+
+#define AUTH     IOCTL_FLAG_AUTHORIZED
+#define PASSIVE  IOCTL_FLAG_PASSIVE
+#define DISABLED IOCTL_FLAG_DISABLED
+#define CALLER   IOCTL_FLAG_CALLER_CONTEXT
+
+static constexpr IOCTL_DESCRIPTOR g_IoctlTable[] = {
+    // 控制码                           最小输入                          最小输出                            标志              处理函数
+    { IOCTL_ENUM_PROCESSES,             0,                                sizeof(PROCESS_LIST_HEADER),        AUTH | PASSIVE,   OnEnumProcesses },
+    { IOCTL_KILL_PROCESS,               sizeof(PROCESS_REQUEST),          sizeof(PROCESS_KILL_RESULT),        AUTH | PASSIVE,   OnKillProcess },
+    { IOCTL_FREEZE_PROCESS,             sizeof(PROCESS_REQUEST),          0,                                  AUTH | PASSIVE,   OnFreezeProcess },
+    { IOCTL_UNFREEZE_PROCESS,           sizeof(PROCESS_REQUEST),          0,                                  AUTH | PASSIVE,   OnUnfreezeProcess },
+    { IOCTL_PROTECT_PROCESS,            sizeof(PROCESS_REQUEST),          0,                                  AUTH | PASSIVE,   OnProtectProcess },
+    { IOCTL_UNPROTECT_PROCESS,          sizeof(PROCESS_REQUEST),          0,                                  AUTH | PASSIVE,   OnUnprotectProcess },
+    { IOCTL_ELEVATE_PROCESS,            sizeof(PROCESS_ELEVATE_REQUEST),  0,                                  AUTH | PASSIVE,   OnElevateProcess },
+    { IOCTL_ENUM_MODULES,               sizeof(PROCESS_REQUEST),          sizeof(MODULE_LIST_HEADER),         AUTH | PASSIVE,   OnEnumModules },
+    // 暂时禁用 - 能直接读写任意进程内存
+    { IOCTL_READ_PROCESS_MEMORY,        0,                                0,                                  AUTH | DISABLED,  NULL },
+    { IOCTL_WRITE_PROCESS_MEMORY,       0,                                0,                                  AUTH | DISABLED,  NULL },
+    { IOCTL_ENUM_THREADS,               sizeof(PROCESS_REQUEST),          sizeof(THREAD_LIST_HEADER),         AUTH | PASSIVE,   OnEnumThreads },
+    { IOCTL_HIDE_PROCESS,               sizeof(PROCESS_REQUEST),          0,                                  AUTH | PASSIVE,   OnHideProcess },
+    { IOCTL_UNHIDE_PROCESS,             sizeof(PROCESS_REQUEST),          0,                                  AUTH | PASSIVE,   OnUnhideProcess },
+    // 暂时禁用 - 拿去干坏事怎么办
+    { IOCTL_INJECT_DLL,                 0,                                0,                                  AUTH | DISABLED,  NULL },
+    { IOCTL_SET_PROTECT_LEVEL,          sizeof(PROCESS_PROTECT_REQUEST),  0,                                  AUTH | PASSIVE,   OnSetProtectLevel },
+    { IOCTL_DELETE_FILE,                sizeof(FILE_PATH_REQUEST),        0,                                  AUTH | PASSIVE,   OnDeleteFile },
+    { IOCTL_ENUM_KERNEL_MODULES,        0,                                sizeof(KERNEL_MODULE_LIST_HEADER),  AUTH | PASSIVE,   OnEnumKernelModules },
+    { IOCTL_UNLOAD_DRIVER,              sizeof(DRIVER_SERVICE_REQUEST),   0,                                  AUTH | PASSIVE,   OnUnloadDriver },
+    { IOCTL_ENUM_HANDLES,               sizeof(HANDLE_ENUM_REQUEST),      sizeof(HANDLE_LIST_HEADER),         AUTH | PASSIVE,   OnEnumHandles },
+    { IOCTL_CLOSE_HANDLE,               sizeof(CLOSE_HANDLE_REQUEST),     0,                                  AUTH | PASSIVE,   OnCloseHandle },
+    // 暂时禁用 - 可绕过 ACL 删除杀软注册表项
+    { IOCTL_REG_DELETE_KEY,             0,                                0,                                  AUTH | DISABLED,  NULL },
+    { IOCTL_REG_DELETE_VALUE,           0,                                0,                                  AUTH | DISABLED,  NULL },
+    { IOCTL_ENUM_CONNECTIONS,           0,                                sizeof(CONNECTION_LIST_HEADER),     AUTH | PASSIVE,   OnEnumConnections },
+    { IOCTL_GET_SIGNATURE_STATS,        0,                                sizeof(SIGNATURE_STATS),            AUTH,             OnGetSignatureStats },
+    { IOCTL_GET_DISPATCH_STATS,         0,                                sizeof(DISPATCH_STATS_HEADER),      AUTH,             OnGetDispatchStats },
+    { IOCTL_GET_ASYNC_STATUS,           0,                                sizeof(ASYNC_STATUS_HEADER),        AUTH,             OnGetAsyncStatus },
+    { IOCTL_ENUM_PROCESSES_DIRECT,      0,                                sizeof(PROCESS_LIST_HEADER),        AUTH | PASSIVE,   OnEnumProcesses },
+    { IOCTL_ENUM_KERNEL_MODULES_DIRECT, 0,                                sizeof(KERNEL_MODULE_LIST_HEADER),  AUTH | PASSIVE,   OnEnumKernelModules },
+    { IOCTL_ENUM_HANDLES_DIRECT,        sizeof(HANDLE_ENUM_REQUEST),      sizeof(HANDLE_LIST_HEADER),         AUTH | PASSIVE,   OnEnumHandles },
+    { IOCTL_BATCH,                      sizeof(BATCH_REQUEST_HEADER),     sizeof(BATCH_REPLY_HEADER),         AUTH | PASSIVE,   OnBatch },
+    { IOCTL_EVENT_SUBSCRIBE,            sizeof(EVENT_SUBSCRIBE_REQUEST),  0,                                  AUTH,             OnEventSubscribe },
+    { IOCTL_READ_EVENTS,                0,                                sizeof(EVENT_READ_HEADER) + EVENT_MAX_RECORD_SIZE, AUTH, OnReadEvents },
+    { IOCTL_GET_EVENT_STATS,            0,                                sizeof(EVENT_STATS),                AUTH,             OnGetEventStats },
+    { IOCTL_MAP_SHARED_SECTION,         0,                                sizeof(SHARED_MAP_REPLY),           AUTH | PASSIVE | CALLER, OnMapSharedSection },
+    { IOCTL_REFRESH_SHARED_SECTION,     0,                                sizeof(SHARED_REFRESH_REPLY),       AUTH | PASSIVE,   OnRefreshSharedSection },
+    { IOCTL_ENUM_PROCESSES_DELTA,       sizeof(PROCESS_DELTA_REQUEST),    sizeof(PROCESS_DELTA_HEADER),       AUTH | PASSIVE,   OnEnumProcessesDelta },
+    { IOCTL_ENUM_PROCESSES_THREADS,     0,                                sizeof(PROCESS_THREAD_HEADER),      AUTH | PASSIVE,   OnEnumProcessesThreads },
+    { IOCTL_ENUM_PROCESSES_THREADS_DIRECT, 0,                             sizeof(PROCESS_THREAD_HEADER),      AUTH | PASSIVE,   OnEnumProcessesThreads },
+    { IOCTL_DETACH_SYMLINK,             0,                                0,                                  AUTH | PASSIVE,   OnDetachSymlink },
+};
+
+#undef AUTH
+#undef PASSIVE
+#undef DISABLED
+#undef CALLER
+
+#define IOCTL_COUNT             ((ULONG)RTL_NUMBER_OF(g_IoctlTable))
+#define IOCTL_FUNCTION_BASE     0x800
+#define IOCTL_FUNCTION_SLOTS    0x100
+
+static constexpr ULONG IoctlDeviceType(ULONG Code) { return Code >> 16; }
+static constexpr ULONG IoctlFunction(ULONG Code)   { return (Code >> 2) & 0xFFF; }
+static constexpr ULONG IoctlMethod(ULONG Code)     { return Code & 3; }
+
+static constexpr BOOLEAN IoctlTableValid()
+{
+    for (ULONG i = 0; i < IOCTL_COUNT; i++) {
+        const IOCTL_DESCRIPTOR& d = g_IoctlTable[i];
+        if (IoctlDeviceType(d.IoControlCode) != DEVICE_TYPE_OPENSYSKIT) return FALSE;
+        if (IoctlMethod(d.IoControlCode) != METHOD_BUFFERED &&
+            IoctlMethod(d.IoControlCode) != METHOD_OUT_DIRECT) return FALSE;
+        if (IoctlFunction(d.IoControlCode) < IOCTL_FUNCTION_BASE ||
+            IoctlFunction(d.IoControlCode) >= IOCTL_FUNCTION_BASE + IOCTL_FUNCTION_SLOTS) return FALSE;
+        if (((d.Flags & IOCTL_FLAG_DISABLED) != 0) != (d.Handler == NULL)) return FALSE;
+        // 严格升序：功能码不重复，统计输出也按此顺序
+        if (i > 0 && IoctlFunction(g_IoctlTable[i - 1].IoControlCode) >= IoctlFunction(d.IoControlCode))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+C_ASSERT(IoctlTableValid());
+C_ASSERT(IOCTL_COUNT < 0xFF);
+
+// 功能码 - IOCTL_FUNCTION_BASE -> 描述符下标 + 1（0 表示未注册）
+typedef struct _IOCTL_INDEX {
+    UCHAR Slot[IOCTL_FUNCTION_SLOTS];
+} IOCTL_INDEX;
+
+static constexpr IOCTL_INDEX BuildIoctlIndex()
+{
+    IOCTL_INDEX index = {};
+    for (ULONG i = 0; i < IOCTL_COUNT; i++)
+        index.Slot[IoctlFunction(g_IoctlTable[i].IoControlCode) - IOCTL_FUNCTION_BASE] = (UCHAR)(i + 1);
+    return index;
+}
+
+static constexpr IOCTL_INDEX g_IoctlIndex = BuildIoctlIndex();
+
+// 找不到或方法 / 访问位不符时返回 MAXULONG
+static ULONG LookupIoctl(ULONG IoControlCode)
+{
+    ULONG slot = IoctlFunction(IoControlCode) - IOCTL_FUNCTION_BASE;
+    if (IoctlDeviceType(IoControlCode) != DEVICE_TYPE_OPENSYSKIT || slot >= IOCTL_FUNCTION_SLOTS)
+        return MAXULONG;
+
+    ULONG index = g_IoctlIndex.Slot[slot];
+    if (index == 0 || g_IoctlTable[index - 1].IoControlCode != IoControlCode)
+        return MAXULONG;
+    return index - 1;
+}
+
+// ========== 统计 ==========
+//
+// 与签名统计相同按 CPU 分块累加，查询时求和。
+//
+
+typedef struct _IOCTL_COUNTERS {
+    LONG64 Calls;
+    LONG64 Failures;
+    LONG64 Rejected;
+    LONG64 Ticks;
+    LONG64 Latency[DISPATCH_STATS_BUCKETS];
+} IOCTL_COUNTERS;
+
+typedef struct DECLSPEC_CACHEALIGN _DISPATCH_CPU_STATS {
+    LONG64         Unrecognized;
+    IOCTL_COUNTERS Ioctl[IOCTL_COUNT];
+} DISPATCH_CPU_STATS, *PDISPATCH_CPU_STATS;
+
+static PDISPATCH_CPU_STATS g_DispatchStats = NULL;
+static ULONG g_DispatchCpuCount = 0;
+static ULONG64 g_TicksPerSecond = 0;
+
+static PDISPATCH_CPU_STATS LocalDispatchStats(VOID)
+{
+    if (!g_DispatchStats) return NULL;
+    ULONG cpu = KeGetCurrentProcessorNumberEx(NULL);
+    return &g_DispatchStats[cpu < g_DispatchCpuCount ? cpu : 0];
+}
+
+static ULONG64 TicksToMicroseconds(ULONG64 Ticks)
+{
+    return g_TicksPerSecond ? Ticks * 1000000 / g_TicksPerSecond : 0;
+}
+
+static ULONG LatencyBucket(ULONG64 Ticks)
+{
+    ULONG64 us = TicksToMicroseconds(Ticks);
+    ULONG index;
+    if (us < 2 || !_BitScanReverse64(&index, us)) return 0;
+    return index < DISPATCH_STATS_BUCKETS ? index : DISPATCH_STATS_BUCKETS - 1;
+}
+
+NTSTATUS InitializeDispatchStats(VOID)
+{
+    LARGE_INTEGER freq;
+    KeQueryPerformanceCounter(&freq);
+    g_TicksPerSecond = (ULONG64)freq.QuadPart;
+
+    g_DispatchCpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    g_DispatchStats = (PDISPATCH_CPU_STATS)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, (SIZE_T)g_DispatchCpuCount * sizeof(DISPATCH_CPU_STATS), DISPATCH_STATS_TAG);
+    if (!g_DispatchStats) {
+        g_DispatchCpuCount = 0;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    return STATUS_SUCCESS;
+}
+
+VOID CleanupDispatchStats(VOID)
+{
+    if (g_DispatchStats) {
+        ExFreePoolWithTag(g_DispatchStats, DISPATCH_STATS_TAG);
+        g_DispatchStats = NULL;
+    }
+    g_DispatchCpuCount = 0;
+}
+
+static NTSTATUS OnGetDispatchStats(PIOCTL_CALL Call)
+{
+    PDISPATCH_STATS_HEADER header = (PDISPATCH_STATS_HEADER)Call->OutBuf;
+    PDISPATCH_IOCTL_STATS  entry  = (PDISPATCH_IOCTL_STATS)(header + 1);
+    ULONG maxEntries = (Call->OutLen - sizeof(DISPATCH_STATS_HEADER)) / sizeof(DISPATCH_IOCTL_STATS);
+    ULONG count = min(maxEntries, IOCTL_COUNT);
+
+    RtlZeroMemory(header, sizeof(DISPATCH_STATS_HEADER) + count * sizeof(DISPATCH_IOCTL_STATS));
+    header->Version   = DISPATCH_STATS_VERSION;
+    header->EntrySize = sizeof(DISPATCH_IOCTL_STATS);
+    header->Count     = count;
+    header->TotalSize = sizeof(DISPATCH_STATS_HEADER) + IOCTL_COUNT * sizeof(DISPATCH_IOCTL_STATS);
+
+    for (ULONG i = 0; i < count; i++) {
+        entry[i].IoControlCode = g_IoctlTable[i].IoControlCode;
+        entry[i].Flags         = g_IoctlTable[i].Flags;
+    }
+
+    for (ULONG cpu = 0; cpu < g_DispatchCpuCount; cpu++) {
+        const DISPATCH_CPU_STATS* c = &g_DispatchStats[cpu];
+        header->Unrecognized += (ULONG64)ReadNoFence64(&c->Unrecognized);
+        for (ULONG i = 0; i < count; i++) {
+            const IOCTL_COUNTERS* ioctl = &c->Ioctl[i];
+            entry[i].Calls             += (ULONG64)ReadNoFence64(&ioctl->Calls);
+            entry[i].Failures          += (ULONG64)ReadNoFence64(&ioctl->Failures);
+            entry[i].Rejected          += (ULONG64)ReadNoFence64(&ioctl->Rejected);
+            entry[i].TotalMicroseconds += (ULONG64)ReadNoFence64(&ioctl->Ticks);
+            for (ULONG b = 0; b < DISPATCH_STATS_BUCKETS; b++)
+                entry[i].Latency[b] += (ULONG64)ReadNoFence64(&ioctl->Latency[b]);
+        }
+    }
+    for (ULONG i = 0; i < count; i++)
+        entry[i].TotalMicroseconds = TicksToMicroseconds(entry[i].TotalMicroseconds);
+
+    Call->BytesWritten = sizeof(DISPATCH_STATS_HEADER) + count * sizeof(DISPATCH_IOCTL_STATS);
+    return STATUS_SUCCESS;
+}
+
+// ========== 分发 ==========
+
+// METHOD_OUT_DIRECT：输入仍在 SystemBuffer，输出为 I/O 管理器锁定的调用方页
+static NTSTATUS MapDirectOutput(PIRP Irp, PIOCTL_CALL Call)
+{
+    if (!Irp->MdlAddress) return STATUS_INVALID_PARAMETER;
+
+    Call->OutBuf = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+    return Call->OutBuf ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+static NTSTATUS CheckRequest(const IOCTL_DESCRIPTOR* Descriptor, PIOCTL_CALL Call)
+{
+    if ((Descriptor->Flags & IOCTL_FLAG_AUTHORIZED) && (!Call->Client || !Call->Client->Authorized))
+        return STATUS_ACCESS_DENIED;
+    if (Descriptor->Flags & IOCTL_FLAG_DISABLED)
+        return STATUS_NOT_SUPPORTED;
+    if ((Descriptor->Flags & IOCTL_FLAG_PASSIVE) && KeGetCurrentIrql() != PASSIVE_LEVEL)
+        return STATUS_INVALID_DEVICE_STATE;
+    if (Call->InLen < Descriptor->MinInput || Call->OutLen < Descriptor->MinOutput)
+        return STATUS_BUFFER_TOO_SMALL;
+    return STATUS_SUCCESS;
+}
+
+static VOID InitializeCall(PIRP Irp, PIOCTL_CALL Call)
+{
+    PIO_STACK_LOCATION irpSp = IoGetCurrentIrpStackLocation(Irp);
+
+    Call->InBuf        = Irp->AssociatedIrp.SystemBuffer;
+    Call->InLen        = irpSp->Parameters.DeviceIoControl.InputBufferLength;
+    Call->OutBuf       = Irp->AssociatedIrp.SystemBuffer;
+    Call->OutLen       = irpSp->Parameters.DeviceIoControl.OutputBufferLength;
+    Call->BytesWritten = 0;
+    Call->Client       = irpSp->FileObject ? (PCLIENT_CONTEXT)irpSp->FileObject->FsContext2 : NULL;
+    Call->Progress     = NULL;
+    Call->Irp          = Irp;
+}
+
+static NTSTATUS InvokeHandler(ULONG Index, PIOCTL_CALL Call)
+{
+    ULONG64 start = (ULONG64)KeQueryPerformanceCounter(NULL).QuadPart;
+    NTSTATUS status = g_IoctlTable[Index].Handler(Call);
+    ULONG64 ticks = (ULONG64)KeQueryPerformanceCounter(NULL).QuadPart - start;
+
+    // 处理函数可能阻塞并迁移 CPU，调用后再取本地块
+    PDISPATCH_CPU_STATS stats = LocalDispatchStats();
+    if (stats) {
+        IOCTL_COUNTERS* counters = &stats->Ioctl[Index];
+        InterlockedIncrementNoFence64(&counters->Calls);
+        if (NT_ERROR(status)) InterlockedIncrementNoFence64(&counters->Failures);
+        InterlockedAddNoFence64(&counters->Ticks, (LONG64)ticks);
+        InterlockedIncrementNoFence64(&counters->Latency[LatencyBucket(ticks)]);
+    }
+    return status;
+}
+
+// 工作线程上执行排队的 IOCTL。描述符检查与输出映射已在分发时做过，
+// MDL 的系统地址映射随 IRP 保留，这里再次取得的是同一地址
+static NTSTATUS RunQueuedIoctl(PIRP Irp, PASYNC_PROGRESS Progress, PULONG_PTR Information)
+{
+    ULONG ioctl = IoGetCurrentIrpStackLocation(Irp)->Parameters.DeviceIoControl.IoControlCode;
+    IOCTL_CALL call;
+    InitializeCall(Irp, &call);
+    call.Progress = Progress;
+
+    NTSTATUS status = STATUS_SUCCESS;
+    if (IoctlMethod(ioctl) == METHOD_OUT_DIRECT)
+        status = MapDirectOutput(Irp, &call);
+    if (NT_SUCCESS(status))
+        status = InvokeHandler(LookupIoctl(ioctl), &call);
+
+    *Information = call.BytesWritten;
+    return status;
+}
+
+NTSTATUS DispatchDeviceControl(PDEVICE_OBJECT DeviceObject, PIRP Irp)
+{
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    ULONG ioctl = IoGetCurrentIrpStackLocation(Irp)->Parameters.DeviceIoControl.IoControlCode;
+    IOCTL_CALL call;
+    InitializeCall(Irp, &call);
+
+    NTSTATUS status;
+
+    ULONG index = LookupIoctl(ioctl);
+    if (index == MAXULONG) {
+        // 未授权的客户端看不到控制码是否存在
+        status = (call.Client && call.Client->Authorized)
+            ? STATUS_INVALID_DEVICE_REQUEST
+            : STATUS_ACCESS_DENIED;
+        PDISPATCH_CPU_STATS stats = LocalDispatchStats();
+        if (stats) InterlockedIncrementNoFence64(&stats->Unrecognized);
+    } else {
+        const IOCTL_DESCRIPTOR* descriptor = &g_IoctlTable[index];
+        status = CheckRequest(descriptor, &call);
+        if (NT_SUCCESS(status) && IoctlMethod(ioctl) == METHOD_OUT_DIRECT)
+            status = MapDirectOutput(Irp, &call);
+        if (!NT_SUCCESS(status)) {
+            PDISPATCH_CPU_STATS stats = LocalDispatchStats();
+            if (stats) InterlockedIncrementNoFence64(&stats->Ioctl[index].Rejected);
+        } else {
+            if ((descriptor->Flags & (IOCTL_FLAG_PASSIVE | IOCTL_FLAG_CALLER_CONTEXT)) == IOCTL_FLAG_PASSIVE &&
+                AsyncEligible(Irp)) {
+                // IRP 已归线程池，之后不能再访问
+                if (AsyncQueueIrp(Irp, call.Client, RunQueuedIoctl) == STATUS_PENDING)
+                    return STATUS_PENDING;
+                // 队列已满或内存不足：退回调用线程上执行
+            }
+            status = InvokeHandler(index, &call);
+            // 处理函数已接管 IRP
+            if (status == STATUS_PENDING)
+                return STATUS_PENDING;
+        }
+    }
+
+    Irp->IoStatus.Status      = status;
+    Irp->IoStatus.Information = call.BytesWritten;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    return status;
+}
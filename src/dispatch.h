@@ -0,0 +1,12 @@
+#pragma once
+
+#include "driver.h"
+
+#define DISPATCH_STATS_TAG 'tSdK'
+
+// 分发统计为尽力而为：分配失败时 IOCTL 照常处理，只是不计数
+NTSTATUS InitializeDispatchStats(VOID);
+VOID CleanupDispatchStats(VOID);
+
+// IRP_MJ_DEVICE_CONTROL
+NTSTATUS DispatchDeviceControl(PDEVICE_OBJECT DeviceObject, PIRP Irp);
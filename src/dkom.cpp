@@ -64,40 +64,35 @@ static VOID EnsureInit()
     }
 }
 
-NTSTATUS HideProcess(ULONG ProcessId)
+NTSTATUS HideProcessObject(PEPROCESS Process)
 {
-    if (ProcessId == 0 || ProcessId == 4) return STATUS_ACCESS_DENIED;
+    ULONG processId = (ULONG)(ULONG_PTR)PsGetProcessId(Process);
+    if (processId == 0 || processId == 4) return STATUS_ACCESS_DENIED;
 
     EnsureInit();
     if (g_LinksOffset == 0) return STATUS_UNSUCCESSFUL;
 
-    PEPROCESS process = nullptr;
-    NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
-    if (!NT_SUCCESS(status)) return status;
-
     KIRQL irql;
     KeAcquireSpinLock(&g_HiddenLock, &irql);
 
     // 已在隐藏表中则幂等返回
     for (ULONG i = 0; i < g_HiddenCount; i++) {
-        if (g_HiddenTable[i].ProcessId == ProcessId) {
+        if (g_HiddenTable[i].ProcessId == processId) {
             KeReleaseSpinLock(&g_HiddenLock, irql);
-            ObDereferenceObject(process);
             return STATUS_SUCCESS;
         }
     }
 
     if (g_HiddenCount >= MAX_HIDDEN_PIDS) {
         KeReleaseSpinLock(&g_HiddenLock, irql);
-        ObDereferenceObject(process);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    PLIST_ENTRY entry = (PLIST_ENTRY)((PUCHAR)process + g_LinksOffset);
+    PLIST_ENTRY entry = (PLIST_ENTRY)((PUCHAR)Process + g_LinksOffset);
     PLIST_ENTRY flink = entry->Flink;
     PLIST_ENTRY blink = entry->Blink;
 
-    g_HiddenTable[g_HiddenCount++] = { ProcessId, flink, blink };
+    g_HiddenTable[g_HiddenCount++] = { processId, flink, blink };
 
     // 摘除节点，自身成单节点环
     flink->Blink = blink;
@@ -106,35 +101,31 @@ NTSTATUS HideProcess(ULONG ProcessId)
     entry->Blink = entry;
 
     KeReleaseSpinLock(&g_HiddenLock, irql);
-    ObDereferenceObject(process);
 
-    DbgPrint("[OpenSysKit] [DKOM] PID=%lu hidden\n", ProcessId);
+    DbgPrint("[OpenSysKit] [DKOM] PID=%lu hidden\n", processId);
     return STATUS_SUCCESS;
 }
 
-NTSTATUS UnhideProcess(ULONG ProcessId)
+NTSTATUS UnhideProcessObject(PEPROCESS Process)
 {
-    EnsureInit();
+    ULONG processId = (ULONG)(ULONG_PTR)PsGetProcessId(Process);
 
-    PEPROCESS process = nullptr;
-    NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
-    if (!NT_SUCCESS(status)) return status;
+    EnsureInit();
 
     KIRQL irql;
     KeAcquireSpinLock(&g_HiddenLock, &irql);
 
     ULONG idx = MAXULONG;
     for (ULONG i = 0; i < g_HiddenCount; i++) {
-        if (g_HiddenTable[i].ProcessId == ProcessId) { idx = i; break; }
+        if (g_HiddenTable[i].ProcessId == processId) { idx = i; break; }
     }
 
     if (idx == MAXULONG) {
         KeReleaseSpinLock(&g_HiddenLock, irql);
-        ObDereferenceObject(process);
         return STATUS_NOT_FOUND;
     }
 
-    PLIST_ENTRY entry = (PLIST_ENTRY)((PUCHAR)process + g_LinksOffset);
+    PLIST_ENTRY entry = (PLIST_ENTRY)((PUCHAR)Process + g_LinksOffset);
     PLIST_ENTRY flink = g_HiddenTable[idx].OldFlink;
     PLIST_ENTRY blink = g_HiddenTable[idx].OldBlink;
 
@@ -148,8 +139,32 @@ NTSTATUS UnhideProcess(ULONG ProcessId)
     RtlZeroMemory(&g_HiddenTable[g_HiddenCount], sizeof(HIDDEN_ENTRY));
 
     KeReleaseSpinLock(&g_HiddenLock, irql);
-    ObDereferenceObject(process);
 
-    DbgPrint("[OpenSysKit] [DKOM] PID=%lu unhidden\n", ProcessId);
+    DbgPrint("[OpenSysKit] [DKOM] PID=%lu unhidden\n", processId);
     return STATUS_SUCCESS;
 }
+
+// 按 PID 的入口：查找 EPROCESS 后转交上面的实现
+NTSTATUS HideProcess(ULONG ProcessId)
+{
+    if (ProcessId == 0 || ProcessId == 4) return STATUS_ACCESS_DENIED;
+
+    PEPROCESS process = nullptr;
+    NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
+    if (!NT_SUCCESS(status)) return status;
+
+    status = HideProcessObject(process);
+    ObDereferenceObject(process);
+    return status;
+}
+
+NTSTATUS UnhideProcess(ULONG ProcessId)
+{
+    PEPROCESS process = nullptr;
+    NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
+    if (!NT_SUCCESS(status)) return status;
+
+    status = UnhideProcessObject(process);
+    ObDereferenceObject(process);
+    return status;
+}
@@ -6,3 +6,7 @@ NTSTATUS HideProcess(ULONG ProcessId);
 
 // 将已隐藏的进程重新插回链表（恢复可见性）
 NTSTATUS UnhideProcess(ULONG ProcessId);
+
+// 同上，作用于调用方已引用的 EPROCESS（批量命令复用同一引用）
+NTSTATUS HideProcessObject(PEPROCESS Process);
+NTSTATUS UnhideProcessObject(PEPROCESS Process);
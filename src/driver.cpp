@@ -1,221 +1,96 @@
 #include "driver.h"
+#include "async.h"
+#include "cpusample.h"
+#include "dispatch.h"
+#include "enumsnap.h"
+#include "events.h"
+#include "shared.h"
 #include "signature.h"
 #include "process.h"
+#include "procsnap.h"
+#include "proctable.h"
 #include "protect.h"
-#include "token.h"
-#include "freeze.h"
-#include "memory.h"
-#include "kernelmod.h"
-#include "handle.h"
-#include "registry.h"
-#include "network.h"
-#include "threads.h"
-#include "inject.h"
-#include "dkom.h"
-#include "unload_driver.h"
 
 DRIVER_CONTEXT g_DriverContext = { 0 };
 
-static NTSTATUS DispatchCreateClose(PDEVICE_OBJECT DeviceObject, PIRP Irp)
+// ========== 打开 / 清理 / 关闭 ==========
+//
+// 签名校验只在 IRP_MJ_CREATE 做一次：此时运行在打开者的进程上下文中，
+// VerifyCallerSignature 拿到的就是打开设备的进程。结果挂在 FileObject 上，
+// 同一句柄后续的 IOCTL 只需读一次 FsContext2。
+//
+// 校验失败时仍允许打开（与旧行为一致），但所有 IOCTL 返回 STATUS_ACCESS_DENIED。
+//
+// 最后一个用户句柄关闭时先收到 IRP_MJ_CLEANUP：取消该句柄上挂起的异步请求与读事件请求，
+// 并在打开者进程上下文中解除共享快照区视图。
+// IRP_MJ_CLOSE 要等这些 IRP 全部完成后才到来，届时释放客户端上下文。
+//
+
+static NTSTATUS OnCreate(PIO_STACK_LOCATION irpSp)
 {
-    UNREFERENCED_PARAMETER(DeviceObject);
-    Irp->IoStatus.Status      = STATUS_SUCCESS;
-    Irp->IoStatus.Information = 0;
-    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    PFILE_OBJECT fileObject = irpSp->FileObject;
+    if (!fileObject) return STATUS_INVALID_PARAMETER;
+
+    PCLIENT_CONTEXT ctx = (PCLIENT_CONTEXT)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, sizeof(CLIENT_CONTEXT), CLIENT_CONTEXT_TAG);
+    if (!ctx) return STATUS_INSUFFICIENT_RESOURCES;
+
+    SIGNATURE_STATUS sigStatus = VerifyCallerSignature();
+
+    ctx->Authorized      = (sigStatus == SignatureValid);
+    ctx->ProcessId       = (ULONG)(ULONG_PTR)PsGetCurrentProcessId();
+    ctx->Process         = PsGetCurrentProcess();
+    ObReferenceObject(ctx->Process);
+    ctx->SignatureStatus = (ULONG)sigStatus;
+
+    if (!ctx->Authorized) {
+        DbgPrint("[OpenSysKit] PID=%lu opened device without valid signature: %d\n",
+            ctx->ProcessId, sigStatus);
+    }
+
+    fileObject->FsContext2 = ctx;
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS DispatchDeviceControl(PDEVICE_OBJECT DeviceObject, PIRP Irp)
+static VOID OnCleanup(PIO_STACK_LOCATION irpSp)
 {
-    UNREFERENCED_PARAMETER(DeviceObject);
+    PFILE_OBJECT fileObject = irpSp->FileObject;
+    if (!fileObject || !fileObject->FsContext2) return;
 
-    SIGNATURE_STATUS sigStatus = VerifyCallerSignature();
-    if (sigStatus != SignatureValid) {
-        DbgPrint("[OpenSysKit] Caller signature verification failed: %d\n", sigStatus);
-        Irp->IoStatus.Status = STATUS_ACCESS_DENIED;
-        Irp->IoStatus.Information = 0;
-        IoCompleteRequest(Irp, IO_NO_INCREMENT);
-        return STATUS_ACCESS_DENIED;
-    }
+    AsyncCancelClient((PCLIENT_CONTEXT)fileObject->FsContext2);
+    EventsCancelClient((PCLIENT_CONTEXT)fileObject->FsContext2);
+    SharedUnmapClient((PCLIENT_CONTEXT)fileObject->FsContext2);
+}
+
+static VOID OnClose(PIO_STACK_LOCATION irpSp)
+{
+    PFILE_OBJECT fileObject = irpSp->FileObject;
+    if (!fileObject || !fileObject->FsContext2) return;
+
+    EnumReleaseClientSnapshot((PCLIENT_CONTEXT)fileObject->FsContext2);
+    EventsReleaseClient((PCLIENT_CONTEXT)fileObject->FsContext2);
+    SharedUnmapClient((PCLIENT_CONTEXT)fileObject->FsContext2);
+    ObDereferenceObject(((PCLIENT_CONTEXT)fileObject->FsContext2)->Process);
+    ExFreePoolWithTag(fileObject->FsContext2, CLIENT_CONTEXT_TAG);
+    fileObject->FsContext2 = NULL;
+}
+
+static NTSTATUS DispatchCreateClose(PDEVICE_OBJECT DeviceObject, PIRP Irp)
+{
+    UNREFERENCED_PARAMETER(DeviceObject);
 
     PIO_STACK_LOCATION irpSp = IoGetCurrentIrpStackLocation(Irp);
-    ULONG  ioctl  = irpSp->Parameters.DeviceIoControl.IoControlCode;
-    PVOID  inBuf  = Irp->AssociatedIrp.SystemBuffer;
-    PVOID  outBuf = Irp->AssociatedIrp.SystemBuffer;
-    ULONG  inLen  = irpSp->Parameters.DeviceIoControl.InputBufferLength;
-    ULONG  outLen = irpSp->Parameters.DeviceIoControl.OutputBufferLength;
-
-    NTSTATUS status       = STATUS_SUCCESS;
-    ULONG    bytesWritten = 0;
-
-    switch (ioctl) {
-
-    // ===== 进程 =====
-
-    case IOCTL_ENUM_PROCESSES:
-        status = ProcessEnumerate(outBuf, outLen, &bytesWritten);
-        break;
-
-    case IOCTL_KILL_PROCESS:
-        if (inLen < sizeof(PROCESS_REQUEST) || outLen < sizeof(PROCESS_KILL_RESULT)) {
-            status = STATUS_BUFFER_TOO_SMALL;
-            break;
-        }
-        status = ProcessKill(((PPROCESS_REQUEST)inBuf)->ProcessId,
-                             (PPROCESS_KILL_RESULT)outBuf);
-        if (NT_SUCCESS(status))
-            bytesWritten = sizeof(PROCESS_KILL_RESULT);
-        break;
-
-    case IOCTL_FREEZE_PROCESS:
-        if (inLen < sizeof(PROCESS_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = ProcessFreeze(((PPROCESS_REQUEST)inBuf)->ProcessId);
-        break;
-
-    case IOCTL_UNFREEZE_PROCESS:
-        if (inLen < sizeof(PROCESS_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = ProcessUnfreeze(((PPROCESS_REQUEST)inBuf)->ProcessId);
-        break;
-
-    case IOCTL_PROTECT_PROCESS:
-        if (inLen < sizeof(PROCESS_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = ProcessProtect(((PPROCESS_REQUEST)inBuf)->ProcessId);
-        break;
-
-    case IOCTL_UNPROTECT_PROCESS:
-        if (inLen < sizeof(PROCESS_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = ProcessUnprotect(((PPROCESS_REQUEST)inBuf)->ProcessId);
-        break;
-
-    case IOCTL_SET_PROTECT_LEVEL:
-        if (inLen < sizeof(PROCESS_PROTECT_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        {
-            PPROCESS_PROTECT_REQUEST req = (PPROCESS_PROTECT_REQUEST)inBuf;
-            status = ProcessSetProtectLevel(req->ProcessId, req->ProtectionLevel);
-        }
-        break;
-
-    case IOCTL_ELEVATE_PROCESS:
-        if (inLen < sizeof(PROCESS_ELEVATE_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        {
-            PPROCESS_ELEVATE_REQUEST req = (PPROCESS_ELEVATE_REQUEST)inBuf;
-            status = ProcessElevate(req->ProcessId, req->Level);
-        }
-        break;
-
-    case IOCTL_ENUM_MODULES:
-        if (inLen < sizeof(PROCESS_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = ProcessEnumModules(((PPROCESS_REQUEST)inBuf)->ProcessId,
-                                    outBuf, outLen, &bytesWritten);
-        break;
-
-    case IOCTL_ENUM_THREADS:
-        if (inLen < sizeof(PROCESS_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = ProcessEnumThreads(((PPROCESS_REQUEST)inBuf)->ProcessId,
-                                    outBuf, outLen, &bytesWritten);
-        break;
-
-    // 暂时禁用 - 能直接读写任意进程内存
-    case IOCTL_READ_PROCESS_MEMORY:
-    case IOCTL_WRITE_PROCESS_MEMORY:
-        status = STATUS_NOT_SUPPORTED;
-        break;
-
-    // ===== 文件 =====
-
-    case IOCTL_DELETE_FILE:
-        if (inLen < sizeof(FILE_PATH_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        ((PFILE_PATH_REQUEST)inBuf)->Path[
-            RTL_NUMBER_OF(((PFILE_PATH_REQUEST)inBuf)->Path) - 1] = L'\0';
-        status = FileDeleteKernel(((PFILE_PATH_REQUEST)inBuf)->Path);
-        break;
-
-    // ===== 内核模块 =====
-
-    case IOCTL_ENUM_KERNEL_MODULES:
-        status = EnumKernelModules(outBuf, outLen, &bytesWritten);
-        break;
-
-    case IOCTL_UNLOAD_DRIVER:
-        if (inLen < sizeof(DRIVER_SERVICE_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        {
-            PDRIVER_SERVICE_REQUEST req = (PDRIVER_SERVICE_REQUEST)inBuf;
-            req->ServiceName[RTL_NUMBER_OF(req->ServiceName) - 1] = L'\0';
-            status = ForceUnloadDriver(req->ServiceName);
-        }
-        break;
-
-    // ===== 句柄 =====
-
-    case IOCTL_ENUM_HANDLES:
-        if (inLen < sizeof(HANDLE_ENUM_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = EnumHandles(((PHANDLE_ENUM_REQUEST)inBuf)->ProcessId,
-                             outBuf, outLen, &bytesWritten);
-        break;
-
-    case IOCTL_CLOSE_HANDLE:
-        if (inLen < sizeof(CLOSE_HANDLE_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        {
-            PCLOSE_HANDLE_REQUEST req = (PCLOSE_HANDLE_REQUEST)inBuf;
-            status = ForceCloseHandle(req->ProcessId, req->Handle);
-        }
-        break;
-
-    // 暂时禁用 - 可绕过 ACL 删除杀软注册表项
-    case IOCTL_REG_DELETE_KEY:
-    case IOCTL_REG_DELETE_VALUE:
-        status = STATUS_NOT_SUPPORTED;
-        break;
-
-    // ===== 网络 =====
-
-    case IOCTL_ENUM_CONNECTIONS:
-        status = EnumConnections(outBuf, outLen, &bytesWritten);
-        break;
-
-    // ===== DLL 注入 =====
-    // 暂时禁用 - 拿去干坏事怎么办
-    case IOCTL_INJECT_DLL:
-        status = STATUS_NOT_SUPPORTED;
-        break;
-        // if (inLen < sizeof(INJECT_DLL_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        // {
-        //     PINJECT_DLL_REQUEST req = (PINJECT_DLL_REQUEST)inBuf;
-        //     req->DllPath[RTL_NUMBER_OF(req->DllPath) - 1] = L'\0';
-        //     status = InjectDll(req->ProcessId, req->DllPath);
-        // }
-        // break;
-
-    // ===== DKOM 进程隐藏 =====
-
-    case IOCTL_HIDE_PROCESS:
-        if (inLen < sizeof(PROCESS_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = HideProcess(((PPROCESS_REQUEST)inBuf)->ProcessId);
-        break;
-
-    case IOCTL_UNHIDE_PROCESS:
-        if (inLen < sizeof(PROCESS_REQUEST)) { status = STATUS_BUFFER_TOO_SMALL; break; }
-        status = UnhideProcess(((PPROCESS_REQUEST)inBuf)->ProcessId);
-        break;
-
-    // ===== 生命周期 =====
-
-    case IOCTL_DETACH_SYMLINK:
-    {
-        UNICODE_STRING symLinkName;
-        RtlInitUnicodeString(&symLinkName, SYMLINK_NAME);
-        status = IoDeleteSymbolicLink(&symLinkName);
-        DbgPrint("[OpenSysKit] IOCTL_DETACH_SYMLINK: 0x%X\n", status);
-        break;
-    }
+    NTSTATUS status = STATUS_SUCCESS;
 
-    default:
-        status = STATUS_INVALID_DEVICE_REQUEST;
-        break;
-    }
+    if (irpSp->MajorFunction == IRP_MJ_CREATE)
+        status = OnCreate(irpSp);
+    else if (irpSp->MajorFunction == IRP_MJ_CLEANUP)
+        OnCleanup(irpSp);
+    else if (irpSp->MajorFunction == IRP_MJ_CLOSE)
+        OnClose(irpSp);
 
     Irp->IoStatus.Status      = status;
-    Irp->IoStatus.Information = bytesWritten;
+    Irp->IoStatus.Information = 0;
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
     return status;
 }
@@ -229,7 +104,14 @@ static VOID DriverUnload(PDRIVER_OBJECT DriverObject)
     // 保护在驱动卸载后继续有效，不在此恢复
     // CleanupProtect();
 
+    SharedShutdown();
+    EventsShutdown();
+    AsyncShutdown();
+    ProcessTableShutdown();
+    CpuSampleShutdown();
+    ProcessSnapshotShutdown();
     CleanupSignatureVerification();
+    CleanupDispatchStats();
 
     UNICODE_STRING symLink;
     RtlInitUnicodeString(&symLink, SYMLINK_NAME);
@@ -245,8 +127,6 @@ static VOID DriverUnload(PDRIVER_OBJECT DriverObject)
 
 extern "C" NTSTATUS DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath)
 {
-    UNREFERENCED_PARAMETER(RegistryPath);
-
     DbgPrint("[OpenSysKit] ============================================\n");
     DbgPrint("[OpenSysKit] >>>    OPENSYSKIT DRIVER LOADING!       <<<\n");
     DbgPrint("[OpenSysKit] ============================================\n");
@@ -279,13 +159,40 @@ extern "C" NTSTATUS DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING Reg
     }
 
     DriverObject->MajorFunction[IRP_MJ_CREATE]         = DispatchCreateClose;
+    DriverObject->MajorFunction[IRP_MJ_CLEANUP]        = DispatchCreateClose;
     DriverObject->MajorFunction[IRP_MJ_CLOSE]          = DispatchCreateClose;
     DriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = DispatchDeviceControl;
     DriverObject->DriverUnload                          = DriverUnload;
 
-    g_DriverContext.DeviceObject->Flags &= ~DO_DEVICE_INITIALIZING;
+    // 签名缓存须在设备可打开之前就绪
+    InitializeSignatureVerification(RegistryPath);
 
-    InitializeSignatureVerification();
+    if (!NT_SUCCESS(InitializeDispatchStats()))
+        DbgPrint("[OpenSysKit] Dispatch stats allocation failed\n");
+
+    // 必须在设备可打开之前就绪；失败时所有 IOCTL 同步执行
+    if (!NT_SUCCESS(AsyncInitialize()))
+        DbgPrint("[OpenSysKit] Async worker pool unavailable\n");
+
+    // 进程快照缓存须在设备可打开、通知注册之前就绪
+    ProcessSnapshotInitialize();
+
+    // 由快照填充；失败时按名 / 按 PID 的进程查找返回 STATUS_NOT_FOUND
+    if (!NT_SUCCESS(ProcessTableInitialize()))
+        DbgPrint("[OpenSysKit] Process table unavailable\n");
+
+    // 以进程表填充时的快照作为第一次 CPU 采样
+    CpuSampleInitialize();
+
+    // 失败时订阅返回 STATUS_DEVICE_NOT_READY，其余功能不受影响
+    if (!NT_SUCCESS(EventsInitialize()))
+        DbgPrint("[OpenSysKit] Event channel unavailable\n");
+
+    // 失败时映射请求返回 STATUS_DEVICE_NOT_READY
+    if (!NT_SUCCESS(SharedInitialize()))
+        DbgPrint("[OpenSysKit] Shared section unavailable\n");
+
+    g_DriverContext.DeviceObject->Flags &= ~DO_DEVICE_INITIALIZING;
 
     ResolvePspTerminateThread();
 
@@ -8,6 +8,9 @@
 #endif
 
 #include <ntddk.h>
+#include "wire_format.h"
+#include "event_format.h"
+#include "shared_format.h"
 
 #ifndef PROCESS_TERMINATE
 #define PROCESS_TERMINATE           0x0001
@@ -63,6 +66,38 @@
 // 网络
 #define IOCTL_ENUM_CONNECTIONS      CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x850, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+// 签名校验
+#define IOCTL_GET_SIGNATURE_STATS   CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x860, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// 零拷贝枚举（METHOD_OUT_DIRECT）：请求与输出格式同对应的 METHOD_BUFFERED 版本，
+// 但结果直接写入调用方输出缓冲区锁定的页，省去系统缓冲区分配与回拷
+#define IOCTL_ENUM_PROCESSES_DIRECT      CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x870, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+#define IOCTL_ENUM_KERNEL_MODULES_DIRECT CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x871, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+#define IOCTL_ENUM_HANDLES_DIRECT        CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x872, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
+// 批量命令：一次往返执行多条进程操作（见下方 BATCH_*）
+#define IOCTL_BATCH                 CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x880, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// 事件通道：进程 / 线程 / 映像生命周期事件（见下方 EVENT_*）
+#define IOCTL_EVENT_SUBSCRIBE       CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x890, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_READ_EVENTS           CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x891, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_EVENT_STATS       CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x892, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// 共享快照区：映射只读视图与周期外刷新（见下方 SHARED_*）
+#define IOCTL_MAP_SHARED_SECTION    CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x8A0, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_REFRESH_SHARED_SECTION CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x8A1, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// 增量进程枚举：只返回某一代之后的变化（见下方 PROCESS_DELTA_*）
+#define IOCTL_ENUM_PROCESSES_DELTA  CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x8B0, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// 一次请求取回同一份快照中的进程及其全部线程，只有 v2 编码（见 wire_format.h 的 PROCESS_THREAD_HEADER）
+#define IOCTL_ENUM_PROCESSES_THREADS        CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x8B1, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_ENUM_PROCESSES_THREADS_DIRECT CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x8B2, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
+// 诊断
+#define IOCTL_GET_DISPATCH_STATS    CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x861, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_GET_ASYNC_STATUS      CTL_CODE(DEVICE_TYPE_OPENSYSKIT, 0x862, METHOD_BUFFERED, FILE_ANY_ACCESS)  // 本句柄上挂起的请求
+
 // ========== 通用结构 ==========
 
 #define PROCESS_KILL_RESULT_VERSION 1
@@ -262,6 +297,298 @@ typedef struct _CONNECTION_LIST_HEADER {
     ULONG TotalSize;
 } CONNECTION_LIST_HEADER, *PCONNECTION_LIST_HEADER;
 
+// ========== 签名校验统计 ==========
+//
+// 计数器为驱动加载以来的累计值，由调用方自行做差分。
+// 结构只在末尾追加字段：调用方按 Version / Size 判断可读范围。
+//
+// 延迟直方图按 log2 微秒分桶：桶 0 为 [0, 2)us，桶 i 为 [2^i, 2^(i+1))us，
+// 最后一桶包含所有更大的值。
+//
+
+#define SIGNATURE_STATS_VERSION   1
+#define SIGNATURE_STATS_BUCKETS   32
+#define SIGNATURE_STATS_VERDICTS  8     // 按 SIGNATURE_STATUS 取下标
+
+typedef struct _SIGNATURE_STATS {
+    ULONG   Version;
+    ULONG   Size;                       // sizeof(SIGNATURE_STATS)
+    ULONG64 PidIndexHits;               // 打开设备时命中 (PID, 创建时间) 索引
+    ULONG64 ContentCacheHits;           // 命中文件身份缓存，未重新哈希
+    ULONG64 Misses;                     // 完整校验次数
+    ULONG64 Evictions;                  // LRU 淘汰次数
+    ULONG64 Verdicts[SIGNATURE_STATS_VERDICTS];     // 完整校验结果分布
+    ULONG64 ReadLatency[SIGNATURE_STATS_BUCKETS];   // 单次校验的文件读取总耗时
+    ULONG64 HashLatency[SIGNATURE_STATS_BUCKETS];   // Authenticode 哈希耗时（不含读取）
+    ULONG64 Pkcs7Latency[SIGNATURE_STATS_BUCKETS];  // PKCS#7 解析与证书比对耗时
+    ULONG64 TotalLatency[SIGNATURE_STATS_BUCKETS];  // 单次完整校验总耗时
+    ULONG   CacheCapacity;
+    ULONG   PrewarmQueued;
+    ULONG   PrewarmDeduplicated;
+    ULONG   PrewarmDropped;
+    ULONG   PrewarmVerified;
+    ULONG   PrewarmHits;
+    ULONG   PrewarmMisses;
+    ULONG   Reserved;
+} SIGNATURE_STATS, *PSIGNATURE_STATS;
+
+// ========== IOCTL 分发统计 ==========
+//
+// 每个已注册的 IOCTL 一条记录，按功能码升序，计数为驱动加载以来的累计值。
+// 输出缓冲区放不下全部记录时只写入能放下的部分，TotalSize 给出所需大小。
+//
+// Calls / Failures / Latency 只统计进入处理函数的请求；未授权、缓冲区过小、
+// IRQL 不符等在处理函数之前被拒绝的请求计入 Rejected。
+// Latency 与 SIGNATURE_STATS 相同按 log2 微秒分桶。
+//
+
+#define DISPATCH_STATS_VERSION  1
+#define DISPATCH_STATS_BUCKETS  24
+
+// IOCTL 描述符标志
+#define IOCTL_FLAG_AUTHORIZED   0x00000001  // 仅限通过签名校验的客户端
+#define IOCTL_FLAG_PASSIVE      0x00000002  // 须在 PASSIVE_LEVEL 执行，可能阻塞，可挂起交给工作线程
+#define IOCTL_FLAG_DISABLED     0x00000004  // 已注册但暂时禁用，返回 STATUS_NOT_SUPPORTED
+#define IOCTL_FLAG_CALLER_CONTEXT 0x00000008 // 须在请求者进程上下文中执行，不交给工作线程
+
+typedef struct _DISPATCH_IOCTL_STATS {
+    ULONG   IoControlCode;
+    ULONG   Flags;                      // IOCTL_FLAG_*
+    ULONG64 Calls;
+    ULONG64 Failures;                   // 处理函数返回错误状态
+    ULONG64 Rejected;
+    ULONG64 TotalMicroseconds;
+    ULONG64 Latency[DISPATCH_STATS_BUCKETS];
+} DISPATCH_IOCTL_STATS, *PDISPATCH_IOCTL_STATS;
+
+typedef struct _DISPATCH_STATS_HEADER {
+    ULONG   Version;
+    ULONG   EntrySize;                  // sizeof(DISPATCH_IOCTL_STATS)
+    ULONG   Count;                      // 本次写入的记录数
+    ULONG   TotalSize;                  // 容纳全部记录所需字节数
+    ULONG64 Unrecognized;               // 未注册的控制码
+} DISPATCH_STATS_HEADER, *PDISPATCH_STATS_HEADER;
+
+// ========== 批量命令 ==========
+//
+// 输入：[BATCH_REQUEST_HEADER][BATCH_COMMAND × Count]
+// 输出：[BATCH_REPLY_HEADER][BATCH_RESULT × Count]，下标与命令一一对应
+//
+// 整批只做一次授权检查；执行前先校验全部命令，任何一条不合法则整批
+// 返回 STATUS_INVALID_PARAMETER，不执行任何命令。输出放不下 Count 条结果时
+// 返回 STATUS_BUFFER_TOO_SMALL，同样不执行。
+//
+// 命令按顺序执行，同一 PID 只调用一次 PsLookupProcessByProcessId，后续命令
+// 复用同一 EPROCESS 引用（查找失败的状态也复用）。IOCTL 本身返回成功，
+// 各条命令的结果看 BATCH_RESULT.Status；带 BATCH_FLAG_STOP_ON_ERROR 时，
+// 首个失败之后的命令不执行，状态为 STATUS_CANCELLED。
+//
+
+#define BATCH_MAX_COMMANDS          1024
+#define BATCH_FLAG_STOP_ON_ERROR    0x00000001
+
+#define BATCH_OP_KILL               1   // Detail = PROCESS_KILL_METHOD_*
+#define BATCH_OP_FREEZE             2
+#define BATCH_OP_UNFREEZE           3
+#define BATCH_OP_PROTECT            4
+#define BATCH_OP_UNPROTECT          5
+#define BATCH_OP_SET_PROTECT_LEVEL  6   // Parameter = PS_PROTECTION.Level，0 为取消保护
+#define BATCH_OP_HIDE               7
+#define BATCH_OP_UNHIDE             8
+
+typedef struct _BATCH_REQUEST_HEADER {
+    ULONG Count;
+    ULONG Flags;                // BATCH_FLAG_*
+} BATCH_REQUEST_HEADER, *PBATCH_REQUEST_HEADER;
+
+typedef struct _BATCH_COMMAND {
+    ULONG Opcode;               // BATCH_OP_*
+    ULONG ProcessId;
+    ULONG Parameter;
+    ULONG Reserved;             // 须为 0
+} BATCH_COMMAND, *PBATCH_COMMAND;
+
+typedef struct _BATCH_REPLY_HEADER {
+    ULONG Count;
+    ULONG Completed;            // 实际执行的命令数
+    ULONG Lookups;              // PsLookupProcessByProcessId 调用次数（去重后的 PID 数）
+    ULONG Reserved;
+} BATCH_REPLY_HEADER, *PBATCH_REPLY_HEADER;
+
+typedef struct _BATCH_RESULT {
+    ULONG Status;               // NTSTATUS
+    ULONG Detail;
+} BATCH_RESULT, *PBATCH_RESULT;
+
+// ========== 异步执行 ==========
+//
+// 以重叠方式打开的句柄（FILE_FLAG_OVERLAPPED，FileObject 无 FO_SYNCHRONOUS_IO）上，
+// 标记为 IOCTL_FLAG_PASSIVE 的 IOCTL（IOCTL_FLAG_CALLER_CONTEXT 除外）不在调用线程上执行：分发函数完成授权与长度
+// 检查后把 IRP 标记挂起、交给驱动自己的工作线程池并返回 STATUS_PENDING，
+// 调用方通过 OVERLAPPED / 完成端口取结果。同步句柄上的行为不变。
+//
+// 取消（CancelIoEx 或关闭句柄）：
+//   - 仍在排队的请求立即以 STATUS_CANCELLED 完成
+//   - 已在执行的请求在处理函数的检查点停下：批量命令以 STATUS_SUCCESS 完成，
+//     应答中 Completed 为已执行条数，其余条目为 STATUS_CANCELLED；
+//     枚举类请求以 STATUS_CANCELLED 完成
+//
+// 执行中的进度用 IOCTL_GET_ASYNC_STATUS 查询，只列出本句柄上的请求。
+// 输出放不下全部记录时只写入能放下的部分，TotalSize 给出所需大小。
+//
+
+#define ASYNC_STATE_QUEUED      1
+#define ASYNC_STATE_RUNNING     2
+
+typedef struct _ASYNC_OPERATION_INFO {
+    ULONG64 Overlapped;             // Irp->UserIosb，即调用方 OVERLAPPED 的地址
+    ULONG   IoControlCode;
+    ULONG   State;                  // ASYNC_STATE_*
+    ULONG   Completed;              // 已完成的工作量（批量命令为条数），未知为 0
+    ULONG   Total;                  // 总工作量，未知为 0
+    ULONG64 ElapsedMicroseconds;    // 自排队起
+} ASYNC_OPERATION_INFO, *PASYNC_OPERATION_INFO;
+
+typedef struct _ASYNC_STATUS_HEADER {
+    ULONG Count;                    // 本次写入的记录数
+    ULONG TotalSize;                // 容纳本句柄全部记录所需字节数
+    ULONG Workers;                  // 工作线程数
+    ULONG Queued;                   // 全局排队数
+    ULONG Running;                  // 全局执行数
+    ULONG Reserved;
+} ASYNC_STATUS_HEADER, *PASYNC_STATUS_HEADER;
+
+// ========== 事件通道 ==========
+//
+// 反向调用：客户端先用 IOCTL_EVENT_SUBSCRIBE 订阅，再在重叠句柄上预先投递若干个
+// IOCTL_READ_EVENTS。进程 / 线程通知与映像加载通知把事件编码成 event_format.h 的
+// 记录写入该句柄自己的环，驱动的投递线程攒批后一次填满并完成一个挂起的读请求，
+// 应答格式见 EVENT_READ_HEADER。读请求到达时环中已有事件则立即完成，不挂起。
+//
+//   - 同一句柄上再次订阅只更新 Mask，环大小以首次订阅为准；Mask 为 0 暂停记录
+//   - 环满时新事件被丢弃，不阻塞通知例程；丢弃数在下一次应答的 Lost 中报告
+//   - 每个句柄最多挂起 EVENT_MAX_PENDING_READS 个读请求，超出返回 STATUS_QUOTA_EXCEEDED
+//   - 全局最多 EVENT_MAX_CHANNELS 个订阅句柄，超出时订阅返回 STATUS_QUOTA_EXCEEDED
+//   - 关闭句柄或 CancelIoEx 时挂起的读请求以 STATUS_CANCELLED 完成
+//
+// IOCTL_READ_EVENTS 的输出至少要放得下 EVENT_READ_HEADER 加一条最长的记录。
+//
+
+#define EVENT_RING_DEFAULT_SIZE (1024 * 1024)
+#define EVENT_RING_MIN_SIZE     (64 * 1024)
+#define EVENT_RING_MAX_SIZE     (16 * 1024 * 1024)
+#define EVENT_MAX_CHANNELS      16
+#define EVENT_MAX_PENDING_READS 64
+
+typedef struct _EVENT_SUBSCRIBE_REQUEST {
+    ULONG Mask;                 // EVENT_MASK(EVENT_*) 的组合
+    ULONG RingSize;             // 字节，0 取默认值；向上取 2 的幂并限制在 [MIN, MAX]
+} EVENT_SUBSCRIBE_REQUEST, *PEVENT_SUBSCRIBE_REQUEST;
+
+// 未订阅的句柄上只有全局字段有效
+typedef struct _EVENT_STATS {
+    ULONG   Mask;
+    ULONG   RingSize;
+    ULONG   RingUsed;           // 环中尚未读取的字节数
+    ULONG   PendingReads;       // 本句柄挂起的读请求数
+    ULONG64 Written;            // 写入环的事件数
+    ULONG64 Dropped;            // 环满丢弃的事件数
+    ULONG64 Delivered;          // 已交给调用方的事件数
+    ULONG64 Completions;        // 带回事件的读请求数（含立即完成）
+    ULONG64 Wakeups;            // 投递线程被唤醒的次数（全局）
+    ULONG   Channels;           // 订阅中的句柄数（全局）
+    ULONG   Reserved;
+} EVENT_STATS, *PEVENT_STATS;
+
+// ========== 共享快照区 ==========
+//
+// 布局与读取协议见 shared_format.h。IOCTL_MAP_SHARED_SECTION 把 section 以只读、
+// 不可改保护（SEC_NO_CHANGE）的视图映射进打开设备的进程，应答给出视图地址；
+// 只能由打开设备的进程调用，每个句柄一个视图，重复调用返回同一视图。
+// 视图随句柄关闭解除映射。
+//
+// 至少有一个视图时驱动每 SHARED_REFRESH_INTERVAL_MS 发布一代；
+// IOCTL_REFRESH_SHARED_SECTION 立即发布一代并返回其编号，
+// 并发的刷新请求合并为一次：返回时的那一代一定是在请求到达之后抓取的。
+//
+
+#define SHARED_SECTION_SIZE         (16 * 1024 * 1024)
+#define SHARED_REFRESH_INTERVAL_MS  1000
+
+typedef struct _SHARED_MAP_REPLY {
+    ULONG64 Address;            // 视图在调用进程中的地址
+    ULONG   Size;               // 视图大小，即 SHARED_SECTION_HEADER.SectionSize
+    ULONG   Reserved;
+    ULONG64 Generation;         // 应答时最近发布的代
+} SHARED_MAP_REPLY, *PSHARED_MAP_REPLY;
+
+typedef struct _SHARED_REFRESH_REPLY {
+    ULONG64 Generation;
+} SHARED_REFRESH_REPLY, *PSHARED_REFRESH_REPLY;
+
+// ========== 增量进程枚举 ==========
+//
+// 客户端带上次应答的 Generation 请求，驱动只返回此后创建、退出或有明显变化
+// （线程数变化，工作集变化超过 1 MB 且超过上次报告值的 1/16）的进程，以及新的 Generation。
+// 先列出退出，再列出创建与变化；期间创建又退出的进程只出现一条 PROCESS_DELTA_EXITED。
+// Generation 为 0、来自驱动的上一次加载，或之后的退出已超出驱动保留的历史时，
+// 应答带 PROCESS_DELTA_FULL，列出全部进程（均为 PROCESS_DELTA_CREATED），客户端应先清空本地表。
+// 映像名为基名，只保留前 PROCESS_DELTA_NAME_CHARS 个字符。
+//
+
+#define PROCESS_DELTA_NAME_CHARS    64
+
+#define PROCESS_DELTA_CREATED       1
+#define PROCESS_DELTA_CHANGED       2
+#define PROCESS_DELTA_EXITED        3   // 只有 ProcessId 与 CreateTime 有效
+
+#define PROCESS_DELTA_FULL          0x00000001
+
+typedef struct _PROCESS_DELTA_REQUEST {
+    ULONG64 Generation;         // 上次应答的 Generation，0 表示取全表
+} PROCESS_DELTA_REQUEST, *PPROCESS_DELTA_REQUEST;
+
+typedef struct _PROCESS_DELTA_HEADER {
+    ULONG   Count;
+    ULONG   TotalSize;
+    ULONG   Flags;              // PROCESS_DELTA_FULL
+    ULONG   Reserved;
+    ULONG64 Generation;         // 下次请求带上
+} PROCESS_DELTA_HEADER, *PPROCESS_DELTA_HEADER;
+
+typedef struct _PROCESS_DELTA_ENTRY {
+    ULONG    Kind;              // PROCESS_DELTA_*
+    ULONG    ProcessId;
+    ULONG    ParentProcessId;
+    ULONG    ThreadCount;
+    ULONG    SessionId;
+    USHORT   NameLength;        // ImageName 中的字符数，不含结尾 0
+    UCHAR    ProtectionLevel;
+    UCHAR    NameTruncated;
+    LONGLONG CreateTime;
+    ULONG64  WorkingSetSize;
+    WCHAR    ImageName[PROCESS_DELTA_NAME_CHARS];
+} PROCESS_DELTA_ENTRY, *PPROCESS_DELTA_ENTRY;
+
+// ========== 客户端上下文 ==========
+//
+// IRP_MJ_CREATE 时校验打开者签名并分配，挂在 FileObject->FsContext2 上，
+// IRP_MJ_CLOSE 时释放。IOCTL 路径只读取 Authorized，不再逐次校验签名。
+//
+
+#define CLIENT_CONTEXT_TAG 'ilCK'
+
+typedef struct _CLIENT_CONTEXT {
+    BOOLEAN Authorized;
+    UCHAR   Reserved[3];
+    ULONG   ProcessId;          // 打开设备的进程，仅用于诊断
+    ULONG   SignatureStatus;    // SIGNATURE_STATUS，仅用于诊断
+    PVOID   Snapshot;           // 最近一次溢出保留的枚举快照（enumsnap.cpp）
+    PVOID   Events;             // 事件通道（events.cpp），首次订阅时创建
+    PVOID   SharedView;         // 共享快照区在 Process 中的视图（shared.cpp）
+    PEPROCESS Process;          // 打开设备的进程，持有引用直到 IRP_MJ_CLOSE，PID 不会被复用
+} CLIENT_CONTEXT, *PCLIENT_CONTEXT;
+
 // ========== 进程保护 ==========
 
 #define MAX_PROTECTED_PIDS 64
@@ -0,0 +1,152 @@
+#include "enumsnap.h"
+
+// ========== 枚举快照与令牌 ==========
+//
+// 每个句柄只有一个快照槽（CLIENT_CONTEXT.Snapshot），用 InterlockedExchangePointer
+// 取出 / 放回，同一句柄上的并发请求各自持有取出的快照，不需要锁。
+// 快照只在溢出时保留，成功应答后即释放，因此每个客户端最多占用一份原始数据。
+//
+
+typedef struct _ENUM_SNAPSHOT {
+    const ENUM_SOURCE* Source;
+    ULONG              ProcessId;
+    ULONG64            Token;
+    ULONG64            CapturedAt;     // KeQueryInterruptTime，100ns
+    PVOID              Data;
+} ENUM_SNAPSHOT, *PENUM_SNAPSHOT;
+
+#define ENUM_SNAPSHOT_LIFETIME  ((ULONG64)ENUM_SNAPSHOT_LIFETIME_MS * 10000)
+
+static LONG64 g_SnapshotSequence = 0;
+
+static VOID FreeSnapshot(PENUM_SNAPSHOT Snapshot)
+{
+    Snapshot->Source->Release(Snapshot->Data);
+    ExFreePoolWithTag(Snapshot, ENUM_SNAPSHOT_TAG);
+}
+
+static BOOLEAN SnapshotExpired(const ENUM_SNAPSHOT* Snapshot)
+{
+    return KeQueryInterruptTime() - Snapshot->CapturedAt > ENUM_SNAPSHOT_LIFETIME;
+}
+
+// 取出与令牌匹配的快照；不匹配但仍有效的快照放回槽中，过期的直接释放
+static PENUM_SNAPSHOT TakeClientSnapshot(
+    PCLIENT_CONTEXT     Client,
+    const ENUM_SOURCE*  Source,
+    const ENUM_REQUEST* Request)
+{
+    PENUM_SNAPSHOT snapshot = (PENUM_SNAPSHOT)InterlockedExchangePointer(&Client->Snapshot, NULL);
+    if (!snapshot)
+        return NULL;
+
+    if (SnapshotExpired(snapshot)) {
+        FreeSnapshot(snapshot);
+        return NULL;
+    }
+
+    if (snapshot->Token == Request->SnapshotToken &&
+        snapshot->Source == Source &&
+        snapshot->ProcessId == Request->ProcessId) {
+        return snapshot;
+    }
+
+    if (InterlockedCompareExchangePointer(&Client->Snapshot, snapshot, NULL) != NULL)
+        FreeSnapshot(snapshot);
+    return NULL;
+}
+
+static VOID StashClientSnapshot(PCLIENT_CONTEXT Client, PENUM_SNAPSHOT Snapshot)
+{
+    PENUM_SNAPSHOT previous = (PENUM_SNAPSHOT)InterlockedExchangePointer(&Client->Snapshot, Snapshot);
+    if (previous)
+        FreeSnapshot(previous);
+}
+
+// 溢出应答只有头部；令牌追加写入，不回读输出
+static VOID WriteSnapshotToken(
+    ULONG   Version,
+    PVOID   OutputBuffer,
+    ULONG   OutputBufferSize,
+    ULONG64 Token,
+    PULONG  BytesWritten)
+{
+    if (Version == ENUM_VERSION_2) {
+        RtlCopyMemory((PUCHAR)OutputBuffer + FIELD_OFFSET(ENUM_V2_HEADER, SnapshotToken),
+            &Token, sizeof(Token));
+        return;
+    }
+
+    if (OutputBufferSize >= sizeof(ENUM_OVERFLOW_HEADER)) {
+        RtlCopyMemory((PUCHAR)OutputBuffer + FIELD_OFFSET(ENUM_OVERFLOW_HEADER, SnapshotToken),
+            &Token, sizeof(Token));
+        *BytesWritten = sizeof(ENUM_OVERFLOW_HEADER);
+    }
+}
+
+NTSTATUS EnumServe(
+    PCLIENT_CONTEXT     Client,
+    const ENUM_SOURCE*  Source,
+    const ENUM_REQUEST* Request,
+    PASYNC_PROGRESS     Progress,
+    PVOID               OutputBuffer,
+    ULONG               OutputBufferSize,
+    PULONG              BytesWritten)
+{
+    PENUM_SNAPSHOT snapshot = NULL;
+    NTSTATUS status;
+
+    *BytesWritten = 0;
+    if (AsyncCancelled(Progress))
+        return STATUS_CANCELLED;
+
+    if (Request->SnapshotToken != 0) {
+        snapshot = Client ? TakeClientSnapshot(Client, Source, Request) : NULL;
+        if (!snapshot)
+            return STATUS_NOT_FOUND;
+    } else {
+        snapshot = (PENUM_SNAPSHOT)ExAllocatePool2(
+            POOL_FLAG_NON_PAGED, sizeof(ENUM_SNAPSHOT), ENUM_SNAPSHOT_TAG);
+        if (!snapshot)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        status = Source->Capture(&snapshot->Data);
+        if (!NT_SUCCESS(status)) {
+            ExFreePoolWithTag(snapshot, ENUM_SNAPSHOT_TAG);
+            return status;
+        }
+
+        snapshot->Source     = Source;
+        snapshot->ProcessId  = Request->ProcessId;
+        snapshot->CapturedAt = KeQueryInterruptTime();
+
+        // 抓取是最耗时的一步；取消后丢弃快照，不留给令牌重试
+        if (AsyncCancelled(Progress)) {
+            FreeSnapshot(snapshot);
+            return STATUS_CANCELLED;
+        }
+    }
+
+    status = Source->Format(snapshot->Data, Request->ProcessId, Request->Version, Request->Fields, Progress,
+        OutputBuffer, OutputBufferSize, BytesWritten);
+
+    if (status != STATUS_BUFFER_OVERFLOW || !Client) {
+        FreeSnapshot(snapshot);
+        return status;
+    }
+
+    // 重试仍然放不下时沿用原令牌
+    if (snapshot->Token == 0)
+        snapshot->Token = (ULONG64)InterlockedIncrement64(&g_SnapshotSequence);
+
+    WriteSnapshotToken(Request->Version, OutputBuffer, OutputBufferSize, snapshot->Token, BytesWritten);
+    StashClientSnapshot(Client, snapshot);
+    return status;
+}
+
+VOID EnumReleaseClientSnapshot(PCLIENT_CONTEXT Client)
+{
+    PENUM_SNAPSHOT snapshot = (PENUM_SNAPSHOT)InterlockedExchangePointer(&Client->Snapshot, NULL);
+    if (snapshot)
+        FreeSnapshot(snapshot);
+}
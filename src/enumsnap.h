@@ -0,0 +1,40 @@
+#pragma once
+
+#include "driver.h"
+#include "async.h"
+
+#define ENUM_SNAPSHOT_TAG 'pSnE'
+
+// ========== 枚举快照与令牌 ==========
+//
+// 快照来源由模块提供：Capture 抓取原始数据（模块自己的池标签），
+// Format 按 ProcessId / Version / Fields 把它写成应答（逐条记录调用 AsyncCheckpoint，
+// 取消时返回 STATUS_CANCELLED），Release 释放。
+// 同一来源的描述符地址即枚举类型，令牌只在类型与 ProcessId 都一致时可用。
+//
+
+typedef NTSTATUS (*PENUM_CAPTURE)(PVOID* Snapshot);
+typedef NTSTATUS (*PENUM_FORMAT)(PVOID Snapshot, ULONG ProcessId, ULONG Version, ULONG Fields,
+    PASYNC_PROGRESS Progress, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+typedef VOID (*PENUM_RELEASE)(PVOID Snapshot);
+
+typedef struct _ENUM_SOURCE {
+    PENUM_CAPTURE Capture;
+    PENUM_FORMAT  Format;
+    PENUM_RELEASE Release;
+} ENUM_SOURCE, *PENUM_SOURCE;
+
+// 处理一次枚举请求：带令牌时取句柄上保留的快照，否则重新抓取；
+// 输出不足时把快照留在 Client 上并在应答中写入令牌。
+// 异步执行时在抓取前后与格式化过程中检查取消，已取消返回 STATUS_CANCELLED
+NTSTATUS EnumServe(
+    PCLIENT_CONTEXT     Client,
+    const ENUM_SOURCE*  Source,
+    const ENUM_REQUEST* Request,
+    PASYNC_PROGRESS     Progress,
+    PVOID               OutputBuffer,
+    ULONG               OutputBufferSize,
+    PULONG              BytesWritten);
+
+// IRP_MJ_CLOSE 时调用
+VOID EnumReleaseClientSnapshot(PCLIENT_CONTEXT Client);
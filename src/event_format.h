@@ -0,0 +1,164 @@
+#pragma once
+
+#include "osk_types.h"
+
+// ========== 事件记录 ==========
+//
+// IOCTL_READ_EVENTS 的应答：
+//
+//   [EVENT_READ_HEADER][记录 0][记录 1]...
+//
+//   - 记录变长，以 EVENT_HEADER 开头，Size 为整条记录字节数（8 的倍数）
+//   - 带名称的记录在定长部分之后紧跟 NameLength 个 WCHAR（不含结尾 NUL），
+//     名称超过 EVENT_MAX_NAME 个字符时截断
+//   - 新字段只追加在定长部分末尾，旧客户端按 Size 跳过即可
+//
+// 同一通道内记录按写入环的顺序排列；不同 CPU 上同时发生的事件，
+// Timestamp 之间可能有微小的先后颠倒。
+// 本头文件只依赖 osk_types.h，驱动与用户态工具共用同一份解码器。
+//
+
+#define EVENT_PROCESS_CREATE    1
+#define EVENT_PROCESS_EXIT      2
+#define EVENT_THREAD_CREATE     3
+#define EVENT_THREAD_EXIT       4
+#define EVENT_IMAGE_LOAD        5
+
+#define EVENT_MASK(Type)        (1UL << (Type))
+#define EVENT_MASK_ALL          (EVENT_MASK(EVENT_PROCESS_CREATE) | EVENT_MASK(EVENT_PROCESS_EXIT) | \
+                                 EVENT_MASK(EVENT_THREAD_CREATE)  | EVENT_MASK(EVENT_THREAD_EXIT)  | \
+                                 EVENT_MASK(EVENT_IMAGE_LOAD))
+
+#define EVENT_MAX_NAME          260
+
+typedef struct _EVENT_HEADER {
+    USHORT  Size;
+    USHORT  Type;           // EVENT_*
+    ULONG   ProcessId;
+    ULONG64 Timestamp;      // 系统时间，100ns（UTC）
+} EVENT_HEADER, *PEVENT_HEADER;
+
+// 名称为映像路径
+typedef struct _EVENT_PROCESS_CREATE_RECORD {
+    EVENT_HEADER Header;
+    ULONG  ParentProcessId;
+    ULONG  CreatingProcessId;   // 发起创建的进程，通常与父进程相同
+    ULONG  CreatingThreadId;
+    USHORT NameLength;
+    USHORT Reserved;
+} EVENT_PROCESS_CREATE_RECORD, *PEVENT_PROCESS_CREATE_RECORD;
+
+// EVENT_PROCESS_EXIT 只有 EVENT_HEADER
+
+// EVENT_THREAD_CREATE / EVENT_THREAD_EXIT
+typedef struct _EVENT_THREAD_RECORD {
+    EVENT_HEADER Header;
+    ULONG ThreadId;
+    ULONG Reserved;
+} EVENT_THREAD_RECORD, *PEVENT_THREAD_RECORD;
+
+#define EVENT_IMAGE_KERNEL      0x0001  // 驱动映像，Header.ProcessId 为 0
+
+// 名称为映像完整路径
+typedef struct _EVENT_IMAGE_LOAD_RECORD {
+    EVENT_HEADER Header;
+    ULONG64 ImageBase;
+    ULONG64 ImageSize;
+    USHORT  NameLength;
+    USHORT  Flags;          // EVENT_IMAGE_*
+    ULONG   Reserved;
+} EVENT_IMAGE_LOAD_RECORD, *PEVENT_IMAGE_LOAD_RECORD;
+
+C_ASSERT(sizeof(EVENT_HEADER) == 16);
+C_ASSERT(sizeof(EVENT_PROCESS_CREATE_RECORD) == 32);
+C_ASSERT(sizeof(EVENT_THREAD_RECORD) == 24);
+C_ASSERT(sizeof(EVENT_IMAGE_LOAD_RECORD) == 40);
+
+#define EVENT_RECORD_SIZE(FixedSize, NameLength) \
+    ((((ULONG)(FixedSize) + (ULONG)(NameLength) * (ULONG)sizeof(WCHAR)) + 7) & ~7UL)
+
+// 最长的一条记录；IOCTL_READ_EVENTS 的输出至少要放得下头部加一条这样的记录
+#define EVENT_MAX_RECORD_SIZE   EVENT_RECORD_SIZE(sizeof(EVENT_IMAGE_LOAD_RECORD), EVENT_MAX_NAME)
+
+typedef struct _EVENT_READ_HEADER {
+    ULONG   Count;
+    ULONG   TotalSize;      // 本次写入的字节数，含头部
+    ULONG64 Sequence;       // 首条记录在本通道上的序号，从 0 起连续编号（丢弃的事件不占序号）
+    ULONG   Lost;           // 上一次应答以来因环满丢弃的事件数
+    ULONG   Pending;        // 应答后环中仍未读取的字节数
+} EVENT_READ_HEADER, *PEVENT_READ_HEADER;
+
+// ========== 解码 ==========
+//
+// EventValidate 通过后，EventNext 遍历到的记录与 EventName 取到的字符都落在应答之内；
+// 应答来自另一端，调用方不应跳过校验。
+//
+
+static inline ULONG EventFixedSize(USHORT Type)
+{
+    switch (Type) {
+    case EVENT_PROCESS_CREATE: return sizeof(EVENT_PROCESS_CREATE_RECORD);
+    case EVENT_PROCESS_EXIT:   return sizeof(EVENT_HEADER);
+    case EVENT_THREAD_CREATE:
+    case EVENT_THREAD_EXIT:    return sizeof(EVENT_THREAD_RECORD);
+    case EVENT_IMAGE_LOAD:     return sizeof(EVENT_IMAGE_LOAD_RECORD);
+    default:                   return sizeof(EVENT_HEADER);    // 未知类型只保证头部
+    }
+}
+
+static inline BOOLEAN EventValidate(const VOID* Reply, ULONG Length)
+{
+    const EVENT_READ_HEADER* header = (const EVENT_READ_HEADER*)Reply;
+    if (Length < sizeof(EVENT_READ_HEADER) || header->TotalSize > Length ||
+        header->TotalSize < sizeof(EVENT_READ_HEADER))
+        return FALSE;
+
+    const UCHAR* base = (const UCHAR*)Reply;
+    ULONG offset = sizeof(EVENT_READ_HEADER);
+    for (ULONG i = 0; i < header->Count; i++) {
+        if (header->TotalSize - offset < sizeof(EVENT_HEADER))
+            return FALSE;
+
+        const EVENT_HEADER* event = (const EVENT_HEADER*)(base + offset);
+        if (event->Size < EventFixedSize(event->Type) || (event->Size & 7) ||
+            event->Size > header->TotalSize - offset)
+            return FALSE;
+
+        ULONG nameLength = 0;
+        if (event->Type == EVENT_PROCESS_CREATE)
+            nameLength = ((const EVENT_PROCESS_CREATE_RECORD*)event)->NameLength;
+        else if (event->Type == EVENT_IMAGE_LOAD)
+            nameLength = ((const EVENT_IMAGE_LOAD_RECORD*)event)->NameLength;
+        if (EVENT_RECORD_SIZE(EventFixedSize(event->Type), nameLength) > event->Size)
+            return FALSE;
+
+        offset += event->Size;
+    }
+    return offset == header->TotalSize;
+}
+
+// Current 为 NULL 时返回第一条；没有更多记录时返回 NULL
+static inline const EVENT_HEADER* EventNext(const VOID* Reply, const EVENT_HEADER* Current)
+{
+    const EVENT_READ_HEADER* header = (const EVENT_READ_HEADER*)Reply;
+    const UCHAR* next = Current
+        ? (const UCHAR*)Current + Current->Size
+        : (const UCHAR*)Reply + sizeof(EVENT_READ_HEADER);
+    return (next < (const UCHAR*)Reply + header->TotalSize) ? (const EVENT_HEADER*)next : NULL;
+}
+
+// 进程创建与映像加载记录的名称；其他类型返回 FALSE
+static inline BOOLEAN EventName(const EVENT_HEADER* Event, const WCHAR** Name, ULONG* Length)
+{
+    if (Event->Type == EVENT_PROCESS_CREATE) {
+        *Name   = (const WCHAR*)((const EVENT_PROCESS_CREATE_RECORD*)Event + 1);
+        *Length = ((const EVENT_PROCESS_CREATE_RECORD*)Event)->NameLength;
+        return TRUE;
+    }
+    if (Event->Type == EVENT_IMAGE_LOAD) {
+        *Name   = (const WCHAR*)((const EVENT_IMAGE_LOAD_RECORD*)Event + 1);
+        *Length = ((const EVENT_IMAGE_LOAD_RECORD*)Event)->NameLength;
+        return TRUE;
+    }
+    return FALSE;
+}
@@ -0,0 +1,200 @@
+#include "event_ring.h"
+
+// ========== 预留与发布 ==========
+//
+// 记录首个 ULONG 即 EVENT_HEADER 的 Size 与 Type，兼作发布标志：
+// 生产者先写记录其余部分，最后以 Release 写入它；消费者以 Acquire 读到非零后
+// 才复制记录。其余字段直接写进环，不经过临时缓冲区。
+//
+
+#define EVENT_COMMIT_WORD(Size, Type)   ((LONG)((ULONG)(Size) | ((ULONG)(Type) << 16)))
+#define EVENT_TYPE_PAD                  0
+
+static ULONG RingOffset(const EVENT_RING* Ring, LONG64 Position)
+{
+    return (ULONG)Position & (Ring->Capacity - 1);
+}
+
+static LONG volatile* CommitWord(PEVENT_RING Ring, ULONG Offset)
+{
+    return (LONG volatile*)(Ring->Data + Offset);
+}
+
+// 成功时返回记录在环中的地址，记录内容全为零
+static PUCHAR Reserve(PEVENT_RING Ring, ULONG Size, PULONG Used)
+{
+    for (;;) {
+        LONG64 head = ReadNoFence64(&Ring->Head);
+        LONG64 tail = ReadAcquire64(&Ring->Tail);
+        ULONG offset = RingOffset(Ring, head);
+        ULONG pad = (Size > Ring->Capacity - offset) ? Ring->Capacity - offset : 0;
+
+        // 读到的 Tail 可能已过时，只会让判断偏保守
+        if ((ULONG64)(head - tail) + pad + Size > Ring->Capacity) {
+            InterlockedIncrementNoFence64(&Ring->Dropped);
+            return NULL;
+        }
+
+        if (InterlockedCompareExchange64(&Ring->Head, head + pad + Size, head) != head) {
+            YieldProcessor();
+            continue;
+        }
+
+        if (pad) {
+            WriteRelease(CommitWord(Ring, offset), EVENT_COMMIT_WORD(pad, EVENT_TYPE_PAD));
+            offset = 0;
+        }
+        *Used = (ULONG)(head - tail) + pad + Size;
+        return Ring->Data + offset;
+    }
+}
+
+static VOID FillHeader(PUCHAR Record, ULONG ProcessId, ULONG64 Timestamp)
+{
+    PEVENT_HEADER header = (PEVENT_HEADER)Record;
+    header->ProcessId = ProcessId;
+    header->Timestamp = Timestamp;
+}
+
+static VOID Publish(PEVENT_RING Ring, PUCHAR Record, ULONG Size, USHORT Type)
+{
+    InterlockedIncrementNoFence64(&Ring->Written);
+    WriteRelease((LONG volatile*)Record, EVENT_COMMIT_WORD(Size, Type));
+}
+
+// ========== 环 ==========
+
+VOID EventRingInitialize(PEVENT_RING Ring, PVOID Buffer, ULONG Capacity)
+{
+    Ring->Head     = 0;
+    Ring->Written  = 0;
+    Ring->Dropped  = 0;
+    Ring->Tail     = 0;
+    Ring->Data     = (PUCHAR)Buffer;
+    Ring->Capacity = Capacity;
+}
+
+ULONG EventRingUsed(const EVENT_RING* Ring)
+{
+    LONG64 tail = ReadAcquire64(&Ring->Tail);
+    return (ULONG)(ReadNoFence64(&Ring->Head) - tail);
+}
+
+BOOLEAN EventRingReady(PEVENT_RING Ring)
+{
+    LONG64 tail = ReadNoFence64(&Ring->Tail);
+    if (tail == ReadAcquire64(&Ring->Head))
+        return FALSE;
+
+    ULONG word = (ULONG)ReadAcquire(CommitWord(Ring, RingOffset(Ring, tail)));
+    if (word == 0)
+        return FALSE;
+    // 填充记录之后的记录总在偏移 0
+    return (word >> 16) != EVENT_TYPE_PAD || ReadAcquire(CommitWord(Ring, 0)) != 0;
+}
+
+ULONG EventRingRead(PEVENT_RING Ring, PVOID Output, ULONG OutputSize, PULONG Count)
+{
+    LONG64 tail = ReadNoFence64(&Ring->Tail);
+    LONG64 head = ReadAcquire64(&Ring->Head);
+    ULONG written = 0;
+    ULONG count = 0;
+
+    while (tail < head) {
+        ULONG offset = RingOffset(Ring, tail);
+        ULONG word = (ULONG)ReadAcquire(CommitWord(Ring, offset));
+        if (word == 0)
+            break;          // 已预留但尚未发布，后面的记录留到下一次
+
+        ULONG size = word & 0xFFFF;
+        if ((word >> 16) != EVENT_TYPE_PAD) {
+            if (size > OutputSize - written)
+                break;
+            RtlCopyMemory((PUCHAR)Output + written, Ring->Data + offset, size);
+            RtlZeroMemory(Ring->Data + offset, size);
+            written += size;
+            count++;
+        } else {
+            // 填充记录只写了首个 ULONG
+            *CommitWord(Ring, offset) = 0;
+        }
+        tail += size;
+    }
+
+    // 清零先于 Tail 对生产者可见
+    WriteRelease64(&Ring->Tail, tail);
+    *Count = count;
+    return written;
+}
+
+// ========== 编码 ==========
+
+BOOLEAN EventWriteProcessCreate(PEVENT_RING Ring, ULONG64 Timestamp, ULONG ProcessId,
+    ULONG ParentProcessId, ULONG CreatingProcessId, ULONG CreatingThreadId,
+    const WCHAR* Name, ULONG NameLength, PULONG Used)
+{
+    NameLength = min(NameLength, (ULONG)EVENT_MAX_NAME);
+    ULONG size = EVENT_RECORD_SIZE(sizeof(EVENT_PROCESS_CREATE_RECORD), NameLength);
+    PUCHAR record = Reserve(Ring, size, Used);
+    if (!record)
+        return FALSE;
+
+    PEVENT_PROCESS_CREATE_RECORD event = (PEVENT_PROCESS_CREATE_RECORD)record;
+    FillHeader(record, ProcessId, Timestamp);
+    event->ParentProcessId   = ParentProcessId;
+    event->CreatingProcessId = CreatingProcessId;
+    event->CreatingThreadId  = CreatingThreadId;
+    event->NameLength        = (USHORT)NameLength;
+    if (NameLength)
+        RtlCopyMemory(event + 1, Name, NameLength * sizeof(WCHAR));
+
+    Publish(Ring, record, size, EVENT_PROCESS_CREATE);
+    return TRUE;
+}
+
+BOOLEAN EventWriteProcessExit(PEVENT_RING Ring, ULONG64 Timestamp, ULONG ProcessId, PULONG Used)
+{
+    PUCHAR record = Reserve(Ring, sizeof(EVENT_HEADER), Used);
+    if (!record)
+        return FALSE;
+
+    FillHeader(record, ProcessId, Timestamp);
+    Publish(Ring, record, sizeof(EVENT_HEADER), EVENT_PROCESS_EXIT);
+    return TRUE;
+}
+
+BOOLEAN EventWriteThread(PEVENT_RING Ring, USHORT Type, ULONG64 Timestamp,
+    ULONG ProcessId, ULONG ThreadId, PULONG Used)
+{
+    PUCHAR record = Reserve(Ring, sizeof(EVENT_THREAD_RECORD), Used);
+    if (!record)
+        return FALSE;
+
+    FillHeader(record, ProcessId, Timestamp);
+    ((PEVENT_THREAD_RECORD)record)->ThreadId = ThreadId;
+    Publish(Ring, record, sizeof(EVENT_THREAD_RECORD), Type);
+    return TRUE;
+}
+
+BOOLEAN EventWriteImageLoad(PEVENT_RING Ring, ULONG64 Timestamp, ULONG ProcessId,
+    ULONG64 ImageBase, ULONG64 ImageSize, USHORT Flags,
+    const WCHAR* Name, ULONG NameLength, PULONG Used)
+{
+    NameLength = min(NameLength, (ULONG)EVENT_MAX_NAME);
+    ULONG size = EVENT_RECORD_SIZE(sizeof(EVENT_IMAGE_LOAD_RECORD), NameLength);
+    PUCHAR record = Reserve(Ring, size, Used);
+    if (!record)
+        return FALSE;
+
+    PEVENT_IMAGE_LOAD_RECORD event = (PEVENT_IMAGE_LOAD_RECORD)record;
+    FillHeader(record, ProcessId, Timestamp);
+    event->ImageBase  = ImageBase;
+    event->ImageSize  = ImageSize;
+    event->NameLength = (USHORT)NameLength;
+    event->Flags      = Flags;
+    if (NameLength)
+        RtlCopyMemory(event + 1, Name, NameLength * sizeof(WCHAR));
+
+    Publish(Ring, record, size, EVENT_IMAGE_LOAD);
+    return TRUE;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "driver.h"
+
+// ========== 事件环 ==========
+//
+// 多生产者、单消费者的字节环。生产者（任意 CPU 上的通知例程）用
+// InterlockedCompareExchange64 预留空间，填好记录后以 Release 写入记录首个
+// ULONG（Size | Type << 16）发布，全程不加锁、不等待；环满时丢弃并计数。
+// 消费者一次只有一个（调用方持通道锁），按位置顺序取出已发布的记录，
+// 取出后清零所占字节再推进 Tail，于是空闲区始终为零，首个 ULONG 非零即表示已发布。
+//
+// 记录不跨越环尾：放不下时连同环尾剩余部分一起预留，剩余部分写成填充记录
+// （Type 为 0），消费者跳过。记录只能来自 event_format.h 定义的类型，
+// 最长 EVENT_MAX_RECORD_SIZE，容量须为不小于它的 2 的幂。
+//
+
+typedef struct _EVENT_RING {
+    // 生产者侧
+    DECLSPEC_CACHEALIGN volatile LONG64 Head;   // 已预留到的位置（单调递增）
+    volatile LONG64 Written;
+    volatile LONG64 Dropped;
+
+    // 消费者侧
+    DECLSPEC_CACHEALIGN volatile LONG64 Tail;   // 已取出到的位置
+    PUCHAR Data;
+    ULONG  Capacity;
+} EVENT_RING, *PEVENT_RING;
+
+// Buffer 须已清零
+VOID EventRingInitialize(PEVENT_RING Ring, PVOID Buffer, ULONG Capacity);
+
+// 已预留（含未发布）的字节数
+ULONG EventRingUsed(const EVENT_RING* Ring);
+
+// Tail 处的记录是否已发布（跳过填充记录）；只由消费者调用，不取出
+BOOLEAN EventRingReady(PEVENT_RING Ring);
+
+// 取出已发布的记录写入 Output，直到遇到未发布的记录或 Output 放不下下一条；
+// 返回写入的字节数，*Count 为记录数
+ULONG EventRingRead(PEVENT_RING Ring, PVOID Output, ULONG OutputSize, PULONG Count);
+
+// ========== 编码 ==========
+//
+// 每个函数编码一条记录并发布，环满返回 FALSE（已计入 Dropped）。
+// 名称按字符数传入，超过 EVENT_MAX_NAME 截断。*Used 为写入后环中已预留的字节数。
+//
+
+BOOLEAN EventWriteProcessCreate(PEVENT_RING Ring, ULONG64 Timestamp, ULONG ProcessId,
+    ULONG ParentProcessId, ULONG CreatingProcessId, ULONG CreatingThreadId,
+    const WCHAR* Name, ULONG NameLength, PULONG Used);
+
+BOOLEAN EventWriteProcessExit(PEVENT_RING Ring, ULONG64 Timestamp, ULONG ProcessId, PULONG Used);
+
+// Type 为 EVENT_THREAD_CREATE 或 EVENT_THREAD_EXIT
+BOOLEAN EventWriteThread(PEVENT_RING Ring, USHORT Type, ULONG64 Timestamp,
+    ULONG ProcessId, ULONG ThreadId, PULONG Used);
+
+BOOLEAN EventWriteImageLoad(PEVENT_RING Ring, ULONG64 Timestamp, ULONG ProcessId,
+    ULONG64 ImageBase, ULONG64 ImageSize, USHORT Flags,
+    const WCHAR* Name, ULONG NameLength, PULONG Used);
@@ -0,0 +1,605 @@
+#include "events.h"
+#include "event_ring.h"
+
+// ========== 通道 ==========
+//
+// 通道在首次订阅时创建并挂到全局槽位上，通知例程与投递线程只通过槽位访问通道。
+// 每个槽位一个 rundown 引用：访问者先取得引用再读通道指针；IRP_MJ_CLEANUP 摘下
+// 通道时等待引用全部释放，之后不会再有生产者写它的环，IRP_MJ_CLOSE 即可释放。
+//
+// 通道锁保护消费者侧：挂起的读请求链表、读环以及序号 / 投递计数。
+// 挂起的 IRP 用 Tail.Overlay.ListEntry 链接，通道指针存放在 DriverContext[0]，
+// 与 async.cpp 相同，谁在锁内用 IoSetCancelRoutine(NULL) 拿到非 NULL 的取消例程，
+// 谁就拥有该 IRP；拿到 NULL 的只把链接复位成自指，由取消例程完成。
+//
+
+// 环中积压超过该值且有挂起的读请求时，提前结束投递线程的攒批窗口
+#define EVENT_FLUSH_THRESHOLD   (16 * 1024)
+
+typedef struct _EVENT_CHANNEL {
+    EVENT_RING     Ring;
+    volatile LONG  Mask;
+    volatile LONG  Armed;           // 有挂起的读请求，下一个事件须唤醒投递线程
+    volatile LONG  Urgent;          // 已为积压请求过提前投递
+    volatile LONG  PendingCount;
+    ULONG          Slot;            // 未挂到槽位上时为 MAXULONG
+
+    KSPIN_LOCK     Lock;
+    LIST_ENTRY     PendingReads;
+    BOOLEAN        Closed;          // IRP_MJ_CLEANUP 之后不再接受读请求
+    ULONG64        Sequence;
+    ULONG64        DroppedReported;
+    ULONG64        Delivered;
+    ULONG64        Completions;
+} EVENT_CHANNEL, *PEVENT_CHANNEL;
+
+typedef struct DECLSPEC_CACHEALIGN _EVENT_SLOT {
+    EX_RUNDOWN_REF  Rundown;
+    PVOID volatile  Channel;
+} EVENT_SLOT, *PEVENT_SLOT;
+
+static EVENT_SLOT     g_EventSlots[EVENT_MAX_CHANNELS];
+static volatile LONG  g_EventChannels = 0;
+static volatile LONG64 g_EventWakeups = 0;
+
+static KEVENT         g_EventWake;      // 挂起的读请求等到了事件
+static KEVENT         g_EventFlush;     // 环中积压，结束攒批窗口
+static PKTHREAD       g_EventThread = NULL;
+static volatile LONG  g_EventStopping = 0;
+
+static ULONG RingCapacity(ULONG Requested)
+{
+    if (Requested == 0)
+        return EVENT_RING_DEFAULT_SIZE;
+
+    ULONG capacity = EVENT_RING_MIN_SIZE;
+    while (capacity < Requested && capacity < EVENT_RING_MAX_SIZE)
+        capacity <<= 1;
+    return capacity;
+}
+
+static PEVENT_CHANNEL CreateChannel(ULONG Mask, ULONG Capacity)
+{
+    PEVENT_CHANNEL channel = (PEVENT_CHANNEL)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, sizeof(EVENT_CHANNEL), EVENT_CHANNEL_TAG);
+    if (!channel)
+        return NULL;
+
+    // 环的空闲区须为零
+    PVOID data = ExAllocatePool2(POOL_FLAG_NON_PAGED, Capacity, EVENT_RING_TAG);
+    if (!data) {
+        ExFreePoolWithTag(channel, EVENT_CHANNEL_TAG);
+        return NULL;
+    }
+
+    EventRingInitialize(&channel->Ring, data, Capacity);
+    channel->Mask = (LONG)Mask;
+    channel->Slot = MAXULONG;
+    KeInitializeSpinLock(&channel->Lock);
+    InitializeListHead(&channel->PendingReads);
+    return channel;
+}
+
+static VOID FreeChannel(PEVENT_CHANNEL Channel)
+{
+    ExFreePoolWithTag(Channel->Ring.Data, EVENT_RING_TAG);
+    ExFreePoolWithTag(Channel, EVENT_CHANNEL_TAG);
+}
+
+static NTSTATUS AttachChannel(PEVENT_CHANNEL Channel)
+{
+    for (ULONG i = 0; i < EVENT_MAX_CHANNELS; i++) {
+        if (InterlockedCompareExchangePointer(&g_EventSlots[i].Channel, Channel, NULL) == NULL) {
+            Channel->Slot = i;
+            InterlockedIncrement(&g_EventChannels);
+            return STATUS_SUCCESS;
+        }
+    }
+    return STATUS_QUOTA_EXCEEDED;
+}
+
+// 返回后不再有通知例程或投递线程访问该通道
+static VOID DetachChannel(PEVENT_CHANNEL Channel)
+{
+    if (Channel->Slot == MAXULONG)
+        return;
+
+    PEVENT_SLOT slot = &g_EventSlots[Channel->Slot];
+    ExWaitForRundownProtectionRelease(&slot->Rundown);
+    InterlockedDecrement(&g_EventChannels);
+
+    // 先清指针再恢复引用：恢复之后取得引用的访问者不会再看到这个通道
+    WritePointerRelease(&slot->Channel, NULL);
+    ExReInitializeRundownProtection(&slot->Rundown);
+    Channel->Slot = MAXULONG;
+}
+
+// ========== 消费者 ==========
+
+// 持有通道锁；输出至少放得下头部加一条最长的记录
+static ULONG FillReply(PEVENT_CHANNEL Channel, PVOID OutputBuffer, ULONG OutputBufferSize)
+{
+    PEVENT_READ_HEADER header = (PEVENT_READ_HEADER)OutputBuffer;
+    ULONG count = 0;
+    ULONG bytes = EventRingRead(&Channel->Ring, header + 1,
+        OutputBufferSize - sizeof(EVENT_READ_HEADER), &count);
+    ULONG64 dropped = (ULONG64)ReadNoFence64(&Channel->Ring.Dropped);
+
+    header->Count     = count;
+    header->TotalSize = sizeof(EVENT_READ_HEADER) + bytes;
+    header->Sequence  = Channel->Sequence;
+    header->Lost      = (ULONG)min(dropped - Channel->DroppedReported, (ULONG64)MAXULONG);
+    header->Pending   = EventRingUsed(&Channel->Ring);
+
+    Channel->Sequence        += count;
+    Channel->DroppedReported  = dropped;
+    Channel->Delivered       += count;
+    Channel->Completions++;
+    return header->TotalSize;
+}
+
+static PEVENT_CHANNEL ChannelFromIrp(PIRP Irp)
+{
+    return (PEVENT_CHANNEL)Irp->Tail.Overlay.DriverContext[0];
+}
+
+static VOID CompleteReads(PLIST_ENTRY Reads)
+{
+    while (!IsListEmpty(Reads)) {
+        PIRP irp = CONTAINING_RECORD(RemoveHeadList(Reads), IRP, Tail.Overlay.ListEntry);
+        IoCompleteRequest(irp, IO_NO_INCREMENT);
+    }
+}
+
+// 持有通道锁，仍有挂起的读请求时调用。先置 Armed 再查环：
+// 在此之前发布、没看到 Armed 的事件由这里补一次唤醒
+static VOID ArmLocked(PEVENT_CHANNEL Channel)
+{
+    InterlockedExchange(&Channel->Armed, 1);
+    if (EventRingReady(&Channel->Ring) && InterlockedExchange(&Channel->Armed, 0))
+        KeSetEvent(&g_EventWake, IO_NO_INCREMENT, FALSE);
+}
+
+// 进入时持有取消自旋锁
+static VOID EventCancelRoutine(PDEVICE_OBJECT DeviceObject, PIRP Irp)
+{
+    UNREFERENCED_PARAMETER(DeviceObject);
+    IoReleaseCancelSpinLock(Irp->CancelIrql);
+
+    PEVENT_CHANNEL channel = ChannelFromIrp(Irp);
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&channel->Lock, &oldIrql);
+    // 已被投递线程或清理摘下的 IRP 链接指向自身
+    if (!IsListEmpty(&Irp->Tail.Overlay.ListEntry)) {
+        RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+        InterlockedDecrement(&channel->PendingCount);
+    }
+    KeReleaseSpinLock(&channel->Lock, oldIrql);
+
+    Irp->IoStatus.Status      = STATUS_CANCELLED;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+// 按挂起顺序用环中的事件填满读请求，锁外完成
+static VOID DeliverChannel(PEVENT_CHANNEL Channel)
+{
+    LIST_ENTRY ready;
+    InitializeListHead(&ready);
+
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&Channel->Lock, &oldIrql);
+    InterlockedExchange(&Channel->Urgent, 0);
+
+    while (!IsListEmpty(&Channel->PendingReads) && EventRingReady(&Channel->Ring)) {
+        PIRP irp = CONTAINING_RECORD(RemoveHeadList(&Channel->PendingReads), IRP, Tail.Overlay.ListEntry);
+        InterlockedDecrement(&Channel->PendingCount);
+
+        if (IoSetCancelRoutine(irp, NULL) == NULL) {
+            InitializeListHead(&irp->Tail.Overlay.ListEntry);
+            continue;
+        }
+
+        irp->IoStatus.Status      = STATUS_SUCCESS;
+        irp->IoStatus.Information = FillReply(Channel, irp->AssociatedIrp.SystemBuffer,
+            IoGetCurrentIrpStackLocation(irp)->Parameters.DeviceIoControl.OutputBufferLength);
+        InsertTailList(&ready, &irp->Tail.Overlay.ListEntry);
+    }
+
+    if (!IsListEmpty(&Channel->PendingReads))
+        ArmLocked(Channel);
+    KeReleaseSpinLock(&Channel->Lock, oldIrql);
+
+    CompleteReads(&ready);
+}
+
+// ========== 投递线程 ==========
+//
+// 第一个事件只负责叫醒线程；线程再等一个攒批窗口（或积压信号）后
+// 一次性投递所有通道，让每次完成带回尽量多的事件。
+//
+
+static VOID EventDeliveryThread(PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    LARGE_INTEGER window;
+    window.QuadPart = -(LONGLONG)EVENT_FLUSH_INTERVAL_MS * 10000;
+
+    for (;;) {
+        KeWaitForSingleObject(&g_EventWake, Executive, KernelMode, FALSE, NULL);
+        if (ReadNoFence(&g_EventStopping)) break;
+
+        InterlockedIncrementNoFence64(&g_EventWakeups);
+        KeWaitForSingleObject(&g_EventFlush, Executive, KernelMode, FALSE, &window);
+        if (ReadNoFence(&g_EventStopping)) break;
+
+        for (ULONG i = 0; i < EVENT_MAX_CHANNELS; i++) {
+            PEVENT_SLOT slot = &g_EventSlots[i];
+            if (!ReadPointerNoFence(&slot->Channel) || !ExAcquireRundownProtection(&slot->Rundown))
+                continue;
+
+            PEVENT_CHANNEL channel = (PEVENT_CHANNEL)ReadPointerAcquire(&slot->Channel);
+            if (channel)
+                DeliverChannel(channel);
+            ExReleaseRundownProtection(&slot->Rundown);
+        }
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+// ========== 生产者 ==========
+
+typedef struct _EVENT_NOTIFICATION {
+    USHORT       Type;
+    USHORT       Flags;             // EVENT_IMAGE_*
+    ULONG        ProcessId;
+    ULONG64      Timestamp;
+    ULONG        ParentProcessId;
+    ULONG        CreatingProcessId;
+    ULONG        CreatingThreadId;
+    ULONG        ThreadId;
+    ULONG64      ImageBase;
+    ULONG64      ImageSize;
+    const WCHAR* Name;
+    ULONG        NameLength;        // 字符数
+} EVENT_NOTIFICATION, *PEVENT_NOTIFICATION;
+
+static BOOLEAN WriteNotification(PEVENT_RING Ring, const EVENT_NOTIFICATION* N, PULONG Used)
+{
+    switch (N->Type) {
+    case EVENT_PROCESS_CREATE:
+        return EventWriteProcessCreate(Ring, N->Timestamp, N->ProcessId, N->ParentProcessId,
+            N->CreatingProcessId, N->CreatingThreadId, N->Name, N->NameLength, Used);
+    case EVENT_PROCESS_EXIT:
+        return EventWriteProcessExit(Ring, N->Timestamp, N->ProcessId, Used);
+    case EVENT_THREAD_CREATE:
+    case EVENT_THREAD_EXIT:
+        return EventWriteThread(Ring, N->Type, N->Timestamp, N->ProcessId, N->ThreadId, Used);
+    case EVENT_IMAGE_LOAD:
+        return EventWriteImageLoad(Ring, N->Timestamp, N->ProcessId, N->ImageBase, N->ImageSize,
+            N->Flags, N->Name, N->NameLength, Used);
+    default:
+        return FALSE;
+    }
+}
+
+static VOID PostToChannel(PEVENT_CHANNEL Channel, const EVENT_NOTIFICATION* Notification)
+{
+    if (!(ReadNoFence(&Channel->Mask) & EVENT_MASK(Notification->Type)))
+        return;
+
+    ULONG used = 0;
+    if (!WriteNotification(&Channel->Ring, Notification, &used))
+        return;
+
+    // 发布与读 Armed 之间须有全屏障，与 ArmLocked 的先写后查配对
+    KeMemoryBarrier();
+    if (ReadNoFence(&Channel->Armed) && InterlockedExchange(&Channel->Armed, 0)) {
+        KeSetEvent(&g_EventWake, IO_NO_INCREMENT, FALSE);
+    } else if (used >= EVENT_FLUSH_THRESHOLD && ReadNoFence(&Channel->PendingCount) &&
+               !ReadNoFence(&Channel->Urgent) && !InterlockedExchange(&Channel->Urgent, 1)) {
+        KeSetEvent(&g_EventFlush, IO_NO_INCREMENT, FALSE);
+    }
+}
+
+static VOID Broadcast(PEVENT_NOTIFICATION Notification)
+{
+    LARGE_INTEGER now;
+    KeQuerySystemTimePrecise(&now);
+    Notification->Timestamp = (ULONG64)now.QuadPart;
+
+    for (ULONG i = 0; i < EVENT_MAX_CHANNELS; i++) {
+        PEVENT_SLOT slot = &g_EventSlots[i];
+        if (!ReadPointerNoFence(&slot->Channel) || !ExAcquireRundownProtection(&slot->Rundown))
+            continue;
+
+        PEVENT_CHANNEL channel = (PEVENT_CHANNEL)ReadPointerAcquire(&slot->Channel);
+        if (channel)
+            PostToChannel(channel, Notification);
+        ExReleaseRundownProtection(&slot->Rundown);
+    }
+}
+
+static ULONG NameLength(PCUNICODE_STRING Name)
+{
+    return (Name && Name->Buffer) ? Name->Length / sizeof(WCHAR) : 0;
+}
+
+static VOID ProcessNotify(PEPROCESS Process, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO CreateInfo)
+{
+    UNREFERENCED_PARAMETER(Process);
+
+    if (ReadNoFence(&g_EventChannels) == 0)
+        return;
+
+    EVENT_NOTIFICATION n = { 0 };
+    n.ProcessId = (ULONG)(ULONG_PTR)ProcessId;
+    if (CreateInfo) {
+        n.Type              = EVENT_PROCESS_CREATE;
+        n.ParentProcessId   = (ULONG)(ULONG_PTR)CreateInfo->ParentProcessId;
+        n.CreatingProcessId = (ULONG)(ULONG_PTR)CreateInfo->CreatingThreadId.UniqueProcess;
+        n.CreatingThreadId  = (ULONG)(ULONG_PTR)CreateInfo->CreatingThreadId.UniqueThread;
+        n.NameLength        = NameLength(CreateInfo->ImageFileName);
+        n.Name              = n.NameLength ? CreateInfo->ImageFileName->Buffer : NULL;
+    } else {
+        n.Type = EVENT_PROCESS_EXIT;
+    }
+    Broadcast(&n);
+}
+
+static VOID ThreadNotify(HANDLE ProcessId, HANDLE ThreadId, BOOLEAN Create)
+{
+    if (ReadNoFence(&g_EventChannels) == 0)
+        return;
+
+    EVENT_NOTIFICATION n = { 0 };
+    n.Type      = Create ? EVENT_THREAD_CREATE : EVENT_THREAD_EXIT;
+    n.ProcessId = (ULONG)(ULONG_PTR)ProcessId;
+    n.ThreadId  = (ULONG)(ULONG_PTR)ThreadId;
+    Broadcast(&n);
+}
+
+static VOID ImageNotify(PUNICODE_STRING FullImageName, HANDLE ProcessId, PIMAGE_INFO ImageInfo)
+{
+    if (ReadNoFence(&g_EventChannels) == 0)
+        return;
+
+    EVENT_NOTIFICATION n = { 0 };
+    n.Type       = EVENT_IMAGE_LOAD;
+    n.ProcessId  = (ULONG)(ULONG_PTR)ProcessId;
+    n.Flags      = ImageInfo->SystemModeImage ? EVENT_IMAGE_KERNEL : 0;
+    n.ImageBase  = (ULONG64)(ULONG_PTR)ImageInfo->ImageBase;
+    n.ImageSize  = (ULONG64)ImageInfo->ImageSize;
+    n.NameLength = NameLength(FullImageName);
+    n.Name       = n.NameLength ? FullImageName->Buffer : NULL;
+    Broadcast(&n);
+}
+
+// ========== 公开接口 ==========
+
+static VOID RemoveNotifyRoutines(BOOLEAN Process, BOOLEAN Thread, BOOLEAN Image)
+{
+    if (Process) PsSetCreateProcessNotifyRoutineEx(ProcessNotify, TRUE);
+    if (Thread)  PsRemoveCreateThreadNotifyRoutine(ThreadNotify);
+    if (Image)   PsRemoveLoadImageNotifyRoutine(ImageNotify);
+}
+
+static VOID StopDeliveryThread(VOID)
+{
+    InterlockedExchange(&g_EventStopping, 1);
+    KeSetEvent(&g_EventWake, IO_NO_INCREMENT, FALSE);
+    KeSetEvent(&g_EventFlush, IO_NO_INCREMENT, FALSE);
+
+    KeWaitForSingleObject(g_EventThread, Executive, KernelMode, FALSE, NULL);
+    ObDereferenceObject(g_EventThread);
+    g_EventThread = NULL;
+}
+
+NTSTATUS EventsInitialize(VOID)
+{
+    for (ULONG i = 0; i < EVENT_MAX_CHANNELS; i++) {
+        ExInitializeRundownProtection(&g_EventSlots[i].Rundown);
+        g_EventSlots[i].Channel = NULL;
+    }
+    KeInitializeEvent(&g_EventWake, SynchronizationEvent, FALSE);
+    KeInitializeEvent(&g_EventFlush, SynchronizationEvent, FALSE);
+    g_EventStopping = 0;
+
+    HANDLE threadHandle = NULL;
+    NTSTATUS status = PsCreateSystemThread(&threadHandle, THREAD_ALL_ACCESS, NULL,
+        NULL, NULL, EventDeliveryThread, NULL);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    status = ObReferenceObjectByHandle(threadHandle, SYNCHRONIZE, *PsThreadType,
+        KernelMode, (PVOID*)&g_EventThread, NULL);
+    ZwClose(threadHandle);
+    if (!NT_SUCCESS(status)) {
+        // 等不到这个线程，只能让它自己退出
+        InterlockedExchange(&g_EventStopping, 1);
+        KeSetEvent(&g_EventWake, IO_NO_INCREMENT, FALSE);
+        g_EventThread = NULL;
+        return status;
+    }
+
+    // 进程通知的 Ex 版本要求映像带 /INTEGRITYCHECK，否则返回 STATUS_ACCESS_DENIED
+    BOOLEAN process = FALSE, thread = FALSE;
+    status = PsSetCreateProcessNotifyRoutineEx(ProcessNotify, FALSE);
+    if (NT_SUCCESS(status)) {
+        process = TRUE;
+        status = PsSetCreateThreadNotifyRoutine(ThreadNotify);
+    }
+    if (NT_SUCCESS(status)) {
+        thread = TRUE;
+        status = PsSetLoadImageNotifyRoutine(ImageNotify);
+    }
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("[OpenSysKit] Event notify registration failed: 0x%X\n", status);
+        RemoveNotifyRoutines(process, thread, FALSE);
+        StopDeliveryThread();
+        return status;
+    }
+
+    DbgPrint("[OpenSysKit] Event channel ready\n");
+    return STATUS_SUCCESS;
+}
+
+// 卸载时所有句柄都已关闭，各通道已在 IRP_MJ_CLEANUP 时摘下
+VOID EventsShutdown(VOID)
+{
+    if (!g_EventThread)
+        return;
+
+    // 移除会等待正在执行的通知例程返回
+    RemoveNotifyRoutines(TRUE, TRUE, TRUE);
+    StopDeliveryThread();
+}
+
+NTSTATUS EventsSubscribe(PCLIENT_CONTEXT Client, const EVENT_SUBSCRIBE_REQUEST* Request)
+{
+    if (!g_EventThread || ReadNoFence(&g_EventStopping))
+        return STATUS_DEVICE_NOT_READY;
+    if (Request->Mask & ~EVENT_MASK_ALL)
+        return STATUS_INVALID_PARAMETER;
+
+    PEVENT_CHANNEL channel = (PEVENT_CHANNEL)ReadPointerAcquire(&Client->Events);
+    if (channel) {
+        InterlockedExchange(&channel->Mask, (LONG)Request->Mask);
+        return STATUS_SUCCESS;
+    }
+
+    channel = CreateChannel(Request->Mask, RingCapacity(Request->RingSize));
+    if (!channel)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    NTSTATUS status = AttachChannel(channel);
+    if (!NT_SUCCESS(status)) {
+        FreeChannel(channel);
+        return status;
+    }
+
+    // 同一句柄上并发的首次订阅：保留先到的通道，再按本次请求更新 Mask
+    PEVENT_CHANNEL existing = (PEVENT_CHANNEL)InterlockedCompareExchangePointer(&Client->Events, channel, NULL);
+    if (existing) {
+        DetachChannel(channel);
+        FreeChannel(channel);
+        InterlockedExchange(&existing->Mask, (LONG)Request->Mask);
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS EventsRead(PCLIENT_CONTEXT Client, PIRP Irp, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+{
+    *BytesWritten = 0;
+    PEVENT_CHANNEL channel = (PEVENT_CHANNEL)ReadPointerAcquire(&Client->Events);
+    if (!channel)
+        return STATUS_INVALID_DEVICE_STATE;
+
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&channel->Lock, &oldIrql);
+
+    if (channel->Closed) {
+        KeReleaseSpinLock(&channel->Lock, oldIrql);
+        return STATUS_CANCELLED;
+    }
+
+    // 前面没有排队的读请求且环中已有事件：立即完成，保持先到先得
+    if (IsListEmpty(&channel->PendingReads) && EventRingReady(&channel->Ring)) {
+        *BytesWritten = FillReply(channel, OutputBuffer, OutputBufferSize);
+        KeReleaseSpinLock(&channel->Lock, oldIrql);
+        return STATUS_SUCCESS;
+    }
+
+    if ((ULONG)channel->PendingCount >= EVENT_MAX_PENDING_READS) {
+        KeReleaseSpinLock(&channel->Lock, oldIrql);
+        return STATUS_QUOTA_EXCEEDED;
+    }
+
+    Irp->Tail.Overlay.DriverContext[0] = channel;
+    IoMarkIrpPending(Irp);
+    IoSetCancelRoutine(Irp, EventCancelRoutine);
+
+    // 挂起前已被取消：取消例程若已被 I/O 管理器取走，它会等锁后从链表摘除
+    if (Irp->Cancel && IoSetCancelRoutine(Irp, NULL) != NULL) {
+        KeReleaseSpinLock(&channel->Lock, oldIrql);
+        Irp->IoStatus.Status      = STATUS_CANCELLED;
+        Irp->IoStatus.Information = 0;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+        return STATUS_PENDING;
+    }
+
+    InsertTailList(&channel->PendingReads, &Irp->Tail.Overlay.ListEntry);
+    InterlockedIncrement(&channel->PendingCount);
+    ArmLocked(channel);
+    KeReleaseSpinLock(&channel->Lock, oldIrql);
+    return STATUS_PENDING;
+}
+
+VOID EventsQueryStats(PCLIENT_CONTEXT Client, PEVENT_STATS Stats)
+{
+    RtlZeroMemory(Stats, sizeof(EVENT_STATS));
+    Stats->Wakeups  = (ULONG64)ReadNoFence64(&g_EventWakeups);
+    Stats->Channels = (ULONG)ReadNoFence(&g_EventChannels);
+
+    PEVENT_CHANNEL channel = (PEVENT_CHANNEL)ReadPointerAcquire(&Client->Events);
+    if (!channel)
+        return;
+
+    Stats->Mask     = (ULONG)ReadNoFence(&channel->Mask);
+    Stats->RingSize = channel->Ring.Capacity;
+    Stats->Written  = (ULONG64)ReadNoFence64(&channel->Ring.Written);
+    Stats->Dropped  = (ULONG64)ReadNoFence64(&channel->Ring.Dropped);
+
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&channel->Lock, &oldIrql);
+    Stats->RingUsed     = EventRingUsed(&channel->Ring);
+    Stats->PendingReads = (ULONG)channel->PendingCount;
+    Stats->Delivered    = channel->Delivered;
+    Stats->Completions  = channel->Completions;
+    KeReleaseSpinLock(&channel->Lock, oldIrql);
+}
+
+VOID EventsCancelClient(PCLIENT_CONTEXT Client)
+{
+    PEVENT_CHANNEL channel = (PEVENT_CHANNEL)ReadPointerAcquire(&Client->Events);
+    if (!channel)
+        return;
+
+    DetachChannel(channel);
+
+    LIST_ENTRY taken;
+    InitializeListHead(&taken);
+
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&channel->Lock, &oldIrql);
+    channel->Closed = TRUE;
+
+    PLIST_ENTRY e = channel->PendingReads.Flink;
+    while (e != &channel->PendingReads) {
+        PIRP irp = CONTAINING_RECORD(e, IRP, Tail.Overlay.ListEntry);
+        e = e->Flink;
+        if (IoSetCancelRoutine(irp, NULL) == NULL)
+            continue;
+
+        RemoveEntryList(&irp->Tail.Overlay.ListEntry);
+        InterlockedDecrement(&channel->PendingCount);
+        irp->IoStatus.Status      = STATUS_CANCELLED;
+        irp->IoStatus.Information = 0;
+        InsertTailList(&taken, &irp->Tail.Overlay.ListEntry);
+    }
+    KeReleaseSpinLock(&channel->Lock, oldIrql);
+
+    CompleteReads(&taken);
+}
+
+VOID EventsReleaseClient(PCLIENT_CONTEXT Client)
+{
+    PEVENT_CHANNEL channel = (PEVENT_CHANNEL)InterlockedExchangePointer(&Client->Events, NULL);
+    if (!channel)
+        return;
+
+    DetachChannel(channel);
+    FreeChannel(channel);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "driver.h"
+
+#define EVENT_CHANNEL_TAG       'hCvE'
+#define EVENT_RING_TAG          'gRvE'
+#define EVENT_FLUSH_INTERVAL_MS 10      // 投递线程被唤醒后的攒批窗口
+
+// ========== 事件通道 ==========
+//
+// 每个订阅的句柄一个通道（CLIENT_CONTEXT.Events）：一个事件环加挂起的读请求。
+// 通知例程是环的生产者，投递线程与 IOCTL_READ_EVENTS 在通道锁内做消费者。
+//
+
+// 注册通知例程并启动投递线程；失败时订阅返回 STATUS_DEVICE_NOT_READY
+NTSTATUS EventsInitialize(VOID);
+VOID EventsShutdown(VOID);
+
+NTSTATUS EventsSubscribe(PCLIENT_CONTEXT Client, const EVENT_SUBSCRIBE_REQUEST* Request);
+
+// 返回 STATUS_PENDING 时 IRP 已标记挂起并归事件通道所有（可能已经完成），
+// 分发函数须原样返回；其他返回值表示已立即处理，*BytesWritten 为应答长度
+NTSTATUS EventsRead(PCLIENT_CONTEXT Client, PIRP Irp, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+
+VOID EventsQueryStats(PCLIENT_CONTEXT Client, PEVENT_STATS Stats);
+
+// IRP_MJ_CLEANUP：停止记录并以 STATUS_CANCELLED 完成挂起的读请求
+VOID EventsCancelClient(PCLIENT_CONTEXT Client);
+
+// IRP_MJ_CLOSE：释放通道
+VOID EventsReleaseClient(PCLIENT_CONTEXT Client);
@@ -73,9 +73,10 @@ static PFN_PS_GET_NEXT_PROCESS_THREAD ResolvePsGetNextProcessThread()
 //
 // 遍历目标进程所有线程，逐一挂起或恢复。
 // 对系统进程（PID 0/4）拒绝操作防止死锁。
+// 按 PID 的接口只负责查找 EPROCESS，批量命令直接传入已引用的对象。
 //
 
-static NTSTATUS FreezeUnfreezeProcess(ULONG ProcessId, BOOLEAN freeze)
+static NTSTATUS FreezeUnfreezeProcess(PEPROCESS process, BOOLEAN freeze)
 {
     PFN_PS_GET_NEXT_PROCESS_THREAD getNextProcessThread = ResolvePsGetNextProcessThread();
     PFN_PS_SUSPEND_THREAD suspendThread = ResolvePsSuspendThread();
@@ -84,11 +85,8 @@ static NTSTATUS FreezeUnfreezeProcess(ULONG ProcessId, BOOLEAN freeze)
     if (!getNextProcessThread || (freeze && !suspendThread) || (!freeze && !resumeThread))
         return STATUS_PROCEDURE_NOT_FOUND;
 
-    if (ProcessId == 0 || ProcessId == 4) return STATUS_ACCESS_DENIED;
-
-    PEPROCESS process = nullptr;
-    NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
-    if (!NT_SUCCESS(status)) return status;
+    ULONG processId = (ULONG)(ULONG_PTR)PsGetProcessId(process);
+    if (processId == 0 || processId == 4) return STATUS_ACCESS_DENIED;
 
     ULONG count = 0;
     PETHREAD thread = getNextProcessThread(process, NULL);
@@ -110,20 +108,41 @@ static NTSTATUS FreezeUnfreezeProcess(ULONG ProcessId, BOOLEAN freeze)
         thread = next;
     }
 
-    ObDereferenceObject(process);
-
     DbgPrint("[OpenSysKit] [Freeze] PID=%lu %s, affected %lu threads\n",
-        ProcessId, freeze ? "frozen" : "unfrozen", count);
+        processId, freeze ? "frozen" : "unfrozen", count);
 
     return (count > 0) ? STATUS_SUCCESS : STATUS_NOT_FOUND;
 }
 
+static NTSTATUS FreezeUnfreezeProcessId(ULONG ProcessId, BOOLEAN freeze)
+{
+    if (ProcessId == 0 || ProcessId == 4) return STATUS_ACCESS_DENIED;
+
+    PEPROCESS process = nullptr;
+    NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
+    if (!NT_SUCCESS(status)) return status;
+
+    status = FreezeUnfreezeProcess(process, freeze);
+    ObDereferenceObject(process);
+    return status;
+}
+
 NTSTATUS ProcessFreeze(ULONG ProcessId)
 {
-    return FreezeUnfreezeProcess(ProcessId, TRUE);
+    return FreezeUnfreezeProcessId(ProcessId, TRUE);
 }
 
 NTSTATUS ProcessUnfreeze(ULONG ProcessId)
 {
-    return FreezeUnfreezeProcess(ProcessId, FALSE);
+    return FreezeUnfreezeProcessId(ProcessId, FALSE);
+}
+
+NTSTATUS ProcessFreezeObject(PEPROCESS Process)
+{
+    return FreezeUnfreezeProcess(Process, TRUE);
+}
+
+NTSTATUS ProcessUnfreezeObject(PEPROCESS Process)
+{
+    return FreezeUnfreezeProcess(Process, FALSE);
 }
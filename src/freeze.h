@@ -7,3 +7,7 @@ NTSTATUS ProcessFreeze(ULONG ProcessId);
 
 // 恢复进程所有线程（通过 PsResumeThread）
 NTSTATUS ProcessUnfreeze(ULONG ProcessId);
+
+// 同上，作用于调用方已引用的 EPROCESS（批量命令复用同一引用）
+NTSTATUS ProcessFreezeObject(PEPROCESS Process);
+NTSTATUS ProcessUnfreezeObject(PEPROCESS Process);
@@ -7,6 +7,7 @@
 
 #include <ntifs.h>
 #include "handle.h"
+#include "wire.h"
 
 // ========== ZwQuerySystemInformation 句柄相关定义 ==========
 
@@ -98,18 +99,12 @@ static VOID QueryObjectTypeName(
 
 // ========== 公开接口 ==========
 
-NTSTATUS EnumHandles(
-    _In_  ULONG  ProcessId,
-    _Out_ PVOID  OutputBuffer,
-    _In_  ULONG  OutputBufferSize,
-    _Out_ PULONG BytesWritten)
+// 快照即 SystemHandleInformation 原始缓冲区；ProcessId 过滤在格式化时进行，
+// 因此同一份快照可按不同 PID 重试
+NTSTATUS HandleCaptureSnapshot(PVOID* Snapshot)
 {
-    *BytesWritten = 0;
-
-    if (OutputBufferSize < sizeof(HANDLE_LIST_HEADER))
-        return STATUS_BUFFER_TOO_SMALL;
+    *Snapshot = nullptr;
 
-    // 查询系统全局句柄表
     ULONG bufSize = 0;
     NTSTATUS status = ZwQuerySystemInformation(SystemHandleInformation, NULL, 0, &bufSize);
     if (status != STATUS_INFO_LENGTH_MISMATCH) return status;
@@ -125,26 +120,69 @@ NTSTATUS EnumHandles(
         return status;
     }
 
-    PHANDLE_LIST_HEADER header = (PHANDLE_LIST_HEADER)OutputBuffer;
+    *Snapshot = sysHandles;
+    return STATUS_SUCCESS;
+}
+
+VOID HandleReleaseSnapshot(PVOID Snapshot)
+{
+    ExFreePoolWithTag(Snapshot, 'hndl');
+}
+
+// 按 PID 过滤（ProcessId=0 返回全部）
+static __forceinline BOOLEAN HandleMatches(PSYSTEM_HANDLE_TABLE_ENTRY_INFO Entry, ULONG ProcessId)
+{
+    return ProcessId == 0 || Entry->UniqueProcessId == (USHORT)ProcessId;
+}
+
+static NTSTATUS FormatHandlesV1(
+    PSYSTEM_HANDLE_INFORMATION sysHandles,
+    ULONG  ProcessId,
+    ULONG  Fields,
+    PASYNC_PROGRESS Progress,
+    PVOID  OutputBuffer,
+    ULONG  OutputBufferSize,
+    PULONG BytesWritten)
+{
+    if (OutputBufferSize < sizeof(HANDLE_LIST_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    ULONG count = sysHandles->NumberOfHandles;
+    if (ProcessId != 0) {
+        count = 0;
+        for (ULONG i = 0; i < sysHandles->NumberOfHandles; i++)
+            count += HandleMatches(&sysHandles->Handles[i], ProcessId) ? 1 : 0;
+    }
+
+    if (count > (MAXULONG - sizeof(HANDLE_LIST_HEADER)) / sizeof(HANDLE_INFO))
+        return STATUS_INTEGER_OVERFLOW;
+
+    ULONG totalSize = sizeof(HANDLE_LIST_HEADER) + count * sizeof(HANDLE_INFO);
+    if (OutputBufferSize < totalSize)
+        return WireListOverflow(OutputBuffer, totalSize, BytesWritten);
+
     PHANDLE_INFO outEntry = (PHANDLE_INFO)((PUCHAR)OutputBuffer + sizeof(HANDLE_LIST_HEADER));
-    ULONG maxEntries = (OutputBufferSize - sizeof(HANDLE_LIST_HEADER)) / sizeof(HANDLE_INFO);
-    ULONG count = 0;
 
-    for (ULONG i = 0; i < sysHandles->NumberOfHandles && count < maxEntries; i++) {
-        PSYSTEM_HANDLE_TABLE_ENTRY_INFO entry = &sysHandles->Handles[i];
+    for (ULONG i = 0; i < sysHandles->NumberOfHandles; i++) {
+        if (AsyncCheckpoint(Progress, i, sysHandles->NumberOfHandles))
+            return STATUS_CANCELLED;
 
-        // 按 PID 过滤（ProcessId=0 返回全部）
-        if (ProcessId != 0 && entry->UniqueProcessId != (USHORT)ProcessId)
+        PSYSTEM_HANDLE_TABLE_ENTRY_INFO entry = &sysHandles->Handles[i];
+        if (!HandleMatches(entry, ProcessId))
             continue;
 
-        outEntry->ProcessId       = entry->UniqueProcessId;
-        outEntry->Handle          = entry->HandleValue;
-        outEntry->ObjectTypeIndex = entry->ObjectTypeIndex;
-        outEntry->GrantedAccess   = entry->GrantedAccess;
-        outEntry->ObjectAddress   = (ULONG64)entry->Object;
+        outEntry->ProcessId       = (Fields & HANDLE_FIELD_PROCESS_ID) ? entry->UniqueProcessId : 0;
+        outEntry->Handle          = (Fields & HANDLE_FIELD_HANDLE) ? entry->HandleValue : 0;
+        outEntry->ObjectTypeIndex = (Fields & HANDLE_FIELD_TYPE_INDEX) ? entry->ObjectTypeIndex : 0;
+        outEntry->GrantedAccess   = (Fields & HANDLE_FIELD_ACCESS) ? entry->GrantedAccess : 0;
+        outEntry->ObjectAddress   = (Fields & HANDLE_FIELD_OBJECT) ? (ULONG64)entry->Object : 0;
 
-        QueryObjectTypeName(entry->ObjectTypeIndex, outEntry->TypeName,
-            RTL_NUMBER_OF(outEntry->TypeName));
+        if (Fields & HANDLE_FIELD_TYPE_NAME) {
+            QueryObjectTypeName(entry->ObjectTypeIndex, outEntry->TypeName,
+                RTL_NUMBER_OF(outEntry->TypeName));
+        } else {
+            RtlZeroMemory(outEntry->TypeName, sizeof(outEntry->TypeName));
+        }
 
         // 临时禁用对象名解析：
         // ObQueryNameString 在某些文件/注册表对象上会进入文件系统路径，
@@ -152,20 +190,108 @@ NTSTATUS EnumHandles(
         // 在彻底修复前先只返回基础句柄信息，ObjectName 保持为空。
         RtlZeroMemory(outEntry->ObjectName, sizeof(outEntry->ObjectName));
 
-        count++;
         outEntry++;
     }
 
-    ExFreePoolWithTag(sysHandles, 'hndl');
-
+    // 输出缓冲区可能直接映射自调用方（METHOD_OUT_DIRECT），只写不回读
+    PHANDLE_LIST_HEADER header = (PHANDLE_LIST_HEADER)OutputBuffer;
     header->Count     = count;
-    header->TotalSize = sizeof(HANDLE_LIST_HEADER) + count * sizeof(HANDLE_INFO);
-    *BytesWritten     = header->TotalSize;
+    header->TotalSize = totalSize;
+    *BytesWritten     = totalSize;
 
     DbgPrint("[OpenSysKit] [Handle] EnumHandles PID=%lu: %lu handles\n", ProcessId, count);
     return STATUS_SUCCESS;
 }
 
+// v2：类型名按 ObjectTypeIndex 缓存字符串偏移，全表只写一份；ObjectName 与 v1 一样暂为空串
+static NTSTATUS FormatHandlesV2(
+    PSYSTEM_HANDLE_INFORMATION sysHandles,
+    ULONG  ProcessId,
+    ULONG  Fields,
+    PASYNC_PROGRESS Progress,
+    PVOID  OutputBuffer,
+    ULONG  OutputBufferSize,
+    PULONG BytesWritten)
+{
+    if (OutputBufferSize < sizeof(ENUM_V2_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    WIRE_ENCODER encoder;
+    NTSTATUS status = WireEncoderInit(&encoder,
+        WireRecordSize(WireHandleFieldEnds, RTL_NUMBER_OF(WireHandleFieldEnds), Fields),
+        ProcessId == 0 ? sysHandles->NumberOfHandles : 0);
+    if (!NT_SUCCESS(status)) return status;
+
+    ULONG typeNames[256];
+    for (ULONG i = 0; i < RTL_NUMBER_OF(typeNames); i++)
+        typeNames[i] = MAXULONG;
+
+    for (ULONG i = 0; i < sysHandles->NumberOfHandles; i++) {
+        if (AsyncCheckpoint(Progress, i, sysHandles->NumberOfHandles)) {
+            status = STATUS_CANCELLED;
+            break;
+        }
+
+        PSYSTEM_HANDLE_TABLE_ENTRY_INFO entry = &sysHandles->Handles[i];
+        if (!HandleMatches(entry, ProcessId))
+            continue;
+
+        if ((Fields & HANDLE_FIELD_TYPE_NAME) && typeNames[entry->ObjectTypeIndex] == MAXULONG) {
+            WCHAR typeName[64];
+            ULONG typeLength = 0;
+
+            QueryObjectTypeName(entry->ObjectTypeIndex, typeName, RTL_NUMBER_OF(typeName));
+            while (typeLength < RTL_NUMBER_OF(typeName) && typeName[typeLength] != L'\0')
+                typeLength++;
+
+            status = WireInternString(&encoder, typeName, typeLength,
+                &typeNames[entry->ObjectTypeIndex]);
+            if (!NT_SUCCESS(status)) break;
+        }
+
+        HANDLE_RECORD_V2 record = { 0 };
+        if (Fields & HANDLE_FIELD_PROCESS_ID)  record.ProcessId       = entry->UniqueProcessId;
+        if (Fields & HANDLE_FIELD_ACCESS)      record.GrantedAccess   = entry->GrantedAccess;
+        if (Fields & HANDLE_FIELD_HANDLE)      record.Handle          = entry->HandleValue;
+        if (Fields & HANDLE_FIELD_OBJECT)      record.ObjectAddress   = (ULONG64)entry->Object;
+        if (Fields & HANDLE_FIELD_TYPE_INDEX)  record.ObjectTypeIndex = entry->ObjectTypeIndex;
+        if (Fields & HANDLE_FIELD_TYPE_NAME)   record.TypeName        = typeNames[entry->ObjectTypeIndex];
+        record.ObjectName = ENUM_V2_EMPTY_STRING;
+
+        status = WireCommitRecord(&encoder, &record);
+        if (!NT_SUCCESS(status)) break;
+    }
+
+    if (NT_SUCCESS(status))
+        status = WireEmit(&encoder, OutputBuffer, OutputBufferSize, BytesWritten);
+
+    DbgPrint("[OpenSysKit] [Handle] EnumHandles PID=%lu: %lu handles (v2, %lu bytes)\n",
+        ProcessId, encoder.Count, *BytesWritten);
+
+    WireEncoderFree(&encoder);
+    return status;
+}
+
+NTSTATUS HandleFormatSnapshot(
+    _In_  PVOID  Snapshot,
+    _In_  ULONG  ProcessId,
+    _In_  ULONG  Version,
+    _In_  ULONG  Fields,
+    _In_opt_ PASYNC_PROGRESS Progress,
+    _Out_ PVOID  OutputBuffer,
+    _In_  ULONG  OutputBufferSize,
+    _Out_ PULONG BytesWritten)
+{
+    PSYSTEM_HANDLE_INFORMATION sysHandles = (PSYSTEM_HANDLE_INFORMATION)Snapshot;
+    *BytesWritten = 0;
+
+    switch (Version) {
+    case ENUM_VERSION_1: return FormatHandlesV1(sysHandles, ProcessId, Fields, Progress, OutputBuffer, OutputBufferSize, BytesWritten);
+    case ENUM_VERSION_2: return FormatHandlesV2(sysHandles, ProcessId, Fields, Progress, OutputBuffer, OutputBufferSize, BytesWritten);
+    default:             return STATUS_NOT_SUPPORTED;
+    }
+}
+
 //
 // 强制关闭指定进程中的句柄：
 //   附加到目标进程地址空间后调用 ZwClose，
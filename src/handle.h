@@ -1,9 +1,13 @@
 #pragma once
 
 #include "driver.h"
+#include "async.h"
 
-// 枚举指定进程（ProcessId=0 则枚举全系统）的句柄
-NTSTATUS EnumHandles(ULONG ProcessId, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+// 句柄枚举：抓取全系统句柄表快照，格式化时按 ProcessId 过滤（0 则全部）
+NTSTATUS HandleCaptureSnapshot(PVOID* Snapshot);
+NTSTATUS HandleFormatSnapshot(PVOID Snapshot, ULONG ProcessId, ULONG Version, ULONG Fields,
+    PASYNC_PROGRESS Progress, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+VOID HandleReleaseSnapshot(PVOID Snapshot);
 
 // 强制关闭指定进程中的句柄
 NTSTATUS ForceCloseHandle(ULONG ProcessId, ULONG64 Handle);
@@ -7,6 +7,7 @@
 
 #include <ntifs.h>
 #include "kernelmod.h"
+#include "wire.h"
 
 // ========== 内核模块枚举 ==========
 //
@@ -59,15 +60,10 @@ static VOID CopyAnsiPathToWide(
     dst[i] = L'\0';
 }
 
-NTSTATUS EnumKernelModules(
-    _Out_ PVOID  OutputBuffer,
-    _In_  ULONG  OutputBufferSize,
-    _Out_ PULONG BytesWritten)
+// 快照即 SystemModuleInformation 原始缓冲区，v1 / v2 均由它格式化
+NTSTATUS KernelModuleCaptureSnapshot(PVOID* Snapshot)
 {
-    *BytesWritten = 0;
-
-    if (OutputBufferSize < sizeof(KERNEL_MODULE_LIST_HEADER))
-        return STATUS_BUFFER_TOO_SMALL;
+    *Snapshot = nullptr;
 
     ULONG bufSize = 0;
     NTSTATUS status = ZwQuerySystemInformation(SystemModuleInformation, nullptr, 0, &bufSize);
@@ -86,46 +82,172 @@ NTSTATUS EnumKernelModules(
         return status;
     }
 
-    PKERNEL_MODULE_LIST_HEADER header = (PKERNEL_MODULE_LIST_HEADER)OutputBuffer;
+    *Snapshot = modules;
+    return STATUS_SUCCESS;
+}
+
+VOID KernelModuleReleaseSnapshot(PVOID Snapshot)
+{
+    ExFreePoolWithTag(Snapshot, 'domK');
+}
+
+// 返回 FullPathName 的有效长度，BaseOffset 收敛到该长度以内
+static ULONG ModulePathLength(_In_ const SYSTEM_MODULE_ENTRY* Entry, _Out_ PULONG BaseOffset)
+{
+    ULONG fullPathLength = 0;
+
+    while (fullPathLength < RTL_NUMBER_OF(Entry->FullPathName) &&
+           Entry->FullPathName[fullPathLength] != '\0') {
+        ++fullPathLength;
+    }
+
+    *BaseOffset = min((ULONG)Entry->OffsetToFileName, fullPathLength);
+    return fullPathLength;
+}
+
+static NTSTATUS FormatKernelModulesV1(
+    _In_  PSYSTEM_MODULE_INFORMATION_EX modules,
+    _In_  ULONG  Fields,
+    _In_opt_ PASYNC_PROGRESS Progress,
+    _Out_ PVOID  OutputBuffer,
+    _In_  ULONG  OutputBufferSize,
+    _Out_ PULONG BytesWritten)
+{
+    if (OutputBufferSize < sizeof(KERNEL_MODULE_LIST_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    ULONG count = modules->NumberOfModules;
+    if (count > (MAXULONG - sizeof(KERNEL_MODULE_LIST_HEADER)) / sizeof(KERNEL_MODULE_INFO))
+        return STATUS_INTEGER_OVERFLOW;
+
+    ULONG totalSize = sizeof(KERNEL_MODULE_LIST_HEADER) + count * sizeof(KERNEL_MODULE_INFO);
+    if (OutputBufferSize < totalSize)
+        return WireListOverflow(OutputBuffer, totalSize, BytesWritten);
+
     PKERNEL_MODULE_INFO outEntry =
         (PKERNEL_MODULE_INFO)((PUCHAR)OutputBuffer + sizeof(KERNEL_MODULE_LIST_HEADER));
-    ULONG maxEntries =
-        (OutputBufferSize - sizeof(KERNEL_MODULE_LIST_HEADER)) / sizeof(KERNEL_MODULE_INFO);
-    ULONG count = 0;
-
-    for (ULONG i = 0; i < modules->NumberOfModules && count < maxEntries; ++i) {
-        SYSTEM_MODULE_ENTRY* entry = &modules->Modules[i];
-        ULONG fullPathLength = 0;
-        ULONG baseOffset = entry->OffsetToFileName;
 
-        while (fullPathLength < RTL_NUMBER_OF(entry->FullPathName) &&
-               entry->FullPathName[fullPathLength] != '\0') {
-            ++fullPathLength;
-        }
+    for (ULONG i = 0; i < count; ++i) {
+        if (AsyncCheckpoint(Progress, i, count))
+            return STATUS_CANCELLED;
 
-        if (baseOffset > fullPathLength)
-            baseOffset = fullPathLength;
+        SYSTEM_MODULE_ENTRY* entry = &modules->Modules[i];
 
-        outEntry->BaseAddress = (ULONG_PTR)entry->ImageBase;
-        outEntry->SizeOfImage = entry->ImageSize;
+        outEntry->BaseAddress = (Fields & MODULE_FIELD_BASE_ADDRESS) ? (ULONG_PTR)entry->ImageBase : 0;
+        outEntry->SizeOfImage = (Fields & MODULE_FIELD_SIZE) ? entry->ImageSize : 0;
         RtlZeroMemory(outEntry->FullPath, sizeof(outEntry->FullPath));
         RtlZeroMemory(outEntry->BaseName, sizeof(outEntry->BaseName));
 
-        CopyAnsiPathToWide(outEntry->FullPath, RTL_NUMBER_OF(outEntry->FullPath),
-            entry->FullPathName, fullPathLength);
-        CopyAnsiPathToWide(outEntry->BaseName, RTL_NUMBER_OF(outEntry->BaseName),
-            entry->FullPathName + baseOffset, fullPathLength - baseOffset);
+        if (Fields & (MODULE_FIELD_FULL_PATH | MODULE_FIELD_BASE_NAME)) {
+            ULONG baseOffset = 0;
+            ULONG fullPathLength = ModulePathLength(entry, &baseOffset);
+
+            if (Fields & MODULE_FIELD_FULL_PATH) {
+                CopyAnsiPathToWide(outEntry->FullPath, RTL_NUMBER_OF(outEntry->FullPath),
+                    entry->FullPathName, fullPathLength);
+            }
+            if (Fields & MODULE_FIELD_BASE_NAME) {
+                CopyAnsiPathToWide(outEntry->BaseName, RTL_NUMBER_OF(outEntry->BaseName),
+                    entry->FullPathName + baseOffset, fullPathLength - baseOffset);
+            }
+        }
 
-        ++count;
         ++outEntry;
     }
 
-    ExFreePoolWithTag(modules, 'domK');
-
+    // 输出缓冲区可能直接映射自调用方（METHOD_OUT_DIRECT），只写不回读
+    PKERNEL_MODULE_LIST_HEADER header = (PKERNEL_MODULE_LIST_HEADER)OutputBuffer;
     header->Count     = count;
-    header->TotalSize = sizeof(KERNEL_MODULE_LIST_HEADER) + count * sizeof(KERNEL_MODULE_INFO);
-    *BytesWritten     = header->TotalSize;
+    header->TotalSize = totalSize;
+    *BytesWritten     = totalSize;
 
     DbgPrint("[OpenSysKit] [KernelMod] enumerated %lu kernel modules\n", count);
     return STATUS_SUCCESS;
 }
+
+// v2：ANSI 路径逐字节扩展为 UTF-16 后入表，BaseName 不再截断到 64 字符；
+// 两个名字都未请求时不做扩展
+static NTSTATUS FormatKernelModulesV2(
+    _In_  PSYSTEM_MODULE_INFORMATION_EX modules,
+    _In_  ULONG  Fields,
+    _In_opt_ PASYNC_PROGRESS Progress,
+    _Out_ PVOID  OutputBuffer,
+    _In_  ULONG  OutputBufferSize,
+    _Out_ PULONG BytesWritten)
+{
+    if (OutputBufferSize < sizeof(ENUM_V2_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    WIRE_ENCODER encoder;
+    NTSTATUS status = WireEncoderInit(&encoder,
+        WireRecordSize(WireModuleFieldEnds, RTL_NUMBER_OF(WireModuleFieldEnds), Fields),
+        modules->NumberOfModules);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    for (ULONG i = 0; i < modules->NumberOfModules; ++i) {
+        if (AsyncCheckpoint(Progress, i, modules->NumberOfModules)) {
+            status = STATUS_CANCELLED;
+            break;
+        }
+
+        SYSTEM_MODULE_ENTRY* entry = &modules->Modules[i];
+        MODULE_RECORD_V2 record = { 0 };
+
+        if (Fields & MODULE_FIELD_BASE_ADDRESS)
+            record.BaseAddress = (ULONG64)(ULONG_PTR)entry->ImageBase;
+        if (Fields & MODULE_FIELD_SIZE)
+            record.SizeOfImage = entry->ImageSize;
+
+        if (Fields & (MODULE_FIELD_FULL_PATH | MODULE_FIELD_BASE_NAME)) {
+            WCHAR path[RTL_NUMBER_OF(entry->FullPathName) + 1];
+            ULONG baseOffset = 0;
+            ULONG fullPathLength = ModulePathLength(entry, &baseOffset);
+
+            CopyAnsiPathToWide(path, RTL_NUMBER_OF(path), entry->FullPathName, fullPathLength);
+
+            if (Fields & MODULE_FIELD_FULL_PATH)
+                status = WireInternString(&encoder, path, fullPathLength, &record.FullPath);
+            if (NT_SUCCESS(status) && (Fields & MODULE_FIELD_BASE_NAME)) {
+                status = WireInternString(&encoder, path + baseOffset,
+                    fullPathLength - baseOffset, &record.BaseName);
+            }
+            if (!NT_SUCCESS(status))
+                break;
+        }
+
+        status = WireCommitRecord(&encoder, &record);
+        if (!NT_SUCCESS(status))
+            break;
+    }
+
+    if (NT_SUCCESS(status))
+        status = WireEmit(&encoder, OutputBuffer, OutputBufferSize, BytesWritten);
+
+    DbgPrint("[OpenSysKit] [KernelMod] enumerated %lu kernel modules (v2, %lu bytes)\n",
+        encoder.Count, *BytesWritten);
+
+    WireEncoderFree(&encoder);
+    return status;
+}
+
+NTSTATUS KernelModuleFormatSnapshot(
+    _In_  PVOID  Snapshot,
+    _In_  ULONG  ProcessId,
+    _In_  ULONG  Version,
+    _In_  ULONG  Fields,
+    _In_opt_ PASYNC_PROGRESS Progress,
+    _Out_ PVOID  OutputBuffer,
+    _In_  ULONG  OutputBufferSize,
+    _Out_ PULONG BytesWritten)
+{
+    PSYSTEM_MODULE_INFORMATION_EX modules = (PSYSTEM_MODULE_INFORMATION_EX)Snapshot;
+    UNREFERENCED_PARAMETER(ProcessId);
+    *BytesWritten = 0;
+
+    switch (Version) {
+    case ENUM_VERSION_1: return FormatKernelModulesV1(modules, Fields, Progress, OutputBuffer, OutputBufferSize, BytesWritten);
+    case ENUM_VERSION_2: return FormatKernelModulesV2(modules, Fields, Progress, OutputBuffer, OutputBufferSize, BytesWritten);
+    default:             return STATUS_NOT_SUPPORTED;
+    }
+}
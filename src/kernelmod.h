@@ -1,6 +1,10 @@
 #pragma once
 
 #include "driver.h"
+#include "async.h"
 
-// 枚举内核已加载模块（通过 ZwQuerySystemInformation(SystemModuleInformation)）
-NTSTATUS EnumKernelModules(PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+// 内核模块枚举（ZwQuerySystemInformation(SystemModuleInformation)）：抓取快照后按 ENUM_VERSION_* 格式化
+NTSTATUS KernelModuleCaptureSnapshot(PVOID* Snapshot);
+NTSTATUS KernelModuleFormatSnapshot(PVOID Snapshot, ULONG ProcessId, ULONG Version, ULONG Fields,
+    PASYNC_PROGRESS Progress, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+VOID KernelModuleReleaseSnapshot(PVOID Snapshot);
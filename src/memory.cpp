@@ -7,6 +7,7 @@
 
 #include <ntifs.h>
 #include "memory.h"
+#include "wire.h"
 
 typedef PVOID (NTAPI* PFN_PS_GET_PROCESS_PEB)(
     _In_ PEPROCESS Process
@@ -134,30 +135,24 @@ typedef struct _PEB_LDR_DATA_PARTIAL {
 // PEB 中 Ldr 字段偏移（x64 固定）
 #define PEB_LDR_OFFSET  0x18
 
-NTSTATUS ProcessEnumModules(
-    _In_  ULONG  ProcessId,
-    _Out_ PVOID  OutputBuffer,
-    _In_  ULONG  OutputBufferSize,
-    _Out_ PULONG BytesWritten)
+// 模块访问回调：在附加态的 __try 内调用，Fields 中请求的 Full/BaseDllName 已 ProbeForRead，
+// 未请求的名字不得访问。返回失败码时停止遍历并原样返回。
+typedef NTSTATUS (*PMODULE_VISITOR)(_In_ PVOID Context, _In_ const LDR_DATA_TABLE_ENTRY_PARTIAL* Entry);
+
+static NTSTATUS WalkProcessModules(
+    _In_ ULONG           ProcessId,
+    _In_ ULONG           Fields,
+    _In_ PMODULE_VISITOR Visitor,
+    _In_ PVOID           Context)
 {
     PFN_PS_GET_PROCESS_PEB getProcessPeb = ResolvePsGetProcessPeb();
-    *BytesWritten = 0;
-
     if (!getProcessPeb)
         return STATUS_PROCEDURE_NOT_FOUND;
 
-    if (OutputBufferSize < sizeof(MODULE_LIST_HEADER))
-        return STATUS_BUFFER_TOO_SMALL;
-
     PEPROCESS process = nullptr;
     NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
     if (!NT_SUCCESS(status)) return status;
 
-    PMODULE_LIST_HEADER header = (PMODULE_LIST_HEADER)OutputBuffer;
-    PMODULE_INFO outEntry = (PMODULE_INFO)((PUCHAR)OutputBuffer + sizeof(MODULE_LIST_HEADER));
-    ULONG maxEntries = (OutputBufferSize - sizeof(MODULE_LIST_HEADER)) / sizeof(MODULE_INFO);
-    ULONG count = 0;
-
     KAPC_STATE apcState;
     KeStackAttachProcess(process, &apcState);
 
@@ -184,7 +179,8 @@ NTSTATUS ProcessEnumModules(
         PLIST_ENTRY head = &ldr->InLoadOrderModuleList;
         PLIST_ENTRY cur  = head->Flink;
 
-        while (cur != head && count < maxEntries) {
+        status = STATUS_SUCCESS;
+        while (cur != head) {
             ProbeForRead(cur, sizeof(LDR_DATA_TABLE_ENTRY_PARTIAL), 1);
             LDR_DATA_TABLE_ENTRY_PARTIAL* entry =
                 CONTAINING_RECORD(cur, LDR_DATA_TABLE_ENTRY_PARTIAL, InLoadOrderLinks);
@@ -194,32 +190,16 @@ NTSTATUS ProcessEnumModules(
                 continue;
             }
 
-            outEntry->BaseAddress  = (ULONG_PTR)entry->DllBase;
-            outEntry->SizeOfImage  = entry->SizeOfImage;
-
-            RtlZeroMemory(outEntry->FullPath,  sizeof(outEntry->FullPath));
-            RtlZeroMemory(outEntry->BaseName,  sizeof(outEntry->BaseName));
-
-            if (entry->FullDllName.Buffer && entry->FullDllName.Length > 0) {
+            if ((Fields & MODULE_FIELD_FULL_PATH) && entry->FullDllName.Buffer && entry->FullDllName.Length > 0)
                 ProbeForRead(entry->FullDllName.Buffer, entry->FullDllName.Length, 1);
-                USHORT copyLen = min(entry->FullDllName.Length,
-                    (USHORT)(sizeof(outEntry->FullPath) - sizeof(WCHAR)));
-                RtlCopyMemory(outEntry->FullPath, entry->FullDllName.Buffer, copyLen);
-            }
-
-            if (entry->BaseDllName.Buffer && entry->BaseDllName.Length > 0) {
+            if ((Fields & MODULE_FIELD_BASE_NAME) && entry->BaseDllName.Buffer && entry->BaseDllName.Length > 0)
                 ProbeForRead(entry->BaseDllName.Buffer, entry->BaseDllName.Length, 1);
-                USHORT copyLen = min(entry->BaseDllName.Length,
-                    (USHORT)(sizeof(outEntry->BaseName) - sizeof(WCHAR)));
-                RtlCopyMemory(outEntry->BaseName, entry->BaseDllName.Buffer, copyLen);
-            }
 
-            count++;
-            outEntry++;
+            status = Visitor(Context, entry);
+            if (!NT_SUCCESS(status)) break;
+
             cur = cur->Flink;
         }
-
-        status = STATUS_SUCCESS;
     }
     __except (EXCEPTION_EXECUTE_HANDLER) {
         status = GetExceptionCode();
@@ -229,12 +209,143 @@ NTSTATUS ProcessEnumModules(
 
     KeUnstackDetachProcess(&apcState);
     ObDereferenceObject(process);
+    return status;
+}
+
+// 放不下的模块只计数，用于在溢出应答中给出准确的 TotalSize
+typedef struct _MODULE_INFO_WRITER {
+    PMODULE_INFO Next;
+    ULONG        Capacity;
+    ULONG        Count;
+    ULONG        Fields;
+} MODULE_INFO_WRITER, *PMODULE_INFO_WRITER;
 
-    if (NT_SUCCESS(status)) {
-        header->Count     = count;
-        header->TotalSize = sizeof(MODULE_LIST_HEADER) + count * sizeof(MODULE_INFO);
-        *BytesWritten     = header->TotalSize;
+static NTSTATUS WriteModuleInfo(_In_ PVOID Context, _In_ const LDR_DATA_TABLE_ENTRY_PARTIAL* Entry)
+{
+    PMODULE_INFO_WRITER writer = (PMODULE_INFO_WRITER)Context;
+    if (writer->Count >= writer->Capacity) {
+        writer->Count++;
+        return STATUS_SUCCESS;
+    }
+
+    PMODULE_INFO outEntry = writer->Next;
+    ULONG fields = writer->Fields;
+    outEntry->BaseAddress  = (fields & MODULE_FIELD_BASE_ADDRESS) ? (ULONG_PTR)Entry->DllBase : 0;
+    outEntry->SizeOfImage  = (fields & MODULE_FIELD_SIZE) ? Entry->SizeOfImage : 0;
+
+    // 先复制名字再只清零其后的部分
+    USHORT copyLen = 0;
+    if ((fields & MODULE_FIELD_FULL_PATH) && Entry->FullDllName.Buffer) {
+        copyLen = min(Entry->FullDllName.Length,
+            (USHORT)(sizeof(outEntry->FullPath) - sizeof(WCHAR)));
+        RtlCopyMemory(outEntry->FullPath, Entry->FullDllName.Buffer, copyLen);
+    }
+    RtlZeroMemory((PUCHAR)outEntry->FullPath + copyLen, sizeof(outEntry->FullPath) - copyLen);
+
+    copyLen = 0;
+    if ((fields & MODULE_FIELD_BASE_NAME) && Entry->BaseDllName.Buffer) {
+        copyLen = min(Entry->BaseDllName.Length,
+            (USHORT)(sizeof(outEntry->BaseName) - sizeof(WCHAR)));
+        RtlCopyMemory(outEntry->BaseName, Entry->BaseDllName.Buffer, copyLen);
     }
+    RtlZeroMemory((PUCHAR)outEntry->BaseName + copyLen, sizeof(outEntry->BaseName) - copyLen);
+
+    writer->Next++;
+    writer->Count++;
+    return STATUS_SUCCESS;
+}
+
+typedef struct _MODULE_RECORD_WRITER {
+    WIRE_ENCODER Encoder;
+    ULONG        Fields;
+} MODULE_RECORD_WRITER, *PMODULE_RECORD_WRITER;
+
+static NTSTATUS EncodeModuleRecord(_In_ PVOID Context, _In_ const LDR_DATA_TABLE_ENTRY_PARTIAL* Entry)
+{
+    PMODULE_RECORD_WRITER writer = (PMODULE_RECORD_WRITER)Context;
+    MODULE_RECORD_V2 record = { 0 };
+    NTSTATUS status;
+
+    if (writer->Fields & MODULE_FIELD_BASE_ADDRESS)
+        record.BaseAddress = (ULONG64)(ULONG_PTR)Entry->DllBase;
+    if (writer->Fields & MODULE_FIELD_SIZE)
+        record.SizeOfImage = Entry->SizeOfImage;
+
+    if (writer->Fields & MODULE_FIELD_FULL_PATH) {
+        status = WireInternString(&writer->Encoder, Entry->FullDllName.Buffer,
+            Entry->FullDllName.Length / sizeof(WCHAR), &record.FullPath);
+        if (!NT_SUCCESS(status))
+            return status;
+    }
+
+    if (writer->Fields & MODULE_FIELD_BASE_NAME) {
+        status = WireInternString(&writer->Encoder, Entry->BaseDllName.Buffer,
+            Entry->BaseDllName.Length / sizeof(WCHAR), &record.BaseName);
+        if (!NT_SUCCESS(status))
+            return status;
+    }
+
+    return WireCommitRecord(&writer->Encoder, &record);
+}
+
+NTSTATUS ProcessEnumModules(
+    _In_  ULONG  ProcessId,
+    _In_  ULONG  Fields,
+    _Out_ PVOID  OutputBuffer,
+    _In_  ULONG  OutputBufferSize,
+    _Out_ PULONG BytesWritten)
+{
+    *BytesWritten = 0;
+
+    if (OutputBufferSize < sizeof(MODULE_LIST_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    PMODULE_LIST_HEADER header = (PMODULE_LIST_HEADER)OutputBuffer;
+    MODULE_INFO_WRITER writer;
+    writer.Next     = (PMODULE_INFO)((PUCHAR)OutputBuffer + sizeof(MODULE_LIST_HEADER));
+    writer.Capacity = (OutputBufferSize - sizeof(MODULE_LIST_HEADER)) / sizeof(MODULE_INFO);
+    writer.Count    = 0;
+    writer.Fields   = Fields;
+
+    NTSTATUS status = WalkProcessModules(ProcessId, Fields, WriteModuleInfo, &writer);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    // 模块链表是活数据，不保留快照：溢出时只给出所需大小
+    ULONG totalSize = sizeof(MODULE_LIST_HEADER) + writer.Count * sizeof(MODULE_INFO);
+    if (writer.Count > writer.Capacity)
+        return WireListOverflow(OutputBuffer, totalSize, BytesWritten);
+
+    header->Count     = writer.Count;
+    header->TotalSize = totalSize;
+    *BytesWritten     = totalSize;
+    return STATUS_SUCCESS;
+}
+
+// v2：模块路径完整保留（v1 截断到 520/260 字符），同名 DLL 路径去重
+NTSTATUS ProcessEnumModulesV2(
+    _In_  ULONG  ProcessId,
+    _In_  ULONG  Fields,
+    _Out_ PVOID  OutputBuffer,
+    _In_  ULONG  OutputBufferSize,
+    _Out_ PULONG BytesWritten)
+{
+    *BytesWritten = 0;
+
+    if (OutputBufferSize < sizeof(ENUM_V2_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    MODULE_RECORD_WRITER writer;
+    writer.Fields = Fields;
+    NTSTATUS status = WireEncoderInit(&writer.Encoder,
+        WireRecordSize(WireModuleFieldEnds, RTL_NUMBER_OF(WireModuleFieldEnds), Fields), 0);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    status = WalkProcessModules(ProcessId, Fields, EncodeModuleRecord, &writer);
+    if (NT_SUCCESS(status))
+        status = WireEmit(&writer.Encoder, OutputBuffer, OutputBufferSize, BytesWritten);
 
+    WireEncoderFree(&writer.Encoder);
     return status;
 }
@@ -9,4 +9,7 @@ NTSTATUS ProcessReadMemory(ULONG ProcessId, ULONG64 Address, PVOID Buffer, ULONG
 NTSTATUS ProcessWriteMemory(ULONG ProcessId, ULONG64 Address, PVOID Buffer, ULONG Size);
 
 // 枚举目标进程已加载的模块（VAD 扫描 PE 头）
-NTSTATUS ProcessEnumModules(ULONG ProcessId, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+NTSTATUS ProcessEnumModules(ULONG ProcessId, ULONG Fields, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+
+// 进程模块枚举，v2 编码（wire_format.h）
+NTSTATUS ProcessEnumModulesV2(ULONG ProcessId, ULONG Fields, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
@@ -0,0 +1,66 @@
+#pragma once
+
+//
+// Base types for code shared by the driver and the host tools
+//
+// Driver builds take everything from the WDK. Host builds (OSK_HOST_BUILD,
+// set by CMake when the WDK is absent) get the small subset of NT types,
+// status codes and Rtl helpers the portable modules use.
+//
+
+#ifndef OSK_HOST_BUILD
+
+#include <ntddk.h>
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void        VOID;
+typedef char        CHAR;
+typedef uint8_t     UCHAR, *PUCHAR;
+typedef uint16_t    USHORT;
+typedef uint16_t    WCHAR;
+typedef int32_t     LONG, *PLONG;
+typedef uint32_t    ULONG, *PULONG;
+typedef int64_t     LONGLONG, LONG64;
+typedef uint64_t    ULONGLONG, ULONG64;
+typedef size_t      SIZE_T;
+typedef void*       PVOID;
+typedef UCHAR       BOOLEAN, *PBOOLEAN;
+typedef int32_t     NTSTATUS;
+
+#define TRUE    1
+#define FALSE   0
+
+#define NT_SUCCESS(Status)      (((NTSTATUS)(Status)) >= 0)
+#define STATUS_SUCCESS          ((NTSTATUS)0x00000000L)
+#define STATUS_UNSUCCESSFUL     ((NTSTATUS)0xC0000001L)
+#define STATUS_END_OF_FILE      ((NTSTATUS)0xC0000011L)
+#define STATUS_NO_MEMORY        ((NTSTATUS)0xC0000017L)
+
+#define MAXULONG    0xFFFFFFFFUL
+
+#define RtlCopyMemory(Destination, Source, Length)  memcpy((Destination), (Source), (Length))
+#define RtlZeroMemory(Destination, Length)          memset((Destination), 0, (Length))
+
+static inline SIZE_T RtlCompareMemory(const VOID* Source1, const VOID* Source2, SIZE_T Length)
+{
+    const UCHAR* a = (const UCHAR*)Source1;
+    const UCHAR* b = (const UCHAR*)Source2;
+    SIZE_T i = 0;
+    while (i < Length && a[i] == b[i]) i++;
+    return i;
+}
+
+#define C_ASSERT(e)                 static_assert(e, #e)
+#define FIELD_OFFSET(type, field)   ((LONG)offsetof(type, field))
+
+#ifndef __forceinline
+#define __forceinline inline __attribute__((always_inline))
+#endif
+
+#endif // OSK_HOST_BUILD
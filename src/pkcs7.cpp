@@ -0,0 +1,264 @@
+//
+// Minimal DER walker for Authenticode PKCS#7 SignedData
+//
+// Only the path from ContentInfo down to the fields Authenticode needs is
+// decoded; every other element is skipped by its length without being
+// looked at. Countersignatures and nested signatures live in the
+// unauthenticated attributes and are never visited.
+//
+
+#include "pkcs7.h"
+
+#define DER_INTEGER         0x02
+#define DER_OCTET_STRING    0x04
+#define DER_OID             0x06
+#define DER_SEQUENCE        0x30
+#define DER_SET             0x31
+#define DER_CONTEXT_0       0xA0    // [0] constructed
+#define DER_CONTEXT_1       0xA1    // [1] constructed
+
+typedef struct _DER_ITEM {
+    UCHAR        Tag;
+    const UCHAR* Raw;       // first byte of the tag
+    ULONG        RawLength; // tag + length + value
+    const UCHAR* Value;
+    ULONG        Length;
+} DER_ITEM, *PDER_ITEM;
+
+// 1.2.840.113549.1.7.2 signedData
+static const UCHAR OidSignedData[]    = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x02 };
+// 1.3.6.1.4.1.311.2.1.4 SPC_INDIRECT_DATA_OBJID
+static const UCHAR OidSpcIndirect[]   = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x02, 0x01, 0x04 };
+// 1.2.840.113549.1.9.4 messageDigest
+static const UCHAR OidMessageDigest[] = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x04 };
+// 1.3.14.3.2.26 sha1
+static const UCHAR OidSha1[]          = { 0x2B, 0x0E, 0x03, 0x02, 0x1A };
+// 2.16.840.1.101.3.4.2.1 sha256
+static const UCHAR OidSha256[]        = { 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01 };
+
+// ================================================================
+// TLV primitives
+// ================================================================
+
+//
+// Reads one TLV at *Cursor and advances past it. Only single-byte tags and
+// definite lengths up to 4 bytes are accepted, which covers all of DER
+// that Authenticode uses.
+//
+static BOOLEAN DerRead(const UCHAR** Cursor, const UCHAR* End, PDER_ITEM Item)
+{
+    const UCHAR* p = *Cursor;
+    if (p >= End || End - p < 2) return FALSE;
+
+    Item->Raw = p;
+    Item->Tag = *p++;
+    if ((Item->Tag & 0x1F) == 0x1F) return FALSE;
+
+    ULONG len = *p++;
+    if (len & 0x80) {
+        ULONG lenBytes = len & 0x7F;
+        if (lenBytes == 0 || lenBytes > 4 || (ULONG)(End - p) < lenBytes) return FALSE;
+        len = 0;
+        for (ULONG i = 0; i < lenBytes; i++)
+            len = (len << 8) | *p++;
+    }
+
+    if ((ULONG)(End - p) < len) return FALSE;
+
+    Item->Value     = p;
+    Item->Length    = len;
+    Item->RawLength = (ULONG)(p - Item->Raw) + len;
+    *Cursor = p + len;
+    return TRUE;
+}
+
+static BOOLEAN DerExpect(const UCHAR** Cursor, const UCHAR* End, UCHAR Tag, PDER_ITEM Item)
+{
+    return DerRead(Cursor, End, Item) && Item->Tag == Tag;
+}
+
+static BOOLEAN DerOidEquals(const DER_ITEM* Item, const UCHAR* Oid, ULONG OidLength)
+{
+    return Item->Tag == DER_OID && Item->Length == OidLength &&
+        RtlCompareMemory(Item->Value, Oid, OidLength) == OidLength;
+}
+
+// AlgorithmIdentifier ::= SEQUENCE { algorithm OID, parameters ANY OPTIONAL }
+static BOOLEAN DerReadDigestAlg(const UCHAR** Cursor, const UCHAR* End, PKCS7_DIGEST_ALG* Alg)
+{
+    DER_ITEM seq, oid;
+    if (!DerExpect(Cursor, End, DER_SEQUENCE, &seq)) return FALSE;
+
+    const UCHAR* p = seq.Value;
+    if (!DerRead(&p, seq.Value + seq.Length, &oid)) return FALSE;
+
+    if (DerOidEquals(&oid, OidSha256, sizeof(OidSha256)))
+        *Alg = Pkcs7DigestSha256;
+    else if (DerOidEquals(&oid, OidSha1, sizeof(OidSha1)))
+        *Alg = Pkcs7DigestSha1;
+    else
+        *Alg = Pkcs7DigestUnknown;
+    return TRUE;
+}
+
+// ================================================================
+// SignedData pieces
+// ================================================================
+
+//
+// encapContentInfo ::= SEQUENCE { SPC_INDIRECT_DATA_OBJID, [0] SpcIndirectDataContent }
+// SpcIndirectDataContent ::= SEQUENCE { data SEQUENCE, messageDigest DigestInfo }
+// DigestInfo ::= SEQUENCE { digestAlgorithm AlgorithmIdentifier, digest OCTET STRING }
+//
+static BOOLEAN ParseIndirectData(const DER_ITEM* ContentInfo, PPKCS7_SIGNED_DATA Out)
+{
+    const UCHAR* p = ContentInfo->Value;
+    const UCHAR* end = p + ContentInfo->Length;
+    DER_ITEM oid, explicit0, indirect, data, digestInfo, digest;
+
+    if (!DerRead(&p, end, &oid) || !DerOidEquals(&oid, OidSpcIndirect, sizeof(OidSpcIndirect)))
+        return FALSE;
+    if (!DerExpect(&p, end, DER_CONTEXT_0, &explicit0)) return FALSE;
+
+    p = explicit0.Value;
+    end = p + explicit0.Length;
+    if (!DerExpect(&p, end, DER_SEQUENCE, &indirect)) return FALSE;
+    Out->IndirectContent       = indirect.Value;
+    Out->IndirectContentLength = indirect.Length;
+
+    p = indirect.Value;
+    end = p + indirect.Length;
+    if (!DerExpect(&p, end, DER_SEQUENCE, &data)) return FALSE;
+    if (!DerExpect(&p, end, DER_SEQUENCE, &digestInfo)) return FALSE;
+
+    p = digestInfo.Value;
+    end = p + digestInfo.Length;
+    if (!DerReadDigestAlg(&p, end, &Out->ImageDigestAlg)) return FALSE;
+    if (!DerExpect(&p, end, DER_OCTET_STRING, &digest)) return FALSE;
+
+    Out->ImageDigest       = digest.Value;
+    Out->ImageDigestLength = digest.Length;
+    return TRUE;
+}
+
+//
+// authenticatedAttributes ::= [0] IMPLICIT SET OF Attribute
+// Attribute ::= SEQUENCE { type OID, values SET OF ANY }
+//
+static BOOLEAN FindMessageDigestAttr(const DER_ITEM* Attributes, PPKCS7_SIGNED_DATA Out)
+{
+    const UCHAR* p = Attributes->Value;
+    const UCHAR* end = p + Attributes->Length;
+
+    while (p < end) {
+        DER_ITEM attr, type, values, value;
+        if (!DerExpect(&p, end, DER_SEQUENCE, &attr)) return FALSE;
+
+        const UCHAR* q = attr.Value;
+        const UCHAR* attrEnd = q + attr.Length;
+        if (!DerRead(&q, attrEnd, &type)) return FALSE;
+        if (!DerOidEquals(&type, OidMessageDigest, sizeof(OidMessageDigest))) continue;
+
+        if (!DerExpect(&q, attrEnd, DER_SET, &values)) return FALSE;
+        q = values.Value;
+        if (!DerExpect(&q, values.Value + values.Length, DER_OCTET_STRING, &value)) return FALSE;
+
+        Out->AttrMessageDigest       = value.Value;
+        Out->AttrMessageDigestLength = value.Length;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// SignerInfo ::= SEQUENCE {
+//     version INTEGER, issuerAndSerialNumber SEQUENCE,
+//     digestAlgorithm AlgorithmIdentifier,
+//     authenticatedAttributes [0] IMPLICIT SET OF Attribute, ... }
+//
+static BOOLEAN ParseSignerInfo(const DER_ITEM* SignerInfos, PPKCS7_SIGNED_DATA Out)
+{
+    const UCHAR* p = SignerInfos->Value;
+    const UCHAR* end = p + SignerInfos->Length;
+    DER_ITEM signer, version, issuer, attrs;
+
+    // Authenticode carries exactly one signer; only the first one counts
+    if (!DerExpect(&p, end, DER_SEQUENCE, &signer)) return FALSE;
+
+    p = signer.Value;
+    end = p + signer.Length;
+    if (!DerExpect(&p, end, DER_INTEGER, &version)) return FALSE;
+    if (!DerExpect(&p, end, DER_SEQUENCE, &issuer)) return FALSE;
+    if (!DerReadDigestAlg(&p, end, &Out->SignerDigestAlg)) return FALSE;
+    if (!DerExpect(&p, end, DER_CONTEXT_0, &attrs)) return FALSE;
+
+    return FindMessageDigestAttr(&attrs, Out);
+}
+
+// ================================================================
+// Public API
+// ================================================================
+
+//
+// ContentInfo ::= SEQUENCE { contentType OID, content [0] EXPLICIT SignedData }
+// SignedData ::= SEQUENCE {
+//     version INTEGER, digestAlgorithms SET,
+//     encapContentInfo SEQUENCE,
+//     certificates [0] IMPLICIT SET OF Certificate OPTIONAL,
+//     crls [1] IMPLICIT OPTIONAL,
+//     signerInfos SET OF SignerInfo }
+//
+BOOLEAN Pkcs7ParseSignedData(const UCHAR* Data, ULONG Length, PPKCS7_SIGNED_DATA Out)
+{
+    RtlZeroMemory(Out, sizeof(*Out));
+    if (!Data) return FALSE;
+
+    const UCHAR* p = Data;
+    const UCHAR* end = Data + Length;
+    DER_ITEM contentInfo, oid, explicit0, signedData, item;
+
+    if (!DerExpect(&p, end, DER_SEQUENCE, &contentInfo)) return FALSE;
+
+    p = contentInfo.Value;
+    end = p + contentInfo.Length;
+    if (!DerRead(&p, end, &oid) || !DerOidEquals(&oid, OidSignedData, sizeof(OidSignedData)))
+        return FALSE;
+    if (!DerExpect(&p, end, DER_CONTEXT_0, &explicit0)) return FALSE;
+
+    p = explicit0.Value;
+    end = p + explicit0.Length;
+    if (!DerExpect(&p, end, DER_SEQUENCE, &signedData)) return FALSE;
+
+    p = signedData.Value;
+    end = p + signedData.Length;
+    if (!DerExpect(&p, end, DER_INTEGER, &item)) return FALSE;      // version
+    if (!DerExpect(&p, end, DER_SET, &item)) return FALSE;          // digestAlgorithms
+    if (!DerExpect(&p, end, DER_SEQUENCE, &item)) return FALSE;     // encapContentInfo
+    if (!ParseIndirectData(&item, Out)) return FALSE;
+
+    if (!DerRead(&p, end, &item)) return FALSE;
+    if (item.Tag == DER_CONTEXT_0) {
+        Out->Certificates       = item.Value;
+        Out->CertificatesLength = item.Length;
+        if (!DerRead(&p, end, &item)) return FALSE;
+    }
+    if (item.Tag == DER_CONTEXT_1) {
+        if (!DerRead(&p, end, &item)) return FALSE;
+    }
+    if (item.Tag != DER_SET) return FALSE;                          // signerInfos
+
+    return ParseSignerInfo(&item, Out);
+}
+
+BOOLEAN Pkcs7NextCertificate(
+    const UCHAR** Cursor, const UCHAR* End,
+    const UCHAR** Cert, ULONG* CertLength)
+{
+    DER_ITEM cert;
+    if (!*Cursor || *Cursor >= End) return FALSE;
+    if (!DerExpect(Cursor, End, DER_SEQUENCE, &cert)) return FALSE;
+
+    *Cert       = cert.Raw;
+    *CertLength = cert.RawLength;
+    return TRUE;
+}
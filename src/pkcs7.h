@@ -0,0 +1,49 @@
+#pragma once
+
+//
+// Minimal DER walker for Authenticode PKCS#7 SignedData
+//
+// Single pass, bounds-checked, definite-length DER only. Nothing is
+// copied: every field in PKCS7_SIGNED_DATA points into the input blob.
+//
+
+#include "osk_types.h"
+
+typedef enum _PKCS7_DIGEST_ALG {
+    Pkcs7DigestUnknown = 0,
+    Pkcs7DigestSha1,
+    Pkcs7DigestSha256
+} PKCS7_DIGEST_ALG;
+
+typedef struct _PKCS7_SIGNED_DATA {
+    // SpcIndirectDataContent.messageDigest: the Authenticode image hash
+    PKCS7_DIGEST_ALG ImageDigestAlg;
+    const UCHAR*     ImageDigest;
+    ULONG            ImageDigestLength;
+
+    // Value bytes (no tag/length) of SpcIndirectDataContent, which is what
+    // the signer's messageDigest attribute is computed over
+    const UCHAR*     IndirectContent;
+    ULONG            IndirectContentLength;
+
+    // Contents of SignedData.certificates [0]; walk with Pkcs7NextCertificate
+    const UCHAR*     Certificates;
+    ULONG            CertificatesLength;
+
+    // First SignerInfo: digest algorithm and the messageDigest
+    // authenticated attribute
+    PKCS7_DIGEST_ALG SignerDigestAlg;
+    const UCHAR*     AttrMessageDigest;
+    ULONG            AttrMessageDigestLength;
+} PKCS7_SIGNED_DATA, *PPKCS7_SIGNED_DATA;
+
+// Parses a ContentInfo wrapping Authenticode SignedData. Returns FALSE on
+// any structural error; Out is only meaningful on success.
+BOOLEAN Pkcs7ParseSignedData(const UCHAR* Data, ULONG Length, PPKCS7_SIGNED_DATA Out);
+
+// Iterates the certificates set. *Cursor starts at Certificates and
+// advances past each returned certificate; Cert/CertLength cover the full
+// DER encoding (tag included), i.e. the bytes a thumbprint is taken over.
+BOOLEAN Pkcs7NextCertificate(
+    const UCHAR** Cursor, const UCHAR* End,
+    const UCHAR** Cert, ULONG* CertLength);
@@ -0,0 +1,253 @@
+//
+// Background signature pre-verification
+//
+// Process-create notify -> bounded, deduplicated queue -> one system worker.
+// The notify routine only copies the image name and signals; all file I/O
+// and hashing happen on the worker at PASSIVE_LEVEL. A create whose image is
+// already queued adds its (PID, create time) to that item; the worker gives
+// those processes the verdict of the single verification.
+//
+
+#include <ntddk.h>
+#include "prewarm.h"
+#include "signature.h"
+
+#ifdef DBG
+#define PrewarmLog(fmt, ...) DbgPrint("[OpenSysKit][Prewarm] " fmt "\n", ##__VA_ARGS__)
+#else
+#define PrewarmLog(fmt, ...)
+#endif
+
+typedef struct _PREWARM_PROCESS {
+    ULONG    ProcessId;
+    LONGLONG CreateTime;
+} PREWARM_PROCESS;
+
+typedef struct _PREWARM_ITEM {
+    LIST_ENTRY      Link;
+    ULONG           ProcessId;
+    LONGLONG        CreateTime;
+    ULONG           PathHash;
+    ULONG           FoldedCount;    // guarded by g_PrewarmLock while queued
+    PREWARM_PROCESS Folded[PREWARM_MAX_FOLDED];
+    UNICODE_STRING  ImagePath;      // Buffer follows the struct
+} PREWARM_ITEM, *PPREWARM_ITEM;
+
+static LIST_ENTRY   g_PrewarmQueue;
+static ULONG        g_PrewarmQueued = 0;
+static KSPIN_LOCK   g_PrewarmLock;
+static KEVENT       g_PrewarmEvent;
+static PKTHREAD     g_PrewarmThread = NULL;
+static BOOLEAN      g_PrewarmNotifyRegistered = FALSE;
+static volatile LONG g_PrewarmStopping = 0;
+static SIGNATURE_PREWARM_STATS g_PrewarmStats = { 0 };
+
+static VOID FreeItem(PPREWARM_ITEM Item)
+{
+    ExFreePoolWithTag(Item, PREWARM_TAG);
+}
+
+static PPREWARM_ITEM Dequeue(VOID)
+{
+    PPREWARM_ITEM item = NULL;
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_PrewarmLock, &oldIrql);
+    if (!IsListEmpty(&g_PrewarmQueue)) {
+        item = CONTAINING_RECORD(RemoveHeadList(&g_PrewarmQueue), PREWARM_ITEM, Link);
+        g_PrewarmQueued--;
+    }
+    KeReleaseSpinLock(&g_PrewarmLock, oldIrql);
+    return item;
+}
+
+//
+// Paths are compared by case-insensitive hash (computed before taking the
+// lock) plus an exact match. Two spellings of one path are not folded;
+// the second verification then hits the content cache anyway.
+//
+static PPREWARM_ITEM FindQueuedLocked(const PREWARM_ITEM* Item)
+{
+    for (PLIST_ENTRY e = g_PrewarmQueue.Flink; e != &g_PrewarmQueue; e = e->Flink) {
+        PPREWARM_ITEM queued = CONTAINING_RECORD(e, PREWARM_ITEM, Link);
+        if (queued->PathHash == Item->PathHash &&
+            queued->ImagePath.Length == Item->ImagePath.Length &&
+            RtlCompareMemory(queued->ImagePath.Buffer, Item->ImagePath.Buffer,
+                Item->ImagePath.Length) == Item->ImagePath.Length)
+            return queued;
+    }
+    return NULL;
+}
+
+static VOID Enqueue(PEPROCESS Process, HANDLE ProcessId, PCUNICODE_STRING ImageFileName)
+{
+    PPREWARM_ITEM item = (PPREWARM_ITEM)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, sizeof(PREWARM_ITEM) + ImageFileName->Length, PREWARM_TAG);
+    if (!item) {
+        InterlockedIncrement(&g_PrewarmStats.Dropped);
+        return;
+    }
+
+    item->ProcessId   = (ULONG)(ULONG_PTR)ProcessId;
+    item->CreateTime  = PsGetProcessCreateTimeQuadPart(Process);
+    item->FoldedCount = 0;
+    item->ImagePath.Buffer        = (PWCH)(item + 1);
+    item->ImagePath.Length        = ImageFileName->Length;
+    item->ImagePath.MaximumLength = ImageFileName->Length;
+    RtlCopyMemory(item->ImagePath.Buffer, ImageFileName->Buffer, ImageFileName->Length);
+    if (!NT_SUCCESS(RtlHashUnicodeString(&item->ImagePath, TRUE,
+            HASH_STRING_ALGORITHM_DEFAULT, &item->PathHash)))
+        item->PathHash = 0;
+
+    PLONG counter;
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_PrewarmLock, &oldIrql);
+    PPREWARM_ITEM queued = FindQueuedLocked(item);
+    if (queued) {
+        if (queued->FoldedCount < PREWARM_MAX_FOLDED) {
+            queued->Folded[queued->FoldedCount].ProcessId  = item->ProcessId;
+            queued->Folded[queued->FoldedCount].CreateTime = item->CreateTime;
+            queued->FoldedCount++;
+            counter = &g_PrewarmStats.Deduplicated;
+        } else {
+            counter = &g_PrewarmStats.Dropped;
+        }
+    } else if (g_PrewarmQueued >= PREWARM_MAX_QUEUED) {
+        counter = &g_PrewarmStats.Dropped;
+    } else {
+        InsertTailList(&g_PrewarmQueue, &item->Link);
+        g_PrewarmQueued++;
+        counter = &g_PrewarmStats.Queued;
+        item = NULL;
+    }
+    KeReleaseSpinLock(&g_PrewarmLock, oldIrql);
+
+    InterlockedIncrement(counter);
+    if (item)
+        FreeItem(item);
+    else
+        KeSetEvent(&g_PrewarmEvent, IO_NO_INCREMENT, FALSE);
+}
+
+static VOID PrewarmCreateProcessNotify(
+    _Inout_ PEPROCESS Process,
+    _In_ HANDLE ProcessId,
+    _Inout_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo)
+{
+    // Exit notifications carry no CreateInfo
+    if (!CreateInfo || !CreateInfo->ImageFileName || !CreateInfo->ImageFileName->Length)
+        return;
+    if (ReadNoFence(&g_PrewarmStopping))
+        return;
+
+    Enqueue(Process, ProcessId, CreateInfo->ImageFileName);
+}
+
+static VOID PrewarmWorker(PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    for (;;) {
+        KeWaitForSingleObject(&g_PrewarmEvent, Executive, KernelMode, FALSE, NULL);
+
+        PPREWARM_ITEM item;
+        while ((item = Dequeue()) != NULL) {
+            // Dequeued, so no notify routine can add to Folded any more
+            if (!ReadNoFence(&g_PrewarmStopping)) {
+                SIGNATURE_STATUS status = PrewarmProcessSignature(
+                    item->ProcessId, item->CreateTime, &item->ImagePath);
+                for (ULONG i = 0; i < item->FoldedCount; i++)
+                    PrewarmRecordSignature(item->Folded[i].ProcessId, item->Folded[i].CreateTime, status);
+                InterlockedIncrement(&g_PrewarmStats.Verified);
+            }
+            FreeItem(item);
+        }
+
+        if (ReadNoFence(&g_PrewarmStopping)) break;
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+NTSTATUS StartSignaturePrewarm(VOID)
+{
+    InitializeListHead(&g_PrewarmQueue);
+    KeInitializeSpinLock(&g_PrewarmLock);
+    KeInitializeEvent(&g_PrewarmEvent, SynchronizationEvent, FALSE);
+    g_PrewarmStopping = 0;
+
+    HANDLE threadHandle = NULL;
+    NTSTATUS status = PsCreateSystemThread(&threadHandle, THREAD_ALL_ACCESS, NULL,
+        NULL, NULL, PrewarmWorker, NULL);
+    if (!NT_SUCCESS(status)) {
+        PrewarmLog("PsCreateSystemThread failed: 0x%08X", status);
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle(threadHandle, SYNCHRONIZE, *PsThreadType,
+        KernelMode, (PVOID*)&g_PrewarmThread, NULL);
+    ZwClose(threadHandle);
+    if (!NT_SUCCESS(status)) {
+        // Cannot wait for it later; stop it now while we still can signal it
+        InterlockedExchange(&g_PrewarmStopping, 1);
+        KeSetEvent(&g_PrewarmEvent, IO_NO_INCREMENT, FALSE);
+        g_PrewarmThread = NULL;
+        return status;
+    }
+
+    status = PsSetCreateProcessNotifyRoutineEx(PrewarmCreateProcessNotify, FALSE);
+    if (!NT_SUCCESS(status)) {
+        PrewarmLog("PsSetCreateProcessNotifyRoutineEx failed: 0x%08X", status);
+        StopSignaturePrewarm();
+        return status;
+    }
+
+    g_PrewarmNotifyRegistered = TRUE;
+    PrewarmLog("Prewarm worker started");
+    return STATUS_SUCCESS;
+}
+
+VOID StopSignaturePrewarm(VOID)
+{
+    // Removal waits for notify routines already running
+    if (g_PrewarmNotifyRegistered) {
+        PsSetCreateProcessNotifyRoutineEx(PrewarmCreateProcessNotify, TRUE);
+        g_PrewarmNotifyRegistered = FALSE;
+    }
+
+    if (g_PrewarmThread) {
+        InterlockedExchange(&g_PrewarmStopping, 1);
+        KeSetEvent(&g_PrewarmEvent, IO_NO_INCREMENT, FALSE);
+        KeWaitForSingleObject(g_PrewarmThread, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(g_PrewarmThread);
+        g_PrewarmThread = NULL;
+
+        PPREWARM_ITEM item;
+        while ((item = Dequeue()) != NULL)
+            FreeItem(item);
+    }
+
+    PrewarmLog("Prewarm stopped: queued=%ld dedup=%ld dropped=%ld verified=%ld hits=%ld misses=%ld",
+        g_PrewarmStats.Queued, g_PrewarmStats.Deduplicated, g_PrewarmStats.Dropped,
+        g_PrewarmStats.Verified, g_PrewarmStats.Hits, g_PrewarmStats.Misses);
+}
+
+BOOLEAN IsSignaturePrewarmRunning(VOID)
+{
+    return g_PrewarmNotifyRegistered;
+}
+
+VOID SignaturePrewarmNoteLookup(BOOLEAN PrewarmHit)
+{
+    if (!g_PrewarmNotifyRegistered) return;
+    InterlockedIncrement(PrewarmHit ? &g_PrewarmStats.Hits : &g_PrewarmStats.Misses);
+}
+
+VOID GetSignaturePrewarmStats(PSIGNATURE_PREWARM_STATS Stats)
+{
+    Stats->Queued       = ReadNoFence(&g_PrewarmStats.Queued);
+    Stats->Deduplicated = ReadNoFence(&g_PrewarmStats.Deduplicated);
+    Stats->Dropped      = ReadNoFence(&g_PrewarmStats.Dropped);
+    Stats->Verified     = ReadNoFence(&g_PrewarmStats.Verified);
+    Stats->Hits         = ReadNoFence(&g_PrewarmStats.Hits);
+    Stats->Misses       = ReadNoFence(&g_PrewarmStats.Misses);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+//
+// Background signature pre-verification
+//
+// When enabled, a process-create callback queues each new process's main
+// image to a system worker thread, which verifies it and records the
+// verdict for that (PID, create time). The first open from the process
+// then finds a warm entry instead of hashing the image itself.
+//
+
+#include <ntddk.h>
+
+#define PREWARM_TAG 'wPsK'
+
+// Queue bound; creates beyond it are dropped and verified on demand
+#define PREWARM_MAX_QUEUED 64
+
+// Creates of an already queued image recorded on that item; beyond this
+// they are dropped like creates beyond the queue bound
+#define PREWARM_MAX_FOLDED 16
+
+typedef struct _SIGNATURE_PREWARM_STATS {
+    LONG Queued;        // images handed to the worker
+    LONG Deduplicated;  // creates folded into an already queued image, warmed with its verdict
+    LONG Dropped;       // creates ignored because the queue was full
+    LONG Verified;      // images verified by the worker
+    LONG Hits;          // opens answered by a prewarmed verdict
+    LONG Misses;        // opens that still had to verify synchronously
+} SIGNATURE_PREWARM_STATS, *PSIGNATURE_PREWARM_STATS;
+
+NTSTATUS StartSignaturePrewarm(VOID);
+VOID StopSignaturePrewarm(VOID);
+BOOLEAN IsSignaturePrewarmRunning(VOID);
+
+// Called by VerifyCallerSignature for each PID index lookup
+VOID SignaturePrewarmNoteLookup(BOOLEAN PrewarmHit);
+
+VOID GetSignaturePrewarmStats(PSIGNATURE_PREWARM_STATS Stats);
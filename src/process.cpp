@@ -7,13 +7,9 @@
 
 #include <ntifs.h>
 #include "process.h"
-
-extern "C" NTSTATUS NTAPI ZwQuerySystemInformation(
-    ULONG  SystemInformationClass,
-    PVOID  SystemInformation,
-    ULONG  SystemInformationLength,
-    PULONG ReturnLength
-);
+#include "cpusample.h"
+#include "procsnap.h"
+#include "wire.h"
 
 extern "C" NTSTATUS NTAPI ZwQueryInformationProcess(
     HANDLE ProcessHandle,
@@ -29,7 +25,6 @@ typedef PETHREAD (NTAPI* PFN_PS_GET_NEXT_PROCESS_THREAD)(
     _In_opt_ PETHREAD Thread
 );
 
-#define SystemProcessInformation        5
 #define ProcessBreakOnTermination       29
 
 #ifndef PROCESS_QUERY_LIMITED_INFORMATION
@@ -201,8 +196,35 @@ typedef struct _SYSTEM_PROCESS_INFORMATION_ENTRY {
     ULONG          PageFaultCount;
     SIZE_T         PeakWorkingSetSize;
     SIZE_T         WorkingSetSize;
+    SIZE_T         QuotaPeakPagedPoolUsage;
+    SIZE_T         QuotaPagedPoolUsage;
+    SIZE_T         QuotaPeakNonPagedPoolUsage;
+    SIZE_T         QuotaNonPagedPoolUsage;
+    SIZE_T         PagefileUsage;
+    SIZE_T         PeakPagefileUsage;
+    SIZE_T         PrivatePageCount;
+    LARGE_INTEGER  IoCounters[6];
 } SYSTEM_PROCESS_INFORMATION_ENTRY, *PSYSTEM_PROCESS_INFORMATION_ENTRY;
 
+// 每个进程条目之后紧跟 NumberOfThreads 个线程条目
+typedef struct _SYSTEM_THREAD_INFORMATION_ENTRY {
+    LARGE_INTEGER KernelTime;
+    LARGE_INTEGER UserTime;
+    LARGE_INTEGER CreateTime;
+    ULONG         WaitTime;
+    PVOID         StartAddress;
+    CLIENT_ID     ClientId;
+    KPRIORITY     Priority;
+    LONG          BasePriority;
+    ULONG         ContextSwitches;
+    ULONG         ThreadState;
+    ULONG         WaitReason;
+} SYSTEM_THREAD_INFORMATION_ENTRY, *PSYSTEM_THREAD_INFORMATION_ENTRY;
+
+// x64 布局
+C_ASSERT(sizeof(SYSTEM_PROCESS_INFORMATION_ENTRY) == 0x100);
+C_ASSERT(sizeof(SYSTEM_THREAD_INFORMATION_ENTRY) == 0x50);
+
 static VOID FillProcessKillResult(
     _Out_ PPROCESS_KILL_RESULT Result,
     _In_  ULONG    Method,
@@ -216,84 +238,327 @@ static VOID FillProcessKillResult(
 
 // ========== 进程枚举 ==========
 
-NTSTATUS ProcessEnumerate(PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+// 快照即共用的 SystemProcessInformation 快照（procsnap.h），v1 / v2 均由它格式化；
+// 新鲜期内的连续枚举不再查询系统
+NTSTATUS ProcessCaptureSnapshot(PVOID* Snapshot)
 {
-    *BytesWritten = 0;
-
-    ULONG bufferSize = 0;
-    NTSTATUS status = ZwQuerySystemInformation(SystemProcessInformation, NULL, 0, &bufferSize);
-    if (status != STATUS_INFO_LENGTH_MISMATCH) return status;
+    return ProcessSnapshotAcquire(PROCESS_SNAPSHOT_FRESH_MS, (PPROCESS_SNAPSHOT*)Snapshot);
+}
 
-    bufferSize += 4096;
-    PVOID buffer = ExAllocatePool2(POOL_FLAG_NON_PAGED, bufferSize, 'ksyS');
-    if (!buffer) return STATUS_INSUFFICIENT_RESOURCES;
+VOID ProcessReleaseSnapshot(PVOID Snapshot)
+{
+    ProcessSnapshotRelease((PPROCESS_SNAPSHOT)Snapshot);
+}
 
-    status = ZwQuerySystemInformation(SystemProcessInformation, buffer, bufferSize, &bufferSize);
-    if (!NT_SUCCESS(status)) {
-        ExFreePoolWithTag(buffer, 'ksyS');
-        return status;
-    }
+static PSYSTEM_PROCESS_INFORMATION_ENTRY FirstProcess(PVOID Snapshot)
+{
+    return (PSYSTEM_PROCESS_INFORMATION_ENTRY)((PPROCESS_SNAPSHOT)Snapshot)->Data;
+}
 
+static ULONG CountSnapshotProcesses(PVOID Snapshot)
+{
     ULONG processCount = 0;
-    PSYSTEM_PROCESS_INFORMATION_ENTRY entry = (PSYSTEM_PROCESS_INFORMATION_ENTRY)buffer;
+    PSYSTEM_PROCESS_INFORMATION_ENTRY entry = FirstProcess(Snapshot);
     while (TRUE) {
         processCount++;
         if (entry->NextEntryOffset == 0) break;
         entry = (PSYSTEM_PROCESS_INFORMATION_ENTRY)((PUCHAR)entry + entry->NextEntryOffset);
     }
+    return processCount;
+}
 
-    if (OutputBufferSize < sizeof(PROCESS_LIST_HEADER)) {
-        ExFreePoolWithTag(buffer, 'ksyS');
+static NTSTATUS FormatProcessesV1(PVOID Snapshot, ULONG Fields, PASYNC_PROGRESS Progress,
+    PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+{
+    if (OutputBufferSize < sizeof(PROCESS_LIST_HEADER))
         return STATUS_BUFFER_TOO_SMALL;
+
+    ULONG processCount = CountSnapshotProcesses(Snapshot);
+    ULONG totalSize = sizeof(PROCESS_LIST_HEADER) + processCount * sizeof(PROCESS_INFO);
+    if (OutputBufferSize < totalSize)
+        return WireListOverflow(OutputBuffer, totalSize, BytesWritten);
+
+    PPROCESS_INFO outEntry = (PPROCESS_INFO)((PUCHAR)OutputBuffer + sizeof(PROCESS_LIST_HEADER));
+    PSYSTEM_PROCESS_INFORMATION_ENTRY entry = FirstProcess(Snapshot);
+    for (ULONG index = 0; ; index++) {
+        if (AsyncCheckpoint(Progress, index, processCount))
+            return STATUS_CANCELLED;
+
+        outEntry->ProcessId       = (Fields & PROCESS_FIELD_PROCESS_ID) ? (ULONG)(ULONG_PTR)entry->UniqueProcessId : 0;
+        outEntry->ParentProcessId = (Fields & PROCESS_FIELD_PARENT_ID) ? (ULONG)(ULONG_PTR)entry->InheritedFromUniqueProcessId : 0;
+        outEntry->ThreadCount     = (Fields & PROCESS_FIELD_THREAD_COUNT) ? entry->NumberOfThreads : 0;
+        outEntry->WorkingSetSize  = (Fields & PROCESS_FIELD_WORKING_SET) ? entry->WorkingSetSize : 0;
+
+        // 只清零名字之后的部分，未请求映像名时整段清零
+        USHORT copyLen = 0;
+        if ((Fields & PROCESS_FIELD_IMAGE_NAME) && entry->ImageName.Buffer) {
+            copyLen = min(entry->ImageName.Length,
+                (USHORT)(sizeof(outEntry->ImageName) - sizeof(WCHAR)));
+            RtlCopyMemory(outEntry->ImageName, entry->ImageName.Buffer, copyLen);
+        }
+        RtlZeroMemory((PUCHAR)outEntry->ImageName + copyLen, sizeof(outEntry->ImageName) - copyLen);
+
+        outEntry++;
+
+        if (entry->NextEntryOffset == 0) break;
+        entry = (PSYSTEM_PROCESS_INFORMATION_ENTRY)((PUCHAR)entry + entry->NextEntryOffset);
     }
 
     PPROCESS_LIST_HEADER header = (PPROCESS_LIST_HEADER)OutputBuffer;
-    header->TotalSize = sizeof(PROCESS_LIST_HEADER) + processCount * sizeof(PROCESS_INFO);
+    header->Count     = processCount;
+    header->TotalSize = totalSize;
+    *BytesWritten     = totalSize;
+    return STATUS_SUCCESS;
+}
 
-    ULONG maxEntries = (OutputBufferSize - sizeof(PROCESS_LIST_HEADER)) / sizeof(PROCESS_INFO);
-    PPROCESS_INFO outEntry = (PPROCESS_INFO)((PUCHAR)OutputBuffer + sizeof(PROCESS_LIST_HEADER));
+// v2：映像名不再截断到 260 字符，进入去重字符串表；记录截止到请求的最后一个字段。
+// CPU 占用率由 cpusample.cpp 按快照顺序一次给出，只在请求了该字段时采样。
+// 成功时 Encoder 归调用方释放
+static NTSTATUS EncodeProcessesV2(PVOID Snapshot, ULONG Fields, PASYNC_PROGRESS Progress, PWIRE_ENCODER Encoder)
+{
+    ULONG processCount = CountSnapshotProcesses(Snapshot);
+    PULONG usage = NULL;
+    if (Fields & PROCESS_FIELD_CPU_USAGE) {
+        usage = (PULONG)ExAllocatePool2(POOL_FLAG_PAGED, (SIZE_T)processCount * sizeof(ULONG), CPU_SAMPLE_TAG);
+        if (!usage) return STATUS_INSUFFICIENT_RESOURCES;
+        CpuSampleQuery((PPROCESS_SNAPSHOT)Snapshot, usage, processCount);
+    }
 
-    entry = (PSYSTEM_PROCESS_INFORMATION_ENTRY)buffer;
-    ULONG written = 0;
-    while (TRUE) {
-        if (written >= maxEntries) break;
+    NTSTATUS status = WireEncoderInit(Encoder,
+        WireRecordSize(WireProcessFieldEnds, RTL_NUMBER_OF(WireProcessFieldEnds), Fields),
+        processCount);
+    if (!NT_SUCCESS(status)) {
+        if (usage) ExFreePoolWithTag(usage, CPU_SAMPLE_TAG);
+        return status;
+    }
 
-        outEntry->ProcessId       = (ULONG)(ULONG_PTR)entry->UniqueProcessId;
-        outEntry->ParentProcessId = (ULONG)(ULONG_PTR)entry->InheritedFromUniqueProcessId;
-        outEntry->ThreadCount     = entry->NumberOfThreads;
-        outEntry->WorkingSetSize  = entry->WorkingSetSize;
+    PSYSTEM_PROCESS_INFORMATION_ENTRY entry = FirstProcess(Snapshot);
+    for (ULONG index = 0; ; index++) {
+        if (AsyncCheckpoint(Progress, index, processCount)) {
+            status = STATUS_CANCELLED;
+            break;
+        }
 
-        RtlZeroMemory(outEntry->ImageName, sizeof(outEntry->ImageName));
-        if (entry->ImageName.Buffer && entry->ImageName.Length > 0) {
-            USHORT copyLen = min(entry->ImageName.Length,
-                (USHORT)(sizeof(outEntry->ImageName) - sizeof(WCHAR)));
-            RtlCopyMemory(outEntry->ImageName, entry->ImageName.Buffer, copyLen);
+        PROCESS_RECORD_V2 record = { 0 };
+
+        if (Fields & PROCESS_FIELD_PROCESS_ID)
+            record.ProcessId = (ULONG)(ULONG_PTR)entry->UniqueProcessId;
+        if (Fields & PROCESS_FIELD_PARENT_ID)
+            record.ParentProcessId = (ULONG)(ULONG_PTR)entry->InheritedFromUniqueProcessId;
+        if (Fields & PROCESS_FIELD_THREAD_COUNT)
+            record.ThreadCount = entry->NumberOfThreads;
+        if (Fields & PROCESS_FIELD_WORKING_SET)
+            record.WorkingSetSize = entry->WorkingSetSize;
+        if (Fields & PROCESS_FIELD_CREATE_TIME)
+            record.CreateTime = entry->CreateTime.QuadPart;
+        if (Fields & PROCESS_FIELD_KERNEL_TIME)
+            record.KernelTime = (ULONG64)entry->KernelTime.QuadPart;
+        if (Fields & PROCESS_FIELD_USER_TIME)
+            record.UserTime = (ULONG64)entry->UserTime.QuadPart;
+        if (Fields & PROCESS_FIELD_PEAK_WORKSET)
+            record.PeakWorkingSetSize = entry->PeakWorkingSetSize;
+        if (Fields & PROCESS_FIELD_HANDLE_COUNT)
+            record.HandleCount = entry->HandleCount;
+        if (Fields & PROCESS_FIELD_SESSION_ID)
+            record.SessionId = entry->SessionId;
+        if (usage)
+            record.CpuUsage = usage[index];
+        if (Fields & PROCESS_FIELD_IMAGE_NAME) {
+            status = WireInternString(Encoder, entry->ImageName.Buffer,
+                entry->ImageName.Length / sizeof(WCHAR), &record.ImageName);
+            if (!NT_SUCCESS(status)) break;
         }
 
-        written++;
-        outEntry++;
+        status = WireCommitRecord(Encoder, &record);
+        if (!NT_SUCCESS(status)) break;
 
         if (entry->NextEntryOffset == 0) break;
         entry = (PSYSTEM_PROCESS_INFORMATION_ENTRY)((PUCHAR)entry + entry->NextEntryOffset);
     }
 
-    header->Count = written;
-    *BytesWritten = sizeof(PROCESS_LIST_HEADER) + written * sizeof(PROCESS_INFO);
+    if (!NT_SUCCESS(status))
+        WireEncoderFree(Encoder);
+    if (usage) ExFreePoolWithTag(usage, CPU_SAMPLE_TAG);
+    return status;
+}
 
-    ExFreePoolWithTag(buffer, 'ksyS');
-    return STATUS_SUCCESS;
+static NTSTATUS FormatProcessesV2(PVOID Snapshot, ULONG Fields, PASYNC_PROGRESS Progress,
+    PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+{
+    if (OutputBufferSize < sizeof(ENUM_V2_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    WIRE_ENCODER encoder;
+    NTSTATUS status = EncodeProcessesV2(Snapshot, Fields, Progress, &encoder);
+    if (!NT_SUCCESS(status)) return status;
+
+    status = WireEmit(&encoder, OutputBuffer, OutputBufferSize, BytesWritten);
+    WireEncoderFree(&encoder);
+    return status;
+}
+
+// 线程表取自同一份快照，不逐进程遍历 ETHREAD；StartAddress 为内核记录的起始地址。
+// 线程按进程顺序成组排列。成功时 Encoder 归调用方释放
+static NTSTATUS EncodeThreadsV2(PVOID Snapshot, PASYNC_PROGRESS Progress, PWIRE_ENCODER Encoder)
+{
+    ULONG threadCount = 0;
+    PSYSTEM_PROCESS_INFORMATION_ENTRY entry = FirstProcess(Snapshot);
+    while (TRUE) {
+        threadCount += entry->NumberOfThreads;
+        if (entry->NextEntryOffset == 0) break;
+        entry = (PSYSTEM_PROCESS_INFORMATION_ENTRY)((PUCHAR)entry + entry->NextEntryOffset);
+    }
+
+    NTSTATUS status = WireEncoderInit(Encoder, sizeof(THREAD_RECORD_V2), threadCount);
+    if (!NT_SUCCESS(status)) return status;
+
+    entry = FirstProcess(Snapshot);
+    while (NT_SUCCESS(status)) {
+        PSYSTEM_THREAD_INFORMATION_ENTRY thread = (PSYSTEM_THREAD_INFORMATION_ENTRY)(entry + 1);
+        for (ULONG i = 0; i < entry->NumberOfThreads; i++, thread++) {
+            if (AsyncCheckpoint(Progress, Encoder->Count, threadCount)) {
+                status = STATUS_CANCELLED;
+                break;
+            }
+
+            PTHREAD_RECORD_V2 record = (PTHREAD_RECORD_V2)WireAppendRecord(Encoder);
+            if (!record) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+
+            record->ThreadId        = (ULONG)(ULONG_PTR)thread->ClientId.UniqueThread;
+            record->ProcessId       = (ULONG)(ULONG_PTR)entry->UniqueProcessId;
+            record->Priority        = thread->Priority;
+            record->State           = thread->ThreadState;
+            record->StartAddress    = (ULONG64)(ULONG_PTR)thread->StartAddress;
+            record->WaitReason      = thread->WaitReason;
+            record->ContextSwitches = thread->ContextSwitches;
+            record->KernelTime      = (ULONG64)thread->KernelTime.QuadPart;
+            record->UserTime        = (ULONG64)thread->UserTime.QuadPart;
+        }
+
+        if (entry->NextEntryOffset == 0) break;
+        entry = (PSYSTEM_PROCESS_INFORMATION_ENTRY)((PUCHAR)entry + entry->NextEntryOffset);
+    }
+
+    if (!NT_SUCCESS(status))
+        WireEncoderFree(Encoder);
+    return status;
+}
+
+NTSTATUS ProcessFormatThreads(PVOID Snapshot, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+{
+    *BytesWritten = 0;
+    if (OutputBufferSize < sizeof(ENUM_V2_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    WIRE_ENCODER encoder;
+    NTSTATUS status = EncodeThreadsV2(Snapshot, NULL, &encoder);
+    if (!NT_SUCCESS(status)) return status;
+
+    status = WireEmit(&encoder, OutputBuffer, OutputBufferSize, BytesWritten);
+    WireEncoderFree(&encoder);
+    return status;
+}
+
+// 两张表都先在编码器中完成，总长度确定后再写输出；输出不足时只写头部
+NTSTATUS ProcessFormatWithThreads(
+    PVOID  Snapshot,
+    ULONG  ProcessId,
+    ULONG  Version,
+    ULONG  Fields,
+    PASYNC_PROGRESS Progress,
+    PVOID  OutputBuffer,
+    ULONG  OutputBufferSize,
+    PULONG BytesWritten)
+{
+    UNREFERENCED_PARAMETER(ProcessId);
+    *BytesWritten = 0;
+
+    if (Version != ENUM_VERSION_2)
+        return STATUS_NOT_SUPPORTED;
+    if (OutputBufferSize < sizeof(PROCESS_THREAD_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    WIRE_ENCODER processes, threads;
+    NTSTATUS status = EncodeProcessesV2(Snapshot, Fields, Progress, &processes);
+    if (!NT_SUCCESS(status)) return status;
+
+    status = EncodeThreadsV2(Snapshot, Progress, &threads);
+    if (!NT_SUCCESS(status)) {
+        WireEncoderFree(&processes);
+        return status;
+    }
+
+    ULONG processEnd    = sizeof(PROCESS_THREAD_HEADER) + WireEncodedSize(&processes);
+    ULONG threadOffset  = (processEnd + 7) & ~7UL;
+    ULONG64 totalSize   = (ULONG64)threadOffset + WireEncodedSize(&threads);
+
+    PROCESS_THREAD_HEADER header;
+    RtlZeroMemory(&header, sizeof(header));
+    header.Version = ENUM_VERSION_2;
+
+    if (totalSize > MAXULONG) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    } else if (OutputBufferSize < totalSize) {
+        // 与 WireEmit 相同，只写头部
+        header.TotalSize = (ULONG)totalSize;
+        RtlCopyMemory(OutputBuffer, &header, sizeof(header));
+        *BytesWritten = sizeof(header);
+        status = STATUS_BUFFER_OVERFLOW;
+    } else {
+        // 输出可能直接映射自调用方（METHOD_OUT_DIRECT），各区段只写不回读；对齐补零也要写出
+        PUCHAR out = (PUCHAR)OutputBuffer;
+        ULONG written = 0;
+        status = WireEmit(&processes, out + sizeof(header), processEnd - sizeof(header), &written);
+        if (NT_SUCCESS(status)) {
+            RtlZeroMemory(out + processEnd, threadOffset - processEnd);
+            status = WireEmit(&threads, out + threadOffset, (ULONG)totalSize - threadOffset, &written);
+        }
+        if (NT_SUCCESS(status)) {
+            header.Count         = processes.Count;
+            header.TotalSize     = (ULONG)totalSize;
+            header.ThreadCount   = threads.Count;
+            header.ProcessOffset = sizeof(header);
+            header.ThreadOffset  = threadOffset;
+            RtlCopyMemory(out, &header, sizeof(header));
+            *BytesWritten = header.TotalSize;
+        }
+    }
+
+    WireEncoderFree(&threads);
+    WireEncoderFree(&processes);
+    return status;
+}
+
+NTSTATUS ProcessFormatSnapshot(
+    PVOID  Snapshot,
+    ULONG  ProcessId,
+    ULONG  Version,
+    ULONG  Fields,
+    PASYNC_PROGRESS Progress,
+    PVOID  OutputBuffer,
+    ULONG  OutputBufferSize,
+    PULONG BytesWritten)
+{
+    UNREFERENCED_PARAMETER(ProcessId);
+    *BytesWritten = 0;
+
+    switch (Version) {
+    case ENUM_VERSION_1: return FormatProcessesV1(Snapshot, Fields, Progress, OutputBuffer, OutputBufferSize, BytesWritten);
+    case ENUM_VERSION_2: return FormatProcessesV2(Snapshot, Fields, Progress, OutputBuffer, OutputBufferSize, BytesWritten);
+    default:             return STATUS_NOT_SUPPORTED;
+    }
 }
 
 // ========== 辅助：打开进程句柄 ==========
 
-static NTSTATUS OpenProcessById(ULONG ProcessId, PHANDLE ProcessHandle, ACCESS_MASK Access)
+// 由已引用的 EPROCESS 打开内核句柄，不再按 PID 查找，避免 PID 被复用时打开别的进程
+static NTSTATUS OpenProcessByObject(PEPROCESS Process, PHANDLE ProcessHandle, ACCESS_MASK Access)
 {
-    OBJECT_ATTRIBUTES objAttr;
-    CLIENT_ID clientId;
-    clientId.UniqueProcess = (HANDLE)(ULONG_PTR)ProcessId;
-    clientId.UniqueThread  = NULL;
-    InitializeObjectAttributes(&objAttr, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
-    return ZwOpenProcess(ProcessHandle, Access, &objAttr, &clientId);
+    return ObOpenObjectByPointer(Process, OBJ_KERNEL_HANDLE, NULL, Access,
+        *PsProcessType, KernelMode, ProcessHandle);
 }
 
 // ========== 内核级终止 ==========
@@ -306,14 +571,18 @@ static NTSTATUS OpenProcessById(ULONG ProcessId, PHANDLE ProcessHandle, ACCESS_M
 //         回退到 ZwTerminateProcess。
 //         终止前检查 ProcessBreakOnTermination，为关键进程时拒绝操作。
 //
+// 两条路径都作用于同一个 EPROCESS 引用：ProcessKill 按 PID 查找一次，
+// 批量命令则直接传入已引用的对象。
+//
 
-NTSTATUS ProcessKill(ULONG ProcessId, PPROCESS_KILL_RESULT Result)
+NTSTATUS ProcessKillObject(PEPROCESS Process, PASYNC_PROGRESS Progress, PPROCESS_KILL_RESULT Result)
 {
     if (!Result) return STATUS_INVALID_PARAMETER;
 
     FillProcessKillResult(Result, PROCESS_KILL_METHOD_NONE, STATUS_UNSUCCESSFUL);
 
-    if (ProcessId == 0 || ProcessId == 4) {
+    ULONG processId = (ULONG)(ULONG_PTR)PsGetProcessId(Process);
+    if (processId == 0 || processId == 4) {
         FillProcessKillResult(Result, PROCESS_KILL_METHOD_NONE, STATUS_ACCESS_DENIED);
         return STATUS_ACCESS_DENIED;
     }
@@ -322,17 +591,20 @@ NTSTATUS ProcessKill(ULONG ProcessId, PPROCESS_KILL_RESULT Result)
     PFN_PS_GET_NEXT_PROCESS_THREAD getNextProcessThread = ResolvePsGetNextProcessThread();
 
     if (g_PspTerminateThread && getNextProcessThread) {
-        PEPROCESS pTargetProcess = nullptr;
-        NTSTATUS status = PsLookupProcessByProcessId(
-            (HANDLE)(ULONG_PTR)ProcessId, &pTargetProcess);
-        if (!NT_SUCCESS(status)) {
-            FillProcessKillResult(Result, PROCESS_KILL_METHOD_PSP, status);
-            return status;
-        }
-
         ULONG killedThreads = 0;
-        PETHREAD pThread = getNextProcessThread(pTargetProcess, NULL);
+        ULONG visitedThreads = 0;
+        PETHREAD pThread = getNextProcessThread(Process, NULL);
         while (pThread != NULL) {
+            // 每个线程都是检查点：已终止的线程无法恢复，取消后余下线程保持原样
+            AsyncReportProgress(Progress, visitedThreads++, 0);
+            if (AsyncCancelled(Progress)) {
+                ObDereferenceObject(pThread);
+                DbgPrint("[OpenSysKit] ProcessKill PID=%lu cancelled after %lu threads\n",
+                    processId, killedThreads);
+                FillProcessKillResult(Result, PROCESS_KILL_METHOD_PSP, STATUS_CANCELLED);
+                return STATUS_CANCELLED;
+            }
+
             __try {
                 NTSTATUS killStatus = g_PspTerminateThread(pThread, 0, TRUE);
                 if (NT_SUCCESS(killStatus)) killedThreads++;
@@ -341,27 +613,25 @@ NTSTATUS ProcessKill(ULONG ProcessId, PPROCESS_KILL_RESULT Result)
                 DbgPrint("[OpenSysKit] exception on thread %p: 0x%08X\n",
                     pThread, GetExceptionCode());
             }
-            PETHREAD pNext = getNextProcessThread(pTargetProcess, pThread);
+            PETHREAD pNext = getNextProcessThread(Process, pThread);
             ObDereferenceObject(pThread);
             pThread = pNext;
         }
 
-        ObDereferenceObject(pTargetProcess);
-
         DbgPrint("[OpenSysKit] ProcessKill PID=%lu via PspTerminateThread, killed=%lu\n",
-            ProcessId, killedThreads);
+            processId, killedThreads);
 
         if (killedThreads > 0) {
             FillProcessKillResult(Result, PROCESS_KILL_METHOD_PSP, STATUS_SUCCESS);
             return STATUS_SUCCESS;
         }
 
-        DbgPrint("[OpenSysKit] PID=%lu no threads killed, fallback to ZwTerminateProcess\n", ProcessId);
+        DbgPrint("[OpenSysKit] PID=%lu no threads killed, fallback to ZwTerminateProcess\n", processId);
     }
 
     // 路径 2：ZwTerminateProcess
     HANDLE hProcess = NULL;
-    NTSTATUS status = OpenProcessById(ProcessId, &hProcess,
+    NTSTATUS status = OpenProcessByObject(Process, &hProcess,
         PROCESS_TERMINATE | PROCESS_QUERY_LIMITED_INFORMATION);
     if (!NT_SUCCESS(status)) {
         FillProcessKillResult(Result, PROCESS_KILL_METHOD_ZW, status);
@@ -383,12 +653,33 @@ NTSTATUS ProcessKill(ULONG ProcessId, PPROCESS_KILL_RESULT Result)
     }
 
     status = ZwTerminateProcess(hProcess, STATUS_SUCCESS);
-    DbgPrint("[OpenSysKit] ProcessKill PID=%lu via ZwTerminateProcess: 0x%08X\n", ProcessId, status);
+    DbgPrint("[OpenSysKit] ProcessKill PID=%lu via ZwTerminateProcess: 0x%08X\n", processId, status);
     ZwClose(hProcess);
     FillProcessKillResult(Result, PROCESS_KILL_METHOD_ZW, status);
     return status;
 }
 
+NTSTATUS ProcessKill(ULONG ProcessId, PASYNC_PROGRESS Progress, PPROCESS_KILL_RESULT Result)
+{
+    if (!Result) return STATUS_INVALID_PARAMETER;
+
+    if (ProcessId == 0 || ProcessId == 4) {
+        FillProcessKillResult(Result, PROCESS_KILL_METHOD_NONE, STATUS_ACCESS_DENIED);
+        return STATUS_ACCESS_DENIED;
+    }
+
+    PEPROCESS process = nullptr;
+    NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
+    if (!NT_SUCCESS(status)) {
+        FillProcessKillResult(Result, PROCESS_KILL_METHOD_NONE, status);
+        return status;
+    }
+
+    status = ProcessKillObject(process, Progress, Result);
+    ObDereferenceObject(process);
+    return status;
+}
+
 // ========== 文件删除 ==========
 //
 // 优先使用 FileDispositionInformationEx（Win10 1709+）：
@@ -1,15 +1,32 @@
 #pragma once
 
 #include "driver.h"
+#include "async.h"
 
 // 在 DriverEntry 中调用一次，解析 PspTerminateThreadByPointer 地址
 VOID ResolvePspTerminateThread();
 
-// 进程枚举
-NTSTATUS ProcessEnumerate(PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+// 进程枚举：抓取快照后按 ENUM_VERSION_* 格式化，输出不足返回 STATUS_BUFFER_OVERFLOW（见 enumsnap.h）
+NTSTATUS ProcessCaptureSnapshot(PVOID* Snapshot);
+NTSTATUS ProcessFormatSnapshot(PVOID Snapshot, ULONG ProcessId, ULONG Version, ULONG Fields,
+    PASYNC_PROGRESS Progress, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+VOID ProcessReleaseSnapshot(PVOID Snapshot);
+
+// 同一份快照中的全部线程，v2 编码（THREAD_RECORD_V2）
+NTSTATUS ProcessFormatThreads(PVOID Snapshot, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+
+// IOCTL_ENUM_PROCESSES_THREADS：同一份快照的进程表（按 Fields）与线程表，
+// 只支持 ENUM_VERSION_2（PROCESS_THREAD_HEADER），签名同 ProcessFormatSnapshot，可作为枚举来源的 Format
+NTSTATUS ProcessFormatWithThreads(PVOID Snapshot, ULONG ProcessId, ULONG Version, ULONG Fields,
+    PASYNC_PROGRESS Progress, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
 
 // 内核级终止（优先 PspTerminateThreadByPointer，回退 ZwTerminateProcess）
-NTSTATUS ProcessKill(ULONG ProcessId, PPROCESS_KILL_RESULT Result);
+NTSTATUS ProcessKill(ULONG ProcessId, PASYNC_PROGRESS Progress, PPROCESS_KILL_RESULT Result);
+
+// 同上，作用于调用方已引用的 EPROCESS（批量命令复用同一引用）。
+// Progress 非 NULL 时逐线程检查取消并报告已处理的线程数（总数未知，Total 为 0），
+// 取消后不再终止余下线程，也不回退 ZwTerminateProcess，返回 STATUS_CANCELLED
+NTSTATUS ProcessKillObject(PEPROCESS Process, PASYNC_PROGRESS Progress, PPROCESS_KILL_RESULT Result);
 
 // 内核级删除文件（NT 路径，如 \??\C:\path\to\file.exe）
 NTSTATUS FileDeleteKernel(PCWSTR Path);
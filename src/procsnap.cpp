@@ -0,0 +1,192 @@
+#include "procsnap.h"
+
+extern "C" NTSTATUS NTAPI ZwQuerySystemInformation(
+    ULONG  SystemInformationClass,
+    PVOID  SystemInformation,
+    ULONG  SystemInformationLength,
+    PULONG ReturnLength
+);
+
+#define SystemProcessInformation    5
+
+// 查询之间进程数可能继续增长，给几次机会
+#define PROCESS_SNAPSHOT_MAX_ATTEMPTS   6
+#define PROCESS_SNAPSHOT_MAX_SIZE       (256 * 1024 * 1024)
+
+C_ASSERT(FIELD_OFFSET(PROCESS_SNAPSHOT, Data) % 8 == 0);
+
+// ========== 状态 ==========
+//
+// g_Current 持有一个引用，只在持锁时读写；锁是初始为有信号的同步事件，
+// 在临界区内持有，期间仍在 PASSIVE_LEVEL（抓取要调用 ZwQuerySystemInformation）。
+// 读者释放引用不需要锁：缓存自己的引用还在，计数只有在快照被摘下之后才可能归零。
+//
+
+static KEVENT            g_SnapshotLock;
+static PPROCESS_SNAPSHOT g_Current  = NULL;
+static ULONG             g_Capacity = PROCESS_SNAPSHOT_INITIAL_SIZE;   // 下次分配的大小
+static volatile LONG64   g_Epoch    = 0;
+static BOOLEAN           g_NotifyRegistered = FALSE;
+
+// 临界区挡住普通内核 APC：持锁线程不会在抓取途中被挂起，让其他请求一直排队
+static VOID AcquireSnapshotLock(VOID)
+{
+    KeEnterCriticalRegion();
+    KeWaitForSingleObject(&g_SnapshotLock, Executive, KernelMode, FALSE, NULL);
+}
+
+static VOID ReleaseSnapshotLock(VOID)
+{
+    KeSetEvent(&g_SnapshotLock, IO_NO_INCREMENT, FALSE);
+    KeLeaveCriticalRegion();
+}
+
+static ULONG RoundToPage(ULONG64 Size)
+{
+    return (ULONG)min((Size + 0xFFF) & ~0xFFFULL, (ULONG64)PROCESS_SNAPSHOT_MAX_SIZE);
+}
+
+static VOID FreeSnapshot(PPROCESS_SNAPSHOT Snapshot)
+{
+    ExFreePoolWithTag(Snapshot, PROCESS_SNAPSHOT_TAG);
+}
+
+static PPROCESS_SNAPSHOT AllocateSnapshot(ULONG Capacity)
+{
+    PPROCESS_SNAPSHOT snapshot = (PPROCESS_SNAPSHOT)ExAllocatePool2(
+        POOL_FLAG_PAGED | POOL_FLAG_UNINITIALIZED,
+        FIELD_OFFSET(PROCESS_SNAPSHOT, Data) + (SIZE_T)Capacity, PROCESS_SNAPSHOT_TAG);
+    if (snapshot)
+        snapshot->Capacity = Capacity;
+    return snapshot;
+}
+
+static BOOLEAN IsFresh(const PROCESS_SNAPSHOT* Snapshot, ULONG MaxAgeMs)
+{
+    return MaxAgeMs != 0 &&
+        Snapshot->Epoch == ReadAcquire64(&g_Epoch) &&
+        KeQueryInterruptTime() - Snapshot->CapturedAt <= (ULONG64)MaxAgeMs * 10000;
+}
+
+// 持锁调用。Snapshot 为可原地复用的旧缓冲区（可为 NULL），失败时已释放
+static NTSTATUS CaptureLocked(PPROCESS_SNAPSHOT Snapshot, PPROCESS_SNAPSHOT* Captured)
+{
+    NTSTATUS status = STATUS_INFO_LENGTH_MISMATCH;
+
+    for (ULONG attempt = 0; attempt < PROCESS_SNAPSHOT_MAX_ATTEMPTS; attempt++) {
+        if (!Snapshot) {
+            Snapshot = AllocateSnapshot(g_Capacity);
+            if (!Snapshot)
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        // 先读失效计数：查询期间发生的创建 / 退出会让这份快照立即过期
+        LONG64 epoch = ReadAcquire64(&g_Epoch);
+        ULONG required = 0;
+        status = ZwQuerySystemInformation(SystemProcessInformation,
+            Snapshot->Data, Snapshot->Capacity, &required);
+        if (NT_SUCCESS(status)) {
+            Snapshot->Size       = min(required, Snapshot->Capacity);
+            Snapshot->Epoch      = epoch;
+            Snapshot->CapturedAt = KeQueryInterruptTime();
+            *Captured = Snapshot;
+            return STATUS_SUCCESS;
+        }
+
+        FreeSnapshot(Snapshot);
+        Snapshot = NULL;
+        if (status != STATUS_INFO_LENGTH_MISMATCH)
+            return status;
+
+        // 至少倍增，并为两次查询之间新出现的进程留出 1/8
+        g_Capacity = RoundToPage(max((ULONG64)g_Capacity * 2, (ULONG64)required + required / 8));
+    }
+    return status;
+}
+
+// ========== 公开接口 ==========
+
+// 共用快照不能跨过进程的创建与退出；自己注册，不依赖事件通道是否可用
+static VOID ProcessSnapshotNotify(PEPROCESS Process, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO CreateInfo)
+{
+    UNREFERENCED_PARAMETER(Process);
+    UNREFERENCED_PARAMETER(ProcessId);
+    UNREFERENCED_PARAMETER(CreateInfo);
+
+    ProcessSnapshotInvalidate();
+}
+
+VOID ProcessSnapshotInitialize(VOID)
+{
+    KeInitializeEvent(&g_SnapshotLock, SynchronizationEvent, TRUE);
+
+    NTSTATUS status = PsSetCreateProcessNotifyRoutineEx(ProcessSnapshotNotify, FALSE);
+    g_NotifyRegistered = NT_SUCCESS(status);
+    if (!g_NotifyRegistered)
+        DbgPrint("[OpenSysKit] Process snapshot notify registration failed: 0x%X\n", status);
+}
+
+VOID ProcessSnapshotShutdown(VOID)
+{
+    // 移除会等待正在运行的通知例程
+    if (g_NotifyRegistered) {
+        PsSetCreateProcessNotifyRoutineEx(ProcessSnapshotNotify, TRUE);
+        g_NotifyRegistered = FALSE;
+    }
+
+    if (g_Current) {
+        ProcessSnapshotRelease(g_Current);
+        g_Current = NULL;
+    }
+}
+
+NTSTATUS ProcessSnapshotAcquire(ULONG MaxAgeMs, PPROCESS_SNAPSHOT* Snapshot)
+{
+    *Snapshot = NULL;
+
+    // 并发的请求在锁上排队，轮到时多半能直接取到前一个抓好的快照
+    AcquireSnapshotLock();
+
+    PPROCESS_SNAPSHOT current = g_Current;
+    if (current && IsFresh(current, MaxAgeMs)) {
+        InterlockedIncrement(&current->RefCount);
+        ReleaseSnapshotLock();
+        *Snapshot = current;
+        return STATUS_SUCCESS;
+    }
+
+    // 只剩缓存引用、且没有大到浪费（不足四分之一）时原地复用
+    PPROCESS_SNAPSHOT reuse = NULL;
+    g_Current = NULL;
+    if (current) {
+        if (ReadNoFence(&current->RefCount) == 1 && current->Size >= current->Capacity / 4) {
+            reuse = current;
+        } else {
+            if (current->Size < current->Capacity / 4)
+                g_Capacity = RoundToPage((ULONG64)current->Size + current->Size / 4);
+            ProcessSnapshotRelease(current);
+        }
+    }
+
+    PPROCESS_SNAPSHOT captured = NULL;
+    NTSTATUS status = CaptureLocked(reuse, &captured);
+    if (NT_SUCCESS(status)) {
+        captured->RefCount = 2;     // 缓存与调用方
+        g_Current = captured;
+        *Snapshot = captured;
+    }
+
+    ReleaseSnapshotLock();
+    return status;
+}
+
+VOID ProcessSnapshotRelease(PPROCESS_SNAPSHOT Snapshot)
+{
+    if (InterlockedDecrement(&Snapshot->RefCount) == 0)
+        FreeSnapshot(Snapshot);
+}
+
+VOID ProcessSnapshotInvalidate(VOID)
+{
+    InterlockedIncrement64(&g_Epoch);
+}
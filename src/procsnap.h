@@ -0,0 +1,45 @@
+#pragma once
+
+#include "driver.h"
+
+#define PROCESS_SNAPSHOT_TAG        'nSrP'
+
+// 首次抓取的缓冲区大小，之后按实际所需倍增
+#define PROCESS_SNAPSHOT_INITIAL_SIZE   (256 * 1024)
+
+// 进程枚举、按名查找等读者可接受的快照年龄
+#define PROCESS_SNAPSHOT_FRESH_MS       100
+
+// ========== SystemProcessInformation 快照 ==========
+//
+// 全驱动共用一份带引用计数的快照：新鲜期内（且期间没有进程创建 / 退出）的请求
+// 直接取同一份，不再查询系统。创建 / 退出由本模块自己注册的进程通知报告，
+// 通知注册失败时只按年龄判断。抓取直接以上次的容量查询，只在
+// STATUS_INFO_LENGTH_MISMATCH 时倍增后重试，不做探测调用；
+// 缓冲区在分页池中，只被缓存引用时原地复用，不重新分配。
+//
+// 全部接口只能在 PASSIVE_LEVEL 调用，Data 也只能在 PASSIVE_LEVEL 访问。
+//
+
+typedef struct _PROCESS_SNAPSHOT {
+    volatile LONG RefCount;
+    ULONG   Capacity;       // Data 的字节数
+    ULONG   Size;           // 查询写入的字节数
+    ULONG   Reserved;
+    LONG64  Epoch;          // 抓取前的失效计数
+    ULONG64 CapturedAt;     // KeQueryInterruptTime，100ns
+    UCHAR   Data[1];        // SYSTEM_PROCESS_INFORMATION 链，实际长度 Capacity
+} PROCESS_SNAPSHOT, *PPROCESS_SNAPSHOT;
+
+// 注册进程创建 / 退出通知；注册失败不影响使用
+VOID ProcessSnapshotInitialize(VOID);
+
+// 卸载时调用，此前所有引用须已释放
+VOID ProcessSnapshotShutdown(VOID);
+
+// 取不超过 MaxAgeMs 的快照，0 表示一定重新抓取；用毕 ProcessSnapshotRelease
+NTSTATUS ProcessSnapshotAcquire(ULONG MaxAgeMs, PPROCESS_SNAPSHOT* Snapshot);
+VOID ProcessSnapshotRelease(PPROCESS_SNAPSHOT Snapshot);
+
+// 进程创建 / 退出时调用，之后的 Acquire 不再复用已有快照
+VOID ProcessSnapshotInvalidate(VOID);
@@ -0,0 +1,731 @@
+#include "proctable.h"
+#include "procsnap.h"
+#include "protect.h"
+
+extern "C" NTKERNELAPI ULONG    PsGetProcessSessionId(PEPROCESS Process);
+extern "C" NTKERNELAPI NTSTATUS PsGetProcessExitStatus(PEPROCESS Process);
+
+#define PROCESS_TABLE_INITIAL_ROWS  256
+
+C_ASSERT(PROCESS_TABLE_NAME_CHARS == PROCESS_DELTA_NAME_CHARS);
+
+// SystemProcessInformation 条目中对账用到的前缀
+typedef struct _SYSTEM_PROCESS_ENTRY {
+    ULONG          NextEntryOffset;
+    ULONG          NumberOfThreads;
+    LARGE_INTEGER  Reserved[3];
+    LARGE_INTEGER  CreateTime;
+    LARGE_INTEGER  UserTime;
+    LARGE_INTEGER  KernelTime;
+    UNICODE_STRING ImageName;
+    KPRIORITY      BasePriority;
+    HANDLE         UniqueProcessId;
+    HANDLE         InheritedFromUniqueProcessId;
+    ULONG          HandleCount;
+    ULONG          SessionId;
+    ULONG_PTR      PageDirectoryBase;
+    SIZE_T         PeakVirtualSize;
+    SIZE_T         VirtualSize;
+    ULONG          PageFaultCount;
+    SIZE_T         PeakWorkingSetSize;
+    SIZE_T         WorkingSetSize;
+} SYSTEM_PROCESS_ENTRY, *PSYSTEM_PROCESS_ENTRY;
+
+typedef struct _EXIT_RECORD {
+    ULONG    ProcessId;
+    ULONG    Reserved;
+    LONGLONG CreateTime;
+    ULONG64  Generation;
+} EXIT_RECORD, *PEXIT_RECORD;
+
+// ========== 状态 ==========
+//
+// 行数组与索引都在分页池中，只在持锁时访问；锁是 ERESOURCE，在临界区内持有，
+// 查找、按名查找、复制与统计共享获取，通知、对账、增量计数与保护级别独占获取。索引槽保存行号 + 1，0 为空槽，线性探测，
+// 装载率不超过 1/2；删除时把后继条目前移（不留墓碑），并把最后一行搬进空出的行。
+//
+// 退出历史是一个环，g_ExitTotal 为写入过的记录总数。被覆盖的记录的表代记入
+// g_HistoryFloor：早于它的请求可能漏掉退出，只能取全表。
+//
+
+static ERESOURCE            g_TableLock;
+static PPROCESS_TABLE_ENTRY g_Rows       = NULL;
+static ULONG                g_Count      = 0;
+static ULONG                g_Capacity   = 0;
+static PULONG               g_Index      = NULL;
+static ULONG                g_IndexMask  = 0;       // 槽数 - 1
+static ULONG                g_IndexShift = 32;      // 32 - log2(槽数)
+static ULONG64              g_Generation = 0;
+static PROCESS_TABLE_STATS  g_Stats      = { 0 };
+
+static PEXIT_RECORD         g_Exits        = NULL;
+static ULONG64              g_ExitTotal    = 0;
+static ULONG64              g_HistoryFloor = 0;
+
+static BOOLEAN              g_NotifyRegistered = FALSE;
+static KEVENT               g_ReconcileWake;
+static PKTHREAD             g_ReconcileThread  = NULL;
+static volatile LONG        g_ReconcileStopping = 0;
+
+// 临界区挡住普通内核 APC：持锁线程不会被挂起而让其他读者、写者一直等
+static VOID AcquireTableShared(VOID)
+{
+    KeEnterCriticalRegion();
+    ExAcquireResourceSharedLite(&g_TableLock, TRUE);
+}
+
+static VOID AcquireTableExclusive(VOID)
+{
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(&g_TableLock, TRUE);
+}
+
+static VOID ReleaseTableLock(VOID)
+{
+    ExReleaseResourceLite(&g_TableLock);
+    KeLeaveCriticalRegion();
+}
+
+// ========== 索引 ==========
+
+// PID 是 4 的倍数，去掉低两位后做乘法散列，取高位
+static ULONG HomeSlot(ULONG ProcessId)
+{
+    return (ULONG)(((ProcessId >> 2) * 0x9E3779B1u) >> g_IndexShift);
+}
+
+// PID 所在的槽，不在表中时为探测链末尾的空槽
+static ULONG FindSlot(ULONG ProcessId)
+{
+    ULONG slot = HomeSlot(ProcessId);
+    while (g_Index[slot] && g_Rows[g_Index[slot] - 1].ProcessId != ProcessId)
+        slot = (slot + 1) & g_IndexMask;
+    return slot;
+}
+
+static VOID DeleteSlot(ULONG Slot)
+{
+    ULONG hole = Slot;
+    ULONG next = Slot;
+    for (;;) {
+        next = (next + 1) & g_IndexMask;
+        if (!g_Index[next])
+            break;
+
+        // 起始槽离 next 不比空洞近的条目可以前移填洞
+        ULONG home = HomeSlot(g_Rows[g_Index[next] - 1].ProcessId);
+        if (((next - home) & g_IndexMask) >= ((next - hole) & g_IndexMask)) {
+            g_Index[hole] = g_Index[next];
+            hole = next;
+        }
+    }
+    g_Index[hole] = 0;
+}
+
+static NTSTATUS RebuildIndex(ULONG Slots)
+{
+    PULONG index = (PULONG)ExAllocatePool2(POOL_FLAG_PAGED, (SIZE_T)Slots * sizeof(ULONG), PROCESS_TABLE_TAG);
+    if (!index)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    if (g_Index)
+        ExFreePoolWithTag(g_Index, PROCESS_TABLE_TAG);
+    g_Index     = index;
+    g_IndexMask = Slots - 1;
+    g_IndexShift = 32;
+    for (ULONG slots = Slots; slots > 1; slots >>= 1)
+        g_IndexShift--;
+
+    for (ULONG row = 0; row < g_Count; row++)
+        g_Index[FindSlot(g_Rows[row].ProcessId)] = row + 1;
+    return STATUS_SUCCESS;
+}
+
+// 保证放得下 Count 行；失败时表保持原样
+static NTSTATUS ReserveLocked(ULONG Count)
+{
+    if (Count > g_Capacity) {
+        ULONG capacity = max(g_Capacity * 2, (ULONG)PROCESS_TABLE_INITIAL_ROWS);
+        while (capacity < Count)
+            capacity *= 2;
+
+        PPROCESS_TABLE_ENTRY rows = (PPROCESS_TABLE_ENTRY)ExAllocatePool2(
+            POOL_FLAG_PAGED | POOL_FLAG_UNINITIALIZED,
+            (SIZE_T)capacity * sizeof(PROCESS_TABLE_ENTRY), PROCESS_TABLE_TAG);
+        if (!rows)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        if (g_Rows) {
+            RtlCopyMemory(rows, g_Rows, (SIZE_T)g_Count * sizeof(PROCESS_TABLE_ENTRY));
+            ExFreePoolWithTag(g_Rows, PROCESS_TABLE_TAG);
+        }
+        g_Rows     = rows;
+        g_Capacity = capacity;
+    }
+
+    ULONG slots = g_Index ? g_IndexMask + 1 : PROCESS_TABLE_INITIAL_ROWS * 2;
+    if (!g_Index || Count > slots / 2) {
+        while (Count > slots / 2)
+            slots *= 2;
+        return RebuildIndex(slots);
+    }
+    return STATUS_SUCCESS;
+}
+
+// ========== 行 ==========
+
+static VOID RecordExitLocked(const PROCESS_TABLE_ENTRY* Entry)
+{
+    PEXIT_RECORD record = &g_Exits[g_ExitTotal % PROCESS_TABLE_EXIT_HISTORY];
+    if (g_ExitTotal >= PROCESS_TABLE_EXIT_HISTORY)
+        g_HistoryFloor = record->Generation;
+
+    record->ProcessId  = Entry->ProcessId;
+    record->Reserved   = 0;
+    record->CreateTime = Entry->CreateTime;
+    record->Generation = g_Generation;
+    g_ExitTotal++;
+}
+
+// 已有同 PID 的条目时整条替换；创建时间不同说明漏掉了旧进程的退出，补记一条
+static NTSTATUS UpsertLocked(const PROCESS_TABLE_ENTRY* Entry)
+{
+    ULONG slot = FindSlot(Entry->ProcessId);
+    ULONG64 created = 0;
+    if (!g_Index[slot]) {
+        NTSTATUS status = ReserveLocked(g_Count + 1);
+        if (!NT_SUCCESS(status))
+            return status;
+
+        // 索引可能已重建
+        slot = FindSlot(Entry->ProcessId);
+        g_Index[slot] = ++g_Count;
+    } else {
+        PPROCESS_TABLE_ENTRY old = &g_Rows[g_Index[slot] - 1];
+        if (old->CreateTime == Entry->CreateTime) {
+            created = old->Created;
+        } else {
+            g_Generation++;
+            RecordExitLocked(old);
+        }
+    }
+
+    PPROCESS_TABLE_ENTRY row = &g_Rows[g_Index[slot] - 1];
+    *row = *Entry;
+    row->Generation = ++g_Generation;
+    row->Created    = created ? created : row->Generation;
+    return STATUS_SUCCESS;
+}
+
+static VOID RemoveLocked(ULONG Slot)
+{
+    ULONG row = g_Index[Slot] - 1;
+    g_Generation++;
+    RecordExitLocked(&g_Rows[row]);
+    DeleteSlot(Slot);
+
+    ULONG last = --g_Count;
+    if (row != last) {
+        g_Rows[row] = g_Rows[last];
+        g_Index[FindSlot(g_Rows[row].ProcessId)] = row + 1;
+    }
+}
+
+static BOOLEAN WorkingSetMoved(ULONG64 Reported, ULONG64 Current)
+{
+    ULONG64 delta = (Current > Reported) ? Current - Reported : Reported - Current;
+    return delta >= PROCESS_TABLE_WORKING_SET_STEP && delta >= Reported / 16;
+}
+
+// 快照中同一进程的线程数与工作集；有明显变化时才算一次修改
+static VOID UpdateCountersLocked(PPROCESS_TABLE_ENTRY Row, const SYSTEM_PROCESS_ENTRY* Source)
+{
+    if (Row->ThreadCount == Source->NumberOfThreads &&
+        !WorkingSetMoved(Row->WorkingSetSize, Source->WorkingSetSize))
+        return;
+
+    Row->ThreadCount    = Source->NumberOfThreads;
+    Row->WorkingSetSize = Source->WorkingSetSize;
+    Row->Generation     = ++g_Generation;
+}
+
+// 与快照中的条目是同一个进程时返回该行
+static PPROCESS_TABLE_ENTRY MatchLocked(const SYSTEM_PROCESS_ENTRY* Source)
+{
+    ULONG slot = FindSlot((ULONG)(ULONG_PTR)Source->UniqueProcessId);
+    if (!g_Index[slot])
+        return NULL;
+
+    PPROCESS_TABLE_ENTRY row = &g_Rows[g_Index[slot] - 1];
+    return (row->CreateTime == Source->CreateTime.QuadPart) ? row : NULL;
+}
+
+static VOID SetImageName(PPROCESS_TABLE_ENTRY Entry, PCUNICODE_STRING Name)
+{
+    if (!Name || !Name->Buffer)
+        return;
+
+    // 通知给出完整路径，快照给出基名，统一只留基名
+    ULONG end = Name->Length / sizeof(WCHAR);
+    ULONG start = end;
+    while (start > 0 && Name->Buffer[start - 1] != L'\\')
+        start--;
+
+    ULONG length = end - start;
+    if (length > PROCESS_TABLE_NAME_CHARS) {
+        length = PROCESS_TABLE_NAME_CHARS;
+        Entry->Flags |= PROCESS_TABLE_NAME_TRUNCATED;
+    }
+    RtlCopyMemory(Entry->ImageName, Name->Buffer + start, length * sizeof(WCHAR));
+    Entry->NameLength = (USHORT)length;
+}
+
+static VOID FillEntry(PPROCESS_TABLE_ENTRY Entry, PEPROCESS Process, ULONG ProcessId, ULONG ParentProcessId)
+{
+    RtlZeroMemory(Entry, sizeof(PROCESS_TABLE_ENTRY));
+    Entry->ProcessId       = ProcessId;
+    Entry->ParentProcessId = ParentProcessId;
+    Entry->SessionId       = PsGetProcessSessionId(Process);
+    Entry->CreateTime      = PsGetProcessCreateTimeQuadPart(Process);
+    Entry->ProtectionLevel = ProcessGetProtectLevel(Process);
+}
+
+// ========== 通知 ==========
+
+static VOID ProcessTableNotify(PEPROCESS Process, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO CreateInfo)
+{
+    ULONG pid = (ULONG)(ULONG_PTR)ProcessId;
+
+    if (CreateInfo) {
+        PROCESS_TABLE_ENTRY entry;
+        FillEntry(&entry, Process, pid, (ULONG)(ULONG_PTR)CreateInfo->ParentProcessId);
+        SetImageName(&entry, CreateInfo->ImageFileName);
+
+        // 插入失败只能等下一次对账补上
+        AcquireTableExclusive();
+        if (NT_SUCCESS(UpsertLocked(&entry)))
+            g_Stats.Inserts++;
+        ReleaseTableLock();
+        return;
+    }
+
+    AcquireTableExclusive();
+    ULONG slot = FindSlot(pid);
+    if (g_Index[slot]) {
+        RemoveLocked(slot);
+        g_Stats.Removals++;
+    }
+    ReleaseTableLock();
+}
+
+// ========== 对账 ==========
+//
+// 先记下表代再抓取快照：表代更大的条目在抓取之后才变化，以通知为准，不动它们。
+// 其余条目与快照不符的删去，快照中有而表中没有（或创建时间不同）的进程
+// 在锁外打开后再插入。打开与插入之间进程可能已经退出并报告过通知，
+// 所以插入前在锁内确认它仍在运行：退出状态在通知之前就已设置，
+// 之后的退出通知会等这把锁，再删掉刚插入的条目。
+//
+
+static BOOLEAN AddMissing(PSYSTEM_PROCESS_ENTRY Source)
+{
+    PEPROCESS process = NULL;
+    if (!NT_SUCCESS(PsLookupProcessByProcessId(Source->UniqueProcessId, &process)))
+        return FALSE;
+
+    BOOLEAN added = FALSE;
+    if (PsGetProcessCreateTimeQuadPart(process) == Source->CreateTime.QuadPart) {
+        PROCESS_TABLE_ENTRY entry;
+        FillEntry(&entry, process, (ULONG)(ULONG_PTR)Source->UniqueProcessId,
+            (ULONG)(ULONG_PTR)Source->InheritedFromUniqueProcessId);
+        SetImageName(&entry, &Source->ImageName);
+        entry.ThreadCount    = Source->NumberOfThreads;
+        entry.WorkingSetSize = Source->WorkingSetSize;
+
+        AcquireTableExclusive();
+        if (PsGetProcessExitStatus(process) == STATUS_PENDING) {
+            ULONG slot = FindSlot(entry.ProcessId);
+            if (!g_Index[slot] || g_Rows[g_Index[slot] - 1].CreateTime != entry.CreateTime)
+                added = NT_SUCCESS(UpsertLocked(&entry));
+        }
+        ReleaseTableLock();
+    }
+
+    ObDereferenceObject(process);
+    return added;
+}
+
+NTSTATUS ProcessTableReconcile(VOID)
+{
+    AcquireTableShared();
+    ULONG64 since = g_Generation;
+    ReleaseTableLock();
+
+    PPROCESS_SNAPSHOT snapshot = NULL;
+    NTSTATUS status = ProcessSnapshotAcquire(0, &snapshot);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    ULONG processes = 0;
+    PSYSTEM_PROCESS_ENTRY entry = (PSYSTEM_PROCESS_ENTRY)snapshot->Data;
+    for (;;) {
+        processes++;
+        if (entry->NextEntryOffset == 0) break;
+        entry = (PSYSTEM_PROCESS_ENTRY)((PUCHAR)entry + entry->NextEntryOffset);
+    }
+
+    PSYSTEM_PROCESS_ENTRY* missing = (PSYSTEM_PROCESS_ENTRY*)ExAllocatePool2(
+        POOL_FLAG_PAGED, (SIZE_T)processes * sizeof(PSYSTEM_PROCESS_ENTRY), PROCESS_TABLE_TAG);
+    if (!missing) {
+        ProcessSnapshotRelease(snapshot);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    AcquireTableExclusive();
+
+    PUCHAR seen = (PUCHAR)ExAllocatePool2(POOL_FLAG_PAGED, g_Count ? g_Count : 1, PROCESS_TABLE_TAG);
+    if (!seen) {
+        ReleaseTableLock();
+        ExFreePoolWithTag(missing, PROCESS_TABLE_TAG);
+        ProcessSnapshotRelease(snapshot);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ULONG missingCount = 0;
+    entry = (PSYSTEM_PROCESS_ENTRY)snapshot->Data;
+    for (;;) {
+        ULONG pid = (ULONG)(ULONG_PTR)entry->UniqueProcessId;
+        // PID 0 是 Idle，没有进程对象
+        if (pid != 0) {
+            ULONG slot = FindSlot(pid);
+            PPROCESS_TABLE_ENTRY row = g_Index[slot] ? &g_Rows[g_Index[slot] - 1] : NULL;
+            if (row && row->CreateTime == entry->CreateTime.QuadPart) {
+                seen[row - g_Rows] = 1;
+                if (row->NameLength == 0 && entry->ImageName.Length) {
+                    SetImageName(row, &entry->ImageName);
+                    row->Generation = ++g_Generation;
+                }
+                UpdateCountersLocked(row, entry);
+            } else if (!row || row->Generation <= since) {
+                missing[missingCount++] = entry;
+            }
+        }
+        if (entry->NextEntryOffset == 0) break;
+        entry = (PSYSTEM_PROCESS_ENTRY)((PUCHAR)entry + entry->NextEntryOffset);
+    }
+
+    // 从后往前删：搬进空行的最后一行已经检查过
+    ULONG removed = 0;
+    for (ULONG row = g_Count; row-- > 0; ) {
+        if (!seen[row] && g_Rows[row].Generation <= since) {
+            RemoveLocked(FindSlot(g_Rows[row].ProcessId));
+            removed++;
+        }
+    }
+
+    ExFreePoolWithTag(seen, PROCESS_TABLE_TAG);
+    ReleaseTableLock();
+
+    ULONG added = 0;
+    for (ULONG i = 0; i < missingCount; i++) {
+        if (AddMissing(missing[i]))
+            added++;
+    }
+
+    ExFreePoolWithTag(missing, PROCESS_TABLE_TAG);
+    ProcessSnapshotRelease(snapshot);
+
+    AcquireTableExclusive();
+    g_Stats.Reconciles++;
+    g_Stats.ReconcileAdded   += added;
+    g_Stats.ReconcileRemoved += removed;
+    ReleaseTableLock();
+    return STATUS_SUCCESS;
+}
+
+static VOID ReconcileThread(PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    LARGE_INTEGER interval;
+    interval.QuadPart = -(LONGLONG)PROCESS_TABLE_RECONCILE_MS * 10000;
+
+    for (;;) {
+        KeWaitForSingleObject(&g_ReconcileWake, Executive, KernelMode, FALSE, &interval);
+        if (ReadNoFence(&g_ReconcileStopping)) break;
+
+        NTSTATUS status = ProcessTableReconcile();
+        if (!NT_SUCCESS(status))
+            DbgPrint("[OpenSysKit] Process table reconcile failed: 0x%X\n", status);
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+// ========== 初始化 / 卸载 ==========
+
+static VOID FreeTable(VOID)
+{
+    if (g_Rows)
+        ExFreePoolWithTag(g_Rows, PROCESS_TABLE_TAG);
+    if (g_Index)
+        ExFreePoolWithTag(g_Index, PROCESS_TABLE_TAG);
+    if (g_Exits)
+        ExFreePoolWithTag(g_Exits, PROCESS_TABLE_TAG);
+    g_Rows     = NULL;
+    g_Index    = NULL;
+    g_Exits    = NULL;
+    g_Count    = 0;
+    g_Capacity = 0;
+    ExDeleteResourceLite(&g_TableLock);
+}
+
+NTSTATUS ProcessTableInitialize(VOID)
+{
+    ExInitializeResourceLite(&g_TableLock);
+    KeInitializeEvent(&g_ReconcileWake, SynchronizationEvent, FALSE);
+    g_ReconcileStopping = 0;
+
+    LARGE_INTEGER now;
+    KeQuerySystemTimePrecise(&now);
+    g_Generation   = (ULONG64)now.QuadPart;
+    g_HistoryFloor = g_Generation;
+    g_ExitTotal    = 0;
+
+    g_Exits = (PEXIT_RECORD)ExAllocatePool2(POOL_FLAG_PAGED,
+        PROCESS_TABLE_EXIT_HISTORY * sizeof(EXIT_RECORD), PROCESS_TABLE_TAG);
+    NTSTATUS status = g_Exits ? ReserveLocked(PROCESS_TABLE_INITIAL_ROWS) : STATUS_INSUFFICIENT_RESOURCES;
+    if (!NT_SUCCESS(status)) {
+        FreeTable();
+        return status;
+    }
+
+    // 先注册再填充：两者之间创建的进程两边都会报告，插入按 PID 覆盖
+    status = PsSetCreateProcessNotifyRoutineEx(ProcessTableNotify, FALSE);
+    g_NotifyRegistered = NT_SUCCESS(status);
+    if (!g_NotifyRegistered)
+        DbgPrint("[OpenSysKit] Process table notify registration failed: 0x%X\n", status);
+
+    status = ProcessTableReconcile();
+    if (!NT_SUCCESS(status))
+        DbgPrint("[OpenSysKit] Process table seeding failed: 0x%X\n", status);
+
+    HANDLE threadHandle = NULL;
+    status = PsCreateSystemThread(&threadHandle, THREAD_ALL_ACCESS, NULL,
+        NULL, NULL, ReconcileThread, NULL);
+    if (NT_SUCCESS(status)) {
+        status = ObReferenceObjectByHandle(threadHandle, SYNCHRONIZE, *PsThreadType,
+            KernelMode, (PVOID*)&g_ReconcileThread, NULL);
+        ZwClose(threadHandle);
+        if (!NT_SUCCESS(status)) {
+            // 等不到这个线程：让它自己退出，表只靠通知维护
+            InterlockedExchange(&g_ReconcileStopping, 1);
+            KeSetEvent(&g_ReconcileWake, IO_NO_INCREMENT, FALSE);
+            g_ReconcileThread = NULL;
+        }
+    }
+    if (!NT_SUCCESS(status))
+        DbgPrint("[OpenSysKit] Process table reconcile thread unavailable: 0x%X\n", status);
+
+    DbgPrint("[OpenSysKit] Process table ready (%lu processes)\n", g_Count);
+    return STATUS_SUCCESS;
+}
+
+VOID ProcessTableShutdown(VOID)
+{
+    if (g_ReconcileThread) {
+        InterlockedExchange(&g_ReconcileStopping, 1);
+        KeSetEvent(&g_ReconcileWake, IO_NO_INCREMENT, FALSE);
+        KeWaitForSingleObject(g_ReconcileThread, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(g_ReconcileThread);
+        g_ReconcileThread = NULL;
+    }
+
+    // 移除会等待正在运行的通知例程
+    if (g_NotifyRegistered) {
+        PsSetCreateProcessNotifyRoutineEx(ProcessTableNotify, TRUE);
+        g_NotifyRegistered = FALSE;
+    }
+
+    FreeTable();
+}
+
+// ========== 查询 ==========
+
+NTSTATUS ProcessTableLookup(ULONG ProcessId, PPROCESS_TABLE_ENTRY Entry)
+{
+    NTSTATUS status = STATUS_NOT_FOUND;
+
+    AcquireTableShared();
+    if (g_Index) {
+        ULONG slot = FindSlot(ProcessId);
+        if (g_Index[slot]) {
+            *Entry = g_Rows[g_Index[slot] - 1];
+            status = STATUS_SUCCESS;
+        }
+    }
+    ReleaseTableLock();
+    return status;
+}
+
+NTSTATUS ProcessTableFindByName(
+    PCUNICODE_STRING Name, const ULONG* SessionId, PPROCESS_TABLE_MATCH Matches, ULONG Capacity, PULONG Count)
+{
+    *Count = 0;
+    if (Name->Length / sizeof(WCHAR) > PROCESS_TABLE_NAME_CHARS)
+        return STATUS_INVALID_PARAMETER;
+
+    AcquireTableShared();
+    for (ULONG row = 0; row < g_Count && *Count < Capacity; row++) {
+        const PROCESS_TABLE_ENTRY* entry = &g_Rows[row];
+        if (SessionId && entry->SessionId != *SessionId)
+            continue;
+
+        UNICODE_STRING imageName;
+        imageName.Buffer        = (PWCH)entry->ImageName;
+        imageName.Length        = entry->NameLength * sizeof(WCHAR);
+        imageName.MaximumLength = imageName.Length;
+        if (RtlEqualUnicodeString(&imageName, Name, TRUE)) {
+            PPROCESS_TABLE_MATCH match = &Matches[(*Count)++];
+            match->ProcessId  = entry->ProcessId;
+            match->Reserved   = 0;
+            match->CreateTime = entry->CreateTime;
+        }
+    }
+    ReleaseTableLock();
+    return *Count ? STATUS_SUCCESS : STATUS_NOT_FOUND;
+}
+
+NTSTATUS ProcessTableCopy(
+    PPROCESS_TABLE_ENTRY Entries, ULONG Capacity, PULONG Count, PULONG64 Generation)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    AcquireTableShared();
+    *Count      = g_Count;
+    *Generation = g_Generation;
+    if (g_Count > Capacity)
+        status = STATUS_BUFFER_TOO_SMALL;
+    else if (g_Count)
+        RtlCopyMemory(Entries, g_Rows, (SIZE_T)g_Count * sizeof(PROCESS_TABLE_ENTRY));
+    ReleaseTableLock();
+    return status;
+}
+
+VOID ProcessTableSetProtection(ULONG ProcessId, UCHAR ProtectionLevel)
+{
+    AcquireTableExclusive();
+    if (g_Index) {
+        ULONG slot = FindSlot(ProcessId);
+        if (g_Index[slot]) {
+            PPROCESS_TABLE_ENTRY row = &g_Rows[g_Index[slot] - 1];
+            row->ProtectionLevel = ProtectionLevel;
+            row->Generation      = ++g_Generation;
+        }
+    }
+    ReleaseTableLock();
+}
+
+VOID ProcessTableQueryStats(PPROCESS_TABLE_STATS Stats)
+{
+    AcquireTableShared();
+    *Stats = g_Stats;
+    Stats->Count      = g_Count;
+    Stats->Capacity   = g_Capacity;
+    Stats->Generation = g_Generation;
+    ReleaseTableLock();
+}
+
+// ========== 增量枚举 ==========
+
+static VOID WriteDeltaEntry(PPROCESS_DELTA_ENTRY Out, ULONG Kind, const PROCESS_TABLE_ENTRY* Entry)
+{
+    RtlZeroMemory(Out, sizeof(PROCESS_DELTA_ENTRY));
+    Out->Kind            = Kind;
+    Out->ProcessId       = Entry->ProcessId;
+    Out->ParentProcessId = Entry->ParentProcessId;
+    Out->ThreadCount     = Entry->ThreadCount;
+    Out->SessionId       = Entry->SessionId;
+    Out->NameLength      = Entry->NameLength;
+    Out->ProtectionLevel = Entry->ProtectionLevel;
+    Out->NameTruncated   = (Entry->Flags & PROCESS_TABLE_NAME_TRUNCATED) ? 1 : 0;
+    Out->CreateTime      = Entry->CreateTime;
+    Out->WorkingSetSize  = Entry->WorkingSetSize;
+    RtlCopyMemory(Out->ImageName, Entry->ImageName, Entry->NameLength * sizeof(WCHAR));
+}
+
+NTSTATUS ProcessTableEnumerateDelta(ULONG64 Since, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+{
+    *BytesWritten = 0;
+
+    // 快照在新鲜期内且没有进程创建 / 退出时直接复用，不查询系统
+    PPROCESS_SNAPSHOT snapshot = NULL;
+    NTSTATUS status = ProcessSnapshotAcquire(PROCESS_SNAPSHOT_FRESH_MS, &snapshot);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    AcquireTableExclusive();
+
+    if (!g_Index) {
+        ReleaseTableLock();
+        ProcessSnapshotRelease(snapshot);
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    PSYSTEM_PROCESS_ENTRY source = (PSYSTEM_PROCESS_ENTRY)snapshot->Data;
+    for (;;) {
+        PPROCESS_TABLE_ENTRY row = source->UniqueProcessId ? MatchLocked(source) : NULL;
+        if (row)
+            UpdateCountersLocked(row, source);
+        if (source->NextEntryOffset == 0) break;
+        source = (PSYSTEM_PROCESS_ENTRY)((PUCHAR)source + source->NextEntryOffset);
+    }
+
+    BOOLEAN full = Since == 0 || Since < g_HistoryFloor || Since > g_Generation;
+
+    // 仍在环里的退出记录是 [first, g_ExitTotal)
+    ULONG64 first = (g_ExitTotal > PROCESS_TABLE_EXIT_HISTORY) ? g_ExitTotal - PROCESS_TABLE_EXIT_HISTORY : 0;
+    ULONG count = 0;
+    if (!full) {
+        for (ULONG64 i = first; i < g_ExitTotal; i++)
+            count += g_Exits[i % PROCESS_TABLE_EXIT_HISTORY].Generation > Since;
+    }
+    for (ULONG row = 0; row < g_Count; row++)
+        count += full || g_Rows[row].Generation > Since;
+
+    PPROCESS_DELTA_HEADER header = (PPROCESS_DELTA_HEADER)OutputBuffer;
+    ULONG64 totalSize = sizeof(PROCESS_DELTA_HEADER) + (ULONG64)count * sizeof(PROCESS_DELTA_ENTRY);
+    RtlZeroMemory(header, sizeof(PROCESS_DELTA_HEADER));
+    header->TotalSize  = (ULONG)min(totalSize, (ULONG64)MAXULONG);
+    header->Flags      = full ? PROCESS_DELTA_FULL : 0;
+    header->Generation = g_Generation;
+
+    if (totalSize > OutputBufferSize) {
+        status = STATUS_BUFFER_OVERFLOW;
+        *BytesWritten = sizeof(PROCESS_DELTA_HEADER);
+    } else {
+        PPROCESS_DELTA_ENTRY out = (PPROCESS_DELTA_ENTRY)(header + 1);
+        if (!full) {
+            for (ULONG64 i = first; i < g_ExitTotal; i++) {
+                const EXIT_RECORD* record = &g_Exits[i % PROCESS_TABLE_EXIT_HISTORY];
+                if (record->Generation <= Since) continue;
+                RtlZeroMemory(out, sizeof(PROCESS_DELTA_ENTRY));
+                out->Kind       = PROCESS_DELTA_EXITED;
+                out->ProcessId  = record->ProcessId;
+                out->CreateTime = record->CreateTime;
+                out++;
+            }
+        }
+        for (ULONG row = 0; row < g_Count; row++) {
+            const PROCESS_TABLE_ENTRY* entry = &g_Rows[row];
+            if (!full && entry->Generation <= Since) continue;
+            WriteDeltaEntry(out++, (full || entry->Created > Since) ? PROCESS_DELTA_CREATED : PROCESS_DELTA_CHANGED, entry);
+        }
+        header->Count = count;
+        *BytesWritten = (ULONG)totalSize;
+    }
+
+    ReleaseTableLock();
+    ProcessSnapshotRelease(snapshot);
+    return status;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "driver.h"
+
+#define PROCESS_TABLE_TAG           'bTrP'
+
+// 条目内联保存的映像基名字符数，更长的名字截断
+#define PROCESS_TABLE_NAME_CHARS    64
+
+// 对账周期：用一次 SystemProcessInformation 快照纠正漏掉的创建 / 退出
+#define PROCESS_TABLE_RECONCILE_MS  10000
+
+// 工作集变化至少达到该值、且不小于上次报告值的 1/16 才算变化
+#define PROCESS_TABLE_WORKING_SET_STEP  (1024 * 1024)
+
+// 保留的退出记录数，增量枚举的历史窗口
+#define PROCESS_TABLE_EXIT_HISTORY  1024
+
+// ========== 驱动自有进程表 ==========
+//
+// 条目连续存放在一个数组中，另有一张以 PID 为键的开放寻址散列索引：按 PID 查找
+// 与增删都是 O(1)，全表遍历就是顺序读数组。表由进程创建 / 退出通知增量维护，
+// 加载时用共用快照（procsnap.h）填充，之后由对账线程定期与快照比对，
+// 补上通知注册失败或竞争中漏掉的进程、删去已不存在的进程。
+// 线程数与工作集只来自快照，在对账与增量枚举时更新。
+//
+// 每次插入、删除或有意义的修改都让表代加一，条目记下插入与最后一次变化时的表代，
+// 删除另记入退出历史，增量枚举据此只返回某一代之后的变化。表代从加载时的系统时间
+// （100ns）起算，驱动重新加载后旧的表代一定小于新的起点。
+// 全部接口只能在 PASSIVE_LEVEL 调用。
+//
+
+#define PROCESS_TABLE_NAME_TRUNCATED    0x01
+
+typedef struct _PROCESS_TABLE_ENTRY {
+    ULONG    ProcessId;
+    ULONG    ParentProcessId;
+    ULONG    SessionId;
+    ULONG    ThreadCount;
+    ULONG64  WorkingSetSize;    // 最近一次算作变化时的值
+    LONGLONG CreateTime;
+    ULONG64  Created;           // 插入时的表代
+    ULONG64  Generation;        // 最后一次插入或修改时的表代
+    UCHAR    ProtectionLevel;   // PS_PROTECTION.Level
+    UCHAR    Flags;             // PROCESS_TABLE_NAME_*
+    USHORT   NameLength;        // ImageName 中的字符数，不含结尾 0
+    ULONG    Reserved;
+    WCHAR    ImageName[PROCESS_TABLE_NAME_CHARS];
+} PROCESS_TABLE_ENTRY, *PPROCESS_TABLE_ENTRY;
+
+typedef struct _PROCESS_TABLE_STATS {
+    ULONG   Count;
+    ULONG   Capacity;
+    ULONG64 Generation;
+    ULONG64 Inserts;            // 来自创建通知
+    ULONG64 Removals;           // 来自退出通知
+    ULONG64 Reconciles;
+    ULONG64 ReconcileAdded;     // 对账补上的进程（含加载时的填充）
+    ULONG64 ReconcileRemoved;   // 对账删去的进程
+} PROCESS_TABLE_STATS, *PPROCESS_TABLE_STATS;
+
+// 注册通知、填充并启动对账线程。通知注册失败时只靠对账维护，返回成功
+NTSTATUS ProcessTableInitialize(VOID);
+VOID ProcessTableShutdown(VOID);
+
+NTSTATUS ProcessTableLookup(ULONG ProcessId, PPROCESS_TABLE_ENTRY Entry);
+
+typedef struct _PROCESS_TABLE_MATCH {
+    ULONG    ProcessId;
+    ULONG    Reserved;
+    LONGLONG CreateTime;
+} PROCESS_TABLE_MATCH, *PPROCESS_TABLE_MATCH;
+
+// 按映像基名（不区分大小写）查找，SessionId 为 NULL 时不限会话。按表中顺序写出至多
+// Capacity 个匹配，*Count 为写出的个数；表中条目可能已过时，调用方逐个核对直到找到仍存活的。
+// 没有匹配返回 STATUS_NOT_FOUND，名字长于 PROCESS_TABLE_NAME_CHARS 时返回 STATUS_INVALID_PARAMETER
+NTSTATUS ProcessTableFindByName(
+    PCUNICODE_STRING Name, const ULONG* SessionId, PPROCESS_TABLE_MATCH Matches, ULONG Capacity, PULONG Count);
+
+// 按表中顺序复制至多 Capacity 个条目；*Count 为表中条目总数，
+// 大于 Capacity 时返回 STATUS_BUFFER_TOO_SMALL 且不复制
+NTSTATUS ProcessTableCopy(
+    PPROCESS_TABLE_ENTRY Entries, ULONG Capacity, PULONG Count, PULONG64 Generation);
+
+// 立即与新抓取的快照对账一次
+NTSTATUS ProcessTableReconcile(VOID);
+
+// 本驱动修改了进程的 Protection 之后调用
+VOID ProcessTableSetProtection(ULONG ProcessId, UCHAR ProtectionLevel);
+
+VOID ProcessTableQueryStats(PPROCESS_TABLE_STATS Stats);
+
+// IOCTL_ENUM_PROCESSES_DELTA：先用共用快照更新线程数与工作集，再写出 Since 之后的变化
+// （PROCESS_DELTA_HEADER 加 PROCESS_DELTA_ENTRY[Count]）。Since 不在历史窗口内时写出全表。
+// 放不下时只写头部（TotalSize 为所需字节数）并返回 STATUS_BUFFER_OVERFLOW
+NTSTATUS ProcessTableEnumerateDelta(ULONG64 Since, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
@@ -7,6 +7,7 @@
 
 #include <ntifs.h>
 #include "protect.h"
+#include "proctable.h"
 
 // ========== PPL 相关定义 ==========
 
@@ -96,16 +97,25 @@ static PS_PROTECTION ReadProtection(PEPROCESS process)
     return prot;
 }
 
-static VOID WriteProtection(PEPROCESS process, PS_PROTECTION prot)
+// 可能在持有 ProtectLock 时调用（DISPATCH_LEVEL），不在此更新进程表；
+// 写入成功后由调用方在 PASSIVE_LEVEL 调用 ProcessTableSetProtection
+static BOOLEAN WriteProtection(PEPROCESS process, PS_PROTECTION prot)
 {
-    if (g_ProtectionOffset == 0) return;
+    if (g_ProtectionOffset == 0) return FALSE;
     
     __try {
         *((PUCHAR)process + g_ProtectionOffset) = prot.Level;
     }
     __except (EXCEPTION_EXECUTE_HANDLER) {
         DbgPrint("[OpenSysKit] WriteProtection: 内存访问异常\n");
+        return FALSE;
     }
+    return TRUE;
+}
+
+UCHAR ProcessGetProtectLevel(PEPROCESS Process)
+{
+    return ReadProtection(Process).Level;
 }
 
 // ========== 保护表管理 ==========
@@ -174,50 +184,52 @@ NTSTATUS ProcessProtect(ULONG ProcessId)
     return ProcessSetProtectLevel(ProcessId, PPL_LEVEL_ANTIMALWARE);
 }
 
-// 设置指定的保护等级
-NTSTATUS ProcessSetProtectLevel(ULONG ProcessId, UCHAR ProtectionLevel)
+NTSTATUS ProcessProtectObject(PEPROCESS Process)
 {
-    if (g_ProtectionOffset == 0) return STATUS_UNSUCCESSFUL;
-    if (ProcessId == 0 || ProcessId == 4) return STATUS_ACCESS_DENIED;
+    return ProcessSetProtectLevelObject(Process, PPL_LEVEL_ANTIMALWARE);
+}
 
-    // 在获取锁之前先查找进程
-    PEPROCESS process = nullptr;
-    NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
-    if (!NT_SUCCESS(status)) return status;
+// 恢复保护表中记录的原始值；调用方持有 process 引用
+static NTSTATUS RestoreProtection(PEPROCESS process, ULONG ProcessId)
+{
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_DriverContext.ProtectLock, &oldIrql);
 
-    // 0 视为取消保护（恢复原始值）
-    if (ProtectionLevel == 0) {
-        KIRQL oldIrql;
-        KeAcquireSpinLock(&g_DriverContext.ProtectLock, &oldIrql);
+    UCHAR originalLevel = 0;
+    BOOLEAN found = RemoveProtectedEntry(ProcessId, &originalLevel);
 
-        UCHAR originalLevel = 0;
-        BOOLEAN found = RemoveProtectedEntry(ProcessId, &originalLevel);
+    KeReleaseSpinLock(&g_DriverContext.ProtectLock, oldIrql);
 
-        KeReleaseSpinLock(&g_DriverContext.ProtectLock, oldIrql);
+    if (!found) return STATUS_NOT_FOUND;
 
-        if (found) {
-            PS_PROTECTION prot = { 0 };
-            prot.Level = originalLevel;
-            WriteProtection(process, prot);
-            DbgPrint("[OpenSysKit] ProcessSetProtectLevel PID=%lu: restore 0x%02X\n", ProcessId, originalLevel);
-            status = STATUS_SUCCESS;
-        } else {
-            status = STATUS_NOT_FOUND;
-        }
+    PS_PROTECTION prot = { 0 };
+    prot.Level = originalLevel;
+    if (WriteProtection(process, prot))
+        ProcessTableSetProtection(ProcessId, originalLevel);
+    DbgPrint("[OpenSysKit] ProcessUnprotect PID=%lu: restored 0x%02X\n",
+        ProcessId, originalLevel);
+    return STATUS_SUCCESS;
+}
 
-        ObDereferenceObject(process);
-        return status;
-    }
+// 设置指定的保护等级；0 视为取消保护（恢复原始值）
+NTSTATUS ProcessSetProtectLevelObject(PEPROCESS Process, UCHAR ProtectionLevel)
+{
+    if (g_ProtectionOffset == 0) return STATUS_UNSUCCESSFUL;
+
+    ULONG processId = (ULONG)(ULONG_PTR)PsGetProcessId(Process);
+    if (processId == 0 || processId == 4) return STATUS_ACCESS_DENIED;
+
+    if (ProtectionLevel == 0)
+        return RestoreProtection(Process, processId);
 
     // 验证保护等级的合法性
     if (!IsValidProtectionLevel(ProtectionLevel)) {
         DbgPrint("[OpenSysKit] ProcessSetProtectLevel: 无效的保护等级 0x%02X\n", ProtectionLevel);
-        ObDereferenceObject(process);
         return STATUS_INVALID_PARAMETER;
     }
 
     // 读取原始保护级别（在锁外进行）
-    PS_PROTECTION original = ReadProtection(process);
+    PS_PROTECTION original = ReadProtection(Process);
 
     KIRQL oldIrql;
     KeAcquireSpinLock(&g_DriverContext.ProtectLock, &oldIrql);
@@ -225,7 +237,7 @@ NTSTATUS ProcessSetProtectLevel(ULONG ProcessId, UCHAR ProtectionLevel)
     // 检查是否已保护
     BOOLEAN alreadyProtected = FALSE;
     for (ULONG i = 0; i < g_DriverContext.ProtectedPidCount; i++) {
-        if (g_DriverContext.ProtectedPids[i] == ProcessId) {
+        if (g_DriverContext.ProtectedPids[i] == processId) {
             alreadyProtected = TRUE;
             break;
         }
@@ -233,11 +245,10 @@ NTSTATUS ProcessSetProtectLevel(ULONG ProcessId, UCHAR ProtectionLevel)
 
     if (!alreadyProtected) {
         // 首次保护，加入保护表
-        status = AddProtectedEntry(ProcessId, original.Level);
+        NTSTATUS status = AddProtectedEntry(processId, original.Level);
         if (!NT_SUCCESS(status)) {
-            DbgPrint("[OpenSysKit] ProcessSetProtectLevel PID=%lu: table full\n", ProcessId);
+            DbgPrint("[OpenSysKit] ProcessSetProtectLevel PID=%lu: table full\n", processId);
             KeReleaseSpinLock(&g_DriverContext.ProtectLock, oldIrql);
-            ObDereferenceObject(process);
             return status;
         }
     }
@@ -245,43 +256,48 @@ NTSTATUS ProcessSetProtectLevel(ULONG ProcessId, UCHAR ProtectionLevel)
     // 设置新的保护等级
     PS_PROTECTION ppl = { 0 };
     ppl.Level = ProtectionLevel;
-    WriteProtection(process, ppl);
+    BOOLEAN written = WriteProtection(Process, ppl);
     DbgPrint("[OpenSysKit] ProcessSetProtectLevel PID=%lu: 0x%02X -> 0x%02X\n",
-        ProcessId, original.Level, ppl.Level);
+        processId, original.Level, ppl.Level);
 
     KeReleaseSpinLock(&g_DriverContext.ProtectLock, oldIrql);
-    ObDereferenceObject(process);
+
+    // 进程表锁是 KEVENT，只能在释放自旋锁回到 PASSIVE_LEVEL 之后更新
+    if (written)
+        ProcessTableSetProtection(processId, ppl.Level);
     return STATUS_SUCCESS;
 }
 
-NTSTATUS ProcessUnprotect(ULONG ProcessId)
+NTSTATUS ProcessUnprotectObject(PEPROCESS Process)
 {
     if (g_ProtectionOffset == 0) return STATUS_UNSUCCESSFUL;
+    return RestoreProtection(Process, (ULONG)(ULONG_PTR)PsGetProcessId(Process));
+}
+
+// 按 PID 的入口：在获取锁之前先查找进程
+NTSTATUS ProcessSetProtectLevel(ULONG ProcessId, UCHAR ProtectionLevel)
+{
+    if (g_ProtectionOffset == 0) return STATUS_UNSUCCESSFUL;
+    if (ProcessId == 0 || ProcessId == 4) return STATUS_ACCESS_DENIED;
 
-    // 在获取锁之前先查找进程
     PEPROCESS process = nullptr;
     NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
     if (!NT_SUCCESS(status)) return status;
 
-    KIRQL oldIrql;
-    KeAcquireSpinLock(&g_DriverContext.ProtectLock, &oldIrql);
-
-    UCHAR originalLevel = 0;
-    BOOLEAN found = RemoveProtectedEntry(ProcessId, &originalLevel);
+    status = ProcessSetProtectLevelObject(process, ProtectionLevel);
+    ObDereferenceObject(process);
+    return status;
+}
 
-    KeReleaseSpinLock(&g_DriverContext.ProtectLock, oldIrql);
+NTSTATUS ProcessUnprotect(ULONG ProcessId)
+{
+    if (g_ProtectionOffset == 0) return STATUS_UNSUCCESSFUL;
 
-    if (found) {
-        PS_PROTECTION prot = { 0 };
-        prot.Level = originalLevel;
-        WriteProtection(process, prot);
-        DbgPrint("[OpenSysKit] ProcessUnprotect PID=%lu: restored 0x%02X\n",
-            ProcessId, originalLevel);
-        status = STATUS_SUCCESS;
-    } else {
-        status = STATUS_NOT_FOUND;
-    }
+    PEPROCESS process = nullptr;
+    NTSTATUS status = PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)ProcessId, &process);
+    if (!NT_SUCCESS(status)) return status;
 
+    status = ProcessUnprotectObject(process);
     ObDereferenceObject(process);
     return status;
 }
@@ -306,7 +322,8 @@ VOID CleanupProtect()
         if (NT_SUCCESS(PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)pids[i], &process))) {
             PS_PROTECTION prot = { 0 };
             prot.Level = levels[i];
-            WriteProtection(process, prot);
+            if (WriteProtection(process, prot))
+                ProcessTableSetProtection(pids[i], levels[i]);
             ObDereferenceObject(process);
             DbgPrint("[OpenSysKit] CleanupProtect PID=%lu restored 0x%02X\n", pids[i], levels[i]);
         }
@@ -14,5 +14,13 @@ NTSTATUS ProcessSetProtectLevel(ULONG ProcessId, UCHAR ProtectionLevel);
 // 取消保护，恢复原始 Protection 值
 NTSTATUS ProcessUnprotect(ULONG ProcessId);
 
+// 同上，作用于调用方已引用的 EPROCESS（批量命令复用同一引用）
+NTSTATUS ProcessProtectObject(PEPROCESS Process);
+NTSTATUS ProcessSetProtectLevelObject(PEPROCESS Process, UCHAR ProtectionLevel);
+NTSTATUS ProcessUnprotectObject(PEPROCESS Process);
+
+// 读取进程当前的 Protection.Level，偏移未找到时为 0
+UCHAR ProcessGetProtectLevel(PEPROCESS Process);
+
 // 驱动卸载时调用，恢复所有被保护进程
 VOID CleanupProtect();
\ No newline at end of file
@@ -0,0 +1,437 @@
+//
+// SHA-256 / SHA-1 for Authenticode verification
+//
+// Scalar block functions are the original portable implementation.
+// On x64 CPUs with the SHA extensions the SHA-NI block functions are used
+// instead; they only touch XMM registers, which x64 kernel code may use
+// without saving extended processor state (unlike YMM/AVX).
+//
+
+#include "osk_types.h"
+#include "sha.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define SHA_HAVE_SHANI 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHA_TARGET_SHANI
+#else
+#include <cpuid.h>
+// GCC/Clang only emit SHA/SSE4.1 instructions inside functions that ask for them
+#define SHA_TARGET_SHANI __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+typedef void (*PFN_SHA_BLOCKS)(ULONG* state, const UCHAR* data, SIZE_T blocks);
+
+#define ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+#define ROR(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+static const ULONG K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// ================================================================
+// Scalar block functions
+// ================================================================
+
+static void SHA256TransformScalar(ULONG state[8], const UCHAR buffer[64])
+{
+    ULONG a, b, c, d, e, f, g, h, t1, t2;
+    ULONG W[64];
+
+    for (ULONG i = 0; i < 16; i++) {
+        W[i] = ((ULONG)buffer[i * 4] << 24) |
+               ((ULONG)buffer[i * 4 + 1] << 16) |
+               ((ULONG)buffer[i * 4 + 2] << 8) |
+               ((ULONG)buffer[i * 4 + 3]);
+    }
+    for (ULONG i = 16; i < 64; i++) {
+        ULONG s0 = ROR(W[i-15], 7) ^ ROR(W[i-15], 18) ^ (W[i-15] >> 3);
+        ULONG s1 = ROR(W[i-2], 17) ^ ROR(W[i-2], 19) ^ (W[i-2] >> 10);
+        W[i] = W[i-16] + s0 + W[i-7] + s1;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+    for (ULONG i = 0; i < 64; i++) {
+        ULONG S1 = ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25);
+        ULONG ch = (e & f) ^ ((~e) & g);
+        t1 = h + S1 + ch + K256[i] + W[i];
+        ULONG S0 = ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22);
+        ULONG maj = (a & b) ^ (a & c) ^ (b & c);
+        t2 = S0 + maj;
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void SHA256BlocksScalar(ULONG* state, const UCHAR* data, SIZE_T blocks)
+{
+    for (SIZE_T i = 0; i < blocks; i++)
+        SHA256TransformScalar(state, data + i * 64);
+}
+
+static void SHA1TransformScalar(ULONG state[5], const UCHAR buffer[64])
+{
+    ULONG a, b, c, d, e;
+    ULONG block[80];
+
+    for (ULONG i = 0; i < 16; i++) {
+        block[i] = ((ULONG)buffer[i * 4] << 24) |
+                   ((ULONG)buffer[i * 4 + 1] << 16) |
+                   ((ULONG)buffer[i * 4 + 2] << 8) |
+                   ((ULONG)buffer[i * 4 + 3]);
+    }
+    for (ULONG i = 16; i < 80; i++) {
+        block[i] = ROL(block[i-3] ^ block[i-8] ^ block[i-14] ^ block[i-16], 1);
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3]; e = state[4];
+
+    for (ULONG i = 0; i < 20; i++) {
+        ULONG temp = ROL(a, 5) + ((b & c) | ((~b) & d)) + e + block[i] + 0x5A827999;
+        e = d; d = c; c = ROL(b, 30); b = a; a = temp;
+    }
+    for (ULONG i = 20; i < 40; i++) {
+        ULONG temp = ROL(a, 5) + (b ^ c ^ d) + e + block[i] + 0x6ED9EBA1;
+        e = d; d = c; c = ROL(b, 30); b = a; a = temp;
+    }
+    for (ULONG i = 40; i < 60; i++) {
+        ULONG temp = ROL(a, 5) + ((b & c) | (b & d) | (c & d)) + e + block[i] + 0x8F1BBCDC;
+        e = d; d = c; c = ROL(b, 30); b = a; a = temp;
+    }
+    for (ULONG i = 60; i < 80; i++) {
+        ULONG temp = ROL(a, 5) + (b ^ c ^ d) + e + block[i] + 0xCA62C1D6;
+        e = d; d = c; c = ROL(b, 30); b = a; a = temp;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+}
+
+static void SHA1BlocksScalar(ULONG* state, const UCHAR* data, SIZE_T blocks)
+{
+    for (SIZE_T i = 0; i < blocks; i++)
+        SHA1TransformScalar(state, data + i * 64);
+}
+
+// ================================================================
+// SHA-NI block functions
+// ================================================================
+
+#ifdef SHA_HAVE_SHANI
+
+//
+// SHA-256: 16 groups of 4 rounds. msg[g % 4] holds the schedule words for
+// group g; sha256msg1/msg2 extend the schedule three groups ahead.
+//
+SHA_TARGET_SHANI
+static void SHA256BlocksShaNi(ULONG* state, const UCHAR* data, SIZE_T blocks)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp    = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+
+    tmp    = _mm_shuffle_epi32(tmp, 0xB1);          // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);       // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);   // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);    // CDGH
+
+    for (SIZE_T n = 0; n < blocks; n++, data += 64) {
+        __m128i abefSave = state0;
+        __m128i cdghSave = state1;
+        __m128i msg[4];
+
+        for (ULONG g = 0; g < 16; g++) {
+            if (g < 4) {
+                msg[g] = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + g * 16)), byteSwap);
+            }
+
+            __m128i wk = _mm_add_epi32(msg[g & 3],
+                _mm_loadu_si128((const __m128i*)&K256[g * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+
+            if (g >= 3 && g < 15) {
+                __m128i next = _mm_add_epi32(msg[(g + 1) & 3],
+                    _mm_alignr_epi8(msg[g & 3], msg[(g - 1) & 3], 4));
+                msg[(g + 1) & 3] = _mm_sha256msg2_epu32(next, msg[g & 3]);
+            }
+
+            wk = _mm_shuffle_epi32(wk, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+
+            if (g >= 1 && g <= 12)
+                msg[(g - 1) & 3] = _mm_sha256msg1_epu32(msg[(g - 1) & 3], msg[g & 3]);
+        }
+
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp    = _mm_shuffle_epi32(state0, 0x1B);       // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);       // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);    // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);       // ABEF
+
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+// sha1rnds4 takes the round function as an immediate
+SHA_TARGET_SHANI
+static __forceinline __m128i Sha1Rounds4(__m128i abcd, __m128i e, ULONG group)
+{
+    switch (group / 5) {
+    case 0:  return _mm_sha1rnds4_epu32(abcd, e, 0);
+    case 1:  return _mm_sha1rnds4_epu32(abcd, e, 1);
+    case 2:  return _mm_sha1rnds4_epu32(abcd, e, 2);
+    default: return _mm_sha1rnds4_epu32(abcd, e, 3);
+    }
+}
+
+//
+// SHA-1: 20 groups of 4 rounds, E alternates between two registers.
+//
+SHA_TARGET_SHANI
+static void SHA1BlocksShaNi(ULONG* state, const UCHAR* data, SIZE_T blocks)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+    __m128i e0   = _mm_set_epi32((int)state[4], 0, 0, 0);
+    __m128i e1;
+
+    for (SIZE_T n = 0; n < blocks; n++, data += 64) {
+        __m128i abcdSave = abcd;
+        __m128i e0Save   = e0;
+        __m128i msg[4];
+
+        for (ULONG g = 0; g < 20; g++) {
+            if (g < 4) {
+                msg[g] = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + g * 16)), byteSwap);
+            }
+
+            if (g == 0) {
+                e0 = _mm_add_epi32(e0, msg[0]);
+                e1 = abcd;
+                abcd = Sha1Rounds4(abcd, e0, g);
+            } else if (g & 1) {
+                e1 = _mm_sha1nexte_epu32(e1, msg[g & 3]);
+                e0 = abcd;
+                abcd = Sha1Rounds4(abcd, e1, g);
+            } else {
+                e0 = _mm_sha1nexte_epu32(e0, msg[g & 3]);
+                e1 = abcd;
+                abcd = Sha1Rounds4(abcd, e0, g);
+            }
+
+            if (g >= 3 && g <= 18)
+                msg[(g + 1) & 3] = _mm_sha1msg2_epu32(msg[(g + 1) & 3], msg[g & 3]);
+            if (g >= 1 && g <= 16)
+                msg[(g - 1) & 3] = _mm_sha1msg1_epu32(msg[(g - 1) & 3], msg[g & 3]);
+            if (g >= 2 && g <= 17)
+                msg[(g - 2) & 3] = _mm_xor_si128(msg[(g - 2) & 3], msg[g & 3]);
+        }
+
+        e0   = _mm_sha1nexte_epu32(e0, e0Save);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1B);
+    _mm_storeu_si128((__m128i*)state, abcd);
+    state[4] = (ULONG)_mm_extract_epi32(e0, 3);
+}
+
+#endif // SHA_HAVE_SHANI
+
+// ================================================================
+// Engine selection
+// ================================================================
+
+static PFN_SHA_BLOCKS g_Sha256Blocks = SHA256BlocksScalar;
+static PFN_SHA_BLOCKS g_Sha1Blocks   = SHA1BlocksScalar;
+static SHA_ENGINE     g_ShaEngine    = ShaEngineScalar;
+
+#ifdef SHA_HAVE_SHANI
+static void CpuId(int regs[4], int leaf, int subleaf)
+{
+#if defined(_MSC_VER)
+    __cpuidex(regs, leaf, subleaf);
+#else
+    unsigned int a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    regs[0] = (int)a; regs[1] = (int)b; regs[2] = (int)c; regs[3] = (int)d;
+#endif
+}
+#endif
+
+static BOOLEAN CpuHasShaNi(VOID)
+{
+#ifdef SHA_HAVE_SHANI
+    int regs[4];
+
+    CpuId(regs, 0, 0);
+    if (regs[0] < 7) return FALSE;
+
+    // SSSE3 (pshufb/palignr) + SSE4.1 (pblendw/pextrd)
+    CpuId(regs, 1, 0);
+    if (!(regs[2] & (1 << 9)) || !(regs[2] & (1 << 19))) return FALSE;
+
+    // SHA extensions: CPUID.(EAX=7,ECX=0):EBX[29]
+    CpuId(regs, 7, 0);
+    return (regs[1] & (1 << 29)) ? TRUE : FALSE;
+#else
+    return FALSE;
+#endif
+}
+
+BOOLEAN ShaSetEngine(SHA_ENGINE Engine)
+{
+    switch (Engine) {
+    case ShaEngineScalar:
+        g_Sha256Blocks = SHA256BlocksScalar;
+        g_Sha1Blocks   = SHA1BlocksScalar;
+        break;
+#ifdef SHA_HAVE_SHANI
+    case ShaEngineShaNi:
+        if (!CpuHasShaNi()) return FALSE;
+        g_Sha256Blocks = SHA256BlocksShaNi;
+        g_Sha1Blocks   = SHA1BlocksShaNi;
+        break;
+#endif
+    default:
+        return FALSE;
+    }
+    g_ShaEngine = Engine;
+    return TRUE;
+}
+
+SHA_ENGINE ShaSelectEngine(VOID)
+{
+    if (!ShaSetEngine(ShaEngineShaNi))
+        ShaSetEngine(ShaEngineScalar);
+    return g_ShaEngine;
+}
+
+SHA_ENGINE ShaGetEngine(VOID)
+{
+    return g_ShaEngine;
+}
+
+// ================================================================
+// Streaming front end (shared by both hashes)
+// ================================================================
+
+static void ShaUpdate(ULONG* state, UCHAR buffer[64], ULONG64* count,
+    PFN_SHA_BLOCKS blockFn, const UCHAR* data, ULONG len)
+{
+    ULONG bufferIndex = (ULONG)(*count & 63);
+    *count += len;
+
+    if (bufferIndex) {
+        ULONG fill = 64 - bufferIndex;
+        if (len < fill) {
+            RtlCopyMemory(&buffer[bufferIndex], data, len);
+            return;
+        }
+        RtlCopyMemory(&buffer[bufferIndex], data, fill);
+        blockFn(state, buffer, 1);
+        data += fill;
+        len  -= fill;
+    }
+
+    // Hand all whole blocks to the engine in one call
+    ULONG blocks = len / 64;
+    if (blocks) {
+        blockFn(state, data, blocks);
+        data += blocks * 64;
+        len  -= blocks * 64;
+    }
+
+    if (len) RtlCopyMemory(buffer, data, len);
+}
+
+static void ShaPad(ULONG* state, UCHAR buffer[64], ULONG64* count, PFN_SHA_BLOCKS blockFn)
+{
+    static const UCHAR padding[64] = { 0x80 };
+    UCHAR lengthBytes[8];
+    ULONG64 bitCount = *count * 8;
+
+    for (ULONG i = 0; i < 8; i++) {
+        lengthBytes[i] = (UCHAR)((bitCount >> ((7 - i) * 8)) & 0xFF);
+    }
+
+    ULONG index = (ULONG)(*count & 63);
+    ULONG padLen = (index < 56) ? (56 - index) : (120 - index);
+    ShaUpdate(state, buffer, count, blockFn, padding, padLen);
+    ShaUpdate(state, buffer, count, blockFn, lengthBytes, 8);
+}
+
+// ================================================================
+// SHA256
+// ================================================================
+
+void SHA256Init(SHA256_CTX* ctx)
+{
+    ctx->state[0] = 0x6a09e667; ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372; ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f; ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab; ctx->state[7] = 0x5be0cd19;
+    ctx->count = 0;
+}
+
+void SHA256Update(SHA256_CTX* ctx, const UCHAR* data, ULONG len)
+{
+    ShaUpdate(ctx->state, ctx->buffer, &ctx->count, g_Sha256Blocks, data, len);
+}
+
+void SHA256Final(UCHAR digest[32], SHA256_CTX* ctx)
+{
+    ShaPad(ctx->state, ctx->buffer, &ctx->count, g_Sha256Blocks);
+
+    for (ULONG i = 0; i < 32; i++) {
+        digest[i] = (UCHAR)((ctx->state[i >> 2] >> ((3 - (i & 3)) * 8)) & 0xFF);
+    }
+}
+
+// ================================================================
+// SHA1
+// ================================================================
+
+void SHA1Init(SHA1_CTX* ctx)
+{
+    ctx->state[0] = 0x67452301; ctx->state[1] = 0xEFCDAB89;
+    ctx->state[2] = 0x98BADCFE; ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xC3D2E1F0;
+    ctx->count = 0;
+}
+
+void SHA1Update(SHA1_CTX* ctx, const UCHAR* data, ULONG len)
+{
+    ShaUpdate(ctx->state, ctx->buffer, &ctx->count, g_Sha1Blocks, data, len);
+}
+
+void SHA1Final(UCHAR digest[20], SHA1_CTX* ctx)
+{
+    ShaPad(ctx->state, ctx->buffer, &ctx->count, g_Sha1Blocks);
+
+    for (ULONG i = 0; i < 20; i++) {
+        digest[i] = (UCHAR)((ctx->state[i >> 2] >> ((3 - (i & 3)) * 8)) & 0xFF);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+//
+// SHA-256 / SHA-1 for Authenticode verification
+//
+// The block function behind SHA256Update / SHA1Update is picked once at
+// start-up from CPUID: SHA-NI when available, otherwise the portable
+// scalar implementation.
+//
+
+#include "osk_types.h"
+
+typedef enum _SHA_ENGINE {
+    ShaEngineScalar = 0,
+    ShaEngineShaNi
+} SHA_ENGINE;
+
+struct SHA256_CTX {
+    ULONG state[8];
+    ULONG64 count;
+    UCHAR buffer[64];
+};
+
+struct SHA1_CTX {
+    ULONG state[5];
+    ULONG64 count;
+    UCHAR buffer[64];
+};
+
+// Detect CPU features and select the block functions. Call once before use;
+// until then the scalar engine is used.
+SHA_ENGINE ShaSelectEngine(VOID);
+SHA_ENGINE ShaGetEngine(VOID);
+
+// Forces one engine, e.g. to test both on the same CPU. Returns FALSE and
+// leaves the current engine in place if this CPU cannot run it. Not safe
+// while other threads are hashing.
+BOOLEAN ShaSetEngine(SHA_ENGINE Engine);
+
+void SHA256Init(SHA256_CTX* ctx);
+void SHA256Update(SHA256_CTX* ctx, const UCHAR* data, ULONG len);
+void SHA256Final(UCHAR digest[32], SHA256_CTX* ctx);
+
+void SHA1Init(SHA1_CTX* ctx);
+void SHA1Update(SHA1_CTX* ctx, const UCHAR* data, ULONG len);
+void SHA1Final(UCHAR digest[20], SHA1_CTX* ctx);
@@ -0,0 +1,330 @@
+#include "shared.h"
+#include "cpusample.h"
+#include "kernelmod.h"
+#include "process.h"
+#include "procsnap.h"
+
+// ========== 状态 ==========
+//
+// section 句柄为内核句柄，映射客户端视图时在请求者进程上下文中使用；
+// 发布只经系统视图 g_SharedHeader。发布锁是一个初始为有信号的同步事件，
+// 在临界区内持有，期间仍在 PASSIVE_LEVEL，可以调用 ZwQuerySystemInformation。
+//
+
+static HANDLE                  g_SharedSection = NULL;
+static PVOID                   g_SharedObject  = NULL;
+static PSHARED_SECTION_HEADER  g_SharedHeader  = NULL;
+
+static KEVENT         g_SharedLock;
+static KEVENT         g_SharedWake;         // 只用于停止刷新线程
+static PKTHREAD       g_SharedThread = NULL;
+static volatile LONG  g_SharedStopping = 0;
+static volatile LONG  g_SharedMappings = 0; // 客户端视图数
+
+// 临界区挡住普通内核 APC：发布途中持锁线程不会被挂起，让刷新请求一直等
+static VOID AcquirePublishLock(VOID)
+{
+    KeEnterCriticalRegion();
+    KeWaitForSingleObject(&g_SharedLock, Executive, KernelMode, FALSE, NULL);
+}
+
+static VOID ReleasePublishLock(VOID)
+{
+    KeSetEvent(&g_SharedLock, IO_NO_INCREMENT, FALSE);
+    KeLeaveCriticalRegion();
+}
+
+// ========== 发布 ==========
+//
+// 两份快照在 bank 变为奇数之前抓取，写入期间只做编码，奇数窗口尽量短。
+// 三张表在 bank 内依次紧密排列，各自 8 字节对齐。
+//
+
+typedef NTSTATUS (*SHARED_FORMAT)(PVOID Snapshot, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+
+static NTSTATUS FormatProcesses(PVOID Snapshot, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+{
+    return ProcessFormatSnapshot(Snapshot, 0, ENUM_VERSION_2, PROCESS_FIELDS_ALL, NULL,
+        OutputBuffer, OutputBufferSize, BytesWritten);
+}
+
+static NTSTATUS FormatKernelModules(PVOID Snapshot, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+{
+    return KernelModuleFormatSnapshot(Snapshot, 0, ENUM_VERSION_2, MODULE_FIELDS_ALL, NULL,
+        OutputBuffer, OutputBufferSize, BytesWritten);
+}
+
+static VOID PublishTable(PSHARED_BANK Bank, ULONG Table, NTSTATUS Status, PVOID Snapshot,
+    SHARED_FORMAT Format, PULONG Offset, ULONG End)
+{
+    PSHARED_TABLE table = &Bank->Tables[Table];
+    PUCHAR output = (PUCHAR)g_SharedHeader + *Offset;
+    ULONG written = 0;
+
+    if (NT_SUCCESS(Status))
+        Status = Format(Snapshot, output, End - *Offset, &written);
+
+    table->Offset   = 0;
+    table->Size     = 0;
+    table->Status   = Status;
+    table->Required = 0;
+
+    if (NT_SUCCESS(Status)) {
+        table->Offset = *Offset;
+        table->Size   = written;
+        *Offset += (written + 7) & ~7UL;
+    } else if (Status == STATUS_BUFFER_OVERFLOW) {
+        // 编码器只写了头部，TotalSize 即所需大小
+        table->Required = ((PENUM_V2_HEADER)output)->TotalSize;
+    }
+}
+
+static VOID PublishLocked(VOID)
+{
+    PSHARED_SECTION_HEADER header = g_SharedHeader;
+    ULONG64 start = KeQueryInterruptTime();
+
+    // 立即刷新要求在请求之后抓取，不取共用快照的缓存；抓到的快照随后也供枚举请求复用
+    PPROCESS_SNAPSHOT processes = NULL;
+    PVOID modules = NULL;
+    NTSTATUS processStatus = ProcessSnapshotAcquire(0, &processes);
+    NTSTATUS moduleStatus  = KernelModuleCaptureSnapshot(&modules);
+
+    // CPU 采样在奇数窗口之外轮换，编码时只查表
+    if (NT_SUCCESS(processStatus))
+        CpuSampleUpdate(processes);
+
+    // 只有持锁者写 Generation
+    LONG64 generation = header->Generation + 1;
+    ULONG index = (ULONG)(generation & 1);
+    PSHARED_BANK bank = &header->Banks[index];
+    ULONG offset = header->BankOffset[index];
+    ULONG end    = offset + header->BankSize;
+
+    InterlockedIncrement64(&bank->Sequence);
+
+    PublishTable(bank, SHARED_TABLE_PROCESSES, processStatus, processes, FormatProcesses, &offset, end);
+    PublishTable(bank, SHARED_TABLE_THREADS, processStatus, processes, ProcessFormatThreads, &offset, end);
+    PublishTable(bank, SHARED_TABLE_KERNEL_MODULES, moduleStatus, modules, FormatKernelModules, &offset, end);
+
+    LARGE_INTEGER now;
+    KeQuerySystemTimePrecise(&now);
+    bank->Generation          = (ULONG64)generation;
+    bank->Timestamp           = (ULONG64)now.QuadPart;
+    bank->CaptureMicroseconds = (ULONG)((KeQueryInterruptTime() - start) / 10);
+
+    InterlockedIncrement64(&bank->Sequence);
+    WriteRelease64(&header->Generation, generation);
+
+    if (processes) ProcessSnapshotRelease(processes);
+    if (modules)   KernelModuleReleaseSnapshot(modules);
+}
+
+NTSTATUS SharedRefresh(PULONG64 Generation)
+{
+    if (!g_SharedHeader)
+        return STATUS_DEVICE_NOT_READY;
+
+    // 进锁之前读到第 seen 代：第 seen + 1 代可能在请求到达前就已开始抓取，
+    // 第 seen + 2 代一定是在它发布之后才开始的
+    LONG64 seen = ReadAcquire64(&g_SharedHeader->Generation);
+
+    AcquirePublishLock();
+    if (g_SharedHeader->Generation < seen + 2)
+        PublishLocked();
+    *Generation = (ULONG64)g_SharedHeader->Generation;
+    ReleasePublishLock();
+    return STATUS_SUCCESS;
+}
+
+// ========== 刷新线程 ==========
+
+static VOID SharedRefreshThread(PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    LARGE_INTEGER interval;
+    interval.QuadPart = -(LONGLONG)SHARED_REFRESH_INTERVAL_MS * 10000;
+
+    for (;;) {
+        KeWaitForSingleObject(&g_SharedWake, Executive, KernelMode, FALSE, &interval);
+        if (ReadNoFence(&g_SharedStopping)) break;
+        if (ReadNoFence(&g_SharedMappings) == 0) continue;
+
+        AcquirePublishLock();
+        PublishLocked();
+        ReleasePublishLock();
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+// ========== 初始化 / 卸载 ==========
+
+static VOID ReleaseSection(VOID)
+{
+    if (g_SharedHeader) {
+        MmUnmapViewInSystemSpace(g_SharedHeader);
+        g_SharedHeader = NULL;
+    }
+    if (g_SharedObject) {
+        ObDereferenceObject(g_SharedObject);
+        g_SharedObject = NULL;
+    }
+    if (g_SharedSection) {
+        ZwClose(g_SharedSection);
+        g_SharedSection = NULL;
+    }
+}
+
+static NTSTATUS CreateSection(VOID)
+{
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+    LARGE_INTEGER size;
+    size.QuadPart = SHARED_SECTION_SIZE;
+    NTSTATUS status = ZwCreateSection(&g_SharedSection, SECTION_ALL_ACCESS, &attributes,
+        &size, PAGE_READWRITE, SEC_COMMIT, NULL);
+    if (!NT_SUCCESS(status)) {
+        g_SharedSection = NULL;
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle(g_SharedSection, SECTION_MAP_READ | SECTION_MAP_WRITE,
+        *MmSectionObjectType, KernelMode, &g_SharedObject, NULL);
+    if (!NT_SUCCESS(status)) {
+        g_SharedObject = NULL;
+        return status;
+    }
+
+    PVOID view = NULL;
+    SIZE_T viewSize = 0;
+    status = MmMapViewInSystemSpace(g_SharedObject, &view, &viewSize);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    // 新 section 的页全为零：Generation 与各 bank 的 Sequence 均为 0
+    PSHARED_SECTION_HEADER header = (PSHARED_SECTION_HEADER)view;
+    ULONG bankSize = (SHARED_SECTION_SIZE - SHARED_HEADER_SIZE) / 2;
+    header->Magic             = SHARED_SECTION_MAGIC;
+    header->Version           = SHARED_SECTION_VERSION;
+    header->SectionSize       = SHARED_SECTION_SIZE;
+    header->BankSize          = bankSize;
+    header->BankOffset[0]     = SHARED_HEADER_SIZE;
+    header->BankOffset[1]     = SHARED_HEADER_SIZE + bankSize;
+    header->RefreshIntervalMs = SHARED_REFRESH_INTERVAL_MS;
+
+    g_SharedHeader = header;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS SharedInitialize(VOID)
+{
+    KeInitializeEvent(&g_SharedLock, SynchronizationEvent, TRUE);
+    KeInitializeEvent(&g_SharedWake, SynchronizationEvent, FALSE);
+    g_SharedStopping = 0;
+    g_SharedMappings = 0;
+
+    NTSTATUS status = CreateSection();
+    if (!NT_SUCCESS(status)) {
+        DbgPrint("[OpenSysKit] Shared section creation failed: 0x%X\n", status);
+        ReleaseSection();
+        return status;
+    }
+
+    HANDLE threadHandle = NULL;
+    status = PsCreateSystemThread(&threadHandle, THREAD_ALL_ACCESS, NULL,
+        NULL, NULL, SharedRefreshThread, NULL);
+    if (!NT_SUCCESS(status)) {
+        ReleaseSection();
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle(threadHandle, SYNCHRONIZE, *PsThreadType,
+        KernelMode, (PVOID*)&g_SharedThread, NULL);
+    ZwClose(threadHandle);
+    if (!NT_SUCCESS(status)) {
+        // 等不到这个线程：让它自己退出，section 只能留到系统回收
+        InterlockedExchange(&g_SharedStopping, 1);
+        KeSetEvent(&g_SharedWake, IO_NO_INCREMENT, FALSE);
+        g_SharedThread = NULL;
+        g_SharedHeader = NULL;
+        return status;
+    }
+
+    DbgPrint("[OpenSysKit] Shared section ready (%lu bytes)\n", (ULONG)SHARED_SECTION_SIZE);
+    return STATUS_SUCCESS;
+}
+
+// 卸载时所有句柄都已关闭，客户端视图已在 IRP_MJ_CLEANUP 时解除
+VOID SharedShutdown(VOID)
+{
+    if (!g_SharedThread)
+        return;
+
+    InterlockedExchange(&g_SharedStopping, 1);
+    KeSetEvent(&g_SharedWake, IO_NO_INCREMENT, FALSE);
+    KeWaitForSingleObject(g_SharedThread, Executive, KernelMode, FALSE, NULL);
+    ObDereferenceObject(g_SharedThread);
+    g_SharedThread = NULL;
+
+    ReleaseSection();
+}
+
+// ========== 客户端视图 ==========
+//
+// 视图以 SEC_NO_CHANGE 映射：调用方不能用 VirtualProtect 改成可写，也不能提前解除映射。
+// 视图只属于打开设备的进程，按 CLIENT_CONTEXT 中持有引用的 EPROCESS 比较而不是 PID，
+// 打开者退出后 PID 被复用也不会误解除别的进程的映射。在别的进程上下文中收到 IRP_MJ_CLOSE 时无法解除，
+// 视图随该进程退出回收，这里只减计数。
+//
+
+NTSTATUS SharedMapClient(PCLIENT_CONTEXT Client, PSHARED_MAP_REPLY Reply)
+{
+    if (!g_SharedHeader || ReadNoFence(&g_SharedStopping))
+        return STATUS_DEVICE_NOT_READY;
+    if (PsGetCurrentProcess() != Client->Process)
+        return STATUS_ACCESS_DENIED;
+
+    RtlZeroMemory(Reply, sizeof(SHARED_MAP_REPLY));
+
+    PVOID view = ReadPointerAcquire(&Client->SharedView);
+    BOOLEAN first = FALSE;
+    if (!view) {
+        SIZE_T viewSize = 0;
+        NTSTATUS status = ZwMapViewOfSection(g_SharedSection, ZwCurrentProcess(), &view, 0, 0,
+            NULL, &viewSize, ViewUnmap, SEC_NO_CHANGE, PAGE_READONLY);
+        if (!NT_SUCCESS(status))
+            return status;
+
+        PVOID existing = InterlockedCompareExchangePointer(&Client->SharedView, view, NULL);
+        if (existing) {
+            ZwUnmapViewOfSection(ZwCurrentProcess(), view);
+            view = existing;
+        } else {
+            first = (InterlockedIncrement(&g_SharedMappings) == 1);
+        }
+    }
+
+    // 刷新线程空闲期间的数据可能很旧，第一个视图映射后立即发布一代
+    ULONG64 generation = (ULONG64)ReadAcquire64(&g_SharedHeader->Generation);
+    if (first || generation == 0)
+        SharedRefresh(&generation);
+
+    Reply->Address    = (ULONG64)(ULONG_PTR)view;
+    Reply->Size       = g_SharedHeader->SectionSize;
+    Reply->Generation = generation;
+    return STATUS_SUCCESS;
+}
+
+VOID SharedUnmapClient(PCLIENT_CONTEXT Client)
+{
+    PVOID view = InterlockedExchangePointer(&Client->SharedView, NULL);
+    if (!view)
+        return;
+
+    if (PsGetCurrentProcess() == Client->Process)
+        ZwUnmapViewOfSection(ZwCurrentProcess(), view);
+    InterlockedDecrement(&g_SharedMappings);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "driver.h"
+
+#define SHARED_SECTION_TAG  'hSsO'
+
+// ========== 共享快照区 ==========
+//
+// 驱动持有 section 与一个系统空间视图，发布只写系统视图；客户端视图只读。
+// 刷新线程只在有客户端视图时工作，发布由一把 PASSIVE_LEVEL 的锁串行化。
+//
+
+// 创建 section 并启动刷新线程；失败时映射请求返回 STATUS_DEVICE_NOT_READY
+NTSTATUS SharedInitialize(VOID);
+VOID SharedShutdown(VOID);
+
+// 须在 Client->ProcessId 的上下文中调用
+NTSTATUS SharedMapClient(PCLIENT_CONTEXT Client, PSHARED_MAP_REPLY Reply);
+
+// 立即发布一代（与并发请求合并），*Generation 为发布后的代
+NTSTATUS SharedRefresh(PULONG64 Generation);
+
+// IRP_MJ_CLEANUP 与 IRP_MJ_CLOSE 都调用，只有第一次生效
+VOID SharedUnmapClient(PCLIENT_CONTEXT Client);
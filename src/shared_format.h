@@ -0,0 +1,117 @@
+#pragma once
+
+#include "wire_format.h"
+
+// ========== 共享快照区 ==========
+//
+// 驱动持有一个分页内存 section，以只读视图映射进后端进程（IOCTL_MAP_SHARED_SECTION），
+// 并按固定间隔把进程、线程、内核模块三张表发布到其中。后端直接读内存，
+// 不再为周期刷新发 IOCTL；IOCTL_REFRESH_SHARED_SECTION 只用于周期之外的立即刷新。
+//
+//   [SHARED_SECTION_HEADER][填充至 4096][bank 0][bank 1]
+//
+// 每张表都是完整的 v2 编码（ENUM_V2_HEADER 开头，见 wire_format.h），
+// 用 WireValidate / WireRecord / WireString 解码，与 IOCTL 应答相同。
+//
+// ========== 发布与读取协议 ==========
+//
+// 第 N 代写入 Banks[N & 1] 指向的 bank，写前把该 bank 的 Sequence 加为奇数，
+// 写完再加为偶数，最后以 Release 发布头部的 Generation = N。
+// 读者持有的总是上一代所在的 bank，写者只会改写再前一代的 bank，
+// 因此正常读取不会与写入重叠；Sequence 只用于发现读者被拖延了整整一个周期的情况：
+//
+//   const SHARED_BANK* bank;
+//   LONG64 sequence;
+//   do {
+//       bank = SharedBeginRead(header, &sequence);     // NULL 表示尚未发布
+//       ... 复制需要的数据 ...
+//   } while (bank && !SharedEndRead(bank, sequence));
+//
+// 复制出的数据在 SharedEndRead 返回 TRUE 之前都可能是撕裂的，不应解引用其中的偏移；
+// 表很大时先复制整表再 WireValidate。
+//
+// 某张表放不下 bank 时该表 Offset 为 0、Status 为 STATUS_BUFFER_OVERFLOW，
+// Required 给出所需字节数，其余表照常发布。
+//
+
+#define SHARED_SECTION_MAGIC    0x4B534F53      // 'OSKS'
+#define SHARED_SECTION_VERSION  1
+#define SHARED_HEADER_SIZE      4096
+
+#define SHARED_TABLE_PROCESSES      0       // PROCESS_RECORD_V2
+#define SHARED_TABLE_THREADS        1       // THREAD_RECORD_V2
+#define SHARED_TABLE_KERNEL_MODULES 2       // MODULE_RECORD_V2
+#define SHARED_TABLE_COUNT          3
+
+typedef struct _SHARED_TABLE {
+    ULONG Offset;               // 相对 section 起始处，0 表示本代未发布该表
+    ULONG Size;                 // 即 ENUM_V2_HEADER.TotalSize
+    LONG  Status;               // NTSTATUS
+    ULONG Required;             // 溢出时所需字节数
+} SHARED_TABLE, *PSHARED_TABLE;
+
+typedef struct _SHARED_BANK {
+    volatile LONG64 Sequence;   // 奇数表示正在写入
+    ULONG64 Generation;
+    ULONG64 Timestamp;          // KeQuerySystemTimePrecise，100ns
+    ULONG   CaptureMicroseconds;// 抓取与编码耗时
+    ULONG   Reserved;
+    SHARED_TABLE Tables[SHARED_TABLE_COUNT];
+} SHARED_BANK, *PSHARED_BANK;
+
+typedef struct _SHARED_SECTION_HEADER {
+    ULONG   Magic;              // SHARED_SECTION_MAGIC
+    ULONG   Version;            // SHARED_SECTION_VERSION
+    ULONG   SectionSize;
+    ULONG   BankSize;
+    ULONG   BankOffset[2];      // 相对 section 起始处
+    ULONG   RefreshIntervalMs;
+    ULONG   Reserved;
+    volatile LONG64 Generation; // 最近发布的代，0 表示尚未发布
+    SHARED_BANK Banks[2];
+} SHARED_SECTION_HEADER, *PSHARED_SECTION_HEADER;
+
+C_ASSERT(sizeof(SHARED_SECTION_HEADER) <= SHARED_HEADER_SIZE);
+
+static inline const SHARED_BANK* SharedBeginRead(const SHARED_SECTION_HEADER* Header, LONG64* Sequence)
+{
+    LONG64 generation = ReadAcquire64(&Header->Generation);
+    if (generation == 0)
+        return NULL;
+
+    const SHARED_BANK* bank = &Header->Banks[generation & 1];
+    *Sequence = ReadAcquire64(&bank->Sequence);
+    return bank;
+}
+
+// 复制期间 bank 未被改写返回 TRUE；开始时正在写入也返回 FALSE
+static inline BOOLEAN SharedEndRead(const SHARED_BANK* Bank, LONG64 Sequence)
+{
+    MemoryBarrier();
+    return (Sequence & 1) == 0 && ReadNoFence64(&Bank->Sequence) == Sequence;
+}
+
+// 表的起始地址与长度；本代未发布该表或越出 bank 时返回 NULL
+static inline const VOID* SharedTable(
+    const SHARED_SECTION_HEADER* Header,
+    const SHARED_BANK*           Bank,
+    ULONG                        Table,
+    PULONG                       Size)
+{
+    if (Table >= SHARED_TABLE_COUNT)
+        return NULL;
+
+    ULONG index  = (ULONG)(Bank - Header->Banks);
+    if (index > 1)
+        return NULL;
+
+    ULONG64 begin = Header->BankOffset[index];
+    ULONG64 end   = begin + Header->BankSize;
+    ULONG offset  = Bank->Tables[Table].Offset;
+    ULONG size    = Bank->Tables[Table].Size;
+    if (offset < begin || (ULONG64)offset + size > end || end > Header->SectionSize)
+        return NULL;
+
+    *Size = size;
+    return (const UCHAR*)Header + offset;
+}
@@ -4,9 +4,13 @@
 // Uses certificate SHA1 thumbprint for verification
 //
 
-#include <ntddk.h>
-#include <ntimage.h>
+#include <ntifs.h>
 #include "signature.h"
+#include "sha.h"
+#include "prewarm.h"
+#include "verdict_store.h"
+#include "sigstats.h"
+#include "sigpid.h"
 
 #ifdef DBG
 #define SigLog(fmt, ...) DbgPrint("[OpenSysKit][Sig] " fmt "\n", ##__VA_ARGS__)
@@ -22,12 +26,10 @@ extern "C" {
 }
 
 
+// Verification only runs at PASSIVE_LEVEL, so work buffers come from paged pool
 static PVOID SigAllocMem(SIZE_T Size)
 {
-    #pragma warning(suppress: 4996)
-    PVOID p = ExAllocatePoolWithTag(NonPagedPool, Size, SIGNATURE_TAG);
-    if (p) RtlZeroMemory(p, Size);
-    return p;
+    return ExAllocatePool2(POOL_FLAG_PAGED, Size, SIGNATURE_TAG);
 }
 
 static VOID SigFreeMem(PVOID Ptr)
@@ -36,629 +38,512 @@ static VOID SigFreeMem(PVOID Ptr)
 }
 
 // ================================================================
-// SHA256 implementation
+// Caller image path
 // ================================================================
 
-struct SHA256_CTX {
-    ULONG state[8];
-    ULONG64 count;
-    UCHAR buffer[64];
-};
-
-struct SHA1_CTX {
-    ULONG state[5];
-    ULONG count[2];
-    UCHAR buffer[64];
-};
-
-#define ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
-#define ROR(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
-
-static const ULONG K256[64] = {
-    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-};
-
-static void SHA256Transform(ULONG state[8], const UCHAR buffer[64])
+NTSTATUS GetCallerImagePath(PUNICODE_STRING ImagePath)
 {
-    ULONG a, b, c, d, e, f, g, h, t1, t2;
-    ULONG W[64];
-
-    for (ULONG i = 0; i < 16; i++) {
-        W[i] = ((ULONG)buffer[i * 4] << 24) |
-               ((ULONG)buffer[i * 4 + 1] << 16) |
-               ((ULONG)buffer[i * 4 + 2] << 8) |
-               ((ULONG)buffer[i * 4 + 3]);
-    }
-    for (ULONG i = 16; i < 64; i++) {
-        ULONG s0 = ROR(W[i-15], 7) ^ ROR(W[i-15], 18) ^ (W[i-15] >> 3);
-        ULONG s1 = ROR(W[i-2], 17) ^ ROR(W[i-2], 19) ^ (W[i-2] >> 10);
-        W[i] = W[i-16] + s0 + W[i-7] + s1;
+    if (!ImagePath || !ImagePath->Buffer || ImagePath->MaximumLength < sizeof(WCHAR)) {
+        return STATUS_INVALID_PARAMETER;
     }
 
-    a = state[0]; b = state[1]; c = state[2]; d = state[3];
-    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    ImagePath->Length = 0;
+    ImagePath->Buffer[0] = L'\0';
 
-    for (ULONG i = 0; i < 64; i++) {
-        ULONG S1 = ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25);
-        ULONG ch = (e & f) ^ ((~e) & g);
-        t1 = h + S1 + ch + K256[i] + W[i];
-        ULONG S0 = ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22);
-        ULONG maj = (a & b) ^ (a & c) ^ (b & c);
-        t2 = S0 + maj;
+    PUNICODE_STRING processImagePath = NULL;
+    NTSTATUS status = SeLocateProcessImageName(IoGetCurrentProcess(), &processImagePath);
+    if (!NT_SUCCESS(status) || !processImagePath || !processImagePath->Buffer) {
+        SigLog("SeLocateProcessImageName failed: 0x%08X", status);
+        if (processImagePath) {
+            ExFreePool(processImagePath);
+        }
+        return !NT_SUCCESS(status) ? status : STATUS_UNSUCCESSFUL;
+    }
 
-        h = g; g = f; f = e; e = d + t1;
-        d = c; c = b; b = a; a = t1 + t2;
+    if (ImagePath->MaximumLength < processImagePath->Length + sizeof(WCHAR)) {
+        ExFreePool(processImagePath);
+        return STATUS_BUFFER_TOO_SMALL;
     }
 
-    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
-    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
-}
+    RtlCopyMemory(ImagePath->Buffer, processImagePath->Buffer, processImagePath->Length);
+    ImagePath->Length = processImagePath->Length;
+    ImagePath->Buffer[ImagePath->Length / sizeof(WCHAR)] = L'\0';
+    SigLog("Caller image path: %wZ", ImagePath);
 
-static void SHA256Init(SHA256_CTX* ctx)
-{
-    ctx->state[0] = 0x6a09e667; ctx->state[1] = 0xbb67ae85;
-    ctx->state[2] = 0x3c6ef372; ctx->state[3] = 0xa54ff53a;
-    ctx->state[4] = 0x510e527f; ctx->state[5] = 0x9b05688c;
-    ctx->state[6] = 0x1f83d9ab; ctx->state[7] = 0x5be0cd19;
-    ctx->count = 0;
+    ExFreePool(processImagePath);
+    return STATUS_SUCCESS;
 }
 
-static void SHA256Update(SHA256_CTX* ctx, const UCHAR* data, ULONG len)
-{
-    ULONG bufferIndex = (ULONG)(ctx->count & 63);
-    ctx->count += len;
+// ================================================================
+// PE signature verification from file
+// ================================================================
 
-    if (bufferIndex + len >= 64) {
-        ULONG firstPart = 64 - bufferIndex;
-        RtlCopyMemory(&ctx->buffer[bufferIndex], data, firstPart);
-        SHA256Transform(ctx->state, ctx->buffer);
+static NTSTATUS ReadFileAt(PVOID Context, ULONG Offset, PVOID Buffer, ULONG Length)
+{
+    IO_STATUS_BLOCK ioStatus = { 0 };
+    LARGE_INTEGER offset;
+    offset.QuadPart = Offset;
 
-        ULONG i;
-        for (i = firstPart; i + 63 < len; i += 64) {
-            SHA256Transform(ctx->state, &data[i]);
-        }
-        bufferIndex = 0;
-        data += i;
-        len -= i;
-    }
-    RtlCopyMemory(&ctx->buffer[bufferIndex], data, len);
+    NTSTATUS status = ZwReadFile((HANDLE)Context, NULL, NULL, NULL, &ioStatus,
+        Buffer, Length, &offset, NULL);
+    if (!NT_SUCCESS(status)) return status;
+    if (ioStatus.Information != Length) return STATUS_END_OF_FILE;
+    return STATUS_SUCCESS;
 }
 
-static void SHA256Final(UCHAR digest[32], SHA256_CTX* ctx)
+//
+// FILE_SHARE_READ only: while the handle is open nobody can write the file,
+// so the identity queried through it describes exactly the bytes we hash.
+//
+static NTSTATUS OpenImageFile(PUNICODE_STRING FilePath, PHANDLE FileHandle)
 {
-    UCHAR finalcount[8];
-    ULONG64 bitCount = ctx->count * 8;
+    OBJECT_ATTRIBUTES objAttr = { 0 };
+    IO_STATUS_BLOCK ioStatus = { 0 };
 
-    for (ULONG i = 0; i < 8; i++) {
-        finalcount[i] = (UCHAR)((bitCount >> ((7 - i) * 8)) & 0xFF);
-    }
+    InitializeObjectAttributes(&objAttr, FilePath, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
 
-    UCHAR c = 0x80;
-    SHA256Update(ctx, &c, 1);
-    while ((ctx->count & 63) != 56) {
-        c = 0;
-        SHA256Update(ctx, &c, 1);
-    }
-    SHA256Update(ctx, finalcount, 8);
+    NTSTATUS status = ZwCreateFile(
+        FileHandle, GENERIC_READ | SYNCHRONIZE, &objAttr, &ioStatus,
+        NULL, FILE_ATTRIBUTE_NORMAL, FILE_SHARE_READ, FILE_OPEN,
+        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
+    if (!NT_SUCCESS(status))
+        SigLog("ZwCreateFile failed: 0x%08X", status);
+    return status;
+}
 
-    for (ULONG i = 0; i < 32; i++) {
-        digest[i] = (UCHAR)((ctx->state[i >> 2] >> ((3 - (i & 3)) * 8)) & 0xFF);
-    }
+static SIGNATURE_STATUS VerifyPESignatureFromHandle(HANDLE FileHandle, LONGLONG FileSize, UCHAR ImageHash[32])
+{
+    RtlZeroMemory(ImageHash, 32);
+    if (FileSize < 0 || FileSize > MAXULONG) return SignatureError;
+
+    SIG_PHASE_TICKS ticks = { 0 };
+    ticks.Now = SigStatsNow;
+
+    SIG_READER reader;
+    reader.Context  = FileHandle;
+    reader.Read     = ReadFileAt;
+    reader.FileSize = (ULONG)FileSize;
+    reader.Ticks    = &ticks;
+
+    ULONG64 start = SigStatsNow();
+    SIGNATURE_STATUS result = AuthenticodeVerifyStream(&reader, TRUSTED_CERT_THUMBPRINT, ImageHash);
+    SigStatsLatency(SigPhaseTotal, SigStatsNow() - start);
+
+    // Phases that never ran (e.g. unsigned file: no hash, no PKCS#7) are not recorded
+    SigStatsLatency(SigPhaseRead, ticks.Read);
+    if (ticks.Hash)  SigStatsLatency(SigPhaseHash, ticks.Hash);
+    if (ticks.Pkcs7) SigStatsLatency(SigPhasePkcs7, ticks.Pkcs7);
+    SigStatsVerdict(result);
+    return result;
 }
 
 // ================================================================
-// SHA1 implementation
+// File identity
 // ================================================================
 
-static void SHA1Transform(ULONG state[5], const UCHAR buffer[64])
-{
-    ULONG a, b, c, d, e;
-    ULONG block[80];
-
-    for (ULONG i = 0; i < 16; i++) {
-        block[i] = ((ULONG)buffer[i * 4] << 24) |
-                   ((ULONG)buffer[i * 4 + 1] << 16) |
-                   ((ULONG)buffer[i * 4 + 2] << 8) |
-                   ((ULONG)buffer[i * 4 + 3]);
-    }
-    for (ULONG i = 16; i < 80; i++) {
-        block[i] = ROL(block[i-3] ^ block[i-8] ^ block[i-14] ^ block[i-16], 1);
-    }
+//
+// A verdict belongs to file content, not to a process. Content is
+// identified by volume + 128-bit file ID, and considered unchanged while
+// the file's USN and the volume's USN journal ID both match. NTFS assigns
+// a new USN on every change while the journal is active and user mode
+// cannot set it (timestamps it can, through SetFileTime). Changes made
+// while the journal is deleted leave the USN behind, but the journal comes
+// back with a new ID, so every key of that volume misses.
+//
+// Without an active journal (FAT, network redirectors, journal disabled)
+// there is no value user mode cannot forge: the file is verified on every
+// open and its verdict is neither cached nor persisted.
+//
+typedef struct _SIG_FILE_ID_INFORMATION {
+    ULONGLONG VolumeSerialNumber;
+    UCHAR     FileId[16];
+} SIG_FILE_ID_INFORMATION;
 
-    a = state[0]; b = state[1]; c = state[2]; d = state[3]; e = state[4];
+#define FileIdInformationClass ((FILE_INFORMATION_CLASS)59)
 
-    for (ULONG i = 0; i < 20; i++) {
-        ULONG temp = ROL(a, 5) + ((b & c) | ((~b) & d)) + e + block[i] + 0x5A827999;
-        e = d; d = c; c = ROL(b, 30); b = a; a = temp;
-    }
-    for (ULONG i = 20; i < 40; i++) {
-        ULONG temp = ROL(a, 5) + (b ^ c ^ d) + e + block[i] + 0x6ED9EBA1;
-        e = d; d = c; c = ROL(b, 30); b = a; a = temp;
-    }
-    for (ULONG i = 40; i < 60; i++) {
-        ULONG temp = ROL(a, 5) + ((b & c) | (b & d) | (c & d)) + e + block[i] + 0x8F1BBCDC;
-        e = d; d = c; c = ROL(b, 30); b = a; a = temp;
-    }
-    for (ULONG i = 60; i < 80; i++) {
-        ULONG temp = ROL(a, 5) + (b ^ c ^ d) + e + block[i] + 0xCA62C1D6;
-        e = d; d = c; c = ROL(b, 30); b = a; a = temp;
+typedef struct _SIG_FILE_IDENTITY {
+    ULONGLONG VolumeSerial;
+    UCHAR     FileId[16];
+    LONGLONG  FileSize;
+    ULONGLONG UsnJournalId;
+    LONGLONG  Usn;
+} SIG_FILE_IDENTITY, *PSIG_FILE_IDENTITY;
+
+//
+// FSCTL_QUERY_USN_JOURNAL only accepts a volume handle: open the volume
+// device the image path starts with (\Device\HarddiskVolumeN).
+//
+static NTSTATUS QueryUsnJournalId(PUNICODE_STRING FilePath, PULONGLONG JournalId)
+{
+    USHORT chars = FilePath->Length / sizeof(WCHAR);
+    USHORT end = 0, separators = 0;
+    for (; end < chars; end++) {
+        if (FilePath->Buffer[end] == L'\\' && ++separators == 3) break;
     }
+    if (separators != 3) return STATUS_OBJECT_PATH_SYNTAX_BAD;
 
-    state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
-}
+    UNICODE_STRING volumePath;
+    volumePath.Buffer        = FilePath->Buffer;
+    volumePath.Length        = (USHORT)(end * sizeof(WCHAR));
+    volumePath.MaximumLength = volumePath.Length;
 
-static void SHA1Init(SHA1_CTX* ctx)
-{
-    ctx->state[0] = 0x67452301; ctx->state[1] = 0xEFCDAB89;
-    ctx->state[2] = 0x98BADCFE; ctx->state[3] = 0x10325476;
-    ctx->state[4] = 0xC3D2E1F0;
-    ctx->count[0] = ctx->count[1] = 0;
+    OBJECT_ATTRIBUTES objAttr = { 0 };
+    IO_STATUS_BLOCK ioStatus = { 0 };
+    HANDLE volumeHandle = NULL;
+    InitializeObjectAttributes(&objAttr, &volumePath, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    NTSTATUS status = ZwCreateFile(
+        &volumeHandle, FILE_READ_DATA | FILE_READ_ATTRIBUTES | SYNCHRONIZE, &objAttr, &ioStatus,
+        NULL, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_OPEN,
+        FILE_SYNCHRONOUS_IO_NONALERT, NULL, 0);
+    if (!NT_SUCCESS(status)) return status;
+
+    USN_JOURNAL_DATA_V0 journal = { 0 };
+    status = ZwFsControlFile(volumeHandle, NULL, NULL, NULL, &ioStatus,
+        FSCTL_QUERY_USN_JOURNAL, NULL, 0, &journal, sizeof(journal));
+    ZwClose(volumeHandle);
+    if (!NT_SUCCESS(status)) return status;
+
+    *JournalId = journal.UsnJournalID;
+    return STATUS_SUCCESS;
 }
 
-static void SHA1Update(SHA1_CTX* ctx, const UCHAR* data, ULONG len)
+static NTSTATUS QueryFileIdentity(PUNICODE_STRING FilePath, HANDLE FileHandle, PSIG_FILE_IDENTITY Identity)
 {
-    ULONG i, j;
-    j = (ctx->count[0] >> 3) & 63;
-    if ((ctx->count[0] += len << 3) < (len << 3)) ctx->count[1]++;
-    ctx->count[1] += (len >> 29);
-    if ((j + len) > 63) {
-        i = 64 - j;
-        RtlCopyMemory(&ctx->buffer[j], data, i);
-        SHA1Transform(ctx->state, ctx->buffer);
-        for (; i + 63 < len; i += 64) {
-            SHA1Transform(ctx->state, &data[i]);
-        }
-        j = 0;
-    } else {
-        i = 0;
-    }
-    RtlCopyMemory(&ctx->buffer[j], &data[i], len - i);
+    IO_STATUS_BLOCK ioStatus = { 0 };
+    SIG_FILE_ID_INFORMATION idInfo = { 0 };
+    FILE_STANDARD_INFORMATION stdInfo = { 0 };
+
+    // USN_RECORD_V2 followed by the file name (at most 255 characters on NTFS)
+    ULONGLONG usnBuffer[(sizeof(USN_RECORD_V2) + 256 * sizeof(WCHAR) + sizeof(ULONGLONG) - 1) / sizeof(ULONGLONG)];
+    PUSN_RECORD_V2 usnRecord = (PUSN_RECORD_V2)usnBuffer;
+
+    NTSTATUS status = ZwQueryInformationFile(FileHandle, &ioStatus, &idInfo, sizeof(idInfo), FileIdInformationClass);
+    if (!NT_SUCCESS(status)) return status;
+    status = ZwQueryInformationFile(FileHandle, &ioStatus, &stdInfo, sizeof(stdInfo), FileStandardInformation);
+    if (!NT_SUCCESS(status)) return status;
+    status = ZwFsControlFile(FileHandle, NULL, NULL, NULL, &ioStatus,
+        FSCTL_READ_FILE_USN_DATA, NULL, 0, usnBuffer, sizeof(usnBuffer));
+    if (!NT_SUCCESS(status)) return status;
+    if (ioStatus.Information < sizeof(USN_RECORD_V2) || usnRecord->MajorVersion != 2)
+        return STATUS_NOT_SUPPORTED;
+
+    // The file is open without FILE_SHARE_WRITE, so its USN cannot move
+    // between the two queries; a journal recreated in between only yields a
+    // key that misses later
+    ULONGLONG journalId = 0;
+    status = QueryUsnJournalId(FilePath, &journalId);
+    if (!NT_SUCCESS(status)) return status;
+
+    RtlZeroMemory(Identity, sizeof(*Identity));
+    Identity->VolumeSerial = idInfo.VolumeSerialNumber;
+    RtlCopyMemory(Identity->FileId, idInfo.FileId, sizeof(Identity->FileId));
+    Identity->FileSize     = stdInfo.EndOfFile.QuadPart;
+    Identity->UsnJournalId = journalId;
+    Identity->Usn          = usnRecord->Usn;
+    return STATUS_SUCCESS;
 }
 
-static void SHA1Final(UCHAR digest[20], SHA1_CTX* ctx)
+static ULONG HashFileIdentity(const SIG_FILE_IDENTITY* Identity)
 {
-    UCHAR finalcount[8];
-    UCHAR c = 0200;
-
-    for (ULONG i = 0; i < 8; i++) {
-        finalcount[i] = (UCHAR)((ctx->count[(i >= 4 ? 0 : 1)] >> ((3 - (i & 3)) * 8)) & 255);
-    }
-    SHA1Update(ctx, &c, 1);
-    while ((ctx->count[0] & 504) != 448) {
-        c = 0;
-        SHA1Update(ctx, &c, 1);
-    }
-    SHA1Update(ctx, finalcount, 8);
-    for (ULONG i = 0; i < 20; i++) {
-        digest[i] = (UCHAR)((ctx->state[i >> 2] >> ((3 - (i & 3)) * 8)) & 255);
-    }
+    // FNV-1a over the whole key; the struct is zeroed before filling so
+    // padding never differs between equal keys
+    const UCHAR* p = (const UCHAR*)Identity;
+    ULONG h = 2166136261u;
+    for (ULONG i = 0; i < sizeof(*Identity); i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
 }
 
 // ================================================================
-// Thumbprint comparison
+// Verdict cache
 // ================================================================
 
-static int HexCharToValue(char c)
-{
-    if (c >= '0' && c <= '9') return c - '0';
-    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-    return -1;
-}
+//
+// Primary cache: file identity -> verdict, bounded, LRU eviction.
+// Entries live in one nonpaged array allocated at init; each is linked into
+// a hash bucket and into either the LRU list or the free list.
+//
+// Secondary index: (PID, process create time) -> verdict, direct-mapped.
+// Create time makes a recycled PID miss instead of inheriting a verdict.
+// A PID miss only costs opening the image and its volume plus four
+// metadata queries when the image is already in the primary cache.
+//
+// The PID index (sigpid.cpp) is the path every open takes and is read
+// without locks. The primary cache is only reached on a PID miss and keeps
+// g_SignatureCacheLock for its bucket and LRU updates.
+//
+typedef struct _SIGNATURE_CACHE_ENTRY {
+    LIST_ENTRY        HashLink;
+    LIST_ENTRY        LruLink;
+    SIG_FILE_IDENTITY Identity;
+    SIGNATURE_STATUS  Status;
+    UCHAR             ImageHash[32];
+} SIGNATURE_CACHE_ENTRY, *PSIGNATURE_CACHE_ENTRY;
 
-static BOOLEAN CompareThumbprint(const UCHAR digest[20], const char* thumbprint)
-{
-    if (!thumbprint || thumbprint[0] == '\0') {
-        return FALSE; // Empty thumbprint = reject all (safer than WinDrive default)
-    }
+#define SIG_CACHE_DEFAULT_CAPACITY 256
+#define SIG_CACHE_MIN_CAPACITY     16
+#define SIG_CACHE_MAX_CAPACITY     4096
 
-    size_t len = 0;
-    while (thumbprint[len] && len < 41) len++;
-    if (len < 40) {
-        SigLog("Invalid thumbprint length: %zu (expected 40)", len);
-        return FALSE;
-    }
+static PSIGNATURE_CACHE_ENTRY g_CacheEntries = NULL;
+static PLIST_ENTRY g_CacheBuckets = NULL;
+static ULONG       g_CacheBucketMask = 0;
+static ULONG       g_CacheCapacity = 0;
+static LIST_ENTRY  g_CacheLru;          // head = most recently used
+static LIST_ENTRY  g_CacheFree;
+static KSPIN_LOCK  g_SignatureCacheLock;
 
-    for (ULONG i = 0; i < 20; i++) {
-        int high = HexCharToValue(thumbprint[i * 2]);
-        int low = HexCharToValue(thumbprint[i * 2 + 1]);
-        if (high < 0 || low < 0) return FALSE;
-        if (digest[i] != (UCHAR)((high << 4) | low)) return FALSE;
+// Caller holds g_SignatureCacheLock
+static PSIGNATURE_CACHE_ENTRY CacheFindLocked(const SIG_FILE_IDENTITY* Identity, ULONG Hash)
+{
+    PLIST_ENTRY bucket = &g_CacheBuckets[Hash & g_CacheBucketMask];
+    for (PLIST_ENTRY e = bucket->Flink; e != bucket; e = e->Flink) {
+        PSIGNATURE_CACHE_ENTRY entry = CONTAINING_RECORD(e, SIGNATURE_CACHE_ENTRY, HashLink);
+        if (RtlCompareMemory(&entry->Identity, Identity, sizeof(*Identity)) == sizeof(*Identity))
+            return entry;
     }
-    return TRUE;
+    return NULL;
 }
 
-// ================================================================
-// PKCS#7 messageDigest extraction
-// ================================================================
-
-static BOOLEAN ExtractMessageDigest(
-    PUCHAR pkcs7Data, ULONG pkcs7Len,
-    UCHAR* digest, ULONG* digestLen,
-    BOOLEAN* isSHA256, PUCHAR expectedHash)
+static BOOLEAN CacheLookup(const SIG_FILE_IDENTITY* Identity, SIGNATURE_STATUS* Status)
 {
-    *digestLen = 0;
-    *isSHA256 = FALSE;
+    if (!g_CacheEntries) return FALSE;
 
-    const UCHAR messageDigestOID[] = { 0x06, 0x09, 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x04 };
-    const UCHAR sha256OID[] = { 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01 };
-
-    for (ULONG i = 0; i + sizeof(sha256OID) <= pkcs7Len; i++) {
-        if (RtlCompareMemory(&pkcs7Data[i], sha256OID, sizeof(sha256OID)) == sizeof(sha256OID)) {
-            *isSHA256 = TRUE;
-            break;
-        }
+    ULONG hash = HashFileIdentity(Identity);
+    BOOLEAN found = FALSE;
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_SignatureCacheLock, &oldIrql);
+    PSIGNATURE_CACHE_ENTRY entry = CacheFindLocked(Identity, hash);
+    if (entry) {
+        RemoveEntryList(&entry->LruLink);
+        InsertHeadList(&g_CacheLru, &entry->LruLink);
+        *Status = entry->Status;
+        found = TRUE;
     }
+    KeReleaseSpinLock(&g_SignatureCacheLock, oldIrql);
+    return found;
+}
 
-    for (ULONG i = 0; i + sizeof(messageDigestOID) + 10 < pkcs7Len; i++) {
-        if (RtlCompareMemory(&pkcs7Data[i], messageDigestOID, sizeof(messageDigestOID)) != sizeof(messageDigestOID))
-            continue;
-
-        ULONG pos = i + sizeof(messageDigestOID);
-
-        if (pos >= pkcs7Len || pkcs7Data[pos] != 0x31) continue;
-        pos++;
+static VOID CacheInsert(const SIG_FILE_IDENTITY* Identity, SIGNATURE_STATUS Status, const UCHAR ImageHash[32])
+{
+    if (!g_CacheEntries) return;
 
-        if (pos >= pkcs7Len) continue;
-        if (pkcs7Data[pos] & 0x80) {
-            ULONG lenBytes = pkcs7Data[pos] & 0x7F;
-            pos += 1 + lenBytes;
-        } else {
-            pos++;
-        }
+    ULONG hash = HashFileIdentity(Identity);
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_SignatureCacheLock, &oldIrql);
 
-        if (pos >= pkcs7Len || pkcs7Data[pos] != 0x04) continue;
-        pos++;
-
-        if (pos >= pkcs7Len) continue;
-        ULONG len = 0;
-        if (pkcs7Data[pos] & 0x80) {
-            ULONG lenBytes = pkcs7Data[pos] & 0x7F;
-            if (lenBytes > 4 || pos + lenBytes >= pkcs7Len) continue;
-            pos++;
-            for (ULONG j = 0; j < lenBytes; j++) {
-                len = (len << 8) | pkcs7Data[pos++];
-            }
+    PSIGNATURE_CACHE_ENTRY entry = CacheFindLocked(Identity, hash);
+    if (entry) {
+        // Another thread verified the same file concurrently
+        RemoveEntryList(&entry->LruLink);
+    } else {
+        PLIST_ENTRY link;
+        if (!IsListEmpty(&g_CacheFree)) {
+            link = RemoveHeadList(&g_CacheFree);
         } else {
-            len = pkcs7Data[pos++];
-        }
-
-        if (len != 20 && len != 32) continue;
-        if (pos + len > pkcs7Len) continue;
-
-        if (expectedHash && len == 32) {
-            if (RtlCompareMemory(&pkcs7Data[pos], expectedHash, 32) == 32) {
-                RtlCopyMemory(digest, &pkcs7Data[pos], len);
-                *digestLen = len;
-                return TRUE;
-            }
-        } else if (!expectedHash) {
-            RtlCopyMemory(digest, &pkcs7Data[pos], len);
-            *digestLen = len;
-            return TRUE;
-        }
-    }
-
-    if (expectedHash) {
-        for (ULONG i = 0; i + 32 < pkcs7Len; i++) {
-            if (RtlCompareMemory(&pkcs7Data[i], expectedHash, 32) == 32) {
-                RtlCopyMemory(digest, &pkcs7Data[i], 32);
-                *digestLen = 32;
-                *isSHA256 = TRUE;
-                return TRUE;
-            }
+            link = RemoveTailList(&g_CacheLru);
+            RemoveEntryList(&CONTAINING_RECORD(link, SIGNATURE_CACHE_ENTRY, LruLink)->HashLink);
+            SigStatsCount(SigCounterEviction);
         }
+        entry = CONTAINING_RECORD(link, SIGNATURE_CACHE_ENTRY, LruLink);
+        entry->Identity = *Identity;
+        InsertHeadList(&g_CacheBuckets[hash & g_CacheBucketMask], &entry->HashLink);
     }
+    entry->Status = Status;
+    RtlCopyMemory(entry->ImageHash, ImageHash, sizeof(entry->ImageHash));
+    InsertHeadList(&g_CacheLru, &entry->LruLink);
 
-    SigLog("messageDigest not found in PKCS7");
-    return FALSE;
+    KeReleaseSpinLock(&g_SignatureCacheLock, oldIrql);
 }
 
-// ================================================================
-// Caller image path
-// ================================================================
-
-NTSTATUS GetCallerImagePath(PUNICODE_STRING ImagePath)
+static NTSTATUS CacheAllocate(ULONG Capacity)
 {
-    if (!ImagePath || !ImagePath->Buffer || ImagePath->MaximumLength < sizeof(WCHAR)) {
-        return STATUS_INVALID_PARAMETER;
-    }
-
-    ImagePath->Length = 0;
-    ImagePath->Buffer[0] = L'\0';
-
-    PUNICODE_STRING processImagePath = NULL;
-    NTSTATUS status = SeLocateProcessImageName(IoGetCurrentProcess(), &processImagePath);
-    if (!NT_SUCCESS(status) || !processImagePath || !processImagePath->Buffer) {
-        SigLog("SeLocateProcessImageName failed: 0x%08X", status);
-        if (processImagePath) {
-            ExFreePool(processImagePath);
-        }
-        return !NT_SUCCESS(status) ? status : STATUS_UNSUCCESSFUL;
-    }
-
-    if (ImagePath->MaximumLength < processImagePath->Length + sizeof(WCHAR)) {
-        ExFreePool(processImagePath);
-        return STATUS_BUFFER_TOO_SMALL;
-    }
-
-    RtlCopyMemory(ImagePath->Buffer, processImagePath->Buffer, processImagePath->Length);
-    ImagePath->Length = processImagePath->Length;
-    ImagePath->Buffer[ImagePath->Length / sizeof(WCHAR)] = L'\0';
-    SigLog("Caller image path: %wZ", ImagePath);
-
-    ExFreePool(processImagePath);
+    ULONG buckets = 1;
+    while (buckets < Capacity) buckets <<= 1;
+
+    g_CacheEntries = (PSIGNATURE_CACHE_ENTRY)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, (SIZE_T)Capacity * sizeof(SIGNATURE_CACHE_ENTRY), SIGNATURE_TAG);
+    g_CacheBuckets = (PLIST_ENTRY)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, (SIZE_T)buckets * sizeof(LIST_ENTRY), SIGNATURE_TAG);
+    if (!g_CacheEntries || !g_CacheBuckets) {
+        if (g_CacheEntries) ExFreePoolWithTag(g_CacheEntries, SIGNATURE_TAG);
+        if (g_CacheBuckets) ExFreePoolWithTag(g_CacheBuckets, SIGNATURE_TAG);
+        g_CacheEntries = NULL;
+        g_CacheBuckets = NULL;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    InitializeListHead(&g_CacheLru);
+    InitializeListHead(&g_CacheFree);
+    for (ULONG i = 0; i < buckets; i++)
+        InitializeListHead(&g_CacheBuckets[i]);
+    for (ULONG i = 0; i < Capacity; i++)
+        InsertTailList(&g_CacheFree, &g_CacheEntries[i].LruLink);
+
+    g_CacheBucketMask = buckets - 1;
+    g_CacheCapacity = Capacity;
     return STATUS_SUCCESS;
 }
 
 // ================================================================
-// WIN_CERTIFICATE
+// Persistent verdict store
 // ================================================================
 
-typedef struct _WIN_CERTIFICATE {
-    ULONG dwLength;
-    USHORT wRevision;
-    USHORT wCertificateType;
-    UCHAR bCertificate[1];
-} WIN_CERTIFICATE, *PWIN_CERTIFICATE;
-
-#define WIN_CERT_TYPE_PKCS_SIGNED_DATA 0x0002
-
-// ================================================================
-// Authenticode hash calculation
-// ================================================================
+//
+// The content cache is saved on unload and reloaded on the next load, so
+// a driver upgrade does not re-hash every client binary. Records are
+// revalidated by exact file identity on lookup like any other entry. The
+// store lives next to the driver binary, which only administrators can
+// write; its checksum only guards against truncation and corruption.
+//
+#define SIG_STORE_PATH L"\\SystemRoot\\System32\\drivers\\OpenSysKit.sigcache"
 
-static BOOLEAN CalculateAuthenticodeHash(
-    PVOID fileBuffer, ULONG fileSize,
-    UCHAR hash[32], BOOLEAN* isSHA256)
+static NTSTATUS OpenVerdictStore(ACCESS_MASK Access, ULONG Disposition, PHANDLE FileHandle)
 {
-    *isSHA256 = FALSE;
-
-    PIMAGE_DOS_HEADER dosHeader = (PIMAGE_DOS_HEADER)fileBuffer;
-    if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE) return FALSE;
-
-    if (dosHeader->e_lfanew < 0 ||
-        (ULONG)dosHeader->e_lfanew + sizeof(IMAGE_NT_HEADERS) > fileSize)
-        return FALSE;
-
-    PIMAGE_NT_HEADERS ntHeaders = (PIMAGE_NT_HEADERS)((ULONG_PTR)fileBuffer + dosHeader->e_lfanew);
-    if (ntHeaders->Signature != IMAGE_NT_SIGNATURE) return FALSE;
-
-    ULONG checksumOffset = 0;
-    ULONG securityDirOffset = 0;
-    ULONG securityDirVA = 0;
-
-    if (ntHeaders->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
-        PIMAGE_NT_HEADERS64 nt64 = (PIMAGE_NT_HEADERS64)ntHeaders;
-        checksumOffset = dosHeader->e_lfanew + 24 + 64;
-        securityDirOffset = dosHeader->e_lfanew + 24 + 144;
-        securityDirVA = nt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY].VirtualAddress;
-    } else if (ntHeaders->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
-        checksumOffset = dosHeader->e_lfanew + 24 + 64;
-        securityDirOffset = dosHeader->e_lfanew + 24 + 128;
-        securityDirVA = ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY].VirtualAddress;
-    } else {
-        return FALSE;
-    }
-
-    ULONG hashEnd = securityDirVA > 0 ? securityDirVA : fileSize;
-
-    if (checksumOffset + 4 > fileSize ||
-        securityDirOffset + 8 > fileSize ||
-        hashEnd > fileSize ||
-        checksumOffset >= securityDirOffset ||
-        securityDirOffset + 8 > hashEnd)
-        return FALSE;
-
-    SHA256_CTX ctx;
-    SHA256Init(&ctx);
-    SHA256Update(&ctx, (PUCHAR)fileBuffer, checksumOffset);
-    SHA256Update(&ctx, (PUCHAR)fileBuffer + checksumOffset + 4, securityDirOffset - checksumOffset - 4);
-    SHA256Update(&ctx, (PUCHAR)fileBuffer + securityDirOffset + 8, hashEnd - securityDirOffset - 8);
-    SHA256Final(hash, &ctx);
-    *isSHA256 = TRUE;
+    UNICODE_STRING path = RTL_CONSTANT_STRING(SIG_STORE_PATH);
+    OBJECT_ATTRIBUTES objAttr;
+    IO_STATUS_BLOCK ioStatus = { 0 };
 
-    return TRUE;
+    InitializeObjectAttributes(&objAttr, &path, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
+    return ZwCreateFile(
+        FileHandle, Access | SYNCHRONIZE, &objAttr, &ioStatus,
+        NULL, FILE_ATTRIBUTE_NORMAL, 0, Disposition,
+        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
 }
 
-// ================================================================
-// PE signature verification from file
-// ================================================================
-
-static SIGNATURE_STATUS VerifyPESignatureFromFile(PUNICODE_STRING FilePath)
+static VOID LoadVerdictStore(VOID)
 {
-    NTSTATUS status;
-    HANDLE fileHandle = NULL;
-    OBJECT_ATTRIBUTES objAttr = { 0 };
-    IO_STATUS_BLOCK ioStatus = { 0 };
-    PVOID fileBuffer = NULL;
-    FILE_STANDARD_INFORMATION fileInfo = { 0 };
-
-    InitializeObjectAttributes(&objAttr, FilePath, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
+    if (!g_CacheEntries) return;
 
-    status = ZwCreateFile(
-        &fileHandle, GENERIC_READ | SYNCHRONIZE, &objAttr, &ioStatus,
-        NULL, FILE_ATTRIBUTE_NORMAL, FILE_SHARE_READ, FILE_OPEN,
-        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
-    if (!NT_SUCCESS(status)) {
-        SigLog("ZwCreateFile failed: 0x%08X", status);
-        return SignatureError;
-    }
-
-    status = ZwQueryInformationFile(fileHandle, &ioStatus, &fileInfo, sizeof(fileInfo), FileStandardInformation);
-    if (!NT_SUCCESS(status)) {
-        ZwClose(fileHandle);
-        return SignatureError;
-    }
+    HANDLE fileHandle = NULL;
+    if (!NT_SUCCESS(OpenVerdictStore(GENERIC_READ, FILE_OPEN, &fileHandle)))
+        return;
 
-    LARGE_INTEGER fileSize = fileInfo.EndOfFile;
-    if (fileSize.QuadPart > 100 * 1024 * 1024 || fileSize.QuadPart < 256) {
+    IO_STATUS_BLOCK ioStatus = { 0 };
+    FILE_STANDARD_INFORMATION stdInfo = { 0 };
+    NTSTATUS status = ZwQueryInformationFile(fileHandle, &ioStatus, &stdInfo, sizeof(stdInfo), FileStandardInformation);
+    if (!NT_SUCCESS(status) ||
+        stdInfo.EndOfFile.QuadPart > VerdictStoreSize(VERDICT_STORE_MAX_RECORDS)) {
         ZwClose(fileHandle);
-        return SignatureError;
+        return;
     }
 
-    fileBuffer = SigAllocMem((SIZE_T)fileSize.QuadPart);
-    if (!fileBuffer) {
+    ULONG size = (ULONG)stdInfo.EndOfFile.QuadPart;
+    PVOID buffer = SigAllocMem(size ? size : 1);
+    if (!buffer) {
         ZwClose(fileHandle);
-        return SignatureError;
+        return;
     }
 
-    LARGE_INTEGER offset = { 0 };
-    status = ZwReadFile(fileHandle, NULL, NULL, NULL, &ioStatus,
-        fileBuffer, (ULONG)fileSize.QuadPart, &offset, NULL);
+    status = ReadFileAt(fileHandle, 0, buffer, size);
     ZwClose(fileHandle);
 
-    if (!NT_SUCCESS(status)) {
-        SigFreeMem(fileBuffer);
-        return SignatureError;
-    }
-
-    PIMAGE_DOS_HEADER dosHeader = (PIMAGE_DOS_HEADER)fileBuffer;
-    if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
-        SigFreeMem(fileBuffer);
-        return SignatureInvalid;
-    }
-
-    if (dosHeader->e_lfanew < 0 ||
-        (ULONG)dosHeader->e_lfanew + sizeof(IMAGE_NT_HEADERS) > (ULONG)fileSize.QuadPart) {
-        SigFreeMem(fileBuffer);
-        return SignatureInvalid;
-    }
-
-    PIMAGE_NT_HEADERS ntHeaders = (PIMAGE_NT_HEADERS)((ULONG_PTR)fileBuffer + dosHeader->e_lfanew);
-    if (ntHeaders->Signature != IMAGE_NT_SIGNATURE) {
-        SigFreeMem(fileBuffer);
-        return SignatureInvalid;
-    }
-
-    PIMAGE_DATA_DIRECTORY securityDir;
-    if (ntHeaders->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
-        PIMAGE_NT_HEADERS64 nt64 = (PIMAGE_NT_HEADERS64)((ULONG_PTR)fileBuffer + dosHeader->e_lfanew);
-        securityDir = &nt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY];
-    } else {
-        securityDir = &ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY];
-    }
-
-    if (securityDir->VirtualAddress == 0 || securityDir->Size == 0) {
-        SigLog("No security directory - file is not signed");
-        SigFreeMem(fileBuffer);
-        return SignatureNotFound;
-    }
-
-    ULONG certOffset = securityDir->VirtualAddress;
-    if ((LONGLONG)certOffset + securityDir->Size > fileSize.QuadPart) {
-        SigLog("SecVA out of range, scanning file tail");
-        certOffset = 0;
-        ULONG scanStart = (ULONG)fileSize.QuadPart > 0x1000 ? (ULONG)fileSize.QuadPart - 0x1000 : 0;
-        for (ULONG i = scanStart; i + 8 < (ULONG)fileSize.QuadPart; i++) {
-            PUCHAR p = (PUCHAR)fileBuffer + i;
-            ULONG  dwLen = *(ULONG*)p;
-            USHORT wType = *(USHORT*)(p + 6);
-            if (wType == WIN_CERT_TYPE_PKCS_SIGNED_DATA &&
-                dwLen > 8 && dwLen < 0x4000 &&
-                (LONGLONG)i + dwLen <= fileSize.QuadPart &&
-                p[8] == 0x30) {
-                certOffset = i;
-                SigLog("Found WIN_CERTIFICATE at 0x%X", certOffset);
-                break;
-            }
+    const VERDICT_STORE_RECORD* records;
+    ULONG count;
+    if (NT_SUCCESS(status) && VerdictStoreOpen(buffer, size, TRUSTED_CERT_THUMBPRINT, &records, &count)) {
+        // Stored MRU first; insert oldest first so the LRU order survives
+        if (count > g_CacheCapacity) count = g_CacheCapacity;
+        for (ULONG i = count; i-- > 0; ) {
+            SIG_FILE_IDENTITY identity;
+            RtlZeroMemory(&identity, sizeof(identity));
+            identity.VolumeSerial  = records[i].VolumeSerial;
+            RtlCopyMemory(identity.FileId, records[i].FileId, sizeof(identity.FileId));
+            identity.FileSize      = records[i].FileSize;
+            identity.UsnJournalId  = records[i].UsnJournalId;
+            identity.Usn           = records[i].Usn;
+            if (records[i].Status <= (ULONG)SignatureExpired)
+                CacheInsert(&identity, (SIGNATURE_STATUS)records[i].Status, records[i].ImageHash);
         }
-        if (certOffset == 0) {
-            SigFreeMem(fileBuffer);
-            return SignatureInvalid;
-        }
-    }
-
-    PWIN_CERTIFICATE cert = (PWIN_CERTIFICATE)((ULONG_PTR)fileBuffer + certOffset);
-    if (cert->wCertificateType != WIN_CERT_TYPE_PKCS_SIGNED_DATA) {
-        SigFreeMem(fileBuffer);
-        return SignatureInvalid;
+        SigLog("Loaded %u verdicts from store", count);
+    } else {
+        SigLog("Verdict store missing or rejected");
     }
 
-    ULONG maxCertLen = (ULONG)fileSize.QuadPart - certOffset;
-    if (cert->dwLength < sizeof(WIN_CERTIFICATE) || cert->dwLength > maxCertLen) {
-        SigFreeMem(fileBuffer);
-        return SignatureInvalid;
-    }
+    SigFreeMem(buffer);
+}
 
-    PUCHAR pkcs7Data = cert->bCertificate;
-    ULONG pkcs7Len = cert->dwLength - FIELD_OFFSET(WIN_CERTIFICATE, bCertificate);
+static VOID SaveVerdictStore(VOID)
+{
+    if (!g_CacheEntries) return;
 
-    if (pkcs7Len < 4 || pkcs7Data[0] != 0x30) {
-        SigFreeMem(fileBuffer);
-        return SignatureInvalid;
-    }
+    PVOID buffer = SigAllocMem(VerdictStoreSize(g_CacheCapacity));
+    if (!buffer) return;
 
-    // Step 1: Calculate Authenticode hash
-    UCHAR authenticodeHash[32];
-    BOOLEAN isAuthSHA256 = FALSE;
-    if (!CalculateAuthenticodeHash(fileBuffer, (ULONG)fileSize.QuadPart, authenticodeHash, &isAuthSHA256)) {
-        SigFreeMem(fileBuffer);
-        return SignatureInvalid;
+    // Snapshot under the lock into pool, write after releasing it
+    PVERDICT_STORE_RECORD records = VerdictStoreRecords(buffer);
+    ULONG count = 0;
+    KIRQL oldIrql;
+    KeAcquireSpinLock(&g_SignatureCacheLock, &oldIrql);
+    for (PLIST_ENTRY e = g_CacheLru.Flink; e != &g_CacheLru && count < g_CacheCapacity; e = e->Flink) {
+        PSIGNATURE_CACHE_ENTRY entry = CONTAINING_RECORD(e, SIGNATURE_CACHE_ENTRY, LruLink);
+        PVERDICT_STORE_RECORD record = &records[count++];
+        RtlZeroMemory(record, sizeof(*record));
+        record->VolumeSerial  = entry->Identity.VolumeSerial;
+        RtlCopyMemory(record->FileId, entry->Identity.FileId, sizeof(record->FileId));
+        record->FileSize      = entry->Identity.FileSize;
+        record->UsnJournalId  = entry->Identity.UsnJournalId;
+        record->Usn           = entry->Identity.Usn;
+        RtlCopyMemory(record->ImageHash, entry->ImageHash, sizeof(record->ImageHash));
+        record->Status        = (ULONG)entry->Status;
     }
+    KeReleaseSpinLock(&g_SignatureCacheLock, oldIrql);
 
-    // Step 2: Extract messageDigest from PKCS7
-    UCHAR messageDigest[32];
-    ULONG messageDigestLen = 0;
-    BOOLEAN isPkcs7SHA256 = FALSE;
-    if (!ExtractMessageDigest(pkcs7Data, pkcs7Len, messageDigest, &messageDigestLen, &isPkcs7SHA256, authenticodeHash)) {
-        SigFreeMem(fileBuffer);
-        return SignatureInvalid;
-    }
+    VerdictStoreSeal(buffer, count, TRUSTED_CERT_THUMBPRINT);
 
-    // Step 3: Compare hashes
-    if (messageDigestLen == 32) {
-        if (RtlCompareMemory(authenticodeHash, messageDigest, 32) != 32) {
-            SigLog("Authenticode SHA256 hash mismatch - file has been tampered");
-            SigFreeMem(fileBuffer);
-            return SignatureInvalid;
-        }
-        SigLog("Authenticode SHA256 hash verified");
-    } else {
-        SigFreeMem(fileBuffer);
-        return SignatureInvalid;
+    HANDLE fileHandle = NULL;
+    NTSTATUS status = OpenVerdictStore(GENERIC_WRITE, FILE_OVERWRITE_IF, &fileHandle);
+    if (NT_SUCCESS(status)) {
+        IO_STATUS_BLOCK ioStatus = { 0 };
+        LARGE_INTEGER offset = { 0 };
+        status = ZwWriteFile(fileHandle, NULL, NULL, NULL, &ioStatus,
+            buffer, VerdictStoreSize(count), &offset, NULL);
+        ZwClose(fileHandle);
     }
+    SigLog("Saved %u verdicts to store: 0x%08X", count, status);
 
-    // Step 4: Verify certificate thumbprint
-    PUCHAR certDerData = NULL;
-    ULONG certDerLen = 0;
-
-    for (ULONG i = 0; i + 4 <= pkcs7Len; i++) {
-        if (pkcs7Data[i] != 0x30 || pkcs7Data[i + 1] != 0x82) continue;
-
-        ULONG cl = ((ULONG)pkcs7Data[i + 2] << 8 | pkcs7Data[i + 3]) + 4;
-        if (cl < 64 || cl >= pkcs7Len || i + cl > pkcs7Len) continue;
+    SigFreeMem(buffer);
+}
 
-        SHA1_CTX tmpCtx;
-        UCHAR tmpThumb[20];
-        SHA1Init(&tmpCtx);
-        SHA1Update(&tmpCtx, &pkcs7Data[i], cl);
-        SHA1Final(tmpThumb, &tmpCtx);
+// ================================================================
+// Configuration
+// ================================================================
 
-        if (CompareThumbprint(tmpThumb, TRUSTED_CERT_THUMBPRINT)) {
-            certDerData = &pkcs7Data[i];
-            certDerLen = cl;
-            SigLog("Found matching cert at pkcs7+0x%X len=%u", i, cl);
-            break;
+//
+// Reads a REG_DWORD from <service key>\Parameters. Returns Default when the
+// key or value is missing or has the wrong type.
+//
+static ULONG QueryParameterDword(PUNICODE_STRING RegistryPath, PCWSTR ValueName, ULONG Default)
+{
+    if (!RegistryPath || !RegistryPath->Buffer) return Default;
+
+    OBJECT_ATTRIBUTES objAttr;
+    HANDLE serviceKey = NULL, paramsKey = NULL;
+    ULONG result = Default;
+
+    InitializeObjectAttributes(&objAttr, RegistryPath, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
+    if (!NT_SUCCESS(ZwOpenKey(&serviceKey, KEY_READ, &objAttr))) return Default;
+
+    UNICODE_STRING subKey = RTL_CONSTANT_STRING(L"Parameters");
+    InitializeObjectAttributes(&objAttr, &subKey, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, serviceKey, NULL);
+    if (NT_SUCCESS(ZwOpenKey(&paramsKey, KEY_READ, &objAttr))) {
+        UNICODE_STRING valueName;
+        RtlInitUnicodeString(&valueName, ValueName);
+
+        UCHAR buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)] = { 0 };
+        PKEY_VALUE_PARTIAL_INFORMATION info = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
+        ULONG resultLen = 0;
+        if (NT_SUCCESS(ZwQueryValueKey(paramsKey, &valueName, KeyValuePartialInformation,
+                info, sizeof(buffer), &resultLen)) &&
+            info->Type == REG_DWORD && info->DataLength == sizeof(ULONG)) {
+            result = *(ULONG UNALIGNED*)info->Data;
         }
+        ZwClose(paramsKey);
     }
 
-    if (!certDerData || certDerLen == 0) {
-        SigLog("No matching certificate found in PKCS#7");
-        SigFreeMem(fileBuffer);
-        return SignatureUntrusted;
-    }
-
-    SigLog("Full Authenticode verification passed");
-    SigFreeMem(fileBuffer);
-    return SignatureValid;
+    ZwClose(serviceKey);
+    return result;
 }
 
 // ================================================================
@@ -666,18 +551,48 @@ static SIGNATURE_STATUS VerifyPESignatureFromFile(PUNICODE_STRING FilePath)
 // ================================================================
 
 //
-// Process signature cache
+// Looks up or computes the verdict for an image path. Only the file
+// metadata is read on a cache hit; the image is hashed on a miss.
 //
-typedef struct _SIGNATURE_CACHE_ENTRY {
-    ULONG ProcessId;
-    LARGE_INTEGER LastVerified;
-    SIGNATURE_STATUS Status;
-} SIGNATURE_CACHE_ENTRY, *PSIGNATURE_CACHE_ENTRY;
+static SIGNATURE_STATUS VerifyImageCached(PUNICODE_STRING FilePath)
+{
+    HANDLE fileHandle = NULL;
+    if (!NT_SUCCESS(OpenImageFile(FilePath, &fileHandle)))
+        return SignatureError;
+
+    SIG_FILE_IDENTITY identity;
+    NTSTATUS status = QueryFileIdentity(FilePath, fileHandle, &identity);
+    if (!NT_SUCCESS(status)) {
+        // No identity user mode cannot forge (no file IDs or no USN journal):
+        // verify uncached, nothing reaches the cache or the store
+        SigLog("QueryFileIdentity failed: 0x%08X", status);
+        FILE_STANDARD_INFORMATION stdInfo = { 0 };
+        IO_STATUS_BLOCK ioStatus = { 0 };
+        SIGNATURE_STATUS result = SignatureError;
+        UCHAR imageHash[32];
+        if (NT_SUCCESS(ZwQueryInformationFile(fileHandle, &ioStatus, &stdInfo, sizeof(stdInfo), FileStandardInformation)))
+            result = VerifyPESignatureFromHandle(fileHandle, stdInfo.EndOfFile.QuadPart, imageHash);
+        ZwClose(fileHandle);
+        return result;
+    }
 
-#define MAX_SIGNATURE_CACHE_ENTRIES 16
-static SIGNATURE_CACHE_ENTRY g_SignatureCache[MAX_SIGNATURE_CACHE_ENTRIES] = { 0 };
-static KSPIN_LOCK g_SignatureCacheLock;
-static BOOLEAN g_SignatureCacheInitialized = FALSE;
+    SIGNATURE_STATUS result;
+    if (CacheLookup(&identity, &result)) {
+        SigStatsCount(SigCounterContentHit);
+        ZwClose(fileHandle);
+        return result;
+    }
+    SigStatsCount(SigCounterMiss);
+
+    UCHAR imageHash[32];
+    result = VerifyPESignatureFromHandle(fileHandle, identity.FileSize, imageHash);
+    ZwClose(fileHandle);
+
+    // SignatureError means I/O or allocation trouble, not a property of the file
+    if (result != SignatureError)
+        CacheInsert(&identity, result, imageHash);
+    return result;
+}
 
 //
 // Verify caller signature with caching
@@ -686,86 +601,123 @@ SIGNATURE_STATUS VerifyCallerSignature(VOID)
 {
     NTSTATUS status = STATUS_SUCCESS;
     ULONG currentPid = (ULONG)(ULONG_PTR)PsGetCurrentProcessId();
-    
+
     // System process is always trusted
     if (currentPid == 4) {
         return SignatureValid;
     }
-    
-    // Initialize lock if needed
-    if (!g_SignatureCacheInitialized) {
-        KeInitializeSpinLock(&g_SignatureCacheLock);
-        g_SignatureCacheInitialized = TRUE;
-    }
-    
-    // Check cache
-    KIRQL oldIrql;
-    KeAcquireSpinLock(&g_SignatureCacheLock, &oldIrql);
-    for (ULONG i = 0; i < MAX_SIGNATURE_CACHE_ENTRIES; i++) {
-        if (g_SignatureCache[i].ProcessId == currentPid) {
-            SIGNATURE_STATUS cachedStatus = g_SignatureCache[i].Status;
-            KeReleaseSpinLock(&g_SignatureCacheLock, oldIrql);
-            // SigLog("Using cached signature status for PID %u: %d", currentPid, cachedStatus);
-            return cachedStatus;
-        }
+
+    LONGLONG createTime = PsGetProcessCreateTimeQuadPart(PsGetCurrentProcess());
+
+    SIGNATURE_STATUS sigStatus;
+    BOOLEAN prewarmed;
+    if (PidIndexLookup(currentPid, createTime, &sigStatus, &prewarmed)) {
+        SigStatsCount(SigCounterPidIndexHit);
+        if (prewarmed) SignaturePrewarmNoteLookup(TRUE);
+        return sigStatus;
     }
-    KeReleaseSpinLock(&g_SignatureCacheLock, oldIrql);
-    
-    SigLog("Verifying signature for PID %u (not in cache)", currentPid);
-    
+    SignaturePrewarmNoteLookup(FALSE);
+
+    SigLog("Verifying signature for PID %u (not in PID index)", currentPid);
+
     WCHAR pathBuffer[520] = { 0 };
     UNICODE_STRING imagePath = { 0 };
-    
+
     imagePath.Buffer = pathBuffer;
     imagePath.MaximumLength = sizeof(pathBuffer);
     imagePath.Length = 0;
-    
+
     status = GetCallerImagePath(&imagePath);
     if (!NT_SUCCESS(status)) {
         SigLog("GetCallerImagePath failed: 0x%08X", status);
         return SignatureError;
     }
-    
-    SIGNATURE_STATUS sigStatus = VerifyFileSignature(&imagePath);
-    
-    // Update cache
-    KeAcquireSpinLock(&g_SignatureCacheLock, &oldIrql);
-    // Find empty slot or use a slot (simple round-robin would be better, but just use first empty for now)
-    BOOLEAN cached = FALSE;
-    for (ULONG i = 0; i < MAX_SIGNATURE_CACHE_ENTRIES; i++) {
-        if (g_SignatureCache[i].ProcessId == 0) {
-            g_SignatureCache[i].ProcessId = currentPid;
-            KeQuerySystemTime(&g_SignatureCache[i].LastVerified);
-            g_SignatureCache[i].Status = sigStatus;
-            cached = TRUE;
-            break;
-        }
-    }
-    // If full, overwrite slot 0
-    if (!cached) {
-        g_SignatureCache[0].ProcessId = currentPid;
-        KeQuerySystemTime(&g_SignatureCache[0].LastVerified);
-        g_SignatureCache[0].Status = sigStatus;
-    }
-    KeReleaseSpinLock(&g_SignatureCacheLock, oldIrql);
-    
+
+    sigStatus = VerifyImageCached(&imagePath);
+    if (sigStatus != SignatureError)
+        PidIndexInsert(currentPid, createTime, sigStatus, FALSE);
+
+    return sigStatus;
+}
+
+SIGNATURE_STATUS PrewarmProcessSignature(ULONG ProcessId, LONGLONG CreateTime, PUNICODE_STRING ImagePath)
+{
+    SIGNATURE_STATUS sigStatus = VerifyImageCached(ImagePath);
+    if (sigStatus != SignatureError)
+        PidIndexInsert(ProcessId, CreateTime, sigStatus, TRUE);
     return sigStatus;
 }
 
+VOID PrewarmRecordSignature(ULONG ProcessId, LONGLONG CreateTime, SIGNATURE_STATUS Status)
+{
+    if (Status != SignatureError)
+        PidIndexInsert(ProcessId, CreateTime, Status, TRUE);
+}
+
+VOID GetSignatureStats(PSIGNATURE_STATS Stats)
+{
+    QuerySignatureStats(Stats, g_CacheCapacity);
+}
+
 SIGNATURE_STATUS VerifyFileSignature(PUNICODE_STRING FilePath)
 {
     if (!FilePath || FilePath->Length == 0) return SignatureError;
     SigLog("Verifying signature for: %wZ", FilePath);
-    return VerifyPESignatureFromFile(FilePath);
+    return VerifyImageCached(FilePath);
 }
 
-NTSTATUS InitializeSignatureVerification(VOID)
+NTSTATUS InitializeSignatureVerification(PUNICODE_STRING RegistryPath)
 {
-    SigLog("Signature verification initialized (thumbprint mode)");
+    SHA_ENGINE engine = ShaSelectEngine();
+    UNREFERENCED_PARAMETER(engine);
+
+    KeInitializeSpinLock(&g_SignatureCacheLock);
+
+    // Metrics are best effort; verification works without them
+    if (!NT_SUCCESS(InitializeSignatureStats()))
+        SigLog("Signature stats allocation failed");
+
+    ULONG capacity = QueryParameterDword(RegistryPath, L"SignatureCacheCapacity", SIG_CACHE_DEFAULT_CAPACITY);
+    if (capacity < SIG_CACHE_MIN_CAPACITY) capacity = SIG_CACHE_MIN_CAPACITY;
+    if (capacity > SIG_CACHE_MAX_CAPACITY) capacity = SIG_CACHE_MAX_CAPACITY;
+
+    // Without the content cache every miss in the PID index re-hashes, which
+    // is slow but still correct
+    NTSTATUS status = CacheAllocate(capacity);
+    if (NT_SUCCESS(status))
+        LoadVerdictStore();
+    else
+        SigLog("Signature cache allocation failed, running uncached");
+
+    // Opt-in: verifying every new process system-wide costs background I/O
+    if (QueryParameterDword(RegistryPath, L"SignaturePrewarm", 0) != 0) {
+        status = StartSignaturePrewarm();
+        if (!NT_SUCCESS(status))
+            SigLog("Signature prewarm not started: 0x%08X", status);
+    }
+
+    SigLog("Signature verification initialized (thumbprint mode, %s, cache %u, prewarm %s)",
+        engine == ShaEngineShaNi ? "SHA-NI" : "scalar", g_CacheCapacity,
+        IsSignaturePrewarmRunning() ? "on" : "off");
     return STATUS_SUCCESS;
 }
 
 VOID CleanupSignatureVerification(VOID)
 {
+    // The worker writes into the caches, stop it before freeing them
+    StopSignaturePrewarm();
+
+    SaveVerdictStore();
+
+    if (g_CacheEntries) {
+        ExFreePoolWithTag(g_CacheEntries, SIGNATURE_TAG);
+        g_CacheEntries = NULL;
+    }
+    if (g_CacheBuckets) {
+        ExFreePoolWithTag(g_CacheBuckets, SIGNATURE_TAG);
+        g_CacheBuckets = NULL;
+    }
+    g_CacheCapacity = 0;
+    CleanupSignatureStats();
     SigLog("Signature verification cleaned up");
 }
@@ -6,25 +6,20 @@
 // Uses certificate SHA1 thumbprint for verification
 //
 
-#include <ntddk.h>
-
-// Certificate: WinDriverLoader (O=Admilk)
-// SHA1 thumbprint of the trusted signing certificate (40 hex chars, uppercase)
-#define TRUSTED_CERT_THUMBPRINT "E723BD5F5C61A0541945A3640F3FEFFE3F090D69"
+#include "driver.h"
+#include "authenticode.h"
 
 #define SIGNATURE_TAG 'GiSK'
 
-typedef enum _SIGNATURE_STATUS {
-    SignatureValid = 0,
-    SignatureNotFound,
-    SignatureInvalid,
-    SignatureUntrusted,
-    SignatureExpired,
-    SignatureError
-} SIGNATURE_STATUS;
-
 SIGNATURE_STATUS VerifyCallerSignature(VOID);
 SIGNATURE_STATUS VerifyFileSignature(PUNICODE_STRING FilePath);
 NTSTATUS GetCallerImagePath(PUNICODE_STRING ImagePath);
-NTSTATUS InitializeSignatureVerification(VOID);
+// Verifies the main image of a process that has not opened the device yet
+// and records the verdict for its (PID, create time). Used by prewarm.cpp.
+SIGNATURE_STATUS PrewarmProcessSignature(ULONG ProcessId, LONGLONG CreateTime, PUNICODE_STRING ImagePath);
+// Records a verdict PrewarmProcessSignature returned for another process
+// started from the same image path
+VOID PrewarmRecordSignature(ULONG ProcessId, LONGLONG CreateTime, SIGNATURE_STATUS Status);
+NTSTATUS InitializeSignatureVerification(PUNICODE_STRING RegistryPath);
 VOID CleanupSignatureVerification(VOID);
+VOID GetSignatureStats(PSIGNATURE_STATS Stats);
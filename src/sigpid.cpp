@@ -0,0 +1,78 @@
+//
+// (PID, create time) -> verdict index
+//
+
+#include "sigpid.h"
+
+//
+// Each PID slot is a seqlock: Sequence is odd while a writer is updating it.
+// Readers never take a lock or write shared memory, they only retry if a
+// write overlapped their read. Writers claim a slot by CAS-ing Sequence
+// from even to odd at DISPATCH_LEVEL, so a claimed slot is never held
+// across a context switch. Slots are cache-line sized so lookups for
+// different PIDs don't share lines.
+//
+typedef struct DECLSPEC_CACHEALIGN _SIGNATURE_PID_SLOT {
+    volatile LONG     Sequence;
+    volatile LONG     ProcessId;
+    volatile LONG64   CreateTime;
+    volatile LONG     Status;
+    volatile LONG     Prewarmed;    // filled by the prewarm worker, not by an open
+} SIGNATURE_PID_SLOT, *PSIGNATURE_PID_SLOT;
+
+static SIGNATURE_PID_SLOT g_PidIndex[SIG_PID_INDEX_SIZE] = { 0 };
+
+static PSIGNATURE_PID_SLOT PidSlotFor(ULONG ProcessId)
+{
+    // PIDs are multiples of 4
+    return &g_PidIndex[(ProcessId >> 2) & (SIG_PID_INDEX_SIZE - 1)];
+}
+
+BOOLEAN PidIndexLookup(
+    ULONG ProcessId, LONGLONG CreateTime, SIGNATURE_STATUS* Status, PBOOLEAN Prewarmed)
+{
+    PSIGNATURE_PID_SLOT slot = PidSlotFor(ProcessId);
+    LONG seq, pid, status, prewarmed;
+    LONG64 createTime;
+
+    for (;;) {
+        seq = ReadAcquire(&slot->Sequence);
+        if (seq & 1) {
+            YieldProcessor();
+            continue;
+        }
+        pid        = ReadAcquire(&slot->ProcessId);
+        createTime = ReadAcquire64(&slot->CreateTime);
+        status     = ReadAcquire(&slot->Status);
+        prewarmed  = ReadAcquire(&slot->Prewarmed);
+        if (ReadAcquire(&slot->Sequence) == seq) break;
+    }
+
+    if ((ULONG)pid != ProcessId || createTime != CreateTime) return FALSE;
+    *Status = (SIGNATURE_STATUS)status;
+    *Prewarmed = (prewarmed != 0);
+    return TRUE;
+}
+
+VOID PidIndexInsert(
+    ULONG ProcessId, LONGLONG CreateTime, SIGNATURE_STATUS Status, BOOLEAN Prewarmed)
+{
+    PSIGNATURE_PID_SLOT slot = PidSlotFor(ProcessId);
+    KIRQL oldIrql;
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+
+    LONG seq;
+    for (;;) {
+        seq = ReadNoFence(&slot->Sequence);
+        if (!(seq & 1) && InterlockedCompareExchange(&slot->Sequence, seq + 1, seq) == seq) break;
+        YieldProcessor();
+    }
+
+    WriteRelease(&slot->ProcessId, (LONG)ProcessId);
+    WriteRelease64(&slot->CreateTime, CreateTime);
+    WriteRelease(&slot->Status, (LONG)Status);
+    WriteRelease(&slot->Prewarmed, Prewarmed ? 1 : 0);
+    WriteRelease(&slot->Sequence, seq + 2);
+
+    KeLowerIrql(oldIrql);
+}
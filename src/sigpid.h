@@ -0,0 +1,24 @@
+#pragma once
+
+//
+// (PID, create time) -> verdict index consulted by every device open
+//
+// A small direct-mapped table of cache-line sized seqlock slots. Lookups
+// take no lock and write no shared memory; inserts overwrite whatever
+// process held the slot. Split out of signature.cpp so the host shim can
+// build and stress it.
+//
+
+#include "driver.h"
+#include "authenticode.h"
+
+#define SIG_PID_INDEX_SIZE  64      // power of two
+
+// Any IRQL <= DISPATCH_LEVEL. Returns FALSE unless the slot holds exactly
+// this (PID, create time).
+BOOLEAN PidIndexLookup(
+    ULONG ProcessId, LONGLONG CreateTime, SIGNATURE_STATUS* Status, PBOOLEAN Prewarmed);
+
+// IRQL <= DISPATCH_LEVEL
+VOID PidIndexInsert(
+    ULONG ProcessId, LONGLONG CreateTime, SIGNATURE_STATUS Status, BOOLEAN Prewarmed);
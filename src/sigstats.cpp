@@ -0,0 +1,120 @@
+//
+// Signature verification metrics
+//
+
+#include "sigstats.h"
+#include "prewarm.h"
+
+typedef struct DECLSPEC_CACHEALIGN _SIG_CPU_STATS {
+    LONG64 Counters[SigCounterMax];
+    LONG64 Verdicts[SIGNATURE_STATS_VERDICTS];
+    LONG64 Latency[SigPhaseMax][SIGNATURE_STATS_BUCKETS];
+} SIG_CPU_STATS, *PSIG_CPU_STATS;
+
+static PSIG_CPU_STATS g_CpuStats = NULL;
+static ULONG g_CpuCount = 0;
+static ULONG64 g_TicksPerSecond = 0;
+
+//
+// Interlocked on the local CPU's block: uncontended, so the lock prefix
+// stays cheap, and still correct if the thread migrates between picking
+// the block and updating it.
+//
+static PSIG_CPU_STATS LocalStats(VOID)
+{
+    if (!g_CpuStats) return NULL;
+    ULONG cpu = KeGetCurrentProcessorNumberEx(NULL);
+    return &g_CpuStats[cpu < g_CpuCount ? cpu : 0];
+}
+
+static ULONG LatencyBucket(ULONG64 Ticks)
+{
+    ULONG64 us = g_TicksPerSecond ? Ticks * 1000000 / g_TicksPerSecond : 0;
+    ULONG index;
+    if (us < 2 || !_BitScanReverse64(&index, us)) return 0;
+    return index < SIGNATURE_STATS_BUCKETS ? index : SIGNATURE_STATS_BUCKETS - 1;
+}
+
+NTSTATUS InitializeSignatureStats(VOID)
+{
+    LARGE_INTEGER freq;
+    KeQueryPerformanceCounter(&freq);
+    g_TicksPerSecond = (ULONG64)freq.QuadPart;
+
+    g_CpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    g_CpuStats = (PSIG_CPU_STATS)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, (SIZE_T)g_CpuCount * sizeof(SIG_CPU_STATS), SIGSTATS_TAG);
+    if (!g_CpuStats) {
+        g_CpuCount = 0;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    return STATUS_SUCCESS;
+}
+
+VOID CleanupSignatureStats(VOID)
+{
+    if (g_CpuStats) {
+        ExFreePoolWithTag(g_CpuStats, SIGSTATS_TAG);
+        g_CpuStats = NULL;
+    }
+    g_CpuCount = 0;
+}
+
+VOID SigStatsCount(SIG_COUNTER Counter)
+{
+    PSIG_CPU_STATS stats = LocalStats();
+    if (stats) InterlockedIncrementNoFence64(&stats->Counters[Counter]);
+}
+
+VOID SigStatsVerdict(SIGNATURE_STATUS Status)
+{
+    PSIG_CPU_STATS stats = LocalStats();
+    if (stats && (ULONG)Status < SIGNATURE_STATS_VERDICTS)
+        InterlockedIncrementNoFence64(&stats->Verdicts[Status]);
+}
+
+VOID SigStatsLatency(SIG_PHASE Phase, ULONG64 Ticks)
+{
+    PSIG_CPU_STATS stats = LocalStats();
+    if (stats) InterlockedIncrementNoFence64(&stats->Latency[Phase][LatencyBucket(Ticks)]);
+}
+
+ULONG64 SigStatsNow(VOID)
+{
+    return (ULONG64)KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+VOID QuerySignatureStats(PSIGNATURE_STATS Stats, ULONG CacheCapacity)
+{
+    RtlZeroMemory(Stats, sizeof(*Stats));
+    Stats->Version       = SIGNATURE_STATS_VERSION;
+    Stats->Size          = sizeof(SIGNATURE_STATS);
+    Stats->CacheCapacity = CacheCapacity;
+
+    // Sums are not a consistent snapshot across CPUs, which is fine for
+    // monotonically increasing counters
+    for (ULONG cpu = 0; cpu < g_CpuCount; cpu++) {
+        const SIG_CPU_STATS* c = &g_CpuStats[cpu];
+        Stats->PidIndexHits     += (ULONG64)ReadNoFence64(&c->Counters[SigCounterPidIndexHit]);
+        Stats->ContentCacheHits += (ULONG64)ReadNoFence64(&c->Counters[SigCounterContentHit]);
+        Stats->Misses           += (ULONG64)ReadNoFence64(&c->Counters[SigCounterMiss]);
+        Stats->Evictions        += (ULONG64)ReadNoFence64(&c->Counters[SigCounterEviction]);
+        for (ULONG i = 0; i < SIGNATURE_STATS_VERDICTS; i++)
+            Stats->Verdicts[i] += (ULONG64)ReadNoFence64(&c->Verdicts[i]);
+        for (ULONG i = 0; i < SIGNATURE_STATS_BUCKETS; i++) {
+            Stats->ReadLatency[i]  += (ULONG64)ReadNoFence64(&c->Latency[SigPhaseRead][i]);
+            Stats->HashLatency[i]  += (ULONG64)ReadNoFence64(&c->Latency[SigPhaseHash][i]);
+            Stats->Pkcs7Latency[i] += (ULONG64)ReadNoFence64(&c->Latency[SigPhasePkcs7][i]);
+            Stats->TotalLatency[i] += (ULONG64)ReadNoFence64(&c->Latency[SigPhaseTotal][i]);
+        }
+    }
+
+    SIGNATURE_PREWARM_STATS prewarm;
+    GetSignaturePrewarmStats(&prewarm);
+    Stats->PrewarmQueued       = (ULONG)prewarm.Queued;
+    Stats->PrewarmDeduplicated = (ULONG)prewarm.Deduplicated;
+    Stats->PrewarmDropped      = (ULONG)prewarm.Dropped;
+    Stats->PrewarmVerified     = (ULONG)prewarm.Verified;
+    Stats->PrewarmHits         = (ULONG)prewarm.Hits;
+    Stats->PrewarmMisses       = (ULONG)prewarm.Misses;
+}
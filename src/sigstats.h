@@ -0,0 +1,43 @@
+#pragma once
+
+//
+// Signature verification metrics
+//
+// Counters and latency histograms are kept per CPU so the hot paths never
+// share a cache line; QuerySignatureStats sums them into the versioned
+// SIGNATURE_STATS returned by IOCTL_GET_SIGNATURE_STATS.
+//
+
+#include "driver.h"
+#include "signature.h"
+
+#define SIGSTATS_TAG 'tSsK'
+
+typedef enum _SIG_COUNTER {
+    SigCounterPidIndexHit = 0,
+    SigCounterContentHit,
+    SigCounterMiss,
+    SigCounterEviction,
+    SigCounterMax
+} SIG_COUNTER;
+
+typedef enum _SIG_PHASE {
+    SigPhaseRead = 0,
+    SigPhaseHash,
+    SigPhasePkcs7,
+    SigPhaseTotal,
+    SigPhaseMax
+} SIG_PHASE;
+
+NTSTATUS InitializeSignatureStats(VOID);
+VOID CleanupSignatureStats(VOID);
+
+VOID SigStatsCount(SIG_COUNTER Counter);
+VOID SigStatsVerdict(SIGNATURE_STATUS Status);
+VOID SigStatsLatency(SIG_PHASE Phase, ULONG64 Ticks);
+
+// Performance counter ticks; latencies are recorded in ticks and converted
+// to microseconds only when bucketed
+ULONG64 SigStatsNow(VOID);
+
+VOID QuerySignatureStats(PSIGNATURE_STATS Stats, ULONG CacheCapacity);
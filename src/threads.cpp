@@ -7,6 +7,7 @@
 
 #include <ntifs.h>
 #include "threads.h"
+#include "wire.h"
 
 typedef PETHREAD (NTAPI* PFN_PS_GET_NEXT_PROCESS_THREAD)(
     _In_ PEPROCESS Process,
@@ -57,10 +58,12 @@ static PFN_PS_GET_NEXT_PROCESS_THREAD ResolvePsGetNextProcessThread()
 //   KeQueryPriorityThread     → 当前优先级
 //   PsGetThreadWin32StartAddress → 用户态起始地址
 //   PsIsThreadTerminating     → 是否正在退出
+// 未请求的字段（THREAD_FIELD_*）不调用对应函数，保持为 0。
 //
 
 NTSTATUS ProcessEnumThreads(
     _In_  ULONG  ProcessId,
+    _In_  ULONG  Fields,
     _Out_ PVOID  OutputBuffer,
     _In_  ULONG  OutputBufferSize,
     _Out_ PULONG BytesWritten)
@@ -85,36 +88,41 @@ NTSTATUS ProcessEnumThreads(
     ULONG maxEntries = (OutputBufferSize - sizeof(THREAD_LIST_HEADER)) / sizeof(THREAD_INFO);
     ULONG count = 0;
 
+    // 放不下的线程继续遍历计数，溢出应答给出准确的 TotalSize；线程链表是活数据，不保留快照
     PETHREAD thread = getNextProcessThread(process, NULL);
-    while (thread != NULL && count < maxEntries) {
-        outEntry->ThreadId      = (ULONG)(ULONG_PTR)PsGetThreadId(thread);
-        outEntry->ProcessId     = ProcessId;
-        outEntry->Priority      = (LONG)KeQueryPriorityThread(thread);
-        outEntry->StartAddress  = getThreadWin32StartAddress
-            ? (ULONG64)getThreadWin32StartAddress(thread)
-            : 0;
-        outEntry->IsTerminating = PsIsThreadTerminating(thread) ? TRUE : FALSE;
+    while (thread != NULL) {
+        if (count < maxEntries) {
+            RtlZeroMemory(outEntry, sizeof(THREAD_INFO));
+            if (Fields & THREAD_FIELD_THREAD_ID)
+                outEntry->ThreadId = (ULONG)(ULONG_PTR)PsGetThreadId(thread);
+            if (Fields & THREAD_FIELD_PROCESS_ID)
+                outEntry->ProcessId = ProcessId;
+            if (Fields & THREAD_FIELD_PRIORITY)
+                outEntry->Priority = (LONG)KeQueryPriorityThread(thread);
+            if ((Fields & THREAD_FIELD_START_ADDRESS) && getThreadWin32StartAddress)
+                outEntry->StartAddress = (ULONG64)getThreadWin32StartAddress(thread);
+            if (Fields & THREAD_FIELD_TERMINATING)
+                outEntry->IsTerminating = PsIsThreadTerminating(thread) ? TRUE : FALSE;
+            outEntry++;
+        }
 
         count++;
-        outEntry++;
 
         PETHREAD next = getNextProcessThread(process, thread);
         ObDereferenceObject(thread);
         thread = next;
     }
 
-    // 释放剩余未处理的引用
-    while (thread) {
-        PETHREAD next = getNextProcessThread(process, thread);
-        ObDereferenceObject(thread);
-        thread = next;
-    }
-
     ObDereferenceObject(process);
 
+    ULONG totalSize = sizeof(THREAD_LIST_HEADER) + count * sizeof(THREAD_INFO);
+    if (count > maxEntries)
+        return WireListOverflow(OutputBuffer, totalSize, BytesWritten);
+
+    // 输出缓冲区可能直接映射自调用方，只写不回读
     header->Count     = count;
-    header->TotalSize = sizeof(THREAD_LIST_HEADER) + count * sizeof(THREAD_INFO);
-    *BytesWritten     = header->TotalSize;
+    header->TotalSize = totalSize;
+    *BytesWritten     = totalSize;
 
     DbgPrint("[OpenSysKit] [Thread] PID=%lu: %lu threads\n", ProcessId, count);
     return STATUS_SUCCESS;
@@ -1,4 +1,4 @@
 #pragma once
 #include "driver.h"
 
-NTSTATUS ProcessEnumThreads(ULONG ProcessId, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+NTSTATUS ProcessEnumThreads(ULONG ProcessId, ULONG Fields, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
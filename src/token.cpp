@@ -7,6 +7,7 @@
 
 #include <ntifs.h>
 #include "token.h"
+#include "proctable.h"
 
 typedef NTSTATUS (NTAPI* PFN_EX_ALLOCATE_LOCALLY_UNIQUE_ID)(
     _Out_ PLUID Luid
@@ -51,36 +52,6 @@ static __forceinline PVOID AtomicExchangePointerValue(
     return oldValue;
 }
 
-// ========== 系统进程信息结构 ==========
-
-typedef struct _SYSTEM_PROCESS_INFO {
-    ULONG          NextEntryOffset;
-    ULONG          NumberOfThreads;
-    LARGE_INTEGER  Reserved[3];
-    LARGE_INTEGER  CreateTime;
-    LARGE_INTEGER  UserTime;
-    LARGE_INTEGER  KernelTime;
-    UNICODE_STRING ImageName;
-    KPRIORITY      BasePriority;
-    HANDLE         UniqueProcessId;
-    HANDLE         InheritedFromUniqueProcessId;
-    ULONG          HandleCount;
-    ULONG          SessionId;
-    ULONG_PTR      PageDirectoryBase;
-    SIZE_T         PeakVirtualSize;
-    SIZE_T         VirtualSize;
-    ULONG          PageFaultCount;
-    SIZE_T         PeakWorkingSetSize;
-    SIZE_T         WorkingSetSize;
-} SYSTEM_PROCESS_INFO, *PSYSTEM_PROCESS_INFO;
-
-extern "C" NTSTATUS NTAPI ZwQuerySystemInformation(
-    ULONG  SystemInformationClass,
-    PVOID  SystemInformation,
-    ULONG  SystemInformationLength,
-    PULONG ReturnLength
-);
-
 // ZwCreateToken — 内核构造任意 Token
 typedef NTSTATUS (NTAPI* PFN_ZW_CREATE_TOKEN)(
     _Out_    PHANDLE             TokenHandle,
@@ -129,8 +100,6 @@ static PFN_ZW_CREATE_TOKEN ResolveZwCreateToken()
     return s_ZwCreateToken;
 }
 
-#define SystemProcessInformation 5
-
 // ========== Token 字段偏移 ==========
 
 static ULONG g_TokenOffset = 0;
@@ -224,6 +193,13 @@ static NTSTATUS SwapProcessToken(
 }
 
 // ========== 按进程名查找 EPROCESS ==========
+//
+// 同一次提权里会连续查找多次（先取会话再逐个候选），都查驱动自有的进程表（proctable.h），
+// 按 PID 取会话是一次散列查找，按名查找只顺序扫描一个紧凑数组，不查询系统。
+// 同名进程（如各会话的 winlogon.exe）一次取回至多 TOKEN_NAME_MATCHES 个，逐个核对。
+//
+
+#define TOKEN_NAME_MATCHES  16
 
 static NTSTATUS FindProcessByNameInternal(
     _In_     PCWSTR    targetName,
@@ -232,77 +208,39 @@ static NTSTATUS FindProcessByNameInternal(
 {
     *outProcess = nullptr;
 
-    ULONG bufSize = 0;
-    NTSTATUS status = ZwQuerySystemInformation(SystemProcessInformation, NULL, 0, &bufSize);
-    if (status != STATUS_INFO_LENGTH_MISMATCH) return status;
-
-    bufSize += 4096;
-    PVOID buf = ExAllocatePool2(POOL_FLAG_NON_PAGED, bufSize, 'koTk');
-    if (!buf) return STATUS_INSUFFICIENT_RESOURCES;
-
-    status = ZwQuerySystemInformation(SystemProcessInformation, buf, bufSize, &bufSize);
-    if (!NT_SUCCESS(status)) {
-        ExFreePoolWithTag(buf, 'koTk');
-        return status;
-    }
-
     UNICODE_STRING target;
     RtlInitUnicodeString(&target, targetName);
 
-    status = STATUS_NOT_FOUND;
-    PSYSTEM_PROCESS_INFO entry = (PSYSTEM_PROCESS_INFO)buf;
-
-    while (TRUE) {
-        if (entry->ImageName.Buffer && entry->UniqueProcessId != 0) {
-            if (RtlEqualUnicodeString(&entry->ImageName, &target, TRUE) &&
-                (SessionId == nullptr || entry->SessionId == *SessionId)) {
-                PEPROCESS proc = nullptr;
-                if (NT_SUCCESS(PsLookupProcessByProcessId(entry->UniqueProcessId, &proc))) {
-                    *outProcess = proc;
-                    status = STATUS_SUCCESS;
-                    break;
-                }
-            }
+    PROCESS_TABLE_MATCH matches[TOKEN_NAME_MATCHES];
+    ULONG count = 0;
+    NTSTATUS status = ProcessTableFindByName(&target, SessionId, matches, RTL_NUMBER_OF(matches), &count);
+    if (!NT_SUCCESS(status)) return status;
+
+    // 表中的进程可能刚退出、PID 已被复用；跳过这样的条目，继续核对后面的匹配
+    for (ULONG i = 0; i < count; i++) {
+        PEPROCESS proc = nullptr;
+        if (!NT_SUCCESS(PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)matches[i].ProcessId, &proc)))
+            continue;
+
+        if (PsGetProcessCreateTimeQuadPart(proc) != matches[i].CreateTime) {
+            ObDereferenceObject(proc);
+            continue;
         }
-        if (entry->NextEntryOffset == 0) break;
-        entry = (PSYSTEM_PROCESS_INFO)((PUCHAR)entry + entry->NextEntryOffset);
-    }
 
-    ExFreePoolWithTag(buf, 'koTk');
-    return status;
+        *outProcess = proc;
+        return STATUS_SUCCESS;
+    }
+    return STATUS_NOT_FOUND;
 }
 
 static NTSTATUS GetProcessSessionId(_In_ ULONG ProcessId, _Out_ PULONG SessionId)
 {
     *SessionId = 0;
 
-    ULONG bufSize = 0;
-    NTSTATUS status = ZwQuerySystemInformation(SystemProcessInformation, NULL, 0, &bufSize);
-    if (status != STATUS_INFO_LENGTH_MISMATCH) return status;
-
-    bufSize += 4096;
-    PVOID buf = ExAllocatePool2(POOL_FLAG_NON_PAGED, bufSize, 'koTk');
-    if (!buf) return STATUS_INSUFFICIENT_RESOURCES;
-
-    status = ZwQuerySystemInformation(SystemProcessInformation, buf, bufSize, &bufSize);
-    if (!NT_SUCCESS(status)) {
-        ExFreePoolWithTag(buf, 'koTk');
-        return status;
-    }
-
-    status = STATUS_NOT_FOUND;
-    PSYSTEM_PROCESS_INFO entry = (PSYSTEM_PROCESS_INFO)buf;
-    while (TRUE) {
-        if ((ULONG_PTR)entry->UniqueProcessId == (ULONG_PTR)ProcessId) {
-            *SessionId = entry->SessionId;
-            status = STATUS_SUCCESS;
-            break;
-        }
-        if (entry->NextEntryOffset == 0) break;
-        entry = (PSYSTEM_PROCESS_INFO)((PUCHAR)entry + entry->NextEntryOffset);
-    }
-
-    ExFreePoolWithTag(buf, 'koTk');
+    PROCESS_TABLE_ENTRY entry;
+    NTSTATUS status = ProcessTableLookup(ProcessId, &entry);
+    if (NT_SUCCESS(status))
+        *SessionId = entry.SessionId;
     return status;
 }
 
@@ -0,0 +1,85 @@
+//
+// On-disk format of the persistent signature verdict store
+//
+
+#include "verdict_store.h"
+#include "sha.h"
+
+static VOID CopyThumbprint(CHAR Dest[40], const CHAR* Thumbprint)
+{
+    ULONG i = 0;
+    for (; i < 40 && Thumbprint && Thumbprint[i]; i++)
+        Dest[i] = Thumbprint[i];
+    for (; i < 40; i++)
+        Dest[i] = 0;
+}
+
+static VOID ComputeChecksum(const VERDICT_STORE_HEADER* Header, const VOID* Records, UCHAR Checksum[32])
+{
+    VERDICT_STORE_HEADER copy = *Header;
+    RtlZeroMemory(copy.Checksum, sizeof(copy.Checksum));
+
+    SHA256_CTX ctx;
+    SHA256Init(&ctx);
+    SHA256Update(&ctx, (const UCHAR*)&copy, sizeof(copy));
+    SHA256Update(&ctx, (const UCHAR*)Records, Header->RecordCount * sizeof(VERDICT_STORE_RECORD));
+    SHA256Final(Checksum, &ctx);
+}
+
+ULONG VerdictStoreSize(ULONG RecordCount)
+{
+    return sizeof(VERDICT_STORE_HEADER) + RecordCount * sizeof(VERDICT_STORE_RECORD);
+}
+
+PVERDICT_STORE_RECORD VerdictStoreRecords(PVOID Buffer)
+{
+    return (PVERDICT_STORE_RECORD)((PUCHAR)Buffer + sizeof(VERDICT_STORE_HEADER));
+}
+
+VOID VerdictStoreSeal(PVOID Buffer, ULONG RecordCount, const CHAR* TrustedThumbprint)
+{
+    PVERDICT_STORE_HEADER header = (PVERDICT_STORE_HEADER)Buffer;
+    header->Magic       = VERDICT_STORE_MAGIC;
+    header->Version     = VERDICT_STORE_VERSION;
+    header->HeaderSize  = sizeof(VERDICT_STORE_HEADER);
+    header->RecordSize  = sizeof(VERDICT_STORE_RECORD);
+    header->RecordCount = RecordCount;
+    header->Reserved    = 0;
+    CopyThumbprint(header->TrustedThumbprint, TrustedThumbprint);
+    ComputeChecksum(header, VerdictStoreRecords(Buffer), header->Checksum);
+}
+
+BOOLEAN VerdictStoreOpen(
+    const VOID* Buffer, ULONG Size, const CHAR* TrustedThumbprint,
+    const VERDICT_STORE_RECORD** Records, PULONG RecordCount)
+{
+    *Records = NULL;
+    *RecordCount = 0;
+
+    if (!Buffer || Size < sizeof(VERDICT_STORE_HEADER)) return FALSE;
+
+    const VERDICT_STORE_HEADER* header = (const VERDICT_STORE_HEADER*)Buffer;
+    if (header->Magic != VERDICT_STORE_MAGIC ||
+        header->Version != VERDICT_STORE_VERSION ||
+        header->HeaderSize != sizeof(VERDICT_STORE_HEADER) ||
+        header->RecordSize != sizeof(VERDICT_STORE_RECORD) ||
+        header->RecordCount > VERDICT_STORE_MAX_RECORDS ||
+        Size != VerdictStoreSize(header->RecordCount))
+        return FALSE;
+
+    // Verdicts made against another trust anchor mean nothing now
+    CHAR thumbprint[40];
+    CopyThumbprint(thumbprint, TrustedThumbprint);
+    if (RtlCompareMemory(thumbprint, header->TrustedThumbprint, sizeof(thumbprint)) != sizeof(thumbprint))
+        return FALSE;
+
+    const VOID* records = (const UCHAR*)Buffer + sizeof(VERDICT_STORE_HEADER);
+    UCHAR checksum[32];
+    ComputeChecksum(header, records, checksum);
+    if (RtlCompareMemory(checksum, header->Checksum, sizeof(checksum)) != sizeof(checksum))
+        return FALSE;
+
+    *Records = (const VERDICT_STORE_RECORD*)records;
+    *RecordCount = header->RecordCount;
+    return TRUE;
+}
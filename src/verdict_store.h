@@ -0,0 +1,62 @@
+#pragma once
+
+//
+// On-disk format of the persistent signature verdict store
+//
+// Pure buffer serialization, no I/O: the driver reads/writes the file and
+// hands the bytes here. Layout (little endian, naturally aligned):
+//
+//   VERDICT_STORE_HEADER
+//   VERDICT_STORE_RECORD[RecordCount]   most recently used first
+//
+// Checksum is SHA-256 over the header (with Checksum zeroed) and all
+// records. A store written for a different trusted thumbprint, version
+// or record size is rejected as a whole.
+//
+
+#include "osk_types.h"
+
+#define VERDICT_STORE_MAGIC     0x56534B4F  // "OKSV"
+#define VERDICT_STORE_VERSION   2   // 1 keyed records on timestamps
+#define VERDICT_STORE_MAX_RECORDS 4096
+
+typedef struct _VERDICT_STORE_HEADER {
+    ULONG Magic;
+    ULONG Version;
+    ULONG HeaderSize;
+    ULONG RecordSize;
+    ULONG RecordCount;
+    ULONG Reserved;
+    CHAR  TrustedThumbprint[40];
+    UCHAR Checksum[32];
+} VERDICT_STORE_HEADER, *PVERDICT_STORE_HEADER;
+
+typedef struct _VERDICT_STORE_RECORD {
+    ULONG64  VolumeSerial;
+    UCHAR    FileId[16];
+    LONGLONG FileSize;
+    ULONG64  UsnJournalId;
+    LONGLONG Usn;
+    UCHAR    ImageHash[32];     // Authenticode SHA-256, zero if never computed
+    ULONG    Status;            // SIGNATURE_STATUS
+    ULONG    Reserved;
+} VERDICT_STORE_RECORD, *PVERDICT_STORE_RECORD;
+
+C_ASSERT(sizeof(VERDICT_STORE_HEADER) == 96);
+C_ASSERT(sizeof(VERDICT_STORE_RECORD) == 88);
+
+// Bytes needed for a store holding RecordCount records
+ULONG VerdictStoreSize(ULONG RecordCount);
+
+// Record array inside a store buffer of VerdictStoreSize() bytes
+PVERDICT_STORE_RECORD VerdictStoreRecords(PVOID Buffer);
+
+// Fills the header and checksum once the caller has written RecordCount
+// records into VerdictStoreRecords(Buffer)
+VOID VerdictStoreSeal(PVOID Buffer, ULONG RecordCount, const CHAR* TrustedThumbprint);
+
+// Validates a store read from disk. On success Records/RecordCount
+// describe the record array inside Buffer.
+BOOLEAN VerdictStoreOpen(
+    const VOID* Buffer, ULONG Size, const CHAR* TrustedThumbprint,
+    const VERDICT_STORE_RECORD** Records, PULONG RecordCount);
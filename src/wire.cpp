@@ -0,0 +1,249 @@
+#include "wire.h"
+
+// ========== v2 编码器 ==========
+//
+// 记录区与字符串表各自上限 1 GiB，保证 WireEmit 的总长度不溢出 ULONG。
+//
+
+#define WIRE_SECTION_LIMIT      0x40000000UL
+#define WIRE_INITIAL_STRINGS    4096
+#define WIRE_INITIAL_BUCKETS    256
+
+static NTSTATUS GrowSection(PUCHAR* Section, PULONG Capacity, ULONG Used, ULONG Needed)
+{
+    if (Needed <= *Capacity)
+        return STATUS_SUCCESS;
+    if (Needed > WIRE_SECTION_LIMIT)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    ULONG capacity = max(*Capacity, 64UL);
+    while (capacity < Needed)
+        capacity = (capacity > WIRE_SECTION_LIMIT / 2) ? WIRE_SECTION_LIMIT : capacity * 2;
+
+    PUCHAR grown = (PUCHAR)ExAllocatePool2(POOL_FLAG_NON_PAGED, capacity, WIRE_POOL_TAG);
+    if (!grown)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    if (*Section) {
+        RtlCopyMemory(grown, *Section, Used);
+        ExFreePoolWithTag(*Section, WIRE_POOL_TAG);
+    }
+
+    *Section  = grown;
+    *Capacity = capacity;
+    return STATUS_SUCCESS;
+}
+
+// FNV-1a，按 UTF-16 码元计算
+static ULONG HashString(const WCHAR* String, ULONG Length)
+{
+    ULONG hash = 2166136261UL;
+    for (ULONG i = 0; i < Length; ++i) {
+        hash ^= String[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+static const WCHAR* StoredString(const WIRE_ENCODER* Encoder, ULONG Offset, PULONG Length)
+{
+    USHORT chars = 0;
+    RtlCopyMemory(&chars, Encoder->Strings + Offset, sizeof(chars));
+    *Length = chars;
+    return (const WCHAR*)(Encoder->Strings + Offset + sizeof(USHORT));
+}
+
+static NTSTATUS RehashBuckets(PWIRE_ENCODER Encoder, ULONG BucketCount)
+{
+    PULONG buckets = (PULONG)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, BucketCount * sizeof(ULONG), WIRE_POOL_TAG);
+    if (!buckets)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    ULONG mask = BucketCount - 1;
+    if (Encoder->Buckets) {
+        for (ULONG i = 0; i <= Encoder->BucketMask; ++i) {
+            if (Encoder->Buckets[i] == 0)
+                continue;
+
+            ULONG length = 0;
+            const WCHAR* chars = StoredString(Encoder, Encoder->Buckets[i] - 1, &length);
+            ULONG slot = HashString(chars, length) & mask;
+            while (buckets[slot] != 0)
+                slot = (slot + 1) & mask;
+            buckets[slot] = Encoder->Buckets[i];
+        }
+        ExFreePoolWithTag(Encoder->Buckets, WIRE_POOL_TAG);
+    }
+
+    Encoder->Buckets    = buckets;
+    Encoder->BucketMask = mask;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WireEncoderInit(PWIRE_ENCODER Encoder, ULONG RecordSize, ULONG ExpectedRecords)
+{
+    RtlZeroMemory(Encoder, sizeof(*Encoder));
+
+    if (RecordSize == 0 || RecordSize % 8 != 0)
+        return STATUS_INVALID_PARAMETER;
+
+    Encoder->RecordSize = RecordSize;
+
+    ULONG records = max(ExpectedRecords, 16UL);
+    NTSTATUS status = (records > WIRE_SECTION_LIMIT / RecordSize)
+        ? STATUS_INSUFFICIENT_RESOURCES
+        : GrowSection(&Encoder->Records, &Encoder->RecordCapacity, 0, records * RecordSize);
+    if (NT_SUCCESS(status))
+        status = GrowSection(&Encoder->Strings, &Encoder->StringCapacity, 0, WIRE_INITIAL_STRINGS);
+    if (NT_SUCCESS(status))
+        status = RehashBuckets(Encoder, WIRE_INITIAL_BUCKETS);
+
+    if (!NT_SUCCESS(status)) {
+        WireEncoderFree(Encoder);
+        return status;
+    }
+
+    // 偏移 0 固定为空串
+    RtlZeroMemory(Encoder->Strings, sizeof(USHORT));
+    Encoder->StringSize = sizeof(USHORT);
+    return STATUS_SUCCESS;
+}
+
+VOID WireEncoderFree(PWIRE_ENCODER Encoder)
+{
+    if (Encoder->Records)
+        ExFreePoolWithTag(Encoder->Records, WIRE_POOL_TAG);
+    if (Encoder->Strings)
+        ExFreePoolWithTag(Encoder->Strings, WIRE_POOL_TAG);
+    if (Encoder->Buckets)
+        ExFreePoolWithTag(Encoder->Buckets, WIRE_POOL_TAG);
+
+    RtlZeroMemory(Encoder, sizeof(*Encoder));
+}
+
+PVOID WireAppendRecord(PWIRE_ENCODER Encoder)
+{
+    ULONG used = Encoder->Count * Encoder->RecordSize;
+
+    if (used > WIRE_SECTION_LIMIT - Encoder->RecordSize)
+        return NULL;
+    if (!NT_SUCCESS(GrowSection(&Encoder->Records, &Encoder->RecordCapacity,
+            used, used + Encoder->RecordSize))) {
+        return NULL;
+    }
+
+    PVOID record = Encoder->Records + used;
+    RtlZeroMemory(record, Encoder->RecordSize);
+    Encoder->Count++;
+    return record;
+}
+
+NTSTATUS WireCommitRecord(PWIRE_ENCODER Encoder, const VOID* Record)
+{
+    PVOID record = WireAppendRecord(Encoder);
+    if (!record)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlCopyMemory(record, Record, Encoder->RecordSize);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WireInternString(PWIRE_ENCODER Encoder, const WCHAR* String, ULONG Length, PULONG Offset)
+{
+    *Offset = ENUM_V2_EMPTY_STRING;
+
+    if (!String || Length == 0)
+        return STATUS_SUCCESS;
+    if (Length > ENUM_V2_MAX_STRING)
+        Length = ENUM_V2_MAX_STRING;
+
+    ULONG hash = HashString(String, Length);
+    ULONG slot = hash & Encoder->BucketMask;
+
+    while (Encoder->Buckets[slot] != 0) {
+        ULONG storedLength = 0;
+        const WCHAR* stored = StoredString(Encoder, Encoder->Buckets[slot] - 1, &storedLength);
+        if (storedLength == Length &&
+            RtlCompareMemory(stored, String, Length * sizeof(WCHAR)) == Length * sizeof(WCHAR)) {
+            *Offset = Encoder->Buckets[slot] - 1;
+            return STATUS_SUCCESS;
+        }
+        slot = (slot + 1) & Encoder->BucketMask;
+    }
+
+    ULONG entrySize = sizeof(USHORT) + Length * sizeof(WCHAR);
+    NTSTATUS status = GrowSection(&Encoder->Strings, &Encoder->StringCapacity,
+        Encoder->StringSize, Encoder->StringSize + entrySize);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    ULONG offset = Encoder->StringSize;
+    USHORT chars = (USHORT)Length;
+    RtlCopyMemory(Encoder->Strings + offset, &chars, sizeof(chars));
+    RtlCopyMemory(Encoder->Strings + offset + sizeof(USHORT), String, Length * sizeof(WCHAR));
+    Encoder->StringSize += entrySize;
+
+    Encoder->Buckets[slot] = offset + 1;
+    Encoder->Interned++;
+
+    // 负载超过 1/2 时扩容；失败不影响已写入的字符串，只是后续探测变长
+    if (Encoder->Interned * 2 > Encoder->BucketMask + 1)
+        RehashBuckets(Encoder, (Encoder->BucketMask + 1) * 2);
+
+    *Offset = offset;
+    return STATUS_SUCCESS;
+}
+
+ULONG WireEncodedSize(const WIRE_ENCODER* Encoder)
+{
+    return sizeof(ENUM_V2_HEADER) + Encoder->Count * Encoder->RecordSize + Encoder->StringSize;
+}
+
+NTSTATUS WireEmit(const WIRE_ENCODER* Encoder, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten)
+{
+    ULONG recordBytes = Encoder->Count * Encoder->RecordSize;
+    ENUM_V2_HEADER header;
+
+    *BytesWritten = 0;
+    if (OutputBufferSize < sizeof(ENUM_V2_HEADER))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    RtlZeroMemory(&header, sizeof(header));
+    header.Count        = Encoder->Count;
+    header.Version      = ENUM_VERSION_2;
+    header.RecordSize   = Encoder->RecordSize;
+    header.StringOffset = sizeof(ENUM_V2_HEADER) + recordBytes;
+    header.StringSize   = Encoder->StringSize;
+    header.TotalSize    = WireEncodedSize(Encoder);
+
+    // 输出缓冲区可能直接映射自调用方（METHOD_OUT_DIRECT），各区段整块写入，不回读
+    if (OutputBufferSize < header.TotalSize) {
+        header.Count        = 0;
+        header.StringOffset = sizeof(ENUM_V2_HEADER);
+        header.StringSize   = 0;
+        RtlCopyMemory(OutputBuffer, &header, sizeof(header));
+        *BytesWritten = sizeof(header);
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    PUCHAR out = (PUCHAR)OutputBuffer;
+    RtlCopyMemory(out, &header, sizeof(header));
+    RtlCopyMemory(out + sizeof(ENUM_V2_HEADER), Encoder->Records, recordBytes);
+    RtlCopyMemory(out + header.StringOffset, Encoder->Strings, Encoder->StringSize);
+
+    *BytesWritten = header.TotalSize;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WireListOverflow(PVOID OutputBuffer, ULONG TotalSize, PULONG BytesWritten)
+{
+    // v1 列表头均为 { Count, TotalSize }，调用方已保证输出不小于它
+    PROCESS_LIST_HEADER header;
+    header.Count     = 0;
+    header.TotalSize = TotalSize;
+    RtlCopyMemory(OutputBuffer, &header, sizeof(header));
+
+    *BytesWritten = sizeof(header);
+    return STATUS_BUFFER_OVERFLOW;
+}
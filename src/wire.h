@@ -0,0 +1,48 @@
+#pragma once
+
+#include "driver.h"
+
+#define WIRE_POOL_TAG 'eriW'
+
+// ========== v2 编码器 ==========
+//
+// 记录区与字符串表分别在非分页池中按需倍增，字符串经开放寻址哈希去重。
+// 用法：WireEncoderInit -> 循环 WireAppendRecord / WireInternString -> WireEmit -> WireEncoderFree。
+// WireAppendRecord 返回的指针在下一次 WireAppendRecord 之前有效。
+//
+
+typedef struct _WIRE_ENCODER {
+    ULONG  RecordSize;
+    ULONG  Count;
+    ULONG  RecordCapacity;
+    PUCHAR Records;
+
+    PUCHAR Strings;
+    ULONG  StringSize;
+    ULONG  StringCapacity;
+
+    PULONG Buckets;         // 字符串偏移 + 1，0 为空槽
+    ULONG  BucketMask;
+    ULONG  Interned;
+} WIRE_ENCODER, *PWIRE_ENCODER;
+
+NTSTATUS WireEncoderInit(PWIRE_ENCODER Encoder, ULONG RecordSize, ULONG ExpectedRecords);
+VOID WireEncoderFree(PWIRE_ENCODER Encoder);
+
+// 追加一条已清零的记录，内存不足返回 NULL
+PVOID WireAppendRecord(PWIRE_ENCODER Encoder);
+
+// 追加一条记录，复制 Record 的前 RecordSize 字节；记录按字段选择截短时用它
+NTSTATUS WireCommitRecord(PWIRE_ENCODER Encoder, const VOID* Record);
+
+// Length 为字符数，超过 ENUM_V2_MAX_STRING 的部分截断
+NTSTATUS WireInternString(PWIRE_ENCODER Encoder, const WCHAR* String, ULONG Length, PULONG Offset);
+
+// WireEmit 写出的总字节数（头部 + 记录区 + 字符串表）
+ULONG WireEncodedSize(const WIRE_ENCODER* Encoder);
+
+// 输出不足时只写 ENUM_V2_HEADER（Count=0，TotalSize=所需字节数）并返回 STATUS_BUFFER_OVERFLOW
+NTSTATUS WireEmit(const WIRE_ENCODER* Encoder, PVOID OutputBuffer, ULONG OutputBufferSize, PULONG BytesWritten);
+
+// v1 列表输出不足：写 { Count = 0, TotalSize } 并返回 STATUS_BUFFER_OVERFLOW
+NTSTATUS WireListOverflow(PVOID OutputBuffer, ULONG TotalSize, PULONG BytesWritten);
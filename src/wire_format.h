@@ -0,0 +1,297 @@
+#pragma once
+
+#include "osk_types.h"
+
+// ========== 枚举结果 v2 编码 ==========
+//
+// v1 的每条记录内嵌定长 WCHAR 数组（PROCESS_INFO 约 540 字节、HANDLE_INFO 约 680 字节），
+// 绝大部分是补零。v2 改为：
+//
+//   [ENUM_V2_HEADER][记录 0][记录 1]...[字符串表]
+//
+//   - 记录定长（RecordSize，8 字节对齐），字符串字段存放字符串表内的字节偏移
+//   - 字符串表由 [USHORT 字符数][WCHAR...] 条目紧密排列，不含结尾 NUL，
+//     同一字符串只存一份；偏移 0 固定为空串
+//   - 新字段只追加在记录末尾，旧客户端按自己认识的前缀读取即可
+//
+// 客户端通过 ENUM_REQUEST.Version 选择版本，不传或传 0/1 均为 v1。
+// 本头文件只依赖 osk_types.h，驱动与用户态工具共用同一份解码器。
+//
+// ========== 输出不足 ==========
+//
+// 所有列表 IOCTL 在输出放不下完整结果时都不再截断：只写头部，Count = 0、
+// TotalSize = 所需字节数，返回 STATUS_BUFFER_OVERFLOW。
+//
+// 进程、内核模块、句柄枚举同时把这次抓到的快照留在句柄上，并在应答中给出
+// SnapshotToken（v1 需输出不小于 ENUM_OVERFLOW_HEADER，v2 在头部）。
+// 按 TotalSize 分配后带上该令牌重试，结果取自同一份快照，不再重新查询系统。
+// 每个句柄只保留最近一份快照，ENUM_SNAPSHOT_LIFETIME_MS 后失效；
+// 令牌失效、或与请求的枚举类型 / ProcessId 不符时返回 STATUS_NOT_FOUND，去掉令牌重新请求即可。
+//
+
+#define ENUM_VERSION_1  1
+#define ENUM_VERSION_2  2
+
+// 枚举请求：HANDLE_ENUM_REQUEST / PROCESS_REQUEST 是它的前缀，旧客户端不受影响
+typedef struct _ENUM_REQUEST {
+    ULONG   ProcessId;      // IOCTL_ENUM_HANDLES / IOCTL_ENUM_MODULES / IOCTL_ENUM_THREADS 的目标进程，其余忽略
+    ULONG   Version;        // ENUM_VERSION_*
+    ULONG64 SnapshotToken;  // 0 = 重新抓取；否则为上次溢出应答给出的令牌
+    ULONG   Fields;         // 按枚举类型取 *_FIELD_* 的组合，0 = 全部字段
+    ULONG   Reserved;
+} ENUM_REQUEST, *PENUM_REQUEST;
+
+#define ENUM_SNAPSHOT_LIFETIME_MS   5000
+
+// v1 列表输出不足时的应答
+typedef struct _ENUM_OVERFLOW_HEADER {
+    ULONG   Count;          // 0
+    ULONG   TotalSize;      // 所需字节数
+    ULONG64 SnapshotToken;  // 0 表示未保留快照
+} ENUM_OVERFLOW_HEADER, *PENUM_OVERFLOW_HEADER;
+
+// Count/TotalSize 与 v1 列表头位置相同
+typedef struct _ENUM_V2_HEADER {
+    ULONG   Count;
+    ULONG   TotalSize;
+    ULONG   Version;        // ENUM_VERSION_2
+    ULONG   RecordSize;
+    ULONG   StringOffset;   // 字符串表相对输出起始处的偏移
+    ULONG   StringSize;
+    ULONG64 SnapshotToken;  // 仅 STATUS_BUFFER_OVERFLOW 时可能非 0
+} ENUM_V2_HEADER, *PENUM_V2_HEADER;
+
+#define ENUM_V2_EMPTY_STRING    0
+#define ENUM_V2_MAX_STRING      0xFFFF
+
+typedef struct _PROCESS_RECORD_V2 {
+    ULONG    ProcessId;
+    ULONG    ParentProcessId;
+    ULONG    ThreadCount;
+    ULONG    ImageName;
+    ULONG64  WorkingSetSize;
+    LONGLONG CreateTime;        // 系统时间，100ns
+    ULONG64  KernelTime;        // 累计，100ns
+    ULONG64  UserTime;
+    ULONG64  PeakWorkingSetSize;
+    ULONG    HandleCount;
+    ULONG    SessionId;
+    ULONG    CpuUsage;          // 最近一个采样区间占整机的比例，万分之一（见 cpusample.h）
+    ULONG    Reserved;
+} PROCESS_RECORD_V2, *PPROCESS_RECORD_V2;
+
+// 进程模块与内核模块共用
+typedef struct _MODULE_RECORD_V2 {
+    ULONG64 BaseAddress;
+    ULONG   SizeOfImage;
+    ULONG   FullPath;
+    ULONG   BaseName;
+    ULONG   Reserved;
+} MODULE_RECORD_V2, *PMODULE_RECORD_V2;
+
+typedef struct _HANDLE_RECORD_V2 {
+    ULONG   ProcessId;
+    ULONG   GrantedAccess;
+    ULONG64 Handle;
+    ULONG64 ObjectAddress;
+    ULONG   ObjectTypeIndex;
+    ULONG   TypeName;
+    ULONG   ObjectName;
+    ULONG   Reserved;
+} HANDLE_RECORD_V2, *PHANDLE_RECORD_V2;
+
+// 取自 SystemProcessInformation，用于共享快照区（见 shared_format.h）与
+// IOCTL_ENUM_PROCESSES_THREADS，与 IOCTL_ENUM_THREADS 的 v1 记录无关
+typedef struct _THREAD_RECORD_V2 {
+    ULONG   ThreadId;
+    ULONG   ProcessId;
+    LONG    Priority;
+    ULONG   State;          // KTHREAD_STATE
+    ULONG64 StartAddress;   // 内核记录的起始地址，用户线程多为 RtlUserThreadStart
+    ULONG   WaitReason;     // KWAIT_REASON，State 为 Waiting 时有意义
+    ULONG   ContextSwitches;
+    ULONG64 KernelTime;     // 累计，100ns
+    ULONG64 UserTime;
+} THREAD_RECORD_V2, *PTHREAD_RECORD_V2;
+
+// IOCTL_ENUM_PROCESSES_THREADS 的应答：同一份快照中的进程表与线程表，各自是完整的 v2 编码
+//
+//   [PROCESS_THREAD_HEADER][进程表：ENUM_V2_HEADER ...][补零至 8 字节对齐][线程表：ENUM_V2_HEADER ...]
+//
+// 两张表的偏移都相对输出起始处，各自的 StringOffset / TotalSize 相对该表起始处，
+// 分别以 WireValidate 校验。线程按进程表的顺序成组排列，每组 ThreadCount 条；
+// 未请求 PROCESS_FIELD_THREAD_COUNT 时按线程记录的 ProcessId 归属。
+// Fields 只选择进程字段，线程记录总是完整的。
+// Count / TotalSize / Version / SnapshotToken 与 ENUM_V2_HEADER 位置相同，溢出应答与令牌重试照旧。
+typedef struct _PROCESS_THREAD_HEADER {
+    ULONG   Count;          // 进程数
+    ULONG   TotalSize;
+    ULONG   Version;        // ENUM_VERSION_2
+    ULONG   ThreadCount;
+    ULONG   ProcessOffset;
+    ULONG   ThreadOffset;
+    ULONG64 SnapshotToken;  // 仅 STATUS_BUFFER_OVERFLOW 时可能非 0
+} PROCESS_THREAD_HEADER, *PPROCESS_THREAD_HEADER;
+
+C_ASSERT(sizeof(ENUM_V2_HEADER) % 8 == 0);
+C_ASSERT(sizeof(PROCESS_RECORD_V2) == 72);
+C_ASSERT(sizeof(MODULE_RECORD_V2) == 24);
+C_ASSERT(sizeof(HANDLE_RECORD_V2) == 40);
+C_ASSERT(sizeof(THREAD_RECORD_V2) == 48);
+C_ASSERT(sizeof(PROCESS_THREAD_HEADER) == sizeof(ENUM_V2_HEADER));
+C_ASSERT(FIELD_OFFSET(PROCESS_THREAD_HEADER, Version) == FIELD_OFFSET(ENUM_V2_HEADER, Version));
+C_ASSERT(FIELD_OFFSET(PROCESS_THREAD_HEADER, SnapshotToken) == FIELD_OFFSET(ENUM_V2_HEADER, SnapshotToken));
+
+// ========== 字段选择 ==========
+//
+// ENUM_REQUEST.Fields 的第 i 位对应 v2 记录按声明顺序的第 i 个字段
+// （线程只有 v1，按 THREAD_FIELD_* 各自对应 THREAD_INFO 的字段）。
+// 未请求的字段不取数：字符串不查询、不复制、不入表，数值字段为 0，字符串偏移为空串。
+//
+//   - v2 记录截止到请求的最后一个字段（8 字节对齐），RecordSize 随之变小，
+//     之后的字段不出现在应答中；WireRecordSize 给出该长度，客户端据此校验
+//   - v1 记录布局不变，未请求的字段为 0
+//   - 含该枚举类型之外的位时返回 STATUS_INVALID_PARAMETER
+//
+
+#define ENUM_FIELDS_ALL             0
+
+#define PROCESS_FIELD_PROCESS_ID    0x00000001
+#define PROCESS_FIELD_PARENT_ID     0x00000002
+#define PROCESS_FIELD_THREAD_COUNT  0x00000004
+#define PROCESS_FIELD_IMAGE_NAME    0x00000008
+#define PROCESS_FIELD_WORKING_SET   0x00000010
+#define PROCESS_FIELD_CREATE_TIME   0x00000020
+#define PROCESS_FIELD_KERNEL_TIME   0x00000040
+#define PROCESS_FIELD_USER_TIME     0x00000080
+#define PROCESS_FIELD_PEAK_WORKSET  0x00000100
+#define PROCESS_FIELD_HANDLE_COUNT  0x00000200
+#define PROCESS_FIELD_SESSION_ID    0x00000400
+#define PROCESS_FIELD_CPU_USAGE     0x00000800
+#define PROCESS_FIELDS_ALL          0x00000FFF
+
+// 进程模块与内核模块共用
+#define MODULE_FIELD_BASE_ADDRESS   0x00000001
+#define MODULE_FIELD_SIZE           0x00000002
+#define MODULE_FIELD_FULL_PATH      0x00000004
+#define MODULE_FIELD_BASE_NAME      0x00000008
+#define MODULE_FIELDS_ALL           0x0000000F
+
+#define HANDLE_FIELD_PROCESS_ID     0x00000001
+#define HANDLE_FIELD_ACCESS         0x00000002
+#define HANDLE_FIELD_HANDLE         0x00000004
+#define HANDLE_FIELD_OBJECT         0x00000008
+#define HANDLE_FIELD_TYPE_INDEX     0x00000010
+#define HANDLE_FIELD_TYPE_NAME      0x00000020
+#define HANDLE_FIELD_OBJECT_NAME    0x00000040
+#define HANDLE_FIELDS_ALL           0x0000007F
+
+#define THREAD_FIELD_THREAD_ID      0x00000001
+#define THREAD_FIELD_PROCESS_ID     0x00000002
+#define THREAD_FIELD_PRIORITY       0x00000004
+#define THREAD_FIELD_START_ADDRESS  0x00000008
+#define THREAD_FIELD_TERMINATING    0x00000010
+#define THREAD_FIELDS_ALL           0x0000001F
+
+#define WIRE_FIELD_END(Type, Field) ((ULONG)(FIELD_OFFSET(Type, Field) + sizeof(((Type*)0)->Field)))
+
+// 各 v2 记录第 i 个字段的结束偏移
+static const ULONG WireProcessFieldEnds[] = {
+    WIRE_FIELD_END(PROCESS_RECORD_V2, ProcessId),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, ParentProcessId),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, ThreadCount),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, ImageName),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, WorkingSetSize),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, CreateTime),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, KernelTime),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, UserTime),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, PeakWorkingSetSize),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, HandleCount),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, SessionId),
+    WIRE_FIELD_END(PROCESS_RECORD_V2, CpuUsage),
+};
+
+static const ULONG WireModuleFieldEnds[] = {
+    WIRE_FIELD_END(MODULE_RECORD_V2, BaseAddress),
+    WIRE_FIELD_END(MODULE_RECORD_V2, SizeOfImage),
+    WIRE_FIELD_END(MODULE_RECORD_V2, FullPath),
+    WIRE_FIELD_END(MODULE_RECORD_V2, BaseName),
+};
+
+static const ULONG WireHandleFieldEnds[] = {
+    WIRE_FIELD_END(HANDLE_RECORD_V2, ProcessId),
+    WIRE_FIELD_END(HANDLE_RECORD_V2, GrantedAccess),
+    WIRE_FIELD_END(HANDLE_RECORD_V2, Handle),
+    WIRE_FIELD_END(HANDLE_RECORD_V2, ObjectAddress),
+    WIRE_FIELD_END(HANDLE_RECORD_V2, ObjectTypeIndex),
+    WIRE_FIELD_END(HANDLE_RECORD_V2, TypeName),
+    WIRE_FIELD_END(HANDLE_RECORD_V2, ObjectName),
+};
+
+// Fields 为已展开的非零掩码
+static inline ULONG WireRecordSize(const ULONG* FieldEnds, ULONG FieldCount, ULONG Fields)
+{
+    ULONG size = 0;
+    for (ULONG i = 0; i < FieldCount; i++) {
+        if (Fields & (1UL << i))
+            size = FieldEnds[i];
+    }
+    return (size + 7) & ~7UL;
+}
+
+// ========== 解码 ==========
+//
+// WireValidate 通过后，WireRecord 取到的记录与 WireString 取到的字符都落在 Length 之内；
+// 输出来自另一端，调用方不应跳过校验。
+//
+
+static inline BOOLEAN WireValidate(const VOID* Buffer, ULONG Length, ULONG MinRecordSize)
+{
+    const ENUM_V2_HEADER* header = (const ENUM_V2_HEADER*)Buffer;
+
+    if (!Buffer || Length < sizeof(ENUM_V2_HEADER))
+        return FALSE;
+    if (header->Version != ENUM_VERSION_2 || header->TotalSize > Length)
+        return FALSE;
+    if (header->RecordSize < MinRecordSize || header->RecordSize % 8 != 0)
+        return FALSE;
+
+    ULONG64 recordsEnd = sizeof(ENUM_V2_HEADER) + (ULONG64)header->Count * header->RecordSize;
+    if (header->StringOffset < recordsEnd || header->StringOffset % 2 != 0)
+        return FALSE;
+    if (header->StringSize < sizeof(USHORT) ||
+        (ULONG64)header->StringOffset + header->StringSize > header->TotalSize) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static inline const VOID* WireRecord(const VOID* Buffer, ULONG Index)
+{
+    const ENUM_V2_HEADER* header = (const ENUM_V2_HEADER*)Buffer;
+    return (const UCHAR*)Buffer + sizeof(ENUM_V2_HEADER) + (SIZE_T)Index * header->RecordSize;
+}
+
+// 字符串偏移 -> 字符指针与字符数（不含 NUL）；偏移越界或未对齐返回 FALSE
+static inline BOOLEAN WireString(
+    const VOID*    Buffer,
+    ULONG          Offset,
+    const WCHAR**  Chars,
+    PULONG         Length)
+{
+    const ENUM_V2_HEADER* header = (const ENUM_V2_HEADER*)Buffer;
+    const UCHAR* table = (const UCHAR*)Buffer + header->StringOffset;
+    USHORT chars = 0;
+
+    if (Offset % 2 != 0 || (ULONG64)Offset + sizeof(USHORT) > header->StringSize)
+        return FALSE;
+
+    RtlCopyMemory(&chars, table + Offset, sizeof(chars));
+    if ((ULONG64)Offset + sizeof(USHORT) + (ULONG64)chars * sizeof(WCHAR) > header->StringSize)
+        return FALSE;
+
+    *Chars  = (const WCHAR*)(table + Offset + sizeof(USHORT));
+    *Length = chars;
+    return TRUE;
+}
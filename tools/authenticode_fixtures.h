@@ -0,0 +1,286 @@
+#pragma once
+
+//
+// Synthetic Authenticode fixtures for the host tools
+//
+// SignedData blobs with a chosen image digest, certificate count and
+// unauthenticated payload, and minimal PE32 / PE32+ images signed with
+// them, verified through an in-memory SIG_READER. Shared by osk-verify and
+// osk-authenticode-bench.
+//
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "authenticode.h"
+#include "sha.h"
+
+inline std::string Hex(const UCHAR* data, size_t length)
+{
+    std::string text(length * 2, '0');
+    for (size_t i = 0; i < length; i++) snprintf(&text[i * 2], 3, "%02x", data[i]);
+    return text;
+}
+
+// ================================================================
+// Synthetic Authenticode SignedData
+// ================================================================
+
+typedef std::vector<UCHAR> Bytes;
+
+inline Bytes Cat(std::initializer_list<Bytes> parts)
+{
+    Bytes out;
+    for (const Bytes& part : parts) out.insert(out.end(), part.begin(), part.end());
+    return out;
+}
+
+// Shortest definite length encoding
+inline Bytes LengthOctets(size_t length)
+{
+    if (length < 0x80) return { (UCHAR)length };
+
+    UCHAR bytes[4];
+    int count = 0;
+    for (size_t l = length; l; l >>= 8) bytes[count++] = (UCHAR)l;
+    Bytes out = { (UCHAR)(0x80 | count) };
+    while (count) out.push_back(bytes[--count]);
+    return out;
+}
+
+inline Bytes Der(UCHAR tag, const Bytes& value)
+{
+    Bytes out = Cat({ { tag }, LengthOctets(value.size()) });
+    out.insert(out.end(), value.begin(), value.end());
+    return out;
+}
+
+inline Bytes Filler(size_t length, UCHAR seed)
+{
+    Bytes out(length);
+    for (size_t i = 0; i < length; i++) out[i] = (UCHAR)(seed + i * 7);
+    return out;
+}
+
+static const Bytes g_OidSignedData    = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x02 };
+static const Bytes g_OidSpcIndirect   = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x02, 0x01, 0x04 };
+static const Bytes g_OidSpcPeImage    = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x02, 0x01, 0x0F };
+static const Bytes g_OidMessageDigest = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x04 };
+static const Bytes g_OidContentType   = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x03 };
+static const Bytes g_OidCounterSign   = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x06 };
+static const Bytes g_OidSha256        = { 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01 };
+static const Bytes g_OidRsa           = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x01, 0x01 };
+
+inline Bytes AlgorithmId(const Bytes& oid)
+{
+    return Der(0x30, Cat({ Der(0x06, oid), Der(0x05, {}) }));
+}
+
+// Stand-in X.509 certificate: only its outer SEQUENCE matters to the walker
+inline Bytes Certificate(ULONG index)
+{
+    Bytes tbs = Der(0x30, Cat({ Der(0x02, { (UCHAR)(index + 1) }), Der(0x04, Filler(600, (UCHAR)index)) }));
+    return Der(0x30, Cat({ tbs, AlgorithmId(g_OidRsa), Der(0x03, Filler(257, 0x5A)) }));
+}
+
+struct SignedDataSpec {
+    UCHAR ImageHash[32] = {};
+    ULONG Certificates = 2;                 // the last one is the trusted signer
+    size_t UnauthenticatedBytes = 0;        // countersignature payload to skip
+    bool WrongAttributeDigest = false;
+};
+
+struct SignedDataBlob {
+    Bytes Data;
+    std::string Thumbprint;                 // SHA1 of the last certificate
+    std::vector<std::string> CertThumbprints;
+    Bytes Indirect;                         // SpcIndirectDataContent value bytes
+};
+
+inline std::string Sha1Thumbprint(const Bytes& data)
+{
+    SHA1_CTX ctx;
+    UCHAR digest[20];
+    SHA1Init(&ctx);
+    SHA1Update(&ctx, data.data(), (ULONG)data.size());
+    SHA1Final(digest, &ctx);
+
+    std::string text = Hex(digest, sizeof(digest));
+    for (char& c : text) c = (char)toupper((unsigned char)c);
+    return text;
+}
+
+inline SignedDataBlob BuildSignedData(const SignedDataSpec& spec)
+{
+    SignedDataBlob blob;
+
+    Bytes imageHash(spec.ImageHash, spec.ImageHash + 32);
+    blob.Indirect = Cat({
+        Der(0x30, Cat({ Der(0x06, g_OidSpcPeImage), Der(0x30, { 0x03, 0x01, 0x00 }) })),
+        Der(0x30, Cat({ AlgorithmId(g_OidSha256), Der(0x04, imageHash) })),
+    });
+    Bytes encap = Der(0x30, Cat({ Der(0x06, g_OidSpcIndirect), Der(0xA0, Der(0x30, blob.Indirect)) }));
+
+    Bytes certs;
+    for (ULONG i = 0; i < spec.Certificates; i++) {
+        Bytes cert = Certificate(i);
+        blob.CertThumbprints.push_back(Sha1Thumbprint(cert));
+        certs = Cat({ certs, cert });
+    }
+    if (!blob.CertThumbprints.empty()) blob.Thumbprint = blob.CertThumbprints.back();
+
+    UCHAR attrDigest[32];
+    SHA256_CTX ctx;
+    SHA256Init(&ctx);
+    SHA256Update(&ctx, blob.Indirect.data(), (ULONG)blob.Indirect.size());
+    SHA256Final(attrDigest, &ctx);
+    if (spec.WrongAttributeDigest) attrDigest[0] ^= 1;
+
+    Bytes attrs = Cat({
+        Der(0x30, Cat({ Der(0x06, g_OidContentType), Der(0x31, Der(0x06, g_OidSpcIndirect)) })),
+        Der(0x30, Cat({ Der(0x06, g_OidMessageDigest), Der(0x31, Der(0x04, Bytes(attrDigest, attrDigest + 32))) })),
+    });
+    Bytes signer = Cat({
+        Der(0x02, { 0x01 }),
+        Der(0x30, Cat({ Der(0x30, Filler(40, 0x11)), Der(0x02, { 0x01 }) })),
+        AlgorithmId(g_OidSha256),
+        Der(0xA0, attrs),
+        AlgorithmId(g_OidRsa),
+        Der(0x04, Filler(256, 0x22)),
+    });
+    if (spec.UnauthenticatedBytes) {
+        signer = Cat({ signer, Der(0xA1, Der(0x30, Cat({
+            Der(0x06, g_OidCounterSign), Der(0x31, Der(0x30, Filler(spec.UnauthenticatedBytes, 0x33))) }))) });
+    }
+
+    Bytes signedData = Der(0x30, Cat({
+        Der(0x02, { 0x01 }),
+        Der(0x31, AlgorithmId(g_OidSha256)),
+        encap,
+        spec.Certificates ? Der(0xA0, certs) : Bytes(),
+        Der(0x31, Der(0x30, signer)),
+    }));
+    blob.Data = Der(0x30, Cat({ Der(0x06, g_OidSignedData), Der(0xA0, signedData) }));
+    return blob;
+}
+
+// ================================================================
+// PE fixtures
+// ================================================================
+
+#define FIXTURE_NT_OFFSET       0x80
+#define FIXTURE_OPTIONAL_HEADER (FIXTURE_NT_OFFSET + 24)
+#define FIXTURE_CHECKSUM        (FIXTURE_OPTIONAL_HEADER + 64)
+
+struct PeFixture {
+    Bytes Image;
+    ULONG SecurityDir = 0;      // offset of the security directory entry
+    ULONG CertOffset = 0;       // WIN_CERTIFICATE, 0 if unsigned
+    UCHAR Hash[32] = {};        // whole-image reference Authenticode hash
+    std::string Thumbprint;
+};
+
+inline void Store16(Bytes& image, size_t offset, USHORT value)
+{
+    image[offset] = (UCHAR)value;
+    image[offset + 1] = (UCHAR)(value >> 8);
+}
+
+inline void Store32(Bytes& image, size_t offset, ULONG value)
+{
+    for (int i = 0; i < 4; i++) image[offset + i] = (UCHAR)(value >> (i * 8));
+}
+
+// Reference hash over an image held in one buffer, one update per range
+inline void ReferenceHash(const Bytes& image, ULONG securityDir, ULONG hashEnd, UCHAR hash[32])
+{
+    SHA256_CTX ctx;
+    SHA256Init(&ctx);
+    SHA256Update(&ctx, image.data(), FIXTURE_CHECKSUM);
+    SHA256Update(&ctx, image.data() + FIXTURE_CHECKSUM + 4, securityDir - FIXTURE_CHECKSUM - 4);
+    SHA256Update(&ctx, image.data() + securityDir + 8, hashEnd - securityDir - 8);
+    SHA256Final(hash, &ctx);
+}
+
+//
+// Headers only (no sections: the verifier never looks at them), a
+// patterned body up to ImageSize, then an 8-byte aligned certificate table
+// holding SignedData over the image's Authenticode hash.
+//
+inline PeFixture BuildPe(bool pe32Plus, ULONG imageSize, bool sign, const SignedDataSpec& base = SignedDataSpec())
+{
+    PeFixture pe;
+    pe.Image = Filler(std::max<ULONG>(imageSize, 0x400), 0x4D);
+    Bytes& image = pe.Image;
+
+    memset(image.data(), 0, 0x200);
+    Store16(image, 0, 0x5A4D);                                      // MZ
+    Store32(image, 0x3C, FIXTURE_NT_OFFSET);
+    Store32(image, FIXTURE_NT_OFFSET, 0x00004550);                  // PE\0\0
+    Store16(image, FIXTURE_NT_OFFSET + 4, pe32Plus ? 0x8664 : 0x014C);
+    Store16(image, FIXTURE_NT_OFFSET + 20, pe32Plus ? 240 : 224);   // SizeOfOptionalHeader
+    Store16(image, FIXTURE_OPTIONAL_HEADER, pe32Plus ? 0x20B : 0x10B);
+    Store32(image, FIXTURE_CHECKSUM, 0x12345678);
+    pe.SecurityDir = FIXTURE_OPTIONAL_HEADER + (pe32Plus ? 144 : 128);
+
+    if (!sign) {
+        ReferenceHash(image, pe.SecurityDir, (ULONG)image.size(), pe.Hash);
+        return pe;
+    }
+
+    image.resize((image.size() + 7) & ~(size_t)7, 0);
+    pe.CertOffset = (ULONG)image.size();
+    ReferenceHash(image, pe.SecurityDir, pe.CertOffset, pe.Hash);
+
+    SignedDataSpec spec = base;
+    memcpy(spec.ImageHash, pe.Hash, sizeof(pe.Hash));
+    SignedDataBlob blob = BuildSignedData(spec);
+    pe.Thumbprint = blob.Thumbprint;
+
+    Bytes certificate = Cat({ Bytes(8), blob.Data });
+    certificate.resize((certificate.size() + 7) & ~(size_t)7, 0);
+    Store32(certificate, 0, (ULONG)certificate.size());
+    Store16(certificate, 4, 0x0200);                                // WIN_CERT_REVISION_2_0
+    Store16(certificate, 6, 0x0002);                                // WIN_CERT_TYPE_PKCS_SIGNED_DATA
+
+    Store32(image, pe.SecurityDir, pe.CertOffset);
+    Store32(image, pe.SecurityDir + 4, (ULONG)certificate.size());
+    image.insert(image.end(), certificate.begin(), certificate.end());
+    return pe;
+}
+
+struct MemoryReader {
+    const Bytes* Image;
+    ULONG MaxRead = 0;
+    ULONG64 BytesRead = 0;
+};
+
+inline NTSTATUS ReadMemory(PVOID Context, ULONG Offset, PVOID Buffer, ULONG Length)
+{
+    MemoryReader* reader = (MemoryReader*)Context;
+    if ((ULONG64)Offset + Length > reader->Image->size()) return STATUS_END_OF_FILE;
+    memcpy(Buffer, reader->Image->data() + Offset, Length);
+    reader->MaxRead = std::max(reader->MaxRead, Length);
+    reader->BytesRead += Length;
+    return STATUS_SUCCESS;
+}
+
+inline SIGNATURE_STATUS VerifyImage(const Bytes& image, const std::string& thumbprint,
+                                    UCHAR hash[32], MemoryReader* stats = NULL)
+{
+    MemoryReader local = { &image };
+    MemoryReader* context = stats ? stats : &local;
+    context->Image = &image;
+
+    SIG_READER reader;
+    reader.Context  = context;
+    reader.Read     = ReadMemory;
+    reader.FileSize = (ULONG)image.size();
+    reader.Ticks    = NULL;
+    return AuthenticodeVerifyStream(&reader, thumbprint.c_str(), hash);
+}
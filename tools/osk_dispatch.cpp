@@ -0,0 +1,3649 @@
+//
+// osk-dispatch: run the driver's enumeration IOCTLs on the host shim
+//
+// Loads the driver (DriverEntry) against a recorded or synthetic system
+// snapshot, opens the device the way a client would, and times the
+// enumeration requests end to end: IRP dispatch, the module's own
+// ZwQuerySystemInformation / object walks, and the METHOD_BUFFERED copies.
+// Pool and object accounting is checked after unload.
+//
+// With -c, compares the METHOD_BUFFERED enumeration IOCTLs with their
+// METHOD_OUT_DIRECT variants instead: wall time and I/O manager traffic
+// per call, with buffers sized exactly for the snapshot.
+//
+// With -w, compares the v1 fixed-record replies with the v2 encoding
+// (src/wire_format.h): reply size, IOCTL time and client-side decode
+// time. Every v2 reply is decoded and checked field by field against the
+// v1 reply for the same snapshot. Then repeats the v2 requests with
+// field masks (ENUM_REQUEST.Fields): narrowed replies must match the full
+// reply in the requested fields and leave the rest empty, undefined bits
+// must be rejected, and v1 replies keep their layout with zeroed fields.
+//
+// With -b, terminates every process in the snapshot (except System and
+// the critical ones), half with one IOCTL_FREEZE_PROCESS + IOCTL_KILL_PROCESS
+// pair per PID and half with IOCTL_BATCH, and compares the round trips,
+// process lookups and wall time. The shim stubs out freezing, so only the
+// kill is real; the freeze exercises reference reuse within a batch.
+//
+// With -a, lists the handles of every process once per process, first one
+// request at a time on a synchronous handle, then all in flight at once
+// from a single thread on an overlapped handle served by the driver's
+// worker pool. Also checks cancellation of queued and running requests and
+// that closing the handle cancels what is still outstanding.
+//
+// With -e, measures the event channel: first the lock-free ring alone
+// (src/event_ring.h) with several producer threads and one consumer, then
+// end to end, with producer threads firing the shim's process, thread and
+// image notifications while this thread keeps IOCTL_READ_EVENTS requests
+// pended on an overlapped handle. Reports events per second, events per
+// completed read and drops; every reply is validated and sequence numbers
+// must be contiguous. Also checks the drop accounting of a full ring, the
+// subscription mask, the pending-read quota and cancellation on close.
+//
+// With -l, checks the driver's process table (src/proctable.h) against the
+// snapshot after load, then times lookups by PID and by name and a full
+// walk against scanning the shared snapshot. Fires create and exit
+// notifications, reports an exit for a live process and a create for one
+// that never existed and checks that one reconcile pass repairs both, and
+// kills a process through the driver.
+//
+// With -d, reads the whole process table with IOCTL_ENUM_PROCESSES_DELTA
+// and then only what changed since the last reply, applying each reply to a
+// client-side view that must keep matching a v1 enumeration. Checks that an
+// idle poll is empty, that only a large working set move counts as a change,
+// and that creates, exits and kills come back as such. Compares bytes per
+// poll with a full v1 enumeration while a few processes change between
+// polls, then overflows the exit history and asks with generations this load
+// never handed out: both must fall back to the whole table.
+//
+// With -r, counts ZwQuerySystemInformation calls and pool allocations per
+// process enumeration against the shared SystemProcessInformation snapshot
+// (src/procsnap.h): the first capture, captures after a process exit,
+// back-to-back requests inside the freshness window, requests after it
+// expired, and several readers racing exits that invalidate the snapshot.
+//
+// With -u, checks the process fields v2 records carry beyond v1 against
+// the snapshot, then charges CPU time to a few processes between two
+// samples and checks the usage the driver reports for the interval, and
+// that a capture inside the sampler's minimum interval keeps it. Times a
+// refresh with the driver's usage against one without it plus the
+// PID-keyed join a client would otherwise do.
+//
+// With -j, reads every process with its threads in one
+// IOCTL_ENUM_PROCESSES_THREADS request and checks it against the snapshot:
+// the process table must equal the v2 process enumeration, every thread
+// record the snapshot's thread entry, and each process's thread IDs what
+// IOCTL_ENUM_THREADS lists for it. Checks the overflow token, that a retry
+// is served from the stashed snapshot, field selection and that only v2 is
+// offered. Compares round trips, bytes and time per refresh with the
+// process list followed by one IOCTL_ENUM_THREADS per process.
+//
+// With -v, maps the shared snapshot section (src/shared_format.h) and
+// checks that the view is read-only, that only the opening process may map
+// it, and that its tables match the IOCTL replies byte for byte. Then times
+// reading all three tables from memory against the v2 enumeration IOCTLs,
+// races out-of-cycle refreshes against a reader (no copy it accepts may be
+// torn), waits for a periodic refresh and checks the view is gone on close.
+//
+// With -o, times the IOCTL round trip on a handle authorized once at open
+// against what every IOCTL paid before authorization moved into
+// IRP_MJ_CREATE: a scan of the spinlock-guarded 16-slot verdict cache on a
+// hit, and on a miss that scan plus Authenticode verification of a signed
+// 1 MiB image (src/authenticode.h), reported separately. Also against
+// reopening the device for every request. Checks that IOCTLs never run a
+// signature check, that a handle opened by an untrusted caller gets
+// STATUS_ACCESS_DENIED, and that a verdict change does not affect handles
+// that are already open.
+//
+// With -i, stresses the signature PID index (src/sigpid.h) with 1 to 64
+// reader threads while a writer keeps replacing the readers' slots with
+// another process, and times the same lookups against one spinlock-guarded
+// table, the design the seqlock slots replaced. A reader that ever sees a
+// status or prewarm flag from the other process in its own entry fails the
+// run.
+//
+// Usage: osk-dispatch [-a | -b | -c | -d | -e | -i | -j | -l | -o | -r | -u | -v | -w] [-s snapshot] [-p procs] [-t threads] [-h handles] [-m modules] [-n iterations]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "osk_shim.h"
+#include "driver.h"
+#include "cpusample.h"
+#include "event_ring.h"
+#include "procsnap.h"
+#include "proctable.h"
+#include "sha.h"
+#include "signature.h"
+#include "sigpid.h"
+
+extern "C" NTSTATUS DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+
+static ULONG64 NowNs(VOID)
+{
+    return (ULONG64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//
+// Every list reply starts with { ULONG Count; ULONG TotalSize; }. A reply
+// that does not fit comes back as STATUS_BUFFER_OVERFLOW with the exact
+// TotalSize and, for snapshot-backed lists, a token: the retry with a
+// buffer of that size is served from the same snapshot.
+//
+typedef struct _LIST_HEADER {
+    ULONG Count;
+    ULONG TotalSize;
+} LIST_HEADER;
+
+struct Request {
+    ULONG       Code;
+    ULONG       ProcessId;
+};
+
+struct Result {
+    ULONG64 Calls = 0;
+    ULONG64 Ns = 0;
+    ULONG64 Bytes = 0;
+    ULONG64 Entries = 0;
+    ULONG64 Overflows = 0;
+    ULONG64 Resumed = 0;
+    ULONG   Failures = 0;
+};
+
+static NTSTATUS Issue(
+    PFILE_OBJECT device, const Request& req, std::vector<UCHAR>& buffer,
+    Result& result, ULONG* bytesOut)
+{
+    ENUM_REQUEST input = { req.ProcessId, ENUM_VERSION_1, 0 };
+
+    for (int attempt = 0; attempt < 8; attempt++) {
+        ULONG bytes = 0;
+        ULONG64 start = NowNs();
+        NTSTATUS status = ShimDeviceIoControl(device, req.Code, &input, sizeof(input),
+            buffer.data(), (ULONG)buffer.size(), &bytes);
+        result.Ns += NowNs() - start;
+        result.Calls++;
+        if (input.SnapshotToken && status != STATUS_NOT_FOUND)
+            result.Resumed++;
+
+        if (status == STATUS_BUFFER_OVERFLOW) {
+            const ENUM_OVERFLOW_HEADER* overflow = (const ENUM_OVERFLOW_HEADER*)buffer.data();
+            result.Overflows++;
+            input.SnapshotToken = (bytes >= sizeof(ENUM_OVERFLOW_HEADER)) ? overflow->SnapshotToken : 0;
+            buffer.resize(overflow->TotalSize);
+            continue;
+        }
+        if (!NT_SUCCESS(status)) return status;
+
+        const LIST_HEADER* header = (const LIST_HEADER*)buffer.data();
+        if (header->TotalSize != bytes) return STATUS_UNSUCCESSFUL;
+
+        result.Bytes += bytes;
+        result.Entries += header->Count;
+        *bytesOut = bytes;
+        return status;
+    }
+    return STATUS_BUFFER_OVERFLOW;
+}
+
+// Driver-side view of the same requests (IOCTL_GET_DISPATCH_STATS)
+static void PrintDispatchStats(PFILE_OBJECT device)
+{
+    std::vector<UCHAR> buffer(sizeof(DISPATCH_STATS_HEADER));
+    ULONG bytes = 0;
+    NTSTATUS status;
+    for (;;) {
+        status = ShimDeviceIoControl(device, IOCTL_GET_DISPATCH_STATS, NULL, 0,
+            buffer.data(), (ULONG)buffer.size(), &bytes);
+        const DISPATCH_STATS_HEADER* header = (const DISPATCH_STATS_HEADER*)buffer.data();
+        if (!NT_SUCCESS(status) || header->TotalSize <= buffer.size()) break;
+        buffer.resize(header->TotalSize);
+    }
+    if (!NT_SUCCESS(status)) {
+        fprintf(stderr, "osk-dispatch: IOCTL_GET_DISPATCH_STATS failed: 0x%08X\n", (unsigned)status);
+        return;
+    }
+
+    const DISPATCH_STATS_HEADER* header = (const DISPATCH_STATS_HEADER*)buffer.data();
+    const DISPATCH_IOCTL_STATS* entry = (const DISPATCH_IOCTL_STATS*)(header + 1);
+    printf("\n%-8s %8s %8s %8s %12s %12s\n", "ioctl", "calls", "failed", "rejected", "avg us", "p99 <= us");
+    for (ULONG i = 0; i < header->Count; i++) {
+        const DISPATCH_IOCTL_STATS& e = entry[i];
+        if (!e.Calls && !e.Rejected) continue;
+
+        // Upper bound of the bucket holding the 99th percentile
+        ULONG64 seen = 0, p99 = 0;
+        for (ULONG b = 0; b < DISPATCH_STATS_BUCKETS; b++) {
+            seen += e.Latency[b];
+            if (seen * 100 >= e.Calls * 99) {
+                p99 = 2ULL << b;
+                break;
+            }
+        }
+        printf("0x%03X    %8llu %8llu %8llu %12.1f %12llu\n", (e.IoControlCode >> 2) & 0xFFF,
+            (unsigned long long)e.Calls, (unsigned long long)e.Failures, (unsigned long long)e.Rejected,
+            e.Calls ? (double)e.TotalMicroseconds / e.Calls : 0.0, (unsigned long long)p99);
+    }
+    printf("unrecognized control codes: %llu\n", (unsigned long long)header->Unrecognized);
+}
+
+// ========== Buffered vs direct ==========
+
+static ULONG64 Fnv1a(const UCHAR* data, size_t length)
+{
+    ULONG64 hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static int CompareTransfers(PFILE_OBJECT device, ULONG iterations)
+{
+    SHIM_SNAPSHOT_COUNTS counts = ShimSnapshotCounts();
+    struct {
+        const char* Name;
+        ULONG       Buffered;
+        ULONG       Direct;
+        size_t      EntrySize;
+        ULONG       Entries;
+        bool        HasInput;
+    } pairs[] = {
+        { "processes",      IOCTL_ENUM_PROCESSES,      IOCTL_ENUM_PROCESSES_DIRECT,      sizeof(PROCESS_INFO),       counts.Processes,     false },
+        { "kernel-modules", IOCTL_ENUM_KERNEL_MODULES, IOCTL_ENUM_KERNEL_MODULES_DIRECT, sizeof(KERNEL_MODULE_INFO), counts.KernelModules, false },
+        { "handles",        IOCTL_ENUM_HANDLES,        IOCTL_ENUM_HANDLES_DIRECT,        sizeof(HANDLE_INFO),        counts.Handles,       true  },
+    };
+
+    int result = 0;
+    printf("%-15s %-9s %10s %14s %14s %14s\n",
+        "request", "method", "avg ms", "sysbuf MiB", "copied MiB", "mapped MiB");
+    for (const auto& pair : pairs) {
+        size_t size = sizeof(LIST_HEADER) + (size_t)pair.Entries * pair.EntrySize;
+        if (size > MAXULONG) {
+            fprintf(stderr, "osk-dispatch: %s reply exceeds 4 GiB, skipped\n", pair.Name);
+            continue;
+        }
+        std::vector<UCHAR> buffer(size);
+        ULONG64 reference = 0;
+
+        for (int direct = 0; direct < 2; direct++) {
+            ULONG code = direct ? pair.Direct : pair.Buffered;
+            ULONG input = 0;
+            ULONG bytes = 0;
+            NTSTATUS status = STATUS_SUCCESS;
+            ULONG64 ns = 0;
+
+            // One untimed call faults in the caller's pages for both methods
+            ShimDeviceIoControl(device, code, pair.HasInput ? &input : NULL, pair.HasInput ? sizeof(input) : 0,
+                buffer.data(), (ULONG)size, &bytes);
+            ShimResetIoStats();
+
+            for (ULONG it = 0; it < iterations && NT_SUCCESS(status); it++) {
+                ULONG64 start = NowNs();
+                status = ShimDeviceIoControl(device, code,
+                    pair.HasInput ? &input : NULL, pair.HasInput ? sizeof(input) : 0,
+                    buffer.data(), (ULONG)size, &bytes);
+                ns += NowNs() - start;
+            }
+            if (!NT_SUCCESS(status)) {
+                fprintf(stderr, "osk-dispatch: %s (%s) failed: 0x%08X\n",
+                    pair.Name, direct ? "direct" : "buffered", (unsigned)status);
+                result = 1;
+                break;
+            }
+
+            // Both methods must produce the same reply
+            ULONG64 hash = Fnv1a(buffer.data(), bytes);
+            if (!direct) {
+                reference = hash;
+            } else if (hash != reference) {
+                fprintf(stderr, "osk-dispatch: %s replies differ between methods\n", pair.Name);
+                result = 1;
+            }
+
+            SHIM_STATS io = ShimGetStats();
+            double calls = iterations ? iterations : 1;
+            printf("%-15s %-9s %10.3f %14.2f %14.2f %14.2f\n", pair.Name, direct ? "direct" : "buffered",
+                ns / 1e6 / calls,
+                io.IoBufferBytes / calls / (1024.0 * 1024.0),
+                io.IoCopiedBytes / calls / (1024.0 * 1024.0),
+                io.IoMappedBytes / calls / (1024.0 * 1024.0));
+        }
+    }
+    return result;
+}
+
+// ========== v1 vs v2 encoding ==========
+
+// v1 strings are NUL-padded and truncated to the array; v2 carries the full string
+static bool SameString(const WCHAR* fixed, size_t capacity, const VOID* reply, ULONG offset)
+{
+    const WCHAR* chars = NULL;
+    ULONG length = 0;
+    if (!WireString(reply, offset, &chars, &length))
+        return false;
+
+    size_t compared = std::min<size_t>(length, capacity - 1);
+    return memcmp(fixed, chars, compared * sizeof(WCHAR)) == 0 && fixed[compared] == 0;
+}
+
+static bool SameRecord(ULONG code, const UCHAR* v1Entry, const VOID* reply, const VOID* record)
+{
+    switch (code) {
+    case IOCTL_ENUM_PROCESSES: {
+        const PROCESS_INFO* a = (const PROCESS_INFO*)v1Entry;
+        const PROCESS_RECORD_V2* b = (const PROCESS_RECORD_V2*)record;
+        return a->ProcessId == b->ProcessId && a->ParentProcessId == b->ParentProcessId &&
+            a->ThreadCount == b->ThreadCount && a->WorkingSetSize == b->WorkingSetSize &&
+            SameString(a->ImageName, RTL_NUMBER_OF(a->ImageName), reply, b->ImageName);
+    }
+    case IOCTL_ENUM_KERNEL_MODULES: {
+        const KERNEL_MODULE_INFO* a = (const KERNEL_MODULE_INFO*)v1Entry;
+        const MODULE_RECORD_V2* b = (const MODULE_RECORD_V2*)record;
+        return a->BaseAddress == b->BaseAddress && a->SizeOfImage == b->SizeOfImage &&
+            SameString(a->FullPath, RTL_NUMBER_OF(a->FullPath), reply, b->FullPath) &&
+            SameString(a->BaseName, RTL_NUMBER_OF(a->BaseName), reply, b->BaseName);
+    }
+    case IOCTL_ENUM_HANDLES: {
+        const HANDLE_INFO* a = (const HANDLE_INFO*)v1Entry;
+        const HANDLE_RECORD_V2* b = (const HANDLE_RECORD_V2*)record;
+        return a->ProcessId == b->ProcessId && a->Handle == b->Handle &&
+            a->ObjectTypeIndex == b->ObjectTypeIndex && a->GrantedAccess == b->GrantedAccess &&
+            a->ObjectAddress == b->ObjectAddress &&
+            SameString(a->TypeName, RTL_NUMBER_OF(a->TypeName), reply, b->TypeName) &&
+            SameString(a->ObjectName, RTL_NUMBER_OF(a->ObjectName), reply, b->ObjectName);
+    }
+    }
+    return false;
+}
+
+// What a client does with a reply: touch every record and resolve every string
+static ULONG64 DecodeV2(const VOID* reply, ULONG length, ULONG recordSize, const ULONG* stringFields)
+{
+    ULONG64 chars = 0;
+    if (!WireValidate(reply, length, recordSize))
+        return ~0ULL;
+
+    const ENUM_V2_HEADER* header = (const ENUM_V2_HEADER*)reply;
+    for (ULONG i = 0; i < header->Count; i++) {
+        const UCHAR* record = (const UCHAR*)WireRecord(reply, i);
+        for (const ULONG* field = stringFields; *field; field++) {
+            const WCHAR* text = NULL;
+            ULONG count = 0;
+            if (!WireString(reply, *(const ULONG*)(record + *field), &text, &count))
+                return ~0ULL;
+            chars += count;
+        }
+    }
+    return chars;
+}
+
+static void DecodeV1(const UCHAR* reply, size_t entrySize, ULONG64* touched)
+{
+    const LIST_HEADER* header = (const LIST_HEADER*)reply;
+    for (ULONG i = 0; i < header->Count; i++)
+        *touched += reply[sizeof(LIST_HEADER) + i * entrySize];
+}
+
+// ========== Field selection ==========
+
+struct WireField {
+    ULONG Offset;
+    ULONG Size;
+    bool  String;
+};
+
+#define WIRE_FIELD(type, field, string) { FIELD_OFFSET(type, field), sizeof(((type*)0)->field), string }
+
+// In *_FIELD_* bit order
+static const WireField g_ProcessFields[] = {
+    WIRE_FIELD(PROCESS_RECORD_V2, ProcessId, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, ParentProcessId, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, ThreadCount, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, ImageName, true),
+    WIRE_FIELD(PROCESS_RECORD_V2, WorkingSetSize, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, CreateTime, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, KernelTime, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, UserTime, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, PeakWorkingSetSize, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, HandleCount, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, SessionId, false),
+    WIRE_FIELD(PROCESS_RECORD_V2, CpuUsage, false),
+};
+static const WireField g_ModuleFields[] = {
+    WIRE_FIELD(MODULE_RECORD_V2, BaseAddress, false),
+    WIRE_FIELD(MODULE_RECORD_V2, SizeOfImage, false),
+    WIRE_FIELD(MODULE_RECORD_V2, FullPath, true),
+    WIRE_FIELD(MODULE_RECORD_V2, BaseName, true),
+};
+static const WireField g_HandleFields[] = {
+    WIRE_FIELD(HANDLE_RECORD_V2, ProcessId, false),
+    WIRE_FIELD(HANDLE_RECORD_V2, GrantedAccess, false),
+    WIRE_FIELD(HANDLE_RECORD_V2, Handle, false),
+    WIRE_FIELD(HANDLE_RECORD_V2, ObjectAddress, false),
+    WIRE_FIELD(HANDLE_RECORD_V2, ObjectTypeIndex, false),
+    WIRE_FIELD(HANDLE_RECORD_V2, TypeName, true),
+    WIRE_FIELD(HANDLE_RECORD_V2, ObjectName, true),
+};
+
+// Grows the buffer to the reported size and retries from the same snapshot
+static NTSTATUS EnumFields(
+    PFILE_OBJECT device, ULONG code, ULONG processId, ULONG version, ULONG fields,
+    std::vector<UCHAR>& buffer, ULONG* bytes)
+{
+    ENUM_REQUEST request = { processId, version, 0, fields };
+    NTSTATUS status = STATUS_BUFFER_OVERFLOW;
+
+    for (int attempt = 0; attempt < 8 && status == STATUS_BUFFER_OVERFLOW; attempt++) {
+        status = ShimDeviceIoControl(device, code, &request, sizeof(request),
+            buffer.data(), (ULONG)buffer.size(), bytes);
+        if (status == STATUS_BUFFER_OVERFLOW) {
+            const ENUM_OVERFLOW_HEADER* overflow = (const ENUM_OVERFLOW_HEADER*)buffer.data();
+            if (version == ENUM_VERSION_2)
+                request.SnapshotToken = ((const ENUM_V2_HEADER*)buffer.data())->SnapshotToken;
+            else
+                request.SnapshotToken = (*bytes >= sizeof(ENUM_OVERFLOW_HEADER)) ? overflow->SnapshotToken : 0;
+            buffer.resize(overflow->TotalSize);
+        }
+    }
+    return status;
+}
+
+// Requested fields must match the full reply; unrequested ones inside the record must be empty
+static ULONG CompareSelected(
+    const VOID* full, const VOID* narrow, const WireField* fields, ULONG fieldCount, ULONG mask)
+{
+    const ENUM_V2_HEADER* a = (const ENUM_V2_HEADER*)full;
+    const ENUM_V2_HEADER* b = (const ENUM_V2_HEADER*)narrow;
+    ULONG mismatches = (a->Count == b->Count) ? 0 : 1;
+
+    for (ULONG i = 0; i < a->Count && i < b->Count; i++) {
+        const UCHAR* x = (const UCHAR*)WireRecord(full, i);
+        const UCHAR* y = (const UCHAR*)WireRecord(narrow, i);
+        bool same = true;
+
+        for (ULONG f = 0; f < fieldCount && same; f++) {
+            const WireField& field = fields[f];
+            if (field.Offset + field.Size > b->RecordSize) {
+                same = !(mask & (1u << f));
+                continue;
+            }
+
+            static const UCHAR zero[8] = { 0 };
+            if (!(mask & (1u << f))) {
+                same = memcmp(y + field.Offset, zero, field.Size) == 0;
+            } else if (field.String) {
+                const WCHAR *s1 = NULL, *s2 = NULL;
+                ULONG n1 = 0, n2 = 0;
+                same = WireString(full, *(const ULONG*)(x + field.Offset), &s1, &n1) &&
+                    WireString(narrow, *(const ULONG*)(y + field.Offset), &s2, &n2) &&
+                    n1 == n2 && memcmp(s1, s2, n1 * sizeof(WCHAR)) == 0;
+            } else {
+                same = memcmp(x + field.Offset, y + field.Offset, field.Size) == 0;
+            }
+        }
+        mismatches += same ? 0 : 1;
+    }
+    return mismatches;
+}
+
+static int CompareFieldSelection(PFILE_OBJECT device, ULONG iterations)
+{
+    struct {
+        const char*      Name;
+        ULONG            Code;
+        ULONG            Fields;
+        const WireField* FieldTable;
+        ULONG            FieldCount;
+        const ULONG*     FieldEnds;
+    } kinds[] = {
+        { "processes",      IOCTL_ENUM_PROCESSES,
+          PROCESS_FIELD_PROCESS_ID | PROCESS_FIELD_PARENT_ID | PROCESS_FIELD_THREAD_COUNT,
+          g_ProcessFields, RTL_NUMBER_OF(g_ProcessFields), WireProcessFieldEnds },
+        { "processes",      IOCTL_ENUM_PROCESSES,
+          PROCESS_FIELD_PROCESS_ID | PROCESS_FIELD_WORKING_SET,
+          g_ProcessFields, RTL_NUMBER_OF(g_ProcessFields), WireProcessFieldEnds },
+        { "processes",      IOCTL_ENUM_PROCESSES,
+          PROCESS_FIELD_PROCESS_ID | PROCESS_FIELD_HANDLE_COUNT | PROCESS_FIELD_SESSION_ID,
+          g_ProcessFields, RTL_NUMBER_OF(g_ProcessFields), WireProcessFieldEnds },
+        { "kernel-modules", IOCTL_ENUM_KERNEL_MODULES,
+          MODULE_FIELD_BASE_ADDRESS | MODULE_FIELD_SIZE,
+          g_ModuleFields, RTL_NUMBER_OF(g_ModuleFields), WireModuleFieldEnds },
+        { "kernel-modules", IOCTL_ENUM_KERNEL_MODULES,
+          MODULE_FIELD_BASE_NAME,
+          g_ModuleFields, RTL_NUMBER_OF(g_ModuleFields), WireModuleFieldEnds },
+        { "handles",        IOCTL_ENUM_HANDLES,
+          HANDLE_FIELD_PROCESS_ID | HANDLE_FIELD_ACCESS | HANDLE_FIELD_HANDLE,
+          g_HandleFields, RTL_NUMBER_OF(g_HandleFields), WireHandleFieldEnds },
+        { "handles",        IOCTL_ENUM_HANDLES,
+          HANDLE_FIELD_HANDLE | HANDLE_FIELD_TYPE_NAME,
+          g_HandleFields, RTL_NUMBER_OF(g_HandleFields), WireHandleFieldEnds },
+    };
+    double calls = iterations ? iterations : 1;
+    int result = 0;
+
+    printf("\n%-15s %-8s %8s %14s %10s %10s\n", "request", "fields", "record", "reply bytes", "ratio", "ioctl ms");
+    for (const auto& kind : kinds) {
+        std::vector<UCHAR> full(sizeof(ENUM_V2_HEADER)), narrow(sizeof(ENUM_V2_HEADER));
+        ULONG fullBytes = 0, narrowBytes = 0;
+        ULONG64 fullNs = 0, narrowNs = 0;
+        NTSTATUS status = EnumFields(device, kind.Code, 0, ENUM_VERSION_2, ENUM_FIELDS_ALL, full, &fullBytes);
+        if (NT_SUCCESS(status))
+            status = EnumFields(device, kind.Code, 0, ENUM_VERSION_2, kind.Fields, narrow, &narrowBytes);
+
+        // Buffers are sized by now; each call captures afresh
+        for (ULONG it = 0; it < iterations && NT_SUCCESS(status); it++) {
+            ULONG64 start = NowNs();
+            status = EnumFields(device, kind.Code, 0, ENUM_VERSION_2, ENUM_FIELDS_ALL, full, &fullBytes);
+            fullNs += NowNs() - start;
+            if (!NT_SUCCESS(status)) break;
+
+            start = NowNs();
+            status = EnumFields(device, kind.Code, 0, ENUM_VERSION_2, kind.Fields, narrow, &narrowBytes);
+            narrowNs += NowNs() - start;
+        }
+
+        ULONG recordSize = WireRecordSize(kind.FieldEnds, kind.FieldCount, kind.Fields);
+        if (!NT_SUCCESS(status) || !WireValidate(full.data(), fullBytes, kind.FieldEnds[kind.FieldCount - 1]) ||
+            !WireValidate(narrow.data(), narrowBytes, recordSize) ||
+            ((const ENUM_V2_HEADER*)narrow.data())->RecordSize != recordSize) {
+            fprintf(stderr, "osk-dispatch: %s fields 0x%X failed: 0x%08X\n", kind.Name, kind.Fields, (unsigned)status);
+            result = 1;
+            continue;
+        }
+
+        ULONG mismatches = CompareSelected(full.data(), narrow.data(), kind.FieldTable, kind.FieldCount, kind.Fields);
+        if (mismatches) {
+            fprintf(stderr, "osk-dispatch: %s fields 0x%X differ from the full reply in %u records\n",
+                kind.Name, kind.Fields, mismatches);
+            result = 1;
+        }
+
+        const ENUM_V2_HEADER* header = (const ENUM_V2_HEADER*)full.data();
+        printf("%-15s %-8s %8u %14u %10s %10.3f\n", kind.Name, "all", header->RecordSize, fullBytes, "1.00",
+            fullNs / 1e6 / calls);
+        printf("%-15s 0x%-6X %8u %14u %10.2f %10.3f\n", kind.Name, kind.Fields, recordSize, narrowBytes,
+            (double)narrowBytes / fullBytes, narrowNs / 1e6 / calls);
+    }
+
+    // v1 keeps its layout: unrequested fields come back zeroed
+    std::vector<UCHAR> v1(sizeof(LIST_HEADER)), v1Narrow(sizeof(LIST_HEADER));
+    ULONG bytes = 0;
+    NTSTATUS status = EnumFields(device, IOCTL_ENUM_PROCESSES, 0, ENUM_VERSION_1, ENUM_FIELDS_ALL, v1, &bytes);
+    if (NT_SUCCESS(status))
+        status = EnumFields(device, IOCTL_ENUM_PROCESSES, 0, ENUM_VERSION_1, PROCESS_FIELD_PROCESS_ID, v1Narrow, &bytes);
+    ULONG v1Mismatches = 0;
+    if (NT_SUCCESS(status)) {
+        const LIST_HEADER* a = (const LIST_HEADER*)v1.data();
+        const LIST_HEADER* b = (const LIST_HEADER*)v1Narrow.data();
+        const PROCESS_INFO* x = (const PROCESS_INFO*)(a + 1);
+        const PROCESS_INFO* y = (const PROCESS_INFO*)(b + 1);
+        v1Mismatches = (a->Count == b->Count) ? 0 : 1;
+        for (ULONG i = 0; i < a->Count && i < b->Count; i++) {
+            if (y[i].ProcessId != x[i].ProcessId || y[i].ParentProcessId || y[i].ThreadCount ||
+                y[i].WorkingSetSize || y[i].ImageName[0]) {
+                v1Mismatches++;
+            }
+        }
+
+        // Threads are v1 only
+        ULONG pid = x[a->Count - 1].ProcessId;
+        status = EnumFields(device, IOCTL_ENUM_THREADS, pid, ENUM_VERSION_1, ENUM_FIELDS_ALL, v1, &bytes);
+        if (NT_SUCCESS(status))
+            status = EnumFields(device, IOCTL_ENUM_THREADS, pid, ENUM_VERSION_1, THREAD_FIELD_THREAD_ID, v1Narrow, &bytes);
+        if (NT_SUCCESS(status)) {
+            const THREAD_INFO* t = (const THREAD_INFO*)((const LIST_HEADER*)v1.data() + 1);
+            const THREAD_INFO* u = (const THREAD_INFO*)((const LIST_HEADER*)v1Narrow.data() + 1);
+            for (ULONG i = 0; i < ((const LIST_HEADER*)v1Narrow.data())->Count; i++) {
+                if (u[i].ThreadId != t[i].ThreadId || u[i].ProcessId || u[i].Priority ||
+                    u[i].StartAddress || u[i].IsTerminating) {
+                    v1Mismatches++;
+                }
+            }
+        }
+    }
+    if (!NT_SUCCESS(status) || v1Mismatches) {
+        fprintf(stderr, "osk-dispatch: v1 field selection: 0x%08X, %u mismatches\n", (unsigned)status, v1Mismatches);
+        result = 1;
+    }
+
+    // Bits the enumeration does not define are rejected
+    const struct { ULONG Code; ULONG Fields; } invalid[] = {
+        { IOCTL_ENUM_PROCESSES,      PROCESS_FIELDS_ALL + 1 },
+        { IOCTL_ENUM_KERNEL_MODULES, MODULE_FIELDS_ALL + 1 },
+        { IOCTL_ENUM_HANDLES,        HANDLE_FIELDS_ALL + 1 },
+        { IOCTL_ENUM_THREADS,        THREAD_FIELDS_ALL + 1 },
+    };
+    for (const auto& request : invalid) {
+        status = EnumFields(device, request.Code, 4, ENUM_VERSION_2, request.Fields, v1, &bytes);
+        if (status != STATUS_INVALID_PARAMETER) {
+            fprintf(stderr, "osk-dispatch: IOCTL 0x%X accepted fields 0x%X: 0x%08X\n",
+                request.Code, request.Fields, (unsigned)status);
+            result = 1;
+        }
+    }
+    return result;
+}
+
+static int CompareWireFormats(PFILE_OBJECT device, ULONG iterations)
+{
+    SHIM_SNAPSHOT_COUNTS counts = ShimSnapshotCounts();
+    struct {
+        const char* Name;
+        ULONG       Code;
+        size_t      EntrySize;
+        ULONG       Entries;
+        ULONG       RecordSize;
+        ULONG       StringFields[3];    // record offsets of string fields, 0-terminated
+    } kinds[] = {
+        { "processes",      IOCTL_ENUM_PROCESSES,      sizeof(PROCESS_INFO),       counts.Processes,     sizeof(PROCESS_RECORD_V2),
+          { FIELD_OFFSET(PROCESS_RECORD_V2, ImageName) } },
+        { "kernel-modules", IOCTL_ENUM_KERNEL_MODULES, sizeof(KERNEL_MODULE_INFO), counts.KernelModules, sizeof(MODULE_RECORD_V2),
+          { FIELD_OFFSET(MODULE_RECORD_V2, FullPath), FIELD_OFFSET(MODULE_RECORD_V2, BaseName) } },
+        { "handles",        IOCTL_ENUM_HANDLES,        sizeof(HANDLE_INFO),        counts.Handles,       sizeof(HANDLE_RECORD_V2),
+          { FIELD_OFFSET(HANDLE_RECORD_V2, TypeName), FIELD_OFFSET(HANDLE_RECORD_V2, ObjectName) } },
+    };
+    double calls = iterations ? iterations : 1;
+    int result = 0;
+
+    printf("%-15s %-6s %14s %10s %10s %10s %10s\n",
+        "request", "format", "reply bytes", "ratio", "ioctl ms", "MiB/s", "decode ms");
+    for (const auto& kind : kinds) {
+        size_t v1Size = sizeof(LIST_HEADER) + (size_t)kind.Entries * kind.EntrySize;
+        if (v1Size > MAXULONG) {
+            fprintf(stderr, "osk-dispatch: %s reply exceeds 4 GiB, skipped\n", kind.Name);
+            continue;
+        }
+
+        ENUM_REQUEST request = { 0, ENUM_VERSION_1 };
+        std::vector<UCHAR> v1(v1Size);
+        ULONG v1Bytes = 0;
+        ULONG64 ns = 0, decodeNs = 0, touched = 0;
+        NTSTATUS status = STATUS_SUCCESS;
+
+        for (ULONG it = 0; it < iterations && NT_SUCCESS(status); it++) {
+            ULONG64 start = NowNs();
+            status = ShimDeviceIoControl(device, kind.Code, &request, sizeof(request),
+                v1.data(), (ULONG)v1.size(), &v1Bytes);
+            ns += NowNs() - start;
+
+            start = NowNs();
+            DecodeV1(v1.data(), kind.EntrySize, &touched);
+            decodeNs += NowNs() - start;
+        }
+        if (!NT_SUCCESS(status) || v1Bytes == 0) {
+            fprintf(stderr, "osk-dispatch: %s (v1) failed: 0x%08X\n", kind.Name, (unsigned)status);
+            result = 1;
+            continue;
+        }
+        printf("%-15s %-6s %14u %10s %10.3f %10.1f %10.3f\n", kind.Name, "v1", v1Bytes, "1.00",
+            ns / 1e6 / calls, v1Bytes * calls / (ns / 1e9) / (1024.0 * 1024.0), decodeNs / 1e6 / calls);
+
+        // A header-sized probe must report the exact v2 size
+        request.Version = ENUM_VERSION_2;
+        std::vector<UCHAR> v2(sizeof(ENUM_V2_HEADER));
+        ULONG v2Bytes = 0;
+        status = ShimDeviceIoControl(device, kind.Code, &request, sizeof(request),
+            v2.data(), (ULONG)v2.size(), &v2Bytes);
+        const ENUM_V2_HEADER* probe = (const ENUM_V2_HEADER*)v2.data();
+        if (status != STATUS_BUFFER_OVERFLOW || v2Bytes != sizeof(ENUM_V2_HEADER) ||
+            probe->Count != 0 || probe->SnapshotToken == 0) {
+            fprintf(stderr, "osk-dispatch: %s (v2) size probe returned 0x%08X\n", kind.Name, (unsigned)status);
+            result = 1;
+            continue;
+        }
+        v2.resize(probe->TotalSize);
+
+        // The first call resumes from the probe's snapshot; the rest capture afresh
+        request.SnapshotToken = probe->SnapshotToken;
+        ns = decodeNs = 0;
+        status = STATUS_SUCCESS;
+        ULONG64 chars = 0;
+        for (ULONG it = 0; it < iterations && NT_SUCCESS(status); it++) {
+            ULONG64 start = NowNs();
+            status = ShimDeviceIoControl(device, kind.Code, &request, sizeof(request),
+                v2.data(), (ULONG)v2.size(), &v2Bytes);
+            ns += NowNs() - start;
+            request.SnapshotToken = 0;
+
+            start = NowNs();
+            chars = DecodeV2(v2.data(), v2Bytes, kind.RecordSize, kind.StringFields);
+            decodeNs += NowNs() - start;
+        }
+        if (!NT_SUCCESS(status) || chars == ~0ULL) {
+            fprintf(stderr, "osk-dispatch: %s (v2) failed: 0x%08X\n", kind.Name, (unsigned)status);
+            result = 1;
+            continue;
+        }
+
+        const ENUM_V2_HEADER* header = (const ENUM_V2_HEADER*)v2.data();
+        const LIST_HEADER* v1Header = (const LIST_HEADER*)v1.data();
+        ULONG mismatches = (header->Count == v1Header->Count) ? 0 : 1;
+        for (ULONG i = 0; i < header->Count && i < v1Header->Count; i++) {
+            const UCHAR* entry = v1.data() + sizeof(LIST_HEADER) + i * kind.EntrySize;
+            if (!SameRecord(kind.Code, entry, v2.data(), WireRecord(v2.data(), i)))
+                mismatches++;
+        }
+        if (mismatches) {
+            fprintf(stderr, "osk-dispatch: %s v2 differs from v1 in %u records\n", kind.Name, mismatches);
+            result = 1;
+        }
+
+        printf("%-15s %-6s %14u %10.2f %10.3f %10.1f %10.3f   strings %u bytes\n", kind.Name, "v2", v2Bytes,
+            (double)v2Bytes / v1Bytes, ns / 1e6 / calls, v2Bytes * calls / (ns / 1e9) / (1024.0 * 1024.0),
+            decodeNs / 1e6 / calls, header->StringSize);
+    }
+
+    if (CompareFieldSelection(device, iterations))
+        result = 1;
+    return result;
+}
+
+// ========== Batch vs one IOCTL per PID ==========
+
+static NTSTATUS IssueBatch(
+    PFILE_OBJECT device, const std::vector<BATCH_COMMAND>& commands, ULONG flags,
+    std::vector<BATCH_RESULT>& results, BATCH_REPLY_HEADER* reply)
+{
+    std::vector<UCHAR> input(sizeof(BATCH_REQUEST_HEADER) + commands.size() * sizeof(BATCH_COMMAND));
+    BATCH_REQUEST_HEADER request = { (ULONG)commands.size(), flags };
+    memcpy(input.data(), &request, sizeof(request));
+    memcpy(input.data() + sizeof(request), commands.data(), commands.size() * sizeof(BATCH_COMMAND));
+
+    std::vector<UCHAR> output(sizeof(BATCH_REPLY_HEADER) + commands.size() * sizeof(BATCH_RESULT));
+    ULONG bytes = 0;
+    NTSTATUS status = ShimDeviceIoControl(device, IOCTL_BATCH, input.data(), (ULONG)input.size(),
+        output.data(), (ULONG)output.size(), &bytes);
+    if (!NT_SUCCESS(status)) return status;
+    if (bytes != output.size()) return STATUS_UNSUCCESSFUL;
+
+    memcpy(reply, output.data(), sizeof(*reply));
+    results.resize(commands.size());
+    memcpy(results.data(), output.data() + sizeof(*reply), commands.size() * sizeof(BATCH_RESULT));
+    return status;
+}
+
+// Malformed batches are refused before any command runs
+static int CheckBatchValidation(PFILE_OBJECT device, ULONG processId)
+{
+    std::vector<BATCH_RESULT> results;
+    BATCH_REPLY_HEADER reply = {};
+    int result = 0;
+
+    std::vector<BATCH_COMMAND> unknown = { { BATCH_OP_KILL, processId, 0, 0 }, { 0xFF, processId, 0, 0 } };
+    NTSTATUS status = IssueBatch(device, unknown, 0, results, &reply);
+    if (status != STATUS_INVALID_PARAMETER) {
+        fprintf(stderr, "osk-dispatch: batch with unknown opcode returned 0x%08X\n", (unsigned)status);
+        result = 1;
+    }
+
+    std::vector<UCHAR> input(sizeof(BATCH_REQUEST_HEADER) + sizeof(BATCH_COMMAND));
+    BATCH_REQUEST_HEADER request = { 1, 0 };
+    BATCH_COMMAND kill = { BATCH_OP_KILL, processId, 0, 0 };
+    memcpy(input.data(), &request, sizeof(request));
+    memcpy(input.data() + sizeof(request), &kill, sizeof(kill));
+    BATCH_REPLY_HEADER small;
+    ULONG bytes = 0;
+    status = ShimDeviceIoControl(device, IOCTL_BATCH, input.data(), (ULONG)input.size(),
+        &small, sizeof(small), &bytes);
+    if (status != STATUS_BUFFER_TOO_SMALL) {
+        fprintf(stderr, "osk-dispatch: batch without room for results returned 0x%08X\n", (unsigned)status);
+        result = 1;
+    }
+
+    // Both requests must have left the process alone
+    std::vector<BATCH_COMMAND> stop = {
+        { BATCH_OP_UNHIDE, processId, 0, 0 }, { BATCH_OP_KILL, processId, 0, 0 } };
+    status = IssueBatch(device, stop, BATCH_FLAG_STOP_ON_ERROR, results, &reply);
+    if (!NT_SUCCESS(status) || reply.Completed != 1 || NT_SUCCESS((NTSTATUS)results[0].Status) ||
+        results[1].Status != (ULONG)STATUS_CANCELLED) {
+        fprintf(stderr, "osk-dispatch: stop-on-error batch: 0x%08X, %u completed\n",
+            (unsigned)status, reply.Completed);
+        result = 1;
+    }
+    return result;
+}
+
+static int CompareBatch(PFILE_OBJECT device)
+{
+    std::vector<UCHAR> buffer(64 * 1024);
+    Result listing;
+    ULONG bytes = 0;
+    Request enumProcesses = { IOCTL_ENUM_PROCESSES, 0 };
+    NTSTATUS status = Issue(device, enumProcesses, buffer, listing, &bytes);
+    if (!NT_SUCCESS(status)) {
+        fprintf(stderr, "osk-dispatch: IOCTL_ENUM_PROCESSES failed: 0x%08X\n", (unsigned)status);
+        return 1;
+    }
+
+    std::vector<ULONG> single, batched;
+    const LIST_HEADER* header = (const LIST_HEADER*)buffer.data();
+    const PROCESS_INFO* info = (const PROCESS_INFO*)(header + 1);
+    for (ULONG p = 0; p < header->Count; p++) {
+        if (info[p].ProcessId == 0 || info[p].ProcessId == 4) continue;
+        ((p % 2) ? batched : single).push_back(info[p].ProcessId);
+    }
+    if (single.empty() || batched.empty()) {
+        fprintf(stderr, "osk-dispatch: -b needs at least two user processes\n");
+        return 1;
+    }
+
+    int result = CheckBatchValidation(device, batched[0]);
+
+    // One freeze and one kill per PID, each its own round trip
+    ULONG singleCalls = 0, singleKilled = 0;
+    ShimResetIoStats();
+    ULONG64 start = NowNs();
+    for (ULONG pid : single) {
+        PROCESS_REQUEST request = { pid };
+        PROCESS_KILL_RESULT kill = {};
+        ShimDeviceIoControl(device, IOCTL_FREEZE_PROCESS, &request, sizeof(request), NULL, 0, &bytes);
+        status = ShimDeviceIoControl(device, IOCTL_KILL_PROCESS, &request, sizeof(request),
+            &kill, sizeof(kill), &bytes);
+        singleCalls += 2;
+        if (NT_SUCCESS(status)) singleKilled++;
+    }
+    ULONG64 singleNs = NowNs() - start;
+    SHIM_STATS singleIo = ShimGetStats();
+
+    // The same pair per PID, BATCH_MAX_COMMANDS commands per round trip
+    ULONG batchCalls = 0, batchKilled = 0, lookups = 0;
+    ULONG perBatch = BATCH_MAX_COMMANDS / 2;
+    ShimResetIoStats();
+    start = NowNs();
+    for (size_t first = 0; first < batched.size(); first += perBatch) {
+        std::vector<BATCH_COMMAND> commands;
+        for (size_t i = first; i < std::min(batched.size(), first + perBatch); i++) {
+            commands.push_back({ BATCH_OP_FREEZE, batched[i], 0, 0 });
+            commands.push_back({ BATCH_OP_KILL, batched[i], 0, 0 });
+        }
+
+        std::vector<BATCH_RESULT> results;
+        BATCH_REPLY_HEADER reply = {};
+        status = IssueBatch(device, commands, 0, results, &reply);
+        batchCalls++;
+        if (!NT_SUCCESS(status) || reply.Completed != commands.size()) {
+            fprintf(stderr, "osk-dispatch: IOCTL_BATCH failed: 0x%08X\n", (unsigned)status);
+            return 1;
+        }
+        lookups += reply.Lookups;
+        for (size_t i = 1; i < results.size(); i += 2) {
+            if (NT_SUCCESS((NTSTATUS)results[i].Status)) batchKilled++;
+        }
+    }
+    ULONG64 batchNs = NowNs() - start;
+    SHIM_STATS batchIo = ShimGetStats();
+
+    if (lookups != batched.size()) {
+        fprintf(stderr, "osk-dispatch: %u lookups for %zu distinct PIDs\n", lookups, batched.size());
+        result = 1;
+    }
+
+    // Every killed PID must be gone from the listing
+    status = Issue(device, enumProcesses, buffer, listing, &bytes);
+    header = (const LIST_HEADER*)buffer.data();
+    info = (const PROCESS_INFO*)(header + 1);
+    ULONG survivors = NT_SUCCESS(status) ? header->Count : 0;
+    ULONG expected = (ULONG)(single.size() + batched.size()) - singleKilled - batchKilled;
+    for (ULONG p = 0; p < survivors; p++) {
+        if (info[p].ProcessId == 0 || info[p].ProcessId == 4) expected++;
+    }
+    if (!NT_SUCCESS(status) || survivors != expected) {
+        fprintf(stderr, "osk-dispatch: %u processes left, expected %u\n", survivors, expected);
+        result = 1;
+    }
+
+    printf("%-10s %8s %8s %10s %12s %12s\n", "mode", "pids", "killed", "ioctls", "total ms", "us / pid");
+    printf("%-10s %8zu %8u %10u %12.3f %12.2f\n", "per-pid", single.size(), singleKilled, singleCalls,
+        singleNs / 1e6, singleNs / 1e3 / single.size());
+    printf("%-10s %8zu %8u %10u %12.3f %12.2f\n", "batch", batched.size(), batchKilled, batchCalls,
+        batchNs / 1e6, batchNs / 1e3 / batched.size());
+    printf("I/O manager: per-pid %llu bytes copied, batch %llu bytes copied; batch lookups %u\n",
+        (unsigned long long)singleIo.IoCopiedBytes, (unsigned long long)batchIo.IoCopiedBytes, lookups);
+    return result;
+}
+
+// ========== Overlapped vs synchronous ==========
+
+#define SystemHandleInformationClass 16     // what the handle capture queries
+
+struct PendingIo {
+    HANDLE_ENUM_REQUEST Input = {};
+    ENUM_REQUEST        Enum = {};
+    std::vector<UCHAR>  Output;
+    PSHIM_ASYNC_IO      Request = NULL;
+    NTSTATUS            Status = STATUS_SUCCESS;    // dispatch status, then final status
+    ULONG               Bytes = 0;
+};
+
+// v2 handle listing of one process; the reply fits, so no snapshot is kept
+static NTSTATUS BeginHandles(PFILE_OBJECT device, ULONG processId, size_t outputSize, PendingIo& io)
+{
+    io.Enum = { processId, ENUM_VERSION_2, 0 };
+    io.Output.resize(outputSize);
+    io.Status = ShimDeviceIoControlAsync(device, IOCTL_ENUM_HANDLES, &io.Enum, sizeof(io.Enum),
+        io.Output.data(), (ULONG)io.Output.size(), &io.Request);
+    return io.Status;
+}
+
+static NTSTATUS FinishIo(PendingIo& io)
+{
+    if (io.Request) {
+        io.Status = ShimWaitIo(io.Request, &io.Bytes);
+        io.Request = NULL;
+    }
+    return io.Status;
+}
+
+static ULONG HandleCount(const PendingIo& io)
+{
+    if (!NT_SUCCESS(io.Status) || !WireValidate(io.Output.data(), io.Bytes, sizeof(HANDLE_RECORD_V2)))
+        return MAXULONG;
+    return ((const ENUM_V2_HEADER*)io.Output.data())->Count;
+}
+
+// IOCTL_GET_ASYNC_STATUS is not PASSIVE, so it completes inline even on an overlapped handle
+static ASYNC_STATUS_HEADER QueryAsync(PFILE_OBJECT device, std::vector<ASYNC_OPERATION_INFO>* operations)
+{
+    std::vector<UCHAR> buffer(sizeof(ASYNC_STATUS_HEADER) + 64 * sizeof(ASYNC_OPERATION_INFO));
+    ASYNC_STATUS_HEADER header = {};
+    ULONG bytes = 0;
+    for (;;) {
+        NTSTATUS status = ShimDeviceIoControl(device, IOCTL_GET_ASYNC_STATUS, NULL, 0,
+            buffer.data(), (ULONG)buffer.size(), &bytes);
+        memcpy(&header, buffer.data(), sizeof(header));
+        if (NT_SUCCESS(status) || header.TotalSize <= buffer.size()) break;
+        buffer.resize(header.TotalSize);
+    }
+    if (operations) {
+        const ASYNC_OPERATION_INFO* entry = (const ASYNC_OPERATION_INFO*)(buffer.data() + sizeof(header));
+        operations->assign(entry, entry + header.Count);
+    }
+    return header;
+}
+
+struct CancelTally {
+    ULONG Completed = 0;
+    ULONG Cancelled = 0;
+    ULONG Other = 0;
+};
+
+static void Tally(CancelTally& tally, NTSTATUS status)
+{
+    if (status == STATUS_CANCELLED) tally.Cancelled++;
+    else if (NT_SUCCESS(status))    tally.Completed++;
+    else                            tally.Other++;
+}
+
+static int CompareAsync(PFILE_OBJECT device)
+{
+    std::vector<UCHAR> buffer(64 * 1024);
+    Result listing;
+    ULONG bytes = 0;
+    Request enumProcesses = { IOCTL_ENUM_PROCESSES, 0 };
+    NTSTATUS status = Issue(device, enumProcesses, buffer, listing, &bytes);
+    if (!NT_SUCCESS(status)) {
+        fprintf(stderr, "osk-dispatch: IOCTL_ENUM_PROCESSES failed: 0x%08X\n", (unsigned)status);
+        return 1;
+    }
+    std::vector<ULONG> pids;
+    const LIST_HEADER* header = (const LIST_HEADER*)buffer.data();
+    const PROCESS_INFO* info = (const PROCESS_INFO*)(header + 1);
+    for (ULONG p = 0; p < header->Count; p++)
+        pids.push_back(info[p].ProcessId);
+
+    PFILE_OBJECT overlapped = ShimOpenDevice(4, TRUE);
+    if (!overlapped) {
+        fprintf(stderr, "osk-dispatch: cannot open overlapped device\n");
+        return 1;
+    }
+
+    // Largest per-process reply, so every request below fits its buffer
+    SHIM_SNAPSHOT_COUNTS counts = ShimSnapshotCounts();
+    size_t outputSize = 64 * 1024 + (size_t)counts.Handles / std::max<ULONG>(counts.Processes, 1) * 4 * 1024;
+    int result = 0;
+
+    // The same listings one after another on a synchronous handle, which never pends
+    std::vector<ULONG> expected(pids.size());
+    ULONG syncPended = 0;
+    ULONG64 start = NowNs();
+    for (size_t i = 0; i < pids.size(); i++) {
+        PendingIo io;
+        if (BeginHandles(device, pids[i], outputSize, io) == STATUS_PENDING) syncPended++;
+        FinishIo(io);
+        expected[i] = HandleCount(io);
+    }
+    ULONG64 syncNs = NowNs() - start;
+
+    // All of them in flight from this one thread
+    std::vector<PendingIo> ios(pids.size());
+    ULONG pended = 0;
+    start = NowNs();
+    for (size_t i = 0; i < pids.size(); i++) {
+        if (BeginHandles(overlapped, pids[i], outputSize, ios[i]) == STATUS_PENDING) pended++;
+    }
+    ULONG64 issueNs = NowNs() - start;
+    ASYNC_STATUS_HEADER peak = QueryAsync(overlapped, NULL);
+    ULONG mismatches = 0;
+    for (size_t i = 0; i < ios.size(); i++) {
+        FinishIo(ios[i]);
+        if (HandleCount(ios[i]) != expected[i]) mismatches++;
+    }
+    ULONG64 asyncNs = NowNs() - start;
+
+    if (syncPended || pended != pids.size() || mismatches) {
+        fprintf(stderr, "osk-dispatch: %u synchronous requests pended, %u of %zu overlapped pended, %u replies differ\n",
+            syncPended, pended, pids.size(), mismatches);
+        result = 1;
+    }
+
+    // A pended batch reports every command
+    std::vector<BATCH_COMMAND> commands;
+    for (ULONG pid : pids)
+        commands.push_back({ BATCH_OP_UNHIDE, pid, 0, 0 });
+    if (commands.size() > BATCH_MAX_COMMANDS) commands.resize(BATCH_MAX_COMMANDS);
+    std::vector<UCHAR> batchInput(sizeof(BATCH_REQUEST_HEADER) + commands.size() * sizeof(BATCH_COMMAND));
+    BATCH_REQUEST_HEADER batchRequest = { (ULONG)commands.size(), 0 };
+    memcpy(batchInput.data(), &batchRequest, sizeof(batchRequest));
+    memcpy(batchInput.data() + sizeof(batchRequest), commands.data(), commands.size() * sizeof(BATCH_COMMAND));
+    std::vector<UCHAR> batchOutput(sizeof(BATCH_REPLY_HEADER) + commands.size() * sizeof(BATCH_RESULT));
+    PSHIM_ASYNC_IO batchIo = NULL;
+    status = ShimDeviceIoControlAsync(overlapped, IOCTL_BATCH, batchInput.data(), (ULONG)batchInput.size(),
+        batchOutput.data(), (ULONG)batchOutput.size(), &batchIo);
+    bool batchPended = status == STATUS_PENDING;
+    if (batchIo) status = ShimWaitIo(batchIo, &bytes);
+    const BATCH_REPLY_HEADER* reply = (const BATCH_REPLY_HEADER*)batchOutput.data();
+    if (!batchPended || !NT_SUCCESS(status) || reply->Completed != commands.size()) {
+        fprintf(stderr, "osk-dispatch: overlapped batch: 0x%08X, pended %d, %u of %zu completed\n",
+            (unsigned)status, batchPended, reply->Completed, commands.size());
+        result = 1;
+    }
+
+    // CancelIoEx on everything while the workers are parked in their capture: the
+    // queued requests are dequeued and the running ones stop after the capture
+    CancelTally queued;
+    ShimHoldSystemQueries(SystemHandleInformationClass);
+    for (size_t i = 0; i < pids.size(); i++)
+        BeginHandles(overlapped, pids[i], outputSize, ios[i]);
+    ShimWaitHeldSystemQueries(std::min<ULONG>(peak.Workers, (ULONG)pids.size()));
+    for (auto& io : ios) {
+        if (io.Request) ShimCancelIo(io.Request);
+    }
+    ShimReleaseSystemQueries();
+    for (auto& io : ios)
+        Tally(queued, FinishIo(io));
+    if (queued.Other || queued.Cancelled != pids.size()) {
+        fprintf(stderr, "osk-dispatch: cancelling queued requests: %u completed, %u cancelled, %u failed\n",
+            queued.Completed, queued.Cancelled, queued.Other);
+        result = 1;
+    }
+
+    // Cancelled once a worker has picked it up: held in the capture, the request must
+    // show as running, and the enumeration checks right after the capture
+    CancelTally running;
+    ULONG seenRunning = 0;
+    const ULONG rounds = 8;
+    size_t fullSize = 64 * 1024 + (size_t)counts.Handles * (sizeof(HANDLE_RECORD_V2) + 64);
+    for (ULONG r = 0; r < rounds; r++) {
+        PendingIo io;
+        ShimHoldSystemQueries(SystemHandleInformationClass);
+        BeginHandles(overlapped, 0, fullSize, io);
+        if (io.Request) {
+            ShimWaitHeldSystemQueries(1);
+            std::vector<ASYNC_OPERATION_INFO> operations;
+            QueryAsync(overlapped, &operations);
+            if (!operations.empty() && operations[0].State == ASYNC_STATE_RUNNING)
+                seenRunning++;
+            ShimCancelIo(io.Request);
+        }
+        ShimReleaseSystemQueries();
+        Tally(running, FinishIo(io));
+    }
+    if (running.Other || running.Cancelled != rounds || seenRunning != rounds) {
+        fprintf(stderr, "osk-dispatch: cancelling running requests: %u completed, %u cancelled, %u failed, %u seen running\n",
+            running.Completed, running.Cancelled, running.Other, seenRunning);
+        result = 1;
+    }
+
+    // Closing the handle with requests outstanding: IRP_MJ_CLEANUP cancels the queued
+    // ones and flags the running ones. Holding the handle query parks every worker in
+    // its capture until the cleanup is done, so each request must end cancelled
+    CancelTally cleanup;
+    ShimHoldSystemQueries(SystemHandleInformationClass);
+    for (size_t i = 0; i < pids.size(); i++)
+        BeginHandles(overlapped, pids[i], outputSize, ios[i]);
+    ShimWaitHeldSystemQueries(std::min<ULONG>(peak.Workers, (ULONG)pids.size()));
+    ShimCleanupDevice(overlapped);
+    ShimReleaseSystemQueries();
+    ShimCloseDevice(overlapped);
+    for (auto& io : ios)
+        Tally(cleanup, FinishIo(io));
+    if (cleanup.Other || cleanup.Cancelled != pids.size()) {
+        fprintf(stderr, "osk-dispatch: closing with requests pending: %u completed, %u cancelled, %u failed\n",
+            cleanup.Completed, cleanup.Cancelled, cleanup.Other);
+        result = 1;
+    }
+
+    printf("%-12s %8s %8s %12s %12s\n", "mode", "requests", "pended", "total ms", "us / req");
+    printf("%-12s %8zu %8u %12.3f %12.2f\n", "synchronous", pids.size(), syncPended,
+        syncNs / 1e6, syncNs / 1e3 / pids.size());
+    printf("%-12s %8zu %8u %12.3f %12.2f\n", "overlapped", pids.size(), pended,
+        asyncNs / 1e6, asyncNs / 1e3 / pids.size());
+    printf("issued in %.3f ms; then %u queued, %u running on %u workers\n",
+        issueNs / 1e6, peak.Queued, peak.Running, peak.Workers);
+    printf("cancel queued:   %u completed, %u cancelled\n", queued.Completed, queued.Cancelled);
+    printf("cancel running:  %u completed, %u cancelled (%u of %u seen running)\n",
+        running.Completed, running.Cancelled, seenRunning, rounds);
+    printf("close pending:   %u completed, %u cancelled\n", cleanup.Completed, cleanup.Cancelled);
+    return result;
+}
+
+// ========== Event channel ==========
+
+static const WCHAR g_BenchProcessImage[] = L"\\Device\\HarddiskVolume3\\Windows\\System32\\notepad.exe";
+static const WCHAR g_BenchModuleImage[]  = L"\\Device\\HarddiskVolume3\\Windows\\System32\\kernel32.dll";
+
+#define EVENT_BENCH_PRODUCERS   4
+#define EVENT_BENCH_READ_SIZE   (64 * 1024)
+#define EVENT_BENCH_READS       8
+#define EVENT_BENCH_SENTINEL    0xFFFFFFF0  // process exit that ends the end-to-end run
+
+// WCHAR is 16 bits here (-fshort-wchar), so the C library's wcslen does not apply
+static ULONG NameLength(const WCHAR* name)
+{
+    ULONG length = 0;
+    while (name[length]) length++;
+    return length;
+}
+
+static NTSTATUS Subscribe(PFILE_OBJECT device, ULONG mask, ULONG ringSize)
+{
+    EVENT_SUBSCRIBE_REQUEST request = { mask, ringSize };
+    ULONG bytes = 0;
+    return ShimDeviceIoControl(device, IOCTL_EVENT_SUBSCRIBE, &request, sizeof(request), NULL, 0, &bytes);
+}
+
+static EVENT_STATS QueryEvents(PFILE_OBJECT device)
+{
+    EVENT_STATS stats = {};
+    ULONG bytes = 0;
+    ShimDeviceIoControl(device, IOCTL_GET_EVENT_STATS, NULL, 0, &stats, sizeof(stats), &bytes);
+    return stats;
+}
+
+static NTSTATUS BeginReadEvents(PFILE_OBJECT device, PendingIo& io)
+{
+    io.Output.resize(EVENT_BENCH_READ_SIZE);
+    io.Bytes = 0;
+    io.Status = ShimDeviceIoControlAsync(device, IOCTL_READ_EVENTS, NULL, 0,
+        io.Output.data(), (ULONG)io.Output.size(), &io.Request);
+    return io.Status;
+}
+
+static const EVENT_READ_HEADER* EventReply(const PendingIo& io)
+{
+    if (!NT_SUCCESS(io.Status) || !EventValidate(io.Output.data(), io.Bytes))
+        return NULL;
+    return (const EVENT_READ_HEADER*)io.Output.data();
+}
+
+// The ring alone. Producer p numbers its events in ThreadId, or in ImageBase
+// for the image load written every 16th event; each producer's numbers must
+// come out in increasing order
+static int BenchEventRing(ULONG producers, ULONG perProducer)
+{
+    std::vector<ULONG64> storage(EVENT_RING_DEFAULT_SIZE / sizeof(ULONG64));
+    EVENT_RING ring;
+    EventRingInitialize(&ring, storage.data(), EVENT_RING_DEFAULT_SIZE);
+
+    ULONG nameLength = NameLength(g_BenchModuleImage);
+    std::atomic<ULONG> running(producers);
+    std::vector<std::thread> threads;
+    ULONG64 start = NowNs();
+    for (ULONG p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            ULONG used = 0;
+            for (ULONG i = 0; i < perProducer; i++) {
+                if (i % 16 == 15)
+                    EventWriteImageLoad(&ring, i, p + 1, i, 0x1000, 0, g_BenchModuleImage, nameLength, &used);
+                else
+                    EventWriteThread(&ring, EVENT_THREAD_CREATE, i, p + 1, i, &used);
+            }
+            running--;
+        });
+    }
+
+    std::vector<UCHAR> reply(EVENT_BENCH_READ_SIZE);
+    EVENT_READ_HEADER* header = (EVENT_READ_HEADER*)reply.data();
+    std::vector<LONG64> last(producers + 1, -1);
+    ULONG64 consumed = 0, reads = 0;
+    ULONG errors = 0;
+    for (;;) {
+        // Sampled before reading: once it is zero, nothing more is written
+        bool finished = running.load() == 0;
+        ULONG count = 0;
+        ULONG bytes = EventRingRead(&ring, header + 1, (ULONG)reply.size() - sizeof(EVENT_READ_HEADER), &count);
+        if (count == 0) {
+            if (finished && EventRingUsed(&ring) == 0) break;
+            std::this_thread::yield();
+            continue;
+        }
+
+        *header = {};
+        header->Count     = count;
+        header->TotalSize = sizeof(EVENT_READ_HEADER) + bytes;
+        reads++;
+        consumed += count;
+        if (!EventValidate(reply.data(), header->TotalSize)) {
+            errors++;
+            continue;
+        }
+        for (const EVENT_HEADER* e = EventNext(header, NULL); e; e = EventNext(header, e)) {
+            LONG64 number = (e->Type == EVENT_IMAGE_LOAD)
+                ? (LONG64)((const EVENT_IMAGE_LOAD_RECORD*)e)->ImageBase
+                : (LONG64)((const EVENT_THREAD_RECORD*)e)->ThreadId;
+            if (e->ProcessId == 0 || e->ProcessId > producers || number <= last[e->ProcessId])
+                errors++;
+            else
+                last[e->ProcessId] = number;
+        }
+    }
+    ULONG64 ns = NowNs() - start;
+    for (auto& t : threads) t.join();
+
+    ULONG64 produced = (ULONG64)producers * perProducer;
+    ULONG64 dropped = (ULONG64)ring.Dropped;
+    int result = 0;
+    if (errors || consumed + dropped != produced || (ULONG64)ring.Written != consumed) {
+        fprintf(stderr, "osk-dispatch: event ring: %u bad records, %llu consumed + %llu dropped of %llu, %llu written\n",
+            errors, (unsigned long long)consumed, (unsigned long long)dropped,
+            (unsigned long long)produced, (unsigned long long)ring.Written);
+        result = 1;
+    }
+
+    printf("%-12s %10s %10s %10s %12s %12s %10s\n",
+        "stage", "offered", "delivered", "dropped", "Mevents/s", "events/read", "ms");
+    printf("%-12s %10llu %10llu %10llu %12.2f %12.1f %10.1f\n", "ring",
+        (unsigned long long)produced, (unsigned long long)consumed, (unsigned long long)dropped,
+        consumed * 1e3 / ns, reads ? (double)consumed / reads : 0.0, ns / 1e6);
+    return result;
+}
+
+// Drop accounting of a full ring, the subscription mask, the pending-read
+// quota and cancellation, on a small ring with no reads posted
+static int CheckEventLimits(VOID)
+{
+    PFILE_OBJECT device = ShimOpenDevice(4, TRUE);
+    if (!device) {
+        fprintf(stderr, "osk-dispatch: cannot open overlapped device\n");
+        return 1;
+    }
+    int result = 0;
+
+    PendingIo early;
+    BeginReadEvents(device, early);
+    if (FinishIo(early) != STATUS_INVALID_DEVICE_STATE) {
+        fprintf(stderr, "osk-dispatch: read before subscribing: 0x%08X\n", (unsigned)early.Status);
+        result = 1;
+    }
+
+    NTSTATUS badMask = Subscribe(device, 0x80000000, 0);
+    NTSTATUS status = Subscribe(device, EVENT_MASK(EVENT_THREAD_CREATE), EVENT_RING_MIN_SIZE);
+    if (badMask != STATUS_INVALID_PARAMETER || !NT_SUCCESS(status)) {
+        fprintf(stderr, "osk-dispatch: subscribe: 0x%08X, with an unknown type 0x%08X\n",
+            (unsigned)status, (unsigned)badMask);
+        ShimCloseDevice(device);
+        return 1;
+    }
+
+    // Thread exits are not subscribed
+    const ULONG fired = 10000;
+    for (ULONG i = 0; i < fired; i++) {
+        ShimNotifyThread(8, 0x10000 + i, TRUE);
+        ShimNotifyThread(8, 0x10000 + i, FALSE);
+    }
+    EVENT_STATS full = QueryEvents(device);
+    if (full.RingSize != EVENT_RING_MIN_SIZE || full.Written + full.Dropped != fired ||
+        full.Dropped == 0 || full.Channels != 1) {
+        fprintf(stderr, "osk-dispatch: full ring: size %u, %llu written + %llu dropped of %u, %u channels\n",
+            full.RingSize, (unsigned long long)full.Written, (unsigned long long)full.Dropped,
+            fired, full.Channels);
+        result = 1;
+    }
+
+    // With events waiting, reads complete at once; the first reports the drops
+    ULONG64 drained = 0, lost = 0, sequence = 0;
+    ULONG immediate = 0, reads = 0;
+    for (;;) {
+        PendingIo io;
+        if (BeginReadEvents(device, io) != STATUS_PENDING) immediate++;
+        FinishIo(io);
+        reads++;
+        const EVENT_READ_HEADER* header = EventReply(io);
+        if (!header || header->Sequence != sequence) {
+            result = 1;
+            break;
+        }
+        sequence += header->Count;
+        drained += header->Count;
+        lost += header->Lost;
+        if (header->Pending == 0) break;
+    }
+    if (immediate != reads || drained != full.Written || lost != full.Dropped) {
+        fprintf(stderr, "osk-dispatch: draining: %u of %u reads immediate, %llu of %llu events, %llu of %llu drops reported\n",
+            immediate, reads, (unsigned long long)drained, (unsigned long long)full.Written,
+            (unsigned long long)lost, (unsigned long long)full.Dropped);
+        result = 1;
+    }
+
+    // Mask 0 pauses; a later subscription keeps the ring
+    Subscribe(device, 0, 0);
+    for (ULONG i = 0; i < 100; i++)
+        ShimNotifyThread(8, 0x10000 + i, TRUE);
+    Subscribe(device, EVENT_MASK_ALL, EVENT_RING_MAX_SIZE);
+    EVENT_STATS paused = QueryEvents(device);
+    if (paused.Written != full.Written || paused.RingSize != EVENT_RING_MIN_SIZE || paused.Mask != EVENT_MASK_ALL) {
+        fprintf(stderr, "osk-dispatch: paused: %llu written (was %llu), ring %u, mask 0x%X\n",
+            (unsigned long long)paused.Written, (unsigned long long)full.Written, paused.RingSize, paused.Mask);
+        result = 1;
+    }
+
+    // The quota, then CancelIoEx on one read and close with the rest pended
+    std::vector<PendingIo> pended(EVENT_MAX_PENDING_READS + 1);
+    ULONG pendedCount = 0;
+    for (auto& io : pended) {
+        if (BeginReadEvents(device, io) == STATUS_PENDING) pendedCount++;
+    }
+    EVENT_STATS quota = QueryEvents(device);
+    NTSTATUS refused = FinishIo(pended.back());
+    ShimCancelIo(pended[0].Request);
+    NTSTATUS cancelled = FinishIo(pended[0]);
+    ShimCloseDevice(device);
+    CancelTally closed;
+    for (size_t i = 1; i + 1 < pended.size(); i++)
+        Tally(closed, FinishIo(pended[i]));
+
+    if (pendedCount != EVENT_MAX_PENDING_READS || quota.PendingReads != EVENT_MAX_PENDING_READS ||
+        refused != STATUS_QUOTA_EXCEEDED || cancelled != STATUS_CANCELLED ||
+        closed.Cancelled != EVENT_MAX_PENDING_READS - 1) {
+        fprintf(stderr, "osk-dispatch: %u reads pended (%u reported), next 0x%08X, cancelled 0x%08X, "
+            "on close %u completed, %u cancelled, %u failed\n",
+            pendedCount, quota.PendingReads, (unsigned)refused, (unsigned)cancelled,
+            closed.Completed, closed.Cancelled, closed.Other);
+        result = 1;
+    }
+
+    printf("limits: %u fired into %u KB, %llu dropped and reported; %u-read quota; %u cancelled on close\n",
+        fired, EVENT_RING_MIN_SIZE / 1024, (unsigned long long)lost, EVENT_MAX_PENDING_READS, closed.Cancelled);
+    return result;
+}
+
+// End to end: producers fire the shim's notifications while this thread keeps
+// EVENT_BENCH_READS reads pended, re-posting each as it completes. Once the
+// producers are done a sentinel process exit is fired until it is delivered,
+// which means every event written before it has been read
+static int BenchEventChannel(ULONG producers, ULONG rounds)
+{
+    PFILE_OBJECT device = ShimOpenDevice(4, TRUE);
+    if (!device) {
+        fprintf(stderr, "osk-dispatch: cannot open overlapped device\n");
+        return 1;
+    }
+    NTSTATUS status = Subscribe(device, EVENT_MASK_ALL, 0);
+    if (!NT_SUCCESS(status)) {
+        fprintf(stderr, "osk-dispatch: subscribe failed: 0x%08X\n", (unsigned)status);
+        ShimCloseDevice(device);
+        return 1;
+    }
+
+    std::vector<PendingIo> reads(EVENT_BENCH_READS);
+    ULONG pended = 0;
+    for (auto& io : reads) {
+        if (BeginReadEvents(device, io) == STATUS_PENDING) pended++;
+    }
+
+    const ULONG perRound = 7;
+    std::atomic<bool> stop(false);
+    std::atomic<ULONG64> sentinels(0);
+    ULONG64 start = NowNs();
+    std::thread coordinator([&] {
+        std::vector<std::thread> threads;
+        for (ULONG p = 0; p < producers; p++) {
+            threads.emplace_back([p, rounds] {
+                for (ULONG r = 0; r < rounds; r++) {
+                    ULONG pid = 0x1000 + (p * rounds + r) * 4;
+                    ShimNotifyProcessCreate(pid, 4, g_BenchProcessImage);
+                    ShimNotifyThread(pid, pid * 4 + 1, TRUE);
+                    ShimNotifyThread(pid, pid * 4 + 2, TRUE);
+                    ShimNotifyImageLoad(pid, g_BenchModuleImage, 0x7FF800000000ULL, 0x1000);
+                    ShimNotifyThread(pid, pid * 4 + 2, FALSE);
+                    ShimNotifyThread(pid, pid * 4 + 1, FALSE);
+                    ShimNotifyProcessExit(pid);
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+        while (!stop.load()) {
+            ShimNotifyProcessExit(EVENT_BENCH_SENTINEL);
+            sentinels++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    ULONG64 sequence = 0, delivered = 0, real = 0, lost = 0, completions = 0;
+    ULONG64 perType[EVENT_IMAGE_LOAD + 1] = {};
+    ULONG errors = 0;
+    bool sawSentinel = false;
+    for (size_t next = 0; !sawSentinel; next = (next + 1) % reads.size()) {
+        PendingIo& io = reads[next];
+        FinishIo(io);
+        const EVENT_READ_HEADER* header = EventReply(io);
+        if (!header) {
+            fprintf(stderr, "osk-dispatch: read events: 0x%08X, %u bytes\n", (unsigned)io.Status, io.Bytes);
+            errors++;
+            break;
+        }
+        if (header->Sequence != sequence) errors++;
+        sequence = header->Sequence + header->Count;
+        delivered += header->Count;
+        lost += header->Lost;
+        completions++;
+
+        for (const EVENT_HEADER* e = EventNext(header, NULL); e; e = EventNext(header, e)) {
+            if (e->Type == EVENT_PROCESS_EXIT && e->ProcessId == EVENT_BENCH_SENTINEL) {
+                sawSentinel = true;
+                continue;
+            }
+            real++;
+            if (e->Type <= EVENT_IMAGE_LOAD) perType[e->Type]++;
+
+            const WCHAR* name;
+            ULONG length;
+            const WCHAR* expected = (e->Type == EVENT_PROCESS_CREATE) ? g_BenchProcessImage : g_BenchModuleImage;
+            if (EventName(e, &name, &length) &&
+                (length != NameLength(expected) || memcmp(name, expected, length * sizeof(WCHAR))))
+                errors++;
+        }
+        if (!sawSentinel) BeginReadEvents(device, io);
+    }
+    ULONG64 ns = NowNs() - start;
+    stop = true;
+    coordinator.join();
+
+    EVENT_STATS stats = QueryEvents(device);
+
+    // The reads still pended are cancelled by IRP_MJ_CLEANUP, unless the
+    // delivery thread got to them first with the last sentinels
+    std::vector<PendingIo*> outstanding;
+    for (auto& io : reads) {
+        if (io.Request) outstanding.push_back(&io);
+    }
+    ShimCloseDevice(device);
+    CancelTally closed;
+    for (PendingIo* io : outstanding)
+        Tally(closed, FinishIo(*io));
+
+    ULONG64 produced = (ULONG64)producers * rounds * perRound;
+    int result = 0;
+    if (pended != reads.size() || errors || real > produced || real + stats.Dropped < produced ||
+        stats.Written + stats.Dropped != produced + sentinels.load() || stats.Delivered < delivered ||
+        lost > stats.Dropped || closed.Other) {
+        fprintf(stderr, "osk-dispatch: event channel: %u of %zu reads pended, %u errors, %llu of %llu delivered, "
+            "%llu written + %llu dropped of %llu, %u failed on close\n",
+            pended, reads.size(), errors, (unsigned long long)real, (unsigned long long)produced,
+            (unsigned long long)stats.Written, (unsigned long long)stats.Dropped,
+            (unsigned long long)(produced + sentinels.load()), closed.Other);
+        result = 1;
+    }
+
+    printf("%-12s %10llu %10llu %10llu %12.2f %12.1f %10.1f\n", "channel",
+        (unsigned long long)produced, (unsigned long long)real, (unsigned long long)(produced - real),
+        real * 1e3 / ns, completions ? (double)delivered / completions : 0.0, ns / 1e6);
+    printf("channel: %llu completions, %llu wakeups, %llu drops reported; by type %llu/%llu/%llu/%llu/%llu "
+        "(process create/exit, thread create/exit, image)\n",
+        (unsigned long long)completions, (unsigned long long)stats.Wakeups, (unsigned long long)lost,
+        (unsigned long long)perType[EVENT_PROCESS_CREATE], (unsigned long long)perType[EVENT_PROCESS_EXIT],
+        (unsigned long long)perType[EVENT_THREAD_CREATE], (unsigned long long)perType[EVENT_THREAD_EXIT],
+        (unsigned long long)perType[EVENT_IMAGE_LOAD]);
+    printf("close pending:   %u completed, %u cancelled\n", closed.Completed, closed.Cancelled);
+    return result;
+}
+
+static int BenchEvents(VOID)
+{
+    int result = BenchEventRing(EVENT_BENCH_PRODUCERS, 500000);
+    result |= BenchEventChannel(EVENT_BENCH_PRODUCERS, 20000);
+    result |= CheckEventLimits();
+    return result;
+}
+
+// ========== Shared snapshot section ==========
+
+static const ULONG g_SharedRecordSizes[SHARED_TABLE_COUNT] = {
+    sizeof(PROCESS_RECORD_V2), sizeof(THREAD_RECORD_V2), sizeof(MODULE_RECORD_V2),
+};
+static const char* const g_SharedTableNames[SHARED_TABLE_COUNT] = { "processes", "threads", "kernel-modules" };
+
+struct SharedCopy {
+    ULONG64            Generation = 0;
+    ULONG              Retries = 0;
+    std::vector<UCHAR> Tables[SHARED_TABLE_COUNT];
+};
+
+// The view's permissions as the host kernel sees them ("r--s" for a read-only
+// shared mapping); empty once the address is no longer mapped
+static std::string MappingPermissions(ULONG64 address)
+{
+    std::string permissions;
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (!maps) return permissions;
+
+    char line[512];
+    while (fgets(line, sizeof(line), maps)) {
+        unsigned long long begin = 0, end = 0;
+        char perms[8] = { 0 };
+        if (sscanf(line, "%llx-%llx %7s", &begin, &end, perms) == 3 && address >= begin && address < end) {
+            permissions = perms;
+            break;
+        }
+    }
+    fclose(maps);
+    return permissions;
+}
+
+// Copies every table of the newest generation, retrying while the bank is
+// rewritten underneath; false if nothing is published or a table is missing
+static bool ReadShared(const SHARED_SECTION_HEADER* header, SharedCopy& copy)
+{
+    copy.Retries = 0;
+    for (;;) {
+        LONG64 sequence = 0;
+        const SHARED_BANK* bank = SharedBeginRead(header, &sequence);
+        if (!bank) return false;
+
+        bool complete = true;
+        copy.Generation = bank->Generation;
+        for (ULONG t = 0; t < SHARED_TABLE_COUNT; t++) {
+            ULONG size = 0;
+            const UCHAR* table = (const UCHAR*)SharedTable(header, bank, t, &size);
+            if (table)
+                copy.Tables[t].assign(table, table + size);
+            else
+                complete = false;
+        }
+        if (SharedEndRead(bank, sequence)) return complete;
+        copy.Retries++;
+    }
+}
+
+// Every table decodes, and the thread table lines up with the process
+// records' thread counts
+static bool ValidShared(const SharedCopy& copy)
+{
+    for (ULONG t = 0; t < SHARED_TABLE_COUNT; t++) {
+        if (!WireValidate(copy.Tables[t].data(), (ULONG)copy.Tables[t].size(), g_SharedRecordSizes[t]))
+            return false;
+    }
+
+    const VOID* processes = copy.Tables[SHARED_TABLE_PROCESSES].data();
+    const VOID* threads   = copy.Tables[SHARED_TABLE_THREADS].data();
+    ULONG next = 0;
+    for (ULONG i = 0; i < ((const ENUM_V2_HEADER*)processes)->Count; i++) {
+        const PROCESS_RECORD_V2* process = (const PROCESS_RECORD_V2*)WireRecord(processes, i);
+        for (ULONG j = 0; j < process->ThreadCount; j++, next++) {
+            if (next >= ((const ENUM_V2_HEADER*)threads)->Count ||
+                ((const THREAD_RECORD_V2*)WireRecord(threads, next))->ProcessId != process->ProcessId) {
+                return false;
+            }
+        }
+    }
+    return next == ((const ENUM_V2_HEADER*)threads)->Count;
+}
+
+static NTSTATUS MapShared(PFILE_OBJECT device, SHARED_MAP_REPLY* reply)
+{
+    ULONG bytes = 0;
+    return ShimDeviceIoControl(device, IOCTL_MAP_SHARED_SECTION, NULL, 0, reply, sizeof(*reply), &bytes);
+}
+
+static NTSTATUS RefreshShared(PFILE_OBJECT device, ULONG64* generation)
+{
+    SHARED_REFRESH_REPLY reply = { 0 };
+    ULONG bytes = 0;
+    NTSTATUS status = ShimDeviceIoControl(device, IOCTL_REFRESH_SHARED_SECTION, NULL, 0, &reply, sizeof(reply), &bytes);
+    *generation = reply.Generation;
+    return status;
+}
+
+static NTSTATUS EnumV2(PFILE_OBJECT device, ULONG code, std::vector<UCHAR>& buffer, ULONG* bytes)
+{
+    ENUM_REQUEST request = { 0, ENUM_VERSION_2, 0 };
+    return ShimDeviceIoControl(device, code, &request, sizeof(request), buffer.data(), (ULONG)buffer.size(), bytes);
+}
+
+static int CompareShared(ULONG iterations)
+{
+    SHIM_SNAPSHOT_COUNTS counts = ShimSnapshotCounts();
+    SHARED_MAP_REPLY map = { 0 };
+    int result = 0;
+
+    // Only the process that opened the device may map it
+    PFILE_OBJECT foreign = ShimOpenDevice(1234);
+    PFILE_OBJECT device  = ShimOpenDevice(4);
+    if (!foreign || !device) {
+        fprintf(stderr, "osk-dispatch: cannot open device\n");
+        return 1;
+    }
+    NTSTATUS status = MapShared(foreign, &map);
+    ShimCloseDevice(foreign);
+    if (status != STATUS_ACCESS_DENIED) {
+        fprintf(stderr, "osk-dispatch: mapping from another process returned 0x%08X\n", (unsigned)status);
+        result = 1;
+    }
+
+    status = MapShared(device, &map);
+    SHARED_MAP_REPLY again = { 0 };
+    NTSTATUS againStatus = MapShared(device, &again);
+    if (!NT_SUCCESS(status) || !NT_SUCCESS(againStatus) || again.Address != map.Address) {
+        fprintf(stderr, "osk-dispatch: map failed: 0x%08X / 0x%08X\n", (unsigned)status, (unsigned)againStatus);
+        ShimCloseDevice(device);
+        return 1;
+    }
+
+    const SHARED_SECTION_HEADER* header = (const SHARED_SECTION_HEADER*)(ULONG_PTR)map.Address;
+    std::string permissions = MappingPermissions(map.Address);
+    if (header->Magic != SHARED_SECTION_MAGIC || header->Version != SHARED_SECTION_VERSION ||
+        header->SectionSize != map.Size || map.Generation == 0 || permissions.compare(0, 2, "r-") != 0) {
+        fprintf(stderr, "osk-dispatch: bad view: magic 0x%08X, generation %llu, permissions '%s'\n",
+            header->Magic, (unsigned long long)map.Generation, permissions.c_str());
+        result = 1;
+    }
+
+    // Tables must match the IOCTL replies for the same system byte for byte
+    SharedCopy copy;
+    if (!ReadShared(header, copy) || !ValidShared(copy)) {
+        fprintf(stderr, "osk-dispatch: shared tables missing or invalid\n");
+        ShimCloseDevice(device);
+        return 1;
+    }
+    ULONG expected[SHARED_TABLE_COUNT] = { counts.Processes, counts.Threads, counts.KernelModules };
+    for (ULONG t = 0; t < SHARED_TABLE_COUNT; t++) {
+        ULONG count = ((const ENUM_V2_HEADER*)copy.Tables[t].data())->Count;
+        if (count != expected[t]) {
+            fprintf(stderr, "osk-dispatch: shared %s: %u records, expected %u\n", g_SharedTableNames[t], count, expected[t]);
+            result = 1;
+        }
+    }
+
+    const struct { ULONG Table; ULONG Code; } ioctls[] = {
+        { SHARED_TABLE_PROCESSES,      IOCTL_ENUM_PROCESSES },
+        { SHARED_TABLE_KERNEL_MODULES, IOCTL_ENUM_KERNEL_MODULES },
+    };
+    std::vector<UCHAR> replies[RTL_NUMBER_OF(ioctls)];
+    for (size_t i = 0; i < RTL_NUMBER_OF(ioctls); i++) {
+        const std::vector<UCHAR>& table = copy.Tables[ioctls[i].Table];
+        replies[i].resize(table.size());
+        ULONG bytes = 0;
+        status = EnumV2(device, ioctls[i].Code, replies[i], &bytes);
+        if (!NT_SUCCESS(status) || bytes != table.size() || memcmp(replies[i].data(), table.data(), bytes) != 0) {
+            fprintf(stderr, "osk-dispatch: shared %s differs from the IOCTL reply (0x%08X)\n",
+                g_SharedTableNames[ioctls[i].Table], (unsigned)status);
+            result = 1;
+        }
+    }
+
+    // Reads from memory vs the IOCTLs that return the same tables
+    ULONG64 sharedNs = 0, ioctlNs = 0, retries = 0;
+    for (ULONG it = 0; it < iterations; it++) {
+        ULONG64 start = NowNs();
+        bool ok = ReadShared(header, copy) && ValidShared(copy);
+        sharedNs += NowNs() - start;
+        retries += copy.Retries;
+        if (!ok) result = 1;
+
+        start = NowNs();
+        for (size_t i = 0; i < RTL_NUMBER_OF(ioctls); i++) {
+            ULONG bytes = 0;
+            if (!NT_SUCCESS(EnumV2(device, ioctls[i].Code, replies[i], &bytes)) ||
+                !WireValidate(replies[i].data(), bytes, g_SharedRecordSizes[ioctls[i].Table])) {
+                result = 1;
+            }
+        }
+        ioctlNs += NowNs() - start;
+    }
+
+    ULONG sharedBytes = 0;
+    for (const auto& table : copy.Tables) sharedBytes += (ULONG)table.size();
+    double calls = iterations ? iterations : 1;
+    printf("%-28s %10s %12s %10s\n", "read", "bytes", "ms/read", "syscalls");
+    printf("%-28s %10u %12.3f %10u\n", "shared (3 tables)", sharedBytes, sharedNs / 1e6 / calls, 0);
+    printf("%-28s %10u %12.3f %10u\n", "ioctl v2 (processes+kmods)",
+        (ULONG)(replies[0].size() + replies[1].size()), ioctlNs / 1e6 / calls, (ULONG)RTL_NUMBER_OF(ioctls));
+
+    // Out-of-cycle refreshes race a reader; every copy it accepts must decode
+    ULONG64 before = 0;
+    RefreshShared(device, &before);
+    std::atomic<bool> done(false);
+    std::atomic<ULONG> refreshFailures(0);
+    std::thread writer([&] {
+        ULONG64 generation = 0;
+        for (ULONG i = 0; i < 200; i++) {
+            if (!NT_SUCCESS(RefreshShared(device, &generation))) refreshFailures++;
+        }
+        done = true;
+    });
+    ULONG64 reads = 0, invalid = 0;
+    retries = 0;
+    while (!done) {
+        if (!ReadShared(header, copy) || !ValidShared(copy)) invalid++;
+        retries += copy.Retries;
+        reads++;
+    }
+    writer.join();
+    ULONG64 after = (ULONG64)header->Generation;
+    printf("concurrent: %llu generations published, %llu reads, %llu retries, %llu invalid\n",
+        (unsigned long long)(after - before), (unsigned long long)reads,
+        (unsigned long long)retries, (unsigned long long)invalid);
+    if (invalid || refreshFailures || after < before + 200) result = 1;
+
+    // The refresh thread publishes on its own while a view is mapped
+    std::this_thread::sleep_for(std::chrono::milliseconds(header->RefreshIntervalMs * 3 / 2));
+    if ((ULONG64)header->Generation <= after) {
+        fprintf(stderr, "osk-dispatch: no periodic refresh within %u ms\n", header->RefreshIntervalMs * 3 / 2);
+        result = 1;
+    }
+    printf("periodic:   generation %llu -> %llu, last capture %u us\n", (unsigned long long)after,
+        (unsigned long long)header->Generation, header->Banks[header->Generation & 1].CaptureMicroseconds);
+
+    ShimCloseDevice(device);
+    if (!MappingPermissions(map.Address).empty()) {
+        fprintf(stderr, "osk-dispatch: view still mapped after close\n");
+        result = 1;
+    }
+    return result;
+}
+
+// ========== Process snapshot reuse ==========
+
+struct SnapshotCost {
+    ULONG64 Calls = 0;
+    ULONG64 Queries = 0;        // ZwQuerySystemInformation
+    ULONG64 Allocations = 0;    // pool allocations of any kind
+    ULONG64 Ns = 0;
+    ULONG   Invalid = 0;
+};
+
+// One v1 process enumeration into an exactly sized buffer; the reply must list every process
+static void EnumProcessesOnce(PFILE_OBJECT device, std::vector<UCHAR>& buffer, SnapshotCost& cost)
+{
+    ENUM_REQUEST request = { 0, ENUM_VERSION_1 };
+    ULONG bytes = 0;
+
+    SHIM_STATS before = ShimGetStats();
+    ULONG64 start = NowNs();
+    NTSTATUS status = ShimDeviceIoControl(device, IOCTL_ENUM_PROCESSES, &request, sizeof(request),
+        buffer.data(), (ULONG)buffer.size(), &bytes);
+    cost.Ns += NowNs() - start;
+    SHIM_STATS after = ShimGetStats();
+
+    cost.Calls++;
+    cost.Queries += after.SystemQueries - before.SystemQueries;
+    cost.Allocations += after.PoolAllocations - before.PoolAllocations;
+    if (!NT_SUCCESS(status) || bytes != buffer.size() ||
+        ((const LIST_HEADER*)buffer.data())->Count != ShimSnapshotCounts().Processes) {
+        cost.Invalid++;
+    }
+}
+
+static int CompareProcessSnapshots(ULONG iterations)
+{
+    SHIM_SNAPSHOT_COUNTS counts = ShimSnapshotCounts();
+    size_t size = sizeof(LIST_HEADER) + (size_t)counts.Processes * sizeof(PROCESS_INFO);
+    std::vector<UCHAR> buffer(size);
+    PFILE_OBJECT device = ShimOpenDevice(4);
+    if (!device) {
+        fprintf(stderr, "osk-dispatch: cannot open device\n");
+        return 1;
+    }
+
+    // Cold: usually served by the snapshot the process table was seeded from at load
+    SnapshotCost cold;
+    EnumProcessesOnce(device, buffer, cold);
+
+    // A process exit between enumerations: one query each, into the same buffer
+    SnapshotCost exited;
+    for (ULONG it = 0; it < iterations; it++) {
+        ShimNotifyProcessExit(0x7FFFFFF0);
+        EnumProcessesOnce(device, buffer, exited);
+    }
+
+    // Back to back within the freshness window: served from the cached snapshot
+    SnapshotCost burst;
+    for (ULONG it = 0; it < iterations; it++)
+        EnumProcessesOnce(device, buffer, burst);
+
+    // Older than the window: recaptured in place
+    SnapshotCost aged;
+    for (ULONG it = 0; it < 3; it++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(PROCESS_SNAPSHOT_FRESH_MS + 20));
+        EnumProcessesOnce(device, buffer, aged);
+    }
+
+    // Readers on several handles while exits keep invalidating the snapshot; the shim's
+    // counters are global, so this row is accounted for the run as a whole
+    const ULONG readers = 4;
+    SHIM_STATS before = ShimGetStats();
+    ULONG64 start = NowNs();
+    std::vector<SnapshotCost> shared(readers);
+    std::vector<std::thread> threads;
+    std::atomic<bool> done(false);
+    for (ULONG r = 0; r < readers; r++) {
+        threads.emplace_back([&, r]() {
+            PFILE_OBJECT handle = ShimOpenDevice(4);
+            std::vector<UCHAR> local(size);
+            for (ULONG it = 0; it < iterations * 10; it++)
+                EnumProcessesOnce(handle, local, shared[r]);
+            ShimCloseDevice(handle);
+        });
+    }
+    std::thread churn([&]() {
+        while (!done.load()) {
+            ShimNotifyProcessExit(0x7FFFFFF0);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+    for (auto& thread : threads)
+        thread.join();
+    done = true;
+    churn.join();
+
+    SHIM_STATS after = ShimGetStats();
+    SnapshotCost concurrent;
+    concurrent.Ns = (NowNs() - start) * readers;
+    concurrent.Queries = after.SystemQueries - before.SystemQueries;
+    concurrent.Allocations = after.PoolAllocations - before.PoolAllocations;
+    for (const auto& cost : shared) {
+        concurrent.Calls += cost.Calls;
+        concurrent.Invalid += cost.Invalid;
+    }
+
+    struct { const char* Name; const SnapshotCost* Cost; } rows[] = {
+        { "cold", &cold }, { "after-exit", &exited }, { "burst", &burst },
+        { "aged", &aged }, { "concurrent", &concurrent },
+    };
+    int result = 0;
+    printf("%-12s %8s %12s %12s %10s\n", "scenario", "calls", "queries/call", "allocs/call", "avg us");
+    for (const auto& row : rows) {
+        const SnapshotCost& c = *row.Cost;
+        double calls = c.Calls ? (double)c.Calls : 1;
+        printf("%-12s %8llu %12.2f %12.2f %10.1f\n", row.Name, (unsigned long long)c.Calls,
+            c.Queries / calls, c.Allocations / calls, c.Ns / 1e3 / calls);
+        if (c.Invalid) {
+            fprintf(stderr, "osk-dispatch: %s: %u invalid replies\n", row.Name, c.Invalid);
+            result = 1;
+        }
+    }
+
+    // The probe-and-fill pattern this replaces cost two queries and a fresh buffer per capture
+    if (exited.Queries != exited.Calls || aged.Queries != aged.Calls || burst.Queries != 0) {
+        fprintf(stderr, "osk-dispatch: unexpected query counts (after-exit %llu, aged %llu, burst %llu)\n",
+            (unsigned long long)exited.Queries, (unsigned long long)aged.Queries,
+            (unsigned long long)burst.Queries);
+        result = 1;
+    }
+
+    ShimCloseDevice(device);
+    return result;
+}
+
+// ========== Process table ==========
+
+// Prefix of a SystemProcessInformation entry, as the snapshot readers walk it
+struct SpiProcess {
+    ULONG          NextEntryOffset;
+    ULONG          NumberOfThreads;
+    LARGE_INTEGER  Reserved[3];
+    LARGE_INTEGER  CreateTime;
+    LARGE_INTEGER  UserTime;
+    LARGE_INTEGER  KernelTime;
+    UNICODE_STRING ImageName;
+    LONG           BasePriority;
+    HANDLE         UniqueProcessId;
+    HANDLE         InheritedFromUniqueProcessId;
+    ULONG          HandleCount;
+    ULONG          SessionId;
+    ULONG_PTR      UniqueProcessKey;
+    SIZE_T         PeakVirtualSize;
+    SIZE_T         VirtualSize;
+    ULONG          PageFaultCount;
+    SIZE_T         PeakWorkingSetSize;
+    SIZE_T         WorkingSetSize;
+};
+
+static const SpiProcess* NextSpi(const SpiProcess* entry)
+{
+    return entry->NextEntryOffset ? (const SpiProcess*)((const UCHAR*)entry + entry->NextEntryOffset) : NULL;
+}
+
+// What the table replaces: a fresh-enough shared snapshot, walked to the entry
+static NTSTATUS SnapshotSession(ULONG processId, ULONG* sessionId)
+{
+    PPROCESS_SNAPSHOT snapshot = NULL;
+    NTSTATUS status = ProcessSnapshotAcquire(PROCESS_SNAPSHOT_FRESH_MS, &snapshot);
+    if (!NT_SUCCESS(status)) return status;
+
+    status = STATUS_NOT_FOUND;
+    for (const SpiProcess* entry = (const SpiProcess*)snapshot->Data; entry; entry = NextSpi(entry)) {
+        if ((ULONG)(ULONG_PTR)entry->UniqueProcessId == processId) {
+            *sessionId = entry->SessionId;
+            status = STATUS_SUCCESS;
+            break;
+        }
+    }
+    ProcessSnapshotRelease(snapshot);
+    return status;
+}
+
+static NTSTATUS SnapshotFindByName(PCUNICODE_STRING name, ULONG* processId)
+{
+    PPROCESS_SNAPSHOT snapshot = NULL;
+    NTSTATUS status = ProcessSnapshotAcquire(PROCESS_SNAPSHOT_FRESH_MS, &snapshot);
+    if (!NT_SUCCESS(status)) return status;
+
+    status = STATUS_NOT_FOUND;
+    for (const SpiProcess* entry = (const SpiProcess*)snapshot->Data; entry; entry = NextSpi(entry)) {
+        if (entry->UniqueProcessId && RtlEqualUnicodeString(&entry->ImageName, name, TRUE)) {
+            *processId = (ULONG)(ULONG_PTR)entry->UniqueProcessId;
+            status = STATUS_SUCCESS;
+            break;
+        }
+    }
+    ProcessSnapshotRelease(snapshot);
+    return status;
+}
+
+// The table keeps at most PROCESS_TABLE_NAME_CHARS of the name
+static bool SameName(const WCHAR* fixed, const WCHAR* name, ULONG nameLength, bool truncated)
+{
+    ULONG length = 0;
+    while (length < 259 && fixed[length]) length++;
+    ULONG kept = std::min<ULONG>(length, PROCESS_TABLE_NAME_CHARS);
+    return nameLength == kept && truncated == (length > kept) &&
+        !memcmp(fixed, name, kept * sizeof(WCHAR));
+}
+
+// Every live process must be in the table with the shim's identity, parent, session and name
+static ULONG CheckTable(PFILE_OBJECT device, const char* stage)
+{
+    std::vector<UCHAR> buffer(64 * 1024);
+    Result listing;
+    ULONG bytes = 0;
+    Request enumProcesses = { IOCTL_ENUM_PROCESSES, 0 };
+    if (!NT_SUCCESS(Issue(device, enumProcesses, buffer, listing, &bytes))) {
+        fprintf(stderr, "osk-dispatch: %s: IOCTL_ENUM_PROCESSES failed\n", stage);
+        return 1;
+    }
+
+    const LIST_HEADER* header = (const LIST_HEADER*)buffer.data();
+    const PROCESS_INFO* info = (const PROCESS_INFO*)(header + 1);
+    ULONG expected = 0, mismatches = 0;
+    for (ULONG p = 0; p < header->Count; p++) {
+        if (info[p].ProcessId == 0) continue;
+        expected++;
+
+        PROCESS_TABLE_ENTRY entry;
+        PEPROCESS process = NULL;
+        bool same = NT_SUCCESS(ProcessTableLookup(info[p].ProcessId, &entry)) &&
+            NT_SUCCESS(PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)info[p].ProcessId, &process));
+        if (same) {
+            same = entry.ParentProcessId == info[p].ParentProcessId &&
+                entry.SessionId == PsGetProcessSessionId(process) &&
+                entry.CreateTime == PsGetProcessCreateTimeQuadPart(process) &&
+                SameName(info[p].ImageName, entry.ImageName, entry.NameLength,
+                    (entry.Flags & PROCESS_TABLE_NAME_TRUNCATED) != 0);
+        }
+        if (process) ObDereferenceObject(process);
+        if (!same) mismatches++;
+    }
+
+    PROCESS_TABLE_STATS stats;
+    ProcessTableQueryStats(&stats);
+    if (stats.Count != expected) mismatches++;
+    if (mismatches)
+        fprintf(stderr, "osk-dispatch: %s: %u table mismatches (%u entries, %u processes)\n",
+            stage, mismatches, stats.Count, expected);
+    return mismatches;
+}
+
+static int CompareProcessTable(PFILE_OBJECT device, ULONG iterations)
+{
+    int result = CheckTable(device, "seeded") ? 1 : 0;
+
+    PROCESS_TABLE_STATS stats;
+    ProcessTableQueryStats(&stats);
+    std::vector<PROCESS_TABLE_ENTRY> entries(stats.Count + 64);
+    ULONG count = 0;
+    ULONG64 generation = 0;
+    ProcessTableCopy(entries.data(), (ULONG)entries.size(), &count, &generation);
+    entries.resize(count);
+
+    // A name lookup returns every process with that name, in table order, so a
+    // caller can skip a stale match and still find a live one
+    ULONG nameMismatches = 0;
+    for (size_t i = 0; i < entries.size(); i += 16) {
+        UNICODE_STRING name = { (USHORT)(entries[i].NameLength * sizeof(WCHAR)),
+            (USHORT)(entries[i].NameLength * sizeof(WCHAR)), entries[i].ImageName };
+        std::vector<ULONG> expected;
+        for (const auto& e : entries) {
+            if (e.NameLength == entries[i].NameLength &&
+                !memcmp(e.ImageName, entries[i].ImageName, e.NameLength * sizeof(WCHAR)))
+                expected.push_back(e.ProcessId);
+        }
+        std::vector<PROCESS_TABLE_MATCH> matches(expected.size() + 1);
+        ULONG found = 0;
+        NTSTATUS status = ProcessTableFindByName(&name, NULL, matches.data(), (ULONG)matches.size(), &found);
+        bool same = NT_SUCCESS(status) && found == expected.size();
+        for (ULONG m = 0; same && m < found; m++)
+            same = matches[m].ProcessId == expected[m];
+        if (!same) nameMismatches++;
+    }
+    if (nameMismatches) {
+        fprintf(stderr, "osk-dispatch: %u name lookups did not return every match\n", nameMismatches);
+        result = 1;
+    }
+
+    // Per PID and per name, table against the snapshot walk; both see the same processes.
+    // The snapshot side is served from the shared snapshot while it stays fresh.
+    struct Timing { ULONG64 Calls = 0; ULONG64 Ns = 0; ULONG Failures = 0; };
+    Timing tableLookup, snapshotLookup, tableChurn, snapshotChurn, tableName, snapshotName, tableWalk, snapshotWalk;
+    for (ULONG it = 0; it < iterations; it++) {
+        ULONG64 start = NowNs();
+        for (const auto& e : entries) {
+            PROCESS_TABLE_ENTRY found;
+            if (!NT_SUCCESS(ProcessTableLookup(e.ProcessId, &found)) || found.SessionId != e.SessionId)
+                tableLookup.Failures++;
+        }
+        tableLookup.Ns += NowNs() - start;
+        tableLookup.Calls += entries.size();
+
+        start = NowNs();
+        for (const auto& e : entries) {
+            ULONG session = MAXULONG;
+            if (!NT_SUCCESS(SnapshotSession(e.ProcessId, &session)) || session != e.SessionId)
+                snapshotLookup.Failures++;
+        }
+        snapshotLookup.Ns += NowNs() - start;
+        snapshotLookup.Calls += entries.size();
+
+        // With processes coming and going every snapshot is stale by the next lookup
+        start = NowNs();
+        for (size_t i = 0; i < entries.size(); i += 16) {
+            PROCESS_TABLE_ENTRY found;
+            if (!NT_SUCCESS(ProcessTableLookup(entries[i].ProcessId, &found)))
+                tableChurn.Failures++;
+            tableChurn.Calls++;
+        }
+        tableChurn.Ns += NowNs() - start;
+
+        start = NowNs();
+        for (size_t i = 0; i < entries.size(); i += 16) {
+            ULONG session = MAXULONG;
+            ProcessSnapshotInvalidate();
+            if (!NT_SUCCESS(SnapshotSession(entries[i].ProcessId, &session)) || session != entries[i].SessionId)
+                snapshotChurn.Failures++;
+            snapshotChurn.Calls++;
+        }
+        snapshotChurn.Ns += NowNs() - start;
+
+        // A name per 16 processes: each table lookup collects every match
+        start = NowNs();
+        for (size_t i = 0; i < entries.size(); i += 16) {
+            UNICODE_STRING name = { (USHORT)(entries[i].NameLength * sizeof(WCHAR)),
+                (USHORT)(entries[i].NameLength * sizeof(WCHAR)), entries[i].ImageName };
+            PROCESS_TABLE_MATCH matches[16];
+            ULONG count = 0;
+            if (!NT_SUCCESS(ProcessTableFindByName(&name, NULL, matches, RTL_NUMBER_OF(matches), &count)))
+                tableName.Failures++;
+            tableName.Calls++;
+        }
+        tableName.Ns += NowNs() - start;
+
+        start = NowNs();
+        for (size_t i = 0; i < entries.size(); i += 16) {
+            UNICODE_STRING name = { (USHORT)(entries[i].NameLength * sizeof(WCHAR)),
+                (USHORT)(entries[i].NameLength * sizeof(WCHAR)), entries[i].ImageName };
+            ULONG pid = 0;
+            if (!NT_SUCCESS(SnapshotFindByName(&name, &pid)))
+                snapshotName.Failures++;
+            snapshotName.Calls++;
+        }
+        snapshotName.Ns += NowNs() - start;
+
+        // Full enumeration: the compact array against the variable-length chain
+        std::vector<PROCESS_TABLE_ENTRY> copy(entries.size() + 64);
+        start = NowNs();
+        ULONG copied = 0;
+        if (!NT_SUCCESS(ProcessTableCopy(copy.data(), (ULONG)copy.size(), &copied, &generation)) ||
+            copied != entries.size())
+            tableWalk.Failures++;
+        tableWalk.Ns += NowNs() - start;
+        tableWalk.Calls++;
+
+        start = NowNs();
+        PPROCESS_SNAPSHOT snapshot = NULL;
+        ULONG walked = 0;
+        if (NT_SUCCESS(ProcessSnapshotAcquire(PROCESS_SNAPSHOT_FRESH_MS, &snapshot))) {
+            for (const SpiProcess* entry = (const SpiProcess*)snapshot->Data; entry; entry = NextSpi(entry))
+                walked += entry->UniqueProcessId != 0;
+            ProcessSnapshotRelease(snapshot);
+        }
+        if (walked != entries.size())
+            snapshotWalk.Failures++;
+        snapshotWalk.Ns += NowNs() - start;
+        snapshotWalk.Calls++;
+    }
+
+    struct { const char* Name; const Timing* Table; const Timing* Snapshot; } rows[] = {
+        { "by-pid", &tableLookup, &snapshotLookup },
+        { "by-pid/churn", &tableChurn, &snapshotChurn },
+        { "by-name", &tableName, &snapshotName },
+        { "walk", &tableWalk, &snapshotWalk },
+    };
+    printf("%-12s %8s %14s %14s %9s\n", "lookup", "calls", "table ns", "snapshot ns", "speedup");
+    for (const auto& row : rows) {
+        double calls = row.Table->Calls ? (double)row.Table->Calls : 1;
+        double table = row.Table->Ns / calls;
+        double snap = row.Snapshot->Ns / calls;
+        printf("%-12s %8llu %14.1f %14.1f %8.1fx\n", row.Name, (unsigned long long)row.Table->Calls,
+            table, snap, table > 0 ? snap / table : 0.0);
+        if (row.Table->Failures || row.Snapshot->Failures) {
+            fprintf(stderr, "osk-dispatch: %s: %u table / %u snapshot failures\n",
+                row.Name, row.Table->Failures, row.Snapshot->Failures);
+            result = 1;
+        }
+    }
+
+    // Create and exit notifications update the table without a query
+    const ULONG ghost = 0x7FFFFFF0;
+    SHIM_STATS before = ShimGetStats();
+    ShimNotifyProcessCreate(ghost, 4, g_BenchProcessImage);
+    PROCESS_TABLE_ENTRY entry;
+    PROCESS_TABLE_ENTRY system;
+    bool created = NT_SUCCESS(ProcessTableLookup(ghost, &entry)) &&
+        NT_SUCCESS(ProcessTableLookup(4, &system)) &&
+        entry.ParentProcessId == 4 && entry.SessionId == system.SessionId &&
+        entry.NameLength == 11 && !memcmp(entry.ImageName, L"notepad.exe", 11 * sizeof(WCHAR));
+    ShimNotifyProcessExit(ghost);
+    bool exited = ProcessTableLookup(ghost, &entry) == STATUS_NOT_FOUND;
+    if (!created || !exited || ShimGetStats().SystemQueries != before.SystemQueries) {
+        fprintf(stderr, "osk-dispatch: notifications: created %d, exited %d\n", created, exited);
+        result = 1;
+    }
+
+    // Drift: an exit reported for a live process and a create for one that never
+    // existed; one reconcile pass puts back the first and drops the second
+    ULONG victim = entries.back().ProcessId;
+    ShimNotifyProcessExit(victim);
+    ShimNotifyProcessCreate(ghost, 4, g_BenchProcessImage);
+    PROCESS_TABLE_STATS drift;
+    ProcessTableQueryStats(&drift);
+    NTSTATUS status = ProcessTableReconcile();
+    PROCESS_TABLE_STATS reconciled;
+    ProcessTableQueryStats(&reconciled);
+    if (!NT_SUCCESS(status) ||
+        reconciled.ReconcileAdded - drift.ReconcileAdded != 1 ||
+        reconciled.ReconcileRemoved - drift.ReconcileRemoved != 1 ||
+        !NT_SUCCESS(ProcessTableLookup(victim, &entry)) ||
+        ProcessTableLookup(ghost, &entry) != STATUS_NOT_FOUND) {
+        fprintf(stderr, "osk-dispatch: reconcile: status 0x%08X, added %llu, removed %llu\n", (unsigned)status,
+            (unsigned long long)(reconciled.ReconcileAdded - drift.ReconcileAdded),
+            (unsigned long long)(reconciled.ReconcileRemoved - drift.ReconcileRemoved));
+        result = 1;
+    }
+    if (CheckTable(device, "reconciled")) result = 1;
+
+    // A real exit: killed through the driver, gone from the table before the reply
+    ULONG killed = 0;
+    for (auto it = entries.rbegin(); it != entries.rend() && !killed; ++it) {
+        if (it->ProcessId == 4) continue;
+        PROCESS_REQUEST request = { it->ProcessId };
+        PROCESS_KILL_RESULT kill = {};
+        ULONG bytes = 0;
+        if (NT_SUCCESS(ShimDeviceIoControl(device, IOCTL_KILL_PROCESS, &request, sizeof(request),
+                &kill, sizeof(kill), &bytes)))
+            killed = it->ProcessId;
+    }
+    if (!killed || ProcessTableLookup(killed, &entry) != STATUS_NOT_FOUND) {
+        fprintf(stderr, "osk-dispatch: kill: process %u still in the table\n", killed);
+        result = 1;
+    }
+    ProcessTableQueryStats(&drift);
+    ProcessTableReconcile();
+    ProcessTableQueryStats(&reconciled);
+    if (reconciled.ReconcileAdded != drift.ReconcileAdded || reconciled.ReconcileRemoved != drift.ReconcileRemoved) {
+        fprintf(stderr, "osk-dispatch: reconcile after kill changed the table\n");
+        result = 1;
+    }
+    if (CheckTable(device, "after kill")) result = 1;
+
+    printf("table: %u entries, generation %llu, %llu inserts, %llu removals, %llu reconciles (+%llu / -%llu)\n",
+        reconciled.Count, (unsigned long long)reconciled.Generation,
+        (unsigned long long)reconciled.Inserts, (unsigned long long)reconciled.Removals,
+        (unsigned long long)reconciled.Reconciles, (unsigned long long)reconciled.ReconcileAdded,
+        (unsigned long long)reconciled.ReconcileRemoved);
+    return result;
+}
+
+// ========== Delta process enumeration ==========
+
+struct DeltaReply {
+    PROCESS_DELTA_HEADER             Header = {};
+    std::vector<PROCESS_DELTA_ENTRY> Entries;
+    ULONG                            Bytes = 0;
+    ULONG                            Overflows = 0;
+};
+
+// Grows the buffer on STATUS_BUFFER_OVERFLOW, as a client would
+static NTSTATUS QueryDelta(PFILE_OBJECT device, ULONG64 since, std::vector<UCHAR>& buffer, DeltaReply& reply)
+{
+    PROCESS_DELTA_REQUEST request = { since };
+    reply.Overflows = 0;
+    for (int attempt = 0; attempt < 8; attempt++) {
+        ULONG bytes = 0;
+        NTSTATUS status = ShimDeviceIoControl(device, IOCTL_ENUM_PROCESSES_DELTA, &request, sizeof(request),
+            buffer.data(), (ULONG)buffer.size(), &bytes);
+        const PROCESS_DELTA_HEADER* header = (const PROCESS_DELTA_HEADER*)buffer.data();
+        if (status == STATUS_BUFFER_OVERFLOW) {
+            if (bytes != sizeof(PROCESS_DELTA_HEADER) || header->TotalSize <= buffer.size())
+                return STATUS_UNSUCCESSFUL;
+            reply.Overflows++;
+            buffer.resize(header->TotalSize);
+            continue;
+        }
+        if (!NT_SUCCESS(status)) return status;
+
+        if (header->TotalSize != bytes ||
+            bytes != sizeof(PROCESS_DELTA_HEADER) + (ULONG64)header->Count * sizeof(PROCESS_DELTA_ENTRY))
+            return STATUS_UNSUCCESSFUL;
+        const PROCESS_DELTA_ENTRY* entries = (const PROCESS_DELTA_ENTRY*)(header + 1);
+        reply.Header = *header;
+        reply.Entries.assign(entries, entries + header->Count);
+        reply.Bytes = bytes;
+        return status;
+    }
+    return STATUS_BUFFER_OVERFLOW;
+}
+
+// The client side: a full reply replaces the view, an exit only removes the
+// instance it names
+static void ApplyDelta(std::map<ULONG, PROCESS_DELTA_ENTRY>& view, const DeltaReply& reply)
+{
+    if (reply.Header.Flags & PROCESS_DELTA_FULL)
+        view.clear();
+    for (const auto& e : reply.Entries) {
+        auto it = view.find(e.ProcessId);
+        if (e.Kind == PROCESS_DELTA_EXITED) {
+            if (it != view.end() && it->second.CreateTime == e.CreateTime)
+                view.erase(it);
+        } else {
+            view[e.ProcessId] = e;
+        }
+    }
+}
+
+// The view must list exactly the processes of a v1 enumeration, with their
+// parent, thread count and name
+static ULONG CheckDeltaView(PFILE_OBJECT device, const std::map<ULONG, PROCESS_DELTA_ENTRY>& view, const char* stage)
+{
+    std::vector<UCHAR> buffer(64 * 1024);
+    Result listing;
+    ULONG bytes = 0;
+    Request enumProcesses = { IOCTL_ENUM_PROCESSES, 0 };
+    if (!NT_SUCCESS(Issue(device, enumProcesses, buffer, listing, &bytes))) {
+        fprintf(stderr, "osk-dispatch: %s: IOCTL_ENUM_PROCESSES failed\n", stage);
+        return 1;
+    }
+
+    const LIST_HEADER* header = (const LIST_HEADER*)buffer.data();
+    const PROCESS_INFO* info = (const PROCESS_INFO*)(header + 1);
+    ULONG expected = 0, mismatches = 0;
+    for (ULONG p = 0; p < header->Count; p++) {
+        if (info[p].ProcessId == 0) continue;
+        expected++;
+        auto it = view.find(info[p].ProcessId);
+        if (it == view.end() ||
+            it->second.ParentProcessId != info[p].ParentProcessId ||
+            it->second.ThreadCount != info[p].ThreadCount ||
+            !SameName(info[p].ImageName, it->second.ImageName, it->second.NameLength, it->second.NameTruncated != 0))
+            mismatches++;
+    }
+    if (view.size() != expected) mismatches++;
+    if (mismatches)
+        fprintf(stderr, "osk-dispatch: %s: %u view mismatches (%zu entries, %u processes)\n",
+            stage, mismatches, view.size(), expected);
+    return mismatches;
+}
+
+// Kinds of the entries for process `pid`, in reply order, as a string of C/M/X
+static std::string DeltaKinds(const DeltaReply& reply, ULONG pid)
+{
+    std::string kinds;
+    for (const auto& e : reply.Entries) {
+        if (e.ProcessId != pid) continue;
+        kinds += e.Kind == PROCESS_DELTA_CREATED ? 'C' : e.Kind == PROCESS_DELTA_CHANGED ? 'M' : 'X';
+    }
+    return kinds;
+}
+
+static int CompareProcessDelta(PFILE_OBJECT device, ULONG iterations)
+{
+    int result = 0;
+    std::vector<UCHAR> buffer(sizeof(PROCESS_DELTA_HEADER));
+    std::map<ULONG, PROCESS_DELTA_ENTRY> view;
+
+    // Generation 0 is the whole table, first into a header-sized buffer
+    DeltaReply reply;
+    NTSTATUS status = QueryDelta(device, 0, buffer, reply);
+    if (!NT_SUCCESS(status) || !(reply.Header.Flags & PROCESS_DELTA_FULL) || reply.Overflows != 1) {
+        fprintf(stderr, "osk-dispatch: full delta: status 0x%08X, flags 0x%X, %u overflows\n",
+            (unsigned)status, reply.Header.Flags, reply.Overflows);
+        return 1;
+    }
+    for (const auto& e : reply.Entries) {
+        if (e.Kind != PROCESS_DELTA_CREATED) {
+            fprintf(stderr, "osk-dispatch: full delta: process %u reported as kind %u\n", e.ProcessId, e.Kind);
+            result = 1;
+        }
+    }
+    ApplyDelta(view, reply);
+    if (CheckDeltaView(device, view, "full")) result = 1;
+    ULONG64 generation = reply.Header.Generation;
+    ULONG fullBytes = reply.Bytes;
+
+    // Nothing happened: an empty reply at the same generation
+    if (!NT_SUCCESS(QueryDelta(device, generation, buffer, reply)) || reply.Header.Count != 0 ||
+        reply.Header.Flags != 0 || reply.Header.Generation != generation) {
+        fprintf(stderr, "osk-dispatch: idle delta: %u entries, flags 0x%X\n", reply.Header.Count, reply.Header.Flags);
+        result = 1;
+    }
+
+    // Working set: a small move is not a change, a large one is
+    ULONG target = 0;
+    for (const auto& v : view) {
+        if (v.first != 4) target = v.first;
+    }
+    SIZE_T workingSet = (SIZE_T)view[target].WorkingSetSize;
+    ShimSetWorkingSet(target, workingSet + 64 * 1024);
+    ProcessSnapshotInvalidate();
+    bool small = NT_SUCCESS(QueryDelta(device, generation, buffer, reply)) && reply.Header.Count == 0;
+    SIZE_T grown = workingSet + std::max<SIZE_T>(8 * 1024 * 1024, workingSet / 8);
+    ShimSetWorkingSet(target, grown);
+    ProcessSnapshotInvalidate();
+    bool large = NT_SUCCESS(QueryDelta(device, generation, buffer, reply)) && reply.Header.Count == 1 &&
+        DeltaKinds(reply, target) == "M" && reply.Entries[0].WorkingSetSize == grown;
+    if (!small || !large) {
+        fprintf(stderr, "osk-dispatch: working set: small %d, large %d\n", small, large);
+        result = 1;
+    }
+    ApplyDelta(view, reply);
+    generation = reply.Header.Generation;
+
+    // Create and exit notifications, each its own reply
+    const ULONG ghost = 0x7FFFFFF0;
+    ShimNotifyProcessCreate(ghost, 4, g_BenchProcessImage);
+    bool created = NT_SUCCESS(QueryDelta(device, generation, buffer, reply)) && reply.Header.Count == 1 &&
+        DeltaKinds(reply, ghost) == "C" && reply.Entries[0].ParentProcessId == 4;
+    LONGLONG ghostCreateTime = reply.Entries.empty() ? 0 : reply.Entries[0].CreateTime;
+    generation = reply.Header.Generation;
+    ShimNotifyProcessExit(ghost);
+    bool exited = NT_SUCCESS(QueryDelta(device, generation, buffer, reply)) && reply.Header.Count == 1 &&
+        DeltaKinds(reply, ghost) == "X" && reply.Entries[0].CreateTime == ghostCreateTime;
+    generation = reply.Header.Generation;
+    if (!created || !exited) {
+        fprintf(stderr, "osk-dispatch: notifications: created %d, exited %d\n", created, exited);
+        result = 1;
+    }
+
+    // Steady state: a few changes per poll, the delta against a full v1 enumeration.
+    // Both pay for a fresh snapshot, as they would with processes coming and going.
+    std::vector<UCHAR> listing(64 * 1024);
+    Result v1;
+    ULONG64 deltaNs = 0, deltaBytes = 0, deltaEntries = 0, v1Bytes = 0;
+    ULONG kills = 0;
+    for (ULONG it = 0; it < iterations; it++) {
+        ULONG pid = 0x7FFF0000 + it;
+        ShimNotifyProcessCreate(pid, 4, g_BenchProcessImage);
+        ShimNotifyProcessExit(pid);
+
+        auto bumped = view.begin();
+        std::advance(bumped, it % view.size());
+        workingSet = (SIZE_T)bumped->second.WorkingSetSize;
+        ShimSetWorkingSet(bumped->first, workingSet + std::max<SIZE_T>(8 * 1024 * 1024, workingSet / 8));
+
+        // Every fourth poll also sees a process killed through the driver
+        if (it % 4 == 3 && view.size() > 16) {
+            PROCESS_REQUEST request = { view.rbegin()->first };
+            PROCESS_KILL_RESULT kill = {};
+            ULONG bytes = 0;
+            if (NT_SUCCESS(ShimDeviceIoControl(device, IOCTL_KILL_PROCESS, &request, sizeof(request),
+                    &kill, sizeof(kill), &bytes)))
+                kills++;
+        }
+
+        ProcessSnapshotInvalidate();
+        ULONG64 start = NowNs();
+        status = QueryDelta(device, generation, buffer, reply);
+        deltaNs += NowNs() - start;
+        if (!NT_SUCCESS(status) || (reply.Header.Flags & PROCESS_DELTA_FULL)) {
+            fprintf(stderr, "osk-dispatch: steady state: status 0x%08X, flags 0x%X\n",
+                (unsigned)status, reply.Header.Flags);
+            result = 1;
+            break;
+        }
+        deltaBytes += reply.Bytes;
+        deltaEntries += reply.Header.Count;
+        ApplyDelta(view, reply);
+        generation = reply.Header.Generation;
+
+        ProcessSnapshotInvalidate();
+        ULONG bytes = 0;
+        Request enumProcesses = { IOCTL_ENUM_PROCESSES, 0 };
+        if (NT_SUCCESS(Issue(device, enumProcesses, listing, v1, &bytes)))
+            v1Bytes += bytes;
+    }
+    if (CheckDeltaView(device, view, "steady state")) result = 1;
+
+    double polls = iterations ? (double)iterations : 1;
+    printf("%-8s %8s %12s %12s %12s\n", "reply", "polls", "bytes/poll", "entries/poll", "ns/poll");
+    printf("%-8s %8u %12.0f %12.1f %12.0f\n", "delta", iterations, deltaBytes / polls, deltaEntries / polls, deltaNs / polls);
+    printf("%-8s %8u %12.0f %12.1f %12.0f\n", "full", iterations, v1Bytes / polls,
+        (double)v1.Entries / polls, (double)v1.Ns / polls);
+    printf("delta: %.1fx fewer bytes than a full v1 enumeration (%u-byte full delta, %u kills)\n",
+        deltaBytes ? (double)v1Bytes / deltaBytes : 0.0, fullBytes, kills);
+
+    // More exits than the history holds: the next reply is the whole table
+    for (ULONG i = 0; i <= PROCESS_TABLE_EXIT_HISTORY; i++) {
+        ShimNotifyProcessCreate(ghost, 4, g_BenchProcessImage);
+        ShimNotifyProcessExit(ghost);
+    }
+    bool wrapped = NT_SUCCESS(QueryDelta(device, generation, buffer, reply)) &&
+        (reply.Header.Flags & PROCESS_DELTA_FULL) && DeltaKinds(reply, ghost).empty();
+    ApplyDelta(view, reply);
+    if (!wrapped || CheckDeltaView(device, view, "history wrapped")) {
+        fprintf(stderr, "osk-dispatch: history wrap: flags 0x%X\n", reply.Header.Flags);
+        result = 1;
+    }
+    generation = reply.Header.Generation;
+
+    // Generations this load never handed out: one from the future, one from before the load
+    ULONG64 foreign[] = { generation + 1000000, 1 };
+    for (ULONG64 since : foreign) {
+        if (!NT_SUCCESS(QueryDelta(device, since, buffer, reply)) || !(reply.Header.Flags & PROCESS_DELTA_FULL) ||
+            reply.Header.Count != view.size()) {
+            fprintf(stderr, "osk-dispatch: generation %llu: flags 0x%X, %u entries\n",
+                (unsigned long long)since, reply.Header.Flags, reply.Header.Count);
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// ========== CPU usage ==========
+
+typedef std::map<ULONG, PROCESS_RECORD_V2> ProcessRecords;
+
+// A v2 process enumeration, validated and keyed by PID
+static NTSTATUS EnumProcessRecords(PFILE_OBJECT device, ULONG fields, std::vector<UCHAR>& buffer, ProcessRecords& records)
+{
+    ULONG bytes = 0;
+    NTSTATUS status = EnumFields(device, IOCTL_ENUM_PROCESSES, 0, ENUM_VERSION_2, fields, buffer, &bytes);
+    if (!NT_SUCCESS(status)) return status;
+
+    ULONG recordSize = WireRecordSize(WireProcessFieldEnds, RTL_NUMBER_OF(WireProcessFieldEnds),
+        fields ? fields : PROCESS_FIELDS_ALL);
+    if (!WireValidate(buffer.data(), bytes, recordSize)) return STATUS_UNSUCCESSFUL;
+
+    records.clear();
+    const ENUM_V2_HEADER* header = (const ENUM_V2_HEADER*)buffer.data();
+    for (ULONG i = 0; i < header->Count; i++) {
+        PROCESS_RECORD_V2 record = {};
+        memcpy(&record, WireRecord(buffer.data(), i), std::min<ULONG>(header->RecordSize, sizeof(record)));
+        records[record.ProcessId] = record;
+    }
+    return STATUS_SUCCESS;
+}
+
+// When the snapshot the last request captured was taken; it is still the cached one
+static ULONG64 CachedSnapshotTime(VOID)
+{
+    PPROCESS_SNAPSHOT snapshot = NULL;
+    if (!NT_SUCCESS(ProcessSnapshotAcquire(PROCESS_SNAPSHOT_FRESH_MS, &snapshot))) return 0;
+    ULONG64 capturedAt = snapshot->CapturedAt;
+    ProcessSnapshotRelease(snapshot);
+    return capturedAt;
+}
+
+// A fresh capture and a full v2 enumeration, after the sampler's minimum interval
+static NTSTATUS SampleAfterInterval(PFILE_OBJECT device, std::vector<UCHAR>& buffer, ProcessRecords& records, ULONG64* capturedAt)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(CPU_SAMPLE_MIN_INTERVAL_MS + 100));
+    ProcessSnapshotInvalidate();
+    NTSTATUS status = EnumProcessRecords(device, ENUM_FIELDS_ALL, buffer, records);
+    *capturedAt = CachedSnapshotTime();
+    return status;
+}
+
+// Every new field against the snapshot entry the reply was formatted from
+static ULONG CheckProcessRecords(const ProcessRecords& records)
+{
+    PPROCESS_SNAPSHOT snapshot = NULL;
+    if (!NT_SUCCESS(ProcessSnapshotAcquire(PROCESS_SNAPSHOT_FRESH_MS, &snapshot))) return 1;
+
+    ULONG mismatches = 0, listed = 0;
+    for (const SpiProcess* entry = (const SpiProcess*)snapshot->Data; entry; entry = NextSpi(entry)) {
+        listed++;
+        auto it = records.find((ULONG)(ULONG_PTR)entry->UniqueProcessId);
+        if (it == records.end() ||
+            it->second.CreateTime != entry->CreateTime.QuadPart ||
+            it->second.KernelTime != (ULONG64)entry->KernelTime.QuadPart ||
+            it->second.UserTime != (ULONG64)entry->UserTime.QuadPart ||
+            it->second.PeakWorkingSetSize != entry->PeakWorkingSetSize ||
+            it->second.HandleCount != entry->HandleCount ||
+            it->second.SessionId != entry->SessionId)
+            mismatches++;
+    }
+    ProcessSnapshotRelease(snapshot);
+    return mismatches + (listed != records.size() ? 1 : 0);
+}
+
+static int CompareCpuUsage(PFILE_OBJECT device, ULONG iterations)
+{
+    int result = 0;
+    std::vector<UCHAR> buffer(sizeof(ENUM_V2_HEADER));
+    ProcessRecords baseline, sampled, again;
+    ULONG64 t0 = 0, t1 = 0;
+
+    NTSTATUS status = SampleAfterInterval(device, buffer, baseline, &t0);
+    if (!NT_SUCCESS(status) || baseline.size() < 4) {
+        fprintf(stderr, "osk-dispatch: baseline enumeration failed: 0x%08X\n", (unsigned)status);
+        return 1;
+    }
+    if (ULONG mismatches = CheckProcessRecords(baseline)) {
+        fprintf(stderr, "osk-dispatch: %u process records differ from the snapshot\n", mismatches);
+        result = 1;
+    }
+
+    // Over the next interval: one process busy in kernel mode, one in user mode, one
+    // using more than the machine has (clamped), the rest idle
+    ULONG cpus = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    LONGLONG unit = 1000000LL * cpus;       // 100 ms on every processor
+    auto target = baseline.rbegin();
+    ULONG kernelBusy = (target++)->first, userBusy = (target++)->first, saturated = (target++)->first;
+    ShimAddCpuTime(kernelBusy, 2 * unit, 0);
+    ShimAddCpuTime(userBusy, 0, unit);
+    ShimAddCpuTime(saturated, 100 * unit, 100 * unit);
+
+    status = SampleAfterInterval(device, buffer, sampled, &t1);
+    ULONG64 interval = (t1 - t0) * cpus;
+    ULONG mismatches = 0;
+    for (const auto& r : sampled) {
+        ULONG64 used = 0;
+        if (r.first == kernelBusy) used = 2 * unit;
+        if (r.first == userBusy) used = unit;
+        if (r.first == saturated) used = 200 * unit;
+        ULONG64 expected = interval ? std::min<ULONG64>(used * CPU_SAMPLE_FULL / interval, CPU_SAMPLE_FULL) : 0;
+        if (r.second.CpuUsage != expected) mismatches++;
+    }
+    if (!NT_SUCCESS(status) || mismatches || CheckProcessRecords(sampled)) {
+        fprintf(stderr, "osk-dispatch: sampled usage: status 0x%08X, %u mismatches\n", (unsigned)status, mismatches);
+        result = 1;
+    }
+    printf("interval %.0f ms on %u processors: kernel-busy %.2f%%, user-busy %.2f%%, saturated %.2f%%\n",
+        (t1 - t0) / 1e4, cpus, sampled[kernelBusy].CpuUsage / 100.0, sampled[userBusy].CpuUsage / 100.0,
+        sampled[saturated].CpuUsage / 100.0);
+
+    // A new capture inside the minimum interval keeps the last interval's usage,
+    // while the cumulative times move on
+    ShimAddCpuTime(kernelBusy, unit, 0);
+    ProcessSnapshotInvalidate();
+    status = EnumProcessRecords(device, ENUM_FIELDS_ALL, buffer, again);
+    bool held = NT_SUCCESS(status) && again[kernelBusy].CpuUsage == sampled[kernelBusy].CpuUsage &&
+        again[kernelBusy].KernelTime == sampled[kernelBusy].KernelTime + (ULONG64)unit;
+    if (!held) {
+        fprintf(stderr, "osk-dispatch: capture inside the interval changed the usage\n");
+        result = 1;
+    }
+
+    // What the backend did before: keep the previous reply per PID and join each
+    // refresh against it. Both sides capture afresh each time.
+    const ULONG withoutUsage = PROCESS_FIELDS_ALL & ~PROCESS_FIELD_CPU_USAGE;
+    ULONG64 driverNs = 0, plainNs = 0, joinNs = 0;
+    std::vector<UCHAR> plain(buffer.size());
+    ProcessRecords previous = again, current;
+    ULONG64 previousAt = CachedSnapshotTime();
+    std::map<ULONG, ULONG> joined;
+    for (ULONG it = 0; it < iterations && NT_SUCCESS(status); it++) {
+        ProcessSnapshotInvalidate();
+        ULONG64 start = NowNs();
+        status = EnumProcessRecords(device, ENUM_FIELDS_ALL, buffer, current);
+        driverNs += NowNs() - start;
+        if (!NT_SUCCESS(status)) break;
+
+        ProcessSnapshotInvalidate();
+        start = NowNs();
+        status = EnumProcessRecords(device, withoutUsage, plain, current);
+        plainNs += NowNs() - start;
+        ULONG64 capturedAt = CachedSnapshotTime();
+
+        start = NowNs();
+        ULONG64 elapsed = (capturedAt - previousAt) * cpus;
+        joined.clear();
+        for (const auto& r : current) {
+            auto prev = previous.find(r.first);
+            ULONG64 base = (prev != previous.end() && prev->second.CreateTime == r.second.CreateTime)
+                ? prev->second.KernelTime + prev->second.UserTime : 0;
+            ULONG64 used = r.second.KernelTime + r.second.UserTime - base;
+            joined[r.first] = elapsed ? (ULONG)std::min<ULONG64>(used * CPU_SAMPLE_FULL / elapsed, CPU_SAMPLE_FULL) : 0;
+        }
+        previous.swap(current);
+        previousAt = capturedAt;
+        joinNs += NowNs() - start;
+    }
+    if (!NT_SUCCESS(status)) {
+        fprintf(stderr, "osk-dispatch: timed enumeration failed: 0x%08X\n", (unsigned)status);
+        result = 1;
+    }
+
+    double calls = iterations ? iterations : 1;
+    printf("%-34s %10s\n", "per refresh", "us");
+    printf("%-34s %10.1f\n", "v2 with CpuUsage from the driver", driverNs / 1e3 / calls);
+    printf("%-34s %10.1f\n", "v2 without CpuUsage", plainNs / 1e3 / calls);
+    printf("%-34s %10.1f\n", "  + client PID-keyed join", joinNs / 1e3 / calls);
+    return result;
+}
+
+// ========== Processes with threads ==========
+
+// Thread entries follow their process entry, which is 0x100 bytes on x64
+#define SPI_PROCESS_ENTRY_SIZE  0x100
+
+struct SpiThread {
+    LARGE_INTEGER KernelTime;
+    LARGE_INTEGER UserTime;
+    LARGE_INTEGER CreateTime;
+    ULONG         WaitTime;
+    PVOID         StartAddress;
+    CLIENT_ID     ClientId;
+    LONG          Priority;
+    LONG          BasePriority;
+    ULONG         ContextSwitches;
+    ULONG         ThreadState;
+    ULONG         WaitReason;
+};
+
+static const SpiThread* SpiThreads(const SpiProcess* entry)
+{
+    return (const SpiThread*)((const UCHAR*)entry + SPI_PROCESS_ENTRY_SIZE);
+}
+
+// Both tables of an IOCTL_ENUM_PROCESSES_THREADS reply
+struct ProcessThreadReply {
+    const PROCESS_THREAD_HEADER* Header = NULL;
+    const UCHAR*                 Processes = NULL;
+    const UCHAR*                 Threads = NULL;
+};
+
+// Each table must decode as a v2 reply of its own and agree with the outer header
+static bool SplitProcessThreads(const std::vector<UCHAR>& buffer, ULONG bytes, ULONG processRecordSize, ProcessThreadReply& reply)
+{
+    const PROCESS_THREAD_HEADER* header = (const PROCESS_THREAD_HEADER*)buffer.data();
+    if (bytes < sizeof(*header) || header->Version != ENUM_VERSION_2 || header->TotalSize != bytes ||
+        header->ProcessOffset != sizeof(*header) || header->ThreadOffset % 8 != 0 ||
+        header->ThreadOffset < header->ProcessOffset || header->ThreadOffset > bytes) {
+        return false;
+    }
+
+    const UCHAR* processes = buffer.data() + header->ProcessOffset;
+    const UCHAR* threads   = buffer.data() + header->ThreadOffset;
+    if (!WireValidate(processes, header->ThreadOffset - header->ProcessOffset, processRecordSize) ||
+        !WireValidate(threads, bytes - header->ThreadOffset, sizeof(THREAD_RECORD_V2)) ||
+        ((const ENUM_V2_HEADER*)processes)->Count != header->Count ||
+        ((const ENUM_V2_HEADER*)threads)->Count != header->ThreadCount) {
+        return false;
+    }
+
+    reply.Header    = header;
+    reply.Processes = processes;
+    reply.Threads   = threads;
+    return true;
+}
+
+static NTSTATUS EnumProcessThreads(
+    PFILE_OBJECT device, ULONG code, ULONG fields, std::vector<UCHAR>& buffer, ProcessThreadReply& reply)
+{
+    ULONG bytes = 0;
+    NTSTATUS status = EnumFields(device, code, 0, ENUM_VERSION_2, fields, buffer, &bytes);
+    if (!NT_SUCCESS(status)) return status;
+
+    ULONG recordSize = WireRecordSize(WireProcessFieldEnds, RTL_NUMBER_OF(WireProcessFieldEnds),
+        fields ? fields : PROCESS_FIELDS_ALL);
+    return SplitProcessThreads(buffer, bytes, recordSize, reply) ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
+}
+
+static const ENUM_V2_HEADER* TableHeader(const UCHAR* table)
+{
+    return (const ENUM_V2_HEADER*)table;
+}
+
+// Every process and thread record, in order, against the snapshot entries the reply was formatted from
+static ULONG CheckProcessThreads(const ProcessThreadReply& reply)
+{
+    PPROCESS_SNAPSHOT snapshot = NULL;
+    if (!NT_SUCCESS(ProcessSnapshotAcquire(PROCESS_SNAPSHOT_FRESH_MS, &snapshot))) return 1;
+
+    ULONG mismatches = 0, index = 0, next = 0;
+    for (const SpiProcess* entry = (const SpiProcess*)snapshot->Data; entry; entry = NextSpi(entry), index++) {
+        if (index >= reply.Header->Count) break;
+
+        const PROCESS_RECORD_V2* process = (const PROCESS_RECORD_V2*)WireRecord(reply.Processes, index);
+        ULONG processId = (ULONG)(ULONG_PTR)entry->UniqueProcessId;
+        if (process->ProcessId != processId || process->ThreadCount != entry->NumberOfThreads) {
+            mismatches++;
+            break;
+        }
+
+        const SpiThread* thread = SpiThreads(entry);
+        for (ULONG t = 0; t < entry->NumberOfThreads && next < reply.Header->ThreadCount; t++, thread++, next++) {
+            const THREAD_RECORD_V2* record = (const THREAD_RECORD_V2*)WireRecord(reply.Threads, next);
+            if (record->ThreadId != (ULONG)(ULONG_PTR)thread->ClientId.UniqueThread ||
+                record->ProcessId != processId ||
+                record->Priority != thread->Priority ||
+                record->State != thread->ThreadState ||
+                record->WaitReason != thread->WaitReason ||
+                record->ContextSwitches != thread->ContextSwitches ||
+                record->StartAddress != (ULONG64)(ULONG_PTR)thread->StartAddress ||
+                record->KernelTime != (ULONG64)thread->KernelTime.QuadPart ||
+                record->UserTime != (ULONG64)thread->UserTime.QuadPart) {
+                mismatches++;
+            }
+        }
+    }
+    ProcessSnapshotRelease(snapshot);
+    return mismatches + (index != reply.Header->Count || next != reply.Header->ThreadCount ? 1 : 0);
+}
+
+typedef std::map<ULONG, std::vector<ULONG>> ThreadIds;
+
+// What a client did before: the process list, then IOCTL_ENUM_THREADS per
+// process. Processes the per-PID request cannot open are left out of tids.
+static NTSTATUS ListThreadsPerProcess(
+    PFILE_OBJECT device, std::vector<UCHAR>& processes, std::vector<UCHAR>& threads, Result& result, ThreadIds* tids)
+{
+    ULONG bytes = 0;
+    NTSTATUS status = Issue(device, { IOCTL_ENUM_PROCESSES, 0 }, processes, result, &bytes);
+    if (!NT_SUCCESS(status)) return status;
+
+    const PROCESS_LIST_HEADER* header = (const PROCESS_LIST_HEADER*)processes.data();
+    const PROCESS_INFO* process = (const PROCESS_INFO*)(header + 1);
+    for (ULONG i = 0; i < header->Count; i++, process++) {
+        if (!NT_SUCCESS(Issue(device, { IOCTL_ENUM_THREADS, process->ProcessId }, threads, result, &bytes))) {
+            result.Failures++;
+            continue;
+        }
+        if (!tids) continue;
+
+        const THREAD_LIST_HEADER* list = (const THREAD_LIST_HEADER*)threads.data();
+        const THREAD_INFO* thread = (const THREAD_INFO*)(list + 1);
+        std::vector<ULONG>& ids = (*tids)[process->ProcessId];
+        for (ULONG t = 0; t < list->Count; t++)
+            ids.push_back(thread[t].ThreadId);
+        std::sort(ids.begin(), ids.end());
+    }
+    return STATUS_SUCCESS;
+}
+
+static int CompareProcessThreads(PFILE_OBJECT device, ULONG iterations)
+{
+    int result = 0;
+    std::vector<UCHAR> buffer(sizeof(PROCESS_THREAD_HEADER)), direct(sizeof(PROCESS_THREAD_HEADER));
+    std::vector<UCHAR> plain(sizeof(ENUM_V2_HEADER));
+    ProcessThreadReply reply, directReply;
+    NTSTATUS status = STATUS_UNSUCCESSFUL;
+
+    // The process table is the v2 process enumeration of the same snapshot, and the
+    // METHOD_OUT_DIRECT variant writes the same bytes; retried if the cached snapshot
+    // expired in between
+    bool same = false;
+    for (int attempt = 0; attempt < 3 && !same; attempt++) {
+        ProcessSnapshotInvalidate();
+        ULONG64 capturedAt = CachedSnapshotTime();
+        ULONG plainBytes = 0;
+        status = EnumProcessThreads(device, IOCTL_ENUM_PROCESSES_THREADS, ENUM_FIELDS_ALL, buffer, reply);
+        if (NT_SUCCESS(status))
+            status = EnumProcessThreads(device, IOCTL_ENUM_PROCESSES_THREADS_DIRECT, ENUM_FIELDS_ALL, direct, directReply);
+        if (NT_SUCCESS(status))
+            status = EnumFields(device, IOCTL_ENUM_PROCESSES, 0, ENUM_VERSION_2, ENUM_FIELDS_ALL, plain, &plainBytes);
+        if (!NT_SUCCESS(status)) break;
+
+        same = capturedAt == CachedSnapshotTime() &&
+            TableHeader(reply.Processes)->TotalSize == plainBytes &&
+            !memcmp(reply.Processes, plain.data(), plainBytes) &&
+            reply.Header->TotalSize == directReply.Header->TotalSize &&
+            !memcmp(buffer.data(), direct.data(), reply.Header->TotalSize);
+    }
+    if (!NT_SUCCESS(status) || !same) {
+        fprintf(stderr, "osk-dispatch: combined reply: status 0x%08X, matches the process enumeration: %s\n",
+            (unsigned)status, same ? "yes" : "no");
+        return 1;
+    }
+    if (ULONG mismatches = CheckProcessThreads(reply)) {
+        fprintf(stderr, "osk-dispatch: %u process or thread records differ from the snapshot\n", mismatches);
+        result = 1;
+    }
+    ULONG processCount = reply.Header->Count, threadCount = reply.Header->ThreadCount;
+
+    // Each process's thread group holds the threads IOCTL_ENUM_THREADS walks
+    std::vector<UCHAR> processList(64 * 1024), threadList(64 * 1024);
+    Result split;
+    ThreadIds tids;
+    status = ListThreadsPerProcess(device, processList, threadList, split, &tids);
+    ULONG differing = 0, next = 0;
+    for (ULONG i = 0; i < reply.Header->Count; i++) {
+        const PROCESS_RECORD_V2* process = (const PROCESS_RECORD_V2*)WireRecord(reply.Processes, i);
+        std::vector<ULONG> group;
+        for (ULONG t = 0; t < process->ThreadCount; t++, next++)
+            group.push_back(((const THREAD_RECORD_V2*)WireRecord(reply.Threads, next))->ThreadId);
+        std::sort(group.begin(), group.end());
+
+        auto listed = tids.find(process->ProcessId);
+        if (listed != tids.end() && listed->second != group) differing++;
+    }
+    if (!NT_SUCCESS(status) || differing || tids.size() + split.Failures != processCount) {
+        fprintf(stderr, "osk-dispatch: per-process thread lists: status 0x%08X, %u differ, %u unlisted\n",
+            (unsigned)status, differing, (unsigned)split.Failures);
+        result = 1;
+    }
+
+    // A header-sized buffer gets the size and a token. The retry is served from the
+    // stashed snapshot even after the system moved on; the token belongs to this
+    // enumeration and not to IOCTL_ENUM_PROCESSES.
+    const PROCESS_RECORD_V2* last = (const PROCESS_RECORD_V2*)WireRecord(reply.Processes, reply.Header->Count - 1);
+    ULONG busy = last->ProcessId, busyThreads = last->ThreadCount;
+    ULONG64 busyKernel = busyThreads
+        ? ((const THREAD_RECORD_V2*)WireRecord(reply.Threads, reply.Header->ThreadCount - busyThreads))->KernelTime : 0;
+
+    std::vector<UCHAR> small(sizeof(PROCESS_THREAD_HEADER));
+    ENUM_REQUEST request = { 0, ENUM_VERSION_2, 0, ENUM_FIELDS_ALL };
+    ULONG bytes = 0;
+    ProcessSnapshotInvalidate();
+    status = ShimDeviceIoControl(device, IOCTL_ENUM_PROCESSES_THREADS, &request, sizeof(request),
+        small.data(), (ULONG)small.size(), &bytes);
+    PROCESS_THREAD_HEADER overflow = *(const PROCESS_THREAD_HEADER*)small.data();
+    if (status != STATUS_BUFFER_OVERFLOW || bytes != sizeof(overflow) || overflow.Count != 0 ||
+        !overflow.SnapshotToken || overflow.TotalSize != reply.Header->TotalSize) {
+        fprintf(stderr, "osk-dispatch: overflow reply: status 0x%08X, %u bytes, TotalSize %u\n",
+            (unsigned)status, bytes, overflow.TotalSize);
+        return 1;
+    }
+
+    ShimAddCpuTime(busy, 1000000, 0);
+    ProcessSnapshotInvalidate();
+    request.SnapshotToken = overflow.SnapshotToken;
+    std::vector<UCHAR> sized(overflow.TotalSize);
+    NTSTATUS foreign = ShimDeviceIoControl(device, IOCTL_ENUM_PROCESSES, &request, sizeof(request),
+        plain.data(), (ULONG)plain.size(), &bytes);
+    status = ShimDeviceIoControl(device, IOCTL_ENUM_PROCESSES_THREADS, &request, sizeof(request),
+        sized.data(), (ULONG)sized.size(), &bytes);
+    ProcessThreadReply resumed, fresh;
+    bool stashed = NT_SUCCESS(status) && SplitProcessThreads(sized, bytes, sizeof(PROCESS_RECORD_V2), resumed) &&
+        (!busyThreads || ((const THREAD_RECORD_V2*)WireRecord(resumed.Threads,
+            resumed.Header->ThreadCount - busyThreads))->KernelTime == busyKernel);
+    NTSTATUS freshStatus = EnumProcessThreads(device, IOCTL_ENUM_PROCESSES_THREADS, ENUM_FIELDS_ALL, buffer, fresh);
+    bool moved = NT_SUCCESS(freshStatus) && CheckProcessThreads(fresh) == 0 &&
+        (!busyThreads || ((const THREAD_RECORD_V2*)WireRecord(fresh.Threads,
+            fresh.Header->ThreadCount - busyThreads))->KernelTime == busyKernel + 1000000);
+    if (foreign != STATUS_NOT_FOUND || !stashed || !moved) {
+        fprintf(stderr, "osk-dispatch: token retry: foreign 0x%08X, retry 0x%08X (stashed %d), fresh 0x%08X (moved %d)\n",
+            (unsigned)foreign, (unsigned)status, stashed, (unsigned)freshStatus, moved);
+        result = 1;
+    }
+
+    // Only v2 is offered; Fields selects process fields and leaves the thread table whole
+    ULONG narrow = PROCESS_FIELD_PROCESS_ID | PROCESS_FIELD_THREAD_COUNT;
+    ProcessThreadReply narrowed;
+    ProcessSnapshotInvalidate();
+    status = EnumProcessThreads(device, IOCTL_ENUM_PROCESSES_THREADS, narrow, small, narrowed);
+    bool narrowOk = NT_SUCCESS(status) &&
+        TableHeader(narrowed.Processes)->RecordSize == WireRecordSize(WireProcessFieldEnds, RTL_NUMBER_OF(WireProcessFieldEnds), narrow) &&
+        TableHeader(narrowed.Threads)->TotalSize == TableHeader(fresh.Threads)->TotalSize &&
+        !memcmp(narrowed.Threads, fresh.Threads, TableHeader(fresh.Threads)->TotalSize);
+    NTSTATUS v1 = EnumFields(device, IOCTL_ENUM_PROCESSES_THREADS, 0, ENUM_VERSION_1, 0, plain, &bytes);
+    NTSTATUS unversioned = EnumFields(device, IOCTL_ENUM_PROCESSES_THREADS, 0, 0, 0, plain, &bytes);
+    NTSTATUS undefined = EnumFields(device, IOCTL_ENUM_PROCESSES_THREADS, 0, ENUM_VERSION_2,
+        PROCESS_FIELDS_ALL + 1, plain, &bytes);
+    if (!narrowOk || v1 != STATUS_NOT_SUPPORTED || unversioned != STATUS_NOT_SUPPORTED ||
+        undefined != STATUS_INVALID_PARAMETER) {
+        fprintf(stderr, "osk-dispatch: narrowed 0x%08X (ok %d), v1 0x%08X, no version 0x%08X, undefined bits 0x%08X\n",
+            (unsigned)status, narrowOk, (unsigned)v1, (unsigned)unversioned, (unsigned)undefined);
+        result = 1;
+    }
+
+    // Per refresh, both sides capture afresh and keep their buffers from the last refresh
+    Result perProcess, combined;
+    for (ULONG it = 0; it < iterations; it++) {
+        ProcessSnapshotInvalidate();
+        status = ListThreadsPerProcess(device, processList, threadList, perProcess, NULL);
+        if (!NT_SUCCESS(status)) break;
+
+        ProcessSnapshotInvalidate();
+        ULONG64 start = NowNs();
+        status = EnumFields(device, IOCTL_ENUM_PROCESSES_THREADS, 0, ENUM_VERSION_2, 0, buffer, &bytes);
+        combined.Ns += NowNs() - start;
+        combined.Calls++;
+        combined.Bytes += bytes;
+        if (!NT_SUCCESS(status)) break;
+    }
+    if (!NT_SUCCESS(status)) {
+        fprintf(stderr, "osk-dispatch: timed enumeration failed: 0x%08X\n", (unsigned)status);
+        result = 1;
+    }
+
+    double calls = iterations ? iterations : 1;
+    printf("%u processes, %u threads per refresh\n", processCount, threadCount);
+    printf("%-34s %12s %12s %10s\n", "per refresh", "round trips", "bytes", "ms");
+    printf("%-34s %12.0f %12.0f %10.3f\n", "processes + threads per process",
+        perProcess.Calls / calls, perProcess.Bytes / calls, perProcess.Ns / 1e6 / calls);
+    printf("%-34s %12.0f %12.0f %10.3f\n", "processes with threads (v2)",
+        combined.Calls / calls, combined.Bytes / calls, combined.Ns / 1e6 / calls);
+    return result;
+}
+
+// ========== Authorization at open ==========
+
+#define AUTH_UNTRUSTED_PID  1240
+#define AUTH_CACHE_SLOTS    16
+#define AUTH_IMAGE_BYTES    (1024 * 1024)
+
+static NTSTATUS QuerySignatureStats(PFILE_OBJECT device)
+{
+    SIGNATURE_STATS stats;
+    ULONG bytes = 0;
+    return ShimDeviceIoControl(device, IOCTL_GET_SIGNATURE_STATS, NULL, 0, &stats, sizeof(stats), &bytes);
+}
+
+//
+// The verdict cache every IOCTL consulted before authorization moved to
+// open: 16 PIDs behind one spinlock, scanned in order. A miss verified the
+// caller's image and took the first free slot, or slot 0 once all were used.
+//
+struct SignatureCache {
+    KSPIN_LOCK Lock = 0;
+    struct { ULONG ProcessId; LARGE_INTEGER LastVerified; SIGNATURE_STATUS Status; } Slots[AUTH_CACHE_SLOTS] = {};
+
+    BOOLEAN Lookup(ULONG pid, SIGNATURE_STATUS* status)
+    {
+        KIRQL irql;
+        KeAcquireSpinLock(&Lock, &irql);
+        for (auto& slot : Slots) {
+            if (slot.ProcessId == pid) {
+                *status = slot.Status;
+                KeReleaseSpinLock(&Lock, irql);
+                return TRUE;
+            }
+        }
+        KeReleaseSpinLock(&Lock, irql);
+        return FALSE;
+    }
+
+    VOID Insert(ULONG pid, SIGNATURE_STATUS status)
+    {
+        KIRQL irql;
+        KeAcquireSpinLock(&Lock, &irql);
+        auto* target = &Slots[0];
+        for (auto& slot : Slots) {
+            if (slot.ProcessId == 0) {
+                target = &slot;
+                break;
+            }
+        }
+        target->ProcessId = pid;
+        KeQuerySystemTimePrecise(&target->LastVerified);
+        target->Status = status;
+        KeReleaseSpinLock(&Lock, irql);
+    }
+};
+
+typedef std::vector<UCHAR> DerBytes;
+
+static DerBytes DerCat(std::initializer_list<DerBytes> parts)
+{
+    DerBytes out;
+    for (const DerBytes& part : parts) out.insert(out.end(), part.begin(), part.end());
+    return out;
+}
+
+static DerBytes Der(UCHAR tag, const DerBytes& value)
+{
+    DerBytes out = { tag };
+    if (value.size() < 0x80) {
+        out.push_back((UCHAR)value.size());
+    } else {
+        UCHAR length[4];
+        int count = 0;
+        for (size_t l = value.size(); l; l >>= 8) length[count++] = (UCHAR)l;
+        out.push_back((UCHAR)(0x80 | count));
+        while (count) out.push_back(length[--count]);
+    }
+    out.insert(out.end(), value.begin(), value.end());
+    return out;
+}
+
+static DerBytes DerFiller(size_t length, UCHAR seed)
+{
+    DerBytes out(length);
+    for (size_t i = 0; i < length; i++) out[i] = (UCHAR)(seed + i * 7);
+    return out;
+}
+
+static void StoreLe(DerBytes& image, size_t offset, ULONG value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) image[offset + i] = (UCHAR)(value >> (i * 8));
+}
+
+struct AuthImage {
+    DerBytes Data;
+    std::string Thumbprint;
+};
+
+//
+// A signed PE32+ image of AUTH_IMAGE_BYTES: headers, a patterned body and
+// SignedData over its Authenticode hash with a two-certificate chain. Stands
+// in for the client executable a cache miss had to verify.
+//
+static AuthImage BuildAuthImage(VOID)
+{
+    const ULONG ntOffset = 0x80, optional = ntOffset + 24, checksum = optional + 64, securityDir = optional + 144;
+
+    AuthImage pe;
+    DerBytes& image = pe.Data;
+    image = DerFiller(AUTH_IMAGE_BYTES, 0x4D);
+    memset(image.data(), 0, 0x200);
+    StoreLe(image, 0, 0x5A4D, 2);                       // MZ
+    StoreLe(image, 0x3C, ntOffset, 4);
+    StoreLe(image, ntOffset, 0x00004550, 4);            // PE\0\0
+    StoreLe(image, ntOffset + 4, 0x8664, 2);
+    StoreLe(image, ntOffset + 20, 240, 2);              // SizeOfOptionalHeader
+    StoreLe(image, optional, 0x20B, 2);
+    StoreLe(image, checksum, 0x12345678, 4);
+
+    UCHAR hash[32];
+    SHA256_CTX sha;
+    SHA256Init(&sha);
+    SHA256Update(&sha, image.data(), checksum);
+    SHA256Update(&sha, image.data() + checksum + 4, securityDir - checksum - 4);
+    SHA256Update(&sha, image.data() + securityDir + 8, (ULONG)image.size() - securityDir - 8);
+    SHA256Final(hash, &sha);
+
+    const DerBytes oidSha256   = { 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01 };
+    const DerBytes oidRsa      = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x01, 0x01 };
+    const DerBytes oidIndirect = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x02, 0x01, 0x04 };
+    const DerBytes oidPeImage  = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x02, 0x01, 0x0F };
+    auto algorithm = [](const DerBytes& oid) { return Der(0x30, DerCat({ Der(0x06, oid), Der(0x05, {}) })); };
+
+    DerBytes indirect = DerCat({
+        Der(0x30, DerCat({ Der(0x06, oidPeImage), Der(0x30, { 0x03, 0x01, 0x00 }) })),
+        Der(0x30, DerCat({ algorithm(oidSha256), Der(0x04, DerBytes(hash, hash + 32)) })),
+    });
+
+    DerBytes certs, signerCert;
+    for (UCHAR i = 0; i < 2; i++) {
+        DerBytes tbs = Der(0x30, DerCat({ Der(0x02, { (UCHAR)(i + 1) }), Der(0x04, DerFiller(600, i)) }));
+        signerCert = Der(0x30, DerCat({ tbs, algorithm(oidRsa), Der(0x03, DerFiller(257, 0x5A)) }));
+        certs = DerCat({ certs, signerCert });
+    }
+    UCHAR digest[32], thumbprint[20];
+    SHA1_CTX sha1;
+    SHA1Init(&sha1);
+    SHA1Update(&sha1, signerCert.data(), (ULONG)signerCert.size());
+    SHA1Final(thumbprint, &sha1);
+    char hex[41];
+    for (int i = 0; i < 20; i++) snprintf(hex + i * 2, 3, "%02X", thumbprint[i]);
+    pe.Thumbprint = hex;
+
+    SHA256Init(&sha);
+    SHA256Update(&sha, indirect.data(), (ULONG)indirect.size());
+    SHA256Final(digest, &sha);
+    DerBytes attrs = DerCat({
+        Der(0x30, DerCat({ Der(0x06, { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x03 }),
+                           Der(0x31, Der(0x06, oidIndirect)) })),
+        Der(0x30, DerCat({ Der(0x06, { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x04 }),
+                           Der(0x31, Der(0x04, DerBytes(digest, digest + 32))) })),
+    });
+    DerBytes signer = Der(0x30, DerCat({
+        Der(0x02, { 0x01 }),
+        Der(0x30, DerCat({ Der(0x30, DerFiller(40, 0x11)), Der(0x02, { 0x01 }) })),
+        algorithm(oidSha256), Der(0xA0, attrs), algorithm(oidRsa), Der(0x04, DerFiller(256, 0x22)),
+    }));
+    DerBytes signedData = Der(0x30, DerCat({
+        Der(0x02, { 0x01 }),
+        Der(0x31, algorithm(oidSha256)),
+        Der(0x30, DerCat({ Der(0x06, oidIndirect), Der(0xA0, Der(0x30, indirect)) })),
+        Der(0xA0, certs),
+        Der(0x31, signer),
+    }));
+    DerBytes content = Der(0x30, DerCat({
+        Der(0x06, { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x02 }), Der(0xA0, signedData) }));
+
+    // WIN_CERTIFICATE, revision 2.0, PKCS_SIGNED_DATA, padded to 8 bytes
+    DerBytes certificate = DerCat({ DerBytes(8), content });
+    certificate.resize((certificate.size() + 7) & ~(size_t)7, 0);
+    StoreLe(certificate, 0, (ULONG)certificate.size(), 4);
+    StoreLe(certificate, 4, 0x0200, 2);
+    StoreLe(certificate, 6, 0x0002, 2);
+
+    StoreLe(image, securityDir, (ULONG)image.size(), 4);
+    StoreLe(image, securityDir + 4, (ULONG)certificate.size(), 4);
+    image.insert(image.end(), certificate.begin(), certificate.end());
+    return pe;
+}
+
+static NTSTATUS ReadAuthImage(PVOID Context, ULONG Offset, PVOID Buffer, ULONG Length)
+{
+    const DerBytes* image = (const DerBytes*)Context;
+    if ((ULONG64)Offset + Length > image->size()) return STATUS_END_OF_FILE;
+    memcpy(Buffer, image->data() + Offset, Length);
+    return STATUS_SUCCESS;
+}
+
+// What an IOCTL cost before: the cache scan, and on a miss the verification
+static SIGNATURE_STATUS CheckCachedCaller(SignatureCache& cache, ULONG pid, const AuthImage& image)
+{
+    SIGNATURE_STATUS status;
+    if (cache.Lookup(pid, &status)) return status;
+
+    SIG_READER reader;
+    reader.Context  = (PVOID)&image.Data;
+    reader.Read     = ReadAuthImage;
+    reader.FileSize = (ULONG)image.Data.size();
+    reader.Ticks    = NULL;
+    UCHAR hash[32];
+    status = AuthenticodeVerifyStream(&reader, image.Thumbprint.c_str(), hash);
+    cache.Insert(pid, status);
+    return status;
+}
+
+static int CompareAuthorization(PFILE_OBJECT device, ULONG iterations)
+{
+    ULONG calls = iterations * 5000;
+    ULONG misses = iterations * 5;
+    ULONG reopens = iterations * 50;
+    ULONG failures = 0;
+    int result = 0;
+
+    // Authorized once at open: the IOCTL only reads FsContext2
+    ULONG checks = ShimSignatureChecks();
+    ULONG64 start = NowNs();
+    for (ULONG i = 0; i < calls; i++)
+        if (!NT_SUCCESS(QuerySignatureStats(device))) failures++;
+    ULONG64 atOpen = NowNs() - start;
+    ULONG ioctlChecks = ShimSignatureChecks() - checks;
+
+    // Before, cache hit: a full cache with the caller at every position in turn
+    SignatureCache* cache = new SignatureCache();
+    AuthImage image = BuildAuthImage();
+    for (ULONG slot = 0; slot < AUTH_CACHE_SLOTS; slot++)
+        cache->Insert(4 * (slot + 1), SignatureValid);
+    start = NowNs();
+    for (ULONG i = 0; i < calls; i++) {
+        ULONG pid = 4 * (i % AUTH_CACHE_SLOTS + 1);
+        if (CheckCachedCaller(*cache, pid, image) != SignatureValid || !NT_SUCCESS(QuerySignatureStats(device)))
+            failures++;
+    }
+    ULONG64 cacheHit = NowNs() - start;
+
+    // The same hits without the IOCTL, to separate the scan from the round trip
+    start = NowNs();
+    for (ULONG i = 0; i < calls; i++) {
+        if (CheckCachedCaller(*cache, 4 * (i % AUTH_CACHE_SLOTS + 1), image) != SignatureValid)
+            failures++;
+    }
+    ULONG64 scanOnly = NowNs() - start;
+
+    // Before, cache miss: more clients than slots, each verified from its image
+    start = NowNs();
+    for (ULONG i = 0; i < misses; i++) {
+        ULONG pid = 4 * (AUTH_CACHE_SLOTS + 1 + i);
+        if (CheckCachedCaller(*cache, pid, image) != SignatureValid || !NT_SUCCESS(QuerySignatureStats(device)))
+            failures++;
+    }
+    ULONG64 cacheMiss = NowNs() - start;
+    delete cache;
+
+    // A client that opens the device for every request
+    start = NowNs();
+    for (ULONG i = 0; i < reopens; i++) {
+        PFILE_OBJECT handle = ShimOpenDevice(4);
+        if (!handle || !NT_SUCCESS(QuerySignatureStats(handle))) failures++;
+        if (handle) ShimCloseDevice(handle);
+    }
+    ULONG64 perOpen = NowNs() - start;
+
+    double baseline = (double)atOpen / calls;
+    char missLabel[64];
+    snprintf(missLabel, sizeof(missLabel), "cache miss, verify %u KiB + IOCTL (before)", AUTH_IMAGE_BYTES / 1024);
+    printf("%-44s %10s %12s %10s\n", "IOCTL_GET_SIGNATURE_STATS", "calls", "ns/call", "vs open");
+    printf("%-44s %10u %12.0f %9.1fx\n", "authorized at open (FsContext2)", calls, baseline, 1.0);
+    struct { const char* Name; ULONG Calls; ULONG64 Ns; } rows[] = {
+        { "16-slot cache hit + IOCTL (before)", calls, cacheHit },
+        { "16-slot cache hit alone (before)", calls, scanOnly },
+        { missLabel, misses, cacheMiss },
+        { "open + IOCTL + close", reopens, perOpen },
+    };
+    for (const auto& row : rows) {
+        double ns = (double)row.Ns / row.Calls;
+        printf("%-44s %10u %12.0f %9.1fx\n", row.Name, row.Calls, ns, baseline > 0 ? ns / baseline : 0.0);
+    }
+
+    if (failures || ioctlChecks) {
+        fprintf(stderr, "osk-dispatch: %u failed requests, %u signature checks on IOCTLs\n", failures, ioctlChecks);
+        result = 1;
+    }
+
+    // An untrusted caller may open the device but not use it
+    ShimSetCallerSignature(SignatureUntrusted);
+    checks = ShimSignatureChecks();
+    PFILE_OBJECT untrusted = ShimOpenDevice(AUTH_UNTRUSTED_PID);
+    NTSTATUS denied = untrusted ? QuerySignatureStats(untrusted) : STATUS_UNSUCCESSFUL;
+    NTSTATUS stillOpen = QuerySignatureStats(device);
+    ULONG openChecks = ShimSignatureChecks() - checks;
+    ShimSetCallerSignature(SignatureValid);
+    if (untrusted) ShimCloseDevice(untrusted);
+
+    bool ok = untrusted && denied == STATUS_ACCESS_DENIED && NT_SUCCESS(stillOpen) && openChecks == 1;
+    printf("untrusted caller: open %s, IOCTL 0x%08X, open handle 0x%08X, %u signature check(s): %s\n",
+        untrusted ? "succeeded" : "failed", (unsigned)denied, (unsigned)stillOpen, openChecks, ok ? "ok" : "FAIL");
+    if (!ok) result = 1;
+    return result;
+}
+
+// ========== Signature PID index ==========
+
+#define PID_STRESS_MAX_THREADS  64
+
+// The old design: every lookup took the one cache spinlock
+struct LockedPidIndex {
+    KSPIN_LOCK Lock = 0;
+    struct { ULONG ProcessId; LONGLONG CreateTime; SIGNATURE_STATUS Status; BOOLEAN Prewarmed; } Slots[SIG_PID_INDEX_SIZE] = {};
+
+    BOOLEAN Lookup(ULONG pid, LONGLONG createTime, SIGNATURE_STATUS* status, PBOOLEAN prewarmed)
+    {
+        KIRQL irql;
+        KeAcquireSpinLock(&Lock, &irql);
+        auto& slot = Slots[(pid >> 2) & (SIG_PID_INDEX_SIZE - 1)];
+        BOOLEAN hit = slot.ProcessId == pid && slot.CreateTime == createTime;
+        if (hit) {
+            *status = slot.Status;
+            *prewarmed = slot.Prewarmed;
+        }
+        KeReleaseSpinLock(&Lock, irql);
+        return hit;
+    }
+
+    VOID Insert(ULONG pid, LONGLONG createTime, SIGNATURE_STATUS status, BOOLEAN prewarmed)
+    {
+        KIRQL irql;
+        KeAcquireSpinLock(&Lock, &irql);
+        Slots[(pid >> 2) & (SIG_PID_INDEX_SIZE - 1)] = { pid, createTime, status, prewarmed };
+        KeReleaseSpinLock(&Lock, irql);
+    }
+};
+
+struct PidStressResult {
+    double Mlookups = 0;
+    ULONG64 Hits = 0;
+    ULONG64 Torn = 0;
+    ULONG64 Writes = 0;
+};
+
+//
+// Reader t owns PID 4 * (t + 1), i.e. slot t + 1. The writer flips each
+// owned slot between two processes with that PID: (create time 1, Valid,
+// not prewarmed) and (create time 2, Untrusted, prewarmed). A reader asks
+// for one of them and must get a miss or exactly that process's verdict.
+//
+template <typename Lookup, typename Insert>
+static PidStressResult StressPidIndex(ULONG readers, ULONG lookups, Lookup lookup, Insert insert)
+{
+    for (ULONG t = 0; t < readers; t++) insert(4 * (t + 1), 1, SignatureValid, FALSE);
+
+    std::atomic<ULONG> ready(0), done(0);
+    std::atomic<bool> go(false);
+    std::atomic<ULONG64> hits(0), torn(0), writes(0);
+
+    std::thread writer([&] {
+        ready++;
+        while (!go.load()) std::this_thread::yield();
+        for (ULONG64 round = 0; done.load() < readers; round++) {
+            for (ULONG t = 0; t < readers; t++) {
+                if (round & 1) insert(4 * (t + 1), 1, SignatureValid, FALSE);
+                else           insert(4 * (t + 1), 2, SignatureUntrusted, TRUE);
+            }
+            writes += readers;
+            if (round % 64 == 63) std::this_thread::yield();
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (ULONG t = 0; t < readers; t++) {
+        threads.emplace_back([&, t] {
+            ULONG pid = 4 * (t + 1);
+            ULONG64 localHits = 0, localTorn = 0;
+            ready++;
+            while (!go.load()) std::this_thread::yield();
+            for (ULONG i = 0; i < lookups; i++) {
+                LONGLONG createTime = 1 + (i & 1);
+                SIGNATURE_STATUS status;
+                BOOLEAN prewarmed;
+                if (!lookup(pid, createTime, &status, &prewarmed)) continue;
+                localHits++;
+                bool expected = createTime == 1
+                    ? (status == SignatureValid && !prewarmed)
+                    : (status == SignatureUntrusted && prewarmed);
+                if (!expected) localTorn++;
+            }
+            hits += localHits;
+            torn += localTorn;
+            done++;
+        });
+    }
+
+    while (ready.load() < readers + 1) std::this_thread::yield();
+    ULONG64 start = NowNs();
+    go = true;
+    for (auto& t : threads) t.join();
+    ULONG64 ns = NowNs() - start;
+    writer.join();
+
+    PidStressResult result;
+    result.Mlookups = (double)readers * lookups * 1e3 / ns;
+    result.Hits = hits.load();
+    result.Torn = torn.load();
+    result.Writes = writes.load();
+    return result;
+}
+
+static int ComparePidIndex(ULONG iterations)
+{
+    ULONG lookups = iterations * 10000;
+    LockedPidIndex* locked = new LockedPidIndex();
+    int result = 0;
+
+    printf("%u CPUs, %u lookups per reader, one writer replacing every reader's slot\n",
+        std::thread::hardware_concurrency(), lookups);
+    printf("%-8s %16s %10s %10s %16s %10s %10s %6s\n",
+        "readers", "seqlock Mops/s", "hits", "writes", "spinlock Mops/s", "hits", "writes", "torn");
+    for (ULONG readers = 1; readers <= PID_STRESS_MAX_THREADS; readers *= 2) {
+        PidStressResult seq = StressPidIndex(readers, lookups, PidIndexLookup, PidIndexInsert);
+        PidStressResult lock = StressPidIndex(readers, lookups,
+            [&](ULONG p, LONGLONG c, SIGNATURE_STATUS* s, PBOOLEAN w) { return locked->Lookup(p, c, s, w); },
+            [&](ULONG p, LONGLONG c, SIGNATURE_STATUS s, BOOLEAN w) { locked->Insert(p, c, s, w); });
+        printf("%-8u %16.2f %10llu %10llu %16.2f %10llu %10llu %6llu\n", readers,
+            seq.Mlookups, (unsigned long long)seq.Hits, (unsigned long long)seq.Writes,
+            lock.Mlookups, (unsigned long long)lock.Hits, (unsigned long long)lock.Writes,
+            (unsigned long long)(seq.Torn + lock.Torn));
+        if (seq.Torn || lock.Torn) result = 1;
+    }
+
+    delete locked;
+    if (result) fprintf(stderr, "osk-dispatch: a PID index lookup returned another process's verdict\n");
+    return result;
+}
+
+static void Usage(VOID)
+{
+    fprintf(stderr,
+        "usage: osk-dispatch [-a | -b | -c | -d | -e | -i | -j | -l | -o | -r | -u | -v | -w] [-s snapshot] [-p procs] [-t threads] [-h handles] [-m modules] [-n iterations]\n"
+        "  -a  compare overlapped requests on the driver's worker pool with synchronous ones (ignores -n)\n"
+        "  -b  compare IOCTL_BATCH with one IOCTL per PID (terminates the processes; ignores -n)\n"
+        "  -c  compare METHOD_BUFFERED with METHOD_OUT_DIRECT enumeration\n"
+        "  -d  compare delta process enumeration with full enumeration, check history and wrap (terminates processes)\n"
+        "  -e  measure the event ring and channel in events per second (ignores -n)\n"
+        "  -i  stress the signature PID index with 1 to 64 readers against a spinlock table (10000 x -n lookups each)\n"
+        "  -j  compare processes with threads in one request with per-process thread enumeration\n"
+        "  -l  compare process table lookups with snapshot scans, check notifications and reconcile\n"
+        "  -o  compare authorizing once at open with a signature check per IOCTL\n"
+        "  -r  measure process snapshot queries and allocations per enumeration\n"
+        "  -u  check per-process CPU usage from the driver's sampler, compare with a client-side join\n"
+        "  -v  compare reading the shared snapshot section with the enumeration IOCTLs\n"
+        "  -w  compare the v1 and v2 reply encodings\n"
+        "  -s  snapshot file (see shim/osk_shim.h); otherwise a synthetic system\n"
+        "  -p  synthetic processes (default 300)\n"
+        "  -t  synthetic threads per process (default 40)\n"
+        "  -h  synthetic handles per process (default 250)\n"
+        "  -m  synthetic kernel modules (default 200)\n"
+        "  -n  iterations (default 20)\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* snapshot = NULL;
+    SHIM_SYNTHETIC_SPEC spec = { 300, 40, 250, 200, 0 };
+    ULONG iterations = 20;
+    bool async = false;
+    bool batch = false;
+    bool compare = false;
+    bool delta = false;
+    bool events = false;
+    bool pids = false;
+    bool joined = false;
+    bool table = false;
+    bool opened = false;
+    bool reuse = false;
+    bool usage = false;
+    bool shared = false;
+    bool wire = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-a")) {
+            async = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-b")) {
+            batch = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-c")) {
+            compare = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-d")) {
+            delta = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-e")) {
+            events = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-i")) {
+            pids = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-j")) {
+            joined = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-l")) {
+            table = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-o")) {
+            opened = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-r")) {
+            reuse = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-u")) {
+            usage = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-v")) {
+            shared = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-w")) {
+            wire = true;
+            continue;
+        }
+        if (i + 1 >= argc || argv[i][0] != '-' || argv[i][2] != '\0') {
+            Usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 's': snapshot = value; break;
+        case 'p': spec.Processes = (ULONG)strtoul(value, NULL, 10); break;
+        case 't': spec.ThreadsPerProcess = (ULONG)strtoul(value, NULL, 10); break;
+        case 'h': spec.HandlesPerProcess = (ULONG)strtoul(value, NULL, 10); break;
+        case 'm': spec.KernelModules = (ULONG)strtoul(value, NULL, 10); break;
+        case 'n': iterations = (ULONG)strtoul(value, NULL, 10); break;
+        default:
+            Usage();
+            return 2;
+        }
+    }
+
+    if (snapshot) {
+        std::string error;
+        if (!ShimLoadSnapshot(snapshot, &error)) {
+            fprintf(stderr, "osk-dispatch: %s\n", error.c_str());
+            return 2;
+        }
+    } else {
+        if (spec.Processes == 0) spec.Processes = 1;
+        ShimSynthesizeSnapshot(&spec);
+    }
+
+    SHIM_SNAPSHOT_COUNTS counts = ShimSnapshotCounts();
+    fprintf(stderr, "osk-dispatch: %u processes, %u threads, %u handles, %u kernel modules, %u iterations\n",
+        counts.Processes, counts.Threads, counts.Handles, counts.KernelModules, iterations);
+
+    NTSTATUS status = ShimLoadDriver(DriverEntry);
+    if (!NT_SUCCESS(status)) {
+        fprintf(stderr, "osk-dispatch: DriverEntry failed: 0x%08X\n", (unsigned)status);
+        return 1;
+    }
+
+    PFILE_OBJECT device = ShimOpenDevice(4);
+    if (!device) {
+        fprintf(stderr, "osk-dispatch: cannot open device\n");
+        ShimUnloadDriver();
+        return 1;
+    }
+
+    if (async || batch || compare || delta || events || pids || joined || table || opened || reuse || usage || shared || wire) {
+        int result = async   ? CompareAsync(device)
+                   : batch   ? CompareBatch(device)
+                   : compare ? CompareTransfers(device, iterations)
+                   : delta   ? CompareProcessDelta(device, iterations)
+                   : events  ? BenchEvents()
+                   : pids    ? ComparePidIndex(iterations)
+                   : joined  ? CompareProcessThreads(device, iterations)
+                   : table   ? CompareProcessTable(device, iterations)
+                   : opened  ? CompareAuthorization(device, iterations)
+                   : reuse   ? CompareProcessSnapshots(iterations)
+                   : usage   ? CompareCpuUsage(device, iterations)
+                   : shared  ? CompareShared(iterations)
+                   :           CompareWireFormats(device, iterations);
+        ShimCloseDevice(device);
+        ShimUnloadDriver();
+        SHIM_STATS final = ShimGetStats();
+        if (final.PoolBytesOutstanding != 0 || final.ObjectsOutstanding != 0) {
+            fprintf(stderr, "osk-dispatch: %llu pool bytes, %lld objects leaked\n",
+                (unsigned long long)final.PoolBytesOutstanding, (long long)final.ObjectsOutstanding);
+            result = 1;
+        }
+        if (final.UnguardedAcquires != 0) {
+            fprintf(stderr, "osk-dispatch: %llu resource acquires outside a critical region\n",
+                (unsigned long long)final.UnguardedAcquires);
+            result = 1;
+        }
+        return result;
+    }
+
+    Result processes, threads, handles, modules;
+    std::vector<UCHAR> processBuffer(64 * 1024), threadBuffer(64 * 1024);
+    std::vector<UCHAR> handleBuffer(64 * 1024), moduleBuffer(64 * 1024);
+    ShimResetIoStats();
+
+    for (ULONG it = 0; it < iterations; it++) {
+        ULONG bytes = 0;
+        Request enumProcesses = { IOCTL_ENUM_PROCESSES, 0 };
+        status = Issue(device, enumProcesses, processBuffer, processes, &bytes);
+        if (!NT_SUCCESS(status)) {
+            processes.Failures++;
+            continue;
+        }
+
+        // Threads of every listed process, as a process viewer refresh would
+        const LIST_HEADER* header = (const LIST_HEADER*)processBuffer.data();
+        const PROCESS_INFO* info = (const PROCESS_INFO*)(header + 1);
+        for (ULONG p = 0; p < header->Count; p++) {
+            Request enumThreads = { IOCTL_ENUM_THREADS, info[p].ProcessId };
+            if (!NT_SUCCESS(Issue(device, enumThreads, threadBuffer, threads, &bytes)))
+                threads.Failures++;
+        }
+
+        Request enumHandles = { IOCTL_ENUM_HANDLES, 0 };
+        if (!NT_SUCCESS(Issue(device, enumHandles, handleBuffer, handles, &bytes)))
+            handles.Failures++;
+
+        Request enumModules = { IOCTL_ENUM_KERNEL_MODULES, 0 };
+        if (!NT_SUCCESS(Issue(device, enumModules, moduleBuffer, modules, &bytes)))
+            modules.Failures++;
+    }
+
+    SHIM_STATS io = ShimGetStats();
+
+    struct { const char* Name; const Result* R; } rows[] = {
+        { "processes", &processes }, { "threads", &threads },
+        { "handles", &handles },     { "kernel-modules", &modules },
+    };
+    printf("%-15s %8s %12s %12s %14s %9s %9s %9s\n",
+        "request", "calls", "avg us", "entries", "bytes", "overflow", "resumed", "failures");
+    for (const auto& row : rows) {
+        const Result& r = *row.R;
+        printf("%-15s %8llu %12.1f %12llu %14llu %9llu %9llu %9u\n", row.Name,
+            (unsigned long long)r.Calls, r.Calls ? r.Ns / 1e3 / r.Calls : 0.0,
+            (unsigned long long)r.Entries, (unsigned long long)r.Bytes,
+            (unsigned long long)r.Overflows, (unsigned long long)r.Resumed, r.Failures);
+    }
+    printf("I/O manager: %llu bytes of system buffers, %llu bytes copied\n",
+        (unsigned long long)io.IoBufferBytes, (unsigned long long)io.IoCopiedBytes);
+
+    PrintDispatchStats(device);
+
+    ShimCloseDevice(device);
+    ShimUnloadDriver();
+
+    SHIM_STATS final = ShimGetStats();
+    printf("pool: %llu allocations, %llu frees, %llu bytes outstanding; %lld objects outstanding\n",
+        (unsigned long long)final.PoolAllocations, (unsigned long long)final.PoolFrees,
+        (unsigned long long)final.PoolBytesOutstanding, (long long)final.ObjectsOutstanding);
+
+    bool leaked = final.PoolBytesOutstanding != 0 || final.ObjectsOutstanding != 0;
+    bool failed = processes.Failures || threads.Failures || handles.Failures || modules.Failures;
+    return (leaked || failed) ? 1 : 0;
+}
@@ -0,0 +1,1131 @@
+//
+// osk-verify: host-side Authenticode verification
+//
+// Runs the same verifier core as the driver (libosk_authenticode) over
+// files and directories, in parallel, and prints per-file phase timings.
+//
+// With -s, checks SHA-256 and SHA-1 (src/sha.h) against the FIPS 180
+// known-answer vectors on every engine this CPU can run, whole and fed in
+// odd-sized pieces, cross-checks the engines on random inputs, and reports
+// throughput per engine for 4 KiB, 1 MiB and 100 MiB inputs.
+//
+// With -d, runs the PKCS#7 DER walker (src/pkcs7.h) over a synthetic
+// Authenticode SignedData and a table of malformed encodings (truncated,
+// indefinite, oversized and overlong lengths, children overrunning their
+// parent, wrong tags and OIDs), then over -n random mutations of the blob.
+// Times parsing and the full signer check on a small blob and on one with
+// many certificates and a large unauthenticated attribute, side by side
+// with the OID byte search and 30 82 thumbprint scan the walker replaced.
+//
+// With -p, verifies synthetic PE32 and PE32+ images signed with the
+// synthetic SignedData through an in-memory SIG_READER: the streamed
+// Authenticode hash must equal a whole-image reference hash at sizes that
+// do and do not line up with the 64 KiB chunk, and tampered, unsigned,
+// untrusted and malformed images must get their verdicts. Also checks that
+// no single read exceeds the chunk size or the certificate table, and
+// times streamed verification against hashing the image in one buffer.
+//
+// With -r, round-trips the signature verdict store (src/verdict_store.h)
+// for empty, small and full stores, then checks that single-bit flips of
+// every byte, a different thumbprint, version or record count, a wrong
+// size and more than VERDICT_STORE_MAX_RECORDS records are all rejected.
+//
+// With -f, feeds each file as-is to the same checks the mutations go
+// through and reports only whether it parsed; this is the entry point for
+// an external fuzzer (e.g. afl-fuzz ... -- osk-verify -f @@).
+//
+// Usage: osk-verify [-j threads] [-t thumbprint] <file|directory>...
+//        osk-verify -s | -d [-n mutations] | -p | -r | -f <file|directory>...
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "authenticode.h"
+#include "authenticode_fixtures.h"
+#include "pkcs7.h"
+#include "verdict_store.h"
+#include "sha.h"
+
+namespace fs = std::filesystem;
+
+static const char* StatusName(SIGNATURE_STATUS status)
+{
+    switch (status) {
+    case SignatureValid:     return "valid";
+    case SignatureNotFound:  return "unsigned";
+    case SignatureInvalid:   return "invalid";
+    case SignatureUntrusted: return "untrusted";
+    case SignatureExpired:   return "expired";
+    default:                 return "error";
+    }
+}
+
+static ULONG64 NowNs(VOID)
+{
+    return (ULONG64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static NTSTATUS ReadFd(PVOID Context, ULONG Offset, PVOID Buffer, ULONG Length)
+{
+    int fd = (int)(intptr_t)Context;
+    size_t done = 0;
+    while (done < Length) {
+        ssize_t n = pread(fd, (char*)Buffer + done, Length - done, (off_t)Offset + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return STATUS_END_OF_FILE;
+        done += (size_t)n;
+    }
+    return STATUS_SUCCESS;
+}
+
+struct FileResult {
+    SIGNATURE_STATUS Status = SignatureError;
+    ULONG64 Size = 0;
+    SIG_PHASE_TICKS Ticks = {};
+    ULONG64 Total = 0;
+    UCHAR Hash[32] = {};
+};
+
+static FileResult VerifyPath(const fs::path& path, const char* thumbprint)
+{
+    FileResult result;
+    result.Ticks.Now = NowNs;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return result;
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size >= 0 && (ULONG64)size <= MAXULONG) {
+        result.Size = (ULONG64)size;
+
+        SIG_READER reader;
+        reader.Context  = (PVOID)(intptr_t)fd;
+        reader.Read     = ReadFd;
+        reader.FileSize = (ULONG)size;
+        reader.Ticks    = &result.Ticks;
+
+        ULONG64 start = NowNs();
+        result.Status = AuthenticodeVerifyStream(&reader, thumbprint, result.Hash);
+        result.Total  = NowNs() - start;
+    }
+
+    close(fd);
+    return result;
+}
+
+static void CollectFiles(const fs::path& root, std::vector<fs::path>& files)
+{
+    std::error_code ec;
+    if (fs::is_regular_file(root, ec)) {
+        files.push_back(root);
+        return;
+    }
+    if (!fs::is_directory(root, ec)) {
+        fprintf(stderr, "osk-verify: %s: not a file or directory\n", root.c_str());
+        return;
+    }
+    for (fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end;
+         !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec)) files.push_back(it->path());
+    }
+}
+
+// ================================================================
+// SHA self-test (-s)
+// ================================================================
+
+static const char* EngineName(SHA_ENGINE engine)
+{
+    return engine == ShaEngineShaNi ? "SHA-NI" : "scalar";
+}
+
+// Hashes data in pieces of Step bytes (0 = one call), so the buffered
+// partial-block path and the multi-block path both get exercised
+static std::string Sha256Hex(const std::string& data, size_t step)
+{
+    SHA256_CTX ctx;
+    UCHAR digest[32];
+    SHA256Init(&ctx);
+    if (step == 0) step = data.size() ? data.size() : 1;
+    for (size_t pos = 0; pos < data.size(); pos += step)
+        SHA256Update(&ctx, (const UCHAR*)data.data() + pos, (ULONG)std::min(step, data.size() - pos));
+    SHA256Final(digest, &ctx);
+    return Hex(digest, sizeof(digest));
+}
+
+static std::string Sha1Hex(const std::string& data, size_t step)
+{
+    SHA1_CTX ctx;
+    UCHAR digest[20];
+    SHA1Init(&ctx);
+    if (step == 0) step = data.size() ? data.size() : 1;
+    for (size_t pos = 0; pos < data.size(); pos += step)
+        SHA1Update(&ctx, (const UCHAR*)data.data() + pos, (ULONG)std::min(step, data.size() - pos));
+    SHA1Final(digest, &ctx);
+    return Hex(digest, sizeof(digest));
+}
+
+struct ShaVector {
+    const char* Name;
+    std::string Message;
+    const char* Sha256;
+    const char* Sha1;
+};
+
+static std::vector<ShaVector> ShaVectors(VOID)
+{
+    // FIPS 180-2 appendix examples plus the empty message
+    return {
+        { "empty", "",
+          "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+          "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+        { "abc", "abc",
+          "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+          "a9993e364706816aba3e25717850c26c9cd0d89d" },
+        { "448-bit", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+          "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+        { "896-bit", "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno"
+                     "ijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+          "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1",
+          "a49b2446a02c645bf419f995b67091253a04a259" },
+        { "million-a", std::string(1000000, 'a'),
+          "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+          "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+    };
+}
+
+static ULONG CheckShaVectors(SHA_ENGINE engine)
+{
+    static const size_t steps[] = { 0, 1, 3, 55, 63, 64, 65, 127, 4097 };
+    ULONG failures = 0;
+
+    for (const ShaVector& v : ShaVectors()) {
+        for (size_t step : steps) {
+            if (step == 1 && v.Message.size() > 4096) continue;
+            std::string sha256 = Sha256Hex(v.Message, step);
+            std::string sha1 = Sha1Hex(v.Message, step);
+            if (sha256 != v.Sha256 || sha1 != v.Sha1) {
+                printf("FAIL %-6s %-10s step %4zu: sha256 %s sha1 %s\n",
+                    EngineName(engine), v.Name, step, sha256.c_str(), sha1.c_str());
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+// Random lengths around the block and padding boundaries, hashed by both engines
+static ULONG CrossCheckEngines(VOID)
+{
+    std::mt19937 rng(180);
+    ULONG failures = 0;
+
+    for (int i = 0; i < 2000; i++) {
+        size_t length = i < 300 ? (size_t)i : rng() % 20000;
+        std::string data(length, '\0');
+        for (char& c : data) c = (char)rng();
+        size_t step = 1 + rng() % 200;
+
+        ShaSetEngine(ShaEngineScalar);
+        std::string sha256 = Sha256Hex(data, step), sha1 = Sha1Hex(data, step);
+        ShaSetEngine(ShaEngineShaNi);
+        if (Sha256Hex(data, 0) != sha256 || Sha1Hex(data, 0) != sha1) {
+            printf("FAIL engines disagree on %zu random bytes\n", length);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static double ShaThroughput(bool sha256, size_t size)
+{
+    static std::vector<UCHAR> data;
+    if (data.size() < size) {
+        data.resize(size);
+        for (size_t i = 0; i < size; i++) data[i] = (UCHAR)(i * 131 + (i >> 9));
+    }
+
+    // Enough repetitions for ~100 MiB, at least one
+    size_t reps = std::max<size_t>(1, (100u << 20) / size);
+    UCHAR digest[32];
+    ULONG64 start = NowNs();
+    for (size_t r = 0; r < reps; r++) {
+        if (sha256) {
+            SHA256_CTX ctx;
+            SHA256Init(&ctx);
+            SHA256Update(&ctx, data.data(), (ULONG)size);
+            SHA256Final(digest, &ctx);
+        } else {
+            SHA1_CTX ctx;
+            SHA1Init(&ctx);
+            SHA1Update(&ctx, data.data(), (ULONG)size);
+            SHA1Final(digest, &ctx);
+        }
+    }
+    double seconds = (NowNs() - start) / 1e9;
+    return seconds > 0 ? (double)size * reps / seconds / (1024.0 * 1024.0) : 0.0;
+}
+
+static int SelfTestSha(VOID)
+{
+    std::vector<SHA_ENGINE> engines = { ShaEngineScalar };
+    if (ShaSetEngine(ShaEngineShaNi)) engines.push_back(ShaEngineShaNi);
+
+    ULONG failures = 0;
+    for (SHA_ENGINE engine : engines) {
+        ShaSetEngine(engine);
+        ULONG failed = CheckShaVectors(engine);
+        printf("%-6s known-answer vectors: %s\n", EngineName(engine), failed ? "FAIL" : "ok");
+        failures += failed;
+    }
+    if (engines.size() > 1) {
+        ULONG failed = CrossCheckEngines();
+        printf("scalar vs SHA-NI on random inputs: %s\n", failed ? "FAIL" : "ok");
+        failures += failed;
+    } else {
+        printf("SHA-NI not available on this CPU, only the scalar engine was checked\n");
+    }
+
+    static const size_t sizes[] = { 4u << 10, 1u << 20, 100u << 20 };
+    printf("\n%-6s %-7s %14s %14s %14s\n", "engine", "hash", "4 KiB MiB/s", "1 MiB MiB/s", "100 MiB MiB/s");
+    for (SHA_ENGINE engine : engines) {
+        ShaSetEngine(engine);
+        for (bool sha256 : { true, false }) {
+            printf("%-6s %-7s", EngineName(engine), sha256 ? "SHA-256" : "SHA-1");
+            for (size_t size : sizes) printf(" %14.1f", ShaThroughput(sha256, size));
+            printf("\n");
+        }
+    }
+
+    ShaSelectEngine();
+    return failures ? 1 : 0;
+}
+
+// ================================================================
+// DER walker checks (-d) and fuzz entry (-f)
+// ================================================================
+
+static bool Inside(const UCHAR* p, ULONG length, const UCHAR* begin, size_t size)
+{
+    return p >= begin && length <= size && (size_t)(p - begin) <= size - length;
+}
+
+//
+// One fuzz input: parse, then check every pointer the walker returned lies
+// inside the input and read every byte it covers, so an out-of-bounds
+// result shows up as a failure here or under ASan. The input is copied to
+// an exactly-sized heap block for the same reason.
+//
+static bool FuzzPkcs7One(const UCHAR* data, size_t size, bool* parsed)
+{
+    std::unique_ptr<UCHAR[]> copy(new UCHAR[size ? size : 1]);
+    if (size) memcpy(copy.get(), data, size);
+    const UCHAR* begin = copy.get();
+
+    PKCS7_SIGNED_DATA sd;
+    *parsed = Pkcs7ParseSignedData(begin, (ULONG)size, &sd) != FALSE;
+    if (!*parsed) return true;
+
+    if (!Inside(sd.ImageDigest, sd.ImageDigestLength, begin, size) ||
+        !Inside(sd.IndirectContent, sd.IndirectContentLength, begin, size) ||
+        !Inside(sd.AttrMessageDigest, sd.AttrMessageDigestLength, begin, size) ||
+        (sd.Certificates && !Inside(sd.Certificates, sd.CertificatesLength, begin, size)))
+        return false;
+
+    volatile UCHAR sink = 0;
+    for (ULONG i = 0; i < sd.ImageDigestLength; i++) sink ^= sd.ImageDigest[i];
+    for (ULONG i = 0; i < sd.IndirectContentLength; i++) sink ^= sd.IndirectContent[i];
+    for (ULONG i = 0; i < sd.AttrMessageDigestLength; i++) sink ^= sd.AttrMessageDigest[i];
+
+    const UCHAR* cursor = sd.Certificates;
+    const UCHAR* end = sd.Certificates + sd.CertificatesLength;
+    const UCHAR* cert;
+    ULONG certLength;
+    while (Pkcs7NextCertificate(&cursor, end, &cert, &certLength)) {
+        if (!Inside(cert, certLength, sd.Certificates, sd.CertificatesLength)) return false;
+        for (ULONG i = 0; i < certLength; i++) sink ^= cert[i];
+    }
+    return true;
+}
+
+static bool ParseBytes(const Bytes& data, PKCS7_SIGNED_DATA* out)
+{
+    return Pkcs7ParseSignedData(data.empty() ? (const UCHAR*)"" : data.data(), (ULONG)data.size(), out) != FALSE;
+}
+
+static ULONG CheckWellFormed(const SignedDataBlob& blob, const SignedDataSpec& spec)
+{
+    PKCS7_SIGNED_DATA sd;
+    if (!ParseBytes(blob.Data, &sd)) {
+        printf("FAIL well-formed blob rejected\n");
+        return 1;
+    }
+
+    ULONG failures = 0;
+    if (sd.ImageDigestAlg != Pkcs7DigestSha256 || sd.ImageDigestLength != 32 ||
+        memcmp(sd.ImageDigest, spec.ImageHash, 32) != 0) {
+        printf("FAIL image digest not found\n");
+        failures++;
+    }
+    if (sd.IndirectContentLength != blob.Indirect.size() ||
+        memcmp(sd.IndirectContent, blob.Indirect.data(), blob.Indirect.size()) != 0) {
+        printf("FAIL SpcIndirectDataContent bytes differ\n");
+        failures++;
+    }
+    if (sd.SignerDigestAlg != Pkcs7DigestSha256 || sd.AttrMessageDigestLength != 32) {
+        printf("FAIL signer digest or messageDigest attribute not found\n");
+        failures++;
+    }
+
+    std::vector<std::string> seen;
+    const UCHAR* cursor = sd.Certificates;
+    const UCHAR* cert;
+    ULONG certLength;
+    while (Pkcs7NextCertificate(&cursor, sd.Certificates + sd.CertificatesLength, &cert, &certLength))
+        seen.push_back(Sha1Thumbprint(Bytes(cert, cert + certLength)));
+    if (seen != blob.CertThumbprints) {
+        printf("FAIL certificates: %zu walked, %zu expected or thumbprints differ\n",
+            seen.size(), blob.CertThumbprints.size());
+        failures++;
+    }
+    return failures;
+}
+
+// Value length of the well-formed element whose tag sits at Offset
+static size_t ElementLength(const Bytes& data, size_t offset)
+{
+    if (!(data[offset + 1] & 0x80)) return data[offset + 1];
+    size_t length = 0;
+    for (int i = 0; i < (data[offset + 1] & 0x7F); i++) length = (length << 8) | data[offset + 2 + i];
+    return length;
+}
+
+// Replaces the length octets of the element whose tag sits at Offset
+static Bytes WithLength(const Bytes& data, size_t offset, const Bytes& length)
+{
+    size_t lengthBytes = (data[offset + 1] & 0x80) ? 1 + (data[offset + 1] & 0x7F) : 1;
+    Bytes out(data.begin(), data.begin() + offset + 1);
+    out.insert(out.end(), length.begin(), length.end());
+    out.insert(out.end(), data.begin() + offset + 1 + lengthBytes, data.end());
+    return out;
+}
+
+static size_t Find(const Bytes& data, const Bytes& needle)
+{
+    auto it = std::search(data.begin(), data.end(), needle.begin(), needle.end());
+    return it == data.end() ? SIZE_MAX : (size_t)(it - data.begin());
+}
+
+static ULONG CheckMalformed(const SignedDataBlob& blob)
+{
+    const Bytes& good = blob.Data;
+    ULONG failures = 0;
+
+    // Every strict prefix must be rejected: the outer length always overruns
+    ULONG acceptedPrefixes = 0;
+    for (size_t length = 0; length < good.size(); length++) {
+        PKCS7_SIGNED_DATA sd;
+        if (Pkcs7ParseSignedData(good.data(), (ULONG)length, &sd)) acceptedPrefixes++;
+    }
+    printf("%-48s %s\n", "truncated prefixes", acceptedPrefixes ? "FAIL" : "rejected");
+    failures += acceptedPrefixes ? 1 : 0;
+
+    size_t encap = Find(good, Der(0x06, g_OidSpcIndirect)) - 2;     // encapContentInfo SEQUENCE
+    size_t attrs = Find(good, Der(0x06, g_OidMessageDigest)) - 2;   // messageDigest Attribute
+    size_t oid = Find(good, Der(0x06, g_OidSignedData));
+    size_t certs = Find(good, Certificate(0)) - 4;                  // certificates [0]
+
+    Bytes wrongType = good;
+    wrongType[oid + 2 + g_OidSignedData.size() - 1] = 0x01;          // 1.2.840.113549.1.7.1 data
+
+    Bytes wrongTag = good;
+    wrongTag[encap] = 0x31;
+
+    Bytes highTag = good;
+    highTag[encap] = 0x3F;
+
+    Bytes noDigestAttr = good;
+    noDigestAttr[attrs + 2 + 2 + g_OidMessageDigest.size() - 1] = 0x05;
+
+    Bytes badCertSet = good;
+    badCertSet[certs + 4] = 0x04;                                   // first certificate is not a SEQUENCE
+
+    struct { const char* Name; Bytes Data; bool Parses; } cases[] = {
+        { "empty input",                                Bytes(),                                false },
+        { "indefinite outer length (0x80)",             WithLength(good, 0, { 0x80 }),          false },
+        { "five length octets (0x85)",                  WithLength(good, 0, { 0x85, 0, 0, 0, 0x10, 0 }), false },
+        { "length 0xFFFFFFFF",                          WithLength(good, 0, { 0x84, 0xFF, 0xFF, 0xFF, 0xFF }), false },
+        { "outer length one short",                     WithLength(good, 0, LengthOctets(ElementLength(good, 0) - 1)), false },
+        { "child overruns its parent by one byte",      WithLength(good, encap, LengthOctets(ElementLength(good, encap) + 1)), false },
+        { "length octets cut off at the end",           Bytes{ 0x30, 0x84, 0x00, 0x00 },        false },
+        { "content type is not signedData",             wrongType,                              false },
+        { "encapContentInfo tagged SET",                wrongTag,                               false },
+        { "multi-byte tag",                             highTag,                                false },
+        { "no messageDigest attribute",                 noDigestAttr,                           false },
+        { "certificate that is not a SEQUENCE",         badCertSet,                             true },
+        { "trailing bytes after ContentInfo",           Cat({ good, { 0x00, 0x00 } }),          true },
+    };
+
+    for (const auto& c : cases) {
+        PKCS7_SIGNED_DATA sd;
+        bool parsed = ParseBytes(c.Data, &sd);
+        bool ok = parsed == c.Parses;
+        if (ok && parsed) {
+            bool fine;
+            ok = FuzzPkcs7One(c.Data.data(), c.Data.size(), &fine);
+        }
+        printf("%-48s %s\n", c.Name, !ok ? "FAIL" : parsed ? "parsed" : "rejected");
+        failures += ok ? 0 : 1;
+    }
+
+    // A certificate set that is not a SEQUENCE stops the walk without a match
+    PKCS7_SIGNED_DATA sd;
+    ParseBytes(badCertSet, &sd);
+    const UCHAR* cursor = sd.Certificates;
+    const UCHAR* cert;
+    ULONG certLength;
+    if (Pkcs7NextCertificate(&cursor, sd.Certificates + sd.CertificatesLength, &cert, &certLength)) {
+        printf("FAIL certificate walk accepted a non-SEQUENCE element\n");
+        failures++;
+    }
+    return failures;
+}
+
+static void Mutate(Bytes& data, std::mt19937& rng)
+{
+    static const UCHAR interesting[] = { 0x00, 0x01, 0x30, 0x7F, 0x80, 0x81, 0x82, 0x84, 0x85, 0xA0, 0xFF };
+    int edits = 1 + rng() % 4;
+    for (int e = 0; e < edits && !data.empty(); e++) {
+        size_t pos = rng() % data.size();
+        switch (rng() % 6) {
+        case 0: data[pos] ^= (UCHAR)(1 << (rng() % 8)); break;
+        case 1: data[pos] = interesting[rng() % sizeof(interesting)]; break;
+        case 2: data.resize(pos); break;
+        case 3: data.erase(data.begin() + pos, data.begin() + std::min(data.size(), pos + 1 + rng() % 16)); break;
+        case 4: data.insert(data.begin() + pos, (size_t)(1 + rng() % 16), (UCHAR)rng()); break;
+        default: data[pos] = (UCHAR)rng(); break;
+        }
+    }
+}
+
+static double ParseNs(const Bytes& data, ULONG iterations)
+{
+    PKCS7_SIGNED_DATA sd;
+    ULONG64 start = NowNs();
+    for (ULONG i = 0; i < iterations; i++) {
+        if (!ParseBytes(data, &sd)) return -1;
+        const UCHAR* cursor = sd.Certificates;
+        const UCHAR* cert;
+        ULONG certLength;
+        while (Pkcs7NextCertificate(&cursor, sd.Certificates + sd.CertificatesLength, &cert, &certLength)) { }
+    }
+    return (double)(NowNs() - start) / iterations;
+}
+
+// ---------------- PKCS#7 check before the DER walker ----------------
+//
+// Ported from signature.cpp as it stood before the walker: the image
+// digest is found by searching the blob for the messageDigest OID and,
+// failing that, for the digest bytes anywhere, and the signer by taking
+// SHA-1 of every element that starts 30 82. Kept only to time against.
+//
+
+static int LegacyHexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static BOOLEAN LegacyCompareThumbprint(const UCHAR digest[20], const char* thumbprint)
+{
+    if (!thumbprint || strlen(thumbprint) < 40) return FALSE;
+    for (ULONG i = 0; i < 20; i++) {
+        int high = LegacyHexValue(thumbprint[i * 2]);
+        int low = LegacyHexValue(thumbprint[i * 2 + 1]);
+        if (high < 0 || low < 0) return FALSE;
+        if (digest[i] != (UCHAR)((high << 4) | low)) return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOLEAN LegacyExtractMessageDigest(
+    const UCHAR* pkcs7Data, ULONG pkcs7Len, UCHAR* digest, ULONG* digestLen,
+    BOOLEAN* isSHA256, const UCHAR* expectedHash)
+{
+    *digestLen = 0;
+    *isSHA256 = FALSE;
+
+    const UCHAR messageDigestOID[] = { 0x06, 0x09, 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x04 };
+    const UCHAR sha256OID[] = { 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01 };
+
+    for (ULONG i = 0; i + sizeof(sha256OID) <= pkcs7Len; i++) {
+        if (RtlCompareMemory(&pkcs7Data[i], sha256OID, sizeof(sha256OID)) == sizeof(sha256OID)) {
+            *isSHA256 = TRUE;
+            break;
+        }
+    }
+
+    for (ULONG i = 0; i + sizeof(messageDigestOID) + 10 < pkcs7Len; i++) {
+        if (RtlCompareMemory(&pkcs7Data[i], messageDigestOID, sizeof(messageDigestOID)) != sizeof(messageDigestOID))
+            continue;
+
+        ULONG pos = i + sizeof(messageDigestOID);
+        if (pos >= pkcs7Len || pkcs7Data[pos] != 0x31) continue;
+        pos++;
+
+        if (pos >= pkcs7Len) continue;
+        if (pkcs7Data[pos] & 0x80) pos += 1 + (pkcs7Data[pos] & 0x7F);
+        else pos++;
+
+        if (pos >= pkcs7Len || pkcs7Data[pos] != 0x04) continue;
+        pos++;
+
+        if (pos >= pkcs7Len) continue;
+        ULONG len = 0;
+        if (pkcs7Data[pos] & 0x80) {
+            ULONG lenBytes = pkcs7Data[pos] & 0x7F;
+            if (lenBytes > 4 || pos + lenBytes >= pkcs7Len) continue;
+            pos++;
+            for (ULONG j = 0; j < lenBytes; j++) len = (len << 8) | pkcs7Data[pos++];
+        } else {
+            len = pkcs7Data[pos++];
+        }
+
+        if (len != 20 && len != 32) continue;
+        if (pos + len > pkcs7Len) continue;
+
+        if (expectedHash && len == 32) {
+            if (RtlCompareMemory(&pkcs7Data[pos], expectedHash, 32) == 32) {
+                RtlCopyMemory(digest, &pkcs7Data[pos], len);
+                *digestLen = len;
+                return TRUE;
+            }
+        } else if (!expectedHash) {
+            RtlCopyMemory(digest, &pkcs7Data[pos], len);
+            *digestLen = len;
+            return TRUE;
+        }
+    }
+
+    if (expectedHash) {
+        for (ULONG i = 0; i + 32 < pkcs7Len; i++) {
+            if (RtlCompareMemory(&pkcs7Data[i], expectedHash, 32) == 32) {
+                RtlCopyMemory(digest, &pkcs7Data[i], 32);
+                *digestLen = 32;
+                *isSHA256 = TRUE;
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+static SIGNATURE_STATUS LegacyVerifyPkcs7(const Bytes& data, const UCHAR authenticodeHash[32], const char* thumbprint)
+{
+    const UCHAR* pkcs7Data = data.data();
+    ULONG pkcs7Len = (ULONG)data.size();
+    if (pkcs7Len < 4 || pkcs7Data[0] != 0x30) return SignatureInvalid;
+
+    UCHAR messageDigest[32];
+    ULONG messageDigestLen = 0;
+    BOOLEAN isPkcs7SHA256 = FALSE;
+    if (!LegacyExtractMessageDigest(pkcs7Data, pkcs7Len, messageDigest, &messageDigestLen, &isPkcs7SHA256, authenticodeHash))
+        return SignatureInvalid;
+    if (messageDigestLen != 32 || RtlCompareMemory(authenticodeHash, messageDigest, 32) != 32)
+        return SignatureInvalid;
+
+    for (ULONG i = 0; i + 4 <= pkcs7Len; i++) {
+        if (pkcs7Data[i] != 0x30 || pkcs7Data[i + 1] != 0x82) continue;
+
+        ULONG cl = ((ULONG)pkcs7Data[i + 2] << 8 | pkcs7Data[i + 3]) + 4;
+        if (cl < 64 || cl >= pkcs7Len || i + cl > pkcs7Len) continue;
+
+        SHA1_CTX ctx;
+        UCHAR thumb[20];
+        SHA1Init(&ctx);
+        SHA1Update(&ctx, &pkcs7Data[i], cl);
+        SHA1Final(thumb, &ctx);
+        if (LegacyCompareThumbprint(thumb, thumbprint)) return SignatureValid;
+    }
+    return SignatureUntrusted;
+}
+
+// The same check through the walker, as VerifyPkcs7 in authenticode.cpp does it
+static SIGNATURE_STATUS WalkerVerifyPkcs7(const Bytes& data, const UCHAR authenticodeHash[32], const char* thumbprint)
+{
+    PKCS7_SIGNED_DATA sd;
+    if (!ParseBytes(data, &sd)) return SignatureInvalid;
+    if (sd.ImageDigestAlg != Pkcs7DigestSha256 || sd.ImageDigestLength != 32 ||
+        memcmp(authenticodeHash, sd.ImageDigest, 32) != 0)
+        return SignatureInvalid;
+
+    UCHAR digest[32];
+    SHA256_CTX sha;
+    SHA256Init(&sha);
+    SHA256Update(&sha, sd.IndirectContent, sd.IndirectContentLength);
+    SHA256Final(digest, &sha);
+    if (sd.SignerDigestAlg != Pkcs7DigestSha256 || sd.AttrMessageDigestLength != 32 ||
+        memcmp(sd.AttrMessageDigest, digest, 32) != 0)
+        return SignatureInvalid;
+
+    const UCHAR* cursor = sd.Certificates;
+    const UCHAR* cert;
+    ULONG certLength;
+    while (Pkcs7NextCertificate(&cursor, sd.Certificates + sd.CertificatesLength, &cert, &certLength)) {
+        SHA1_CTX ctx;
+        UCHAR thumb[20];
+        SHA1Init(&ctx);
+        SHA1Update(&ctx, cert, certLength);
+        SHA1Final(thumb, &ctx);
+        if (LegacyCompareThumbprint(thumb, thumbprint)) return SignatureValid;
+    }
+    return SignatureUntrusted;
+}
+
+typedef SIGNATURE_STATUS (*PKCS7_CHECK)(const Bytes& data, const UCHAR authenticodeHash[32], const char* thumbprint);
+
+// ns per check, or -1 if the check does not accept the blob
+static double CheckNs(PKCS7_CHECK check, const SignedDataBlob& blob, const UCHAR hash[32], ULONG iterations)
+{
+    ULONG64 start = NowNs();
+    for (ULONG i = 0; i < iterations; i++)
+        if (check(blob.Data, hash, blob.Thumbprint.c_str()) != SignatureValid) return -1;
+    return (double)(NowNs() - start) / iterations;
+}
+
+static int CheckDerWalker(ULONG mutations)
+{
+    SignedDataSpec spec;
+    for (int i = 0; i < 32; i++) spec.ImageHash[i] = (UCHAR)(0xC0 + i);
+    SignedDataBlob blob = BuildSignedData(spec);
+
+    ULONG failures = CheckWellFormed(blob, spec);
+    printf("%-48s %s (%zu bytes)\n", "well-formed SignedData", failures ? "FAIL" : "parsed", blob.Data.size());
+    failures += CheckMalformed(blob);
+
+    std::mt19937 rng(6);
+    ULONG parsedCount = 0, bad = 0;
+    for (ULONG i = 0; i < mutations; i++) {
+        Bytes data = blob.Data;
+        Mutate(data, rng);
+        bool parsed;
+        if (!FuzzPkcs7One(data.data(), data.size(), &parsed)) {
+            if (bad++ < 5) printf("FAIL mutation %u returned a field outside the input\n", i);
+        }
+        parsedCount += parsed ? 1 : 0;
+    }
+    printf("%-48s %s (%u of %u still parse)\n", "random mutations", bad ? "FAIL" : "ok", parsedCount, mutations);
+    failures += bad;
+
+    SignedDataSpec large = spec;
+    large.Certificates = 50;
+    large.UnauthenticatedBytes = 512 * 1024;
+    SignedDataBlob largeBlob = BuildSignedData(large);
+    failures += CheckWellFormed(largeBlob, large);
+
+    // Parse alone, then the whole signer check: walker against the byte scan it replaced
+    printf("\n%-44s %9s %10s %12s %12s %9s\n", "ns per SignedData", "bytes", "parse+walk",
+        "walker check", "legacy scan", "speedup");
+    struct { const char* Name; const SignedDataBlob* Blob; ULONG Iterations; } rows[] = {
+        { "2 certificates", &blob, 20000 },
+        { "50 certificates, 512 KiB countersignature", &largeBlob, 200 },
+    };
+    for (const auto& row : rows) {
+        double parse = ParseNs(row.Blob->Data, row.Iterations * 10);
+        double walker = CheckNs(WalkerVerifyPkcs7, *row.Blob, spec.ImageHash, row.Iterations);
+        double legacy = CheckNs(LegacyVerifyPkcs7, *row.Blob, spec.ImageHash, row.Iterations);
+        printf("%-44s %9zu %10.0f %12.0f %12.0f %8.1fx\n", row.Name, row.Blob->Data.size(),
+            parse, walker, legacy, walker > 0 ? legacy / walker : 0.0);
+        if (parse < 0 || walker < 0 || legacy < 0) {
+            printf("FAIL %s: a check did not accept the signer\n", row.Name);
+            failures++;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
+
+static int FuzzFiles(const std::vector<fs::path>& files)
+{
+    int result = 0;
+    for (const fs::path& path : files) {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f) continue;
+        Bytes data;
+        UCHAR chunk[65536];
+        for (size_t n; (n = fread(chunk, 1, sizeof(chunk), f)) > 0; ) data.insert(data.end(), chunk, chunk + n);
+        fclose(f);
+
+        bool parsed;
+        bool ok = FuzzPkcs7One(data.data(), data.size(), &parsed);
+        printf("%-8s %s\n", !ok ? "FAIL" : parsed ? "parsed" : "rejected", path.c_str());
+        if (!ok) result = 1;
+    }
+    // Out-of-bounds results abort, so a fuzzer sees them as crashes
+    if (result) abort();
+    return 0;
+}
+
+// ================================================================
+// PE fixtures (-p)
+// ================================================================
+
+static ULONG CheckPeVerdicts(VOID)
+{
+    ULONG failures = 0;
+    UCHAR hash[32];
+
+    // Streamed hash must match the reference at sizes around the chunk size
+    static const ULONG sizes[] = { 0x400, 64 * 1024 - 8, 64 * 1024, 64 * 1024 + 13, 3 * 64 * 1024 + 1001 };
+    for (bool pe32Plus : { true, false }) {
+        for (ULONG size : sizes) {
+            PeFixture pe = BuildPe(pe32Plus, size, true);
+            SIGNATURE_STATUS status = VerifyImage(pe.Image, pe.Thumbprint, hash);
+            bool ok = status == SignatureValid && memcmp(hash, pe.Hash, 32) == 0;
+            printf("%-6s %8zu bytes signed: %-9s hash %s\n", pe32Plus ? "PE32+" : "PE32",
+                pe.Image.size(), StatusName(status), memcmp(hash, pe.Hash, 32) == 0 ? "matches" : "DIFFERS");
+            failures += ok ? 0 : 1;
+        }
+    }
+
+    PeFixture pe = BuildPe(true, 200 * 1024, true);
+    const std::string& trusted = pe.Thumbprint;
+
+    Bytes checksum = pe.Image;
+    Store32(checksum, FIXTURE_CHECKSUM, 0);
+
+    Bytes body = pe.Image;
+    body[150 * 1024] ^= 1;
+
+    Bytes header = pe.Image;
+    header[FIXTURE_NT_OFFSET + 8] ^= 1;                             // TimeDateStamp
+
+    Bytes certOutside = pe.Image;
+    Store32(certOutside, pe.CertOffset, (ULONG)(pe.Image.size() - pe.CertOffset + 8));
+
+    Bytes dirOutside = pe.Image;
+    Store32(dirOutside, pe.SecurityDir, (ULONG)pe.Image.size());
+
+    Bytes certType = pe.Image;
+    Store16(certType, pe.CertOffset + 6, 0x0001);                   // WIN_CERT_TYPE_X509
+
+    Bytes notMz = pe.Image;
+    notMz[0] = 'Z';
+
+    Bytes notPe = pe.Image;
+    notPe[FIXTURE_NT_OFFSET] = 'N';
+
+    Bytes lfanew = pe.Image;
+    Store32(lfanew, 0x3C, (ULONG)pe.Image.size() - 100);
+
+    Bytes magic = pe.Image;
+    Store16(magic, FIXTURE_OPTIONAL_HEADER, 0x107);                 // ROM image
+
+    SignedDataSpec wrongAttr;
+    wrongAttr.WrongAttributeDigest = true;
+    PeFixture attr = BuildPe(true, 4096, true, wrongAttr);
+
+    SignedDataSpec noCerts;
+    noCerts.Certificates = 0;
+    PeFixture bare = BuildPe(true, 4096, true, noCerts);
+
+    PeFixture unsigned_ = BuildPe(true, 4096, false);
+
+    struct { const char* Name; Bytes Image; std::string Thumbprint; SIGNATURE_STATUS Expected; } cases[] = {
+        { "checksum changed after signing",     checksum,           trusted,        SignatureValid },
+        { "body byte flipped",                  body,               trusted,        SignatureInvalid },
+        { "header byte flipped",                header,             trusted,        SignatureInvalid },
+        { "other trusted thumbprint",           pe.Image,           "0000000000000000000000000000000000000000", SignatureUntrusted },
+        { "empty trusted thumbprint",           pe.Image,           "",             SignatureUntrusted },
+        { "messageDigest attribute mismatch",   attr.Image,         attr.Thumbprint, SignatureInvalid },
+        { "no certificates",                    bare.Image,         trusted,        SignatureUntrusted },
+        { "no security directory",              unsigned_.Image,    trusted,        SignatureNotFound },
+        { "certificate table past end of file", certOutside,        trusted,        SignatureInvalid },
+        { "security directory past end of file", dirOutside,        trusted,        SignatureInvalid },
+        { "certificate type X.509",             certType,           trusted,        SignatureInvalid },
+        { "no MZ signature",                    notMz,              trusted,        SignatureInvalid },
+        { "no PE signature",                    notPe,              trusted,        SignatureInvalid },
+        { "e_lfanew near end of file",          lfanew,             trusted,        SignatureInvalid },
+        { "unknown optional header magic",      magic,              trusted,        SignatureInvalid },
+        { "shorter than 256 bytes",             Bytes(pe.Image.begin(), pe.Image.begin() + 255), trusted, SignatureError },
+        { "cut inside the certificate table",   Bytes(pe.Image.begin(), pe.Image.end() - 16), trusted, SignatureInvalid },
+    };
+    for (const auto& c : cases) {
+        SIGNATURE_STATUS status = VerifyImage(c.Image, c.Thumbprint, hash);
+        bool ok = status == c.Expected;
+        printf("%-38s %-9s %s\n", c.Name, StatusName(status), ok ? "ok" : "FAIL");
+        failures += ok ? 0 : 1;
+    }
+    return failures;
+}
+
+static int CheckPeFixtures(VOID)
+{
+    ULONG failures = CheckPeVerdicts();
+
+    fprintf(stderr, "osk-verify: %s engine\n", EngineName(ShaGetEngine()));
+    printf("\n%-9s %14s %14s %12s %14s\n", "image", "stream MiB/s", "buffer MiB/s", "largest read", "bytes read");
+    static const ULONG sizes[] = { 1u << 20, 16u << 20, 100u << 20 };
+    for (ULONG size : sizes) {
+        PeFixture pe = BuildPe(true, size, true);
+        UCHAR hash[32], reference[32];
+        MemoryReader stats = { &pe.Image };
+
+        ULONG reps = std::max<ULONG>(1, (64u << 20) / size);
+        ULONG64 start = NowNs();
+        SIGNATURE_STATUS status = SignatureValid;
+        for (ULONG r = 0; r < reps && status == SignatureValid; r++) {
+            stats.MaxRead = 0;
+            stats.BytesRead = 0;
+            status = VerifyImage(pe.Image, pe.Thumbprint, hash, &stats);
+        }
+        double stream = (NowNs() - start) / 1e9 / reps;
+
+        start = NowNs();
+        for (ULONG r = 0; r < reps; r++) ReferenceHash(pe.Image, pe.SecurityDir, pe.CertOffset, reference);
+        double buffer = (NowNs() - start) / 1e9 / reps;
+
+        // Every byte read once, the certificate table twice (header, then
+        // whole), nothing larger than a chunk or the table in one read
+        ULONG certLength = (ULONG)pe.Image.size() - pe.CertOffset;
+        bool bounded = stats.MaxRead <= std::max<ULONG>(64 * 1024, certLength) &&
+            stats.BytesRead <= pe.Image.size() + certLength + 64 + 264 + 8;
+        bool ok = status == SignatureValid && memcmp(hash, reference, 32) == 0 && bounded;
+
+        printf("%6u MiB %14.1f %14.1f %12u %14llu%s\n", size >> 20,
+            size / stream / (1024.0 * 1024.0), size / buffer / (1024.0 * 1024.0),
+            stats.MaxRead, (unsigned long long)stats.BytesRead, ok ? "" : " FAIL");
+        failures += ok ? 0 : 1;
+    }
+
+    return failures ? 1 : 0;
+}
+
+// ================================================================
+// Verdict store checks (-r)
+// ================================================================
+
+static Bytes SealStore(const std::vector<VERDICT_STORE_RECORD>& records, const char* thumbprint)
+{
+    Bytes store(VerdictStoreSize((ULONG)records.size()));
+    if (!records.empty())
+        memcpy(VerdictStoreRecords(store.data()), records.data(), records.size() * sizeof(VERDICT_STORE_RECORD));
+    VerdictStoreSeal(store.data(), (ULONG)records.size(), thumbprint);
+    return store;
+}
+
+static bool OpenStore(const Bytes& store, const char* thumbprint, ULONG* count)
+{
+    const VERDICT_STORE_RECORD* records;
+    return VerdictStoreOpen(store.empty() ? NULL : store.data(), (ULONG)store.size(), thumbprint, &records, count) != FALSE;
+}
+
+static std::vector<VERDICT_STORE_RECORD> RandomRecords(ULONG count, std::mt19937& rng)
+{
+    std::vector<VERDICT_STORE_RECORD> records(count);
+    for (VERDICT_STORE_RECORD& r : records) {
+        UCHAR* bytes = (UCHAR*)&r;
+        for (size_t i = 0; i < sizeof(r); i++) bytes[i] = (UCHAR)rng();
+        r.Status = rng() % (SignatureError + 1);
+        r.Reserved = 0;
+    }
+    return records;
+}
+
+static int CheckVerdictStore(VOID)
+{
+    const char* thumbprint = TRUSTED_CERT_THUMBPRINT;
+    std::mt19937 rng(8);
+    ULONG failures = 0;
+
+    for (ULONG count : { 0u, 1u, 3u, (ULONG)VERDICT_STORE_MAX_RECORDS }) {
+        std::vector<VERDICT_STORE_RECORD> records = RandomRecords(count, rng);
+
+        ULONG64 start = NowNs();
+        Bytes store = SealStore(records, thumbprint);
+        ULONG64 sealed = NowNs();
+        const VERDICT_STORE_RECORD* opened;
+        ULONG openedCount;
+        bool ok = VerdictStoreOpen(store.data(), (ULONG)store.size(), thumbprint, &opened, &openedCount) &&
+            openedCount == count &&
+            (count == 0 || memcmp(opened, records.data(), count * sizeof(VERDICT_STORE_RECORD)) == 0);
+        ULONG64 done = NowNs();
+
+        printf("round trip %4u records %8zu bytes: %-4s seal %8.1f us, open %8.1f us\n",
+            count, store.size(), ok ? "ok" : "FAIL", (sealed - start) / 1e3, (done - sealed) / 1e3);
+        failures += ok ? 0 : 1;
+    }
+
+    Bytes good = SealStore(RandomRecords(3, rng), thumbprint);
+    ULONG count;
+
+    ULONG acceptedFlips = 0;
+    for (size_t i = 0; i < good.size(); i++) {
+        for (int bit = 0; bit < 8; bit++) {
+            Bytes flipped = good;
+            flipped[i] ^= (UCHAR)(1 << bit);
+            if (OpenStore(flipped, thumbprint, &count)) acceptedFlips++;
+        }
+    }
+    printf("%-40s %s (%zu flips)\n", "single-bit corruption", acceptedFlips ? "FAIL" : "rejected", good.size() * 8);
+    failures += acceptedFlips ? 1 : 0;
+
+    // Re-sealed stores with one header field changed
+    Bytes otherThumbprint = good;
+    VerdictStoreSeal(otherThumbprint.data(), 3, "0000000000000000000000000000000000000000");
+
+    Bytes oldVersion = good;
+    ((PVERDICT_STORE_HEADER)oldVersion.data())->Version = 1;
+
+    Bytes moreRecords = SealStore(RandomRecords(4, rng), thumbprint);
+    moreRecords.resize(good.size());
+
+    std::vector<VERDICT_STORE_RECORD> tooMany = RandomRecords(VERDICT_STORE_MAX_RECORDS + 1, rng);
+
+    struct { const char* Name; Bytes Data; } cases[] = {
+        { "different trusted thumbprint",   otherThumbprint },
+        { "version 1 store",                oldVersion },
+        { "record count beyond the buffer", moreRecords },
+        { "truncated by one byte",          Bytes(good.begin(), good.end() - 1) },
+        { "truncated to the header",        Bytes(good.begin(), good.begin() + sizeof(VERDICT_STORE_HEADER)) },
+        { "one byte appended",              Cat({ good, { 0 } }) },
+        { "shorter than a header",          Bytes(good.begin(), good.begin() + sizeof(VERDICT_STORE_HEADER) - 1) },
+        { "empty file",                     Bytes() },
+        { "more than the maximum records",  SealStore(tooMany, thumbprint) },
+    };
+    for (const auto& c : cases) {
+        bool accepted = OpenStore(c.Data, thumbprint, &count);
+        printf("%-40s %s\n", c.Name, accepted ? "FAIL" : "rejected");
+        failures += accepted ? 1 : 0;
+    }
+
+    return failures ? 1 : 0;
+}
+
+static void Usage(VOID)
+{
+    fprintf(stderr,
+        "usage: osk-verify [-j threads] [-t thumbprint] <file|directory>...\n"
+        "       osk-verify -s | -d [-n mutations] | -p | -r | -f <file|directory>...\n"
+        "  -j  worker threads (default: hardware concurrency)\n"
+        "  -t  trusted certificate SHA1 thumbprint (default: driver's)\n"
+        "  -s  check SHA-256/SHA-1 known-answer vectors on every engine, measure throughput\n"
+        "  -d  check the PKCS#7 DER walker on malformed and mutated input, time parsing\n"
+        "  -n  random mutations for -d (default 200000)\n"
+        "  -p  verify synthetic signed and malformed PE images, time streamed verification\n"
+        "  -r  round-trip the verdict store, check that corrupted stores are rejected\n"
+        "  -f  feed files to the DER walker checks (fuzzer entry point)\n");
+}
+
+int main(int argc, char** argv)
+{
+    SHA_ENGINE engine = ShaSelectEngine();
+    unsigned threads = std::thread::hardware_concurrency();
+    const char* thumbprint = TRUSTED_CERT_THUMBPRINT;
+    std::vector<fs::path> files;
+    ULONG mutations = 200000;
+    bool der = false;
+    bool fuzz = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s")) {
+            return SelfTestSha();
+        }
+        if (!strcmp(argv[i], "-p")) {
+            return CheckPeFixtures();
+        }
+        if (!strcmp(argv[i], "-r")) {
+            return CheckVerdictStore();
+        }
+        if (!strcmp(argv[i], "-d")) {
+            der = true;
+        } else if (!strcmp(argv[i], "-f")) {
+            fuzz = true;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            mutations = (ULONG)strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            thumbprint = argv[++i];
+        } else if (argv[i][0] == '-') {
+            Usage();
+            return 2;
+        } else {
+            CollectFiles(argv[i], files);
+        }
+    }
+    if (der) return CheckDerWalker(mutations);
+    if (fuzz) return FuzzFiles(files);
+    if (files.empty()) {
+        Usage();
+        return 2;
+    }
+    if (threads == 0) threads = 1;
+    if (threads > files.size()) threads = (unsigned)files.size();
+
+    fprintf(stderr, "osk-verify: %zu files, %u threads, %s engine\n",
+        files.size(), threads, EngineName(engine));
+
+    std::vector<FileResult> results(files.size());
+    std::atomic<size_t> next(0);
+    std::mutex outputLock;
+
+    auto worker = [&]() {
+        for (size_t i; (i = next.fetch_add(1)) < files.size(); ) {
+            results[i] = VerifyPath(files[i], thumbprint);
+            const FileResult& r = results[i];
+
+            char hash[65];
+            for (int b = 0; b < 32; b++) snprintf(hash + b * 2, 3, "%02x", r.Hash[b]);
+
+            std::lock_guard<std::mutex> guard(outputLock);
+            printf("%-9s %10llu  total %8.3f ms  read %8.3f  hash %8.3f  pkcs7 %8.3f  %s  %s\n",
+                StatusName(r.Status), (unsigned long long)r.Size,
+                r.Total / 1e6, r.Ticks.Read / 1e6, r.Ticks.Hash / 1e6, r.Ticks.Pkcs7 / 1e6,
+                hash, files[i].c_str());
+        }
+    };
+
+    ULONG64 start = NowNs();
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++) pool.emplace_back(worker);
+    for (auto& t : pool) t.join();
+    double elapsed = (NowNs() - start) / 1e9;
+
+    size_t counts[SignatureError + 1] = {};
+    ULONG64 bytes = 0;
+    for (const auto& r : results) {
+        counts[r.Status]++;
+        bytes += r.Size;
+    }
+
+    fprintf(stderr, "osk-verify: %.3f s, %.1f MiB/s;", elapsed,
+        elapsed > 0 ? bytes / elapsed / (1024.0 * 1024.0) : 0.0);
+    for (int s = SignatureValid; s <= SignatureError; s++) {
+        if (counts[s]) fprintf(stderr, " %s %zu", StatusName((SIGNATURE_STATUS)s), counts[s]);
+    }
+    fprintf(stderr, "\n");
+
+    return counts[SignatureValid] == files.size() ? 0 : 1;
+}